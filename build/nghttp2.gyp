@@ -0,0 +1,71 @@
+# Copyright 2016 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# The HTTP/2 framing library only; the nghttp2 tools and asio bindings are
+# not built.  nghttp2ver.h is normally generated by configure, so a fixed
+# copy is kept in build/nghttp2; it and the source list below match the
+# v1.29.0 tag, which third_party/nghttp2 should be checked out at.  Only
+# built when gyp is run with -Denable_http2_fetcher=1.
+
+{
+  'variables': {
+    'nghttp2_root': '<(DEPTH)/third_party/nghttp2',
+    'nghttp2_lib': '<(nghttp2_root)/lib',
+  },
+  'targets': [
+    {
+      'target_name': 'nghttp2',
+      'type': '<(library)',
+      'sources': [
+        '<(nghttp2_lib)/nghttp2_buf.c',
+        '<(nghttp2_lib)/nghttp2_callbacks.c',
+        '<(nghttp2_lib)/nghttp2_debug.c',
+        '<(nghttp2_lib)/nghttp2_frame.c',
+        '<(nghttp2_lib)/nghttp2_hd.c',
+        '<(nghttp2_lib)/nghttp2_hd_huffman.c',
+        '<(nghttp2_lib)/nghttp2_hd_huffman_data.c',
+        '<(nghttp2_lib)/nghttp2_helper.c',
+        '<(nghttp2_lib)/nghttp2_http.c',
+        '<(nghttp2_lib)/nghttp2_map.c',
+        '<(nghttp2_lib)/nghttp2_mem.c',
+        '<(nghttp2_lib)/nghttp2_npn.c',
+        '<(nghttp2_lib)/nghttp2_option.c',
+        '<(nghttp2_lib)/nghttp2_outbound_item.c',
+        '<(nghttp2_lib)/nghttp2_pq.c',
+        '<(nghttp2_lib)/nghttp2_priority_spec.c',
+        '<(nghttp2_lib)/nghttp2_queue.c',
+        '<(nghttp2_lib)/nghttp2_rcbuf.c',
+        '<(nghttp2_lib)/nghttp2_session.c',
+        '<(nghttp2_lib)/nghttp2_stream.c',
+        '<(nghttp2_lib)/nghttp2_submit.c',
+        '<(nghttp2_lib)/nghttp2_version.c',
+      ],
+      'defines': [
+        'BUILDING_NGHTTP2',
+        'HAVE_ARPA_INET_H',
+        'HAVE_NETINET_IN_H',
+      ],
+      'include_dirs': [
+        '<(DEPTH)/build/nghttp2',
+        '<(nghttp2_lib)/includes',
+      ],
+      'direct_dependent_settings': {
+        'include_dirs': [
+          '<(DEPTH)/build/nghttp2',
+          '<(nghttp2_lib)/includes',
+        ],
+      },
+    },
+  ],
+}
@@ -65,6 +65,8 @@ const char HTTPCache::kCacheFallbacks[] = "cache_fallbacks";
 const char HTTPCache::kCacheExpirations[] = "cache_expirations";
 const char HTTPCache::kCacheInserts[] = "cache_inserts";
 const char HTTPCache::kCacheDeletes[] = "cache_deletes";
+const char HTTPCache::kCacheHeaderParsesAvoided[] =
+    "cache_header_parses_avoided";
 
 // This used for doing prefix match for etag in fetcher code.
 const char HTTPCache::kEtagPrefix[] = "W/\"PSA-";
@@ -72,6 +74,7 @@ const char HTTPCache::kEtagPrefix[] = "W/\"PSA-";
 HTTPCache::HTTPCache(CacheInterface* cache, Timer* timer, Hasher* hasher,
                      Statistics* stats)
     : cache_(cache),
+      decoded_cache_(NULL),
       timer_(timer),
       hasher_(hasher),
       force_caching_(false),
@@ -87,6 +90,8 @@ HTTPCache::HTTPCache(CacheInterface* cache, Timer* timer, Hasher* hasher,
       cache_expirations_(stats->GetVariable(kCacheExpirations)),
       cache_inserts_(stats->GetVariable(kCacheInserts)),
       cache_deletes_(stats->GetVariable(kCacheDeletes)),
+      cache_header_parses_avoided_(
+          stats->GetVariable(kCacheHeaderParsesAvoided)),
       name_(FormatName(cache->Name())) {
   max_cacheable_response_content_length_ = kCacheSizeUnlimited;
   SetVersion(kHttpCacheVersion);
@@ -145,8 +150,13 @@ class HTTPCacheCallback : public CacheInterface::Callback {
     int64 now_ms = now_us / 1000;
     ResponseHeaders* headers = callback_->response_headers();
     bool is_expired = false;
-    if ((backend_state == CacheInterface::kAvailable) &&
-        callback_->http_value()->Link(value(), headers, handler_) &&
+    bool linked = (backend_state == CacheInterface::kAvailable) &&
+        callback_->http_value()->Link(value(), headers, handler_);
+    if (linked && headers->HasCachingSummary()) {
+      // IsProxyCacheable and Sanitize below will use the summary.
+      http_cache_->cache_header_parses_avoided_->Add(1);
+    }
+    if (linked &&
         (http_cache_->force_caching_ ||
          headers->IsProxyCacheable(callback_->req_properties(),
                                    callback_->RespectVaryOnResources(),
@@ -235,9 +245,10 @@ class HTTPCacheCallback : public CacheInterface::Callback {
             if (callback_->request_context()->accepts_gzip() ||
                 !callback_->http_value()->ExtractHeaders(&fallback_headers,
                                                          handler_) ||
-                !InflatingFetch::UnGzipValueIfCompressed(
-                    *callback_->http_value(), &fallback_headers,
-                    callback_->fallback_http_value(), handler_)) {
+                !http_cache_->InflateCachedValue(
+                    key_, fragment_, *callback_->http_value(),
+                    &fallback_headers, callback_->fallback_http_value(),
+                    handler_)) {
               // If we don't need to unzip, or can't unzip, then just
               // link the value and fallback together.
               callback_->fallback_http_value()->Link(callback_->http_value());
@@ -265,8 +276,9 @@ class HTTPCacheCallback : public CacheInterface::Callback {
                headers->IsGzipped()) {
       HTTPValue new_value;
       GoogleString inflated;
-      if (InflatingFetch::UnGzipValueIfCompressed(
-              *callback_->http_value(), headers, &new_value, handler_)) {
+      if (http_cache_->InflateCachedValue(key_, fragment_,
+                                          *callback_->http_value(), headers,
+                                          &new_value, handler_)) {
         callback_->http_value()->Link(&new_value);
       }
     }
@@ -295,6 +307,49 @@ class HTTPCacheCallback : public CacheInterface::Callback {
   DISALLOW_COPY_AND_ASSIGN(HTTPCacheCallback);
 };
 
+bool HTTPCache::InflateCachedValue(const GoogleString& key,
+                                   const GoogleString& fragment,
+                                   const HTTPValue& src,
+                                   ResponseHeaders* headers, HTTPValue* dest,
+                                   MessageHandler* handler) {
+  if (decoded_cache_ == NULL) {
+    return InflatingFetch::UnGzipValueIfCompressed(src, headers, dest,
+                                                   handler);
+  }
+  if (src.Empty() || !headers->IsGzipped()) {
+    return false;
+  }
+
+  // The decoded copy is keyed by a hash of the headers as they stand now
+  // (which reflect any per-lookup TTL override) and the size of the
+  // compressed entry, so neither a re-Put of the resource nor a different
+  // caller can be answered with a mismatched copy; superseded copies simply
+  // age out.
+  GoogleString decoded_key = StrCat(
+      CompositeKey(key, fragment), "@", hasher_->Hash(headers->ToString()),
+      ":", Integer64ToString(src.size()));
+  CacheInterface::SynchronousCallback callback;
+  decoded_cache_->Get(decoded_key, &callback);
+  DCHECK(callback.called());
+  if (callback.called() && (callback.state() == CacheInterface::kAvailable)) {
+    HTTPValue decoded;
+    if (decoded.Link(callback.value(), headers, handler)) {
+      dest->Link(&decoded);
+      return true;
+    }
+    // A corrupt entry clobbers headers; restore them and replace the entry.
+    if (!src.ExtractHeaders(headers, handler)) {
+      return false;
+    }
+  }
+
+  if (!InflatingFetch::UnGzipValueIfCompressed(src, headers, dest, handler)) {
+    return false;
+  }
+  decoded_cache_->Put(decoded_key, dest->share());
+  return true;
+}
+
 void HTTPCache::Find(const GoogleString& key, const GoogleString& fragment,
                      MessageHandler* handler, Callback* callback) {
   HTTPCacheCallback* cb = new HTTPCacheCallback(
@@ -582,6 +637,7 @@ void HTTPCache::InitStats(Statistics* statistics) {
   statistics->AddVariable(kCacheExpirations);
   statistics->AddVariable(kCacheInserts);
   statistics->AddVariable(kCacheDeletes);
+  statistics->AddVariable(kCacheHeaderParsesAvoided);
 }
 
 GoogleString HTTPCache::FormatEtag(StringPiece hash) {
@@ -272,6 +272,8 @@ TEST_F(HTTPCacheTest, PutGet) {
   EXPECT_EQ("content", contents);
   EXPECT_EQ(1, GetStat(HTTPCache::kCacheHits));
   EXPECT_EQ(0, GetStat(HTTPCache::kCacheFallbacks));
+  // The entry carries the caching summary computed at insertion.
+  EXPECT_EQ(1, GetStat(HTTPCache::kCacheHeaderParsesAvoided));
 
   simple_stats_.Clear();
   scoped_ptr<Callback> callback(NewCallback());
@@ -976,6 +978,43 @@ TEST_F(HTTPCacheTest, LeaveFallbackCompressed) {
       HttpAttributes::kContentEncoding, "gzip"));
 }
 
+TEST_F(HTTPCacheTest, DecodedCacheReusesInflatedCopy) {
+  // With a decoded cache, a gzipped entry served to clients that do not
+  // accept gzip is inflated once; later hits share the inflated copy.
+  LRUCache decoded_cache(kMaxSize);
+  http_cache_->set_decoded_cache(&decoded_cache);
+  ResponseHeaders response_headers;
+  PopulateGzippedEntry("max-age=300", &response_headers);
+
+  for (int i = 0; i < 3; ++i) {
+    HTTPValue value;
+    response_headers.Clear();
+    ASSERT_EQ(kFoundResult,
+              Find(kUrl, kFragment, &value, &response_headers));
+    StringPiece contents;
+    ASSERT_TRUE(value.ExtractContents(&contents));
+    EXPECT_STREQ(kCssText, contents);
+    EXPECT_FALSE(response_headers.HasValue(
+        HttpAttributes::kContentEncoding, "gzip"));
+    int64 content_length;
+    ASSERT_TRUE(response_headers.FindContentLength(&content_length));
+    EXPECT_EQ(STATIC_STRLEN(kCssText), content_length);
+  }
+  EXPECT_EQ(1, decoded_cache.num_inserts());
+  EXPECT_EQ(2, decoded_cache.num_hits());
+
+  // Clients that accept gzip get the compressed entry and never consult the
+  // decoded cache.
+  HTTPValue value;
+  response_headers.Clear();
+  ASSERT_EQ(kFoundResult,
+            FindAcceptGzip(kUrl, kFragment, &value, &response_headers));
+  EXPECT_TRUE(response_headers.HasValue(
+      HttpAttributes::kContentEncoding, "gzip"));
+  EXPECT_EQ(1, decoded_cache.num_misses());
+  http_cache_->set_decoded_cache(NULL);
+}
+
 TEST_F(HTTPCacheTest, PutAlreadyCompressedWithCompressionOff) {
   size_t cache_size = CacheSizeAfterPut(0, true);
   // The physical cache entry includes the key, fragment, and value, which
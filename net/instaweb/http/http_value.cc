@@ -96,6 +96,11 @@ bool HTTPValue::Write(const StringPiece& str, MessageHandler* handler) {
   return true;
 }
 
+void HTTPValue::ReserveContents(int64 contents_size) {
+  CopyOnWrite();
+  storage_.Reserve(storage_.size() + kStorageOverhead + contents_size);
+}
+
 bool HTTPValue::Flush(MessageHandler* handler) {
   return true;
 }
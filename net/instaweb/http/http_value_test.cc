@@ -110,6 +110,23 @@ TEST_F(HTTPValueTest, EmptyContentsFirst) {
   CheckResponseHeaders(check_headers);
 }
 
+TEST_F(HTTPValueTest, ReserveContents) {
+  HTTPValue value;
+  ResponseHeaders headers, check_headers;
+  FillResponseHeaders(&headers);
+  value.ReserveContents(8);
+  EXPECT_TRUE(value.Empty());
+  value.Write("body", &message_handler_);
+  value.Write("body", &message_handler_);
+  value.SetHeaders(&headers);
+  StringPiece body;
+  ASSERT_TRUE(value.ExtractContents(&body));
+  EXPECT_EQ("bodybody", body.as_string());
+  EXPECT_EQ(body.size(), ComputeContentsSize(&value));
+  ASSERT_TRUE(value.ExtractHeaders(&check_headers, &message_handler_));
+  CheckResponseHeaders(check_headers);
+}
+
 TEST_F(HTTPValueTest, TestCopyOnWrite) {
   HTTPValue v1;
   v1.Write("Hello", &message_handler_);
@@ -279,7 +296,7 @@ TEST_F(HTTPValueEncodeTest, EncodeDecodeGold) {
       ".blue {color: blue;}\n";
 
   const char header_first_golden_value_buf[] =
-      "hv\x1\0\0\b\xC8\x1\x12\x2OK\x18\x1 \x1(\xC0\xD8\xBA\xCC\xD5)0\x80\x89"
+      "h|\x1\0\0\b\xC8\x1\x12\x2OK\x18\x1 \x1(\xC0\xD8\xBA\xCC\xD5)0\x80\x89"
       "\x96\xCC\xD5)8\x1@\x1JR\n\x6"
       "Server\x12HApache/2.2.29 (Unix) mod_ssl/2.2.29 OpenSSL/1.0.1j DAV/2"
       " mod_fcgid/2.3.9J.\n\r"
@@ -291,7 +308,7 @@ TEST_F(HTTPValueEncodeTest, EncodeDecodeGold) {
       "Content-Type\x12\btext/cssJ\x1A\n\x4"
       "Etag\x12\x12W/\"PSA-35DPOkCBal\"J%\n\x4"
       "Date\x12\x1D" "Fri, 15 May 2015 21:40:32 GMTP"
-      "\xE0\xC8\xBA\xC1\xBA)X\xC0\xCF$h\0p\0."
+      "\xE0\xC8\xBA\xC1\xBA)X\xC0\xCF$h\0p\0z\x4\b\0\x10\x1."
       "blue {color: blue;}\n";
   StringPiece header_first_golden_value(
       header_first_golden_value_buf,
@@ -313,7 +330,8 @@ TEST_F(HTTPValueEncodeTest, EncodeDecodeGold) {
   StringPiece body_first_golden_value(
       body_first_golden_value_buf, STATIC_STRLEN(body_first_golden_value_buf));
 
-  // These tests should work even if proto formats change.
+  // These tests should work even if proto formats change.  Note that
+  // body_first_golden_value predates the caching summary.
   EXPECT_STREQ(example_http, Decode(header_first_golden_value));
   EXPECT_STREQ(example_http, Decode(body_first_golden_value));
 
@@ -22,12 +22,12 @@
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/message_handler.h"
-#include "pagespeed/kernel/base/stack_buffer.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_writer.h"
 #include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/request_headers.h"
 #include "pagespeed/kernel/http/response_headers.h"
+#include "pagespeed/kernel/util/gzip_inflater.h"
 
 namespace net_instaweb {
 
@@ -54,7 +54,8 @@ bool InflatingFetch::IsCompressionAllowedInRequest() {
             // What if we want only gzip, but get deflate?  I think this will
             // rarely happen in practice but we could handle it here.
             compression_desired_ = true;
-            break;
+          } else if (StringCaseEqual(value, HttpAttributes::kBrotli)) {
+            brotli_desired_ = true;
           }
         }
       }
@@ -63,6 +64,13 @@ bool InflatingFetch::IsCompressionAllowedInRequest() {
   return compression_desired_;
 }
 
+bool InflatingFetch::IsEncodingAllowedInRequest(
+    StreamingDecoder::Encoding encoding) {
+  bool compression_desired = IsCompressionAllowedInRequest();
+  return (encoding == StreamingDecoder::kBrotli) ? brotli_desired_
+                                                 : compression_desired;
+}
+
 void InflatingFetch::EnableGzipFromBackend() {
   if (!IsCompressionAllowedInRequest()) {
     request_headers()->Add(HttpAttributes::kAcceptEncoding,
@@ -79,29 +87,11 @@ bool InflatingFetch::HandleWrite(const StringPiece& sp,
     return SharedAsyncFetch::HandleWrite(sp, handler);
   }
 
-  DCHECK(!inflater_->HasUnconsumedInput());
-  bool status = false;
-  if (!inflater_->error()) {
-    status = inflater_->SetInput(sp.data(), sp.size());
-    if (status && !inflater_->error()) {
-      char buf[kStackBufferSize];
-      while (inflater_->HasUnconsumedInput()) {
-        int size = inflater_->InflateBytes(buf, sizeof buf);
-        if (inflater_->error() || (size < 0)) {
-          handler->Message(kWarning, "inflation failure, size=%d", size);
-          inflate_failure_ = true;
-          break;
-        } else {
-          status = SharedAsyncFetch::HandleWrite(
-              StringPiece(buf, size), handler);
-        }
-      }
-    } else {
-      handler->MessageS(kWarning, "inflation failure SetInput returning false");
-      inflate_failure_ = true;
-    }
+  // The decoder writes each decoded block straight into the base fetch.
+  if (!inflater_->Decode(sp, base_fetch(), handler)) {
+    inflate_failure_ = true;
   }
-  return status && !inflate_failure_;
+  return !inflate_failure_;
 }
 
 // Inflate a HTTPValue, if it was gzip compressed.
@@ -110,11 +100,14 @@ bool InflatingFetch::UnGzipValueIfCompressed(const HTTPValue& src,
                                              HTTPValue* dest,
                                              MessageHandler* handler) {
   if (!src.Empty() && headers->IsGzipped()) {
-    GoogleString inflated;
-    StringWriter inflate_writer(&inflated);
     StringPiece content;
     src.ExtractContents(&content);
-    if (GzipInflater::Inflate(content, GzipInflater::kGzip, &inflate_writer)) {
+
+    // Decode directly into dest rather than through a temporary string.
+    // The headers are written last, once the inflated length is known.
+    HTTPValue inflated;
+    if (StreamingDecoder::DecodeAll(StreamingDecoder::kGzip, content,
+                                    &inflated, handler)) {
       if (!headers->HasValue(HttpAttributes::HttpAttributes::kVary,
                              HttpAttributes::kAcceptEncoding)) {
         headers->Add(HttpAttributes::HttpAttributes::kVary,
@@ -122,11 +115,9 @@ bool InflatingFetch::UnGzipValueIfCompressed(const HTTPValue& src,
       }
       headers->RemoveAll(HttpAttributes::kTransferEncoding);
       headers->Remove(HttpAttributes::kContentEncoding, HttpAttributes::kGzip);
-      headers->SetContentLength(inflated.length());
-      content.set(inflated.c_str(), inflated.length());
-      dest->Clear();
-      dest->Write(content, handler);
-      dest->SetHeaders(headers);
+      headers->SetContentLength(inflated.contents_size());
+      inflated.SetHeaders(headers);
+      dest->Link(&inflated);
       return true;
     }
   }
@@ -174,18 +165,17 @@ bool InflatingFetch::GzipValue(int compression_level,
 // This is referenced from http://boston.com.
 void InflatingFetch::HandleHeadersComplete() {
   ConstStringStarVector v;
-  if (!IsCompressionAllowedInRequest() &&
-      response_headers()->Lookup(HttpAttributes::kContentEncoding, &v)) {
+  if (response_headers()->Lookup(HttpAttributes::kContentEncoding, &v)) {
     // Look for an encoding to strip.  We only look at the *last* encoding.
     // See http://www.w3.org/Protocols/rfc2616/rfc2616-sec14.html
     for (int i = v.size() - 1; i >= 0; --i) {
       if (v[i] != NULL) {
         const StringPiece& value = *v[i];
         if (!value.empty()) {
-          if (StringCaseEqual(value, HttpAttributes::kGzip)) {
-            InitInflater(GzipInflater::kGzip, value);
-          } else if (StringCaseEqual(value, HttpAttributes::kDeflate)) {
-            InitInflater(GzipInflater::kDeflate, value);
+          StreamingDecoder::Encoding encoding;
+          if (StreamingDecoder::ParseEncoding(value, &encoding) &&
+              !IsEncodingAllowedInRequest(encoding)) {
+            InitInflater(encoding, value);
           }
           break;  // Stop on the last non-empty value.
         }
@@ -195,7 +185,7 @@ void InflatingFetch::HandleHeadersComplete() {
   SharedAsyncFetch::HandleHeadersComplete();
 }
 
-void InflatingFetch::InitInflater(GzipInflater::InflateType type,
+void InflatingFetch::InitInflater(StreamingDecoder::Encoding encoding,
                                   const StringPiece& value) {
   response_headers()->Remove(HttpAttributes::kContentEncoding, value);
   response_headers()->RemoveAll(HttpAttributes::kContentLength);
@@ -203,7 +193,7 @@ void InflatingFetch::InitInflater(GzipInflater::InflateType type,
 
   // TODO(jmarantz): Consider integrating with a free-store of Inflater
   // objects to avoid re-initializing these on every request.
-  inflater_.reset(new GzipInflater(type));
+  inflater_.reset(new StreamingDecoder(encoding));
   if (!inflater_->Init()) {
     inflate_failure_ = true;
     inflater_.reset(NULL);
@@ -216,12 +206,10 @@ void InflatingFetch::HandleDone(bool success) {
 }
 
 void InflatingFetch::Reset() {
-  if (inflater_.get() != NULL) {
-    inflater_->ShutDown();
-    inflater_.reset(NULL);
-  }
+  inflater_.reset(NULL);
   request_checked_for_accept_encoding_ = false;
   compression_desired_ = false;
+  brotli_desired_ = false;
   inflate_failure_ = false;
   SharedAsyncFetch::Reset();
 }
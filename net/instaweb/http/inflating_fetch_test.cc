@@ -51,6 +51,9 @@ const unsigned char kGzippedData[] = {
   0x89, 0xd1, 0xf7, 0x05, 0x00, 0x00, 0x00
 };
 
+// "hello\n", generated with the command line tool "bro".
+const char kBrotliHello[] = "\x8b\x02\x80\x68\x65\x6c\x6c\x6f\x0a\x03";
+
 bool binary_data_same(const void* left, size_t left_len,
                       const void* right, size_t right_len) {
   return left_len == right_len && memcmp(left, right, left_len) == 0;
@@ -176,6 +179,58 @@ TEST_F(InflatingFetchTest, ExpectGzipped) {
   EXPECT_TRUE(mock_fetch_->success());
 }
 
+// Tests that gzipped data delivered in arbitrary pieces, including empty
+// ones, is inflated as if it had arrived in one Write.
+TEST_F(InflatingFetchTest, AutoInflateInPieces) {
+  inflating_fetch_->response_headers()->Add(
+      HttpAttributes::kContentEncoding, HttpAttributes::kGzip);
+  inflating_fetch_->response_headers()->SetStatusAndReason(HttpStatus::kOK);
+  EXPECT_TRUE(inflating_fetch_->Write("", &message_handler_));
+  for (int i = 0, n = gzipped_data_.size(); i < n; ++i) {
+    EXPECT_TRUE(inflating_fetch_->Write(gzipped_data_.substr(i, 1),
+                                        &message_handler_));
+  }
+  inflating_fetch_->Done(true);
+  EXPECT_EQ(kClearData, mock_fetch_->buffer());
+  EXPECT_TRUE(mock_fetch_->done());
+  EXPECT_TRUE(mock_fetch_->success());
+}
+
+// Tests that br content is decoded for a request that accepts gzip but
+// not br.
+TEST_F(InflatingFetchTest, AutoInflateBrotli) {
+  inflating_fetch_->request_headers()->Add(
+      HttpAttributes::kAcceptEncoding, HttpAttributes::kGzip);
+  inflating_fetch_->response_headers()->Add(
+      HttpAttributes::kContentEncoding, HttpAttributes::kBrotli);
+  inflating_fetch_->response_headers()->SetStatusAndReason(HttpStatus::kOK);
+  StringPiece brotli_data(kBrotliHello, STATIC_STRLEN(kBrotliHello));
+  inflating_fetch_->Write(brotli_data, &message_handler_);
+  inflating_fetch_->Done(true);
+  EXPECT_EQ("hello\n", mock_fetch_->buffer());
+  EXPECT_TRUE(mock_fetch_->response_headers()->Lookup1(
+      HttpAttributes::kContentEncoding) == NULL);
+  EXPECT_TRUE(mock_fetch_->done());
+  EXPECT_TRUE(mock_fetch_->success());
+}
+
+TEST_F(InflatingFetchTest, ExpectBrotli) {
+  inflating_fetch_->request_headers()->Add(
+      HttpAttributes::kAcceptEncoding, HttpAttributes::kBrotli);
+  inflating_fetch_->response_headers()->Add(
+      HttpAttributes::kContentEncoding, HttpAttributes::kBrotli);
+  inflating_fetch_->response_headers()->SetStatusAndReason(HttpStatus::kOK);
+  StringPiece brotli_data(kBrotliHello, STATIC_STRLEN(kBrotliHello));
+  inflating_fetch_->Write(brotli_data, &message_handler_);
+  inflating_fetch_->Done(true);
+  EXPECT_EQ(brotli_data, mock_fetch_->buffer()) << "data should be untouched.";
+  EXPECT_STREQ(HttpAttributes::kBrotli,
+               mock_fetch_->response_headers()->Lookup1(
+                   HttpAttributes::kContentEncoding));
+  EXPECT_TRUE(mock_fetch_->done());
+  EXPECT_TRUE(mock_fetch_->success());
+}
+
 // Check that empty blacklist is processed correctly and everything is inflated.
 // The blacklist feature has been removed since after this test was written,
 // but behavior should be unchanged.
@@ -313,6 +313,10 @@ class SharedAsyncFetch : public AsyncFetch {
   // Propagates any set_content_length from this to the base fetch.
   void PropagateContentLength();
 
+  // The fetch that HandleWrite forwards to, for subclasses that produce
+  // their output through a Writer interface.
+  AsyncFetch* base_fetch() { return base_fetch_; }
+
  private:
   AsyncFetch* base_fetch_;
   DISALLOW_COPY_AND_ASSIGN(SharedAsyncFetch);
@@ -78,6 +78,7 @@ class HTTPCache {
   static const char kCacheExpirations[];
   static const char kCacheInserts[];
   static const char kCacheDeletes[];
+  static const char kCacheHeaderParsesAvoided[];
 
   // The prefix used for Etags.
   static const char kEtagPrefix[];
@@ -369,6 +370,16 @@ class HTTPCache {
   }
   int compression_level() const { return compression_level_; }
 
+  // Sets a blocking cache in which to keep inflated copies of gzipped
+  // entries, so that serving a hot gzipped resource to clients that don't
+  // accept gzip does not re-inflate it on every hit.  The cache is owned by
+  // the caller; NULL (the default) inflates on every such hit.
+  void set_decoded_cache(CacheInterface* cache) {
+    DCHECK(cache == NULL || cache->IsBlocking());
+    decoded_cache_ = cache;
+  }
+  CacheInterface* decoded_cache() const { return decoded_cache_; }
+
   GoogleString Name() const { return FormatName(cache_->Name()); }
   static GoogleString FormatName(StringPiece cache);
 
@@ -412,11 +423,19 @@ class HTTPCache {
   void UpdateStats(const GoogleString& key, const GoogleString& fragment,
                    CacheInterface::KeyState backend_state, FindResult result,
                    bool has_fallback, bool is_expired, MessageHandler* handler);
+  // Inflates the gzipped src into dest, updating headers to match, via
+  // decoded_cache_ when one is set.  Returns false, leaving dest unmodified,
+  // if src is not gzipped or fails to inflate.
+  bool InflateCachedValue(const GoogleString& key,
+                          const GoogleString& fragment, const HTTPValue& src,
+                          ResponseHeaders* headers, HTTPValue* dest,
+                          MessageHandler* handler);
   void RememberFetchFailedOrNotCacheableHelper(
       const GoogleString& key, const GoogleString& fragment,
       MessageHandler* handler, HttpStatus::Code code, int64 ttl_sec);
 
   CacheInterface* cache_;  // Owned by the caller.
+  CacheInterface* decoded_cache_;  // Owned by the caller; may be NULL.
   Timer* timer_;
   Hasher* hasher_;
   bool force_caching_;
@@ -441,6 +460,9 @@ class HTTPCache {
   Variable* cache_expirations_;
   Variable* cache_inserts_;
   Variable* cache_deletes_;
+  // # of cache candidates validated using the caching summary stored with
+  // their headers, rather than by looking up and parsing header values.
+  Variable* cache_header_parses_avoided_;
 
   GoogleString name_;
   HttpCacheFailurePolicy remember_failure_policy_;
@@ -63,6 +63,10 @@ class HTTPValue : public Writer {
   // or after SetHeaders.  However, SetHeaders cannot be interleaved
   // in between calls to Write.
   virtual bool Write(const StringPiece& str, MessageHandler* handler);
+
+  // Preallocates storage for contents_size bytes of contents, for callers
+  // that know the size up front and will stream the contents in with Write.
+  void ReserveContents(int64 contents_size);
   virtual bool Flush(MessageHandler* handler);
 
   // Retrieves the headers, returning false if empty.
@@ -27,7 +27,7 @@
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/http/response_headers.h"
-#include "pagespeed/kernel/util/gzip_inflater.h"
+#include "pagespeed/kernel/util/streaming_decoder.h"
 
 namespace net_instaweb {
 
@@ -36,7 +36,10 @@ class MessageHandler;
 // This Fetch layer helps work with origin servers that serve gzipped
 // content even when request-headers do not include
 // accept-encoding:gzip.  In that scenario, this class inflates the
-// content and strips the content-encoding:gzip response header.
+// content and strips the content-encoding:gzip response header.  The
+// same applies to deflate, and to br when the request does not list br.
+// Decoding is streamed: each block is inflated straight into the base
+// fetch as it arrives.
 //
 // Some servers will serve gzipped content even to clients that didn't
 // ask for it.  Depending on the serving environment, we may also want
@@ -55,7 +58,9 @@ class InflatingFetch : public SharedAsyncFetch {
 
   // Inflate a GZipped HTTPValue if it has been gzipped-compressed,
   // updating the headers to reflect the new state.  Returns false if
-  // the data was not compressed, leaving dest unmodified.
+  // the data was not compressed, leaving dest unmodified.  The inflated
+  // body is written directly into dest's storage, without an
+  // intermediate copy.
   //
   // Notes: dest and src should not be the same object.  If the
   // unzip fails, you may need to link src into dest.
@@ -82,13 +87,18 @@ class InflatingFetch : public SharedAsyncFetch {
   virtual void Reset();
 
  private:
-  void InitInflater(GzipInflater::InflateType, const StringPiece& value);
+  void InitInflater(StreamingDecoder::Encoding encoding,
+                    const StringPiece& value);
 
   // If this returns true, it means that we should not inflate incoming data and
   // pass it to the caller as is, since that is what caller requested.
   bool IsCompressionAllowedInRequest();
 
-  scoped_ptr<GzipInflater> inflater_;
+  // Like IsCompressionAllowedInRequest, but for a specific encoding: br is
+  // only passed through if the request explicitly accepts it.
+  bool IsEncodingAllowedInRequest(StreamingDecoder::Encoding encoding);
+
+  scoped_ptr<StreamingDecoder> inflater_;
 
   // Caching gate inside IsCompressionAllowedInRequest().
   bool request_checked_for_accept_encoding_;
@@ -96,6 +106,9 @@ class InflatingFetch : public SharedAsyncFetch {
   // Will be set to true if accepted encoding included gzip and/or deflate.
   bool compression_desired_;
 
+  // Will be set to true if accepted encoding included br.
+  bool brotli_desired_;
+
   // Whether any kind of error happened to the inflater. Once set to true, never
   // gets reset.
   bool inflate_failure_;
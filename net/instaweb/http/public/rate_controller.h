@@ -22,6 +22,7 @@
 #define NET_INSTAWEB_HTTP_PUBLIC_RATE_CONTROLLER_H_
 
 #include <map>
+#include <vector>
 
 #include "pagespeed/kernel/base/atomic_bool.h"
 #include "pagespeed/kernel/base/basictypes.h"
@@ -35,10 +36,13 @@ namespace net_instaweb {
 class AbstractMutex;
 class AsyncFetch;
 class MessageHandler;
+class Sequence;
 class Statistics;
 class ThreadSystem;
 class TimedVariable;
+class Timer;
 class UpDownCounter;
+class Variable;
 class UrlAsyncFetcher;
 
 // Controller which limits the number of outgoing fetches per domain. If the
@@ -52,12 +56,36 @@ class UrlAsyncFetcher;
 // If a request is dropped, the response will have HttpAttributes::kXPsaLoadShed
 // set on the response headers.
 //
+//
+// By default the per-host limit is fixed. With EnableAdaptiveLimits each host
+// gets its own limit, tuned from the latency and errors of its fetches, so a
+// slow or failing origin holds fewer fetch slots and queue entries while a
+// fast one can be given more.
+//
 // Note: this requires working statistics to work.
 class RateController {
  public:
   static const char kQueuedFetchCount[];
   static const char kDroppedFetchCount[];
   static const char kCurrentGlobalFetchQueueSize[];
+  static const char kAdaptiveLimitDecreases[];
+  static const char kAdaptiveLimitIncreases[];
+  static const char kAdaptiveThrottledHosts[];
+
+  // A host's adaptive fetch limit, as listed on the admin pages.
+  struct HostLimit {
+    // Orders lower limits first, then by host.
+    static bool MoreThrottled(const HostLimit& a, const HostLimit& b) {
+      return (a.outgoing_limit != b.outgoing_limit) ?
+          (a.outgoing_limit < b.outgoing_limit) : (a.host < b.host);
+    }
+
+    GoogleString host;
+    int outgoing_limit;
+    // Smoothed latency of the host's successful fetches, or -1 before the
+    // first.
+    int64 baseline_latency_ms;
+  };
 
   RateController(int max_global_queue_size,
                  int per_host_outgoing_request_threshold,
@@ -72,11 +100,35 @@ class RateController {
   bool is_shut_down() const { return shutdown_.value(); }
 
   // Applies our shaping policies, and either (eventually) asks fetcher to
-  // fetch the given URL or drops it.
+  // fetch the given URL or drops it.  response_sequence, which may be NULL,
+  // is passed on to UrlAsyncFetcher::FetchOnSequence.
   void Fetch(UrlAsyncFetcher* fetcher,
              const GoogleString& url,
              MessageHandler* message_handler,
-             AsyncFetch* fetch);
+             AsyncFetch* fetch,
+             Sequence* response_sequence);
+
+  // Makes each host's outgoing fetch limit adapt, between 1 and
+  // max_per_host_outgoing_request_threshold (raised to the configured
+  // per-host threshold if lower), starting at the configured threshold.
+  // A host's limit is halved when a fetch fails, returns a 5xx, or takes over
+  // twice the host's usual latency, and grows by one after a window of
+  // successful fetches that the limit held back. A host's queue allowance is
+  // scaled down along with its limit, and idle hosts are remembered, up to a
+  // bound. timer is used to measure latencies. Must be called before the
+  // first Fetch.
+  void EnableAdaptiveLimits(Timer* timer,
+                            int max_per_host_outgoing_request_threshold);
+
+  // Returns the number of background fetches currently let through to host
+  // at once.
+  int HostOutgoingLimit(const GoogleString& host);
+
+  // Fills *limits with the adaptive limits of up to max_hosts of the hosts
+  // this controller tracks, most throttled first, and returns the number of
+  // hosts tracked, which is bounded since only so many idle hosts are kept.
+  // Returns 0 unless EnableAdaptiveLimits was called.
+  int GetHostLimits(int max_hosts, std::vector<HostLimit>* limits);
 
   // Initializes statistics variables associated with this class.
   static void InitStats(Statistics* statistics);
@@ -93,6 +145,13 @@ class RateController {
   // Delete the fetch info from fetch_info_map_ if possible.
   void DeleteFetchInfoIfPossible(const HostFetchInfoPtr& fetch_info);
 
+  // Feeds the outcome of a fetch to the host's adaptive limit, and counts
+  // any change in the statistics.
+  void AdaptLimit(const HostFetchInfoPtr& fetch_info, int64 latency_ms,
+                  bool ok);
+
+  bool adaptive() const { return timer_ != NULL; }
+
   // The maximum permissible size of the global queue.
   const int max_global_queue_size_;
   // The maximum number of outgoing requests allowed per host.
@@ -100,6 +159,10 @@ class RateController {
   // The maximum number of queued requests allowed per host.
   const int per_host_queued_request_threshold_;
   ThreadSystem* thread_system_;
+  // Non-NULL when per-host limits are adaptive.
+  Timer* timer_;
+  // The most outgoing requests an adaptive limit may allow per host.
+  int max_adaptive_outgoing_request_threshold_;
 
   // Map containing per-host information tracking outgoing and queued fetches.
   HostFetchInfoMap fetch_info_map_ GUARDED_BY(mutex_);
@@ -110,6 +173,10 @@ class RateController {
   // Using a variable here, since we want to be able to track this in the server
   // statistics.
   UpDownCounter* current_global_fetch_queue_size_;
+  Variable* adaptive_limit_decreases_;
+  Variable* adaptive_limit_increases_;
+  // Hosts whose adaptive limit is below the configured threshold.
+  UpDownCounter* adaptive_throttled_hosts_;
 
   AtomicBool shutdown_;
 
@@ -31,6 +31,7 @@ namespace net_instaweb {
 class AsyncFetch;
 class MessageHandler;
 class RateController;
+class Sequence;
 class Statistics;
 class ThreadSystem;
 
@@ -58,9 +59,16 @@ class RateControllingUrlAsyncFetcher : public UrlAsyncFetcher {
   virtual void Fetch(const GoogleString& url,
                      MessageHandler* message_handler,
                      AsyncFetch* fetch);
+  virtual void FetchOnSequence(const GoogleString& url,
+                               MessageHandler* message_handler,
+                               AsyncFetch* fetch,
+                               Sequence* response_sequence);
 
   virtual void ShutDown();
 
+  // The controller applying our limits, e.g. to enable adaptive limits.
+  RateController* rate_controller() { return rate_controller_.get(); }
+
  private:
   UrlAsyncFetcher* base_fetcher_;
   scoped_ptr<RateController> rate_controller_;
@@ -28,6 +28,7 @@ namespace net_instaweb {
 
 class AsyncFetch;
 class MessageHandler;
+class Sequence;
 
 // UrlAsyncFetcher is an interface for asynchronously fetching URLs.
 // The results of a fetch are asynchronously passed back to the callbacks
@@ -51,6 +52,19 @@ class UrlAsyncFetcher {
                      MessageHandler* message_handler,
                      AsyncFetch* fetch) = 0;
 
+  // Like Fetch, but asks for fetch's callbacks to be run on
+  // response_sequence rather than on whatever thread the fetcher completes
+  // on, so the caller can do its completion work there without another
+  // hop.  Fetchers that cannot do so, which includes this base-class
+  // implementation, ignore response_sequence and call Fetch, so callers
+  // must still accept callbacks on any thread.  A NULL response_sequence
+  // makes this the same as Fetch.  Fetchers that wrap another fetcher should
+  // forward response_sequence to it.
+  virtual void FetchOnSequence(const GoogleString& url,
+                               MessageHandler* message_handler,
+                               AsyncFetch* fetch,
+                               Sequence* response_sequence);
+
   // Determine if the fetcher supports fetching using HTTPS. By default we
   // assume a fetcher can.
   virtual bool SupportsHttps() const { return true; }
@@ -32,6 +32,7 @@ namespace net_instaweb {
 class AsyncFetch;
 class Histogram;
 class MessageHandler;
+class Sequence;
 class Statistics;
 class Timer;
 class Variable;
@@ -64,6 +65,10 @@ class UrlAsyncFetcherStats : public UrlAsyncFetcher {
   virtual void Fetch(const GoogleString& url,
                      MessageHandler* message_handler,
                      AsyncFetch* fetch);
+  virtual void FetchOnSequence(const GoogleString& url,
+                               MessageHandler* message_handler,
+                               AsyncFetch* fetch,
+                               Sequence* response_sequence);
   virtual int64 timeout_ms();
   virtual void ShutDown();
 
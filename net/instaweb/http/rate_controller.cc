@@ -20,9 +20,11 @@
 
 #include "net/instaweb/http/public/rate_controller.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <queue>
 #include <utility>
+#include <vector>
 
 #include "base/logging.h"
 #include "net/instaweb/http/public/async_fetch.h"
@@ -31,10 +33,12 @@
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/http/google_url.h"
 #include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/response_headers.h"
@@ -48,21 +52,41 @@ struct DeferredFetch {
   DeferredFetch(const GoogleString& in_url,
                 UrlAsyncFetcher* fetcher,
                 AsyncFetch* in_fetch,
-                MessageHandler* in_handler)
+                MessageHandler* in_handler,
+                Sequence* in_response_sequence)
       : url(in_url),
         fetcher(fetcher),
         fetch(in_fetch),
-        handler(in_handler) {}
+        handler(in_handler),
+        response_sequence(in_response_sequence) {}
 
   GoogleString url;
   UrlAsyncFetcher* fetcher;
   AsyncFetch* fetch;
   MessageHandler* handler;
+  Sequence* response_sequence;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(DeferredFetch);
 };
 
+// A fetch slower than this multiple of its host's baseline latency is taken as
+// a sign the host is overloaded.
+const int kLatencyToleranceFactor = 2;
+
+// Baselines below this are rounded up before applying the tolerance, so
+// jitter on near-instant fetches doesn't count as overload.
+const int64 kMinBaselineLatencyMs = 10;
+
+// Each successful fetch moves its host's baseline latency this fraction of
+// the way towards its own latency, so a lasting change in a host's speed
+// eventually becomes its new normal.
+const int64 kBaselineLatencyWeight = 16;
+
+// How many idle hosts to remember the latency and limit of. Beyond this, hosts
+// are forgotten when they go idle, and start over at the configured threshold.
+const size_t kMaxRetainedAdaptiveHosts = 1000;
+
 }  // namespace
 
 const char RateController::kQueuedFetchCount[] =
@@ -71,6 +95,12 @@ const char RateController::kDroppedFetchCount[] =
     "dropped-fetch-count";
 const char RateController::kCurrentGlobalFetchQueueSize[] =
     "current-fetch-queue-size";
+const char RateController::kAdaptiveLimitDecreases[] =
+    "adaptive-fetch-limit-decreases";
+const char RateController::kAdaptiveLimitIncreases[] =
+    "adaptive-fetch-limit-increases";
+const char RateController::kAdaptiveThrottledHosts[] =
+    "adaptive-fetch-throttled-hosts";
 
 // Keeps track of all the pending and enqueued fetches for a given host.
 class RateController::HostFetchInfo
@@ -86,7 +116,11 @@ class RateController::HostFetchInfo
         per_host_outgoing_request_threshold_(
             per_host_outgoing_request_threshold),
         per_host_queued_request_threshold_(per_host_queued_request_threshold),
-        mutex_(mutex) {}
+        mutex_(mutex),
+        outgoing_limit_(per_host_outgoing_request_threshold),
+        baseline_latency_ms_(-1),
+        completions_since_decrease_(per_host_outgoing_request_threshold),
+        saturated_successes_(0) {}
 
   ~HostFetchInfo() {}
 
@@ -100,7 +134,7 @@ class RateController::HostFetchInfo
   // increments the number of outbound fetches and returns true. Returns false
   // otherwise.
   bool IncrementIfCanTriggerFetch() EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
-    if (num_outbound_fetches_ < per_host_outgoing_request_threshold_) {
+    if (num_outbound_fetches_ < outgoing_limit_) {
       ++num_outbound_fetches_;
       return true;
     }
@@ -123,11 +157,12 @@ class RateController::HostFetchInfo
   bool EnqueueFetchIfWithinThreshold(const GoogleString& url,
                                      UrlAsyncFetcher* fetcher,
                                      MessageHandler* handler,
-                                     AsyncFetch* fetch)
+                                     AsyncFetch* fetch,
+                                     Sequence* response_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
-    if (fetch_queue_.size() <
-        static_cast<size_t>(per_host_queued_request_threshold_)) {
-      fetch_queue_.push(new DeferredFetch(url, fetcher, fetch, handler));
+    if (fetch_queue_.size() < static_cast<size_t>(QueuedThreshold())) {
+      fetch_queue_.push(new DeferredFetch(url, fetcher, fetch, handler,
+                                          response_sequence));
       return true;
     }
     return false;
@@ -137,8 +172,7 @@ class RateController::HostFetchInfo
   DeferredFetch* PopNextFetchAndIncrementCountIfWithinThreshold()
       LOCKS_EXCLUDED(mutex_) {
     ScopedMutex lock(mutex_.get());
-    if (fetch_queue_.empty() ||
-        num_outbound_fetches_ >= per_host_outgoing_request_threshold_) {
+    if (fetch_queue_.empty() || num_outbound_fetches_ >= outgoing_limit_) {
       return NULL;
     }
     DeferredFetch* fetch = fetch_queue_.front();
@@ -150,6 +184,62 @@ class RateController::HostFetchInfo
   // Returns the host associated with this HostFetchInfo object.
   const GoogleString& host() { return host_; }
 
+  // Returns the current limit on outbound background fetches.
+  int outgoing_limit() const LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    return outgoing_limit_;
+  }
+
+  // Returns the current limit and the smoothed latency it is judged against.
+  void GetLimit(HostLimit* limit) const LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    limit->host = host_;
+    limit->outgoing_limit = outgoing_limit_;
+    limit->baseline_latency_ms = baseline_latency_ms_;
+  }
+
+  // Updates the outbound fetch limit given the outcome of a fetch that is
+  // still counted as outbound, never raising it past max_limit. Returns the
+  // new limit, and sets *old_limit to the limit before the update.
+  int AdaptLimit(int64 latency_ms, bool ok, int max_limit, int* old_limit)
+      LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    *old_limit = outgoing_limit_;
+    bool overloaded = !ok;
+    if (ok) {
+      if (baseline_latency_ms_ < 0) {
+        baseline_latency_ms_ = latency_ms;
+      } else {
+        overloaded = (latency_ms > kLatencyToleranceFactor * std::max(
+            baseline_latency_ms_, kMinBaselineLatencyMs));
+        baseline_latency_ms_ +=
+            (latency_ms - baseline_latency_ms_) / kBaselineLatencyWeight;
+      }
+    }
+
+    // Fetches issued before a decrease report overload caused by the old
+    // limit, so react at most once per limit's worth of completions.
+    ++completions_since_decrease_;
+    if (overloaded) {
+      if (outgoing_limit_ > 1 &&
+          completions_since_decrease_ >= outgoing_limit_) {
+        outgoing_limit_ /= 2;
+        completions_since_decrease_ = 0;
+        saturated_successes_ = 0;
+      }
+    } else if (num_outbound_fetches_ >= outgoing_limit_ ||
+               !fetch_queue_.empty()) {
+      // Only successes the limit was holding back argue for raising it.
+      ++saturated_successes_;
+      if (saturated_successes_ >= outgoing_limit_ &&
+          outgoing_limit_ < max_limit) {
+        ++outgoing_limit_;
+        saturated_successes_ = 0;
+      }
+    }
+    return outgoing_limit_;
+  }
+
   bool AnyInFlightOrQueuedFetches() const LOCKS_EXCLUDED(mutex_) {
     ScopedMutex lock(mutex_.get());
     DCHECK_GE(num_outbound_fetches_, 0);
@@ -165,6 +255,17 @@ class RateController::HostFetchInfo
   }
 
  private:
+  // The most fetches that may be queued, scaled down in proportion to the
+  // outbound limit so a throttled host can't fill the global queue.
+  int QueuedThreshold() const EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    if (outgoing_limit_ >= per_host_outgoing_request_threshold_) {
+      return per_host_queued_request_threshold_;
+    }
+    int scaled = per_host_queued_request_threshold_ * outgoing_limit_ /
+                 per_host_outgoing_request_threshold_;
+    return std::min(per_host_queued_request_threshold_, std::max(1, scaled));
+  }
+
   GoogleString host_;
   int num_outbound_fetches_ GUARDED_BY(mutex_);
   const int per_host_outgoing_request_threshold_;
@@ -172,6 +273,13 @@ class RateController::HostFetchInfo
   scoped_ptr<AbstractMutex> mutex_;
   std::queue<DeferredFetch*> fetch_queue_ GUARDED_BY(mutex_);
 
+  // Only changed from per_host_outgoing_request_threshold_ by AdaptLimit.
+  int outgoing_limit_ GUARDED_BY(mutex_);
+  // Smoothed latency of successful fetches, or -1 before the first.
+  int64 baseline_latency_ms_ GUARDED_BY(mutex_);
+  int completions_since_decrease_ GUARDED_BY(mutex_);
+  int saturated_successes_ GUARDED_BY(mutex_);
+
   DISALLOW_COPY_AND_ASSIGN(HostFetchInfo);
 };
 
@@ -185,16 +293,28 @@ class RateController::CustomFetch : public SharedAsyncFetch {
               RateController* controller)
       : SharedAsyncFetch(fetch),
         fetch_info_(fetch_info),
-        controller_(controller) {}
+        controller_(controller),
+        start_ms_(controller->adaptive() ? controller->timer_->NowMs() : 0) {}
 
   virtual void HandleDone(bool success) {
+    // Read the status now, as the base fetch may be gone once it is Done.
+    bool ok = success &&
+        response_headers()->status_code() < HttpStatus::kInternalServerError;
     SharedAsyncFetch::HandleDone(success);
+    if (controller_->adaptive()) {
+      controller_->AdaptLimit(fetch_info_,
+                              controller_->timer_->NowMs() - start_ms_, ok);
+    }
     fetch_info_->decrement_num_outbound_fetches();
-    // Check if there is any fetch queued up for this host and the number of
-    // outstanding fetches for the host is less than the threshold.
-    DeferredFetch* deferred_fetch =
-        fetch_info_->PopNextFetchAndIncrementCountIfWithinThreshold();
-    if (deferred_fetch != NULL) {
+    // Trigger fetches for any requests queued up for this host while the
+    // number of outstanding fetches for the host is less than the threshold.
+    // An adaptive limit may just have grown, so there can be more than one.
+    bool triggered_fetch = false;
+    DeferredFetch* deferred_fetch;
+    while ((deferred_fetch =
+            fetch_info_->PopNextFetchAndIncrementCountIfWithinThreshold()) !=
+           NULL) {
+      triggered_fetch = true;
       DCHECK_GT(controller_->current_global_fetch_queue_size_->Get(), 0);
       controller_->current_global_fetch_queue_size_->Add(-1);
       // Trigger a fetch for the queued up request.
@@ -207,12 +327,13 @@ class RateController::CustomFetch : public SharedAsyncFetch {
             deferred_fetch->url.c_str());
         wrapper_fetch->Done(false);
       } else {
-        deferred_fetch->fetcher->Fetch(deferred_fetch->url,
-                                       deferred_fetch->handler,
-                                       wrapper_fetch);
+        deferred_fetch->fetcher->FetchOnSequence(
+            deferred_fetch->url, deferred_fetch->handler, wrapper_fetch,
+            deferred_fetch->response_sequence);
       }
       delete deferred_fetch;
-    } else {
+    }
+    if (!triggered_fetch) {
       controller_->DeleteFetchInfoIfPossible(fetch_info_);
     }
     delete this;
@@ -221,6 +342,7 @@ class RateController::CustomFetch : public SharedAsyncFetch {
  private:
   HostFetchInfoPtr fetch_info_;
   RateController* controller_;
+  int64 start_ms_;
   DISALLOW_COPY_AND_ASSIGN(CustomFetch);
 };
 
@@ -235,6 +357,9 @@ RateController::RateController(
           per_host_outgoing_request_threshold),
       per_host_queued_request_threshold_(per_host_queued_request_threshold),
       thread_system_(thread_system),
+      timer_(NULL),
+      max_adaptive_outgoing_request_threshold_(
+          per_host_outgoing_request_threshold),
       mutex_(thread_system->NewMutex()) {
   CHECK_GE(max_global_queue_size, 0);
   CHECK_GE(per_host_outgoing_request_threshold, 0);
@@ -244,15 +369,82 @@ RateController::RateController(
   dropped_fetch_count_ = statistics->GetTimedVariable(kDroppedFetchCount);
   current_global_fetch_queue_size_ = statistics->GetUpDownCounter(
       kCurrentGlobalFetchQueueSize);
+  adaptive_limit_decreases_ = statistics->GetVariable(kAdaptiveLimitDecreases);
+  adaptive_limit_increases_ = statistics->GetVariable(kAdaptiveLimitIncreases);
+  adaptive_throttled_hosts_ = statistics->GetUpDownCounter(
+      kAdaptiveThrottledHosts);
 }
 
 RateController::~RateController() {
+  // Adaptive limits keep idle hosts in the map.
+  STLDeleteValues(&fetch_info_map_);
+}
+
+void RateController::EnableAdaptiveLimits(
+    Timer* timer, int max_per_host_outgoing_request_threshold) {
+  CHECK(timer != NULL);
+  timer_ = timer;
+  max_adaptive_outgoing_request_threshold_ =
+      std::max(max_per_host_outgoing_request_threshold,
+               per_host_outgoing_request_threshold_);
+}
+
+int RateController::HostOutgoingLimit(const GoogleString& host) {
+  GoogleString lower_host(host);
+  LowerString(&lower_host);
+  ScopedMutex lock(mutex_.get());
+  HostFetchInfoMap::iterator iter = fetch_info_map_.find(lower_host);
+  if (iter == fetch_info_map_.end()) {
+    return per_host_outgoing_request_threshold_;
+  }
+  return (*iter->second)->outgoing_limit();
+}
+
+int RateController::GetHostLimits(int max_hosts,
+                                  std::vector<HostLimit>* limits) {
+  limits->clear();
+  if (!adaptive()) {
+    return 0;
+  }
+  ScopedMutex lock(mutex_.get());
+  for (HostFetchInfoMap::const_iterator iter = fetch_info_map_.begin();
+       iter != fetch_info_map_.end(); ++iter) {
+    limits->push_back(HostLimit());
+    (*iter->second)->GetLimit(&limits->back());
+  }
+  int num_hosts = limits->size();
+  if (num_hosts > max_hosts) {
+    std::partial_sort(limits->begin(), limits->begin() + max_hosts,
+                      limits->end(), HostLimit::MoreThrottled);
+    limits->resize(max_hosts);
+  } else {
+    std::sort(limits->begin(), limits->end(), HostLimit::MoreThrottled);
+  }
+  return num_hosts;
+}
+
+void RateController::AdaptLimit(const HostFetchInfoPtr& fetch_info,
+                                int64 latency_ms, bool ok) {
+  int old_limit;
+  int new_limit = fetch_info->AdaptLimit(
+      latency_ms, ok, max_adaptive_outgoing_request_threshold_, &old_limit);
+  if (new_limit == old_limit) {
+    return;
+  }
+  (new_limit < old_limit ? adaptive_limit_decreases_
+                         : adaptive_limit_increases_)->Add(1);
+  bool was_throttled = old_limit < per_host_outgoing_request_threshold_;
+  bool is_throttled = new_limit < per_host_outgoing_request_threshold_;
+  if (was_throttled != is_throttled) {
+    adaptive_throttled_hosts_->Add(is_throttled ? 1 : -1);
+  }
 }
 
 void RateController::Fetch(UrlAsyncFetcher* fetcher,
                            const GoogleString& url,
                            MessageHandler* message_handler,
-                           AsyncFetch* fetch) {
+                           AsyncFetch* fetch,
+                           Sequence* response_sequence) {
   if (is_shut_down()) {
     message_handler->Message(
         kWarning, "RateController: drop fetch of %s on shutdown",
@@ -269,7 +461,8 @@ void RateController::Fetch(UrlAsyncFetcher* fetcher,
   } else {
     // TODO(nikhilmadan): We should ideally just be dropping this fetch, but for
     // now we just hand it off to the base fetcher.
-    return fetcher->Fetch(url, message_handler, fetch);
+    return fetcher->FetchOnSequence(url, message_handler, fetch,
+                                    response_sequence);
   }
 
   HostFetchInfoPtr fetch_info_ptr;
@@ -308,10 +501,11 @@ void RateController::Fetch(UrlAsyncFetcher* fetcher,
     fetch_info_ptr->Unlock();
     mutex_->Unlock();
     CustomFetch* wrapper_fetch = new CustomFetch(fetch_info_ptr, fetch, this);
-    return fetcher->Fetch(url, message_handler, wrapper_fetch);
+    return fetcher->FetchOnSequence(url, message_handler, wrapper_fetch,
+                                    response_sequence);
   } else if (current_global_fetch_queue_size_->Get() < max_global_queue_size_ &&
              fetch_info_ptr->EnqueueFetchIfWithinThreshold(
-                 url, fetcher, message_handler, fetch)) {
+                 url, fetcher, message_handler, fetch, response_sequence)) {
     // If the number of globally queued up fetches is within the threshold and
     // the number of queued requests for this host is less than the threshold,
     // push it to the back of the per-host queue.
@@ -342,6 +536,9 @@ void RateController::InitStats(Statistics* statistics) {
                                Statistics::kDefaultGroup);
   statistics->AddTimedVariable(kDroppedFetchCount,
                                Statistics::kDefaultGroup);
+  statistics->AddVariable(kAdaptiveLimitDecreases);
+  statistics->AddVariable(kAdaptiveLimitIncreases);
+  statistics->AddUpDownCounter(kAdaptiveThrottledHosts);
 }
 
 void RateController::DeleteFetchInfoIfPossible(
@@ -350,9 +547,16 @@ void RateController::DeleteFetchInfoIfPossible(
   if (fetch_info->AnyInFlightOrQueuedFetches()) {
     return;
   }
+  // Remember what we learned about an idle host, unless too many are idle.
+  if (adaptive() && fetch_info_map_.size() <= kMaxRetainedAdaptiveHosts) {
+    return;
+  }
 
   HostFetchInfoMap::iterator iter = fetch_info_map_.find(fetch_info->host());
   if (iter != fetch_info_map_.end()) {
+    if (fetch_info->outgoing_limit() < per_host_outgoing_request_threshold_) {
+      adaptive_throttled_hosts_->Add(-1);
+    }
     delete iter->second;
     fetch_info_map_.erase(iter);
   }
@@ -48,7 +48,14 @@ RateControllingUrlAsyncFetcher::~RateControllingUrlAsyncFetcher() {
 void RateControllingUrlAsyncFetcher::Fetch(const GoogleString& url,
                                            MessageHandler* message_handler,
                                            AsyncFetch* fetch) {
-  rate_controller_->Fetch(base_fetcher_, url, message_handler, fetch);
+  rate_controller_->Fetch(base_fetcher_, url, message_handler, fetch, NULL);
+}
+
+void RateControllingUrlAsyncFetcher::FetchOnSequence(
+    const GoogleString& url, MessageHandler* message_handler,
+    AsyncFetch* fetch, Sequence* response_sequence) {
+  rate_controller_->Fetch(base_fetcher_, url, message_handler, fetch,
+                          response_sequence);
 }
 
 void RateControllingUrlAsyncFetcher::ShutDown() {
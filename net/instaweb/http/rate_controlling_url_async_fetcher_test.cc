@@ -22,13 +22,18 @@
 
 #include <vector>
 
+#include "base/logging.h"
 #include "net/instaweb/http/public/async_fetch.h"
 #include "net/instaweb/http/public/counting_url_async_fetcher.h"
 #include "net/instaweb/http/public/mock_url_fetcher.h"
 #include "net/instaweb/http/public/rate_controller.h"
 #include "net/instaweb/http/public/request_context.h"
+#include "net/instaweb/http/public/simulated_delay_fetcher.h"
+#include "net/instaweb/http/public/url_async_fetcher.h"
 #include "net/instaweb/http/public/wait_url_async_fetcher.h"
+#include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mem_file_system.h"
 #include "pagespeed/kernel/base/mock_timer.h"
 #include "pagespeed/kernel/base/null_message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
@@ -39,6 +44,8 @@
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/response_headers.h"
+#include "pagespeed/kernel/thread/mock_scheduler.h"
+#include "pagespeed/kernel/thread/sequence.h"
 #include "pagespeed/kernel/util/platform.h"
 #include "pagespeed/kernel/util/simple_stats.h"
 
@@ -85,6 +92,46 @@ class MockFetch : public AsyncFetch {
   DISALLOW_COPY_AND_ASSIGN(MockFetch);
 };
 
+// Sequence that is never run; only its address is compared.
+class UnusedSequence : public Sequence {
+ public:
+  UnusedSequence() {}
+  virtual void Add(Function* function) { LOG(FATAL) << "Not used"; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(UnusedSequence);
+};
+
+// Records the response_sequence of each fetch before handing it on to
+// the wrapped fetcher.
+class SequenceRecordingFetcher : public UrlAsyncFetcher {
+ public:
+  explicit SequenceRecordingFetcher(UrlAsyncFetcher* fetcher)
+      : fetcher_(fetcher) {}
+  virtual ~SequenceRecordingFetcher() {}
+
+  virtual void Fetch(const GoogleString& url,
+                     MessageHandler* message_handler,
+                     AsyncFetch* fetch) {
+    FetchOnSequence(url, message_handler, fetch, NULL);
+  }
+  virtual void FetchOnSequence(const GoogleString& url,
+                               MessageHandler* message_handler,
+                               AsyncFetch* fetch,
+                               Sequence* response_sequence) {
+    sequences_.push_back(response_sequence);
+    fetcher_->Fetch(url, message_handler, fetch);
+  }
+
+  const std::vector<Sequence*>& sequences() const { return sequences_; }
+
+ private:
+  UrlAsyncFetcher* fetcher_;
+  std::vector<Sequence*> sequences_;
+
+  DISALLOW_COPY_AND_ASSIGN(SequenceRecordingFetcher);
+};
+
 class RateControllingUrlAsyncFetcherTest : public ::testing::Test {
  protected:
   RateControllingUrlAsyncFetcherTest()
@@ -127,6 +174,22 @@ class RateControllingUrlAsyncFetcherTest : public ::testing::Test {
         RateController::kCurrentGlobalFetchQueueSize)->Get();
   }
 
+  // Starts count background fetches of url, appending them to fetch_vector.
+  void StartBackgroundFetches(const GoogleString& url, int count,
+                              std::vector<MockFetch*>* fetch_vector) {
+    for (int i = 0; i < count; ++i) {
+      MockFetch* fetch = new MockFetch(
+          RequestContext::NewTestRequestContext(thread_system_.get()), true);
+      fetch_vector->push_back(fetch);
+      rate_controlling_fetcher_->Fetch(url, &handler_, fetch);
+    }
+  }
+
+  int host_limit(const GoogleString& host) {
+    return rate_controlling_fetcher_->rate_controller()->HostOutgoingLimit(
+        host);
+  }
+
   MockUrlFetcher mock_fetcher_;
   scoped_ptr<ThreadSystem> thread_system_;
   SimpleStats stats_;
@@ -159,6 +222,36 @@ TEST_F(RateControllingUrlAsyncFetcherTest, SingleUrlWorks) {
   EXPECT_STREQ(body1_, fetch.content());
 }
 
+TEST_F(RateControllingUrlAsyncFetcherTest, ForwardsResponseSequence) {
+  SequenceRecordingFetcher recording_fetcher(wait_fetcher_.get());
+  RateControllingUrlAsyncFetcher fetcher(
+      &recording_fetcher, 10, 2, 4, thread_system_.get(), &stats_);
+  UnusedSequence sequence1, sequence2;
+  std::vector<MockFetch*> fetch_vector;
+  Sequence* sequences[] = {&sequence1, NULL, &sequence2};
+  for (int i = 0; i < 3; ++i) {
+    MockFetch* fetch = new MockFetch(
+        RequestContext::NewTestRequestContext(thread_system_.get()), true);
+    fetch_vector.push_back(fetch);
+    fetcher.FetchOnSequence(domain1_url1_, &handler_, fetch, sequences[i]);
+  }
+
+  // The first two fetches go straight out, the third is queued behind them.
+  ASSERT_EQ(2, recording_fetcher.sequences().size());
+  EXPECT_EQ(&sequence1, recording_fetcher.sequences()[0]);
+  EXPECT_EQ(NULL, recording_fetcher.sequences()[1]);
+
+  // The queued fetch keeps its sequence when it is finally issued.
+  wait_fetcher_->CallCallbacks();
+  ASSERT_EQ(3, recording_fetcher.sequences().size());
+  EXPECT_EQ(&sequence2, recording_fetcher.sequences()[2]);
+  wait_fetcher_->CallCallbacks();
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(fetch_vector[i]->success());
+  }
+  STLDeleteContainerPointers(fetch_vector.begin(), fetch_vector.end());
+}
+
 TEST_F(RateControllingUrlAsyncFetcherTest,
        MultipleBackgroundRequestsForSingleHost) {
   std::vector<MockFetch*> fetch_vector;
@@ -407,6 +500,184 @@ TEST_F(RateControllingUrlAsyncFetcherTest,
   STLDeleteContainerPointers(fetch_vector.begin(), fetch_vector.end());
 }
 
+TEST_F(RateControllingUrlAsyncFetcherTest, AdaptiveLimitFollowsLatency) {
+  rate_controlling_fetcher_->rate_controller()->EnableAdaptiveLimits(&timer_,
+                                                                     4);
+  std::vector<MockFetch*> fetch_vector;
+
+  // Two fetches taking 100ms set the baseline latency for domain1.
+  StartBackgroundFetches(domain1_url1_, 2, &fetch_vector);
+  timer_.AdvanceMs(100);
+  wait_fetcher_->CallCallbacks();
+  EXPECT_EQ(2, host_limit("www.d1.com"));
+
+  // Two fetches ten times slower halve the limit, but only once, as both were
+  // issued under the old limit.
+  StartBackgroundFetches(domain1_url1_, 2, &fetch_vector);
+  timer_.AdvanceMs(1000);
+  wait_fetcher_->CallCallbacks();
+  EXPECT_EQ(1, host_limit("www.d1.com"));
+  EXPECT_EQ(2, host_limit("www.d2.com"));
+  EXPECT_EQ(1, stats_.GetVariable(
+      RateController::kAdaptiveLimitDecreases)->Get());
+  EXPECT_EQ(1, stats_.GetUpDownCounter(
+      RateController::kAdaptiveThrottledHosts)->Get());
+
+  // Now one fetch goes out at a time, and domain1 may queue only half as
+  // many, so of 4 fetches 1 is triggered, 2 queued and 1 dropped.
+  StartBackgroundFetches(domain1_url1_, 4, &fetch_vector);
+  EXPECT_EQ(2, global_fetch_queue_size());
+  EXPECT_EQ(1, stats_.GetTimedVariable(
+      RateController::kDroppedFetchCount)->Get(TimedVariable::START));
+  EXPECT_TRUE(fetch_vector[7]->done());
+  EXPECT_FALSE(fetch_vector[7]->success());
+
+  // A fast fetch completing with others waiting raises the limit again, and
+  // both queued fetches go out.
+  timer_.AdvanceMs(100);
+  wait_fetcher_->CallCallbacks();
+  EXPECT_EQ(2, host_limit("www.d1.com"));
+  EXPECT_EQ(1, stats_.GetVariable(
+      RateController::kAdaptiveLimitIncreases)->Get());
+  EXPECT_EQ(0, stats_.GetUpDownCounter(
+      RateController::kAdaptiveThrottledHosts)->Get());
+  EXPECT_EQ(0, global_fetch_queue_size());
+
+  timer_.AdvanceMs(100);
+  wait_fetcher_->CallCallbacks();
+  for (int i = 0; i < 7; ++i) {
+    EXPECT_TRUE(fetch_vector[i]->done());
+    EXPECT_TRUE(fetch_vector[i]->success());
+    EXPECT_STREQ(body1_, fetch_vector[i]->content());
+  }
+
+  STLDeleteContainerPointers(fetch_vector.begin(), fetch_vector.end());
+}
+
+// Drives adaptive limits with SimulatedDelayFetcher, which answers each host
+// after a fixed delay and fails hosts it doesn't know.
+class AdaptiveRateControllingUrlAsyncFetcherTest : public ::testing::Test {
+ protected:
+  static const int kFastDelayMs = 10;
+
+  AdaptiveRateControllingUrlAsyncFetcherTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        stats_(thread_system_.get()),
+        timer_(thread_system_->NewMutex(), MockTimer::kApr_5_2010_ms),
+        scheduler_(thread_system_.get(), &timer_),
+        file_system_(thread_system_.get(), &timer_) {
+    RateController::InitStats(&stats_);
+    file_system_.WriteFile(
+        "delays.txt", StrCat("fast.com=", IntegerToString(kFastDelayMs), ";"),
+        &handler_);
+    delay_fetcher_.reset(new SimulatedDelayFetcher(
+        thread_system_.get(), &timer_, &scheduler_, &handler_, &file_system_,
+        "delays.txt", "requests.log", 100));
+
+    // As in RateControllingUrlAsyncFetcherTest, but each host's limit may
+    // vary between 1 and 4.
+    rate_controlling_fetcher_.reset(new RateControllingUrlAsyncFetcher(
+        delay_fetcher_.get(), 10, 2, 4, thread_system_.get(), &stats_));
+    rate_controlling_fetcher_->rate_controller()->EnableAdaptiveLimits(&timer_,
+                                                                       4);
+  }
+
+  virtual ~AdaptiveRateControllingUrlAsyncFetcherTest() {
+    STLDeleteContainerPointers(fetch_vector_.begin(), fetch_vector_.end());
+  }
+
+  void StartBackgroundFetches(const GoogleString& url, int count) {
+    for (int i = 0; i < count; ++i) {
+      MockFetch* fetch = new MockFetch(
+          RequestContext::NewTestRequestContext(thread_system_.get()), true);
+      fetch_vector_.push_back(fetch);
+      rate_controlling_fetcher_->Fetch(url, &handler_, fetch);
+    }
+  }
+
+  int host_limit(const GoogleString& host) {
+    return rate_controlling_fetcher_->rate_controller()->HostOutgoingLimit(
+        host);
+  }
+
+  int64 variable(const char* name) {
+    return stats_.GetVariable(name)->Get();
+  }
+
+  int throttled_hosts() {
+    return stats_.GetUpDownCounter(
+        RateController::kAdaptiveThrottledHosts)->Get();
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  SimpleStats stats_;
+  NullMessageHandler handler_;
+  MockTimer timer_;
+  MockScheduler scheduler_;
+  MemFileSystem file_system_;
+  scoped_ptr<SimulatedDelayFetcher> delay_fetcher_;
+  scoped_ptr<RateControllingUrlAsyncFetcher> rate_controlling_fetcher_;
+  std::vector<MockFetch*> fetch_vector_;
+};
+
+TEST_F(AdaptiveRateControllingUrlAsyncFetcherTest, FastHostLimitGrows) {
+  // Keep fast.com busy, so its steady latency lets the limit climb to the
+  // maximum and no further.
+  for (int i = 0; i < 10; ++i) {
+    StartBackgroundFetches("http://fast.com/", 4);
+    scheduler_.AdvanceTimeMs(kFastDelayMs);
+  }
+  EXPECT_EQ(4, host_limit("fast.com"));
+  EXPECT_EQ(2, variable(RateController::kAdaptiveLimitIncreases));
+  EXPECT_EQ(0, variable(RateController::kAdaptiveLimitDecreases));
+  EXPECT_EQ(0, throttled_hosts());
+
+  scheduler_.AdvanceTimeMs(10 * kFastDelayMs);
+  for (int i = 0, n = fetch_vector_.size(); i < n; ++i) {
+    EXPECT_TRUE(fetch_vector_[i]->done());
+  }
+}
+
+TEST_F(AdaptiveRateControllingUrlAsyncFetcherTest, FailingHostIsThrottled) {
+  StartBackgroundFetches("http://down.com/", 5);
+  EXPECT_EQ(1, host_limit("down.com"));
+  EXPECT_EQ(2, host_limit("fast.com"));
+  EXPECT_EQ(1, variable(RateController::kAdaptiveLimitDecreases));
+  EXPECT_EQ(1, throttled_hosts());
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_TRUE(fetch_vector_[i]->done());
+    EXPECT_FALSE(fetch_vector_[i]->success());
+  }
+
+  // The idle host's limit is remembered, and still applies.
+  StartBackgroundFetches("http://fast.com/", 1);
+  scheduler_.AdvanceTimeMs(kFastDelayMs);
+  EXPECT_EQ(1, host_limit("down.com"));
+  EXPECT_TRUE(fetch_vector_[5]->success());
+}
+
+TEST_F(AdaptiveRateControllingUrlAsyncFetcherTest, ListsMostThrottledFirst) {
+  StartBackgroundFetches("http://fast.com/", 1);
+  scheduler_.AdvanceTimeMs(kFastDelayMs);
+  StartBackgroundFetches("http://down.com/", 5);
+
+  RateController* controller = rate_controlling_fetcher_->rate_controller();
+  std::vector<RateController::HostLimit> limits;
+  EXPECT_EQ(2, controller->GetHostLimits(10, &limits));
+  ASSERT_EQ(2, limits.size());
+  EXPECT_EQ("down.com", limits[0].host);
+  EXPECT_EQ(1, limits[0].outgoing_limit);
+  EXPECT_EQ(-1, limits[0].baseline_latency_ms);
+  EXPECT_EQ("fast.com", limits[1].host);
+  EXPECT_EQ(2, limits[1].outgoing_limit);
+  EXPECT_EQ(static_cast<int64>(kFastDelayMs), limits[1].baseline_latency_ms);
+
+  // Only as many hosts as asked for are listed, but all are counted.
+  EXPECT_EQ(2, controller->GetHostLimits(1, &limits));
+  ASSERT_EQ(1, limits.size());
+  EXPECT_EQ("down.com", limits[0].host);
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -29,6 +29,13 @@ const int64 UrlAsyncFetcher::kUnspecifiedTimeout = 0;
 UrlAsyncFetcher::~UrlAsyncFetcher() {
 }
 
+void UrlAsyncFetcher::FetchOnSequence(const GoogleString& url,
+                                      MessageHandler* message_handler,
+                                      AsyncFetch* fetch,
+                                      Sequence* response_sequence) {
+  Fetch(url, message_handler, fetch);
+}
+
 void UrlAsyncFetcher::ShutDown() {
 }
 
@@ -126,8 +126,17 @@ bool UrlAsyncFetcherStats::SupportsHttps() const {
 void UrlAsyncFetcherStats::Fetch(const GoogleString& url,
                                  MessageHandler* message_handler,
                                  AsyncFetch* fetch) {
+  FetchOnSequence(url, message_handler, fetch, NULL);
+}
+
+void UrlAsyncFetcherStats::FetchOnSequence(const GoogleString& url,
+                                           MessageHandler* message_handler,
+                                           AsyncFetch* fetch,
+                                           Sequence* response_sequence) {
   fetch = EnableInflation(fetch);
-  base_fetcher_->Fetch(url, message_handler, new StatsAsyncFetch(this, fetch));
+  base_fetcher_->FetchOnSequence(url, message_handler,
+                                 new StatsAsyncFetch(this, fetch),
+                                 response_sequence);
 }
 
 int64 UrlAsyncFetcherStats::timeout_ms() {
@@ -1208,6 +1208,7 @@
       'dependencies': [
         '<(instaweb_root)/third_party/base64/base64.gyp:base64',
         '<(DEPTH)/base/base.gyp:base',
+        '<(DEPTH)/pagespeed/kernel.gyp:brotli',
         '<(DEPTH)/pagespeed/kernel.gyp:pagespeed_base_core',
         '<(DEPTH)/pagespeed/kernel.gyp:pagespeed_cache',
         '<(DEPTH)/pagespeed/kernel.gyp:pagespeed_http',
@@ -1346,6 +1347,7 @@
         'rewriter/downstream_cache_purger.cc',
         'rewriter/downstream_caching_directives.cc',
         'rewriter/inline_output_resource.cc',
+        'rewriter/merged_options_cache.cc',
         'rewriter/output_resource.cc',
         'rewriter/request_properties.cc',
         'rewriter/resource.cc',
@@ -1633,6 +1635,7 @@
         'rewriter/redirect_on_size_limit_filter.cc',
         'rewriter/resource_combiner.cc',
         'rewriter/resource_fetch.cc',
+        'rewriter/resource_prefetch_filter.cc',
         'rewriter/resource_slot.cc',
         'rewriter/resource_tag_scanner.cc',
         'rewriter/rewrite_context.cc',
@@ -1720,6 +1723,16 @@
         '<(DEPTH)/pagespeed/system/system_thread_system.cc',
         '<(DEPTH)/third_party/aprutil/apr_memcache2.c',
       ],
+      'conditions': [
+        ['enable_http2_fetcher == 1', {
+          'dependencies': [
+            '<(DEPTH)/build/nghttp2.gyp:nghttp2',
+          ],
+          'sources': [
+            '<(DEPTH)/pagespeed/system/http2_url_async_fetcher.cc',
+          ],
+        }]
+      ],
     },
     {
       # TODO(sligocki): Why is this called "automatic" util?
@@ -32,11 +32,13 @@
 #include "net/instaweb/rewriter/cached_result.pb.h"
 #include "net/instaweb/rewriter/public/request_properties.h"
 #include "net/instaweb/rewriter/public/resource.h"
+#include "net/instaweb/rewriter/public/resource_prefetch_filter.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
 #include "net/instaweb/rewriter/public/rewrite_options.h"
 #include "net/instaweb/rewriter/public/rewrite_stats.h"
 #include "pagespeed/kernel/base/basictypes.h"        // for int64
 #include "pagespeed/kernel/base/callback.h"
+#include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/hasher.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
@@ -83,6 +85,7 @@ class CacheableResourceBase::FetchCallbackBase : public AsyncFetchWithLock {
         rewrite_options_(rewrite_options),
         message_handler_(handler),
         no_cache_ok_(false),
+        response_sequence_(NULL),
         fetcher_(NULL),
         fallback_fetch_(NULL) {
     if (fallback_value != NULL) {
@@ -95,6 +98,9 @@ class CacheableResourceBase::FetchCallbackBase : public AsyncFetchWithLock {
   // Set this to true if implementing a kLoadEvenIfNotCacheable policy.
   void set_no_cache_ok(bool x) { no_cache_ok_ = x; }
 
+  // Passed to UrlAsyncFetcher::FetchOnSequence; NULL by default.
+  void set_response_sequence(Sequence* x) { response_sequence_ = x; }
+
  protected:
   // The two derived classes differ in how they provide the
   // fields below. LoadAndCallback updates the resource directly, while
@@ -212,7 +218,8 @@ class CacheableResourceBase::FetchCallbackBase : public AsyncFetchWithLock {
     }
     resource_->PrepareRequest(fetch->request_context(),
                               fetch->request_headers());
-    fetcher_->Fetch(fetch_url_, message_handler_, fetch);
+    fetcher_->FetchOnSequence(fetch_url_, message_handler_, fetch,
+                              response_sequence_);
   }
 
  private:
@@ -272,6 +279,8 @@ class CacheableResourceBase::FetchCallbackBase : public AsyncFetchWithLock {
   // Used to implement kLoadEvenIfNotCacheable.
   bool no_cache_ok_;
 
+  Sequence* response_sequence_;
+
   // These 2 are set only once we get to StartFetch
   UrlAsyncFetcher* fetcher_;
   GoogleString fetch_url_;
@@ -539,6 +548,7 @@ void CacheableResourceBase::LoadHttpCacheCallback::LoadAndSaveToCache() {
   if (not_cacheable_policy_ == Resource::kLoadEvenIfNotCacheable) {
     cb->set_no_cache_ok(true);
   }
+  cb->set_response_sequence(resource_callback_->response_sequence());
   cb->Start(resource_->rewrite_driver()->async_fetcher());
 }
 
@@ -706,6 +716,20 @@ void CacheableResourceBase::LoadAndCallback(
                                 callback, this);
 
   cache_callback->set_is_background(is_background_fetch());
+  ResourcePrefetchFilter* prefetcher =
+      rewrite_driver()->resource_prefetch_filter();
+  if (prefetcher == NULL) {
+    FindInHttpCache(cache_callback);
+  } else {
+    // If this resource is already being prefetched, look it up once that is
+    // done, so we find it in the cache rather than fetching it again.
+    prefetcher->RunAfterPrefetch(this, MakeFunction(
+        this, &CacheableResourceBase::FindInHttpCache, cache_callback));
+  }
+}
+
+void CacheableResourceBase::FindInHttpCache(
+    LoadHttpCacheCallback* cache_callback) {
   http_cache()->Find(cache_key(), rewrite_driver()->CacheFragment(),
                      message_handler(), cache_callback);
 }
@@ -66,10 +66,9 @@ bool CssTagScanner::ParseCssElement(
   }
   // We must have all attributes rel='stylesheet' href='name.css'; and if
   // there is a type, it must be type='text/css'. These can be in any order.
-  HtmlElement::AttributeList* attrs = element->mutable_attributes();
   bool has_href = false, has_rel_stylesheet = false;
-  for (HtmlElement::AttributeIterator i(attrs->begin());
-       i != attrs->end(); ++i) {
+  for (HtmlElement::AttributeIterator i(element->attributes_begin());
+       i != element->attributes_end(); ++i) {
     HtmlElement::Attribute& attr = *i;
     switch (attr.keyword()) {
       case HtmlName::kHref:
@@ -147,13 +147,14 @@ void DelayImagesFilter::EndElementImpl(HtmlElement* element) {
           RewriteOptions::FilterId(RewriteOptions::kDelayImages),
           RewriterApplication::APPLIED_OK);
       // Rename src -> data-pagespeed-high-res-src
-      driver()->SetAttributeName(src, HtmlName::kDataPagespeedHighResSrc);
+      driver()->SetAttributeName(element, src,
+                                 HtmlName::kDataPagespeedHighResSrc);
       // Rename srcset -> data-pagespeed-high-res-srcset
       HtmlElement::Attribute* srcset =
           element->FindAttribute(HtmlName::kSrcset);
       if (srcset != NULL) {
         driver()->SetAttributeName(
-            srcset, HtmlName::kDataPagespeedHighResSrcset);
+            element, srcset, HtmlName::kDataPagespeedHighResSrcset);
       }
       if (insert_low_res_images_inplace_) {
         // Set the src as the low resolution image.
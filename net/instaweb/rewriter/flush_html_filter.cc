@@ -19,11 +19,13 @@
 
 
 #include <memory>
+#include <vector>
 
 #include "net/instaweb/rewriter/public/common_filter.h"
 #include "net/instaweb/rewriter/public/flush_html_filter.h"
 #include "net/instaweb/rewriter/public/resource_tag_scanner.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
+#include "pagespeed/kernel/html/html_name.h"
 #include "pagespeed/kernel/http/semantic_type.h"
 
 namespace {
@@ -60,6 +62,15 @@ void FlushHtmlFilter::Flush() {
   score_ = 0;
 }
 
+bool FlushHtmlFilter::GetRelevantElements(
+    std::vector<HtmlName::Keyword>* keywords) const {
+  // CommonFilter tracks base and noscript.
+  keywords->push_back(HtmlName::kBase);
+  keywords->push_back(HtmlName::kNoscript);
+  return resource_tag_scanner::GetScannedElements(driver()->options(),
+                                                  keywords);
+}
+
 void FlushHtmlFilter::StartElementImpl(HtmlElement* element) {
   resource_tag_scanner::UrlCategoryVector attributes;
   resource_tag_scanner::ScanElement(element, driver()->options(), &attributes);
@@ -58,6 +58,7 @@
 #include "net/instaweb/util/public/property_cache.h"
 #include "pagespeed/controller/central_controller.h"
 #include "pagespeed/controller/expensive_operation_callback.h"
+#include "pagespeed/controller/expensive_operation_cost.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/escaping.h"
 #include "pagespeed/kernel/base/message_handler.h"
@@ -437,6 +438,10 @@ class ImageRewriteFilter::Context : public SingleRewriteContext {
 
   friend class ImageRewriteFilter;
 
+  // Describes the rewrite of input_resource to the central controller, so it
+  // can estimate how much CPU the rewrite will take.
+  ExpensiveOperationCost EstimateCost(const ResourcePtr& input_resource);
+
   virtual bool ScheduleViaCentralController() { return true; }
 
   int64 css_image_inline_max_bytes_;
@@ -449,6 +454,29 @@ class ImageRewriteFilter::Context : public SingleRewriteContext {
   DISALLOW_COPY_AND_ASSIGN(Context);
 };
 
+namespace {
+
+// Returns the user CPU time consumed so far by the calling thread, or -1 if
+// that can't be measured. See http://linux.die.net/man/2/getrusage --
+// RUSAGE_THREAD is supported on Linux since Linux 2.6.26.
+int64 GetThreadCpuTimeUs() {
+#ifdef RUSAGE_THREAD
+  struct rusage usage;
+  if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+    return (usage.ru_utime.tv_sec * Timer::kSecondUs) + usage.ru_utime.tv_usec;
+  }
+#endif
+  return -1;
+}
+
+// As above, but falls back to wall-clock time.
+int64 GetCurrentCpuTimeMs(Timer* timer) {
+  int64 cpu_us = GetThreadCpuTimeUs();
+  return (cpu_us >= 0) ? (cpu_us / Timer::kMsUs) : timer->NowMs();
+}
+
+}  // namespace
+
 class ImageRewriteFilter::Context::InvokeRewriteFunction
     : public ExpensiveOperationCallback {
  public:
@@ -466,8 +494,13 @@ class ImageRewriteFilter::Context::InvokeRewriteFunction
 
  protected:
   virtual void RunImpl(scoped_ptr<ExpensiveOperationContext>* context) {
+    int64 start_cpu_us = GetThreadCpuTimeUs();
     RewriteResult result = filter_->RewriteLoadedResourceImpl(
         context_, input_resource_, output_resource_);
+    // Let the controller learn what images like this one cost.
+    if (start_cpu_us >= 0) {
+      (*context)->ReportCpuUsage(GetThreadCpuTimeUs() - start_cpu_us);
+    }
     (*context)->Done();
     context_->RewriteDone(result, 0);
   }
@@ -561,9 +594,36 @@ void ImageRewriteFilter::Context::RewriteSingle(
   bool is_ipro = IsNestedIn(RewriteOptions::kInPlaceRewriteId);
   AttachDependentRequestTrace(is_ipro ? "IproProcessImage" : "ProcessImage");
   AddLinkRelCanonical(input_resource, output_resource->response_headers());
-  FindServerContext()->central_controller()->ScheduleExpensiveOperation(
-      new InvokeRewriteFunction(this, filter_, input_resource,
-                                output_resource));
+  InvokeRewriteFunction* rewrite = new InvokeRewriteFunction(
+      this, filter_, input_resource, output_resource);
+  ServerContext* server_context = FindServerContext();
+  if (server_context->estimate_expensive_operation_costs()) {
+    rewrite->set_cost(EstimateCost(input_resource));
+  }
+  server_context->central_controller()->ScheduleExpensiveOperation(rewrite);
+}
+
+ExpensiveOperationCost ImageRewriteFilter::Context::EstimateCost(
+    const ResourcePtr& input_resource) {
+  // Only the image header is parsed here, to find its format and dimensions,
+  // so this is cheap next to the rewrite itself.
+  StringPiece contents = input_resource->ExtractUncompressedContents();
+  ServerContext* server_context = FindServerContext();
+  scoped_ptr<Image> image(NewImage(
+      contents, input_resource->url(), server_context->filename_prefix(),
+      new Image::CompressionOptions(), server_context->timer(),
+      server_context->message_handler()));
+  ImageDim dims;
+  image->Dimensions(&dims);
+  int64 pixels = 0;
+  if (ImageUrlEncoder::HasValidDimensions(dims)) {
+    pixels = static_cast<int64>(dims.width()) * dims.height();
+  }
+  const ContentType* type = image->content_type();
+  return ExpensiveOperationCost(
+      StrCat(filter_->id(), ":",
+             (type == NULL) ? "unknown" : type->file_extension()),
+      contents.size(), pixels);
 }
 
 bool ImageRewriteFilter::Context::PolicyPermitsRendering() const {
@@ -1030,23 +1090,6 @@ bool ImageRewriteFilter::ShouldResize(const ResourceContext& resource_context,
   return false;
 }
 
-namespace {
-
-int64 GetCurrentCpuTimeMs(Timer* timer) {
-  // See http://linux.die.net/man/2/getrusage -- RUSAGE_THREAD is supported
-  // on Linux since Linux 2.6.26, so fall back to wall-clock time.
-#ifdef RUSAGE_THREAD
-  struct rusage start_rusage;
-  if (getrusage(RUSAGE_THREAD, &start_rusage) == 0) {
-    return ((start_rusage.ru_utime.tv_sec * 1000) +
-            (start_rusage.ru_utime.tv_usec / 1000));
-  }
-#endif
-  return timer->NowMs();
-}
-
-}  // namespace
-
 // Format as InfoAt and using TracePrintf.
 // TODO(jmaessen): Avoid formatting if neither applies.
 void ImageRewriteFilter::InfoAndTrace(
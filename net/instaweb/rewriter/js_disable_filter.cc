@@ -158,7 +158,8 @@ void JsDisableFilter::StartElementImpl(HtmlElement* element) {
       // TODO(rahulbansal): Add logging for prioritize scripts
       HtmlElement::Attribute* type = element->FindAttribute(HtmlName::kType);
       if (type != NULL) {
-        type->set_name(driver()->MakeName(HtmlName::kDataPagespeedOrigType));
+        driver()->SetAttributeName(element, type,
+                                   HtmlName::kDataPagespeedOrigType);
       }
       // Delete all type attributes if any. Some sites have more than one type
       // attribute(duplicate). Chrome and firefox picks up the first type
@@ -191,7 +192,8 @@ void JsDisableFilter::StartElementImpl(HtmlElement* element) {
     // TODO(ksimbili): Call onloads on elements in the same order as they are
     // triggered.
     // See the test file js_defer_onload_in_html.html
-    onload->set_name(driver()->MakeName("data-pagespeed-onload"));
+    element->SetAttributeName(onload,
+                              driver()->MakeName("data-pagespeed-onload"));
     driver()->AddEscapedAttribute(element, HtmlName::kOnload,
                                   kElementOnloadCode);
     // TODO(sligocki): Should we add onerror handler here too?
@@ -290,12 +290,14 @@ void LazyloadImagesFilter::EndElementImpl(HtmlElement* element) {
     InsertLazyloadJsCode(element);
   }
   // Replace the src with data-pagespeed-lazy-src.
-  driver()->SetAttributeName(src, HtmlName::kDataPagespeedLazySrc);
+  driver()->SetAttributeName(element, src,
+                             HtmlName::kDataPagespeedLazySrc);
   // Rename srcset -> data-pagespeed-high-res-srcset
   HtmlElement::Attribute* srcset =
       element->FindAttribute(HtmlName::kSrcset);
   if (srcset != NULL) {
-    driver()->SetAttributeName(srcset, HtmlName::kDataPagespeedLazySrcset);
+    driver()->SetAttributeName(element, srcset,
+                               HtmlName::kDataPagespeedLazySrcset);
   }
   driver()->AddAttribute(element, HtmlName::kSrc, blank_image_url_);
   log_record->LogLazyloadFilter(
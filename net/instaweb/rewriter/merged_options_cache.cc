@@ -0,0 +1,98 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "net/instaweb/rewriter/public/merged_options_cache.h"
+
+#include "net/instaweb/rewriter/public/rewrite_options.h"
+#include "pagespeed/kernel/base/thread_system.h"
+
+namespace net_instaweb {
+
+MergedOptionsCache::Entry::Entry(RewriteOptions* options)
+    : options_(options) {
+}
+
+MergedOptionsCache::Entry::~Entry() {
+}
+
+MergedOptionsCache::MergedOptionsCache(size_t max_bytes,
+                                       ThreadSystem* thread_system)
+    : mutex_(thread_system->NewMutex()),
+      lru_(max_bytes, &helper_),
+      generation_(0) {
+}
+
+MergedOptionsCache::~MergedOptionsCache() {
+}
+
+RewriteOptions* MergedOptionsCache::Lookup(const GoogleString& key) {
+  EntryPtr entry;
+  {
+    ScopedMutex lock(mutex_.get());
+    EntryPtr* found = lru_.GetFreshen(key);
+    if (found == NULL) {
+      return NULL;
+    }
+    entry = *found;
+  }
+  // Clone outside the lock; concurrent Clones of a frozen RewriteOptions
+  // only read it.
+  return entry->options().Clone();
+}
+
+int64 MergedOptionsCache::generation() const {
+  ScopedMutex lock(mutex_.get());
+  return generation_;
+}
+
+void MergedOptionsCache::Insert(const GoogleString& key,
+                                const RewriteOptions& options,
+                                int64 generation) {
+  RewriteOptions* copy = options.Clone();
+  copy->Freeze();
+  EntryPtr entry(new Entry(copy));
+  ScopedMutex lock(mutex_.get());
+  if (generation == generation_) {
+    lru_.Put(key, entry);
+  }
+}
+
+void MergedOptionsCache::Clear() {
+  ScopedMutex lock(mutex_.get());
+  lru_.Clear();
+  ++generation_;
+}
+
+size_t MergedOptionsCache::num_hits() const {
+  ScopedMutex lock(mutex_.get());
+  return lru_.num_hits();
+}
+
+size_t MergedOptionsCache::num_misses() const {
+  ScopedMutex lock(mutex_.get());
+  return lru_.num_misses();
+}
+
+size_t MergedOptionsCache::num_elements() const {
+  ScopedMutex lock(mutex_.get());
+  return lru_.num_elements();
+}
+
+}  // namespace net_instaweb
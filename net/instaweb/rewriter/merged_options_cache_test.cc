@@ -0,0 +1,101 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "net/instaweb/rewriter/public/merged_options_cache.h"
+
+#include "net/instaweb/rewriter/public/rewrite_options.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/null_thread_system.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class MergedOptionsCacheTest : public testing::Test {
+ protected:
+  MergedOptionsCacheTest()
+      : cache_(2 * MergedOptionsCache::kEntryOverheadBytes + 100,
+               &thread_system_) {
+    RewriteOptions::Initialize();
+  }
+
+  ~MergedOptionsCacheTest() {
+    RewriteOptions::Terminate();
+  }
+
+  void InsertWithFilter(const GoogleString& key,
+                        RewriteOptions::Filter filter) {
+    RewriteOptions options(&thread_system_);
+    options.EnableFilter(filter);
+    cache_.Insert(key, options, cache_.generation());
+  }
+
+  NullThreadSystem thread_system_;
+  MergedOptionsCache cache_;
+};
+
+TEST_F(MergedOptionsCacheTest, LookupReturnsMutableClone) {
+  EXPECT_TRUE(cache_.Lookup("a") == NULL);
+  InsertWithFilter("a", RewriteOptions::kCombineCss);
+
+  scoped_ptr<RewriteOptions> first(cache_.Lookup("a"));
+  ASSERT_TRUE(first.get() != NULL);
+  EXPECT_FALSE(first->frozen());
+  EXPECT_TRUE(first->Enabled(RewriteOptions::kCombineCss));
+
+  // Mutating one clone does not affect the cached copy.
+  first->DisableFilter(RewriteOptions::kCombineCss);
+  scoped_ptr<RewriteOptions> second(cache_.Lookup("a"));
+  ASSERT_TRUE(second.get() != NULL);
+  EXPECT_TRUE(second->Enabled(RewriteOptions::kCombineCss));
+  EXPECT_EQ(2U, cache_.num_hits());
+  EXPECT_EQ(1U, cache_.num_misses());
+}
+
+TEST_F(MergedOptionsCacheTest, EvictsLeastRecentlyUsed) {
+  InsertWithFilter("a", RewriteOptions::kCombineCss);
+  InsertWithFilter("b", RewriteOptions::kExtendCacheCss);
+  delete cache_.Lookup("a");
+  InsertWithFilter("c", RewriteOptions::kRewriteCss);
+  EXPECT_EQ(2U, cache_.num_elements());
+  EXPECT_TRUE(cache_.Lookup("b") == NULL);
+  delete cache_.Lookup("a");
+  delete cache_.Lookup("c");
+  EXPECT_EQ(3U, cache_.num_hits());
+
+  cache_.Clear();
+  EXPECT_EQ(0U, cache_.num_elements());
+}
+
+TEST_F(MergedOptionsCacheTest, InsertAfterClearIsDropped) {
+  // Options merged before a Clear may be stale, so they are not cached.
+  int64 generation = cache_.generation();
+  cache_.Clear();
+  RewriteOptions options(&thread_system_);
+  cache_.Insert("a", options, generation);
+  EXPECT_EQ(0U, cache_.num_elements());
+  cache_.Insert("a", options, cache_.generation());
+  EXPECT_EQ(1U, cache_.num_elements());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -117,6 +117,9 @@ class CacheableResourceBase : public Resource {
   // before updating the resource
   bool IsValidAndCacheableImpl(const ResponseHeaders& headers) const;
 
+  // Second half of LoadAndCallback.
+  void FindInHttpCache(LoadHttpCacheCallback* cache_callback);
+
   Timer* timer() const { return server_context()->timer(); }
   MessageHandler* message_handler() const {
     return server_context()->message_handler();
@@ -21,8 +21,11 @@
 #ifndef NET_INSTAWEB_REWRITER_PUBLIC_FLUSH_HTML_FILTER_H_
 #define NET_INSTAWEB_REWRITER_PUBLIC_FLUSH_HTML_FILTER_H_
 
+#include <vector>
+
 #include "net/instaweb/rewriter/public/common_filter.h"
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/html/html_name.h"
 
 namespace net_instaweb {
 
@@ -41,6 +44,8 @@ class FlushHtmlFilter : public CommonFilter {
   virtual void StartElementImpl(HtmlElement* element);
   virtual void EndElementImpl(HtmlElement* element);
   virtual void Flush();
+  virtual bool GetRelevantElements(
+      std::vector<HtmlName::Keyword>* keywords) const;
 
   virtual const char* Name() const { return "FlushHtmlFilter"; }
 
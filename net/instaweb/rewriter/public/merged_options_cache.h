@@ -0,0 +1,120 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef NET_INSTAWEB_REWRITER_PUBLIC_MERGED_OPTIONS_CACHE_H_
+#define NET_INSTAWEB_REWRITER_PUBLIC_MERGED_OPTIONS_CACHE_H_
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/cache/lru_cache_base.h"
+
+namespace net_instaweb {
+
+class RewriteOptions;
+class ThreadSystem;
+
+// Bounded, thread-safe LRU cache of merged RewriteOptions, keyed by the
+// signature of the base options and the RewriteOptions::MergeKey of the
+// overrides merged onto it.  Requests that carry the same
+// overrides (e.g. the same PageSpeedFilters query-param) can then Clone the
+// cached result rather than merging the global options again.
+//
+// Cached options are frozen and shared between lookups; Lookup hands each
+// caller its own mutable Clone, which shares the expensive members
+// (DomainLawyer, wildcard groups, ...) via CopyOnWrite.
+class MergedOptionsCache {
+ public:
+  // Each entry is charged for its key plus this many bytes against
+  // max_bytes.  This is a rough estimate of a RewriteOptions object, which
+  // is mostly fixed-size.
+  static const size_t kEntryOverheadBytes = 16 * 1024;
+
+  MergedOptionsCache(size_t max_bytes, ThreadSystem* thread_system);
+  ~MergedOptionsCache();
+
+  // Returns a new Clone of the options cached under key, or NULL if there
+  // are none.  The caller takes ownership.
+  RewriteOptions* Lookup(const GoogleString& key);
+
+  // Returns the number of times Clear has been called.  Read this before
+  // merging the options to Insert.
+  int64 generation() const;
+
+  // Caches a frozen Clone of options under key, unless Clear has been
+  // called since generation was read: options merged from base options
+  // that have since changed must not be cached.
+  void Insert(const GoogleString& key, const RewriteOptions& options,
+              int64 generation);
+
+  // Drops all entries.  Call this when the base options change in a way
+  // not reflected in the key, e.g. a cache purge.
+  void Clear();
+
+  size_t num_hits() const;
+  size_t num_misses() const;
+  size_t num_elements() const;
+
+ private:
+  // Owns a frozen RewriteOptions, so that a lookup can release the cache
+  // mutex before cloning.
+  class Entry : public RefCounted<Entry> {
+   public:
+    explicit Entry(RewriteOptions* options);
+    ~Entry();
+
+    const RewriteOptions& options() const { return *options_; }
+
+   private:
+    scoped_ptr<RewriteOptions> options_;
+    DISALLOW_COPY_AND_ASSIGN(Entry);
+  };
+  typedef RefCountedPtr<Entry> EntryPtr;
+
+  class EntryHelper {
+   public:
+    size_t size(const EntryPtr& entry) const { return kEntryOverheadBytes; }
+    bool Equal(const EntryPtr& a, const EntryPtr& b) const {
+      return a.get() == b.get();
+    }
+    void EvictNotify(const EntryPtr& entry) {}
+    bool ShouldReplace(const EntryPtr& old_entry,
+                       const EntryPtr& new_entry) const {
+      return true;
+    }
+  };
+  typedef LRUCacheBase<EntryPtr, EntryHelper> Lru;
+
+  EntryHelper helper_;
+  scoped_ptr<AbstractMutex> mutex_;
+  Lru lru_ GUARDED_BY(mutex_);
+  int64 generation_ GUARDED_BY(mutex_);
+
+  DISALLOW_COPY_AND_ASSIGN(MergedOptionsCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // NET_INSTAWEB_REWRITER_PUBLIC_MERGED_OPTIONS_CACHE_H_
@@ -51,6 +51,7 @@ class InputInfo;
 class MessageHandler;
 class Resource;
 class RewriteDriver;
+class Sequence;
 class ServerContext;
 
 typedef RefCountedPtr<Resource> ResourcePtr;
@@ -225,6 +226,12 @@ class Resource : public RefCounted<Resource> {
     virtual ~AsyncCallback();
     virtual void Done(bool lock_failure, bool resource_ok) = 0;
 
+    // Returns NULL by default.  Subclasses whose Done hands its work to a
+    // Sequence can return it, so that a fetch needed to load the resource
+    // delivers its response there rather than on the fetcher's thread.
+    // Done may still be called on any thread.
+    virtual Sequence* response_sequence() { return NULL; }
+
     const ResourcePtr& resource() { return resource_; }
 
    private:
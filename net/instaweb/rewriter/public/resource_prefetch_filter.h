@@ -0,0 +1,130 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef NET_INSTAWEB_REWRITER_PUBLIC_RESOURCE_PREFETCH_FILTER_H_
+#define NET_INSTAWEB_REWRITER_PUBLIC_RESOURCE_PREFETCH_FILTER_H_
+
+#include <map>
+#include <vector>
+
+#include "net/instaweb/rewriter/public/common_filter.h"
+#include "net/instaweb/rewriter/public/resource.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/html/html_name.h"
+#include "pagespeed/kernel/http/semantic_type.h"
+
+namespace net_instaweb {
+
+class AbstractMutex;
+class Function;
+class HtmlElement;
+class RewriteDriver;
+class Statistics;
+class Variable;
+
+// This filter is run immediately after lexing, like FlushHtmlFilter.  It
+// starts loading the stylesheets, scripts and images that the enabled
+// rewriters will want as soon as their elements are lexed, so the HTTP cache
+// lookups and origin fetches overlap with the rest of the parse rather than
+// starting when a RewriteContext is initiated in that element's flush window.
+//
+// When the metadata cache has a page's rewrites, their inputs are never
+// loaded, so loading them early would only add work.  Prefetching therefore
+// starts once one of the document's rewrites misses in the metadata cache,
+// and covers the resources lexed since the last flush and those lexed later.
+// Resources in flushed windows are left to their own rewrites.
+//
+// A CacheableResourceBase load of a resource that is being prefetched waits
+// for the prefetch, via RunAfterPrefetch, and then finds the result in the
+// HTTP cache rather than fetching it a second time.
+class ResourcePrefetchFilter : public CommonFilter {
+ public:
+  static const char kResourcePrefetches[];
+  static const char kResourcePrefetchWaits[];
+
+  explicit ResourcePrefetchFilter(RewriteDriver* driver);
+  virtual ~ResourcePrefetchFilter();
+
+  static void InitStats(Statistics* statistics);
+
+  virtual void StartDocumentImpl();
+  virtual void StartElementImpl(HtmlElement* element);
+  virtual void EndElementImpl(HtmlElement* element) {}
+  virtual bool GetRelevantElements(
+      std::vector<HtmlName::Keyword>* keywords) const;
+
+  virtual const char* Name() const { return "ResourcePrefetch"; }
+
+  // Runs callback once any prefetch of the resource's cache key has
+  // completed, or immediately if there is none or it is resource's own load.
+  // May be called from any thread.
+  void RunAfterPrefetch(const Resource* resource, Function* callback);
+
+  // Called as the driver starts the rewrites of a flush window, which load
+  // their own inputs.
+  void FlushStarted();
+
+  // Called when one of this document's rewrites misses in the metadata
+  // cache; starts the prefetches held back so far.  May be called from any
+  // thread.
+  void MetadataCacheMissed();
+
+ private:
+  class PrefetchCallback;
+
+  struct Prefetch {
+    Prefetch() : resource(NULL) {}
+
+    const Resource* resource;
+    std::vector<Function*> waiters;
+  };
+  typedef std::map<GoogleString, Prefetch> PrefetchMap;
+
+  // Returns true if an enabled rewriter loads resources of this category.
+  bool ShouldPrefetch(semantic_type::Category category) const;
+  void StartPrefetch(semantic_type::Category category, StringPiece url);
+  void LoadResource(const ResourcePtr& resource);
+  void PrefetchDone(const GoogleString& cache_key);
+
+  scoped_ptr<AbstractMutex> mutex_;
+  PrefetchMap in_flight_ GUARDED_BY(mutex_);
+
+  // Whether a rewrite of this document has missed in the metadata cache, and
+  // the resources lexed since the last flush that are waiting for one to.
+  bool metadata_cache_missed_ GUARDED_BY(mutex_);
+  std::vector<ResourcePtr> held_back_ GUARDED_BY(mutex_);
+
+  // URLs seen in this document, so repeated references are skipped.  Only
+  // accessed from the HTML thread.
+  StringSet seen_urls_;
+
+  Variable* prefetches_;
+  Variable* prefetch_waits_;
+
+  DISALLOW_COPY_AND_ASSIGN(ResourcePrefetchFilter);
+};
+
+}  // namespace net_instaweb
+
+#endif  // NET_INSTAWEB_REWRITER_PUBLIC_RESOURCE_PREFETCH_FILTER_H_
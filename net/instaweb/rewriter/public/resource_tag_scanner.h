@@ -26,6 +26,7 @@
 #include <vector>
 
 #include "pagespeed/kernel/html/html_element.h"
+#include "pagespeed/kernel/html/html_name.h"
 #include "pagespeed/kernel/http/semantic_type.h"
 
 namespace net_instaweb {
@@ -133,6 +134,13 @@ semantic_type::Category CategorizeAttribute(
 void ScanElement(HtmlElement* element, const RewriteOptions* options,
                  UrlCategoryVector* attributes);
 
+// Appends to *keywords every element for which ScanElement can return a
+// url-valued attribute, for use in HtmlFilter::GetRelevantElements.  Returns
+// false if options declare url-valued attributes on an element that isn't
+// an HtmlName keyword, as no keyword list can then cover them.
+bool GetScannedElements(const RewriteOptions* options,
+                        std::vector<HtmlName::Keyword>* keywords);
+
 }  // namespace resource_tag_scanner
 }  // namespace net_instaweb
 
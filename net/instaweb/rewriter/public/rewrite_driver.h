@@ -89,8 +89,10 @@ class FileSystem;
 class FlushEarlyInfo;
 class HtmlWriterFilter;
 class MessageHandler;
+class PipelinedWriter;
 class RequestProperties;
 class RequestTrace;
+class ResourcePrefetchFilter;
 class RewriteDriverPool;
 class RewriteFilter;
 class Statistics;
@@ -959,6 +961,10 @@ class RewriteDriver : public HtmlParse {
   // Such tasks are expected to be safely cancelable.
   void AddLowPriorityRewriteTask(Function* task);
 
+  // As above, but the task is canceled if it has not started running within
+  // timeout_us, typically because whoever wanted its result stopped waiting.
+  void AddLowPriorityRewriteTaskWithTimeout(Function* task, int64 timeout_us);
+
   QueuedWorkerPool::Sequence* html_worker() { return html_worker_; }
   Sequence* rewrite_worker();
   Scheduler::Sequence* scheduler_sequence() {
@@ -969,6 +975,13 @@ class RewriteDriver : public HtmlParse {
     return low_priority_rewrite_worker_;
   }
 
+  // Sets the priority with which tasks queued by AddRewriteTask and
+  // AddLowPriorityRewriteTask compete with those of other drivers for
+  // worker threads.  HTML rewriting and user-facing resource fetches are
+  // kDeadlineCritical, and work that continues after nobody is waiting on
+  // it is kBackground.  Reset to kNormal when the driver is recycled.
+  void SetRewritePriority(QueuedWorkerPool::Priority priority);
+
   // Make the rewrite_worker tasks run on the request thread.  This
   // must be called immediately after initializing the driver, before
   // it starts processing the request.
@@ -1163,6 +1176,12 @@ class RewriteDriver : public HtmlParse {
     return dom_stats_filter_;
   }
 
+  // Returns the event listener that prefetches subresources during lexing, or
+  // NULL if prefetch_resources_on_lex is off.
+  ResourcePrefetchFilter* resource_prefetch_filter() const {
+    return resource_prefetch_filter_;
+  }
+
   // Determines whether the system is healthy enough to rewrite resources.
   // Currently, systems get sick based on the health of the metadata cache.
   bool can_rewrite_resources() const { return can_rewrite_resources_; }
@@ -1316,8 +1335,13 @@ class RewriteDriver : public HtmlParse {
   // Called as part of implementation of FinishParseAsync, after the
   // flush is complete.
   void QueueFinishParseAfterFlush(Function* user_callback);
+  void QueueFinishParseAfterDrain(Function* user_callback);
   void FinishParseAfterFlush(Function* user_callback);
 
+  // If output is pipelined, blocks until the output worker has delivered
+  // everything written so far.
+  void DrainPipelinedOutput();
+
   bool RewritesComplete() const EXCLUSIVE_LOCKS_REQUIRED(rewrite_mutex());
 
   // Sets the base GURL in response to a base-tag being parsed.  This
@@ -1646,6 +1670,7 @@ class RewriteDriver : public HtmlParse {
   std::vector<UrlAsyncFetcher*> owned_url_async_fetchers_;
 
   DomStatsFilter* dom_stats_filter_;
+  ResourcePrefetchFilter* resource_prefetch_filter_;  // Owned by HtmlParse.
   scoped_ptr<HtmlWriterFilter> html_writer_filter_;
 
   ScanFilter scan_filter_;
@@ -1690,8 +1715,12 @@ class RewriteDriver : public HtmlParse {
   QueuedWorkerPool::Sequence* rewrite_worker_;
   QueuedWorkerPool::Sequence* low_priority_rewrite_worker_;
   scoped_ptr<Scheduler::Sequence> scheduler_sequence_;
+  // Delivers flushed output to the downstream writer when
+  // pipeline_html_output is on; allocated on first use.
+  QueuedWorkerPool::Sequence* output_worker_;
 
   Writer* writer_;
+  scoped_ptr<PipelinedWriter> pipelined_writer_;
 
   // Stores any cached properties associated with the current URL and fallback
   // URL (i.e. without query params).
@@ -382,6 +382,14 @@ class RewriteDriverFactory {
   // QueuedWorkerPool::set_load_shedding_threshold
   virtual int LowPriorityLoadSheddingThreshold() const;
 
+  // Subclasses can override this method to request queue-time-based load
+  // shedding in the low-priority work pool: once work there has been
+  // waiting longer than the returned number of milliseconds for a sustained
+  // period, it will start getting dropped.  The default implementation
+  // returns 0, which disables the feature.  See also
+  // QueuedWorkerPool::EnableQueueTimeShedding.
+  virtual int64 LowPriorityQueueTimeTargetMs() const;
+
   // Subclasses can override this to create an appropriate Scheduler
   // subclass if the default isn't acceptable.
   virtual Scheduler* CreateScheduler();
@@ -33,8 +33,26 @@ class RewriteOptions;
 // A class for managing recycling of RewriteDrivers with standard options.
 // Note that this class by itself is not threadsafe, as ServerContext
 // takes care of that.
+//
+// The number of drivers retained adapts to recent demand: every
+// kAdaptationPeriod calls to PopDriver, the pool resizes itself to the peak
+// number of simultaneously outstanding drivers seen during the previous
+// period, bounded by [min_target_size(), kMaxDriversInPool].  Idle drivers
+// beyond that are deleted rather than retained.
 class RewriteDriverPool  {
  public:
+  // Don't allow more than this many drivers in the pool. The pool is an
+  // optimisation to save the cost of constructing a RewriteDriver, but keeping
+  // a lot of them lying around winds up wasting a lot of memory instead.
+  static const int kMaxDriversInPool = 50;
+
+  // Always allow at least this many drivers to be retained, so that a server
+  // that is mostly idle doesn't construct a driver for every request.
+  static const int kMinDriversInPool = 2;
+
+  // Number of PopDriver calls between recomputations of the target size.
+  static const int kAdaptationPeriod = 100;
+
   RewriteDriverPool();
 
   // Deletes all drivers in the pool.
@@ -42,19 +60,46 @@ class RewriteDriverPool  {
 
   virtual const RewriteOptions* TargetOptions() const = 0;
 
-  // Return a driver from freelist, or NULL.
+  // Return a driver from freelist, or NULL.  Drivers whose options no longer
+  // match TargetOptions() are deleted rather than returned.  If NULL is
+  // returned the caller is expected to construct a new driver controlled by
+  // this pool, and to eventually pass it to RecycleDriver.
   RewriteDriver* PopDriver();
 
-  // Stores the driver on freelist, and Clear()s it for reuse.
+  // Stores the driver on freelist, and Clear()s it for reuse, unless the pool
+  // already holds as many drivers as recent demand calls for, in which case
+  // the driver is deleted.
   void RecycleDriver(RewriteDriver* driver);
 
+  // Number of drivers currently idle in the pool.
+  int num_idle_drivers() const { return drivers_.size(); }
+
+  // Number of drivers handed out by PopDriver (or constructed after a NULL
+  // return) that have not yet been recycled.
+  int num_outstanding_drivers() const { return num_outstanding_; }
+
+  // The maximum number of drivers, idle plus outstanding, that the pool
+  // currently aims to keep alive.
+  int target_size() const { return target_size_; }
+
+  // The size below which the pool never shrinks, kMinDriversInPool unless
+  // raised, as ServerContext::WarmRewriteDriverPool does so that the drivers
+  // it constructs outlive the first adaptation period.  Clamped to
+  // [kMinDriversInPool, kMaxDriversInPool].
+  int min_target_size() const { return min_target_size_; }
+  void set_min_target_size(int x);
+
  private:
-  std::vector<RewriteDriver*> drivers_;
+  // Recomputes target_size_ from the peak demand of the period just ended,
+  // and deletes idle drivers in excess of it.
+  void Adapt();
 
-  // Don't allow more than this many drivers in the pool. The pool is an
-  // optimisation to save the cost of constructing a RewriteDriver, but keeping
-  // a lot of them lying around winds up wasting a lot of memory instead.
-  static const int kMaxDriversInPool = 50;
+  std::vector<RewriteDriver*> drivers_;
+  int num_outstanding_;
+  int peak_outstanding_;
+  int target_size_;
+  int pops_since_adapt_;
+  int min_target_size_;
 
   DISALLOW_COPY_AND_ASSIGN(RewriteDriverPool);
 };
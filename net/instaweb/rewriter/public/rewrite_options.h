@@ -301,6 +301,7 @@ class RewriteOptions {
   static const char kHideRefererUsingMeta[];
   static const char kHttpCacheCompressionLevel[];
   static const char kHonorCsp[];
+  static const char kHtmlPassthrough[];
   static const char kIdleFlushTimeMs[];
   static const char kImageInlineMaxBytes[];
   // TODO(huibao): Unify terminology for image rewrites. For example,
@@ -366,6 +367,8 @@ class RewriteOptions {
   static const char kObliviousPagespeedUrls[];
   static const char kOptionCookiesDurationMs[];
   static const char kOverrideCachingTtlMs[];
+  static const char kPipelineHtmlOutput[];
+  static const char kPrefetchResourcesOnLex[];
   static const char kPreserveSubresourceHints[];
   static const char kPreserveUrlRelativity[];
   static const char kPrivateNotVaryForIE[];
@@ -390,6 +393,7 @@ class RewriteOptions {
   static const char kServeStaleIfFetchError[];
   static const char kServeStaleWhileRevalidateThresholdSec[];
   static const char kServeXhrAccessControlHeaders[];
+  static const char kShedFetchRewritesAtDeadline[];
   static const char kStickyQueryParameters[];
   static const char kSupportNoScriptEnabled[];
   static const char kTestOnlyPrioritizeCriticalCssDontApplyOriginalCss[];
@@ -2711,6 +2715,34 @@ class RewriteOptions {
     set_option(x, &honor_csp_);
   }
 
+  bool html_passthrough() const {
+    return html_passthrough_.value();
+  }
+  void set_html_passthrough(bool x) {
+    set_option(x, &html_passthrough_);
+  }
+
+  bool pipeline_html_output() const {
+    return pipeline_html_output_.value();
+  }
+  void set_pipeline_html_output(bool x) {
+    set_option(x, &pipeline_html_output_);
+  }
+
+  bool shed_fetch_rewrites_at_deadline() const {
+    return shed_fetch_rewrites_at_deadline_.value();
+  }
+  void set_shed_fetch_rewrites_at_deadline(bool x) {
+    set_option(x, &shed_fetch_rewrites_at_deadline_);
+  }
+
+  bool prefetch_resources_on_lex() const {
+    return prefetch_resources_on_lex_.value();
+  }
+  void set_prefetch_resources_on_lex(bool x) {
+    set_option(x, &prefetch_resources_on_lex_);
+  }
+
   virtual bool DisableDomainRewrite() const { return false; }
 
   // Merge src into 'this'.  Generally, options that are explicitly
@@ -2965,6 +2997,17 @@ class RewriteOptions {
     return signature_;
   }
 
+  // Returns a key for what Merge copies from these options onto a base: the
+  // explicitly enabled, disabled and forbidden filters, every option that was
+  // set, including those the signature omits, and the non-Option part of the
+  // signature.  Merging options with equal keys onto the same base gives
+  // equal results.  Returns an empty string if the options carry state the
+  // key does not describe, such as experiment specs or resource headers.
+  //
+  // This is cheaper than ComputeSignature, which checks Enabled() for every
+  // filter, and does not freeze the options.
+  GoogleString MergeKey() LOCKS_EXCLUDED(cache_purge_mutex_.get());
+
   virtual GoogleString OptionsToString() const;
   GoogleString FilterSetToString(const FilterSet& filter_set) const;
   GoogleString EnabledFiltersToString() const;
@@ -3362,6 +3405,12 @@ class RewriteOptions {
   // option/filter merging, and then performed after option/filter merging.
   enum MergeOverride { kNoAction, kDisablePreserve, kDisableFilter };
 
+  // Appends the part of the signature that does not come from filters or
+  // Options: the DomainLawyer, the wildcard groups, the global invalidation
+  // timestamp and SubclassSignatureLockHeld().
+  void AppendNonOptionSignatureLockHeld(GoogleString* signature)
+      SHARED_LOCKS_REQUIRED(cache_purge_mutex_);
+
   static Properties* properties_;          // from RewriteOptions only
   static Properties* all_properties_;      // includes subclass properties
 
@@ -4126,6 +4175,25 @@ class RewriteOptions {
   // Whether our CSP support is on or not.
   Option<bool> honor_csp_;
 
+  // Whether the HTML lexer may forward tags that no enabled filter cares
+  // about as raw characters.
+  Option<bool> html_passthrough_;
+
+  // Whether flushed HTML is delivered downstream on a separate sequence,
+  // overlapping with parsing and filtering of the next flush window.  Only
+  // output is pipelined: lexing and filtering still run in turn on the html
+  // worker.
+  Option<bool> pipeline_html_output_;
+
+  // Whether a .pagespeed. fetch's rewrite is dropped, rather than left to
+  // finish in the background, if it has not started by the fetch deadline.
+  Option<bool> shed_fetch_rewrites_at_deadline_;
+
+  // Whether subresources start loading as soon as the lexer sees them,
+  // ahead of the rewrite contexts that will use them, once a rewrite on the
+  // page has missed in the metadata cache.
+  Option<bool> prefetch_resources_on_lex_;
+
   // If set, how to fragment the http cache.  Otherwise the server's hostname,
   // from the Host header, is used.
   CacheFragmentOption cache_fragment_;
@@ -27,6 +27,7 @@
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
 
 namespace net_instaweb {
 
@@ -119,6 +120,25 @@ class RewriteStats {
   // HTML rewrite latency in ms.
   Histogram* rewrite_latency_histogram() { return rewrite_latency_histogram_; }
   Histogram* backend_latency_histogram() { return backend_latency_histogram_; }
+  // Time sequences of the given priority spend waiting for a worker thread,
+  // in microseconds.
+  Histogram* worker_queue_time_histogram(QueuedWorkerPool::Priority priority) {
+    return worker_queue_time_histograms_[priority];
+  }
+  // Time functions spend queued in low-priority rewrite sequences, in
+  // microseconds, whether they are then run or shed.
+  Histogram* low_priority_sojourn_time_histogram() {
+    return low_priority_sojourn_time_histogram_;
+  }
+  // Number of queued functions canceled by worker pools, by reason.
+  Variable* worker_functions_shed(QueuedWorkerPool::ShedReason reason) {
+    return worker_functions_shed_[reason];
+  }
+  // Microseconds pinned worker threads have spent running functions, indexed
+  // by CPU; see QueuedWorkerPool::EnableCoreAffinity.
+  const std::vector<Variable*>& worker_cpu_busy_times() const {
+    return worker_cpu_busy_times_;
+  }
 
   // Number of .pagespeed. resources fetched.
   TimedVariable* total_fetch_count() { return total_fetch_count_; }
@@ -134,6 +154,15 @@ class RewriteStats {
   TimedVariable* num_rewrites_executed() { return num_rewrites_executed_; }
   TimedVariable* num_rewrites_dropped() { return num_rewrites_dropped_; }
 
+  // Number of RewriteDrivers constructed, whether pooled or custom.
+  TimedVariable* num_rewrite_drivers_constructed() {
+    return num_rewrite_drivers_constructed_;
+  }
+  // Requests for a pooled RewriteDriver satisfied by recycling an idle
+  // driver, and those that required constructing one.
+  Variable* rewrite_driver_pool_hits() { return rewrite_driver_pool_hits_; }
+  Variable* rewrite_driver_pool_misses() { return rewrite_driver_pool_misses_; }
+
  private:
   Variable* cached_output_hits_;
   Variable* cached_output_missed_deadline_;
@@ -159,16 +188,23 @@ class RewriteStats {
   Variable* ipro_not_rewritable_;
   Variable* downstream_cache_purge_attempts_;
   Variable* successful_downstream_cache_purges_;
+  Variable* rewrite_driver_pool_hits_;
+  Variable* rewrite_driver_pool_misses_;
 
   Histogram* beacon_timings_ms_histogram_;
   Histogram* fetch_latency_histogram_;
   Histogram* rewrite_latency_histogram_;
   Histogram* backend_latency_histogram_;
+  Histogram* low_priority_sojourn_time_histogram_;
+  Histogram* worker_queue_time_histograms_[QueuedWorkerPool::kNumPriorities];
+  Variable* worker_functions_shed_[QueuedWorkerPool::kNumShedReasons];
+  std::vector<Variable*> worker_cpu_busy_times_;
 
   TimedVariable* total_fetch_count_;
   TimedVariable* total_rewrite_count_;
   TimedVariable* num_rewrites_executed_;
   TimedVariable* num_rewrites_dropped_;
+  TimedVariable* num_rewrite_drivers_constructed_;
 
   std::vector<Waveform*> thread_queue_depths_;
 
@@ -21,7 +21,10 @@
 #ifndef NET_INSTAWEB_REWRITER_PUBLIC_SCAN_FILTER_H_
 #define NET_INSTAWEB_REWRITER_PUBLIC_SCAN_FILTER_H_
 
+#include <vector>
+
 #include "pagespeed/kernel/html/empty_html_filter.h"
+#include "pagespeed/kernel/html/html_name.h"
 
 namespace net_instaweb {
 
@@ -53,6 +56,9 @@ class ScanFilter : public EmptyHtmlFilter {
   virtual void Characters(HtmlCharactersNode* characters);
   virtual void Directive(HtmlDirectiveNode* directive);
   virtual void Flush();
+  // Base, meta, and every element resource_tag_scanner can find urls in.
+  virtual bool GetRelevantElements(
+      std::vector<HtmlName::Keyword>* keywords) const;
 
   virtual const char* Name() const { return "Scan"; }
 
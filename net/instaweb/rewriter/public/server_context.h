@@ -66,6 +66,7 @@ class RequestProperties;
 class ExperimentMatcher;
 class FileSystem;
 class GoogleUrl;
+class MergedOptionsCache;
 class MessageHandler;
 class NamedLock;
 class NamedLockManager;
@@ -386,6 +387,21 @@ class ServerContext {
                                    RewriteOptions* domain_options,
                                    RewriteOptions* query_options);
 
+  // GetCustomOptions can cache the result of merging query options into
+  // frozen global_options(), keyed by the global signature and the query
+  // options' MergeKey.  This sets the size of that cache; 0, the default,
+  // disables it.  Should be called before request processing starts.
+  void set_merged_options_cache_bytes(size_t max_bytes);
+
+  // Drops the merged options cached by GetCustomOptions.  This must be
+  // called whenever global_options() change in a way that is not reflected
+  // in their signature, such as an update to the cache PurgeSet.
+  void ClearMergedOptionsCache();
+
+  MergedOptionsCache* merged_options_cache() {
+    return merged_options_cache_.get();
+  }
+
   // Returns the RewriteOptions signature hash.
   // Returns empty string if RewriteOptions is NULL.
   GoogleString GetRewriteOptionsSignatureHash(const RewriteOptions* options);
@@ -405,6 +421,14 @@ class ServerContext {
   RewriteDriver* NewRewriteDriverFromPool(
       RewriteDriverPool* pool, const RequestContextPtr& request_ctx);
 
+  // Pre-constructs up to num_drivers drivers with the global options and
+  // parks them in the standard pool, so that the first burst of requests
+  // after startup doesn't pay for driver construction.  The pool's floor is
+  // raised to match, so it keeps them rather than shrinking back to
+  // RewriteDriverPool::kMinDriversInPool once it adapts.  Must be called
+  // after the server context is fully initialized.
+  void WarmRewriteDriverPool(int num_drivers);
+
   // Generates a new unmanaged RewriteDriver with given RewriteOptions,
   // which are assumed to correspond to drivers managed by 'pool'
   // (which may be NULL if the options are custom).  Each RewriteDriver is
@@ -568,6 +592,16 @@ class ServerContext {
     return central_controller_.get();
   }
 
+  // Whether expensive operations should describe their cost to the central
+  // controller.  Estimating it can mean parsing the input, so this is only
+  // turned on when the controller admits operations by cost.
+  bool estimate_expensive_operation_costs() const {
+    return estimate_expensive_operation_costs_;
+  }
+  void set_estimate_expensive_operation_costs(bool x) {
+    estimate_expensive_operation_costs_ = x;
+  }
+
   // Adds an X-Original-Content-Length header to the response headers
   // based on the size of the input resources.
   void AddOriginalContentLengthHeader(const ResourceVector& inputs,
@@ -715,6 +749,7 @@ class ServerContext {
   bool store_outputs_in_file_system_;
   bool response_headers_finalized_;
   bool enable_property_cache_;
+  bool estimate_expensive_operation_costs_;
 
   NamedLockManager* lock_manager_;
   MessageHandler* message_handler_;
@@ -783,6 +818,10 @@ class ServerContext {
   // Used to match clients or sessions to a specific experiment.
   scoped_ptr<ExperimentMatcher> experiment_matcher_;
 
+  // Results of merging query options into global_options(); NULL if
+  // disabled.
+  scoped_ptr<MergedOptionsCache> merged_options_cache_;
+
   UsageDataReporter* usage_data_reporter_;
 
   // A convenient central place to store the hostname we're running on.
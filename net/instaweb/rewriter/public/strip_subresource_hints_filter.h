@@ -21,8 +21,11 @@
 #ifndef NET_INSTAWEB_REWRITER_PUBLIC_STRIP_SUBRESOURCE_HINTS_FILTER_H_
 #define NET_INSTAWEB_REWRITER_PUBLIC_STRIP_SUBRESOURCE_HINTS_FILTER_H_
 
+#include <vector>
+
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/html/empty_html_filter.h"
+#include "pagespeed/kernel/html/html_name.h"
 
 namespace net_instaweb {
 
@@ -37,6 +40,8 @@ class StripSubresourceHintsFilter : public EmptyHtmlFilter {
 
   void StartDocument() override;
   void StartElement(HtmlElement* element) override;
+  bool GetRelevantElements(
+      std::vector<HtmlName::Keyword>* keywords) const override;
   const char* Name() const override { return "StripSubresourceHints"; }
 
  private:
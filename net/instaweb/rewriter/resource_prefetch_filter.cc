@@ -0,0 +1,235 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "net/instaweb/rewriter/public/resource_prefetch_filter.h"
+
+#include "net/instaweb/rewriter/public/resource.h"
+#include "net/instaweb/rewriter/public/resource_tag_scanner.h"
+#include "net/instaweb/rewriter/public/rewrite_driver.h"
+#include "net/instaweb/rewriter/public/rewrite_options.h"
+#include "net/instaweb/rewriter/public/server_context.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/html/html_element.h"
+
+namespace net_instaweb {
+
+const char ResourcePrefetchFilter::kResourcePrefetches[] =
+    "resource_prefetches";
+const char ResourcePrefetchFilter::kResourcePrefetchWaits[] =
+    "resource_prefetch_waits";
+
+// Drops the loaded resource once it is in the HTTP cache, and releases
+// anyone who was waiting on it.
+class ResourcePrefetchFilter::PrefetchCallback
+    : public Resource::AsyncCallback {
+ public:
+  PrefetchCallback(const ResourcePtr& resource,
+                   ResourcePrefetchFilter* filter)
+      : Resource::AsyncCallback(resource),
+        filter_(filter) {
+  }
+
+  virtual void Done(bool lock_failure, bool resource_ok) {
+    RewriteDriver* driver = filter_->driver();
+    filter_->PrefetchDone(resource()->cache_key());
+    delete this;
+    // This may release the driver, so it must come last.
+    driver->DecrementAsyncEventsCount();
+  }
+
+ private:
+  ResourcePrefetchFilter* filter_;
+
+  DISALLOW_COPY_AND_ASSIGN(PrefetchCallback);
+};
+
+ResourcePrefetchFilter::ResourcePrefetchFilter(RewriteDriver* driver)
+    : CommonFilter(driver),
+      mutex_(driver->server_context()->thread_system()->NewMutex()),
+      metadata_cache_missed_(false) {
+  Statistics* stats = driver->server_context()->statistics();
+  prefetches_ = stats->GetVariable(kResourcePrefetches);
+  prefetch_waits_ = stats->GetVariable(kResourcePrefetchWaits);
+}
+
+ResourcePrefetchFilter::~ResourcePrefetchFilter() {
+  DCHECK(in_flight_.empty());
+}
+
+void ResourcePrefetchFilter::InitStats(Statistics* statistics) {
+  statistics->AddVariable(kResourcePrefetches);
+  statistics->AddVariable(kResourcePrefetchWaits);
+}
+
+void ResourcePrefetchFilter::StartDocumentImpl() {
+  seen_urls_.clear();
+  ScopedMutex lock(mutex_.get());
+  metadata_cache_missed_ = false;
+  held_back_.clear();
+}
+
+void ResourcePrefetchFilter::FlushStarted() {
+  ScopedMutex lock(mutex_.get());
+  held_back_.clear();
+}
+
+void ResourcePrefetchFilter::MetadataCacheMissed() {
+  std::vector<ResourcePtr> held_back;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (metadata_cache_missed_) {
+      return;
+    }
+    metadata_cache_missed_ = true;
+    held_back.swap(held_back_);
+  }
+  for (int i = 0, n = held_back.size(); i < n; ++i) {
+    LoadResource(held_back[i]);
+  }
+}
+
+bool ResourcePrefetchFilter::GetRelevantElements(
+    std::vector<HtmlName::Keyword>* keywords) const {
+  // CommonFilter tracks base and noscript.
+  keywords->push_back(HtmlName::kBase);
+  keywords->push_back(HtmlName::kImg);
+  keywords->push_back(HtmlName::kLink);
+  keywords->push_back(HtmlName::kNoscript);
+  keywords->push_back(HtmlName::kScript);
+  return true;
+}
+
+bool ResourcePrefetchFilter::ShouldPrefetch(
+    semantic_type::Category category) const {
+  const RewriteOptions* options = driver()->options();
+  switch (category) {
+    case semantic_type::kStylesheet:
+      return (options->Enabled(RewriteOptions::kRewriteCss) ||
+              options->Enabled(RewriteOptions::kCombineCss) ||
+              options->Enabled(RewriteOptions::kInlineCss) ||
+              options->Enabled(RewriteOptions::kExtendCacheCss));
+    case semantic_type::kScript:
+      return (options->Enabled(RewriteOptions::kRewriteJavascriptExternal) ||
+              options->Enabled(RewriteOptions::kCombineJavascript) ||
+              options->Enabled(RewriteOptions::kInlineJavascript) ||
+              options->Enabled(RewriteOptions::kExtendCacheScripts));
+    case semantic_type::kImage:
+      return (options->ImageOptimizationEnabled() ||
+              options->Enabled(RewriteOptions::kResizeImages) ||
+              options->Enabled(RewriteOptions::kInlineImages) ||
+              options->Enabled(RewriteOptions::kExtendCacheImages));
+    default:
+      return false;
+  }
+}
+
+void ResourcePrefetchFilter::StartElementImpl(HtmlElement* element) {
+  // Filters generally leave resources inside noscript alone.
+  if (noscript_element() != NULL) {
+    return;
+  }
+  resource_tag_scanner::UrlCategoryVector attributes;
+  resource_tag_scanner::ScanElement(element, driver()->options(), &attributes);
+  for (int i = 0, n = attributes.size(); i < n; ++i) {
+    StringPiece url(attributes[i].url->DecodedValueOrNull());
+    if (!url.empty() && ShouldPrefetch(attributes[i].category)) {
+      StartPrefetch(attributes[i].category, url);
+    }
+  }
+}
+
+void ResourcePrefetchFilter::StartPrefetch(semantic_type::Category category,
+                                           StringPiece url) {
+  if (!seen_urls_.insert(url.as_string()).second) {
+    return;
+  }
+  RewriteDriver::InputRole role = RewriteDriver::InputRole::kImg;
+  if (category == semantic_type::kStylesheet) {
+    role = RewriteDriver::InputRole::kStyle;
+  } else if (category == semantic_type::kScript) {
+    role = RewriteDriver::InputRole::kScript;
+  }
+  bool is_authorized;
+  ResourcePtr resource(CreateInputResource(url, role, &is_authorized));
+  if (resource.get() == NULL || !is_authorized || !resource->UseHttpCache()) {
+    return;
+  }
+  {
+    ScopedMutex lock(mutex_.get());
+    if (!metadata_cache_missed_) {
+      held_back_.push_back(resource);
+      return;
+    }
+  }
+  LoadResource(resource);
+}
+
+void ResourcePrefetchFilter::LoadResource(const ResourcePtr& resource) {
+  {
+    ScopedMutex lock(mutex_.get());
+    Prefetch* prefetch = &in_flight_[resource->cache_key()];
+    if (prefetch->resource != NULL) {
+      return;
+    }
+    prefetch->resource = resource.get();
+  }
+  prefetches_->Add(1);
+  driver()->IncrementAsyncEventsCount();
+  resource->LoadAsync(Resource::kReportFailureIfNotCacheable,
+                      driver()->request_context(),
+                      new PrefetchCallback(resource, this));
+}
+
+void ResourcePrefetchFilter::RunAfterPrefetch(const Resource* resource,
+                                              Function* callback) {
+  {
+    ScopedMutex lock(mutex_.get());
+    if (!in_flight_.empty()) {
+      PrefetchMap::iterator p = in_flight_.find(resource->cache_key());
+      if (p != in_flight_.end() && p->second.resource != resource) {
+        p->second.waiters.push_back(callback);
+        prefetch_waits_->Add(1);
+        return;
+      }
+    }
+  }
+  callback->CallRun();
+}
+
+void ResourcePrefetchFilter::PrefetchDone(const GoogleString& cache_key) {
+  std::vector<Function*> waiters;
+  {
+    ScopedMutex lock(mutex_.get());
+    PrefetchMap::iterator p = in_flight_.find(cache_key);
+    DCHECK(p != in_flight_.end());
+    if (p != in_flight_.end()) {
+      waiters.swap(p->second.waiters);
+      in_flight_.erase(p);
+    }
+  }
+  for (int i = 0, n = waiters.size(); i < n; ++i) {
+    waiters[i]->CallRun();
+  }
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,139 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Unit-test the ResourcePrefetchFilter.
+
+#include "net/instaweb/rewriter/public/resource_prefetch_filter.h"
+
+#include "net/instaweb/http/public/counting_url_async_fetcher.h"
+#include "net/instaweb/rewriter/public/rewrite_driver.h"
+#include "net/instaweb/rewriter/public/rewrite_options.h"
+#include "net/instaweb/rewriter/public/rewrite_test_base.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/http/content_type.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kCss[] = ".a { color: red; }";
+
+class ResourcePrefetchFilterTest : public RewriteTestBase {
+ protected:
+  virtual void SetUp() {
+    options()->set_prefetch_resources_on_lex(true);
+    RewriteTestBase::SetUp();
+    SetResponseWithDefaultHeaders("a.css", kContentTypeCss, kCss, 100);
+    SetResponseWithDefaultHeaders("b.css", kContentTypeCss, kCss, 100);
+    SetResponseWithDefaultHeaders("b.png", kContentTypePng, "png", 100);
+  }
+
+  // Parses first_window, flushes, then parses second_window.  Prefetching
+  // can only start in the second window, once a rewrite in the first has
+  // missed in the metadata cache.
+  void ParseInTwoWindows(StringPiece id, StringPiece first_window,
+                         StringPiece second_window) {
+    SetupWriter();
+    rewrite_driver()->StartParse(StrCat(kTestDomain, id, ".html"));
+    rewrite_driver()->ParseText(first_window);
+    rewrite_driver()->Flush();
+    rewrite_driver()->ParseText(second_window);
+    rewrite_driver()->FinishParse();
+  }
+
+  int64 Prefetches() {
+    return statistics()->GetVariable(
+        ResourcePrefetchFilter::kResourcePrefetches)->Get();
+  }
+
+  int64 PrefetchWaits() {
+    return statistics()->GetVariable(
+        ResourcePrefetchFilter::kResourcePrefetchWaits)->Get();
+  }
+};
+
+TEST_F(ResourcePrefetchFilterTest, RewriteContextWaitsForPrefetch) {
+  AddFilter(RewriteOptions::kRewriteCss);
+  ASSERT_TRUE(rewrite_driver()->resource_prefetch_filter() != NULL);
+  SetupWaitFetcher();
+
+  // The fetches are held, so the page is served unrewritten.  a.css's
+  // metadata miss starts prefetching, and the rewrite context's load of
+  // b.css joins b.css's prefetch rather than fetching again.
+  ParseInTwoWindows("held", CssLinkHref("a.css"), CssLinkHref("b.css"));
+  EXPECT_EQ(1, Prefetches());
+  EXPECT_EQ(1, PrefetchWaits());
+  EXPECT_EQ(2, counting_url_async_fetcher()->fetch_count());
+
+  CallFetcherCallbacks();
+  EXPECT_EQ(2, counting_url_async_fetcher()->fetch_count());
+}
+
+TEST_F(ResourcePrefetchFilterTest, NoPrefetchOnMetadataHit) {
+  AddFilter(RewriteOptions::kRewriteCss);
+  ParseInTwoWindows("page", CssLinkHref("a.css"), CssLinkHref("b.css"));
+  EXPECT_EQ(1, Prefetches());
+
+  // Every rewrite now hits in the metadata cache, so nothing is prefetched,
+  // and the inputs are neither looked up in the HTTP cache nor fetched.
+  ClearStats();
+  ParseInTwoWindows("page", CssLinkHref("a.css"), CssLinkHref("b.css"));
+  EXPECT_EQ(StrCat(CssLinkHref(Encode("", "cf", "0", "a.css", "css")),
+                   CssLinkHref(Encode("", "cf", "0", "b.css", "css"))),
+            output_buffer_);
+  EXPECT_EQ(0, Prefetches());
+  EXPECT_EQ(0, PrefetchWaits());
+  EXPECT_EQ(0, http_cache()->cache_hits()->Get());
+  EXPECT_EQ(0, http_cache()->cache_misses()->Get());
+  EXPECT_EQ(0, counting_url_async_fetcher()->fetch_count());
+}
+
+TEST_F(ResourcePrefetchFilterTest, OnlyResourcesEnabledFiltersUse) {
+  AddFilter(RewriteOptions::kRewriteCss);
+  ParseInTwoWindows("img", CssLinkHref("a.css"), "<img src=b.png>");
+  EXPECT_EQ(0, Prefetches());
+  EXPECT_EQ(1, counting_url_async_fetcher()->fetch_count());
+}
+
+TEST_F(ResourcePrefetchFilterTest, SkipsRepeatsAndNoscript) {
+  AddFilter(RewriteOptions::kExtendCacheCss);
+  SetupWaitFetcher();
+  ParseInTwoWindows(
+      "repeats", CssLinkHref("a.css"),
+      StrCat(CssLinkHref("a.css"), CssLinkHref("b.css"), CssLinkHref("b.css"),
+             "<noscript>", CssLinkHref("c.css"), "</noscript>"));
+  EXPECT_EQ(1, Prefetches());
+  CallFetcherCallbacks();
+}
+
+TEST_F(ResourcePrefetchFilterTest, OffByDefault) {
+  options()->set_prefetch_resources_on_lex(false);
+  AddFilter(RewriteOptions::kRewriteCss);
+  EXPECT_TRUE(rewrite_driver()->resource_prefetch_filter() == NULL);
+  ParseInTwoWindows("off", CssLinkHref("a.css"), CssLinkHref("b.css"));
+  EXPECT_EQ(0, Prefetches());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
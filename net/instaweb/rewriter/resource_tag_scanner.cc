@@ -237,9 +237,8 @@ semantic_type::Category CategorizeAttribute(
 void ScanElement(HtmlElement* element,
                  const RewriteOptions* options,
                  UrlCategoryVector* attributes) {
-  HtmlElement::AttributeList* attrs = element->mutable_attributes();
-  for (HtmlElement::AttributeIterator i = attrs->begin();
-       i != attrs->end(); ++i) {
+  for (HtmlElement::AttributeIterator i = element->attributes_begin();
+       i != element->attributes_end(); ++i) {
     UrlCategoryPair url_category_pair;
     url_category_pair.url = i.Get();
     if (IsAttributeValid(url_category_pair.url)) {
@@ -252,5 +251,38 @@ void ScanElement(HtmlElement* element,
   }
 }
 
+bool GetScannedElements(const RewriteOptions* options,
+                        std::vector<HtmlName::Keyword>* keywords) {
+  // Every element with a case in CategorizeAttributeBySpec.
+  static const HtmlName::Keyword kSpecElements[] = {
+    HtmlName::kA, HtmlName::kArea, HtmlName::kAudio, HtmlName::kBlockquote,
+    HtmlName::kBody, HtmlName::kButton, HtmlName::kCommand, HtmlName::kDel,
+    HtmlName::kEmbed, HtmlName::kForm, HtmlName::kFrame, HtmlName::kHtml,
+    HtmlName::kIframe, HtmlName::kImg, HtmlName::kInput, HtmlName::kIns,
+    HtmlName::kLink, HtmlName::kQ, HtmlName::kScript, HtmlName::kSource,
+    HtmlName::kTable, HtmlName::kTbody, HtmlName::kTd, HtmlName::kTfoot,
+    HtmlName::kTh, HtmlName::kThead, HtmlName::kTrack, HtmlName::kVideo,
+  };
+  keywords->insert(keywords->end(), kSpecElements,
+                   kSpecElements + arraysize(kSpecElements));
+
+  for (int i = 0, n = options->num_url_valued_attributes(); i < n; ++i) {
+    StringPiece element_i;
+    StringPiece attribute_i;
+    semantic_type::Category category_i;
+    options->UrlValuedAttribute(i, &element_i, &attribute_i, &category_i);
+    HtmlName::Keyword keyword = HtmlName::Lookup(element_i);
+    if (keyword == HtmlName::kNotAKeyword) {
+      return false;
+    }
+    keywords->push_back(keyword);
+    if (keyword == HtmlName::kLink) {
+      // CategorizeAttribute also applies these to <style>; see there.
+      keywords->push_back(HtmlName::kStyle);
+    }
+  }
+  return true;
+}
+
 }  // namespace resource_tag_scanner
 }  // namespace net_instaweb
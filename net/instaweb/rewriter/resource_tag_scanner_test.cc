@@ -20,6 +20,7 @@
 
 #include "net/instaweb/rewriter/public/resource_tag_scanner.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <memory>
 #include <vector>
@@ -33,6 +34,7 @@
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/html/empty_html_filter.h"
 #include "pagespeed/kernel/html/html_element.h"
+#include "pagespeed/kernel/html/html_name.h"
 #include "pagespeed/kernel/http/semantic_type.h"
 
 namespace net_instaweb {
@@ -706,6 +708,26 @@ TEST_F(ResourceTagScannerTest, THeadBackgroundImage) {
   EXPECT_EQ(semantic_type::kImage, resource_category_[0]);
 }
 
+TEST_F(ResourceTagScannerTest, ScannedElements) {
+  std::vector<HtmlName::Keyword> keywords;
+  EXPECT_TRUE(resource_tag_scanner::GetScannedElements(options(), &keywords));
+  EXPECT_NE(keywords.end(),
+            std::find(keywords.begin(), keywords.end(), HtmlName::kThead));
+  EXPECT_EQ(keywords.end(),
+            std::find(keywords.begin(), keywords.end(), HtmlName::kDiv));
+
+  // User-declared url-valued attributes add their elements, and make the set
+  // unknowable if the element isn't a keyword.
+  options()->ClearSignatureForTesting();
+  options()->AddUrlValuedAttribute("div", "data-bg", semantic_type::kImage);
+  keywords.clear();
+  EXPECT_TRUE(resource_tag_scanner::GetScannedElements(options(), &keywords));
+  EXPECT_NE(keywords.end(),
+            std::find(keywords.begin(), keywords.end(), HtmlName::kDiv));
+  options()->AddUrlValuedAttribute("my-widget", "src", semantic_type::kImage);
+  EXPECT_FALSE(resource_tag_scanner::GetScannedElements(options(), &keywords));
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -44,6 +44,7 @@
 #include "net/instaweb/rewriter/public/output_resource.h"
 #include "net/instaweb/rewriter/public/resource.h"
 #include "net/instaweb/rewriter/public/resource_namer.h"
+#include "net/instaweb/rewriter/public/resource_prefetch_filter.h"
 #include "net/instaweb/rewriter/public/resource_slot.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
 #include "net/instaweb/rewriter/public/rewrite_filter.h"
@@ -75,6 +76,7 @@
 #include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/response_headers.h"
 #include "pagespeed/kernel/thread/queued_alarm.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
 #include "pagespeed/kernel/thread/sequence.h"
 #include "pagespeed/kernel/util/url_segment_encoder.h"
 #include "pagespeed/opt/logging/log_record.h"
@@ -548,6 +550,12 @@ class RewriteContext::ResourceFetchCallback : public Resource::AsyncCallback {
     delete this;
   }
 
+  // delegate_ continues on the rewrite sequence, so have the fetch finish
+  // there too.
+  virtual Sequence* response_sequence() {
+    return rewrite_context_->Driver()->rewrite_worker();
+  }
+
  private:
   RewriteContext* rewrite_context_;
   ResourceCallbackUtils delegate_;
@@ -681,15 +689,17 @@ class RewriteContext::FetchContext {
     stats->AddVariable(kNumDeadlineAlarmInvocations);
   }
 
-  void SetupDeadlineAlarm() {
+  // Returns how long, in microseconds, the fetch will wait for the rewrite
+  // before serving the original, or -1 if it will wait indefinitely.
+  int64 SetupDeadlineAlarm() {
     // No point in doing this for on-the-fly resources.
     if (rewrite_context_->kind() == kOnTheFlyResource) {
-      return;
+      return -1;
     }
 
     // Can't do this if a subclass forced us to be detached already.
     if (detached_) {
-      return;
+      return -1;
     }
 
     RewriteDriver* driver = rewrite_context_->Driver();
@@ -708,7 +718,7 @@ class RewriteContext::FetchContext {
       // OutputResources, and hence the JS variables may turn out not be
       // what was expected.
 
-      return;
+      return -1;
     }
 
     Timer* timer = rewrite_context_->FindServerContext()->timer();
@@ -728,7 +738,9 @@ class RewriteContext::FetchContext {
               driver->scheduler(), driver->rewrite_worker(),
               timer->NowUs() + (deadline_ms * Timer::kMsUs),
               MakeFunction(this, &FetchContext::HandleDeadline));
+      return deadline_ms * Timer::kMsUs;
     }
+    return -1;
   }
 
   // Must be invoked from main rewrite thread.
@@ -1398,6 +1410,12 @@ void RewriteContext::OutputCacheHit(bool write_partitions) {
 
 void RewriteContext::OutputCacheMiss() {
   is_metadata_cache_miss_ = true;
+  // The page's other inputs are likely not cached either, so start loading
+  // them as they are lexed.
+  ResourcePrefetchFilter* prefetcher = Driver()->resource_prefetch_filter();
+  if (prefetcher != NULL) {
+    prefetcher->MetadataCacheMissed();
+  }
   outputs_.clear();
   CheckNotFrozen();
   partitions_->Clear();
@@ -2228,9 +2246,18 @@ void RewriteContext::StartRewriteForFetch() {
         new InvokeRewriteFunction(this, 0, output);
     if (CanFetchFallbackToOriginal(kFallbackDiscretional)) {
       // To avoid rewrites from delaying fetches, we try to fallback to the
-      // original version if rewriting takes too long.
-      fetch_->SetupDeadlineAlarm();
-      Driver()->AddLowPriorityRewriteTask(call_rewrite);
+      // original version if rewriting takes too long.  The rewrite normally
+      // still finishes in the background so that later fetches find it
+      // cached, but with shed_fetch_rewrites_at_deadline it is dropped if it
+      // has not even started by then; a later fetch will retry it.
+      int64 timeout_us = fetch_->SetupDeadlineAlarm();
+      if (timeout_us >= 0 &&
+          Driver()->options()->shed_fetch_rewrites_at_deadline()) {
+        Driver()->AddLowPriorityRewriteTaskWithTimeout(call_rewrite,
+                                                        timeout_us);
+      } else {
+        Driver()->AddLowPriorityRewriteTask(call_rewrite);
+      }
     } else {
       Driver()->AddRewriteTask(call_rewrite);
     }
@@ -2767,6 +2794,8 @@ void RewriteContext::StartFetchReconstruction() {
 void RewriteContext::DetachFetch() {
   CHECK(IsFetchRewrite());
   fetch_->set_detached(true);
+  // The client has been answered, so what remains is background work.
+  Driver()->SetRewritePriority(QueuedWorkerPool::kBackground);
   Driver()->DetachFetch();
 }
 
@@ -2689,6 +2689,62 @@ TEST_F(RewriteContextTest, FetchDeadlineMandatoryTest) {
   EXPECT_EQ(3, lru_cache()->num_inserts());  // input, output, metadata
 }
 
+TEST_F(RewriteContextTest, FetchDeadlineShedsQueuedRewrite) {
+  // With shed_fetch_rewrites_at_deadline, a fetch's rewrite that is still
+  // stuck behind other low-priority work when the fetch gives up on it is
+  // dropped rather than run later.  This uses the real fetch deadline set
+  // up by TestRewriteDriverFactory, not test_instant_fetch_rewrite_deadline.
+  options()->ClearSignatureForTesting();
+  options()->set_shed_fetch_rewrites_at_deadline(true);
+  server_context()->ComputeSignature(options());
+  InitCombiningFilter(0);
+  EnableDebug();
+  InitResources();
+  combining_filter_->set_prefix("|");
+
+  GoogleString combined_url = Encode(kTestDomain, CombiningFilter::kFilterId,
+                                     "0", "a.css", "css");
+  Variable* shed_deadline = server_context()->rewrite_stats()->
+      worker_functions_shed(QueuedWorkerPool::kShedDeadline);
+  EXPECT_EQ(0, shed_deadline->Get());
+
+  GoogleString content;
+  StringAsyncFetch async_fetch(CreateRequestContext(), &content);
+  RewriteDriver* driver =
+      server_context()->NewRewriteDriver(CreateRequestContext());
+  int deadline_ms = driver->rewrite_deadline_ms();
+  ASSERT_LT(0, deadline_ms);
+
+  // Back up the low-priority queue, as a busy server would.
+  WorkerTestBase::SyncPoint unblock_rewrite(server_context()->thread_system());
+  driver->low_priority_rewrite_worker()->Add(
+      new WorkerTestBase::WaitRunFunction(&unblock_rewrite));
+
+  driver->FetchResource(combined_url, &async_fetch);
+  AdvanceTimeMs(deadline_ms);
+
+  // The queue only frees up after the rewrite's timeout, which is measured
+  // on the worker pool's own clock.
+  scoped_ptr<Timer> real_timer(server_context()->thread_system()->NewTimer());
+  real_timer->SleepMs(2 * deadline_ms);
+  unblock_rewrite.Notify();
+  driver->WaitForShutDown();
+  driver->Cleanup();
+
+  EXPECT_TRUE(async_fetch.done());
+  EXPECT_EQ(" a ", content);
+  EXPECT_EQ(1, shed_deadline->Get());
+
+  // Nothing was cached for the dropped rewrite, so the next fetch redoes it.
+  ClearStats();
+  content.clear();
+  EXPECT_TRUE(FetchResourceUrl(combined_url, &content));
+  EXPECT_EQ("| a ", content);
+  EXPECT_EQ(1, shed_deadline->Get());
+  EXPECT_EQ(2, lru_cache()->num_inserts()) << "output, metadata";
+  EXPECT_EQ(0, counting_url_async_fetcher()->fetch_count());
+}
+
 TEST_F(RewriteContextTest, FetchDeadlineTestBeforeDeadline) {
   // As above, but rewrite finishes quickly. This time we should see the |
   // immediately
@@ -103,6 +103,7 @@
 #include "net/instaweb/rewriter/public/request_properties.h"
 #include "net/instaweb/rewriter/public/resource.h"
 #include "net/instaweb/rewriter/public/resource_namer.h"
+#include "net/instaweb/rewriter/public/resource_prefetch_filter.h"
 #include "net/instaweb/rewriter/public/resource_slot.h"
 #include "net/instaweb/rewriter/public/responsive_image_filter.h"
 #include "net/instaweb/rewriter/public/rewrite_context.h"
@@ -153,6 +154,8 @@
 #include "pagespeed/kernel/http/google_url.h"
 #include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/request_headers.h"
+#include "pagespeed/kernel/thread/pipelined_writer.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
 #include "pagespeed/kernel/thread/scheduler.h"
 #include "pagespeed/kernel/thread/scheduler_sequence.h"
 #include "pagespeed/kernel/util/statistics_logger.h"
@@ -264,6 +267,7 @@ RewriteDriver::RewriteDriver(MessageHandler* message_handler,
       default_url_async_fetcher_(url_async_fetcher),
       url_async_fetcher_(default_url_async_fetcher_),
       dom_stats_filter_(NULL),
+      resource_prefetch_filter_(NULL),
       scan_filter_(this),
       controlling_pool_(NULL),
       cache_url_async_fetcher_async_op_hooks_(
@@ -271,6 +275,7 @@ RewriteDriver::RewriteDriver(MessageHandler* message_handler,
       html_worker_(NULL),
       rewrite_worker_(NULL),
       low_priority_rewrite_worker_(NULL),
+      output_worker_(NULL),
       writer_(NULL),
       fallback_property_page_(NULL),
       owns_property_page_(false),
@@ -369,6 +374,19 @@ RewriteDriver::~RewriteDriver() {
     server_context_->low_priority_rewrite_workers()->FreeSequence(
         low_priority_rewrite_worker_);
   }
+  // The freed sequences may be handed to another driver, so make sure Clear
+  // below does not touch them.
+  rewrite_worker_ = NULL;
+  html_worker_ = NULL;
+  low_priority_rewrite_worker_ = NULL;
+  // Destroying the pipelined writer waits for any delivery in progress and
+  // drops the chunks still queued on output_worker_, so the sequence can be
+  // freed without draining it.
+  pipelined_writer_.reset();
+  if (output_worker_ != NULL) {
+    scheduler_->UnregisterWorker(output_worker_);
+    server_context_->html_workers()->FreeSequence(output_worker_);
+  }
   Clear();
   STLDeleteElements(&filters_to_delete_);
   STLDeleteElements(&resource_claimants_);
@@ -413,6 +431,7 @@ void RewriteDriver::Clear() NO_THREAD_SAFETY_ANALYSIS {
   }
 
   HtmlParse::Clear();
+  pipelined_writer_.reset();
 
   // If this was a fetch, fetch_rewrites_ may still hold a reference to a
   // RewriteContext.
@@ -420,6 +439,7 @@ void RewriteDriver::Clear() NO_THREAD_SAFETY_ANALYSIS {
 
   DCHECK(!flush_requested_);
   release_driver_ = false;
+  SetRewritePriority(QueuedWorkerPool::kNormal);
   downstream_cache_purger_.Clear();
   write_property_cache_dom_cohort_ = false;
   base_url_.Clear();
@@ -646,9 +666,18 @@ void RewriteDriver::Flush() {
   SchedulerBlockingFunction wait(scheduler_);
   FlushAsync(&wait);
   wait.Block();
+  DrainPipelinedOutput();
   flush_requested_ = false;
 }
 
+void RewriteDriver::DrainPipelinedOutput() {
+  if (pipelined_writer_.get() != NULL) {
+    SchedulerBlockingFunction drained(scheduler_);
+    pipelined_writer_->Drain(&drained);
+    drained.Block();
+  }
+}
+
 void RewriteDriver::FlushAsync(Function* callback) {
   DCHECK(request_context_.get() != NULL);
   TraceLiteral("RewriteDriver::FlushAsync()");
@@ -661,6 +690,10 @@ void RewriteDriver::FlushAsync(Function* callback) {
   // can modify urls.
   DetermineFiltersBehavior();
 
+  if (resource_prefetch_filter_ != NULL) {
+    resource_prefetch_filter_->FlushStarted();
+  }
+
   for (FilterList::iterator it = early_pre_render_filters_.begin();
       it != early_pre_render_filters_.end(); ++it) {
     HtmlFilter* filter = *it;
@@ -888,6 +921,7 @@ void RewriteDriver::InitStats(Statistics* statistics) {
   LocalStorageCacheFilter::InitStats(statistics);
   MakeShowAdsAsyncFilter::InitStats(statistics);
   MetaTagFilter::InitStats(statistics);
+  ResourcePrefetchFilter::InitStats(statistics);
   RewriteContext::InitStats(statistics);
   UrlInputResource::InitStats(statistics);
   UrlLeftTrimFilter::InitStats(statistics);
@@ -1023,6 +1057,12 @@ void RewriteDriver::AddPreRenderFilters() {
     // based on the content it sees.
     add_event_listener(new FlushHtmlFilter(this));
   }
+  if (rewrite_options->prefetch_resources_on_lex()) {
+    // Also run after every ParseText, so fetches for the resources rewrite
+    // contexts will need start before the flush window reaches the filters.
+    resource_prefetch_filter_ = new ResourcePrefetchFilter(this);
+    add_event_listener(resource_prefetch_filter_);
+  }
   add_event_listener(new AmpDocumentFilter(this, NewPermanentCallback(
       this, &RewriteDriver::SetIsAmpDocument)));
 
@@ -1419,6 +1459,20 @@ void RewriteDriver::RegisterRewriteFilter(RewriteFilter* filter) {
 }
 
 void RewriteDriver::SetWriter(Writer* writer) {
+  if (writer != NULL && options()->pipeline_html_output()) {
+    // Serialize flush windows on a separate sequence so that the html
+    // worker can lex and filter window N+1 while window N is being
+    // delivered downstream.
+    if (output_worker_ == NULL) {
+      output_worker_ = server_context_->html_workers()->NewSequence();
+      scheduler_->RegisterWorker(output_worker_);
+    }
+    // Let the output fall at most a few flush windows behind.
+    pipelined_writer_.reset(new PipelinedWriter(
+        writer, output_worker_, server_context_->thread_system(),
+        4 * options()->flush_buffer_limit_bytes()));
+    writer = pipelined_writer_.get();
+  }
   writer_ = writer;
   if (html_writer_filter_ == NULL) {
     html_writer_filter_.reset(new HtmlWriterFilter(this));
@@ -1887,6 +1941,8 @@ void RewriteDriver::FetchInPlaceResource(const GoogleUrl& gurl,
   }
 
   ref_counts_.AddRef(kRefFetchUserFacing);
+  // As in FetchOutputResource, a client is waiting on this.
+  SetRewritePriority(QueuedWorkerPool::kDeadlineCritical);
   InPlaceRewriteContext* context = new InPlaceRewriteContext(this, gurl.Spec());
   context->set_proxy_mode(proxy_mode);
 
@@ -1940,6 +1996,10 @@ bool RewriteDriver::FetchOutputResource(
   } else {
     SetBaseUrlForFetch(output_resource->url());
     ref_counts_.AddRef(kRefFetchUserFacing);
+    // A client is waiting on the resource, as for HTML.  If the rewrite
+    // outlives the response, RewriteContext::DetachFetch lowers this to
+    // kBackground.
+    SetRewritePriority(QueuedWorkerPool::kDeadlineCritical);
     if (output_resource->kind() == kOnTheFlyResource) {
       // Don't bother to look up the resource in the cache: ask the filter.
       if (filter != NULL) {
@@ -2165,6 +2225,7 @@ bool RewriteDriver::StartParseId(const StringPiece& url, const StringPiece& id,
   }
   start_time_ms_ = server_context_->timer()->NowMs();
   set_log_rewrite_timing(options()->log_rewrite_timing());
+  set_allow_passthrough(options()->html_passthrough());
 
   if (debug_filter_ != NULL) {
     debug_filter_->InitParse();
@@ -2172,6 +2233,8 @@ bool RewriteDriver::StartParseId(const StringPiece& url, const StringPiece& id,
 
   bool ret = HtmlParse::StartParseId(url, id, content_type);
   if (ret) {
+    // The response is waiting on our rewrites until the deadline.
+    SetRewritePriority(QueuedWorkerPool::kDeadlineCritical);
     ScopedMutex lock(rewrite_mutex());
     DCHECK_EQ(0, ref_counts_.QueryCountMutexHeld(kRefParsing));
     ref_counts_.AddRefMutexHeld(kRefParsing);
@@ -2531,6 +2594,17 @@ void RewriteDriver::FinishParseAsync(Function* callback) {
 }
 
 void RewriteDriver::QueueFinishParseAfterFlush(Function* user_callback) {
+  if (pipelined_writer_.get() != NULL) {
+    // The caller may complete its response from user_callback, so all
+    // pipelined output must be delivered first.
+    pipelined_writer_->Drain(MakeFunction(
+        this, &RewriteDriver::QueueFinishParseAfterDrain, user_callback));
+  } else {
+    QueueFinishParseAfterDrain(user_callback);
+  }
+}
+
+void RewriteDriver::QueueFinishParseAfterDrain(Function* user_callback) {
   Function* finish_parse = MakeFunction(this,
                                         &RewriteDriver::FinishParseAfterFlush,
                                         user_callback);
@@ -2557,6 +2631,10 @@ void RewriteDriver::FinishParseAfterFlush(Function* user_callback) {
     stats_logger->UpdateAndDumpIfRequired();
   }
 
+  // Any rewrites still outstanding have been detached from the response, so
+  // they can yield to drivers that are still rendering.  This must precede
+  // dropping the parsing reference, which may recycle the driver.
+  SetRewritePriority(QueuedWorkerPool::kBackground);
   DropReference(kRefParsing);
   Cleanup();
   if (user_callback != NULL) {
@@ -2946,6 +3024,18 @@ void RewriteDriver::AddLowPriorityRewriteTask(Function* task) {
   low_priority_rewrite_worker_->Add(task);
 }
 
+void RewriteDriver::AddLowPriorityRewriteTaskWithTimeout(Function* task,
+                                                         int64 timeout_us) {
+  low_priority_rewrite_worker_->AddWithTimeout(task, timeout_us);
+}
+
+void RewriteDriver::SetRewritePriority(QueuedWorkerPool::Priority priority) {
+  if (rewrite_worker_ != NULL) {
+    rewrite_worker_->set_priority(priority);
+    low_priority_rewrite_worker_->set_priority(priority);
+  }
+}
+
 OptionsAwareHTTPCacheCallback::OptionsAwareHTTPCacheCallback(
     const RewriteOptions* rewrite_options, const RequestContextPtr& request_ctx)
     : HTTPCache::Callback(request_ctx, RequestHeaders::Properties()),
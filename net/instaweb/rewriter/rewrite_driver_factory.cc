@@ -386,8 +386,16 @@ int RewriteDriverFactory::LowPriorityLoadSheddingThreshold() const {
   return QueuedWorkerPool::kNoLoadShedding;
 }
 
+int64 RewriteDriverFactory::LowPriorityQueueTimeTargetMs() const {
+  return 0;
+}
+
 Scheduler* RewriteDriverFactory::CreateScheduler() {
-  return new Scheduler(thread_system(), timer());
+  // Every fetch and rewrite deadline is an alarm on this scheduler, so use
+  // the timing wheel to keep adds and cancels constant-time.
+  Scheduler* scheduler = new Scheduler(thread_system(), timer());
+  scheduler->EnableTimerWheel();
+  return scheduler;
 }
 
 NamedLockManager* RewriteDriverFactory::lock_manager() {
@@ -419,9 +427,31 @@ QueuedWorkerPool* RewriteDriverFactory::WorkerPool(WorkerPoolCategory pool) {
     worker_pools_[pool] = CreateWorkerPool(pool, name);
     worker_pools_[pool]->set_queue_size_stat(
         rewrite_stats()->thread_queue_depth(pool));
+    for (int i = 0; i < QueuedWorkerPool::kNumPriorities; ++i) {
+      QueuedWorkerPool::Priority priority =
+          static_cast<QueuedWorkerPool::Priority>(i);
+      worker_pools_[pool]->set_queue_time_histogram(
+          priority, rewrite_stats()->worker_queue_time_histogram(priority));
+    }
+    for (int i = 0; i < QueuedWorkerPool::kNumShedReasons; ++i) {
+      QueuedWorkerPool::ShedReason reason =
+          static_cast<QueuedWorkerPool::ShedReason>(i);
+      worker_pools_[pool]->set_shed_count_stat(
+          reason, rewrite_stats()->worker_functions_shed(reason));
+    }
+    worker_pools_[pool]->set_cpu_busy_time_stats(
+        rewrite_stats()->worker_cpu_busy_times());
     if (pool == kLowPriorityRewriteWorkers) {
       worker_pools_[pool]->SetLoadSheddingThreshold(
           LowPriorityLoadSheddingThreshold());
+      int64 target_ms = LowPriorityQueueTimeTargetMs();
+      if (target_ms > 0) {
+        // CoDel suggests a target of 5-10% of the interval.
+        worker_pools_[pool]->EnableQueueTimeShedding(
+            target_ms * Timer::kMsUs, 20 * target_ms * Timer::kMsUs);
+      }
+      worker_pools_[pool]->set_sojourn_time_histogram(
+          rewrite_stats()->low_priority_sojourn_time_histogram());
     }
   }
 
@@ -20,30 +20,70 @@
 
 #include "net/instaweb/rewriter/public/rewrite_driver_pool.h"
 
+#include <algorithm>
+
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
+#include "net/instaweb/rewriter/public/rewrite_options.h"
 #include "pagespeed/kernel/base/stl_util.h"
 
 namespace net_instaweb {
 
 const int RewriteDriverPool::kMaxDriversInPool;
+const int RewriteDriverPool::kMinDriversInPool;
+const int RewriteDriverPool::kAdaptationPeriod;
 
-RewriteDriverPool::RewriteDriverPool() {}
+// Until we have observed some demand, behave as the pool always used to and
+// retain up to kMaxDriversInPool drivers.
+RewriteDriverPool::RewriteDriverPool()
+    : num_outstanding_(0),
+      peak_outstanding_(0),
+      target_size_(kMaxDriversInPool),
+      pops_since_adapt_(0),
+      min_target_size_(kMinDriversInPool) {
+}
 
 RewriteDriverPool::~RewriteDriverPool() {
   STLDeleteElements(&drivers_);
 }
 
 RewriteDriver* RewriteDriverPool::PopDriver() {
-  if (!drivers_.empty()) {
-    RewriteDriver* driver = drivers_.back();
+  RewriteDriver* driver = NULL;
+  const RewriteOptions* options = TargetOptions();
+  while (!drivers_.empty()) {
+    driver = drivers_.back();
     drivers_.pop_back();
-    return driver;
+    // Note: there is currently some activity to make the RewriteOptions
+    // signature insensitive to changes that need not affect the metadata
+    // cache key.  As we are dependent on a comprehensive signature in
+    // order to correctly determine whether we can recycle a RewriteDriver,
+    // we would have to use a separate signature for metadata_cache_key
+    // vs this purpose.
+    //
+    // So for now, let us keep all the options incorporated into the
+    // signature, and revisit the issue of pulling options out if we
+    // find we are having poor hit-rate in the metadata cache during
+    // operations.
+    if (driver->options()->IsEqual(*options)) {
+      break;
+    }
+    delete driver;
+    driver = NULL;
   }
-  return NULL;
+
+  // Either way the caller now holds a driver controlled by this pool.
+  ++num_outstanding_;
+  peak_outstanding_ = std::max(peak_outstanding_, num_outstanding_);
+  if (++pops_since_adapt_ >= kAdaptationPeriod) {
+    Adapt();
+  }
+  return driver;
 }
 
 void RewriteDriverPool::RecycleDriver(RewriteDriver* driver) {
-  if (drivers_.size() < kMaxDriversInPool) {
+  if (num_outstanding_ > 0) {
+    --num_outstanding_;
+  }
+  if (static_cast<int>(drivers_.size()) + num_outstanding_ < target_size_) {
     drivers_.push_back(driver);
     driver->Clear();
   } else {
@@ -51,4 +91,22 @@ void RewriteDriverPool::RecycleDriver(RewriteDriver* driver) {
   }
 }
 
+void RewriteDriverPool::set_min_target_size(int x) {
+  min_target_size_ = std::min(kMaxDriversInPool,
+                              std::max(kMinDriversInPool, x));
+  target_size_ = std::max(target_size_, min_target_size_);
+}
+
+void RewriteDriverPool::Adapt() {
+  target_size_ = std::min(kMaxDriversInPool,
+                          std::max(min_target_size_, peak_outstanding_));
+  peak_outstanding_ = num_outstanding_;
+  pops_since_adapt_ = 0;
+  while (!drivers_.empty() &&
+         static_cast<int>(drivers_.size()) + num_outstanding_ > target_size_) {
+    delete drivers_.back();
+    drivers_.pop_back();
+  }
+}
+
 }  // namespace net_instaweb
@@ -26,6 +26,31 @@
 //
 // Thus, about 4 ms per 35k file, running all filters.
 //
+// BM_LargePage{Serial,Pipelined}{FirstByte,LastByte} stream a 4MB page in
+// 100KB flush windows to a client that takes 500us to accept each window,
+// with pipeline_html_output off and on.  FirstByte times only up to the
+// first byte reaching the client; LastByte times the whole response.
+// pipeline_html_output only moves delivery to the client onto another
+// sequence; lexing and filtering still run one window at a time, so it
+// cannot help the first byte, and the last byte only gains when a spare
+// core can run delivery.  Median of 5 runs of 5 iterations on one core:
+//
+// CPU: Intel Xeon, 1 core, -O2
+// Benchmark                         Time(ns)
+// ----------------------------------------------
+// BM_LargePageSerialFirstByte        7510540
+// BM_LargePagePipelinedFirstByte     8108320
+// BM_LargePageSerialLastByte       706632427
+// BM_LargePagePipelinedLastByte    743781568
+//
+// Run to run, these vary by about 10%, so both pairs are a wash here.
+//
+// BM_GetCustomOptions{Disabled,Miss,Hit} merge the same query-param
+// overrides into the global options with the merged options cache off,
+// missing on every request, and hitting on every request.  Each iteration
+// builds its own query options, as RewriteQuery does per request, so a hit
+// still pays for the query options and their MergeKey.
+//
 // Disclaimer: comparing runs over time and across different machines
 // can be misleading.  When contemplating an algorithm change, always do
 // interleaved runs with the old & new algorithm.
@@ -43,10 +68,17 @@
 #include "net/instaweb/rewriter/public/server_context.h"
 #include "net/instaweb/rewriter/public/test_rewrite_driver_factory.h"
 #include "net/instaweb/util/public/mock_property_page.h"
+#include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/benchmark.h"
+#include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/base/writer.h"
+#include "pagespeed/kernel/http/request_headers.h"
 #include "pagespeed/kernel/http/user_agent_matcher.h"
+#include "pagespeed/kernel/thread/scheduler.h"
 #include "pagespeed/opt/http/property_cache.h"
 
 namespace net_instaweb {
@@ -171,5 +203,152 @@ static void BM_EmptyFilter(int iters) {
 }
 BENCHMARK(BM_EmptyFilter);
 
+// Calls GetCustomOptions with the overrides RewriteQuery makes of
+// ?PageSpeedFilters=+extend_cache_css,-combine_css&PageSpeedCssInlineMaxBytes=N
+// with the merged options cache given cache_bytes.  N is fixed when
+// same_query, so that every lookup after the first hits, and otherwise
+// changes on every request, so that every lookup misses.
+static void GetCustomOptionsFromQuery(size_t cache_bytes, bool same_query,
+                                      int iters) {
+  SpeedTestContext speed_test_context;
+
+  StopBenchmarkTiming();
+  ServerContext* server_context = speed_test_context.server_context();
+  ThreadSystem* thread_system = speed_test_context.factory()->thread_system();
+  server_context->set_merged_options_cache_bytes(cache_bytes);
+  RewriteOptions* global_options = server_context->global_options();
+  global_options->SetRewriteLevel(RewriteOptions::kCoreFilters);
+  server_context->ComputeSignature(global_options);
+  RequestHeaders request_headers;
+  StartBenchmarkTiming();
+
+  for (int i = 0; i < iters; ++i) {
+    RewriteOptions* query_options = new RewriteOptions(thread_system);
+    query_options->EnableFilter(RewriteOptions::kExtendCacheCss);
+    query_options->DisableFilter(RewriteOptions::kCombineCss);
+    query_options->set_css_inline_max_bytes(same_query ? 2048 : i);
+    delete server_context->GetCustomOptions(&request_headers, NULL,
+                                            query_options);
+  }
+}
+
+static void BM_GetCustomOptionsDisabled(int iters) {
+  GetCustomOptionsFromQuery(0, true, iters);
+}
+BENCHMARK(BM_GetCustomOptionsDisabled);
+
+static void BM_GetCustomOptionsMiss(int iters) {
+  GetCustomOptionsFromQuery(1 << 20, false, iters);
+}
+BENCHMARK(BM_GetCustomOptionsMiss);
+
+static void BM_GetCustomOptionsHit(int iters) {
+  GetCustomOptionsFromQuery(1 << 20, true, iters);
+}
+BENCHMARK(BM_GetCustomOptionsHit);
+
+const int kLargePageBytes = 4 << 20;
+const int64 kClientFlushUs = 500;
+
+// Models a client connection that takes kClientFlushUs to accept each flush
+// window.  Runs first_byte when the first bytes arrive.
+class ThrottledWriter : public Writer {
+ public:
+  ThrottledWriter(Timer* timer, Function* first_byte)
+      : timer_(timer), first_byte_(first_byte) {}
+
+  virtual bool Write(const StringPiece& str, MessageHandler* handler) {
+    if ((first_byte_ != NULL) && !str.empty()) {
+      Function* first_byte = first_byte_;
+      first_byte_ = NULL;
+      first_byte->CallRun();
+    }
+    return true;
+  }
+
+  virtual bool Flush(MessageHandler* handler) {
+    timer_->SleepUs(kClientFlushUs);
+    return true;
+  }
+
+ private:
+  Timer* timer_;
+  Function* first_byte_;
+
+  DISALLOW_COPY_AND_ASSIGN(ThrottledWriter);
+};
+
+// Streams kLargePageBytes of HTML through a driver one flush window at a
+// time, as ProxyFetch does, timing either the whole response or only up to
+// its first byte.
+static void StreamLargePage(bool pipelined, bool first_byte_only, int iters) {
+  SpeedTestContext speed_test_context;
+
+  StopBenchmarkTiming();
+  ServerContext* server_context = speed_test_context.server_context();
+  Scheduler* scheduler = server_context->scheduler();
+  std::unique_ptr<Timer> timer(
+      speed_test_context.factory()->thread_system()->NewTimer());
+  std::unique_ptr<RewriteOptions> options(new RewriteOptions(
+      speed_test_context.factory()->thread_system()));
+  options->EnableFilter(RewriteOptions::kCollapseWhitespace);
+  options->EnableFilter(RewriteOptions::kRemoveComments);
+  options->set_pipeline_html_output(pipelined);
+
+  GoogleString window;
+  while (static_cast<int64>(window.size()) <
+         options->flush_buffer_limit_bytes()) {
+    window += "<div class='y'>  <!-- c -->  x  y  z </div>\n";  // 44 bytes
+  }
+  int num_windows = kLargePageBytes / window.size();
+  StartBenchmarkTiming();
+
+  for (int i = 0; i < iters; ++i) {
+    SchedulerBlockingFunction first_byte(scheduler);
+    ThrottledWriter writer(timer.get(), &first_byte);
+    RewriteDriver* driver = speed_test_context.NewDriver(options->Clone());
+    driver->SetWriter(&writer);
+    driver->StartParse("http://example.com/index.html");
+    for (int j = 0; j < num_windows; ++j) {
+      driver->ParseText(window);
+      SchedulerBlockingFunction flushed(scheduler);
+      driver->FlushAsync(&flushed);
+      flushed.Block();
+      if ((j == 0) && first_byte_only) {
+        first_byte.Block();
+        StopBenchmarkTiming();
+      }
+    }
+    driver->FinishParse();
+    if (first_byte_only) {
+      StartBenchmarkTiming();
+    }
+  }
+  if (!first_byte_only) {
+    SetBenchmarkBytesProcessed(static_cast<int64>(iters) * num_windows *
+                               window.size());
+  }
+}
+
+static void BM_LargePageSerialFirstByte(int iters) {
+  StreamLargePage(false, true, iters);
+}
+BENCHMARK(BM_LargePageSerialFirstByte);
+
+static void BM_LargePagePipelinedFirstByte(int iters) {
+  StreamLargePage(true, true, iters);
+}
+BENCHMARK(BM_LargePagePipelinedFirstByte);
+
+static void BM_LargePageSerialLastByte(int iters) {
+  StreamLargePage(false, false, iters);
+}
+BENCHMARK(BM_LargePageSerialLastByte);
+
+static void BM_LargePagePipelinedLastByte(int iters) {
+  StreamLargePage(true, false, iters);
+}
+BENCHMARK(BM_LargePagePipelinedLastByte);
+
 }  // namespace
 }  // namespace net_instaweb
@@ -51,6 +51,7 @@
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/string_writer.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
 #include "pagespeed/kernel/html/empty_html_filter.h"
@@ -85,6 +86,10 @@ class RewriteDriverTest : public RewriteTestBase {
     return rewrite_driver()->base_url().Spec().as_string();
   }
 
+  QueuedWorkerPool::Sequence* OutputWorker(RewriteDriver* driver) {
+    return driver->output_worker_;
+  }
+
   // A helper to call ComputeCurrentFlushWindowRewriteDelayMs() that allows
   // us to keep it private.
   int64 GetFlushTimeout() {
@@ -196,6 +201,103 @@ TEST_F(RewriteDriverTest, NoChanges) {
                     "</form></body>");
 }
 
+TEST_F(RewriteDriverTest, PipelinedOutput) {
+  options()->set_pipeline_html_output(true);
+  GoogleString output;
+  StringWriter writer(&output);
+  rewrite_driver()->AddFilters();
+  rewrite_driver()->SetWriter(&writer);
+  ASSERT_TRUE(rewrite_driver()->StartParse(kTestDomain));
+  rewrite_driver()->ParseText("<div>a</div>");
+  rewrite_driver()->Flush();
+  // A blocking Flush waits for the output sequence to deliver the window.
+  EXPECT_EQ("<div>a</div>", output);
+  rewrite_driver()->ParseText("<p>b</p>");
+  rewrite_driver()->FinishParse();
+  EXPECT_EQ("<div>a</div><p>b</p>", output);
+}
+
+// Notifies a SyncPoint whether it is run or canceled.
+class NotifyDoneFunction : public Function {
+ public:
+  explicit NotifyDoneFunction(WorkerTestBase::SyncPoint* sync) : sync_(sync) {}
+
+ protected:
+  virtual void Run() { sync_->Notify(); }
+  virtual void Cancel() { sync_->Notify(); }
+
+ private:
+  WorkerTestBase::SyncPoint* sync_;
+
+  DISALLOW_COPY_AND_ASSIGN(NotifyDoneFunction);
+};
+
+TEST_F(RewriteDriverTest, DestroyWithPipelinedOutputInFlight) {
+  RewriteOptions* driver_options = options()->Clone();
+  driver_options->set_pipeline_html_output(true);
+  RewriteDriver* driver = server_context()->NewUnmanagedRewriteDriver(
+      NULL, driver_options, CreateRequestContext());
+  driver->set_externally_managed(true);
+  driver->AddFilters();
+  GoogleString output;
+  StringWriter writer(&output);
+  driver->SetWriter(&writer);
+  ASSERT_TRUE(driver->StartParse(kTestDomain));
+
+  // Stall the output sequence so the flushed window stays queued on it.
+  WorkerTestBase::SyncPoint stall(server_context()->thread_system());
+  WorkerTestBase::SyncPoint done(server_context()->thread_system());
+  OutputWorker(driver)->Add(new WorkerTestBase::WaitRunFunction(&stall));
+  driver->ParseText("<div>a</div>");
+  SchedulerBlockingFunction flushed(driver->scheduler());
+  driver->FlushAsync(&flushed);
+  flushed.Block();
+  OutputWorker(driver)->Add(new NotifyDoneFunction(&done));
+
+  // The queued delivery must neither touch the deleted driver nor write
+  // to its writer once the sequence resumes.
+  delete driver;
+  stall.Notify();
+  done.Wait();
+  EXPECT_EQ("", output);
+}
+
+TEST_F(RewriteDriverTest, HtmlPassthrough) {
+  options()->set_html_passthrough(true);
+  GoogleString output;
+  StringWriter writer(&output);
+  rewrite_driver()->AddFilters();
+  rewrite_driver()->SetWriter(&writer);
+  const char kHtml[] =
+      "<html><body><div class=a><img src=a.png>"
+      "<base href=http://other.com/><span>b</span></div></body></html>";
+  ASSERT_TRUE(rewrite_driver()->StartParse(kTestDomain));
+  rewrite_driver()->ParseText(kHtml);
+  rewrite_driver()->Flush();
+  // The default filter chain declares its elements, so the div and span are
+  // forwarded without being parsed, while ScanFilter still sees the img
+  // before the base.
+  EXPECT_TRUE(rewrite_driver()->passthrough_active());
+  EXPECT_TRUE(rewrite_driver()->refs_before_base());
+  rewrite_driver()->FinishParse();
+  EXPECT_EQ(kHtml, output);
+}
+
+TEST_F(RewriteDriverTest, HtmlPassthroughNeedsEveryFilter) {
+  options()->set_html_passthrough(true);
+  // CollapseWhitespaceFilter needs to see every element.
+  options()->EnableFilter(RewriteOptions::kCollapseWhitespace);
+  GoogleString output;
+  StringWriter writer(&output);
+  rewrite_driver()->AddFilters();
+  rewrite_driver()->SetWriter(&writer);
+  ASSERT_TRUE(rewrite_driver()->StartParse(kTestDomain));
+  rewrite_driver()->ParseText("<div>a</div>");
+  rewrite_driver()->FinishParse();
+  EXPECT_FALSE(rewrite_driver()->passthrough_active());
+  EXPECT_EQ("<div>a</div>", output);
+}
+
 TEST_F(RewriteDriverTest, CloneMarksNested) {
   RequestHeaders request_headers;
   request_headers.Add(HttpAttributes::kAccept, "image/webp");
@@ -137,6 +137,7 @@ const char RewriteOptions::kHideRefererUsingMeta[] = "HideRefererUsingMeta";
 const char RewriteOptions::kHttpCacheCompressionLevel[] =
     "HttpCacheCompressionLevel";
 const char RewriteOptions::kHonorCsp[] = "HonorCsp";
+const char RewriteOptions::kHtmlPassthrough[] = "HtmlPassthrough";
 const char RewriteOptions::kIdleFlushTimeMs[] = "IdleFlushTimeMs";
 const char RewriteOptions::kImageInlineMaxBytes[] = "ImageInlineMaxBytes";
 const char RewriteOptions::kImageJpegNumProgressiveScans[] =
@@ -234,6 +235,9 @@ const char RewriteOptions::kObliviousPagespeedUrls[] = "ObliviousPagespeedUrls";
 const char RewriteOptions::kOptionCookiesDurationMs[] =
     "OptionCookiesDurationMs";
 const char RewriteOptions::kOverrideCachingTtlMs[] = "OverrideCachingTtlMs";
+const char RewriteOptions::kPipelineHtmlOutput[] = "PipelineHtmlOutput";
+const char RewriteOptions::kPrefetchResourcesOnLex[] =
+    "PrefetchResourcesOnLex";
 const char RewriteOptions::kPreserveSubresourceHints[] =
     "PreserveSubresourceHints";
 const char RewriteOptions::kPreserveUrlRelativity[] = "PreserveUrlRelativity";
@@ -266,6 +270,8 @@ const char RewriteOptions::kServeStaleWhileRevalidateThresholdSec[] =
     "ServeStaleWhileRevalidateThresholdSec";
 const char RewriteOptions::kServeXhrAccessControlHeaders[] =
     "ServeXhrAccessControlHeaders";
+const char RewriteOptions::kShedFetchRewritesAtDeadline[] =
+    "ShedFetchRewritesAtDeadline";
 const char RewriteOptions::kStickyQueryParameters[] = "StickyQueryParameters";
 const char RewriteOptions::kSupportNoScriptEnabled[] = "SupportNoScriptEnabled";
 const char
@@ -950,6 +956,8 @@ struct RenamedOptionMap {
 };
 
 const RenamedOptionMap kRenamedOptionNameData[] = {
+  {"ExperimentalCentralControllerSharedMem",
+      "CentralControllerSharedMem"},
   {"ImageWebpRecompressionQuality",
       "WebpRecompressionQuality"},
   {"ImageWebpRecompressionQualityForSmallScreens",
@@ -2076,6 +2084,31 @@ void RewriteOptions::AddProperties() {
                   "Controls whether PageSpeed should pay attention to "
                   "Content-Security-Policy directives",
                   false);
+  AddBaseProperty(false, &RewriteOptions::html_passthrough_, "htpt",
+                  kHtmlPassthrough, kDirectoryScope,
+                  "Lets the HTML parser forward tags that no enabled filter "
+                  "handles without building elements for them",
+                  true);
+  AddBaseProperty(false, &RewriteOptions::pipeline_html_output_, "pho",
+                  kPipelineHtmlOutput, kServerScope,
+                  "Delivers each flushed window of HTML downstream on a "
+                  "separate thread, overlapping with parsing and filtering "
+                  "of the next window.  Parsing and filtering themselves "
+                  "are not pipelined",
+                  true);
+  AddBaseProperty(false, &RewriteOptions::shed_fetch_rewrites_at_deadline_,
+                  "sfrad", kShedFetchRewritesAtDeadline, kServerScope,
+                  "Drops the rewrite behind a .pagespeed. resource fetch if it "
+                  "is still queued when the fetch gives up waiting and serves "
+                  "the original, rather than finishing it in the background "
+                  "for later fetches",
+                  true);
+  AddBaseProperty(false, &RewriteOptions::prefetch_resources_on_lex_, "prol",
+                  kPrefetchResourcesOnLex, kDirectoryScope,
+                  "Once a rewrite on the page misses in the metadata cache, "
+                  "starts loading stylesheets, scripts and images as soon as "
+                  "the HTML parser sees them, ahead of the rewrite filters",
+                  true);
 
   // Note: defer_javascript and defer_iframe were previously not
   // trusted on mobile user-agents, but have now matured to the point
@@ -3967,27 +4000,37 @@ void RewriteOptions::ComputeSignatureLockHeld() {
                 option->Signature(hasher()), "_");
     }
   }
+  AppendNonOptionSignatureLockHeld(&signature_);
+
+  frozen_ = true;
+
+  // TODO(jmarantz): Incorporate signature from file_load_policy.  However, the
+  // changes made here make our system strictly more correct than it was before,
+  // using an ad-hoc signature in css_filter.cc.
+}
+
+void RewriteOptions::AppendNonOptionSignatureLockHeld(GoogleString* signature) {
   if (javascript_library_identification() != NULL) {
-    StrAppend(&signature_, "LI:");
-    javascript_library_identification()->AppendSignature(&signature_);
-    StrAppend(&signature_, "_");
+    StrAppend(signature, "LI:");
+    javascript_library_identification()->AppendSignature(signature);
+    StrAppend(signature, "_");
   }
-  StrAppend(&signature_, domain_lawyer_->Signature(), "_");
-  StrAppend(&signature_, "AR:", allow_resources_->Signature(), "_");
-  StrAppend(&signature_, "AWIR:",
+  StrAppend(signature, domain_lawyer_->Signature(), "_");
+  StrAppend(signature, "AR:", allow_resources_->Signature(), "_");
+  StrAppend(signature, "AWIR:",
             allow_when_inlining_resources_->Signature(), "_");
-  StrAppend(&signature_, "RC:", retain_comments_->Signature(), "_");
-  StrAppend(&signature_, "LDC:", lazyload_enabled_classes_->Signature(), "_");
-  StrAppend(&signature_, "CCPI:",
+  StrAppend(signature, "RC:", retain_comments_->Signature(), "_");
+  StrAppend(signature, "LDC:", lazyload_enabled_classes_->Signature(), "_");
+  StrAppend(signature, "CCPI:",
             css_combining_permitted_ids_->Signature(), "_");
-  StrAppend(&signature_, "BRRU:",
+  StrAppend(signature, "BRRU:",
             blocking_rewrite_referer_urls_->Signature(), "_");
-  StrAppend(&signature_, "UCI:");
+  StrAppend(signature, "UCI:");
   for (int i = 0, n = url_cache_invalidation_entries_.size(); i < n; ++i) {
     const UrlCacheInvalidationEntry& entry =
         *url_cache_invalidation_entries_[i];
     if (!entry.ignores_metadata_and_pcache) {
-      StrAppend(&signature_, entry.ComputeSignature(), "|");
+      StrAppend(signature, entry.ComputeSignature(), "|");
     }
   }
 
@@ -3998,21 +4041,15 @@ void RewriteOptions::ComputeSignatureLockHeld() {
   // signature and add explicit timestamp checking where needed, such
   // as pcache lookups.  Note that it is already included in HTTPCache
   // lookups.
-  StrAppend(&signature_, "GTS:",
+  StrAppend(signature, "GTS:",
             Integer64ToString(purge_set_->global_invalidation_timestamp_ms()),
             "_");
 
   // rejected_request_map_ is not added to rewrite options signature as this
   // should not affect rewriting and metadata or property cache lookups.
-  StrAppend(&signature_, "OC:", override_caching_wildcard_->Signature(), "_");
-
-  StrAppend(&signature_, SubclassSignatureLockHeld());
-
-  frozen_ = true;
+  StrAppend(signature, "OC:", override_caching_wildcard_->Signature(), "_");
 
-  // TODO(jmarantz): Incorporate signature from file_load_policy.  However, the
-  // changes made here make our system strictly more correct than it was before,
-  // using an ad-hoc signature in css_filter.cc.
+  StrAppend(signature, SubclassSignatureLockHeld());
 }
 
 bool RewriteOptions::ClearSignatureWithCaution() {
@@ -4051,6 +4088,47 @@ bool RewriteOptions::IsEqual(const RewriteOptions& that) const {
   }
 }
 
+GoogleString RewriteOptions::MergeKey() {
+  if (!experiment_specs_.empty() || !resource_headers_.empty() ||
+      !custom_fetch_headers_.empty() || (num_url_valued_attributes() != 0) ||
+      !rejected_request_map_.empty() ||
+      !url_cache_invalidation_entries_.empty()) {
+    return "";
+  }
+  GoogleString key;
+  const FilterSet* filter_sets[] = {
+    &enabled_filters_, &disabled_filters_, &forbidden_filters_
+  };
+  for (int s = 0; s < static_cast<int>(arraysize(filter_sets)); ++s) {
+    key += "|";
+    if (filter_sets[s]->empty()) {
+      continue;
+    }
+    for (int i = kFirstFilter; i != kEndOfFilters; ++i) {
+      Filter filter = static_cast<Filter>(i);
+      if (filter_sets[s]->IsSet(filter)) {
+        StrAppend(&key, FilterId(filter), "_");
+      }
+    }
+  }
+  key += "|";
+  for (int i = 0, n = all_options_.size(); i < n; ++i) {
+    const OptionBase* option = all_options_[i];
+    if (option->was_set()) {
+      // Length-prefix the value, which may contain any character.
+      GoogleString value = option->ToString();
+      StrAppend(&key, option->id(), ":", IntegerToString(value.size()), ":",
+                value);
+    }
+  }
+  key += "|";
+  {
+    ThreadSystem::ScopedReader read_lock(cache_purge_mutex_.get());
+    AppendNonOptionSignatureLockHeld(&key);
+  }
+  return key;
+}
+
 GoogleString RewriteOptions::ToString(const ResourceCategorySet &x) {
   GoogleString result = "";
   const char* delim = "";
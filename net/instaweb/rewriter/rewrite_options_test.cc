@@ -969,6 +969,7 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
     RewriteOptions::kHideRefererUsingMeta,
     RewriteOptions::kHttpCacheCompressionLevel,
     RewriteOptions::kHonorCsp,
+    RewriteOptions::kHtmlPassthrough,
     RewriteOptions::kIdleFlushTimeMs,
     RewriteOptions::kImageInlineMaxBytes,
     RewriteOptions::kImageJpegNumProgressiveScans,
@@ -1033,6 +1034,8 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
     RewriteOptions::kObliviousPagespeedUrls,
     RewriteOptions::kOptionCookiesDurationMs,
     RewriteOptions::kOverrideCachingTtlMs,
+    RewriteOptions::kPipelineHtmlOutput,
+    RewriteOptions::kPrefetchResourcesOnLex,
     RewriteOptions::kPreserveSubresourceHints,
     RewriteOptions::kPreserveUrlRelativity,
     RewriteOptions::kPrivateNotVaryForIE,
@@ -1058,6 +1061,7 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
     RewriteOptions::kServeStaleWhileRevalidateThresholdSec,
     RewriteOptions::kServeWebpToAnyAgent,
     RewriteOptions::kServeXhrAccessControlHeaders,
+    RewriteOptions::kShedFetchRewritesAtDeadline,
     RewriteOptions::kStickyQueryParameters,
     RewriteOptions::kSupportNoScriptEnabled,
     RewriteOptions::kTestOnlyPrioritizeCriticalCssDontApplyOriginalCss,
@@ -2417,6 +2421,33 @@ TEST_F(RewriteOptionsTest, IsEqual) {
   EXPECT_TRUE(a.IsEqual(b));
 }
 
+TEST_F(RewriteOptionsTest, MergeKey) {
+  RewriteOptions a(&thread_system_), b(&thread_system_);
+  a.EnableFilter(RewriteOptions::kSpriteImages);
+  b.EnableFilter(RewriteOptions::kSpriteImages);
+  EXPECT_EQ(a.MergeKey(), b.MergeKey());
+
+  // The key does not need, or compute, the signature.
+  EXPECT_FALSE(a.frozen());
+  a.ComputeSignature();
+  b.ComputeSignature();
+  EXPECT_EQ(a.MergeKey(), b.MergeKey());
+
+  // Explicitly disabling a filter does not change the signature, but
+  // changes what Merge does, so it must change the key.
+  b.ClearSignatureForTesting();
+  b.DisableFilter(RewriteOptions::kCombineCss);
+  b.ComputeSignature();
+  EXPECT_EQ(a.signature(), b.signature());
+  EXPECT_NE(a.MergeKey(), b.MergeKey());
+
+  // State outside the key makes the options uncacheable.
+  b.ClearSignatureForTesting();
+  b.AddResourceHeader("X-Foo", "bar");
+  b.ComputeSignature();
+  EXPECT_EQ("", b.MergeKey());
+}
+
 TEST_F(RewriteOptionsTest, ComputeSignatureEmptyIdempotent) {
   options_.ClearSignatureForTesting();
   options_.DisallowTroublesomeResources();
@@ -20,10 +20,17 @@
 
 #include "net/instaweb/rewriter/public/rewrite_stats.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "net/instaweb/rewriter/public/server_context.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/waveform.h"
+#include "pagespeed/kernel/thread/cpu_affinity.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
 
 namespace net_instaweb {
 
@@ -52,6 +59,30 @@ const char kIproServed[] = "ipro_served";
 const char kIproNotInCache[] = "ipro_not_in_cache";
 const char kIproNotRewritable[] = "ipro_not_rewritable";
 
+const char kRewriteDriverPoolHits[] = "rewrite_driver_pool_hits";
+const char kRewriteDriverPoolMisses[] = "rewrite_driver_pool_misses";
+
+const char* kWorkerFunctionsShed[QueuedWorkerPool::kNumShedReasons] = {
+  "worker_functions_shed_queue_length",
+  "worker_functions_shed_queue_time",
+  "worker_functions_shed_deadline"
+};
+
+// Worker busy time is tracked for each CPU this process may run on, up to
+// this many.
+const int kMaxWorkerCpuBusyTimeStats = 64;
+
+int NumWorkerCpuBusyTimeStats() {
+  std::vector<int> cpus;
+  CpuAffinity::AllowedCpus(&cpus);
+  return cpus.empty() ? 0 : std::min(cpus.back() + 1,
+                                     kMaxWorkerCpuBusyTimeStats);
+}
+
+GoogleString WorkerCpuBusyTimeName(int cpu) {
+  return StrCat("worker_cpu_busy_us_", IntegerToString(cpu));
+}
+
 const char* kWaveFormCounters[RewriteDriverFactory::kNumWorkerPools] = {
   "html-worker-queue-depth",
   "rewrite-worker-queue-depth",
@@ -75,12 +106,20 @@ const char kFetchLatencyHistogram[] = "Pagespeed Resource Latency Histogram";
 const char kRewriteLatencyHistogram[] = "Rewrite Latency Histogram";
 const char kBackendLatencyHistogram[] =
     "Backend Fetch First Byte Latency Histogram";
+const char* kWorkerQueueTimeHistograms[QueuedWorkerPool::kNumPriorities] = {
+  "Deadline-Critical Worker Queue Time (us)",
+  "Normal Worker Queue Time (us)",
+  "Background Worker Queue Time (us)"
+};
+const char kLowPrioritySojournTimeHistogram[] =
+    "Low-Priority Worker Sojourn Time (us)";
 
 // TimedVariable names.
 const char kTotalFetchCount[] = "total_fetch_count";
 const char kTotalRewriteCount[] = "total_rewrite_count";
 const char kRewritesExecuted[] = "num_rewrites_executed";
 const char kRewritesDropped[] = "num_rewrites_dropped";
+const char kRewriteDriversConstructed[] = "num_rewrite_drivers_constructed";
 
 }  // namespace
 
@@ -130,6 +169,16 @@ void RewriteStats::InitStats(Statistics* statistics) {
   statistics->AddHistogram(kFetchLatencyHistogram);
   statistics->AddHistogram(kRewriteLatencyHistogram);
   statistics->AddHistogram(kBackendLatencyHistogram);
+  for (int i = 0; i < QueuedWorkerPool::kNumPriorities; ++i) {
+    statistics->AddHistogram(kWorkerQueueTimeHistograms[i]);
+  }
+  statistics->AddHistogram(kLowPrioritySojournTimeHistogram);
+  for (int i = 0; i < QueuedWorkerPool::kNumShedReasons; ++i) {
+    statistics->AddVariable(kWorkerFunctionsShed[i]);
+  }
+  for (int cpu = 0, n = NumWorkerCpuBusyTimeStats(); cpu < n; ++cpu) {
+    statistics->AddVariable(WorkerCpuBusyTimeName(cpu));
+  }
   statistics->AddVariable(kFallbackResponsesServed);
   statistics->AddVariable(kProactivelyFreshenUserFacingRequest);
   statistics->AddVariable(kFallbackResponsesServedWhileRevalidate);
@@ -139,6 +188,8 @@ void RewriteStats::InitStats(Statistics* statistics) {
   statistics->AddVariable(kIproNotRewritable);
   statistics->AddVariable(kDownstreamCachePurgeAttempts);
   statistics->AddVariable(kSuccessfulDownstreamCachePurges);
+  statistics->AddVariable(kRewriteDriverPoolHits);
+  statistics->AddVariable(kRewriteDriverPoolMisses);
   statistics->AddTimedVariable(kTotalFetchCount,
                                Statistics::kDefaultGroup);
   statistics->AddTimedVariable(kTotalRewriteCount,
@@ -147,6 +198,8 @@ void RewriteStats::InitStats(Statistics* statistics) {
                                Statistics::kDefaultGroup);
   statistics->AddTimedVariable(kRewritesDropped,
                                Statistics::kDefaultGroup);
+  statistics->AddTimedVariable(kRewriteDriversConstructed,
+                               Statistics::kDefaultGroup);
   statistics->AddVariable(kNumResourceFetchSuccesses);
   statistics->AddVariable(kNumResourceFetchFailures);
 
@@ -209,6 +262,9 @@ RewriteStats::RewriteStats(bool has_waveforms,
           stats->GetVariable(kDownstreamCachePurgeAttempts)),
       successful_downstream_cache_purges_(
           stats->GetVariable(kSuccessfulDownstreamCachePurges)),
+      rewrite_driver_pool_hits_(stats->GetVariable(kRewriteDriverPoolHits)),
+      rewrite_driver_pool_misses_(
+          stats->GetVariable(kRewriteDriverPoolMisses)),
       beacon_timings_ms_histogram_(
           stats->GetHistogram(kBeaconTimingsMsHistogram)),
       fetch_latency_histogram_(
@@ -217,10 +273,14 @@ RewriteStats::RewriteStats(bool has_waveforms,
           stats->GetHistogram(kRewriteLatencyHistogram)),
       backend_latency_histogram_(
           stats->GetHistogram(kBackendLatencyHistogram)),
+      low_priority_sojourn_time_histogram_(
+          stats->GetHistogram(kLowPrioritySojournTimeHistogram)),
       total_fetch_count_(stats->GetTimedVariable(kTotalFetchCount)),
       total_rewrite_count_(stats->GetTimedVariable(kTotalRewriteCount)),
       num_rewrites_executed_(stats->GetTimedVariable(kRewritesExecuted)),
-      num_rewrites_dropped_(stats->GetTimedVariable(kRewritesDropped)) {
+      num_rewrites_dropped_(stats->GetTimedVariable(kRewritesDropped)),
+      num_rewrite_drivers_constructed_(
+          stats->GetTimedVariable(kRewriteDriversConstructed)) {
   // Timers are not guaranteed to go forward in time, however
   // Histograms will CHECK-fail given a negative value unless
   // EnableNegativeBuckets is called, allowing bars to be created with
@@ -231,6 +291,20 @@ RewriteStats::RewriteStats(bool has_waveforms,
   rewrite_latency_histogram_->EnableNegativeBuckets();
   backend_latency_histogram_->EnableNegativeBuckets();
 
+  for (int i = 0; i < QueuedWorkerPool::kNumPriorities; ++i) {
+    worker_queue_time_histograms_[i] =
+        stats->GetHistogram(kWorkerQueueTimeHistograms[i]);
+    worker_queue_time_histograms_[i]->EnableNegativeBuckets();
+  }
+  low_priority_sojourn_time_histogram_->EnableNegativeBuckets();
+  for (int i = 0; i < QueuedWorkerPool::kNumShedReasons; ++i) {
+    worker_functions_shed_[i] = stats->GetVariable(kWorkerFunctionsShed[i]);
+  }
+  for (int cpu = 0, n = NumWorkerCpuBusyTimeStats(); cpu < n; ++cpu) {
+    worker_cpu_busy_times_.push_back(
+        stats->GetVariable(WorkerCpuBusyTimeName(cpu)));
+  }
+
   for (int i = 0; i < RewriteDriverFactory::kNumWorkerPools; ++i) {
     if (has_waveforms) {
       thread_queue_depths_.push_back(
@@ -21,6 +21,7 @@
 #include "net/instaweb/rewriter/public/scan_filter.h"
 
 #include <memory>
+#include <vector>
 
 #include "net/instaweb/rewriter/public/common_filter.h"
 #include "net/instaweb/rewriter/public/csp.h"
@@ -215,6 +216,14 @@ void ScanFilter::EndElement(HtmlElement* element) {
   }
 }
 
+bool ScanFilter::GetRelevantElements(
+    std::vector<HtmlName::Keyword>* keywords) const {
+  keywords->push_back(HtmlName::kBase);
+  keywords->push_back(HtmlName::kMeta);
+  return resource_tag_scanner::GetScannedElements(driver_->options(),
+                                                  keywords);
+}
+
 void ScanFilter::Flush() {
   driver_->server_context()->rewrite_stats()->num_flushes()->Add(1);
 }
@@ -36,6 +36,7 @@
 #include "net/instaweb/rewriter/public/critical_images_finder.h"
 #include "net/instaweb/rewriter/public/critical_selector_finder.h"
 #include "net/instaweb/rewriter/public/experiment_matcher.h"
+#include "net/instaweb/rewriter/public/merged_options_cache.h"
 #include "net/instaweb/rewriter/public/output_resource_kind.h"
 #include "net/instaweb/rewriter/public/request_properties.h"
 #include "net/instaweb/rewriter/public/resource.h"
@@ -258,6 +259,7 @@ ServerContext::ServerContext(RewriteDriverFactory* factory)
       store_outputs_in_file_system_(false),
       response_headers_finalized_(true),
       enable_property_cache_(true),
+      estimate_expensive_operation_costs_(false),
       lock_manager_(NULL),
       message_handler_(NULL),
       dom_cohort_(NULL),
@@ -726,6 +728,9 @@ RewriteDriver* ServerContext::NewUnmanagedRewriteDriver(
     const RequestContextPtr& request_ctx) {
   RewriteDriver* rewrite_driver = new RewriteDriver(
       message_handler_, file_system_, default_system_fetcher_);
+  if (rewrite_stats_ != NULL) {
+    rewrite_stats_->num_rewrite_drivers_constructed()->IncBy(1);
+  }
   rewrite_driver->set_options_for_pool(pool, options);
   rewrite_driver->SetServerContext(this);
   rewrite_driver->ClearRequestProperties();
@@ -750,24 +755,13 @@ RewriteDriver* ServerContext::NewRewriteDriverFromPool(
   const RewriteOptions* options = pool->TargetOptions();
   {
     ScopedMutex lock(rewrite_drivers_mutex_.get());
-    while ((rewrite_driver = pool->PopDriver()) != NULL) {
-      // Note: there is currently some activity to make the RewriteOptions
-      // signature insensitive to changes that need not affect the metadata
-      // cache key.  As we are dependent on a comprehensive signature in
-      // order to correctly determine whether we can recycle a RewriteDriver,
-      // we would have to use a separate signature for metadata_cache_key
-      // vs this purpose.
-      //
-      // So for now, let us keep all the options incorporated into the
-      // signature, and revisit the issue of pulling options out if we
-      // find we are having poor hit-rate in the metadata cache during
-      // operations.
-      if (rewrite_driver->options()->IsEqual(*options)) {
-        break;
-      } else {
-        delete rewrite_driver;
-        rewrite_driver = NULL;
-      }
+    rewrite_driver = pool->PopDriver();
+  }
+  if (rewrite_stats_ != NULL) {
+    if (rewrite_driver == NULL) {
+      rewrite_stats_->rewrite_driver_pool_misses()->Add(1);
+    } else {
+      rewrite_stats_->rewrite_driver_pool_hits()->Add(1);
     }
   }
 
@@ -794,6 +788,24 @@ RewriteDriver* ServerContext::NewRewriteDriverFromPool(
   return rewrite_driver;
 }
 
+void ServerContext::WarmRewriteDriverPool(int num_drivers) {
+  num_drivers = std::min(num_drivers, RewriteDriverPool::kMaxDriversInPool);
+  {
+    ScopedMutex lock(rewrite_drivers_mutex_.get());
+    standard_rewrite_driver_pool()->set_min_target_size(num_drivers);
+  }
+  RequestContextPtr request_ctx(new RequestContext(
+      global_options()->ComputeHttpOptions(), thread_system()->NewMutex(),
+      timer()));
+  std::vector<RewriteDriver*> drivers;
+  for (int i = 0; i < num_drivers; ++i) {
+    drivers.push_back(NewRewriteDriver(request_ctx));
+  }
+  for (int i = 0, n = drivers.size(); i < n; ++i) {
+    drivers[i]->Cleanup();
+  }
+}
+
 void ServerContext::ReleaseRewriteDriver(RewriteDriver* rewrite_driver) {
   ScopedMutex lock(rewrite_drivers_mutex_.get());
   ReleaseRewriteDriverImpl(rewrite_driver);
@@ -885,6 +897,22 @@ const RewriteOptions* ServerContext::global_options() const {
 
 void ServerContext::reset_global_options(RewriteOptions* options) {
   base_class_options_.reset(options);
+  ClearMergedOptionsCache();
+}
+
+void ServerContext::set_merged_options_cache_bytes(size_t max_bytes) {
+  if (max_bytes == 0) {
+    merged_options_cache_.reset();
+  } else {
+    merged_options_cache_.reset(
+        new MergedOptionsCache(max_bytes, thread_system_));
+  }
+}
+
+void ServerContext::ClearMergedOptionsCache() {
+  if (merged_options_cache_.get() != NULL) {
+    merged_options_cache_->Clear();
+  }
 }
 
 RewriteOptions* ServerContext::NewOptions() {
@@ -951,6 +979,27 @@ RewriteOptions* ServerContext::GetCustomOptions(RequestHeaders* request_headers,
   }
 
   scoped_ptr<RewriteOptions> query_options_ptr(query_options);
+
+  // The common case of query-param or request-header overrides on top of
+  // the global options is served from merged_options_cache_ when possible.
+  // The generation is read before global_options() are merged, so that a
+  // result merged from options that are concurrently purged is not cached.
+  GoogleString merged_key;
+  int64 merged_generation = 0;
+  if (query_options_ptr.get() != NULL && custom_options.get() == NULL &&
+      merged_options_cache_.get() != NULL && options->frozen()) {
+    merged_generation = merged_options_cache_->generation();
+    GoogleString query_key = query_options->MergeKey();
+    if (!query_key.empty()) {
+      StrAppend(&merged_key, options->signature(), "|", query_key);
+      RewriteOptions* cached = merged_options_cache_->Lookup(merged_key);
+      if (cached != NULL) {
+        custom_options.reset(cached);
+        query_options_ptr.reset();
+      }
+    }
+  }
+
   // Check query params & request-headers
   if (query_options_ptr.get() != NULL) {
     // Subtle memory management to handle deleting any domain_options
@@ -966,6 +1015,10 @@ RewriteOptions* ServerContext::GetCustomOptions(RequestHeaders* request_headers,
     if (!custom_options->enroll_experiment()) {
       custom_options->set_running_experiment(false);
     }
+    if (!merged_key.empty()) {
+      merged_options_cache_->Insert(merged_key, *custom_options,
+                                    merged_generation);
+    }
   }
 
   url_namer()->ConfigureCustomOptions(*request_headers, custom_options.get());
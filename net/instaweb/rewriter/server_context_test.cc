@@ -23,6 +23,7 @@
 #include "net/instaweb/rewriter/public/server_context.h"
 
 #include <cstddef>                     // for size_t
+#include <vector>
 
 #include "base/logging.h"
 #include "net/instaweb/http/public/async_fetch.h"
@@ -39,12 +40,14 @@
 #include "net/instaweb/rewriter/public/css_outline_filter.h"
 #include "net/instaweb/rewriter/public/domain_lawyer.h"
 #include "net/instaweb/rewriter/public/file_load_policy.h"
+#include "net/instaweb/rewriter/public/merged_options_cache.h"
 #include "net/instaweb/rewriter/public/mock_resource_callback.h"
 #include "net/instaweb/rewriter/public/output_resource.h"
 #include "net/instaweb/rewriter/public/output_resource_kind.h"
 #include "net/instaweb/rewriter/public/resource.h"
 #include "net/instaweb/rewriter/public/resource_namer.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
+#include "net/instaweb/rewriter/public/rewrite_driver_pool.h"
 #include "net/instaweb/rewriter/public/rewrite_filter.h"
 #include "net/instaweb/rewriter/public/rewrite_options.h"
 #include "net/instaweb/rewriter/public/rewrite_query.h"
@@ -463,6 +466,58 @@ TEST_F(ServerContextTest, CustomOptionsWithNoUrlNamerOptions) {
   EXPECT_FALSE(options->Enabled(RewriteOptions::kPrioritizeCriticalCss));
 }
 
+TEST_F(ServerContextTest, CustomOptionsAreCachedByQuery) {
+  // The cache is off unless configured.
+  EXPECT_TRUE(server_context()->merged_options_cache() == NULL);
+  server_context()->set_merged_options_cache_bytes(1 << 20);
+  server_context()->ComputeSignature(server_context()->global_options());
+  MergedOptionsCache* cache = server_context()->merged_options_cache();
+  ASSERT_TRUE(cache != NULL);
+  RequestHeaders request_headers;
+
+  scoped_ptr<RewriteOptions> first(GetCustomOptions(
+      "http://example.com/?PageSpeedFilters=extend_cache",
+      &request_headers, NULL));
+  ASSERT_TRUE(first.get() != NULL);
+  EXPECT_EQ(0U, cache->num_hits());
+  EXPECT_EQ(1U, cache->num_elements());
+
+  // Same overrides on a different URL hit the cache, and the result is a
+  // mutable copy equivalent to the merged original.
+  scoped_ptr<RewriteOptions> second(GetCustomOptions(
+      "http://example.com/other?PageSpeedFilters=extend_cache",
+      &request_headers, NULL));
+  ASSERT_TRUE(second.get() != NULL);
+  EXPECT_EQ(1U, cache->num_hits());
+  EXPECT_FALSE(second->frozen());
+  CheckExtendCache(second.get(), true);
+  EXPECT_FALSE(second->Enabled(RewriteOptions::kCombineCss));
+  first->ComputeSignature();
+  second->ComputeSignature();
+  EXPECT_TRUE(first->IsEqual(*second));
+
+  // The debug filter is not in the signature but must still miss.
+  scoped_ptr<RewriteOptions> debug(GetCustomOptions(
+      "http://example.com/?PageSpeedFilters=extend_cache,debug",
+      &request_headers, NULL));
+  ASSERT_TRUE(debug.get() != NULL);
+  EXPECT_TRUE(debug->Enabled(RewriteOptions::kDebug));
+  EXPECT_EQ(1U, cache->num_hits());
+  EXPECT_EQ(2U, cache->num_elements());
+
+  // Disabling a filter leaves the signature unchanged, since it only lists
+  // enabled filters, but must also miss.
+  scoped_ptr<RewriteOptions> disabled(GetCustomOptions(
+      "http://example.com/?PageSpeedFilters=extend_cache,-combine_css",
+      &request_headers, NULL));
+  ASSERT_TRUE(disabled.get() != NULL);
+  EXPECT_EQ(1U, cache->num_hits());
+  EXPECT_EQ(3U, cache->num_elements());
+
+  server_context()->ClearMergedOptionsCache();
+  EXPECT_EQ(0U, cache->num_elements());
+}
+
 TEST_F(ServerContextTest, CustomOptionsWithUrlNamerOptions) {
   // Inject a url-namer that will establish a domain configuration.
   RewriteOptions namer_options(factory()->thread_system());
@@ -719,6 +774,61 @@ TEST_F(ServerContextTest, TestPlatformSpecificConfiguration) {
   custom_driver->Cleanup();
 }
 
+TEST_F(ServerContextTest, RewriteDriverPoolAdaptsToDemand) {
+  RewriteDriverPool* pool = server_context()->standard_rewrite_driver_pool();
+  Variable* hits = statistics()->GetVariable("rewrite_driver_pool_hits");
+  Variable* misses = statistics()->GetVariable("rewrite_driver_pool_misses");
+  ASSERT_EQ(0, pool->num_idle_drivers());
+
+  // A burst of 4 concurrent requests constructs 4 drivers.
+  std::vector<RewriteDriver*> drivers;
+  for (int i = 0; i < 4; ++i) {
+    drivers.push_back(server_context()->NewRewriteDriver(
+        CreateRequestContext()));
+  }
+  for (int i = 0; i < 4; ++i) {
+    drivers[i]->Cleanup();
+  }
+  EXPECT_EQ(4, pool->num_idle_drivers());
+  EXPECT_EQ(0, pool->num_outstanding_drivers());
+  EXPECT_EQ(4, misses->Get());
+
+  // Serial requests are all served from the pool.  After a couple of
+  // adaptation periods in which at most one driver was needed at a time, the
+  // pool shrinks to its minimum size.
+  for (int i = 0; i < 2 * RewriteDriverPool::kAdaptationPeriod; ++i) {
+    RewriteDriver* driver = server_context()->NewRewriteDriver(
+        CreateRequestContext());
+    driver->Cleanup();
+  }
+  EXPECT_EQ(4, misses->Get());
+  EXPECT_EQ(2 * RewriteDriverPool::kAdaptationPeriod, hits->Get());
+  EXPECT_EQ(RewriteDriverPool::kMinDriversInPool, pool->target_size());
+  EXPECT_EQ(RewriteDriverPool::kMinDriversInPool, pool->num_idle_drivers());
+}
+
+TEST_F(ServerContextTest, WarmRewriteDriverPoolIsKept) {
+  RewriteDriverPool* pool = server_context()->standard_rewrite_driver_pool();
+  Variable* hits = statistics()->GetVariable("rewrite_driver_pool_hits");
+  Variable* misses = statistics()->GetVariable("rewrite_driver_pool_misses");
+
+  server_context()->WarmRewriteDriverPool(4);
+  EXPECT_EQ(4, pool->num_idle_drivers());
+  EXPECT_EQ(4, pool->min_target_size());
+  EXPECT_EQ(4, misses->Get());
+
+  // Serial traffic doesn't shrink the pool below the warm size.
+  for (int i = 0; i < 2 * RewriteDriverPool::kAdaptationPeriod; ++i) {
+    RewriteDriver* driver = server_context()->NewRewriteDriver(
+        CreateRequestContext());
+    driver->Cleanup();
+  }
+  EXPECT_EQ(4, misses->Get());
+  EXPECT_EQ(2 * RewriteDriverPool::kAdaptationPeriod, hits->Get());
+  EXPECT_EQ(4, pool->target_size());
+  EXPECT_EQ(4, pool->num_idle_drivers());
+}
+
 // Tests that platform-specific rewriters are used for decoding fetches.
 TEST_F(ServerContextTest, TestPlatformSpecificRewritersDecoding) {
   GoogleString url = Encode("http://example.com/dir/123/",
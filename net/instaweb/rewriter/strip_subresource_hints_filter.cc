@@ -20,6 +20,8 @@
 
 #include "net/instaweb/rewriter/public/strip_subresource_hints_filter.h"
 
+#include <vector>
+
 #include "net/instaweb/rewriter/public/domain_lawyer.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
 #include "net/instaweb/rewriter/public/rewrite_options.h"
@@ -84,6 +86,12 @@ bool StripSubresourceHintsFilter::ShouldStrip(HtmlElement* element) {
   return false;
 }
 
+bool StripSubresourceHintsFilter::GetRelevantElements(
+    std::vector<HtmlName::Keyword>* keywords) const {
+  keywords->push_back(HtmlName::kLink);
+  return true;
+}
+
 void StripSubresourceHintsFilter::StartElement(HtmlElement* element) {
   if (ShouldStrip(element)) {
     const RewriteOptions *options = driver_->options();
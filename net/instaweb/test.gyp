@@ -181,6 +181,7 @@
         'rewriter/local_storage_cache_filter_test.cc',
         'rewriter/make_show_ads_async_filter_test.cc',
         'rewriter/measurement_proxy_url_namer_test.cc',
+        'rewriter/merged_options_cache_test.cc',
         'rewriter/meta_tag_filter_test.cc',
         'rewriter/mock_critical_images_finder.cc',
         'rewriter/mock_resource_callback.cc',
@@ -192,6 +193,7 @@
         'rewriter/resource_combiner_test.cc',
         'rewriter/resource_fetch_test.cc',
         'rewriter/resource_namer_test.cc',
+        'rewriter/resource_prefetch_filter_test.cc',
         'rewriter/resource_slot_test.cc',
         'rewriter/resource_tag_scanner_test.cc',
         'rewriter/resource_update_test.cc',
@@ -230,15 +232,19 @@
         '<(DEPTH)/pagespeed/system/system_message_handler_test.cc',
         '<(DEPTH)/pagespeed/controller/central_controller_callback_test.cc',
         '<(DEPTH)/pagespeed/controller/context_registry_test.cc',
+        '<(DEPTH)/pagespeed/controller/cost_based_expensive_operation_controller_test.cc',
         '<(DEPTH)/pagespeed/controller/expensive_operation_rpc_context_test.cc',
         '<(DEPTH)/pagespeed/controller/expensive_operation_rpc_handler_test.cc',
         '<(DEPTH)/pagespeed/controller/grpc_server_test.cc',
+        '<(DEPTH)/pagespeed/controller/multiplexed_rpc_handler_test.cc',
         '<(DEPTH)/pagespeed/controller/named_lock_schedule_rewrite_controller_test.cc',
         '<(DEPTH)/pagespeed/controller/popularity_contest_schedule_rewrite_controller_test.cc',
         '<(DEPTH)/pagespeed/controller/priority_queue_test.cc',
         '<(DEPTH)/pagespeed/controller/rpc_handler_test.cc',
         '<(DEPTH)/pagespeed/controller/schedule_rewrite_rpc_context_test.cc',
         '<(DEPTH)/pagespeed/controller/schedule_rewrite_rpc_handler_test.cc',
+        '<(DEPTH)/pagespeed/controller/sharded_schedule_rewrite_controller_test.cc',
+        '<(DEPTH)/pagespeed/controller/shared_mem_central_controller_test.cc',
         '<(DEPTH)/pagespeed/controller/queued_expensive_operation_controller_test.cc',
         '<(DEPTH)/pagespeed/controller/work_bound_expensive_operation_controller_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/annotated_message_handler_test.cc',
@@ -313,6 +319,7 @@
         '<(DEPTH)/pagespeed/kernel/http/data_url_test.cc',
         '<(DEPTH)/pagespeed/kernel/http/domain_registry_test.cc',
         '<(DEPTH)/pagespeed/kernel/http/google_url_test.cc',
+        '<(DEPTH)/pagespeed/kernel/http/header_index_test.cc',
         '<(DEPTH)/pagespeed/kernel/http/query_params_test.cc',
         '<(DEPTH)/pagespeed/kernel/http/request_headers_test.cc',
         '<(DEPTH)/pagespeed/kernel/http/response_headers_test.cc',
@@ -340,7 +347,9 @@
         '<(DEPTH)/pagespeed/kernel/js/js_tokenizer_test.cc',
         '<(DEPTH)/pagespeed/kernel/sharedmem/inprocess_shared_mem_test.cc',
         '<(DEPTH)/pagespeed/kernel/sharedmem/shared_mem_cache_spammer_test.cc',
+        '<(DEPTH)/pagespeed/kernel/thread/cpu_affinity_test.cc',
         '<(DEPTH)/pagespeed/kernel/thread/mock_scheduler_test.cc',
+        '<(DEPTH)/pagespeed/kernel/thread/pipelined_writer_test.cc',
         '<(DEPTH)/pagespeed/kernel/thread/pthread_condvar_test.cc',
         '<(DEPTH)/pagespeed/kernel/thread/pthread_thread_system_test.cc',
         '<(DEPTH)/pagespeed/kernel/thread/queued_alarm_test.cc',
@@ -364,6 +373,7 @@
         '<(DEPTH)/pagespeed/kernel/util/re2_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/simple_stats_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/statistics_logger_test.cc',
+        '<(DEPTH)/pagespeed/kernel/util/streaming_decoder_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/threadsafe_lock_manager_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/url_escaper_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/url_multipart_encoder_test.cc',
@@ -448,6 +458,16 @@
         '<(DEPTH)/pagespeed/system/system_rewrite_options_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/mem_debug.cc',
       ],
+      'conditions': [
+        ['enable_http2_fetcher == 1', {
+          'dependencies': [
+            '<(DEPTH)/build/nghttp2.gyp:nghttp2',
+          ],
+          'sources': [
+            '<(DEPTH)/pagespeed/system/http2_url_async_fetcher_test.cc',
+          ],
+        }]
+      ],
     },
     {
       'target_name': 'test_infrastructure',
@@ -504,10 +524,14 @@
         'test_util',
         '<(DEPTH)/net/instaweb/instaweb.gyp:instaweb_console_css_data2c',
         '<(DEPTH)/net/instaweb/instaweb.gyp:instaweb_console_js_data2c',
+        '<(DEPTH)/net/instaweb/instaweb.gyp:instaweb_system',
+        '<(DEPTH)/pagespeed/controller.gyp:pagespeed_controller',
+        '<(DEPTH)/pagespeed/kernel.gyp:brotli',
         '<(DEPTH)/pagespeed/kernel.gyp:pthread_system',
         '<(DEPTH)/pagespeed/kernel.gyp:pagespeed_base_core',
         '<(DEPTH)/pagespeed/kernel.gyp:pagespeed_http',
         '<(DEPTH)/pagespeed/kernel.gyp:proto_util',
+        '<(DEPTH)/pagespeed/kernel.gyp:tcp_server_thread_for_testing',
         '<(DEPTH)/third_party/css_parser/css_parser.gyp:css_parser',
         '<(DEPTH)/third_party/re2/re2.gyp:re2_bench_util',
       ],
@@ -521,6 +545,7 @@
         'rewriter/image_speed_test.cc',
         'rewriter/javascript_minify_speed_test.cc',
         'rewriter/rewrite_driver_speed_test.cc',
+        '<(DEPTH)/pagespeed/controller/schedule_rewrite_controller_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/fast_wildcard_group_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/file_system_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/string_multi_map_speed_test.cc',
@@ -528,8 +553,11 @@
         '<(DEPTH)/pagespeed/kernel/cache/compressed_cache_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/lru_cache_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/html_parse_speed_test.cc',
+        '<(DEPTH)/pagespeed/kernel/http/response_headers_parser_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/deque_speed_test.cc',
+        '<(DEPTH)/pagespeed/kernel/util/streaming_decoder_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/url_escaper_speed_test.cc',
+        '<(DEPTH)/pagespeed/system/serf_url_async_fetcher_speed_test.cc',
       ],
     },
     {
@@ -126,6 +126,8 @@ const char kModPagespeedDomain[] = "ModPagespeedDomain";
 const char kModPagespeedDownstreamCachePurgeLocationPrefix[] =
     "ModPagespeedDownstreamCachePurgeLocationPrefix";
 const char kModPagespeedEnableFilters[] = "ModPagespeedEnableFilters";
+const char kModPagespeedExpensiveRewriteQueueTimeTargetMs[] =
+    "ModPagespeedExpensiveRewriteQueueTimeTargetMs";
 const char kModPagespeedFetchProxy[] = "ModPagespeedFetchProxy";
 const char kModPagespeedFetcherTimeoutMs[] = "ModPagespeedFetcherTimeOutMs";
 const char kModPagespeedFileCachePath[] = "ModPagespeedFileCachePath";
@@ -165,6 +167,9 @@ const char kModPagespeedPreserveSubresourceHints[] =
     "ModPagespeedPreserveSubresourceHints";
 const char kModPagespeedProxySuffix[] = "ModPagespeedProxySuffix";
 const char kModPagespeedRetainComment[] = "ModPagespeedRetainComment";
+const char kModPagespeedRewriteDriverPoolWarmSize[] =
+    "ModPagespeedRewriteDriverPoolWarmSize";
+const char kModPagespeedRewriteWorkerCpus[] = "ModPagespeedRewriteWorkerCpus";
 const char kModPagespeedRunExperiment[] = "ModPagespeedRunExperiment";
 const char kModPagespeedShardDomain[] = "ModPagespeedShardDomain";
 const char kModPagespeedSpeedTracking[] = "ModPagespeedIncreaseSpeedTracking";
@@ -1784,6 +1789,14 @@ static const command_rec mod_pagespeed_filter_cmds[] = {
   APACHE_CONFIG_OPTION(kModPagespeedNumExpensiveRewriteThreads,
         "Number of threads to use for computation-intensive portions of "
         "resource-rewriting. <= 0 to auto-detect"),
+  APACHE_CONFIG_OPTION(kModPagespeedExpensiveRewriteQueueTimeTargetMs,
+        "Drop computation-intensive rewrites once they persistently wait "
+        "longer than this many ms for a thread. 0 to disable"),
+  APACHE_CONFIG_OPTION(kModPagespeedRewriteDriverPoolWarmSize,
+        "Number of rewrite drivers to construct and keep for each enabled "
+        "virtual host in each child process"),
+  APACHE_CONFIG_OPTION(kModPagespeedRewriteWorkerCpus,
+        "CPUs, e.g. 0-3,8 or all, to pin rewrite threads to, one per core"),
   APACHE_CONFIG_OPTION(kModPagespeedStaticAssetPrefix,
          "Where to serve static support files for pagespeed filters from."),
   APACHE_CONFIG_OPTION(kModPagespeedTrackOriginalContentLength,
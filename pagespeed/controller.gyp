@@ -58,16 +58,24 @@
         'controller/central_controller_rpc_client.cc',
         'controller/central_controller_rpc_server.cc',
         'controller/compatible_central_controller.cc',
+        'controller/cost_based_expensive_operation_controller.cc',
         'controller/expensive_operation_callback.cc',
+        'controller/expensive_operation_cost.cc',
         'controller/expensive_operation_rpc_context.cc',
         'controller/expensive_operation_rpc_handler.cc',
         'controller/in_process_central_controller.cc',
+        'controller/multiplexed_rpc_client.cc',
+        'controller/multiplexed_rpc_handler.cc',
         'controller/named_lock_schedule_rewrite_controller.cc',
         'controller/popularity_contest_schedule_rewrite_controller.cc',
         'controller/queued_expensive_operation_controller.cc',
         'controller/schedule_rewrite_callback.cc',
         'controller/schedule_rewrite_rpc_context.cc',
         'controller/schedule_rewrite_rpc_handler.cc',
+        'controller/sharded_schedule_rewrite_controller.cc',
+        'controller/shared_mem_central_controller.cc',
+        'controller/shared_mem_controller_channel.cc',
+        'controller/shared_mem_controller_server.cc',
         'controller/work_bound_expensive_operation_controller.cc',
       ],
       'include_dirs': [
@@ -76,6 +84,7 @@
       'dependencies': [
         ':pagespeed_controller_proto',
         '<(DEPTH)/base/base.gyp:base',
+        '<(DEPTH)/pagespeed/kernel.gyp:pagespeed_sharedmem',
         '<(DEPTH)/third_party/grpc/grpc.gyp:grpc_cpp',
       ],
       'export_dependent_settings': [
@@ -125,7 +125,8 @@ CentralControllerRpcClient::CentralControllerRpcClient(
           statistics->GetUpDownCounter(kControllerReconnectTimeStatistic)),
       channel_(::grpc::CreateChannel(server_address,
                                      ::grpc::InsecureChannelCredentials())),
-      stub_(grpc::CentralControllerRpcService::NewStub(channel_)) {
+      stub_(grpc::CentralControllerRpcService::NewStub(channel_)),
+      multiplex_supported_(true) {
   ::grpc::ClientContext::SetGlobalCallbacks(clients_.get());
   {
     ScopedMutex lock(mutex_.get());
@@ -158,6 +159,9 @@ void CentralControllerRpcClient::ShutDown() {
 
     // This will reject all further requests.
     state_ = SHUTDOWN;
+    // The stream is canceled below along with all the other clients; it holds
+    // refs to itself until it has finished.
+    multiplex_.clear();
   }
   clients_->CancelAllActiveAndWait();
   {
@@ -220,6 +224,24 @@ void CentralControllerRpcClient::ConsiderConnecting(
   }
 }
 
+MultiplexedRpcClient* CentralControllerRpcClient::GetMultiplexedClient() {
+  if (multiplex_.get() != nullptr && multiplex_->finished()) {
+    if (multiplex_->unimplemented()) {
+      handler_->Message(kInfo,
+                        "Controller doesn't support Multiplex, using a "
+                        "stream per request.");
+      multiplex_supported_ = false;
+    }
+    multiplex_.clear();
+  }
+  if (multiplex_supported_ && multiplex_.get() == nullptr) {
+    multiplex_.reset(new MultiplexedRpcClient(
+        stub_.get(), client_thread_->queue(), thread_system_, handler_));
+    multiplex_->Start();
+  }
+  return multiplex_.get();
+}
+
 template <typename ContextT, typename CallbackT>
 void CentralControllerRpcClient::StartContext(CallbackT* callback) {
   bool shutdown_required = false;
@@ -233,7 +255,11 @@ void CentralControllerRpcClient::StartContext(CallbackT* callback) {
         // Someone else (another thread or process) detected that the
         // controller is not responding. Kill the client thread.
         shutdown_required = true;
-      } else if (clients_->Size() > controller_panic_threshold_) {
+      } else if (clients_->Size() +
+                     (multiplex_.get() == nullptr
+                          ? 0
+                          : multiplex_->NumOutstanding()) >
+                 controller_panic_threshold_) {
         // We've accumulated a crazy number of gRPC clients in the registry.
         // It looks like the controller isn't responding and we're just piling
         // up detached RewriteDrivers.
@@ -246,15 +272,21 @@ void CentralControllerRpcClient::StartContext(CallbackT* callback) {
         reconnect_time_ms_statistic_->Set(now_ms + kControllerReconnectDelayMs);
         shutdown_required = true;
       } else {
-        // Starts the transaction and deletes itself when done.
-        new ContextT(stub_.get(), client_thread_->queue(), thread_system_,
-                     handler_, callback);
+        MultiplexedRpcClient* multiplex = GetMultiplexedClient();
+        if (multiplex == nullptr || !multiplex->Schedule(callback)) {
+          // Starts the transaction and deletes itself when done.
+          new ContextT(stub_.get(), client_thread_->queue(), thread_system_,
+                       handler_, callback);
+        }
         return;  // Do not fall through, as callback will be canceled!
       }
 
       if (shutdown_required) {
         // Stop further requests. We must do this before releasing the lock.
         state_ = DISCONNECTED;
+        // CancelAllActive below will break the stream; start a new one when
+        // we reconnect.
+        multiplex_.clear();
       }
     }
   }
@@ -28,10 +28,12 @@
 #include "pagespeed/controller/central_controller.h"
 #include "pagespeed/controller/controller.grpc.pb.h"
 #include "pagespeed/controller/expensive_operation_callback.h"
+#include "pagespeed/controller/multiplexed_rpc_client.h"
 #include "pagespeed/controller/schedule_rewrite_callback.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
@@ -50,6 +52,12 @@ namespace net_instaweb {
 // controller to have hung, cancel all outstanding requests and stop talking to
 // it. We signal this via a statistic, so all processes can notice and do the
 // same.
+//
+// Requests are normally sent over a single long-lived Multiplex stream (see
+// MultiplexedRpcClient), which batches them and avoids the cost of setting up
+// a stream per request. If that stream is unavailable, either transiently or
+// because the server doesn't implement Multiplex, we fall back to one stream
+// per request.
 
 class CentralControllerRpcClient : public CentralController {
  public:
@@ -92,6 +100,10 @@ class CentralControllerRpcClient : public CentralController {
   // Have we passed reconnect_time_ms_ and reconnect_time_ms_statistic_?
   bool TimestampsAllowConnection(int64 now) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Returns the Multiplex stream, opening a new one if the previous one has
+  // finished. Returns NULL if the server doesn't support multiplexing.
+  MultiplexedRpcClient* GetMultiplexedClient() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   ThreadSystem* thread_system_;
   Timer* timer_;
   std::unique_ptr<AbstractMutex> mutex_;
@@ -111,6 +123,10 @@ class CentralControllerRpcClient : public CentralController {
   std::shared_ptr<::grpc::ChannelInterface> channel_;
   std::unique_ptr<grpc::CentralControllerRpcService::Stub> stub_;
 
+  RefCountedPtr<MultiplexedRpcClient> multiplex_ GUARDED_BY(mutex_);
+  // Cleared if the server responds UNIMPLEMENTED to Multiplex.
+  bool multiplex_supported_ GUARDED_BY(mutex_);
+
   // This must be last so that it's destructed first.
   std::unique_ptr<GrpcClientThread> client_thread_ GUARDED_BY(mutex_);
 
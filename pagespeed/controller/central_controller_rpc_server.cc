@@ -24,6 +24,7 @@
 
 #include "pagespeed/controller/controller.grpc.pb.h"
 #include "pagespeed/controller/expensive_operation_rpc_handler.h"
+#include "pagespeed/controller/multiplexed_rpc_handler.h"
 #include "pagespeed/controller/schedule_rewrite_rpc_handler.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/string.h"
@@ -60,6 +61,19 @@ int CentralControllerRpcServer::Setup() {
 
   ScheduleRewriteRpcHandler::CreateAndStart(&service_, queue_.get(),
                                             rewrite_controller_.get());
+
+  MultiplexedRpcHandler::CreateAndStart(&service_, queue_.get(),
+                                        expensive_operation_controller_.get(),
+                                        rewrite_controller_.get());
+
+  if (shared_mem_server_.get() != NULL &&
+      !shared_mem_server_->Start(expensive_operation_controller_.get(),
+                                 rewrite_controller_.get())) {
+    // Clients will stick to gRPC.
+    PS_LOG_WARN(handler_, "CentralControllerRpcServer failed to start "
+                "shared memory transport");
+    shared_mem_server_.clear();
+  }
   return 0;
 }
 
@@ -89,6 +103,9 @@ void CentralControllerRpcServer::MainLoop(::grpc::CompletionQueue* queue) {
 
 void CentralControllerRpcServer::Stop() {
   PS_LOG_INFO(handler_, "Shutting down CentralControllerRpcServer.");
+  if (shared_mem_server_.get() != NULL) {
+    shared_mem_server_->Stop();
+  }
   // Stop accepting new RPCs and forcibly terminate all outstanding ones. Blocks
   // until cancel callbacks have been invoked on all oustanding RPCs.
   // It doesn't make much sense to try and wait here, since mostly the client
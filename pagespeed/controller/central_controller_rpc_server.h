@@ -26,7 +26,9 @@
 #include "pagespeed/controller/controller.grpc.pb.h"
 #include "pagespeed/controller/expensive_operation_controller.h"
 #include "pagespeed/controller/schedule_rewrite_controller.h"
+#include "pagespeed/controller/shared_mem_controller_server.h"
 #include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/util/grpc.h"
 #include "pagespeed/system/controller_process.h"
@@ -49,6 +51,12 @@ class CentralControllerRpcServer : public ControllerProcess {
       MessageHandler* handler);
   virtual ~CentralControllerRpcServer() { }
 
+  // Also serve the controllers over shared memory, for workers on this host.
+  // Must be called before Setup().
+  void set_shared_mem_server(SharedMemControllerServer* server) {
+    shared_mem_server_.reset(server);
+  }
+
   // ControllerProcess implementation.
   int Setup() override;
   int Run() override;
@@ -65,6 +73,8 @@ class CentralControllerRpcServer : public ControllerProcess {
 
   std::unique_ptr<ExpensiveOperationController> expensive_operation_controller_;
   std::unique_ptr<ScheduleRewriteController> rewrite_controller_;
+  // Declared after the controllers, so it's destroyed first.
+  RefCountedPtr<SharedMemControllerServer> shared_mem_server_;
   MessageHandler* handler_;
 
   DISALLOW_COPY_AND_ASSIGN(CentralControllerRpcServer);
@@ -0,0 +1,268 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/controller/cost_based_expensive_operation_controller.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+const char CostBasedExpensiveOperationController::kActiveExpensiveOperations[] =
+    "cost-based-active-expensive-operations";
+const char CostBasedExpensiveOperationController::kQueuedExpensiveOperations[] =
+    "cost-based-queued-expensive-operations";
+const char
+    CostBasedExpensiveOperationController::kPermittedExpensiveOperations[] =
+        "cost-based-permitted-expensive-operations";
+const char
+    CostBasedExpensiveOperationController::kDroppedExpensiveOperations[] =
+        "cost-based-dropped-expensive-operations";
+const char CostBasedExpensiveOperationController::kEstimatedCpuUs[] =
+    "cost-based-estimated-cpu-us";
+const char CostBasedExpensiveOperationController::kReportedCpuUs[] =
+    "cost-based-reported-cpu-us";
+const char CostBasedExpensiveOperationController::kCpuBudgetRemainingUs[] =
+    "cost-based-cpu-budget-remaining-us";
+
+// Roughly what recompressing a JPEG or PNG costs on a current server core.
+const double CostBasedExpensiveOperationController::kDefaultUsPerPixel = 0.05;
+const double CostBasedExpensiveOperationController::kDefaultUsPerByte = 0.5;
+const int64 CostBasedExpensiveOperationController::kDefaultUsPerOperation =
+    10 * Timer::kMsUs;
+const int64 CostBasedExpensiveOperationController::kMinEstimateUs = 100;
+const double CostBasedExpensiveOperationController::kModelWeight = 0.2;
+
+CostBasedExpensiveOperationController::CostBasedExpensiveOperationController(
+    int64 cpu_budget_us, int64 window_ms, int max_queue_size,
+    ThreadSystem* thread_system, Timer* timer, Statistics* stats)
+    : budget_us_(cpu_budget_us),
+      window_ms_(std::max<int64>(window_ms, 1)),
+      max_queue_size_(max_queue_size),
+      timer_(timer),
+      mutex_(thread_system->NewMutex()),
+      num_in_progress_(0),
+      tokens_us_(cpu_budget_us),
+      last_refill_ms_(timer->NowMs()),
+      active_operations_counter_(
+          stats->GetUpDownCounter(kActiveExpensiveOperations)),
+      queued_operations_counter_(
+          stats->GetUpDownCounter(kQueuedExpensiveOperations)),
+      budget_remaining_counter_(
+          stats->GetUpDownCounter(kCpuBudgetRemainingUs)),
+      permitted_operations_counter_(
+          stats->GetTimedVariable(kPermittedExpensiveOperations)),
+      dropped_operations_counter_(
+          stats->GetTimedVariable(kDroppedExpensiveOperations)),
+      estimated_cpu_counter_(stats->GetTimedVariable(kEstimatedCpuUs)),
+      reported_cpu_counter_(stats->GetTimedVariable(kReportedCpuUs)) {
+  CHECK_GT(budget_us_, 0);
+  ScopedMutex lock(mutex_.get());
+  UpdateBudgetStat();
+}
+
+CostBasedExpensiveOperationController::
+    ~CostBasedExpensiveOperationController() {
+  // As in QueuedExpensiveOperationController, the queue should be empty by
+  // now, and running Cancel this late is unsafe, so just free what's left.
+  DCHECK(queue_.empty());
+  while (!queue_.empty()) {
+    delete queue_.front().callback;
+    queue_.pop_front();
+  }
+}
+
+void CostBasedExpensiveOperationController::InitStats(Statistics* statistics) {
+  statistics->AddGlobalUpDownCounter(kActiveExpensiveOperations);
+  statistics->AddGlobalUpDownCounter(kQueuedExpensiveOperations);
+  statistics->AddGlobalUpDownCounter(kCpuBudgetRemainingUs);
+  statistics->AddTimedVariable(kPermittedExpensiveOperations,
+                               Statistics::kDefaultGroup);
+  statistics->AddTimedVariable(kDroppedExpensiveOperations,
+                               Statistics::kDefaultGroup);
+  statistics->AddTimedVariable(kEstimatedCpuUs, Statistics::kDefaultGroup);
+  statistics->AddTimedVariable(kReportedCpuUs, Statistics::kDefaultGroup);
+}
+
+void CostBasedExpensiveOperationController::ScheduleExpensiveOperation(
+    Function* callback) {
+  ScheduleExpensiveOperation(ExpensiveOperationCost(), callback);
+}
+
+void CostBasedExpensiveOperationController::ScheduleExpensiveOperation(
+    const ExpensiveOperationCost& cost, Function* callback) {
+  CHECK(callback != NULL);
+  std::deque<Function*> to_run;
+  bool drop = false;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (max_queue_size_ >= 0 &&
+        queue_.size() >= static_cast<size_t>(max_queue_size_) &&
+        num_in_progress_ > 0) {
+      drop = true;
+      dropped_operations_counter_->IncBy(1);
+    } else {
+      Request request;
+      request.cost = cost;
+      request.callback = callback;
+      queue_.push_back(request);
+      AdmitQueued(&to_run);
+      queued_operations_counter_->Set(queue_.size());
+    }
+  }
+  if (drop) {
+    callback->CallCancel();
+  }
+  for (Function* function : to_run) {
+    function->CallRun();
+  }
+}
+
+void CostBasedExpensiveOperationController::NotifyExpensiveOperationComplete() {
+  NotifyExpensiveOperationComplete(ExpensiveOperationCost(), 0);
+}
+
+void CostBasedExpensiveOperationController::NotifyExpensiveOperationComplete(
+    const ExpensiveOperationCost& cost, int64 cpu_us) {
+  std::deque<Function*> to_run;
+  {
+    ScopedMutex lock(mutex_.get());
+    DCHECK_GT(num_in_progress_, 0);
+    if (num_in_progress_ > 0) {
+      --num_in_progress_;
+      active_operations_counter_->Set(num_in_progress_);
+    }
+    ChargeMap::iterator charge = charges_.find(KeyFor(cost));
+    DCHECK(charge != charges_.end());
+    if (charge != charges_.end()) {
+      int64 charged_us = charge->second;
+      charges_.erase(charge);
+      if (cpu_us > 0) {
+        // Settle up: the bucket pays for what was actually used.
+        Refill();
+        tokens_us_ = std::min<double>(tokens_us_ + charged_us - cpu_us,
+                                      budget_us_);
+        reported_cpu_counter_->IncBy(cpu_us);
+        Learn(cost, cpu_us);
+      }
+    }
+    AdmitQueued(&to_run);
+    queued_operations_counter_->Set(queue_.size());
+    UpdateBudgetStat();
+  }
+  for (Function* function : to_run) {
+    function->CallRun();
+  }
+}
+
+int64 CostBasedExpensiveOperationController::EstimateCpuUs(
+    const ExpensiveOperationCost& cost) {
+  ScopedMutex lock(mutex_.get());
+  return EstimateLocked(cost);
+}
+
+CostBasedExpensiveOperationController::ChargeKey
+CostBasedExpensiveOperationController::KeyFor(
+    const ExpensiveOperationCost& cost) {
+  return ChargeKey(cost.kind, std::make_pair(cost.input_bytes, cost.pixels));
+}
+
+GoogleString CostBasedExpensiveOperationController::ModelKey(
+    const ExpensiveOperationCost& cost, int64* units) {
+  if (cost.pixels > 0) {
+    *units = cost.pixels;
+    return StrCat(cost.kind, "/px");
+  } else if (cost.input_bytes > 0) {
+    *units = cost.input_bytes;
+    return StrCat(cost.kind, "/byte");
+  }
+  *units = 1;
+  return StrCat(cost.kind, "/op");
+}
+
+int64 CostBasedExpensiveOperationController::EstimateLocked(
+    const ExpensiveOperationCost& cost) {
+  int64 units;
+  GoogleString key = ModelKey(cost, &units);
+  double us_per_unit;
+  std::map<GoogleString, double>::const_iterator model = models_.find(key);
+  if (model != models_.end()) {
+    us_per_unit = model->second;
+  } else if (cost.pixels > 0) {
+    us_per_unit = kDefaultUsPerPixel;
+  } else if (cost.input_bytes > 0) {
+    us_per_unit = kDefaultUsPerByte;
+  } else {
+    us_per_unit = kDefaultUsPerOperation;
+  }
+  return std::max(kMinEstimateUs, static_cast<int64>(us_per_unit * units));
+}
+
+void CostBasedExpensiveOperationController::Learn(
+    const ExpensiveOperationCost& cost, int64 cpu_us) {
+  int64 units;
+  GoogleString key = ModelKey(cost, &units);
+  double observed = static_cast<double>(cpu_us) / units;
+  std::pair<std::map<GoogleString, double>::iterator, bool> inserted =
+      models_.insert(std::make_pair(key, observed));
+  if (!inserted.second) {
+    double* model = &inserted.first->second;
+    *model += kModelWeight * (observed - *model);
+  }
+}
+
+void CostBasedExpensiveOperationController::Refill() {
+  int64 now_ms = timer_->NowMs();
+  if (now_ms > last_refill_ms_) {
+    double refill_us = static_cast<double>(budget_us_) *
+                       (now_ms - last_refill_ms_) / window_ms_;
+    tokens_us_ = std::min<double>(tokens_us_ + refill_us, budget_us_);
+    last_refill_ms_ = now_ms;
+  }
+}
+
+void CostBasedExpensiveOperationController::AdmitQueued(
+    std::deque<Function*>* to_run) {
+  Refill();
+  while (!queue_.empty()) {
+    const Request& request = queue_.front();
+    int64 estimate_us = EstimateLocked(request.cost);
+    if (num_in_progress_ > 0 && tokens_us_ < estimate_us) {
+      break;
+    }
+    tokens_us_ -= estimate_us;
+    charges_.insert(std::make_pair(KeyFor(request.cost), estimate_us));
+    ++num_in_progress_;
+    active_operations_counter_->Set(num_in_progress_);
+    permitted_operations_counter_->IncBy(1);
+    estimated_cpu_counter_->IncBy(estimate_us);
+    to_run->push_back(request.callback);
+    queue_.pop_front();
+  }
+  UpdateBudgetStat();
+}
+
+void CostBasedExpensiveOperationController::UpdateBudgetStat() {
+  budget_remaining_counter_->Set(static_cast<int64>(tokens_us_));
+}
+
+}  // namespace net_instaweb
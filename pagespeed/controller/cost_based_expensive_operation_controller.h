@@ -0,0 +1,155 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_CONTROLLER_COST_BASED_EXPENSIVE_OPERATION_CONTROLLER_H_
+#define PAGESPEED_CONTROLLER_COST_BASED_EXPENSIVE_OPERATION_CONTROLLER_H_
+
+#include <deque>
+#include <map>
+#include <utility>
+
+#include "pagespeed/controller/expensive_operation_controller.h"
+#include "pagespeed/controller/expensive_operation_cost.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+
+namespace net_instaweb {
+
+// Implements ExpensiveOperationController by admitting work against a budget
+// of CPU time rather than a count of operations, so that one huge image
+// doesn't cost the same as a dozen icons. The budget is a token bucket holding
+// at most cpu_budget_us microseconds, refilled at that rate per window_ms.
+// Each operation is charged an estimate when it starts, and the difference
+// from the CPU time it reports on completion is settled afterwards.
+//
+// Estimates come from a model learned per ExpensiveOperationCost::kind, of
+// CPU time per input pixel (or per input byte, when pixels are unknown, or
+// per operation, when neither is known). Until a kind has reported any usage,
+// conservative defaults are used.
+//
+// Like QueuedExpensiveOperationController, requests are queued in strict
+// order and this does not communicate across process boundaries. An
+// operation is always admitted when nothing else is running, so a single
+// operation costing more than the whole budget still makes progress.
+class CostBasedExpensiveOperationController
+    : public ExpensiveOperationController {
+ public:
+  static const char kActiveExpensiveOperations[];
+  static const char kQueuedExpensiveOperations[];
+  static const char kPermittedExpensiveOperations[];
+  static const char kDroppedExpensiveOperations[];
+  static const char kEstimatedCpuUs[];
+  static const char kReportedCpuUs[];
+  static const char kCpuBudgetRemainingUs[];
+
+  // Defaults used before anything has been learned about a kind.
+  static const double kDefaultUsPerPixel;
+  static const double kDefaultUsPerByte;
+  static const int64 kDefaultUsPerOperation;
+  // No operation is estimated to cost less than this.
+  static const int64 kMinEstimateUs;
+  // Weight given to each new observation in the learned models.
+  static const double kModelWeight;
+
+  // max_queue_size < 0 means the queue is unbounded; requests arriving when
+  // the queue is full are canceled.
+  CostBasedExpensiveOperationController(int64 cpu_budget_us, int64 window_ms,
+                                        int max_queue_size,
+                                        ThreadSystem* thread_system,
+                                        Timer* timer, Statistics* stats);
+  virtual ~CostBasedExpensiveOperationController();
+
+  // ExpensiveOperationController interface. Operations scheduled without a
+  // cost are charged kDefaultUsPerOperation.
+  virtual void ScheduleExpensiveOperation(Function* callback);
+  virtual void ScheduleExpensiveOperation(const ExpensiveOperationCost& cost,
+                                          Function* callback);
+  virtual void NotifyExpensiveOperationComplete();
+  virtual void NotifyExpensiveOperationComplete(
+      const ExpensiveOperationCost& cost, int64 cpu_us);
+
+  // Current estimate of how much CPU an operation with the given cost will
+  // use, in microseconds.
+  int64 EstimateCpuUs(const ExpensiveOperationCost& cost)
+      LOCKS_EXCLUDED(mutex_);
+
+  static void InitStats(Statistics* stats);
+
+ private:
+  struct Request {
+    ExpensiveOperationCost cost;
+    Function* callback;
+  };
+
+  // Identifies the estimates charged for operations in progress, so
+  // completion refunds exactly what was charged even if the model has moved.
+  typedef std::pair<GoogleString, std::pair<int64, int64> > ChargeKey;
+  typedef std::multimap<ChargeKey, int64> ChargeMap;
+
+  static ChargeKey KeyFor(const ExpensiveOperationCost& cost);
+  static GoogleString ModelKey(const ExpensiveOperationCost& cost,
+                               int64* units);
+
+  int64 EstimateLocked(const ExpensiveOperationCost& cost)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void Learn(const ExpensiveOperationCost& cost, int64 cpu_us)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void Refill() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Takes requests off the front of the queue while the budget allows, and
+  // appends their callbacks to to_run.
+  void AdmitQueued(std::deque<Function*>* to_run)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void UpdateBudgetStat() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const int64 budget_us_;
+  const int64 window_ms_;
+  const int max_queue_size_;
+  Timer* timer_;
+  scoped_ptr<AbstractMutex> mutex_;
+  std::deque<Request> queue_ GUARDED_BY(mutex_);
+  int num_in_progress_ GUARDED_BY(mutex_);
+  // May go negative when operations cost more than estimated.
+  double tokens_us_ GUARDED_BY(mutex_);
+  int64 last_refill_ms_ GUARDED_BY(mutex_);
+  ChargeMap charges_ GUARDED_BY(mutex_);
+  // Learned CPU microseconds per unit, keyed by ModelKey.
+  std::map<GoogleString, double> models_ GUARDED_BY(mutex_);
+
+  UpDownCounter* active_operations_counter_;
+  UpDownCounter* queued_operations_counter_;
+  UpDownCounter* budget_remaining_counter_;
+  TimedVariable* permitted_operations_counter_;
+  TimedVariable* dropped_operations_counter_;
+  TimedVariable* estimated_cpu_counter_;
+  TimedVariable* reported_cpu_counter_;
+
+  DISALLOW_COPY_AND_ASSIGN(CostBasedExpensiveOperationController);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_CONTROLLER_COST_BASED_EXPENSIVE_OPERATION_CONTROLLER_H_
@@ -0,0 +1,263 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/controller/cost_based_expensive_operation_controller.h"
+
+#include "pagespeed/controller/expensive_operation_cost.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int64 kBudgetUs = 100 * Timer::kMsUs;
+const int64 kWindowMs = 1000;
+const int kMaxQueueSize = 2;
+
+class TrackCallsFunction : public Function {
+ public:
+  TrackCallsFunction() : run_called_(false), cancel_called_(false) {
+    set_delete_after_callback(false);
+  }
+  virtual ~TrackCallsFunction() { }
+
+  virtual void Run() { run_called_ = true; }
+  virtual void Cancel() { cancel_called_ = true; }
+
+  bool run_called_;
+  bool cancel_called_;
+};
+
+class CostBasedExpensiveOperationTest : public testing::Test {
+ public:
+  CostBasedExpensiveOperationTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(thread_system_->NewMutex(), MockTimer::kApr_5_2010_ms),
+        stats_(thread_system_.get()),
+        // Bytes-only costs use the per-byte default, which makes 2000 bytes
+        // cost 1ms until something has been learned.
+        small_("test", 2000, 0),
+        // 40% of the budget.
+        large_("test", 80000, 0) {
+    CostBasedExpensiveOperationController::InitStats(&stats_);
+    controller_.reset(new CostBasedExpensiveOperationController(
+        kBudgetUs, kWindowMs, kMaxQueueSize, thread_system_.get(), &timer_,
+        &stats_));
+  }
+
+  int64 active_operations() {
+    return stats_.GetUpDownCounter(
+        CostBasedExpensiveOperationController::kActiveExpensiveOperations)
+        ->Get();
+  }
+
+  int64 queued_operations() {
+    return stats_.GetUpDownCounter(
+        CostBasedExpensiveOperationController::kQueuedExpensiveOperations)
+        ->Get();
+  }
+
+  int64 budget_remaining_us() {
+    return stats_.GetUpDownCounter(
+        CostBasedExpensiveOperationController::kCpuBudgetRemainingUs)->Get();
+  }
+
+  int64 dropped_operations() {
+    return stats_.GetTimedVariable(
+        CostBasedExpensiveOperationController::kDroppedExpensiveOperations)
+        ->Get(TimedVariable::START);
+  }
+
+ protected:
+  scoped_ptr<ThreadSystem> thread_system_;
+  MockTimer timer_;
+  SimpleStats stats_;
+  scoped_ptr<CostBasedExpensiveOperationController> controller_;
+  ExpensiveOperationCost small_;
+  ExpensiveOperationCost large_;
+};
+
+TEST_F(CostBasedExpensiveOperationTest, DefaultEstimates) {
+  EXPECT_EQ(1000, controller_->EstimateCpuUs(small_));
+  EXPECT_EQ(40 * Timer::kMsUs, controller_->EstimateCpuUs(large_));
+  EXPECT_EQ(
+      CostBasedExpensiveOperationController::kDefaultUsPerOperation,
+      controller_->EstimateCpuUs(ExpensiveOperationCost()));
+  // 200x200 pixels.
+  EXPECT_EQ(2000, controller_->EstimateCpuUs(
+      ExpensiveOperationCost("test", 2000, 40000)));
+  EXPECT_EQ(CostBasedExpensiveOperationController::kMinEstimateUs,
+            controller_->EstimateCpuUs(ExpensiveOperationCost("test", 1, 0)));
+}
+
+TEST_F(CostBasedExpensiveOperationTest, ChargesByCost) {
+  // Many small operations fit in the budget at once where two large ones
+  // don't leave room for a third.
+  TrackCallsFunction small[10];
+  for (int i = 0; i < 10; ++i) {
+    controller_->ScheduleExpensiveOperation(small_, &small[i]);
+    EXPECT_TRUE(small[i].run_called_);
+  }
+  EXPECT_EQ(10, active_operations());
+  EXPECT_EQ(90 * Timer::kMsUs, budget_remaining_us());
+
+  TrackCallsFunction large1, large2;
+  controller_->ScheduleExpensiveOperation(large_, &large1);
+  EXPECT_TRUE(large1.run_called_);
+  controller_->ScheduleExpensiveOperation(large_, &large2);
+  EXPECT_TRUE(large2.run_called_);
+  EXPECT_EQ(10 * Timer::kMsUs, budget_remaining_us());
+
+  TrackCallsFunction large3;
+  controller_->ScheduleExpensiveOperation(large_, &large3);
+  EXPECT_FALSE(large3.run_called_);
+  EXPECT_EQ(1, queued_operations());
+
+  // Finishing a large operation without reporting its usage refunds nothing,
+  // so large3 must wait for time to pass.
+  controller_->NotifyExpensiveOperationComplete(large_, 0);
+  EXPECT_FALSE(large3.run_called_);
+  timer_.AdvanceMs(300);  // Refills 30ms of budget.
+  controller_->NotifyExpensiveOperationComplete(large_, 0);
+  EXPECT_TRUE(large3.run_called_);
+  EXPECT_EQ(0, queued_operations());
+
+  for (int i = 0; i < 10; ++i) {
+    controller_->NotifyExpensiveOperationComplete(small_, 0);
+  }
+  controller_->NotifyExpensiveOperationComplete(large_, 0);
+  EXPECT_EQ(0, active_operations());
+}
+
+TEST_F(CostBasedExpensiveOperationTest, RefundsUnusedEstimate) {
+  TrackCallsFunction large1, large2, large3;
+  controller_->ScheduleExpensiveOperation(large_, &large1);
+  controller_->ScheduleExpensiveOperation(large_, &large2);
+  controller_->ScheduleExpensiveOperation(large_, &large3);
+  EXPECT_TRUE(large1.run_called_);
+  EXPECT_TRUE(large2.run_called_);
+  EXPECT_FALSE(large3.run_called_);
+
+  // large1 only used 5ms of the 40ms it was charged, so there's room now.
+  controller_->NotifyExpensiveOperationComplete(large_, 5 * Timer::kMsUs);
+  EXPECT_TRUE(large3.run_called_);
+
+  controller_->NotifyExpensiveOperationComplete(large_, 5 * Timer::kMsUs);
+  controller_->NotifyExpensiveOperationComplete(large_, 5 * Timer::kMsUs);
+  EXPECT_EQ(0, active_operations());
+}
+
+TEST_F(CostBasedExpensiveOperationTest, LearnsPerKind) {
+  TrackCallsFunction f1, f2;
+  controller_->ScheduleExpensiveOperation(large_, &f1);
+  // 80000 bytes took 8ms: 0.1us per byte.
+  controller_->NotifyExpensiveOperationComplete(large_, 8 * Timer::kMsUs);
+  EXPECT_EQ(8 * Timer::kMsUs, controller_->EstimateCpuUs(large_));
+  EXPECT_EQ(200, controller_->EstimateCpuUs(small_));
+
+  // Later observations move the model gradually.
+  controller_->ScheduleExpensiveOperation(large_, &f2);
+  controller_->NotifyExpensiveOperationComplete(large_, 18 * Timer::kMsUs);
+  EXPECT_EQ(10 * Timer::kMsUs, controller_->EstimateCpuUs(large_));
+
+  // Other kinds, and pixel counts, are learned separately.
+  EXPECT_EQ(40 * Timer::kMsUs, controller_->EstimateCpuUs(
+      ExpensiveOperationCost("other", 80000, 0)));
+  EXPECT_EQ(2000, controller_->EstimateCpuUs(
+      ExpensiveOperationCost("test", 80000, 40000)));
+}
+
+TEST_F(CostBasedExpensiveOperationTest, OverBudgetRunsAlone) {
+  // An operation bigger than the whole budget still runs when nothing else
+  // is, but nothing runs alongside it.
+  ExpensiveOperationCost huge("huge", 1000000, 0);
+  TrackCallsFunction f1, f2;
+  controller_->ScheduleExpensiveOperation(huge, &f1);
+  EXPECT_TRUE(f1.run_called_);
+  controller_->ScheduleExpensiveOperation(small_, &f2);
+  EXPECT_FALSE(f2.run_called_);
+
+  // It ran over its estimate, so the debt has to be paid off by refilling.
+  controller_->NotifyExpensiveOperationComplete(huge, 600 * Timer::kMsUs);
+  EXPECT_TRUE(f2.run_called_);
+  EXPECT_EQ(-501 * Timer::kMsUs, budget_remaining_us());
+  controller_->NotifyExpensiveOperationComplete(small_, 0);
+
+  TrackCallsFunction f3, f4;
+  controller_->ScheduleExpensiveOperation(small_, &f3);
+  EXPECT_TRUE(f3.run_called_);
+  controller_->ScheduleExpensiveOperation(small_, &f4);
+  EXPECT_FALSE(f4.run_called_);
+  timer_.AdvanceMs(5030);
+  controller_->NotifyExpensiveOperationComplete(small_, 0);
+  EXPECT_TRUE(f4.run_called_);
+  controller_->NotifyExpensiveOperationComplete(small_, 0);
+}
+
+TEST_F(CostBasedExpensiveOperationTest, DropsWhenQueueFull) {
+  ExpensiveOperationCost huge("test", 1000000, 0);
+  TrackCallsFunction running, queued1, queued2, dropped;
+  controller_->ScheduleExpensiveOperation(huge, &running);
+  controller_->ScheduleExpensiveOperation(small_, &queued1);
+  controller_->ScheduleExpensiveOperation(small_, &queued2);
+  controller_->ScheduleExpensiveOperation(small_, &dropped);
+  EXPECT_TRUE(running.run_called_);
+  EXPECT_FALSE(queued1.run_called_ || queued1.cancel_called_);
+  EXPECT_FALSE(queued2.run_called_ || queued2.cancel_called_);
+  EXPECT_TRUE(dropped.cancel_called_);
+  EXPECT_EQ(2, queued_operations());
+  EXPECT_EQ(1, dropped_operations());
+
+  timer_.AdvanceMs(10 * kWindowMs);
+  controller_->NotifyExpensiveOperationComplete(huge, 0);
+  EXPECT_TRUE(queued1.run_called_);
+  EXPECT_TRUE(queued2.run_called_);
+  controller_->NotifyExpensiveOperationComplete(small_, 0);
+  controller_->NotifyExpensiveOperationComplete(small_, 0);
+  EXPECT_EQ(0, active_operations());
+}
+
+TEST_F(CostBasedExpensiveOperationTest, UnhintedOperations) {
+  // The plain interface still works, charging the per-operation default.
+  TrackCallsFunction f[11];
+  for (int i = 0; i < 11; ++i) {
+    controller_->ScheduleExpensiveOperation(&f[i]);
+  }
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(f[i].run_called_);
+  }
+  EXPECT_FALSE(f[10].run_called_);
+  timer_.AdvanceMs(100);
+  controller_->NotifyExpensiveOperationComplete();
+  EXPECT_TRUE(f[10].run_called_);
+  for (int i = 0; i < 10; ++i) {
+    controller_->NotifyExpensiveOperationComplete();
+  }
+  EXPECT_EQ(0, active_operations());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
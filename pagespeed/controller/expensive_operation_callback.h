@@ -22,6 +22,7 @@
 #define PAGESPEED_CONTROLLER_EXPENSIVE_OPERATION_CALLBACK_H_
 
 #include "pagespeed/controller/central_controller_callback.h"
+#include "pagespeed/controller/expensive_operation_cost.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/thread/sequence.h"
@@ -39,6 +40,10 @@ class ExpensiveOperationContext {
   // destruction if not explicitly called.
   virtual void Done() = 0;
 
+  // Records how much CPU time the operation actually used, so controllers
+  // can learn what operations cost. Optional; call it before Done().
+  virtual void ReportCpuUsage(int64 cpu_us) { }
+
  protected:
   ExpensiveOperationContext();
 
@@ -53,11 +58,18 @@ class ExpensiveOperationCallback
   explicit ExpensiveOperationCallback(Sequence* sequence);
   virtual ~ExpensiveOperationCallback();
 
+  // Hint about how much CPU the operation will need; see
+  // ExpensiveOperationCost. Set before scheduling.
+  const ExpensiveOperationCost& cost() const { return cost_; }
+  void set_cost(const ExpensiveOperationCost& cost) { cost_ = cost; }
+
  private:
   // CentralControllerCallback interface.
   virtual void RunImpl(scoped_ptr<ExpensiveOperationContext>* context) = 0;
   virtual void CancelImpl() = 0;
 
+  ExpensiveOperationCost cost_;
+
   DISALLOW_COPY_AND_ASSIGN(ExpensiveOperationCallback);
 };
 
@@ -21,6 +21,7 @@
 #ifndef PAGESPEED_CONTROLLER_EXPENSIVE_OPERATION_CONTROLLER_H_
 #define PAGESPEED_CONTROLLER_EXPENSIVE_OPERATION_CONTROLLER_H_
 
+#include "pagespeed/controller/expensive_operation_cost.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/function.h"
 
@@ -38,10 +39,24 @@ class ExpensiveOperationController {
   // point if it is determined that the work cannot be performed.
   virtual void ScheduleExpensiveOperation(Function* callback) = 0;
 
+  // As above, with a hint about how much CPU the operation will use. The
+  // default implementation ignores it.
+  virtual void ScheduleExpensiveOperation(const ExpensiveOperationCost& cost,
+                                          Function* callback) {
+    ScheduleExpensiveOperation(callback);
+  }
+
   // Inform controller that the operation has been completed.
   // Should only be called if Run() was invoked on callback above.
   virtual void NotifyExpensiveOperationComplete() = 0;
 
+  // As above, for an operation scheduled with cost. cpu_us is the CPU time it
+  // actually used, or <= 0 if that isn't known (eg, it was abandoned).
+  virtual void NotifyExpensiveOperationComplete(
+      const ExpensiveOperationCost& cost, int64 cpu_us) {
+    NotifyExpensiveOperationComplete();
+  }
+
  protected:
   ExpensiveOperationController() { }
 
@@ -0,0 +1,41 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/controller/expensive_operation_cost.h"
+
+#include "pagespeed/controller/controller.pb.h"
+
+namespace net_instaweb {
+
+void ExpensiveOperationCost::CopyToProto(
+    ExpensiveOperationCostProto* proto) const {
+  proto->set_kind(kind);
+  proto->set_input_bytes(input_bytes);
+  proto->set_pixels(pixels);
+}
+
+void ExpensiveOperationCost::CopyFromProto(
+    const ExpensiveOperationCostProto& proto) {
+  kind = proto.kind();
+  input_bytes = proto.input_bytes();
+  pixels = proto.pixels();
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,58 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_CONTROLLER_EXPENSIVE_OPERATION_COST_H_
+#define PAGESPEED_CONTROLLER_EXPENSIVE_OPERATION_COST_H_
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+class ExpensiveOperationCostProto;
+
+// A caller's description of an expensive operation, from which an
+// ExpensiveOperationController can estimate how much CPU it will use. Every
+// field is optional, and controllers that limit operations by count ignore
+// it altogether.
+struct ExpensiveOperationCost {
+  ExpensiveOperationCost() : input_bytes(0), pixels(0) {}
+  ExpensiveOperationCost(StringPiece kind_in, int64 input_bytes_in,
+                         int64 pixels_in)
+      : input_bytes(input_bytes_in), pixels(pixels_in) {
+    kind_in.CopyToString(&kind);
+  }
+
+  // For passing costs to a controller over RPC.
+  void CopyToProto(ExpensiveOperationCostProto* proto) const;
+  void CopyFromProto(const ExpensiveOperationCostProto& proto);
+
+  // What sort of work this is, eg the filter and input format. Controllers
+  // learn costs separately for each kind.
+  GoogleString kind;
+  int64 input_bytes;
+  // Number of pixels in the input, for images. 0 if unknown.
+  int64 pixels;
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_CONTROLLER_EXPENSIVE_OPERATION_COST_H_
@@ -25,6 +25,7 @@
 #include "pagespeed/controller/controller.grpc.pb.h"
 #include "pagespeed/controller/controller.pb.h"
 #include "pagespeed/controller/expensive_operation_callback.h"
+#include "pagespeed/controller/expensive_operation_cost.h"
 #include "pagespeed/controller/request_result_rpc_client.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/thread_system.h"
@@ -41,7 +42,9 @@ class ExpensiveOperationRpcContext::ExpensiveOperationRequestResultRpcClient
       grpc::CentralControllerRpcService::StubInterface* stub,
       ::grpc::CompletionQueue* queue, ThreadSystem* thread_system,
       MessageHandler* handler, ExpensiveOperationCallback* callback)
-      : RequestResultRpcClient(queue, thread_system, handler, callback) {
+      : RequestResultRpcClient(queue, thread_system, handler, callback),
+        cost_(callback->cost()),
+        cpu_us_(0) {
     // Nothing will happen until a call to Start() is made. We don't do it here
     // because the wrapper needs to call SetTransactionContext first.
   }
@@ -59,15 +62,20 @@ class ExpensiveOperationRpcContext::ExpensiveOperationRequestResultRpcClient
 
   void Done() {
     ScheduleExpensiveOperationRequest req;
-    // req has no fields.
+    req.set_cpu_us(cpu_us_);
     SendResultToServer(req);
   }
 
+  void set_cpu_us(int64 cpu_us) { cpu_us_ = cpu_us; }
+
  private:
   void PopulateServerRequest(
       ScheduleExpensiveOperationRequest* request) override {
-    // request has no fields, so this is a no-op.
+    cost_.CopyToProto(request->mutable_cost());
   }
+
+  const ExpensiveOperationCost cost_;
+  int64 cpu_us_;
 };
 
 ExpensiveOperationRpcContext::ExpensiveOperationRpcContext(
@@ -83,4 +91,8 @@ ExpensiveOperationRpcContext::ExpensiveOperationRpcContext(
 
 void ExpensiveOperationRpcContext::Done() { client_->Done(); }
 
+void ExpensiveOperationRpcContext::ReportCpuUsage(int64 cpu_us) {
+  client_->set_cpu_us(cpu_us);
+}
+
 }  // namespace net_instaweb
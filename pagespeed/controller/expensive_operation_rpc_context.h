@@ -43,6 +43,7 @@ class ExpensiveOperationRpcContext : public ExpensiveOperationContext {
       MessageHandler* handler, ExpensiveOperationCallback* callback);
 
   void Done() override;
+  void ReportCpuUsage(int64 cpu_us) override;
 
  private:
   class ExpensiveOperationRequestResultRpcClient;
@@ -29,16 +29,17 @@ ExpensiveOperationRpcHandler::ExpensiveOperationRpcHandler(
 
 void ExpensiveOperationRpcHandler::HandleClientRequest(
     const ScheduleExpensiveOperationRequest& req, Function* callback) {
-  controller()->ScheduleExpensiveOperation(callback);
+  cost_.CopyFromProto(req.cost());
+  controller()->ScheduleExpensiveOperation(cost_, callback);
 }
 
 void ExpensiveOperationRpcHandler::HandleClientResult(
     const ScheduleExpensiveOperationRequest& req) {
-  controller()->NotifyExpensiveOperationComplete();
+  controller()->NotifyExpensiveOperationComplete(cost_, req.cpu_us());
 }
 
 void ExpensiveOperationRpcHandler::HandleOperationFailed() {
-  controller()->NotifyExpensiveOperationComplete();
+  controller()->NotifyExpensiveOperationComplete(cost_, 0);
 }
 
 void ExpensiveOperationRpcHandler::InitResponder(
@@ -24,6 +24,7 @@
 #include "pagespeed/controller/controller.grpc.pb.h"
 #include "pagespeed/controller/controller.pb.h"
 #include "pagespeed/controller/expensive_operation_controller.h"
+#include "pagespeed/controller/expensive_operation_cost.h"
 #include "pagespeed/controller/request_result_rpc_handler.h"
 #include "pagespeed/controller/rpc_handler.h"
 #include "pagespeed/kernel/base/basictypes.h"
@@ -34,14 +35,14 @@ namespace net_instaweb {
 
 // RpcHandler for ExpensiveOperationController.
 //
-// The request message on the RPC contains no payload, it's just the client
-// saying "I have something expensive to do now, let me know when". This
+// The request message on the RPC is the client saying "I have something
+// expensive to do now, let me know when", with an optional cost hint. This
 // will trigger a call to HandleClientRequest() which we use to call
 // ScheduleExpensiveOperation(). When the controller decides if it will allow
 // the rewrite to proceed, RequestResultRpcHandler returns that decision to
 // the client. Once the client completes, it sends another Request message,
 // which will trigger a call to HandleClientResult() and we in-turn call
-// NotifyExpensiveOperationComplete().
+// NotifyExpensiveOperationComplete() with the CPU time the client reports.
 //
 // If the client disconnects after requesting an operation but before sending a
 // second "completed" message, we receive a call to HandleOperationFailed() and
@@ -77,6 +78,10 @@ class ExpensiveOperationRpcHandler
   friend class RequestResultRpcHandler;
   friend class ExpensiveOperationRpcHandlerTest;
 
+  // From the client's first request, so it can be passed back to the
+  // controller on completion.
+  ExpensiveOperationCost cost_;
+
   DISALLOW_COPY_AND_ASSIGN(ExpensiveOperationRpcHandler);
 };
 
@@ -20,7 +20,9 @@
 
 #include "pagespeed/controller/in_process_central_controller.h"
 
+#include "pagespeed/controller/cost_based_expensive_operation_controller.h"
 #include "pagespeed/controller/expensive_operation_callback.h"
+#include "pagespeed/controller/expensive_operation_cost.h"
 #include "pagespeed/controller/named_lock_schedule_rewrite_controller.h"
 #include "pagespeed/controller/popularity_contest_schedule_rewrite_controller.h"
 #include "pagespeed/controller/queued_expensive_operation_controller.h"
@@ -37,11 +39,13 @@ class ExpensiveOperationContextImpl : public ExpensiveOperationContext {
  public:
   ExpensiveOperationContextImpl(ExpensiveOperationController* controller,
                                 ExpensiveOperationCallback* callback)
-      : controller_(controller), callback_(callback) {
+      : controller_(controller), callback_(callback), cost_(callback->cost()),
+        cpu_us_(0) {
     // SetTransactionContext steals ownership, which means we will never outlive
     // the callback.
     callback_->SetTransactionContext(this);
     controller_->ScheduleExpensiveOperation(
+        cost_,
         MakeFunction(this, &ExpensiveOperationContextImpl::CallRun,
                      &ExpensiveOperationContextImpl::CallCancel));
   }
@@ -52,11 +56,13 @@ class ExpensiveOperationContextImpl : public ExpensiveOperationContext {
 
   void Done() override {
     if (controller_ != nullptr) {
-      controller_->NotifyExpensiveOperationComplete();
+      controller_->NotifyExpensiveOperationComplete(cost_, cpu_us_);
       controller_ = nullptr;
     }
   }
 
+  void ReportCpuUsage(int64 cpu_us) override { cpu_us_ = cpu_us; }
+
  private:
   void CallRun() {
     callback_->CallRun();
@@ -69,6 +75,8 @@ class ExpensiveOperationContextImpl : public ExpensiveOperationContext {
 
   ExpensiveOperationController* controller_;
   ExpensiveOperationCallback* callback_;
+  const ExpensiveOperationCost cost_;
+  int64 cpu_us_;
 };
 
 class ScheduleRewriteContextImpl : public ScheduleRewriteContext {
@@ -132,6 +140,7 @@ InProcessCentralController::~InProcessCentralController() {
 void InProcessCentralController::InitStats(Statistics* statistics) {
   NamedLockScheduleRewriteController::InitStats(statistics);
   PopularityContestScheduleRewriteController::InitStats(statistics);
+  CostBasedExpensiveOperationController::InitStats(statistics);
   QueuedExpensiveOperationController::InitStats(statistics);
   WorkBoundExpensiveOperationController::InitStats(statistics);
 }
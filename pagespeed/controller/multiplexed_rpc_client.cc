@@ -0,0 +1,359 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/controller/multiplexed_rpc_client.h"
+
+#include <utility>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/function.h"
+
+namespace net_instaweb {
+
+class MultiplexedRpcClient::RewriteContextImpl : public ScheduleRewriteContext {
+ public:
+  explicit RewriteContextImpl(MultiplexedRpcClient* client)
+      : client_(client), id_(0), done_(false) {}
+
+  ~RewriteContextImpl() override { MarkSucceeded(); }
+
+  void set_id(uint64 id) { id_ = id; }
+
+  void MarkSucceeded() override {
+    Complete(ControllerOperation::REWRITE_SUCCEEDED);
+  }
+
+  void MarkFailed() override { Complete(ControllerOperation::REWRITE_FAILED); }
+
+ private:
+  void Complete(ControllerOperation::Type type) {
+    if (!done_) {
+      done_ = true;
+      client_->SendCompletion(id_, type, 0);
+    }
+  }
+
+  MultiplexedRpcClient::RefPtr client_;
+  uint64 id_;
+  bool done_;
+
+  DISALLOW_COPY_AND_ASSIGN(RewriteContextImpl);
+};
+
+class MultiplexedRpcClient::ExpensiveOperationContextImpl
+    : public ExpensiveOperationContext {
+ public:
+  explicit ExpensiveOperationContextImpl(MultiplexedRpcClient* client)
+      : client_(client), id_(0), cpu_us_(0), done_(false) {}
+
+  ~ExpensiveOperationContextImpl() override { Done(); }
+
+  void set_id(uint64 id) { id_ = id; }
+
+  void Done() override {
+    if (!done_) {
+      done_ = true;
+      client_->SendCompletion(
+          id_, ControllerOperation::EXPENSIVE_OPERATION_DONE, cpu_us_);
+    }
+  }
+
+  void ReportCpuUsage(int64 cpu_us) override { cpu_us_ = cpu_us; }
+
+ private:
+  MultiplexedRpcClient::RefPtr client_;
+  uint64 id_;
+  int64 cpu_us_;
+  bool done_;
+
+  DISALLOW_COPY_AND_ASSIGN(ExpensiveOperationContextImpl);
+};
+
+MultiplexedRpcClient::MultiplexedRpcClient(
+    grpc::CentralControllerRpcService::StubInterface* stub,
+    ::grpc::CompletionQueue* queue, ThreadSystem* thread_system,
+    MessageHandler* handler)
+    : mutex_(thread_system->NewMutex()),
+      stub_(stub),
+      queue_(queue),
+      handler_(handler),
+      client_ctx_(new ::grpc::ClientContext),
+      state_(CONNECTING),
+      write_outstanding_(false),
+      finish_called_(false),
+      finish_done_(false),
+      finished_(false),
+      unimplemented_(false),
+      // Ids start at 1 so a context that was never sent can't match anything.
+      next_id_(1) {}
+
+MultiplexedRpcClient::~MultiplexedRpcClient() {
+  // Every waiting callback owns a context, which holds a ref to us.
+  DCHECK(waiting_.empty());
+}
+
+void MultiplexedRpcClient::Start() {
+  ScopedMutex lock(mutex_.get());
+  rw_ = stub_->AsyncMultiplex(
+      client_ctx_.get(), queue_,
+      MakeFunction(this, &MultiplexedRpcClient::StartDone,
+                   &MultiplexedRpcClient::StreamFailed, RefPtr(this)));
+}
+
+bool MultiplexedRpcClient::Schedule(ScheduleRewriteCallback* callback) {
+  return ScheduleOperation(ControllerOperation::SCHEDULE_REWRITE,
+                           callback->key(), NULL, callback,
+                           new RewriteContextImpl(this));
+}
+
+bool MultiplexedRpcClient::Schedule(ExpensiveOperationCallback* callback) {
+  return ScheduleOperation(ControllerOperation::SCHEDULE_EXPENSIVE_OPERATION,
+                           GoogleString(), &callback->cost(), callback,
+                           new ExpensiveOperationContextImpl(this));
+}
+
+template <typename CallbackT, typename ContextT>
+bool MultiplexedRpcClient::ScheduleOperation(ControllerOperation::Type type,
+                                             const GoogleString& key,
+                                             const ExpensiveOperationCost* cost,
+                                             CallbackT* callback,
+                                             ContextT* context) {
+  ScopedMutex lock(mutex_.get());
+  if (state_ == FAILED) {
+    lock.Release();
+    // context was never sent, so its destructor won't notify the server.
+    delete context;
+    return false;
+  }
+  uint64 id = next_id_++;
+  context->set_id(id);
+  // SetTransactionContext takes ownership of context.
+  callback->SetTransactionContext(context);
+  waiting_[id] = callback;
+  ControllerOperation* op = outgoing_.add_operations();
+  op->set_id(id);
+  op->set_type(type);
+  if (!key.empty()) {
+    op->set_key(key);
+  }
+  if (cost != NULL) {
+    cost->CopyToProto(op->mutable_cost());
+  }
+  FlushOperations();
+  return true;
+}
+
+void MultiplexedRpcClient::SendCompletion(uint64 id,
+                                          ControllerOperation::Type type,
+                                          int64 cpu_us) {
+  ScopedMutex lock(mutex_.get());
+  if (running_.erase(id) == 0) {
+    return;
+  }
+  ControllerOperation* op = outgoing_.add_operations();
+  op->set_id(id);
+  op->set_type(type);
+  if (cpu_us > 0) {
+    op->set_cpu_us(cpu_us);
+  }
+  FlushOperations();
+}
+
+void MultiplexedRpcClient::Cancel() {
+  ScopedMutex lock(mutex_.get());
+  if (client_ctx_ != nullptr) {
+    client_ctx_->TryCancel();
+  }
+}
+
+int MultiplexedRpcClient::NumOutstanding() const {
+  ScopedMutex lock(mutex_.get());
+  return waiting_.size() + running_.size();
+}
+
+bool MultiplexedRpcClient::finished() const {
+  ScopedMutex lock(mutex_.get());
+  return finished_;
+}
+
+bool MultiplexedRpcClient::unimplemented() const {
+  ScopedMutex lock(mutex_.get());
+  return unimplemented_;
+}
+
+void MultiplexedRpcClient::StartDone(RefPtr ref) {
+  ScopedMutex lock(mutex_.get());
+  DCHECK_EQ(state_, CONNECTING);
+  state_ = RUNNING;
+  AttemptRead();
+  FlushOperations();
+}
+
+void MultiplexedRpcClient::AttemptRead() {
+  rw_->Read(&incoming_,
+            MakeFunction(this, &MultiplexedRpcClient::ReadDone,
+                         &MultiplexedRpcClient::StreamFailed, RefPtr(this)));
+}
+
+void MultiplexedRpcClient::ReadDone(RefPtr ref) {
+  std::vector<Function*> to_run;
+  std::vector<Function*> to_cancel;
+  {
+    ScopedMutex lock(mutex_.get());
+    for (const ControllerDecision& decision : incoming_.decisions()) {
+      std::unordered_map<uint64, Function*>::iterator i =
+          waiting_.find(decision.id());
+      if (i == waiting_.end()) {
+        // Can only happen if we already failed and canceled everything.
+        continue;
+      }
+      if (decision.ok_to_proceed()) {
+        running_.insert(decision.id());
+        to_run.push_back(i->second);
+      } else {
+        to_cancel.push_back(i->second);
+      }
+      waiting_.erase(i);
+    }
+    incoming_.Clear();
+    if (state_ == RUNNING) {
+      AttemptRead();
+    } else {
+      FinishStream();
+    }
+  }
+  for (Function* callback : to_run) {
+    // Our user will call back into SendCompletion via the context.
+    callback->CallRun();
+  }
+  CancelAll(to_cancel);
+}
+
+void MultiplexedRpcClient::FlushOperations() {
+  if (state_ != RUNNING || write_outstanding_ ||
+      outgoing_.operations_size() == 0) {
+    return;
+  }
+  // Write serializes the message immediately, so outgoing_ can be reused
+  // straight away.
+  write_outstanding_ = true;
+  rw_->Write(outgoing_,
+             MakeFunction(this, &MultiplexedRpcClient::WriteDone,
+                          &MultiplexedRpcClient::WriteFailed, RefPtr(this)));
+  outgoing_.Clear();
+}
+
+void MultiplexedRpcClient::WriteDone(RefPtr ref) {
+  ScopedMutex lock(mutex_.get());
+  write_outstanding_ = false;
+  if (state_ == RUNNING) {
+    FlushOperations();
+  } else {
+    MaybeTearDown();
+  }
+}
+
+void MultiplexedRpcClient::WriteFailed(RefPtr ref) {
+  std::vector<Function*> to_cancel;
+  {
+    ScopedMutex lock(mutex_.get());
+    write_outstanding_ = false;
+    Fail(&to_cancel);
+    if (client_ctx_ != nullptr) {
+      // Make sure the outstanding Read fails promptly, so we Finish.
+      client_ctx_->TryCancel();
+    }
+    MaybeTearDown();
+  }
+  CancelAll(to_cancel);
+}
+
+void MultiplexedRpcClient::StreamFailed(RefPtr ref) {
+  std::vector<Function*> to_cancel;
+  {
+    ScopedMutex lock(mutex_.get());
+    Fail(&to_cancel);
+    FinishStream();
+  }
+  CancelAll(to_cancel);
+}
+
+void MultiplexedRpcClient::Fail(std::vector<Function*>* to_cancel) {
+  if (state_ == FAILED) {
+    return;
+  }
+  state_ = FAILED;
+  for (const std::pair<const uint64, Function*>& id_and_callback : waiting_) {
+    to_cancel->push_back(id_and_callback.second);
+  }
+  waiting_.clear();
+  // The server releases granted operations when the stream goes away.
+  running_.clear();
+  outgoing_.Clear();
+}
+
+void MultiplexedRpcClient::FinishStream() {
+  if (finish_called_) {
+    return;
+  }
+  finish_called_ = true;
+  rw_->Finish(&status_,
+              MakeFunction(this, &MultiplexedRpcClient::FinishDone,
+                           &MultiplexedRpcClient::FinishFailed, RefPtr(this)));
+}
+
+void MultiplexedRpcClient::FinishDone(RefPtr ref) {
+  ScopedMutex lock(mutex_.get());
+  if (status_.error_code() == ::grpc::StatusCode::UNIMPLEMENTED) {
+    unimplemented_ = true;
+  } else if (status_.error_code() != ::grpc::StatusCode::OK &&
+             status_.error_code() != ::grpc::StatusCode::CANCELLED) {
+    handler_->Message(
+        kWarning, "Multiplexed stream to CentralController failed: %d (%s)",
+        status_.error_code(), status_.error_message().c_str());
+  }
+  finish_done_ = true;
+  MaybeTearDown();
+}
+
+void MultiplexedRpcClient::FinishFailed(RefPtr ref) {
+  ScopedMutex lock(mutex_.get());
+  PS_LOG_WARN(handler_, "Multiplexed stream Finish failed");
+  finish_done_ = true;
+  MaybeTearDown();
+}
+
+void MultiplexedRpcClient::MaybeTearDown() {
+  if (finish_done_ && !write_outstanding_ && !finished_) {
+    rw_.reset();
+    // This unregisters from the ClientRegistry, which lets
+    // CentralControllerRpcClient::ShutDown complete.
+    client_ctx_.reset();
+    finished_ = true;
+  }
+}
+
+void MultiplexedRpcClient::CancelAll(const std::vector<Function*>& to_cancel) {
+  for (Function* callback : to_cancel) {
+    callback->CallCancel();
+  }
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,179 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_CONTROLLER_MULTIPLEXED_RPC_CLIENT_H_
+#define PAGESPEED_CONTROLLER_MULTIPLEXED_RPC_CLIENT_H_
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "pagespeed/controller/controller.grpc.pb.h"
+#include "pagespeed/controller/controller.pb.h"
+#include "pagespeed/controller/expensive_operation_callback.h"
+#include "pagespeed/controller/expensive_operation_cost.h"
+#include "pagespeed/controller/schedule_rewrite_callback.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/grpc.h"
+
+namespace net_instaweb {
+
+// Client side of the Multiplex RPC; the counterpart to MultiplexedRpcHandler.
+// Keeps a single stream open to the controller and sends every schedule and
+// completion over it, tagged with an id, instead of opening a stream per
+// operation. Operations submitted while a Write is outstanding are batched
+// into the next one.
+//
+// Once the stream breaks, every operation still waiting for a decision is
+// canceled and all further Schedule calls return false; the owner should
+// discard this object and create a new one once finished() is true. The server
+// releases any granted operations when it notices the disconnect, so the
+// contexts of those become no-ops.
+//
+// Thread-safe. Callbacks are invoked without any locks held.
+class MultiplexedRpcClient : public RefCounted<MultiplexedRpcClient> {
+ public:
+  MultiplexedRpcClient(grpc::CentralControllerRpcService::StubInterface* stub,
+                       ::grpc::CompletionQueue* queue,
+                       ThreadSystem* thread_system, MessageHandler* handler);
+  ~MultiplexedRpcClient();
+
+  // Open the stream. Operations may be scheduled straight away, they will be
+  // sent once the stream is up.
+  void Start() LOCKS_EXCLUDED(mutex_);
+
+  // Send a schedule operation for callback. If this returns true, callback
+  // will eventually be invoked with a transaction context, exactly as
+  // CentralController::ScheduleRewrite/ScheduleExpensiveOperation would.
+  // If it returns false, the stream has failed and callback was not touched.
+  bool Schedule(ScheduleRewriteCallback* callback) LOCKS_EXCLUDED(mutex_);
+  bool Schedule(ExpensiveOperationCallback* callback) LOCKS_EXCLUDED(mutex_);
+
+  // Break the stream, as if the server went away. CentralControllerRpcClient
+  // doesn't need this, since ClientRegistry cancels the stream along with
+  // everything else.
+  void Cancel() LOCKS_EXCLUDED(mutex_);
+
+  // Number of operations waiting for a decision or running.
+  int NumOutstanding() const LOCKS_EXCLUDED(mutex_);
+
+  // True once the stream has failed and been torn down.
+  bool finished() const LOCKS_EXCLUDED(mutex_);
+
+  // True if the stream finished because the server doesn't implement
+  // Multiplex, ie: there is no point in trying again.
+  bool unimplemented() const LOCKS_EXCLUDED(mutex_);
+
+ private:
+  typedef ::grpc::ClientAsyncReaderWriterInterface<
+      MultiplexedControllerRequest, MultiplexedControllerResponse>
+      ReaderWriter;
+  typedef RefCountedPtr<MultiplexedRpcClient> RefPtr;
+
+  enum State {
+    CONNECTING,
+    RUNNING,
+    FAILED,
+  };
+
+  class RewriteContextImpl;
+  class ExpensiveOperationContextImpl;
+
+  // Common code for the Schedule variants. context is owned by callback if
+  // this returns true, and deleted otherwise. cost is NULL for rewrites.
+  template <typename CallbackT, typename ContextT>
+  bool ScheduleOperation(ControllerOperation::Type type,
+                         const GoogleString& key,
+                         const ExpensiveOperationCost* cost,
+                         CallbackT* callback,
+                         ContextT* context) LOCKS_EXCLUDED(mutex_);
+
+  // Invoked by the contexts to let the server know a granted operation is
+  // done. Does nothing if id is not running (it was denied or the stream
+  // failed). cpu_us is only meaningful for expensive operations.
+  void SendCompletion(uint64 id, ControllerOperation::Type type, int64 cpu_us)
+      LOCKS_EXCLUDED(mutex_);
+
+  // gRPC event handlers. These hold a ref so we can't be freed while an
+  // operation is pending.
+  void StartDone(RefPtr ref) LOCKS_EXCLUDED(mutex_);
+  void ReadDone(RefPtr ref) LOCKS_EXCLUDED(mutex_);
+  void WriteDone(RefPtr ref) LOCKS_EXCLUDED(mutex_);
+  void FinishDone(RefPtr ref) LOCKS_EXCLUDED(mutex_);
+  void StreamFailed(RefPtr ref) LOCKS_EXCLUDED(mutex_);
+  void WriteFailed(RefPtr ref) LOCKS_EXCLUDED(mutex_);
+  void FinishFailed(RefPtr ref) LOCKS_EXCLUDED(mutex_);
+
+  void AttemptRead() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void FlushOperations() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Mark the stream as failed and collect the callbacks that were waiting for
+  // a decision, which the caller must cancel once mutex_ is released.
+  void Fail(std::vector<Function*>* to_cancel)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Call Finish on the stream to collect the final status, if not already
+  // done.
+  void FinishStream() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Once Finish has completed and no Write is outstanding, free the stream.
+  void MaybeTearDown() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  static void CancelAll(const std::vector<Function*>& to_cancel);
+
+  std::unique_ptr<AbstractMutex> mutex_;
+  grpc::CentralControllerRpcService::StubInterface* stub_;
+  ::grpc::CompletionQueue* queue_;
+  MessageHandler* handler_;
+
+  std::unique_ptr<::grpc::ClientContext> client_ctx_ GUARDED_BY(mutex_);
+  std::unique_ptr<ReaderWriter> rw_ GUARDED_BY(mutex_);
+  ::grpc::Status status_ GUARDED_BY(mutex_);
+
+  State state_ GUARDED_BY(mutex_);
+  bool write_outstanding_ GUARDED_BY(mutex_);
+  bool finish_called_ GUARDED_BY(mutex_);
+  bool finish_done_ GUARDED_BY(mutex_);
+  bool finished_ GUARDED_BY(mutex_);
+  bool unimplemented_ GUARDED_BY(mutex_);
+
+  uint64 next_id_ GUARDED_BY(mutex_);
+  MultiplexedControllerRequest outgoing_ GUARDED_BY(mutex_);
+  MultiplexedControllerResponse incoming_ GUARDED_BY(mutex_);
+  // Operations sent to the server that are waiting for a decision, and the
+  // callbacks to invoke with it.
+  std::unordered_map<uint64, Function*> waiting_ GUARDED_BY(mutex_);
+  // Operations the server has granted that have not yet been completed.
+  std::unordered_set<uint64> running_ GUARDED_BY(mutex_);
+
+  DISALLOW_COPY_AND_ASSIGN(MultiplexedRpcClient);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_CONTROLLER_MULTIPLEXED_RPC_CLIENT_H_
@@ -0,0 +1,239 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/controller/multiplexed_rpc_handler.h"
+
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/util/grpc.h"
+
+namespace net_instaweb {
+
+MultiplexedRpcHandler::MultiplexedRpcHandler(
+    grpc::CentralControllerRpcService::AsyncService* service,
+    ::grpc::ServerCompletionQueue* cq,
+    ExpensiveOperationController* expensive_operation_controller,
+    ScheduleRewriteController* rewrite_controller)
+    : RpcHandler(service, cq),
+      expensive_operation_controller_(expensive_operation_controller),
+      rewrite_controller_(rewrite_controller),
+      write_outstanding_(false),
+      in_batch_(false),
+      done_(false) {}
+
+MultiplexedRpcHandler::~MultiplexedRpcHandler() {
+  // Operations waiting on a controller hold a ref, and running operations are
+  // released by HandleError, so nothing should be left.
+  DCHECK(operations_.empty());
+}
+
+void MultiplexedRpcHandler::CreateAndStart(
+    grpc::CentralControllerRpcService::AsyncService* service,
+    ::grpc::ServerCompletionQueue* cq,
+    ExpensiveOperationController* expensive_operation_controller,
+    ScheduleRewriteController* rewrite_controller) {
+  (new MultiplexedRpcHandler(service, cq, expensive_operation_controller,
+                             rewrite_controller))->Start();
+}
+
+void MultiplexedRpcHandler::HandleRequest(
+    const MultiplexedControllerRequest& req) {
+  in_batch_ = true;
+  for (const ControllerOperation& op : req.operations()) {
+    if (done_) {
+      break;
+    }
+    if (!HandleOperation(op)) {
+      LOG(ERROR) << "Malformed operation " << op.type() << " for id "
+                 << op.id() << " in MultiplexedRpcHandler";
+      Finish(::grpc::Status(::grpc::StatusCode::ABORTED,
+                            "Protocol error (Multiplex)"));
+      ReleaseAll();
+    }
+  }
+  in_batch_ = false;
+  FlushDecisions();
+}
+
+bool MultiplexedRpcHandler::HandleOperation(const ControllerOperation& op) {
+  switch (op.type()) {
+    case ControllerOperation::SCHEDULE_REWRITE:
+    case ControllerOperation::SCHEDULE_EXPENSIVE_OPERATION:
+      return StartOperation(op);
+    case ControllerOperation::REWRITE_SUCCEEDED:
+    case ControllerOperation::REWRITE_FAILED:
+    case ControllerOperation::EXPENSIVE_OPERATION_DONE:
+      return CompleteOperation(op);
+    default:
+      return false;
+  }
+}
+
+bool MultiplexedRpcHandler::StartOperation(const ControllerOperation& op) {
+  bool is_rewrite = (op.type() == ControllerOperation::SCHEDULE_REWRITE);
+  if (is_rewrite && op.key().empty()) {
+    return false;
+  }
+  std::pair<OperationMap::iterator, bool> insert_result =
+      operations_.emplace(op.id(), Operation());
+  if (!insert_result.second) {
+    return false;  // Duplicate id.
+  }
+  Operation* operation = &insert_result.first->second;
+  operation->type = op.type();
+  operation->key = op.key();
+  operation->cost.CopyFromProto(op.cost());
+  // The controller may call back synchronously, which can erase operation,
+  // so don't touch it after this point.
+  Function* callback = new DecisionCallback(this, op.id());
+  if (is_rewrite) {
+    rewrite_controller_->ScheduleRewrite(op.key(), callback);
+  } else {
+    expensive_operation_controller_->ScheduleExpensiveOperation(
+        operation->cost, callback);
+  }
+  return true;
+}
+
+bool MultiplexedRpcHandler::CompleteOperation(const ControllerOperation& op) {
+  OperationMap::iterator i = operations_.find(op.id());
+  if (i == operations_.end() || !i->second.running) {
+    return false;
+  }
+  bool is_rewrite = (i->second.type == ControllerOperation::SCHEDULE_REWRITE);
+  bool completes_rewrite =
+      (op.type() == ControllerOperation::REWRITE_SUCCEEDED ||
+       op.type() == ControllerOperation::REWRITE_FAILED);
+  if (is_rewrite != completes_rewrite) {
+    return false;
+  }
+  Operation operation = i->second;
+  operations_.erase(i);
+  ReleaseOperation(operation,
+                   op.type() != ControllerOperation::REWRITE_FAILED,
+                   op.cpu_us());
+  return true;
+}
+
+void MultiplexedRpcHandler::Decide(uint64 id, bool ok_to_proceed) {
+  OperationMap::iterator i = operations_.find(id);
+  if (i == operations_.end()) {
+    LOG(DFATAL) << "Decision for unknown operation " << id;
+    return;
+  }
+  DCHECK(!i->second.running);
+
+  if (done_) {
+    // The client is gone, so if the controller just told us to do work,
+    // we cannot; tell it that we did nothing.
+    Operation operation = i->second;
+    operations_.erase(i);
+    if (ok_to_proceed) {
+      ReleaseOperation(operation, false /* succeeded */, 0 /* cpu_us */);
+    }
+    return;
+  }
+
+  if (ok_to_proceed) {
+    i->second.running = true;
+  } else {
+    operations_.erase(i);
+  }
+  ControllerDecision* decision = pending_decisions_.add_decisions();
+  decision->set_id(id);
+  decision->set_ok_to_proceed(ok_to_proceed);
+  FlushDecisions();
+}
+
+void MultiplexedRpcHandler::ReleaseOperation(const Operation& op,
+                                             bool succeeded, int64 cpu_us) {
+  if (op.type == ControllerOperation::SCHEDULE_REWRITE) {
+    if (succeeded) {
+      rewrite_controller_->NotifyRewriteComplete(op.key);
+    } else {
+      rewrite_controller_->NotifyRewriteFailed(op.key);
+    }
+  } else {
+    expensive_operation_controller_->NotifyExpensiveOperationComplete(
+        op.cost, cpu_us);
+  }
+}
+
+void MultiplexedRpcHandler::ReleaseAll() {
+  done_ = true;
+  pending_decisions_.Clear();
+  // Releasing may cause a controller to call Decide() for one of our waiting
+  // operations, so detach the running ones from operations_ first.
+  std::vector<Operation> running;
+  for (OperationMap::iterator i = operations_.begin();
+       i != operations_.end();) {
+    if (i->second.running) {
+      running.push_back(i->second);
+      i = operations_.erase(i);
+    } else {
+      ++i;
+    }
+  }
+  for (const Operation& op : running) {
+    ReleaseOperation(op, false /* succeeded */, 0 /* cpu_us */);
+  }
+}
+
+void MultiplexedRpcHandler::FlushDecisions() {
+  if (in_batch_ || write_outstanding_ || done_ ||
+      pending_decisions_.decisions_size() == 0) {
+    return;
+  }
+  if (Write(pending_decisions_)) {
+    write_outstanding_ = true;
+    pending_decisions_.Clear();
+  } else {
+    // The client is no longer writeable, so none of the granted operations
+    // can proceed.
+    ReleaseAll();
+  }
+}
+
+void MultiplexedRpcHandler::HandleWriteDone() {
+  write_outstanding_ = false;
+  FlushDecisions();
+}
+
+void MultiplexedRpcHandler::HandleError() {
+  ReleaseAll();
+}
+
+void MultiplexedRpcHandler::InitResponder(
+    grpc::CentralControllerRpcService::AsyncService* service,
+    ::grpc::ServerContext* ctx, ReaderWriterT* responder,
+    ::grpc::ServerCompletionQueue* cq, void* tag) {
+  service->RequestMultiplex(ctx, responder, cq, cq, tag);
+}
+
+MultiplexedRpcHandler::RpcHandler* MultiplexedRpcHandler::CreateHandler(
+    grpc::CentralControllerRpcService::AsyncService* service,
+    ::grpc::ServerCompletionQueue* cq) {
+  return new MultiplexedRpcHandler(service, cq, expensive_operation_controller_,
+                                   rewrite_controller_);
+}
+
+}  // namespace net_instaweb
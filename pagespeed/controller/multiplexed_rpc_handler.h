@@ -0,0 +1,160 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_CONTROLLER_MULTIPLEXED_RPC_HANDLER_H_
+#define PAGESPEED_CONTROLLER_MULTIPLEXED_RPC_HANDLER_H_
+
+#include <unordered_map>
+
+#include "pagespeed/controller/controller.grpc.pb.h"
+#include "pagespeed/controller/controller.pb.h"
+#include "pagespeed/controller/expensive_operation_controller.h"
+#include "pagespeed/controller/expensive_operation_cost.h"
+#include "pagespeed/controller/rpc_handler.h"
+#include "pagespeed/controller/schedule_rewrite_controller.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/util/grpc.h"
+
+namespace net_instaweb {
+
+// RpcHandler for the Multiplex RPC, which carries operations for both the
+// ScheduleRewriteController and the ExpensiveOperationController over a single
+// long-lived stream per client process.
+//
+// Each request message holds a batch of ControllerOperations. Schedule
+// operations are passed to the relevant controller, tagged with the
+// client-supplied id. As the controller makes up its mind, the decisions are
+// collected and written back in batches: anything decided while a Write is
+// outstanding goes out together in the next one. Completion operations are
+// dispatched to NotifyRewriteComplete(), NotifyRewriteFailed() or
+// NotifyExpensiveOperationComplete() for the operation with the matching id.
+//
+// If the client disconnects, every granted operation is released as failed,
+// and any operation the controller grants afterwards is released immediately,
+// just as RequestResultRpcHandler does for a single operation. A malformed
+// operation aborts the whole stream in the same way.
+
+class MultiplexedRpcHandler
+    : public RpcHandler<grpc::CentralControllerRpcService::AsyncService,
+                        MultiplexedControllerRequest,
+                        MultiplexedControllerResponse> {
+ public:
+  virtual ~MultiplexedRpcHandler();
+
+  // Call this to create a handler and add it to the gRPC event loop. It will
+  // free itself.
+  static void CreateAndStart(
+      grpc::CentralControllerRpcService::AsyncService* service,
+      ::grpc::ServerCompletionQueue* cq,
+      ExpensiveOperationController* expensive_operation_controller,
+      ScheduleRewriteController* rewrite_controller);
+
+ protected:
+  MultiplexedRpcHandler(
+      grpc::CentralControllerRpcService::AsyncService* service,
+      ::grpc::ServerCompletionQueue* cq,
+      ExpensiveOperationController* expensive_operation_controller,
+      ScheduleRewriteController* rewrite_controller);
+
+ private:
+  typedef RefCountedPtr<MultiplexedRpcHandler> RefPtr;
+
+  struct Operation {
+    Operation() : type(ControllerOperation::SCHEDULE_REWRITE),
+                  running(false) {}
+
+    // Either SCHEDULE_REWRITE or SCHEDULE_EXPENSIVE_OPERATION.
+    ControllerOperation::Type type;
+    GoogleString key;
+    // Only for SCHEDULE_EXPENSIVE_OPERATION.
+    ExpensiveOperationCost cost;
+    // false while waiting for the controller, true once granted.
+    bool running;
+  };
+
+  typedef std::unordered_map<uint64, Operation> OperationMap;
+
+  // Callback passed to the controllers, which routes the decision back to
+  // Decide() for the given id. Holds a ref so that we outlive the client.
+  class DecisionCallback : public Function {
+   public:
+    DecisionCallback(MultiplexedRpcHandler* handler, uint64 id)
+        : handler_(handler), id_(id) {}
+
+    void Run() override { handler_->Decide(id_, true /* ok_to_proceed */); }
+    void Cancel() override { handler_->Decide(id_, false /* ok_to_proceed */); }
+
+   private:
+    RefPtr handler_;
+    const uint64 id_;
+  };
+
+  // RpcHandler implementation.
+  void HandleRequest(const MultiplexedControllerRequest& req) override;
+  void HandleError() override;
+  void HandleWriteDone() override;
+  void InitResponder(grpc::CentralControllerRpcService::AsyncService* service,
+                     ::grpc::ServerContext* ctx, ReaderWriterT* responder,
+                     ::grpc::ServerCompletionQueue* cq, void* tag) override;
+  RpcHandler* CreateHandler(
+      grpc::CentralControllerRpcService::AsyncService* service,
+      ::grpc::ServerCompletionQueue* cq) override;
+
+  // Dispatch a single operation from the client. Returns false if it was
+  // malformed.
+  bool HandleOperation(const ControllerOperation& op);
+  bool StartOperation(const ControllerOperation& op);
+  bool CompleteOperation(const ControllerOperation& op);
+
+  // Invoked via DecisionCallback when a controller decides on operation id.
+  void Decide(uint64 id, bool ok_to_proceed);
+
+  // Tell the appropriate controller that op is finished. cpu_us is what the
+  // client reported for an expensive operation, or 0 if unknown.
+  void ReleaseOperation(const Operation& op, bool succeeded, int64 cpu_us);
+
+  // Fail every running operation. Operations still waiting for the controller
+  // are released from Decide() when their decision arrives.
+  void ReleaseAll();
+
+  // Write out any decisions that have accumulated, if no Write is outstanding.
+  void FlushDecisions();
+
+  ExpensiveOperationController* expensive_operation_controller_;
+  ScheduleRewriteController* rewrite_controller_;
+
+  OperationMap operations_;
+  MultiplexedControllerResponse pending_decisions_;
+  bool write_outstanding_;
+  // Set while processing a batch from the client, to coalesce the decisions
+  // made synchronously into a single Write.
+  bool in_batch_;
+  // Set once the client has gone away or we aborted the stream.
+  bool done_;
+
+  DISALLOW_COPY_AND_ASSIGN(MultiplexedRpcHandler);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_CONTROLLER_MULTIPLEXED_RPC_HANDLER_H_
@@ -0,0 +1,467 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "pagespeed/controller/controller.grpc.pb.h"
+#include "pagespeed/controller/controller.pb.h"
+#include "pagespeed/controller/central_controller_rpc_server.h"
+#include "pagespeed/controller/grpc_server_test.h"
+#include "pagespeed/controller/multiplexed_rpc_client.h"
+#include "pagespeed/controller/multiplexed_rpc_handler.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/gmock.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/thread/sequence.h"
+#include "pagespeed/kernel/thread/worker_test_base.h"
+#include "pagespeed/kernel/util/grpc.h"
+
+using testing::_;
+using testing::Eq;
+using testing::Invoke;
+using testing::InvokeWithoutArgs;
+using testing::WithArgs;
+
+namespace net_instaweb {
+
+namespace {
+
+// Free functions to allow use of WithArgs<N>(Invoke(, because gMock doesn't
+// understand our Functions.
+void RunFunction(Function* f) {
+  f->CallRun();
+}
+
+void CancelFunction(Function* f) {
+  f->CallCancel();
+}
+
+class MockScheduleRewriteController : public ScheduleRewriteController {
+ public:
+  MockScheduleRewriteController() {
+    EXPECT_CALL(*this, ScheduleRewrite(_, _)).Times(0);
+    EXPECT_CALL(*this, NotifyRewriteComplete(_)).Times(0);
+    EXPECT_CALL(*this, NotifyRewriteFailed(_)).Times(0);
+  }
+  virtual ~MockScheduleRewriteController() { }
+
+  MOCK_METHOD2(ScheduleRewrite, void(const GoogleString& key, Function* cb));
+  MOCK_METHOD1(NotifyRewriteComplete, void(const GoogleString& key));
+  MOCK_METHOD1(NotifyRewriteFailed, void(const GoogleString& key));
+
+  void SaveFunction(Function* f) { saved_function_ = f; }
+
+  Function* saved_function_;
+};
+
+class MockExpensiveOperationController : public ExpensiveOperationController {
+ public:
+  MockExpensiveOperationController() {
+    EXPECT_CALL(*this, ScheduleExpensiveOperation(_)).Times(0);
+    EXPECT_CALL(*this, NotifyExpensiveOperationComplete()).Times(0);
+  }
+  virtual ~MockExpensiveOperationController() { }
+
+  MOCK_METHOD1(ScheduleExpensiveOperation, void(Function* cb));
+  MOCK_METHOD0(NotifyExpensiveOperationComplete, void());
+};
+
+// Records what happened to it and notifies sync. The context is dropped on
+// return from RunImpl, which tells the controller that the rewrite succeeded.
+class TestRewriteCallback : public ScheduleRewriteCallback {
+ public:
+  TestRewriteCallback(const GoogleString& key, Sequence* sequence, bool* ran,
+                      bool* canceled, WorkerTestBase::SyncPoint* sync)
+      : ScheduleRewriteCallback(key, sequence),
+        ran_(ran),
+        canceled_(canceled),
+        sync_(sync) {}
+
+ private:
+  void RunImpl(scoped_ptr<ScheduleRewriteContext>* context) override {
+    *ran_ = true;
+    sync_->Notify();
+  }
+
+  void CancelImpl() override {
+    *canceled_ = true;
+    sync_->Notify();
+  }
+
+  bool* ran_;
+  bool* canceled_;
+  WorkerTestBase::SyncPoint* sync_;
+};
+
+// Runs the client side completion queue for MultiplexedRpcClient.
+class ClientQueueThread : public ThreadSystem::Thread {
+ public:
+  explicit ClientQueueThread(ThreadSystem* thread_system)
+      : Thread(thread_system, "multiplexed_client", ThreadSystem::kJoinable) {}
+
+  ~ClientQueueThread() override {
+    queue_.Shutdown();
+    if (Started()) {
+      Join();
+    }
+  }
+
+  ::grpc::CompletionQueue* queue() { return &queue_; }
+
+ private:
+  void Run() override { CentralControllerRpcServer::MainLoop(&queue_); }
+
+  ::grpc::CompletionQueue queue_;
+};
+
+}  // namespace
+
+class MultiplexedRpcHandlerTest : public GrpcServerTest {
+ public:
+  void SetUp() override {
+    GrpcServerTest::SetUp();
+    client_.reset(new ClientConnection(ServerAddress()));
+  }
+
+  void RegisterServices(::grpc::ServerBuilder* builder) override {
+    builder->RegisterService(&service_);
+  }
+
+  void StartHandler() {
+    QueueFunctionForServerThread(
+        MakeFunction(this, &MultiplexedRpcHandlerTest::StartOnServerThread));
+  }
+
+ protected:
+  class ClientConnection : public BaseClientConnection {
+   public:
+    explicit ClientConnection(const GoogleString& address)
+        : BaseClientConnection(address),
+          stub_(grpc::CentralControllerRpcService::NewStub(channel_)),
+          reader_writer_(stub_->Multiplex(&client_ctx_)) {
+    }
+
+    std::unique_ptr<grpc::CentralControllerRpcService::Stub> stub_;
+    std::unique_ptr<::grpc::ClientReaderWriter<MultiplexedControllerRequest,
+                                               MultiplexedControllerResponse>>
+        reader_writer_;
+  };
+
+  // gRPC functions can only safely be called from the server thread.
+  void StartOnServerThread() {
+    MultiplexedRpcHandler::CreateAndStart(&service_, queue_.get(),
+                                          &mock_expensive_controller_,
+                                          &mock_rewrite_controller_);
+  }
+
+  static void AddOperation(uint64 id, ControllerOperation::Type type,
+                           const GoogleString& key,
+                           MultiplexedControllerRequest* req) {
+    ControllerOperation* op = req->add_operations();
+    op->set_id(id);
+    op->set_type(type);
+    if (!key.empty()) {
+      op->set_key(key);
+    }
+  }
+
+  void SendOperations(const MultiplexedControllerRequest& req) {
+    ASSERT_THAT(client_->reader_writer_->Write(req), Eq(true));
+  }
+
+  void SendOperation(uint64 id, ControllerOperation::Type type,
+                     const GoogleString& key) {
+    MultiplexedControllerRequest req;
+    AddOperation(id, type, key, &req);
+    SendOperations(req);
+  }
+
+  // Reads exactly one response, which must hold all of the expected decisions.
+  void ExpectDecisions(
+      const std::vector<std::pair<uint64, bool>>& expected) {
+    MultiplexedControllerResponse resp;
+    ASSERT_THAT(client_->reader_writer_->Read(&resp), Eq(true));
+    ASSERT_THAT(resp.decisions_size(), Eq(static_cast<int>(expected.size())));
+    for (int i = 0; i < resp.decisions_size(); ++i) {
+      EXPECT_THAT(resp.decisions(i).id(), Eq(expected[i].first));
+      EXPECT_THAT(resp.decisions(i).ok_to_proceed(), Eq(expected[i].second));
+    }
+  }
+
+  void ExpectFinalStatus(const ::grpc::StatusCode& expected_code) {
+    ::grpc::Status status = client_->reader_writer_->Finish();
+    EXPECT_THAT(status.error_code(), Eq(expected_code));
+  }
+
+  grpc::CentralControllerRpcService::AsyncService service_;
+  std::unique_ptr<ClientConnection> client_;
+  MockScheduleRewriteController mock_rewrite_controller_;
+  MockExpensiveOperationController mock_expensive_controller_;
+};
+
+namespace {
+
+TEST_F(MultiplexedRpcHandlerTest, BatchOfDecisions) {
+  EXPECT_CALL(mock_rewrite_controller_, ScheduleRewrite("granted", _))
+      .WillOnce(WithArgs<1>(Invoke(&RunFunction)));
+  EXPECT_CALL(mock_rewrite_controller_, ScheduleRewrite("denied", _))
+      .WillOnce(WithArgs<1>(Invoke(&CancelFunction)));
+  EXPECT_CALL(mock_expensive_controller_, ScheduleExpensiveOperation(_))
+      .WillOnce(WithArgs<0>(Invoke(&RunFunction)));
+  StartHandler();
+
+  MultiplexedControllerRequest req;
+  AddOperation(1, ControllerOperation::SCHEDULE_REWRITE, "granted", &req);
+  AddOperation(2, ControllerOperation::SCHEDULE_REWRITE, "denied", &req);
+  AddOperation(3, ControllerOperation::SCHEDULE_EXPENSIVE_OPERATION, "", &req);
+  SendOperations(req);
+
+  // All three decisions are made synchronously, so they come back together.
+  ExpectDecisions({{1, true}, {2, false}, {3, true}});
+}
+
+TEST_F(MultiplexedRpcHandlerTest, CompleteOperations) {
+  WorkerTestBase::SyncPoint rewrite_sync(thread_system_.get());
+  WorkerTestBase::SyncPoint failed_sync(thread_system_.get());
+  WorkerTestBase::SyncPoint expensive_sync(thread_system_.get());
+  EXPECT_CALL(mock_rewrite_controller_, ScheduleRewrite(_, _))
+      .Times(2)
+      .WillRepeatedly(WithArgs<1>(Invoke(&RunFunction)));
+  EXPECT_CALL(mock_expensive_controller_, ScheduleExpensiveOperation(_))
+      .WillOnce(WithArgs<0>(Invoke(&RunFunction)));
+  EXPECT_CALL(mock_rewrite_controller_, NotifyRewriteComplete("good"))
+      .WillOnce(InvokeWithoutArgs(&rewrite_sync,
+                                  &WorkerTestBase::SyncPoint::Notify));
+  EXPECT_CALL(mock_rewrite_controller_, NotifyRewriteFailed("bad"))
+      .WillOnce(InvokeWithoutArgs(&failed_sync,
+                                  &WorkerTestBase::SyncPoint::Notify));
+  EXPECT_CALL(mock_expensive_controller_, NotifyExpensiveOperationComplete())
+      .WillOnce(InvokeWithoutArgs(&expensive_sync,
+                                  &WorkerTestBase::SyncPoint::Notify));
+  StartHandler();
+
+  MultiplexedControllerRequest req;
+  AddOperation(7, ControllerOperation::SCHEDULE_REWRITE, "good", &req);
+  AddOperation(8, ControllerOperation::SCHEDULE_REWRITE, "bad", &req);
+  AddOperation(9, ControllerOperation::SCHEDULE_EXPENSIVE_OPERATION, "", &req);
+  SendOperations(req);
+  ExpectDecisions({{7, true}, {8, true}, {9, true}});
+
+  req.Clear();
+  AddOperation(7, ControllerOperation::REWRITE_SUCCEEDED, "", &req);
+  AddOperation(8, ControllerOperation::REWRITE_FAILED, "", &req);
+  AddOperation(9, ControllerOperation::EXPENSIVE_OPERATION_DONE, "", &req);
+  SendOperations(req);
+
+  rewrite_sync.Wait();
+  failed_sync.Wait();
+  expensive_sync.Wait();
+}
+
+TEST_F(MultiplexedRpcHandlerTest, DelayedDecision) {
+  WorkerTestBase::SyncPoint sync(thread_system_.get());
+  EXPECT_CALL(mock_rewrite_controller_, ScheduleRewrite("slow", _))
+      .WillOnce(DoAll(
+          WithArgs<1>(Invoke(&mock_rewrite_controller_,
+                             &MockScheduleRewriteController::SaveFunction)),
+          InvokeWithoutArgs(&sync, &WorkerTestBase::SyncPoint::Notify)));
+  EXPECT_CALL(mock_rewrite_controller_, ScheduleRewrite("fast", _))
+      .WillOnce(WithArgs<1>(Invoke(&CancelFunction)));
+  StartHandler();
+
+  MultiplexedControllerRequest req;
+  AddOperation(1, ControllerOperation::SCHEDULE_REWRITE, "slow", &req);
+  AddOperation(2, ControllerOperation::SCHEDULE_REWRITE, "fast", &req);
+  SendOperations(req);
+
+  // The decision that was available goes out without waiting for the other.
+  ExpectDecisions({{2, false}});
+  sync.Wait();
+  QueueFunctionForServerThread(
+      MakeFunction(mock_rewrite_controller_.saved_function_,
+                   &Function::CallCancel));
+  ExpectDecisions({{1, false}});
+}
+
+TEST_F(MultiplexedRpcHandlerTest, ClientDisconnectReleasesRunning) {
+  WorkerTestBase::SyncPoint rewrite_sync(thread_system_.get());
+  WorkerTestBase::SyncPoint expensive_sync(thread_system_.get());
+  EXPECT_CALL(mock_rewrite_controller_, ScheduleRewrite("broken", _))
+      .WillOnce(WithArgs<1>(Invoke(&RunFunction)));
+  EXPECT_CALL(mock_expensive_controller_, ScheduleExpensiveOperation(_))
+      .WillOnce(WithArgs<0>(Invoke(&RunFunction)));
+  EXPECT_CALL(mock_rewrite_controller_, NotifyRewriteFailed("broken"))
+      .WillOnce(InvokeWithoutArgs(&rewrite_sync,
+                                  &WorkerTestBase::SyncPoint::Notify));
+  EXPECT_CALL(mock_expensive_controller_, NotifyExpensiveOperationComplete())
+      .WillOnce(InvokeWithoutArgs(&expensive_sync,
+                                  &WorkerTestBase::SyncPoint::Notify));
+  StartHandler();
+
+  MultiplexedControllerRequest req;
+  AddOperation(1, ControllerOperation::SCHEDULE_REWRITE, "broken", &req);
+  AddOperation(2, ControllerOperation::SCHEDULE_EXPENSIVE_OPERATION, "", &req);
+  SendOperations(req);
+  ExpectDecisions({{1, true}, {2, true}});
+  client_.reset();
+
+  rewrite_sync.Wait();
+  expensive_sync.Wait();
+}
+
+TEST_F(MultiplexedRpcHandlerTest, ClientDisconnectWhileWaiting) {
+  WorkerTestBase::SyncPoint func_saved(thread_system_.get());
+  WorkerTestBase::SyncPoint func_run(thread_system_.get());
+  {
+    // The Failed notification must not happen until after the controller
+    // grants the rewrite.
+    ::testing::InSequence s;
+
+    EXPECT_CALL(mock_rewrite_controller_, ScheduleRewrite("broken", _))
+        .WillOnce(DoAll(
+            WithArgs<1>(Invoke(&mock_rewrite_controller_,
+                               &MockScheduleRewriteController::SaveFunction)),
+            InvokeWithoutArgs(&func_saved,
+                              &WorkerTestBase::SyncPoint::Notify)));
+    EXPECT_CALL(mock_rewrite_controller_, NotifyRewriteFailed("broken"))
+        .WillOnce(
+            InvokeWithoutArgs(&func_run, &WorkerTestBase::SyncPoint::Notify));
+  }
+  StartHandler();
+
+  SendOperation(1, ControllerOperation::SCHEDULE_REWRITE, "broken");
+
+  // Wait for the server to process the request, then drop the client.
+  func_saved.Wait();
+  client_.reset();
+
+  // Now "wake up" the server. This should call NotifyRewriteFailed.
+  QueueFunctionForServerThread(mock_rewrite_controller_.saved_function_);
+  func_run.Wait();
+}
+
+TEST_F(MultiplexedRpcHandlerTest, ScheduleRewriteWithoutKey) {
+  StartHandler();
+
+  SendOperation(1, ControllerOperation::SCHEDULE_REWRITE, "");
+  ExpectFinalStatus(::grpc::StatusCode::ABORTED);
+}
+
+TEST_F(MultiplexedRpcHandlerTest, CompleteUnknownId) {
+  StartHandler();
+
+  SendOperation(1, ControllerOperation::REWRITE_SUCCEEDED, "");
+  ExpectFinalStatus(::grpc::StatusCode::ABORTED);
+}
+
+TEST_F(MultiplexedRpcHandlerTest, DuplicateIdReleasesRunning) {
+  WorkerTestBase::SyncPoint sync(thread_system_.get());
+  EXPECT_CALL(mock_rewrite_controller_, ScheduleRewrite("first", _))
+      .WillOnce(WithArgs<1>(Invoke(&RunFunction)));
+  EXPECT_CALL(mock_rewrite_controller_, NotifyRewriteFailed("first"))
+      .WillOnce(InvokeWithoutArgs(&sync, &WorkerTestBase::SyncPoint::Notify));
+  StartHandler();
+
+  SendOperation(1, ControllerOperation::SCHEDULE_REWRITE, "first");
+  ExpectDecisions({{1, true}});
+  SendOperation(1, ControllerOperation::SCHEDULE_REWRITE, "second");
+  ExpectFinalStatus(::grpc::StatusCode::ABORTED);
+  sync.Wait();
+}
+
+TEST_F(MultiplexedRpcHandlerTest, MismatchedCompletion) {
+  WorkerTestBase::SyncPoint sync(thread_system_.get());
+  EXPECT_CALL(mock_expensive_controller_, ScheduleExpensiveOperation(_))
+      .WillOnce(WithArgs<0>(Invoke(&RunFunction)));
+  EXPECT_CALL(mock_expensive_controller_, NotifyExpensiveOperationComplete())
+      .WillOnce(InvokeWithoutArgs(&sync, &WorkerTestBase::SyncPoint::Notify));
+  StartHandler();
+
+  SendOperation(1, ControllerOperation::SCHEDULE_EXPENSIVE_OPERATION, "");
+  ExpectDecisions({{1, true}});
+  SendOperation(1, ControllerOperation::REWRITE_SUCCEEDED, "");
+  ExpectFinalStatus(::grpc::StatusCode::ABORTED);
+  sync.Wait();
+}
+
+// Drives the handler with the real MultiplexedRpcClient.
+TEST_F(MultiplexedRpcHandlerTest, MultiplexedClient) {
+  WorkerTestBase::SyncPoint callbacks_done(thread_system_.get());
+  WorkerTestBase::SyncPoint complete(thread_system_.get());
+  EXPECT_CALL(mock_rewrite_controller_, ScheduleRewrite("granted", _))
+      .WillOnce(WithArgs<1>(Invoke(&RunFunction)));
+  EXPECT_CALL(mock_rewrite_controller_, ScheduleRewrite("denied", _))
+      .WillOnce(WithArgs<1>(Invoke(&CancelFunction)));
+  EXPECT_CALL(mock_rewrite_controller_, NotifyRewriteComplete("granted"))
+      .WillOnce(InvokeWithoutArgs(&complete,
+                                  &WorkerTestBase::SyncPoint::Notify));
+  StartHandler();
+
+  QueuedWorkerPool pool(1 /* max_workers */, "multiplexed_client_test",
+                        thread_system_.get());
+  QueuedWorkerPool::Sequence* sequence = pool.NewSequence();
+  ClientQueueThread client_thread(thread_system_.get());
+  ASSERT_TRUE(client_thread.Start());
+  NullMessageHandler handler;
+
+  RefCountedPtr<MultiplexedRpcClient> client(new MultiplexedRpcClient(
+      client_->stub_.get(), client_thread.queue(), thread_system_.get(),
+      &handler));
+  client->Start();
+
+  WorkerTestBase::SyncPoint granted_sync(thread_system_.get());
+  WorkerTestBase::SyncPoint denied_sync(thread_system_.get());
+  bool granted_ran = false, granted_canceled = false;
+  bool denied_ran = false, denied_canceled = false;
+  EXPECT_TRUE(client->Schedule(
+      new TestRewriteCallback("granted", sequence, &granted_ran,
+                              &granted_canceled, &granted_sync)));
+  EXPECT_TRUE(client->Schedule(
+      new TestRewriteCallback("denied", sequence, &denied_ran,
+                              &denied_canceled, &denied_sync)));
+  granted_sync.Wait();
+  denied_sync.Wait();
+  EXPECT_TRUE(granted_ran);
+  EXPECT_FALSE(granted_canceled);
+  EXPECT_FALSE(denied_ran);
+  EXPECT_TRUE(denied_canceled);
+
+  // The granted callback dropped its context, which reports success.
+  complete.Wait();
+  EXPECT_THAT(client->NumOutstanding(), Eq(0));
+
+  // Break the stream so that the client finishes and drops its refs.
+  client->Cancel();
+  std::unique_ptr<Timer> timer(thread_system_->NewTimer());
+  while (!client->finished()) {
+    timer->SleepMs(1);
+  }
+  pool.FreeSequence(sequence);
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -53,7 +53,9 @@ class QueuedExpensiveOperationController
                                      Statistics* stats);
   virtual ~QueuedExpensiveOperationController();
 
-  // ExpensiveOperationController interface.
+  // ExpensiveOperationController interface. Cost hints are ignored.
+  using ExpensiveOperationController::ScheduleExpensiveOperation;
+  using ExpensiveOperationController::NotifyExpensiveOperationComplete;
   virtual void ScheduleExpensiveOperation(Function* callback);
   virtual void NotifyExpensiveOperationComplete();
 
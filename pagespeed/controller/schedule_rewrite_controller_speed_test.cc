@@ -0,0 +1,455 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//
+// Measures how many ScheduleRewrite decisions per second the central controller
+// can make when driven by many concurrent gRPC clients through
+// CentralControllerRpcServer. The argument is the number of shards in the
+// ScheduleRewriteController; 1 uses a plain
+// PopularityContestScheduleRewriteController, larger values use
+// ShardedScheduleRewriteController.
+//
+// BM_ScheduleRewriteRpc opens a ScheduleRewrite stream per decision, as
+// ScheduleRewriteRpcContext does. BM_ScheduleRewriteMultiplexed sends the same
+// decisions over a few long-lived Multiplex streams via MultiplexedRpcClient,
+// as CentralControllerRpcClient does when the server supports it.
+//
+// Each iteration is one complete decision (request, response and, if the
+// rewrite was granted, the completion notification), so the reported
+// Time(ns) is the per-decision cost and decisions/s is 1e9 / Time(ns). For the
+// final run of each benchmark we also print the rate directly, along with the
+// 99th percentile time from issuing a request to receiving its decision and
+// the CPU time spent by the controller's event loop thread per decision.
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/controller/central_controller_rpc_server.h"
+#include "pagespeed/controller/controller.grpc.pb.h"
+#include "pagespeed/controller/controller.pb.h"
+#include "pagespeed/controller/multiplexed_rpc_client.h"
+#include "pagespeed/controller/popularity_contest_schedule_rewrite_controller.h"
+#include "pagespeed/controller/queued_expensive_operation_controller.h"
+#include "pagespeed/controller/schedule_rewrite_callback.h"
+#include "pagespeed/controller/schedule_rewrite_controller.h"
+#include "pagespeed/controller/sharded_schedule_rewrite_controller.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/benchmark.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/thread/worker_test_base.h"
+#include "pagespeed/kernel/util/grpc.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int kNumClients = 32;
+// Number of Multiplex streams the clients share, ie: the number of server
+// processes being simulated.
+const int kNumProcesses = 4;
+// Each client cycles through its own set of keys, so concurrent requests
+// rarely collide on a key and most decisions are grants.
+const int kKeysPerClient = 64;
+const int kMaxRunningRewrites = 64;
+const int kMaxQueuedRewrites = 4096;
+
+int64 ThreadCpuUs() {
+  struct rusage usage;
+  CHECK_EQ(0, getrusage(RUSAGE_THREAD, &usage));
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * Timer::kSecondUs +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+GoogleString ClientKey(int client_id, int i) {
+  return StrCat(IntegerToString(client_id), "-",
+                IntegerToString(i % kKeysPerClient));
+}
+
+// Runs the controller and records how much CPU its event loop used.
+class ServerThread : public ThreadSystem::Thread {
+ public:
+  ServerThread(ThreadSystem* thread_system, CentralControllerRpcServer* server)
+      : Thread(thread_system, "controller_speed_test_server",
+               ThreadSystem::kJoinable),
+        server_(server),
+        cpu_us_(0) {}
+
+  // Only valid after Join().
+  int64 cpu_us() const { return cpu_us_; }
+
+ private:
+  void Run() override {
+    int64 start_us = ThreadCpuUs();
+    server_->Run();
+    cpu_us_ = ThreadCpuUs() - start_us;
+  }
+
+  CentralControllerRpcServer* server_;
+  int64 cpu_us_;
+
+  DISALLOW_COPY_AND_ASSIGN(ServerThread);
+};
+
+// Runs the client side completion queue for the MultiplexedRpcClients.
+class ClientQueueThread : public ThreadSystem::Thread {
+ public:
+  explicit ClientQueueThread(ThreadSystem* thread_system)
+      : Thread(thread_system, "controller_speed_test_client_queue",
+               ThreadSystem::kJoinable) {}
+
+  ~ClientQueueThread() override {
+    queue_.Shutdown();
+    if (Started()) {
+      Join();
+    }
+  }
+
+  ::grpc::CompletionQueue* queue() { return &queue_; }
+
+ private:
+  void Run() override { CentralControllerRpcServer::MainLoop(&queue_); }
+
+  ::grpc::CompletionQueue queue_;
+
+  DISALLOW_COPY_AND_ASSIGN(ClientQueueThread);
+};
+
+// Base class for the client threads, which issue a fixed number of decisions
+// one at a time and record how long each took.
+class ClientThread : public ThreadSystem::Thread {
+ public:
+  ClientThread(ThreadSystem* thread_system, Timer* timer, int id,
+               int num_decisions)
+      : Thread(thread_system, "controller_speed_test_client",
+               ThreadSystem::kJoinable),
+        timer_(timer),
+        id_(id),
+        num_decisions_(num_decisions),
+        num_granted_(0) {
+    latencies_us_.reserve(num_decisions);
+  }
+
+  int num_granted() const { return num_granted_; }
+  const std::vector<int64>& latencies_us() const { return latencies_us_; }
+
+ protected:
+  Timer* timer_;
+  const int id_;
+  const int num_decisions_;
+  int num_granted_;
+  std::vector<int64> latencies_us_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ClientThread);
+};
+
+// Makes every decision with its own ScheduleRewrite RPC over its own channel,
+// reporting success for every rewrite it is granted.
+class PerCallClientThread : public ClientThread {
+ public:
+  PerCallClientThread(ThreadSystem* thread_system, Timer* timer,
+                      const GoogleString& address, int id, int num_decisions)
+      : ClientThread(thread_system, timer, id, num_decisions),
+        channel_(::grpc::CreateChannel(address,
+                                       ::grpc::InsecureChannelCredentials())),
+        stub_(grpc::CentralControllerRpcService::NewStub(channel_)) {}
+
+ private:
+  void Run() override {
+    for (int i = 0; i < num_decisions_; ++i) {
+      int64 start_us = timer_->NowUs();
+      ::grpc::ClientContext ctx;
+      std::unique_ptr<::grpc::ClientReaderWriter<ScheduleRewriteRequest,
+                                                 ScheduleRewriteResponse>>
+          rw(stub_->ScheduleRewrite(&ctx));
+      ScheduleRewriteRequest req;
+      req.set_key(ClientKey(id_, i));
+      ScheduleRewriteResponse resp;
+      bool ok = rw->Write(req) && rw->Read(&resp);
+      latencies_us_.push_back(timer_->NowUs() - start_us);
+      if (ok && resp.ok_to_proceed()) {
+        ++num_granted_;
+        ScheduleRewriteRequest done;
+        done.set_status(ScheduleRewriteRequest::SUCCESS);
+        rw->Write(done);
+      }
+      rw->WritesDone();
+      rw->Finish();
+    }
+  }
+
+  std::shared_ptr<::grpc::Channel> channel_;
+  std::unique_ptr<grpc::CentralControllerRpcService::Stub> stub_;
+
+  DISALLOW_COPY_AND_ASSIGN(PerCallClientThread);
+};
+
+// Records whether it was granted and wakes up the client thread. Dropping the
+// context on return from RunImpl reports success to the controller.
+class DecisionCallback : public ScheduleRewriteCallback {
+ public:
+  DecisionCallback(const GoogleString& key, Sequence* sequence, bool* granted,
+                   WorkerTestBase::SyncPoint* sync)
+      : ScheduleRewriteCallback(key, sequence),
+        granted_(granted),
+        sync_(sync) {}
+
+ private:
+  void RunImpl(scoped_ptr<ScheduleRewriteContext>* context) override {
+    *granted_ = true;
+    sync_->Notify();
+  }
+
+  void CancelImpl() override { sync_->Notify(); }
+
+  bool* granted_;
+  WorkerTestBase::SyncPoint* sync_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecisionCallback);
+};
+
+// Makes every decision through a shared MultiplexedRpcClient.
+class MultiplexedClientThread : public ClientThread {
+ public:
+  MultiplexedClientThread(ThreadSystem* thread_system, Timer* timer,
+                          MultiplexedRpcClient* client, Sequence* sequence,
+                          int id, int num_decisions)
+      : ClientThread(thread_system, timer, id, num_decisions),
+        thread_system_(thread_system),
+        client_(client),
+        sequence_(sequence) {}
+
+ private:
+  void Run() override {
+    for (int i = 0; i < num_decisions_; ++i) {
+      int64 start_us = timer_->NowUs();
+      WorkerTestBase::SyncPoint sync(thread_system_);
+      bool granted = false;
+      CHECK(client_->Schedule(
+          new DecisionCallback(ClientKey(id_, i), sequence_, &granted, &sync)));
+      sync.Wait();
+      latencies_us_.push_back(timer_->NowUs() - start_us);
+      if (granted) {
+        ++num_granted_;
+      }
+    }
+  }
+
+  ThreadSystem* thread_system_;
+  MultiplexedRpcClient* client_;
+  Sequence* sequence_;
+
+  DISALLOW_COPY_AND_ASSIGN(MultiplexedClientThread);
+};
+
+// Everything on the controller side of the benchmark.
+class ControllerHarness {
+ public:
+  explicit ControllerHarness(int num_shards)
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(thread_system_->NewTimer()),
+        stats_(thread_system_.get()) {
+    PopularityContestScheduleRewriteController::InitStats(&stats_);
+    QueuedExpensiveOperationController::InitStats(&stats_);
+
+    ScheduleRewriteController* rewrite_controller;
+    if (num_shards == 1) {
+      rewrite_controller = new PopularityContestScheduleRewriteController(
+          thread_system_.get(), &stats_, timer_.get(), kMaxRunningRewrites,
+          kMaxQueuedRewrites);
+    } else {
+      rewrite_controller = new ShardedScheduleRewriteController(
+          thread_system_.get(), &stats_, timer_.get(), num_shards,
+          kMaxRunningRewrites, kMaxQueuedRewrites);
+    }
+
+    mkdir(GTestTempDir().c_str(), 0755);
+    address_ = StrCat("unix:", GTestTempDir(), "/controller_speed_test.sock");
+    server_.reset(new CentralControllerRpcServer(
+        address_,
+        new QueuedExpensiveOperationController(1, thread_system_.get(),
+                                               &stats_),
+        rewrite_controller, &handler_));
+    CHECK_EQ(0, server_->Setup());
+    server_thread_.reset(new ServerThread(thread_system_.get(), server_.get()));
+    CHECK(server_thread_->Start());
+  }
+
+  // Stops the server and returns the CPU time its event loop used.
+  int64 Stop() {
+    server_->Stop();
+    server_thread_->Join();
+    return server_thread_->cpu_us();
+  }
+
+  ThreadSystem* thread_system() { return thread_system_.get(); }
+  Timer* timer() { return timer_.get(); }
+  MessageHandler* handler() { return &handler_; }
+  const GoogleString& address() const { return address_; }
+
+ private:
+  std::unique_ptr<ThreadSystem> thread_system_;
+  std::unique_ptr<Timer> timer_;
+  SimpleStats stats_;
+  NullMessageHandler handler_;
+  GoogleString address_;
+  std::unique_ptr<CentralControllerRpcServer> server_;
+  std::unique_ptr<ServerThread> server_thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(ControllerHarness);
+};
+
+// Starts all the clients, waits for them to finish and returns the elapsed
+// time. Benchmark timing only covers this.
+int64 RunClients(Timer* timer, const std::vector<ClientThread*>& clients) {
+  int64 start_us = timer->NowUs();
+  StartBenchmarkTiming();
+  for (ClientThread* client : clients) {
+    CHECK(client->Start());
+  }
+  for (ClientThread* client : clients) {
+    client->Join();
+  }
+  StopBenchmarkTiming();
+  return timer->NowUs() - start_us;
+}
+
+// Splits iters as evenly as possible over kNumClients.
+int DecisionsForClient(int iters, int client) {
+  return iters / kNumClients + (client < iters % kNumClients ? 1 : 0);
+}
+
+void Report(const char* name, int num_shards, int iters, int64 elapsed_us,
+            int64 server_cpu_us, const std::vector<ClientThread*>& clients) {
+  // The benchmark harness keeps re-running with more iterations until a run
+  // takes at least a second; only report that one.
+  if (elapsed_us < Timer::kSecondUs) {
+    return;
+  }
+  int num_granted = 0;
+  std::vector<int64> latencies_us;
+  for (ClientThread* client : clients) {
+    num_granted += client->num_granted();
+    latencies_us.insert(latencies_us.end(), client->latencies_us().begin(),
+                        client->latencies_us().end());
+  }
+  std::sort(latencies_us.begin(), latencies_us.end());
+  int64 p99_us = latencies_us[latencies_us.size() * 99 / 100];
+  fprintf(stdout,
+          "%s/%d: %.0f decisions/s, p99 latency %d us, "
+          "controller CPU %.2f us/decision (%d of %d granted)\n",
+          name, num_shards,
+          iters * static_cast<double>(Timer::kSecondUs) / elapsed_us,
+          static_cast<int>(p99_us),
+          server_cpu_us / static_cast<double>(iters), num_granted, iters);
+}
+
+void BM_ScheduleRewriteRpc(int iters, int num_shards) {
+  StopBenchmarkTiming();
+  ControllerHarness harness(num_shards);
+
+  std::vector<ClientThread*> clients;
+  for (int i = 0; i < kNumClients; ++i) {
+    clients.push_back(new PerCallClientThread(
+        harness.thread_system(), harness.timer(), harness.address(), i,
+        DecisionsForClient(iters, i)));
+  }
+
+  int64 elapsed_us = RunClients(harness.timer(), clients);
+  int64 server_cpu_us = harness.Stop();
+  Report("BM_ScheduleRewriteRpc", num_shards, iters, elapsed_us,
+         server_cpu_us, clients);
+  STLDeleteElements(&clients);
+}
+BENCHMARK_RANGE(BM_ScheduleRewriteRpc, 1, 16);
+
+void BM_ScheduleRewriteMultiplexed(int iters, int num_shards) {
+  StopBenchmarkTiming();
+  ControllerHarness harness(num_shards);
+  ThreadSystem* thread_system = harness.thread_system();
+
+  ClientQueueThread queue_thread(thread_system);
+  CHECK(queue_thread.Start());
+  std::vector<std::shared_ptr<::grpc::Channel>> channels;
+  std::vector<std::unique_ptr<grpc::CentralControllerRpcService::Stub>> stubs;
+  std::vector<RefCountedPtr<MultiplexedRpcClient>> streams;
+  for (int i = 0; i < kNumProcesses; ++i) {
+    channels.push_back(::grpc::CreateChannel(
+        harness.address(), ::grpc::InsecureChannelCredentials()));
+    stubs.push_back(grpc::CentralControllerRpcService::NewStub(channels[i]));
+    streams.push_back(RefCountedPtr<MultiplexedRpcClient>(
+        new MultiplexedRpcClient(stubs[i].get(), queue_thread.queue(),
+                                 thread_system, harness.handler())));
+    streams[i]->Start();
+  }
+
+  QueuedWorkerPool pool(kNumClients, "controller_speed_test_callbacks",
+                        thread_system);
+  std::vector<QueuedWorkerPool::Sequence*> sequences;
+  std::vector<ClientThread*> clients;
+  for (int i = 0; i < kNumClients; ++i) {
+    sequences.push_back(pool.NewSequence());
+    clients.push_back(new MultiplexedClientThread(
+        thread_system, harness.timer(), streams[i % kNumProcesses].get(),
+        sequences[i], i, DecisionsForClient(iters, i)));
+  }
+
+  int64 elapsed_us = RunClients(harness.timer(), clients);
+
+  // Tear the streams down before stopping the server, which would otherwise
+  // wait for them.
+  for (const RefCountedPtr<MultiplexedRpcClient>& stream : streams) {
+    stream->Cancel();
+    while (!stream->finished()) {
+      harness.timer()->SleepMs(1);
+    }
+  }
+  int64 server_cpu_us = harness.Stop();
+  Report("BM_ScheduleRewriteMultiplexed", num_shards, iters, elapsed_us,
+         server_cpu_us, clients);
+  STLDeleteElements(&clients);
+  for (QueuedWorkerPool::Sequence* sequence : sequences) {
+    pool.FreeSequence(sequence);
+  }
+}
+BENCHMARK_RANGE(BM_ScheduleRewriteMultiplexed, 1, 16);
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -0,0 +1,85 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/controller/sharded_schedule_rewrite_controller.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "base/logging.h"
+#include "pagespeed/controller/popularity_contest_schedule_rewrite_controller.h"
+#include "pagespeed/kernel/base/stl_util.h"
+
+namespace net_instaweb {
+
+ShardedScheduleRewriteController::ShardedScheduleRewriteController(
+    ThreadSystem* thread_system, Statistics* statistics, Timer* timer,
+    int num_shards, int max_running_rewrites, int max_queued_rewrites) {
+  CHECK_GT(max_running_rewrites, 0);
+  CHECK_GT(max_queued_rewrites, 0);
+  num_shards = std::max(1, std::min(num_shards, std::min(
+      max_running_rewrites, max_queued_rewrites)));
+  shards_.reserve(num_shards);
+  for (int i = 0; i < num_shards; ++i) {
+    shards_.push_back(new PopularityContestScheduleRewriteController(
+        thread_system, statistics, timer,
+        ShardBudget(max_running_rewrites, num_shards, i),
+        ShardBudget(max_queued_rewrites, num_shards, i)));
+  }
+}
+
+ShardedScheduleRewriteController::~ShardedScheduleRewriteController() {
+  STLDeleteElements(&shards_);
+}
+
+int ShardedScheduleRewriteController::ShardBudget(int total, int num_shards,
+                                                  int index) {
+  DCHECK_LT(index, num_shards);
+  return total / num_shards + ((index < total % num_shards) ? 1 : 0);
+}
+
+PopularityContestScheduleRewriteController*
+ShardedScheduleRewriteController::ShardForKey(const GoogleString& key) const {
+  size_t hash = std::hash<GoogleString>()(key);
+  return shards_[hash % shards_.size()];
+}
+
+void ShardedScheduleRewriteController::ScheduleRewrite(
+    const GoogleString& key, Function* callback) {
+  ShardForKey(key)->ScheduleRewrite(key, callback);
+}
+
+void ShardedScheduleRewriteController::NotifyRewriteComplete(
+    const GoogleString& key) {
+  ShardForKey(key)->NotifyRewriteComplete(key);
+}
+
+void ShardedScheduleRewriteController::NotifyRewriteFailed(
+    const GoogleString& key) {
+  ShardForKey(key)->NotifyRewriteFailed(key);
+}
+
+void ShardedScheduleRewriteController::ShutDown() {
+  for (PopularityContestScheduleRewriteController* shard : shards_) {
+    shard->ShutDown();
+  }
+}
+
+}  // namespace net_instaweb
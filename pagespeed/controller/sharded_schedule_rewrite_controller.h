@@ -0,0 +1,87 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_CONTROLLER_SHARDED_SCHEDULE_REWRITE_CONTROLLER_H_
+#define PAGESPEED_CONTROLLER_SHARDED_SCHEDULE_REWRITE_CONTROLLER_H_
+
+#include <vector>
+
+#include "pagespeed/controller/schedule_rewrite_controller.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+
+namespace net_instaweb {
+
+class PopularityContestScheduleRewriteController;
+
+// ScheduleRewriteController that splits the key space across several
+// independent PopularityContestScheduleRewriteControllers, each with its own
+// mutex, map and priority queue. Keys are hashed to a shard, so the "at most
+// one rewrite per key" guarantee is preserved, while callers working on
+// different keys mostly stop contending on a single lock.
+//
+// The running and queued budgets are divided between the shards in proportion,
+// so the totals never exceed what an unsharded controller would allow. The
+// cost is that popularity is only compared within a shard: a shard with idle
+// slots will start its own most popular rewrite even if another shard has a
+// more popular one waiting.
+//
+// All shards report into the same PopularityContestScheduleRewriteController
+// statistics, so the aggregate values are unchanged by sharding.
+class ShardedScheduleRewriteController : public ScheduleRewriteController {
+ public:
+  // num_shards is clamped so that each shard has at least one running and one
+  // queued slot. The budgets must be > 0, as for
+  // PopularityContestScheduleRewriteController.
+  ShardedScheduleRewriteController(ThreadSystem* thread_system,
+                                   Statistics* statistics,
+                                   Timer* timer,
+                                   int num_shards,
+                                   int max_running_rewrites,
+                                   int max_queued_rewrites);
+  virtual ~ShardedScheduleRewriteController();
+
+  // ScheduleRewriteController interface.
+  void ScheduleRewrite(const GoogleString& key, Function* callback) override;
+  void NotifyRewriteComplete(const GoogleString& key) override;
+  void NotifyRewriteFailed(const GoogleString& key) override;
+  void ShutDown() override;
+
+  int num_shards() const { return shards_.size(); }
+
+  // Returns the share of total that the shard with the given index is allowed,
+  // spreading any remainder over the lowest-numbered shards.
+  static int ShardBudget(int total, int num_shards, int index);
+
+ private:
+  PopularityContestScheduleRewriteController* ShardForKey(
+      const GoogleString& key) const;
+
+  std::vector<PopularityContestScheduleRewriteController*> shards_;
+
+  DISALLOW_COPY_AND_ASSIGN(ShardedScheduleRewriteController);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_CONTROLLER_SHARDED_SCHEDULE_REWRITE_CONTROLLER_H_
@@ -0,0 +1,186 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/controller/sharded_schedule_rewrite_controller.h"
+
+#include <memory>
+#include <vector>
+
+#include "pagespeed/controller/popularity_contest_schedule_rewrite_controller.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/gmock.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+using testing::Eq;
+using testing::Le;
+
+namespace net_instaweb {
+
+namespace {
+
+const int kNumShards = 4;
+const int kMaxRewrites = 8;
+const int kMaxQueueLength = 20;
+
+class TrackCallsFunction : public Function {
+ public:
+  TrackCallsFunction() : run_called_(false), cancel_called_(false) {
+    set_delete_after_callback(false);
+  }
+  virtual ~TrackCallsFunction() { }
+
+  void Run() override { run_called_ = true; }
+  void Cancel() override { cancel_called_ = true; }
+
+  bool run_called_;
+  bool cancel_called_;
+};
+
+class ShardedScheduleRewriteControllerTest : public testing::Test {
+ public:
+  ShardedScheduleRewriteControllerTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        stats_(thread_system_.get()),
+        timer_(thread_system_->NewMutex(), MockTimer::kApr_5_2010_ms) {
+    PopularityContestScheduleRewriteController::InitStats(&stats_);
+    controller_.reset(new ShardedScheduleRewriteController(
+        thread_system_.get(), &stats_, &timer_, kNumShards, kMaxRewrites,
+        kMaxQueueLength));
+  }
+
+  ~ShardedScheduleRewriteControllerTest() override {
+    controller_.reset();
+    STLDeleteElements(&functions_);
+  }
+
+ protected:
+  TrackCallsFunction* Schedule(const GoogleString& key) {
+    TrackCallsFunction* f = new TrackCallsFunction;
+    functions_.push_back(f);
+    controller_->ScheduleRewrite(key, f);
+    return f;
+  }
+
+  int64 StatValue(const char* name) {
+    return stats_.GetUpDownCounter(name)->Get();
+  }
+
+  std::unique_ptr<ThreadSystem> thread_system_;
+  SimpleStats stats_;
+  MockTimer timer_;
+  std::unique_ptr<ShardedScheduleRewriteController> controller_;
+  std::vector<TrackCallsFunction*> functions_;
+};
+
+TEST_F(ShardedScheduleRewriteControllerTest, ShardBudgets) {
+  int total = 0;
+  for (int i = 0; i < 3; ++i) {
+    total += ShardedScheduleRewriteController::ShardBudget(10, 3, i);
+  }
+  EXPECT_THAT(total, Eq(10));
+  EXPECT_THAT(ShardedScheduleRewriteController::ShardBudget(10, 3, 0), Eq(4));
+  EXPECT_THAT(ShardedScheduleRewriteController::ShardBudget(10, 3, 2), Eq(3));
+}
+
+TEST_F(ShardedScheduleRewriteControllerTest, ShardsClampedToBudget) {
+  EXPECT_THAT(controller_->num_shards(), Eq(kNumShards));
+  ShardedScheduleRewriteController small(thread_system_.get(), &stats_,
+                                         &timer_, 16, 2, 100);
+  EXPECT_THAT(small.num_shards(), Eq(2));
+  ShardedScheduleRewriteController none(thread_system_.get(), &stats_,
+                                        &timer_, 0, 2, 100);
+  EXPECT_THAT(none.num_shards(), Eq(1));
+}
+
+TEST_F(ShardedScheduleRewriteControllerTest, DuplicateKeyRejected) {
+  TrackCallsFunction* first = Schedule("a");
+  EXPECT_TRUE(first->run_called_);
+  TrackCallsFunction* second = Schedule("a");
+  EXPECT_FALSE(second->run_called_);
+  EXPECT_TRUE(second->cancel_called_);
+  controller_->NotifyRewriteComplete("a");
+
+  // Once complete, the key can be rewritten again.
+  TrackCallsFunction* third = Schedule("a");
+  EXPECT_TRUE(third->run_called_);
+  controller_->NotifyRewriteComplete("a");
+}
+
+TEST_F(ShardedScheduleRewriteControllerTest, RunningBudgetRespected) {
+  // Queue up more keys than can run at once. No matter how the keys hash,
+  // the shards between them never exceed kMaxRewrites running.
+  const int kNumKeys = kMaxQueueLength / 2;
+  std::vector<TrackCallsFunction*> callbacks;
+  for (int i = 0; i < kNumKeys; ++i) {
+    callbacks.push_back(Schedule(IntegerToString(i)));
+  }
+  std::vector<bool> completed(kNumKeys, false);
+  int num_completed = 0;
+  while (num_completed < kNumKeys) {
+    int running = 0;
+    for (int i = 0; i < kNumKeys; ++i) {
+      EXPECT_FALSE(callbacks[i]->cancel_called_);
+      if (callbacks[i]->run_called_ && !completed[i]) {
+        ++running;
+      }
+    }
+    EXPECT_THAT(running, Le(kMaxRewrites));
+    EXPECT_THAT(StatValue(
+        PopularityContestScheduleRewriteController::kNumRewritesRunning),
+        Eq(running));
+    // Every shard with queued work has a running rewrite, so progress is
+    // always possible.
+    ASSERT_GT(running, 0);
+    for (int i = 0; i < kNumKeys; ++i) {
+      if (callbacks[i]->run_called_ && !completed[i]) {
+        completed[i] = true;
+        ++num_completed;
+        controller_->NotifyRewriteComplete(IntegerToString(i));
+        break;
+      }
+    }
+  }
+  EXPECT_THAT(StatValue(
+      PopularityContestScheduleRewriteController::kRewriteQueueSize), Eq(0));
+}
+
+TEST_F(ShardedScheduleRewriteControllerTest, FailureRetriedOnSameShard) {
+  TrackCallsFunction* first = Schedule("a");
+  ASSERT_TRUE(first->run_called_);
+  controller_->NotifyRewriteFailed("a");
+  EXPECT_THAT(StatValue(
+      PopularityContestScheduleRewriteController::kNumRewritesAwaitingRetry),
+      Eq(1));
+  TrackCallsFunction* retry = Schedule("a");
+  EXPECT_TRUE(retry->run_called_);
+  EXPECT_THAT(StatValue(
+      PopularityContestScheduleRewriteController::kNumRewritesAwaitingRetry),
+      Eq(0));
+  controller_->NotifyRewriteComplete("a");
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
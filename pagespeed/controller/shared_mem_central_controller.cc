@@ -0,0 +1,572 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/controller/shared_mem_central_controller.h"
+
+#include <unistd.h>
+#include <map>
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/controller/expensive_operation_cost.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// How long the watcher sleeps before checking the controller is still alive.
+const int64 kLivenessCheckIntervalMs = 100;
+
+typedef SharedMemControllerChannel::SlotState SlotState;
+
+void ScheduleOn(CentralController* controller,
+                ScheduleRewriteCallback* callback) {
+  controller->ScheduleRewrite(callback);
+}
+
+void ScheduleOn(CentralController* controller,
+                ExpensiveOperationCallback* callback) {
+  controller->ScheduleExpensiveOperation(callback);
+}
+
+}  // namespace
+
+const int64 SharedMemCentralController::kPickUpTimeoutMs;
+
+// State shared between the controller, its contexts and the watcher thread.
+// Contexts may outlive the controller, so this is reference counted.
+class SharedMemCentralController::Core : public RefCounted<Core> {
+ public:
+  // fallback must stay valid until ShutDown returns.
+  Core(SharedMemControllerChannel* channel, CentralController* fallback,
+       ThreadSystem* thread_system, MessageHandler* handler);
+
+  // Claims a slot for key and records it in transaction. Returns false if
+  // the request can't be sent over shared memory. cost is NULL for rewrites.
+  bool Claim(StringPiece key, const ExpensiveOperationCost* cost,
+             Transaction* transaction) LOCKS_EXCLUDED(mutex_);
+
+  // Sends the slot claimed by pending's transaction to the server, taking
+  // ownership of pending. Its callback will be Run or Cancelled once the
+  // server decides, or passed to the fallback if the server doesn't pick it
+  // up in time.
+  void Submit(SlotState request, PendingRequest* pending)
+      LOCKS_EXCLUDED(mutex_);
+
+  // Tells the server a granted operation is over. cpu_us is only meaningful
+  // for expensive operations.
+  void Complete(int slot, int32 epoch, SlotState outcome, int64 cpu_us);
+
+  void ShutDown() LOCKS_EXCLUDED(mutex_);
+
+ private:
+  class WatcherThread;
+
+  struct Waiter {
+    SlotState request;
+    PendingRequest* pending;
+    int64 submitted_ms;
+  };
+  typedef std::map<int, Waiter> WaiterMap;
+  typedef std::vector<PendingRequest*> PendingVector;
+
+  friend class RefCounted<Core>;
+  ~Core();
+
+  void WatchLoop() LOCKS_EXCLUDED(mutex_);
+  // Removes every decided request from waiting_, adding it to to_run or
+  // to_cancel.
+  void CollectDecisions(PendingVector* to_run, PendingVector* to_cancel)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Abandons every request the server hasn't taken off the ring within
+  // kPickUpTimeoutMs, adding it to to_fall_back. The server may be held up by
+  // a client that died halfway through submitting.
+  void WithdrawOverdue(int64 now_ms, PendingVector* to_fall_back)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Cancels everything in waiting_ if the controller process has exited.
+  void CheckServerAlive(PendingVector* to_cancel) LOCKS_EXCLUDED(mutex_);
+
+  std::unique_ptr<SharedMemControllerChannel> channel_;
+  CentralController* fallback_;
+  ThreadSystem* thread_system_;
+  std::unique_ptr<Timer> timer_;
+  MessageHandler* handler_;
+  std::unique_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  std::unique_ptr<ThreadSystem::Condvar> waiting_nonempty_;
+  std::unique_ptr<WatcherThread> watcher_ GUARDED_BY(mutex_);
+  WaiterMap waiting_ GUARDED_BY(mutex_);
+  // The pid of a controller we saw die. A restarted controller will have a
+  // different one.
+  int32 dead_server_pid_ GUARDED_BY(mutex_);
+  bool shut_down_ GUARDED_BY(mutex_);
+
+  DISALLOW_COPY_AND_ASSIGN(Core);
+};
+
+class SharedMemCentralController::Core::WatcherThread
+    : public ThreadSystem::Thread {
+ public:
+  WatcherThread(Core* core, ThreadSystem* thread_system)
+      : Thread(thread_system, "shm_controller_client",
+               ThreadSystem::kJoinable),
+        core_(core) {}
+
+ private:
+  void Run() override { core_->WatchLoop(); }
+
+  Core* core_;
+
+  DISALLOW_COPY_AND_ASSIGN(WatcherThread);
+};
+
+// The client's end of a single operation, embedded in its context. Notifies
+// the server of completion at most once, and not at all if the operation was
+// never granted.
+class SharedMemCentralController::Transaction {
+ public:
+  Transaction() : slot_(SharedMemControllerChannel::kNoSlot), epoch_(0) {}
+
+  void Start(Core* core, int slot, int32 epoch) {
+    core_.reset(core);
+    slot_ = slot;
+    epoch_ = epoch;
+  }
+
+  // There is nothing to tell the server, eg because it denied the request.
+  void Disarm() { core_.clear(); }
+
+  void Finish(SlotState outcome, int64 cpu_us) {
+    if (core_.get() != NULL) {
+      core_->Complete(slot_, epoch_, outcome, cpu_us);
+      core_.clear();
+    }
+  }
+
+  int slot() const { return slot_; }
+  int32 epoch() const { return epoch_; }
+
+ private:
+  RefCountedPtr<Core> core_;
+  int slot_;
+  int32 epoch_;
+
+  DISALLOW_COPY_AND_ASSIGN(Transaction);
+};
+
+class SharedMemCentralController::ExpensiveOperationContextImpl
+    : public ExpensiveOperationContext {
+ public:
+  ExpensiveOperationContextImpl() : cpu_us_(0) {}
+  ~ExpensiveOperationContextImpl() override { Done(); }
+
+  void Done() override {
+    transaction_.Finish(SharedMemControllerChannel::kExpensiveOperationDone,
+                        cpu_us_);
+  }
+
+  void ReportCpuUsage(int64 cpu_us) override { cpu_us_ = cpu_us; }
+
+  Transaction* transaction() { return &transaction_; }
+
+ private:
+  Transaction transaction_;
+  int64 cpu_us_;
+
+  DISALLOW_COPY_AND_ASSIGN(ExpensiveOperationContextImpl);
+};
+
+class SharedMemCentralController::ScheduleRewriteContextImpl
+    : public ScheduleRewriteContext {
+ public:
+  ScheduleRewriteContextImpl() {}
+  ~ScheduleRewriteContextImpl() override { MarkSucceeded(); }
+
+  void MarkSucceeded() override {
+    transaction_.Finish(SharedMemControllerChannel::kRewriteSucceeded, 0);
+  }
+
+  void MarkFailed() override {
+    transaction_.Finish(SharedMemControllerChannel::kRewriteFailed, 0);
+  }
+
+  Transaction* transaction() { return &transaction_; }
+
+ private:
+  Transaction transaction_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScheduleRewriteContextImpl);
+};
+
+// A request sent to the server and waiting for its decision. Holds on to the
+// context until the request is granted, so that a request the server never
+// picks up can still go to the fallback, which gives the callback its own.
+class SharedMemCentralController::PendingRequest {
+ public:
+  PendingRequest() {}
+  virtual ~PendingRequest() {}
+
+  virtual Transaction* transaction() = 0;
+
+  // Passes the context to the callback and runs it.
+  virtual void Grant() = 0;
+  // These two expect the transaction to have been disarmed.
+  virtual void Deny() = 0;
+  virtual void FallBack(CentralController* fallback) = 0;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(PendingRequest);
+};
+
+template <typename CallbackType, typename ContextType>
+class SharedMemCentralController::Pending : public PendingRequest {
+ public:
+  Pending(CallbackType* callback, ContextType* context)
+      : callback_(callback), context_(context) {}
+
+  Transaction* transaction() override { return context_->transaction(); }
+
+  void Grant() override {
+    callback_->SetTransactionContext(context_.release());
+    callback_->CallRun();
+  }
+
+  void Deny() override {
+    context_.reset();
+    callback_->CallCancel();
+  }
+
+  void FallBack(CentralController* fallback) override {
+    context_.reset();
+    ScheduleOn(fallback, callback_);
+  }
+
+ private:
+  CallbackType* callback_;
+  std::unique_ptr<ContextType> context_;
+
+  DISALLOW_COPY_AND_ASSIGN(Pending);
+};
+
+SharedMemCentralController::Core::Core(SharedMemControllerChannel* channel,
+                                       CentralController* fallback,
+                                       ThreadSystem* thread_system,
+                                       MessageHandler* handler)
+    : channel_(channel),
+      fallback_(fallback),
+      thread_system_(thread_system),
+      timer_(thread_system->NewTimer()),
+      handler_(handler),
+      mutex_(thread_system->NewMutex()),
+      waiting_nonempty_(mutex_->NewCondvar()),
+      dead_server_pid_(0),
+      shut_down_(false) {
+}
+
+SharedMemCentralController::Core::~Core() {
+  DCHECK(watcher_ == nullptr);
+  DCHECK(waiting_.empty());
+}
+
+bool SharedMemCentralController::Core::Claim(StringPiece key,
+                                             const ExpensiveOperationCost* cost,
+                                             Transaction* transaction) {
+  if (key.size() > static_cast<size_t>(
+                       SharedMemControllerChannel::kMaxKeySize)) {
+    return false;
+  }
+  int32 server_pid = channel_->server_pid();
+  {
+    ScopedMutex lock(mutex_.get());
+    if (shut_down_ || server_pid == 0 || server_pid == dead_server_pid_) {
+      return false;
+    }
+  }
+  int slot = channel_->ClaimSlot();
+  if (slot == SharedMemControllerChannel::kNoSlot) {
+    return false;
+  }
+  // The server bumps the epoch before publishing its pid, so this is at least
+  // as new as the server we checked.
+  int32 epoch = channel_->epoch();
+  channel_->FillSlot(slot, getpid(), epoch, key);
+  if (cost != NULL) {
+    channel_->SetCost(slot, cost->input_bytes, cost->pixels);
+  }
+  transaction->Start(this, slot, epoch);
+  return true;
+}
+
+void SharedMemCentralController::Core::Submit(SlotState request,
+                                              PendingRequest* pending) {
+  int slot = pending->transaction()->slot();
+  {
+    ScopedMutex lock(mutex_.get());
+    if (!shut_down_ && watcher_ == nullptr) {
+      watcher_.reset(new WatcherThread(this, thread_system_));
+      if (!watcher_->Start()) {
+        handler_->Message(kError, "Unable to start shared memory controller "
+                          "client thread");
+        watcher_.reset();
+      }
+    }
+    if (!shut_down_ && watcher_ != nullptr) {
+      Waiter waiter = {request, pending, timer_->NowMs()};
+      waiting_[slot] = waiter;
+      // This is done with the lock held so that ShutDown finds the slot
+      // either claimed but not yet known to waiting_, or submitted.
+      channel_->Submit(slot, request);
+      waiting_nonempty_->Signal();
+      return;
+    }
+  }
+  channel_->FreeSlot(slot);
+  pending->transaction()->Disarm();
+  pending->Deny();
+  delete pending;
+}
+
+void SharedMemCentralController::Core::Complete(int slot, int32 epoch,
+                                                SlotState outcome,
+                                                int64 cpu_us) {
+  if (channel_->epoch() != epoch || channel_->server_pid() == 0) {
+    // The server has restarted or gone away, and forgotten all about it.
+    return;
+  }
+  if (cpu_us > 0) {
+    channel_->SetCpuUs(slot, cpu_us);
+  }
+  channel_->Submit(slot, outcome);
+}
+
+void SharedMemCentralController::Core::WatchLoop() {
+  while (true) {
+    // Read the sequence number before looking at the slots, so a decision
+    // published after we look stops us from sleeping.
+    int32 seen = channel_->decision_sequence();
+    PendingVector to_run;
+    PendingVector to_cancel;
+    PendingVector to_fall_back;
+    {
+      ScopedMutex lock(mutex_.get());
+      while (waiting_.empty() && !shut_down_) {
+        waiting_nonempty_->Wait();
+      }
+      if (shut_down_) {
+        // ShutDown takes care of anything left in waiting_.
+        break;
+      }
+      CollectDecisions(&to_run, &to_cancel);
+      WithdrawOverdue(timer_->NowMs(), &to_fall_back);
+    }
+    if (to_run.empty() && to_cancel.empty() && to_fall_back.empty()) {
+      channel_->WaitForDecisions(seen, kLivenessCheckIntervalMs);
+      CheckServerAlive(&to_cancel);
+    }
+    for (int i = 0, n = to_run.size(); i < n; ++i) {
+      to_run[i]->Grant();
+      delete to_run[i];
+    }
+    for (int i = 0, n = to_cancel.size(); i < n; ++i) {
+      to_cancel[i]->Deny();
+      delete to_cancel[i];
+    }
+    for (int i = 0, n = to_fall_back.size(); i < n; ++i) {
+      to_fall_back[i]->FallBack(fallback_);
+      delete to_fall_back[i];
+    }
+  }
+}
+
+void SharedMemCentralController::Core::CollectDecisions(
+    PendingVector* to_run, PendingVector* to_cancel) {
+  int32 epoch = channel_->epoch();
+  bool serving = (channel_->server_pid() != 0);
+  for (WaiterMap::iterator iter = waiting_.begin(); iter != waiting_.end();) {
+    int slot = iter->first;
+    Waiter* waiter = &iter->second;
+    Transaction* transaction = waiter->pending->transaction();
+    if (!serving || transaction->epoch() != epoch) {
+      // The server reset the slot, or will when it restarts.
+      transaction->Disarm();
+      to_cancel->push_back(waiter->pending);
+    } else {
+      SlotState state = channel_->state(slot);
+      if (state == SharedMemControllerChannel::kGranted) {
+        to_run->push_back(waiter->pending);
+      } else if (state == SharedMemControllerChannel::kDenied) {
+        channel_->FreeSlot(slot);
+        transaction->Disarm();
+        to_cancel->push_back(waiter->pending);
+      } else {
+        ++iter;
+        continue;
+      }
+    }
+    waiting_.erase(iter++);
+  }
+}
+
+void SharedMemCentralController::Core::WithdrawOverdue(
+    int64 now_ms, PendingVector* to_fall_back) {
+  for (WaiterMap::iterator iter = waiting_.begin(); iter != waiting_.end();) {
+    int slot = iter->first;
+    Waiter* waiter = &iter->second;
+    // Once the server has the request it will decide on it, however long
+    // its controller takes. If we do abandon it, the server frees the slot.
+    if (now_ms - waiter->submitted_ms >= kPickUpTimeoutMs &&
+        !channel_->Consumed(slot) &&
+        channel_->CompareAndSwapState(slot, waiter->request,
+                                      SharedMemControllerChannel::kAbandoned)) {
+      waiter->pending->transaction()->Disarm();
+      to_fall_back->push_back(waiter->pending);
+      waiting_.erase(iter++);
+    } else {
+      ++iter;
+    }
+  }
+}
+
+void SharedMemCentralController::Core::CheckServerAlive(
+    PendingVector* to_cancel) {
+  int32 server_pid = channel_->server_pid();
+  if (server_pid == 0 ||
+      SharedMemControllerChannel::ProcessAlive(server_pid)) {
+    // If it stopped serving cleanly, CollectDecisions deals with it.
+    return;
+  }
+  ScopedMutex lock(mutex_.get());
+  if (dead_server_pid_ != server_pid) {
+    handler_->Message(kWarning, "Central controller process %d has exited, "
+                      "cancelling %d operations", static_cast<int>(server_pid),
+                      static_cast<int>(waiting_.size()));
+    dead_server_pid_ = server_pid;
+  }
+  for (WaiterMap::iterator iter = waiting_.begin(); iter != waiting_.end();
+       ++iter) {
+    iter->second.pending->transaction()->Disarm();
+    to_cancel->push_back(iter->second.pending);
+  }
+  waiting_.clear();
+}
+
+void SharedMemCentralController::Core::ShutDown() {
+  PendingVector to_cancel;
+  std::unique_ptr<WatcherThread> watcher;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (shut_down_) {
+      return;
+    }
+    shut_down_ = true;
+    int32 epoch = channel_->epoch();
+    bool serving = (channel_->server_pid() != 0);
+    for (WaiterMap::iterator iter = waiting_.begin(); iter != waiting_.end();
+         ++iter) {
+      int slot = iter->first;
+      Waiter* waiter = &iter->second;
+      Transaction* transaction = waiter->pending->transaction();
+      if (serving && transaction->epoch() == epoch &&
+          !channel_->CompareAndSwapState(
+              slot, waiter->request, SharedMemControllerChannel::kAbandoned)) {
+        // Too late to abandon it: the server has already decided, so hand
+        // back what it gave us. If we did abandon it, the server frees the
+        // slot.
+        SlotState state = channel_->state(slot);
+        if (state == SharedMemControllerChannel::kGranted) {
+          SlotState outcome =
+              (waiter->request == SharedMemControllerChannel::kScheduleRewrite)
+                  ? SharedMemControllerChannel::kRewriteFailed
+                  : SharedMemControllerChannel::kExpensiveOperationDone;
+          channel_->Submit(slot, outcome);
+        } else if (state == SharedMemControllerChannel::kDenied) {
+          channel_->FreeSlot(slot);
+        }
+      }
+      transaction->Disarm();
+      to_cancel.push_back(waiter->pending);
+    }
+    waiting_.clear();
+    waiting_nonempty_->Signal();
+    watcher.swap(watcher_);
+  }
+  if (watcher != nullptr) {
+    // It may be asleep in WaitForDecisions.
+    channel_->WakeClients();
+    watcher->Join();
+  }
+  for (int i = 0, n = to_cancel.size(); i < n; ++i) {
+    to_cancel[i]->Deny();
+    delete to_cancel[i];
+  }
+}
+
+SharedMemCentralController::SharedMemCentralController(
+    SharedMemControllerChannel* channel, CentralController* fallback,
+    ThreadSystem* thread_system, MessageHandler* handler)
+    : core_(new Core(channel, fallback, thread_system, handler)),
+      fallback_(fallback) {
+}
+
+SharedMemCentralController::~SharedMemCentralController() {
+  ShutDown();
+}
+
+void SharedMemCentralController::ScheduleExpensiveOperation(
+    ExpensiveOperationCallback* callback) {
+  std::unique_ptr<ExpensiveOperationContextImpl> context(
+      new ExpensiveOperationContextImpl);
+  const ExpensiveOperationCost& cost = callback->cost();
+  if (!core_->Claim(cost.kind, &cost, context->transaction())) {
+    fallback_->ScheduleExpensiveOperation(callback);
+    return;
+  }
+  core_->Submit(SharedMemControllerChannel::kScheduleExpensiveOperation,
+                new Pending<ExpensiveOperationCallback,
+                            ExpensiveOperationContextImpl>(
+                    callback, context.release()));
+}
+
+void SharedMemCentralController::ScheduleRewrite(
+    ScheduleRewriteCallback* callback) {
+  std::unique_ptr<ScheduleRewriteContextImpl> context(
+      new ScheduleRewriteContextImpl);
+  if (!core_->Claim(callback->key(), NULL, context->transaction())) {
+    fallback_->ScheduleRewrite(callback);
+    return;
+  }
+  core_->Submit(SharedMemControllerChannel::kScheduleRewrite,
+                new Pending<ScheduleRewriteCallback,
+                            ScheduleRewriteContextImpl>(
+                    callback, context.release()));
+}
+
+void SharedMemCentralController::ShutDown() {
+  core_->ShutDown();
+  fallback_->ShutDown();
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,85 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_CONTROLLER_SHARED_MEM_CENTRAL_CONTROLLER_H_
+#define PAGESPEED_CONTROLLER_SHARED_MEM_CENTRAL_CONTROLLER_H_
+
+#include <memory>
+
+#include "pagespeed/controller/central_controller.h"
+#include "pagespeed/controller/expensive_operation_callback.h"
+#include "pagespeed/controller/schedule_rewrite_callback.h"
+#include "pagespeed/controller/shared_mem_controller_channel.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
+#include "pagespeed/kernel/base/thread_system.h"
+
+namespace net_instaweb {
+
+// CentralController implementation for workers on the same host as the
+// controller process, which talks to a SharedMemControllerServer through a
+// SharedMemControllerChannel instead of going over gRPC. Decisions are picked
+// up by a watcher thread, started on first use, which sleeps on the channel
+// while there is nothing to do.
+//
+// Anything that can't be carried over shared memory goes to fallback
+// instead: keys that are too long, requests made when every slot is in use,
+// and everything while the controller isn't serving the channel (eg, it
+// hasn't started yet or has died). Requests that the controller hasn't
+// picked up within kPickUpTimeoutMs are withdrawn and sent to fallback too.
+// Requests that are waiting for a decision when the controller goes away are
+// cancelled.
+
+class SharedMemCentralController : public CentralController {
+ public:
+  static const int64 kPickUpTimeoutMs = 500;
+
+  // Takes ownership of channel, which must already be initialized, and of
+  // fallback.
+  SharedMemCentralController(SharedMemControllerChannel* channel,
+                             CentralController* fallback,
+                             ThreadSystem* thread_system,
+                             MessageHandler* handler);
+  ~SharedMemCentralController() override;
+
+  // CentralController implementation.
+  void ScheduleExpensiveOperation(
+      ExpensiveOperationCallback* callback) override;
+  void ScheduleRewrite(ScheduleRewriteCallback* callback) override;
+  void ShutDown() override;
+
+ private:
+  class Core;
+  class PendingRequest;
+  template <typename CallbackType, typename ContextType> class Pending;
+  class Transaction;
+  class ExpensiveOperationContextImpl;
+  class ScheduleRewriteContextImpl;
+
+  RefCountedPtr<Core> core_;
+  std::unique_ptr<CentralController> fallback_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedMemCentralController);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_CONTROLLER_SHARED_MEM_CENTRAL_CONTROLLER_H_
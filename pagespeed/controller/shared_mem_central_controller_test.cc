@@ -0,0 +1,613 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/controller/shared_mem_central_controller.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <memory>
+#include <vector>
+
+#include "pagespeed/controller/expensive_operation_callback.h"
+#include "pagespeed/controller/expensive_operation_controller.h"
+#include "pagespeed/controller/expensive_operation_cost.h"
+#include "pagespeed/controller/schedule_rewrite_callback.h"
+#include "pagespeed/controller/schedule_rewrite_controller.h"
+#include "pagespeed/controller/shared_mem_controller_channel.h"
+#include "pagespeed/controller/shared_mem_controller_server.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/google_message_handler.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/sharedmem/inprocess_shared_mem.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/thread/worker_test_base.h"
+#include "pagespeed/kernel/util/platform.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kSegmentName[] = "controller";
+const char kDeniedKey[] = "denied";
+
+// Both controllers in one. Grants everything except kDeniedKey, unless asked
+// to hold on to callbacks, and records releases.
+class FakeController : public ExpensiveOperationController,
+                       public ScheduleRewriteController {
+ public:
+  explicit FakeController(ThreadSystem* thread_system)
+      : mutex_(thread_system->NewMutex()),
+        hold_(false),
+        held_sync_(nullptr),
+        expected_releases_(0),
+        release_sync_(nullptr),
+        cpu_us_(0) {}
+
+  void ScheduleExpensiveOperation(Function* callback) override {
+    if (!MaybeHold(callback)) {
+      callback->CallRun();
+    }
+  }
+
+  void ScheduleExpensiveOperation(const ExpensiveOperationCost& cost,
+                                  Function* callback) override {
+    {
+      ScopedMutex lock(mutex_.get());
+      scheduled_cost_ = cost;
+    }
+    ScheduleExpensiveOperation(callback);
+  }
+
+  void NotifyExpensiveOperationComplete() override { Record("done"); }
+
+  void NotifyExpensiveOperationComplete(const ExpensiveOperationCost& cost,
+                                        int64 cpu_us) override {
+    {
+      ScopedMutex lock(mutex_.get());
+      completed_cost_ = cost;
+      cpu_us_ = cpu_us;
+    }
+    NotifyExpensiveOperationComplete();
+  }
+
+  void ScheduleRewrite(const GoogleString& key, Function* callback) override {
+    if (!MaybeHold(callback)) {
+      if (key == kDeniedKey) {
+        callback->CallCancel();
+      } else {
+        callback->CallRun();
+      }
+    }
+  }
+
+  void NotifyRewriteComplete(const GoogleString& key) override {
+    Record(StrCat("succeeded:", key));
+  }
+
+  void NotifyRewriteFailed(const GoogleString& key) override {
+    Record(StrCat("failed:", key));
+  }
+
+  // Keep callbacks, notifying sync when one arrives, until RunHeld.
+  void Hold(WorkerTestBase::SyncPoint* sync) {
+    ScopedMutex lock(mutex_.get());
+    hold_ = true;
+    held_sync_ = sync;
+  }
+
+  void RunHeld() {
+    std::vector<Function*> held;
+    {
+      ScopedMutex lock(mutex_.get());
+      held.swap(held_);
+      hold_ = false;
+    }
+    for (int i = 0, n = held.size(); i < n; ++i) {
+      held[i]->CallRun();
+    }
+  }
+
+  // sync is notified once there have been count releases in total.
+  void ExpectReleases(int count, WorkerTestBase::SyncPoint* sync) {
+    ScopedMutex lock(mutex_.get());
+    if (static_cast<int>(releases_.size()) >= count) {
+      sync->Notify();
+    } else {
+      expected_releases_ = count;
+      release_sync_ = sync;
+    }
+  }
+
+  GoogleString releases() {
+    ScopedMutex lock(mutex_.get());
+    return JoinCollection(releases_, ",");
+  }
+
+  // What the last expensive operation was scheduled and completed with.
+  GoogleString last_cost() {
+    ScopedMutex lock(mutex_.get());
+    return StrCat(scheduled_cost_.kind, "/",
+                  Integer64ToString(scheduled_cost_.input_bytes), "/",
+                  Integer64ToString(scheduled_cost_.pixels), " ",
+                  StrCat(completed_cost_.kind, "/",
+                         Integer64ToString(completed_cost_.input_bytes), "/",
+                         Integer64ToString(completed_cost_.pixels), " ",
+                         Integer64ToString(cpu_us_)));
+  }
+
+ private:
+  bool MaybeHold(Function* callback) {
+    ScopedMutex lock(mutex_.get());
+    if (!hold_) {
+      return false;
+    }
+    held_.push_back(callback);
+    if (held_sync_ != nullptr) {
+      held_sync_->Notify();
+      held_sync_ = nullptr;
+    }
+    return true;
+  }
+
+  void Record(const GoogleString& release) {
+    ScopedMutex lock(mutex_.get());
+    releases_.push_back(release);
+    if (release_sync_ != nullptr &&
+        static_cast<int>(releases_.size()) >= expected_releases_) {
+      release_sync_->Notify();
+      release_sync_ = nullptr;
+    }
+  }
+
+  std::unique_ptr<AbstractMutex> mutex_;
+  bool hold_;
+  WorkerTestBase::SyncPoint* held_sync_;
+  int expected_releases_;
+  WorkerTestBase::SyncPoint* release_sync_;
+  std::vector<Function*> held_;
+  StringVector releases_;
+  ExpensiveOperationCost scheduled_cost_;
+  ExpensiveOperationCost completed_cost_;
+  int64 cpu_us_;
+};
+
+// Records what's sent to it and denies it.
+class FakeFallback : public CentralController {
+ public:
+  FakeFallback() : expensive_operations_(0), shut_down_(false) {}
+
+  void ScheduleExpensiveOperation(
+      ExpensiveOperationCallback* callback) override {
+    ++expensive_operations_;
+    callback->CallCancel();
+  }
+
+  void ScheduleRewrite(ScheduleRewriteCallback* callback) override {
+    rewrites_.push_back(callback->key());
+    callback->CallCancel();
+  }
+
+  void ShutDown() override { shut_down_ = true; }
+
+  int expensive_operations() const { return expensive_operations_; }
+  const StringVector& rewrites() const { return rewrites_; }
+  bool shut_down() const { return shut_down_; }
+
+ private:
+  int expensive_operations_;
+  StringVector rewrites_;
+  bool shut_down_;
+};
+
+struct Result {
+  explicit Result(ThreadSystem* thread_system)
+      : sync(thread_system), ran(false), cancelled(false) {}
+
+  WorkerTestBase::SyncPoint sync;
+  bool ran;
+  bool cancelled;
+  scoped_ptr<ScheduleRewriteContext> rewrite_context;
+  scoped_ptr<ExpensiveOperationContext> expensive_context;
+};
+
+class TestRewriteCallback : public ScheduleRewriteCallback {
+ public:
+  TestRewriteCallback(const GoogleString& key, Sequence* sequence,
+                      Result* result)
+      : ScheduleRewriteCallback(key, sequence), result_(result) {}
+
+ private:
+  void RunImpl(scoped_ptr<ScheduleRewriteContext>* context) override {
+    result_->ran = true;
+    result_->rewrite_context.reset(context->release());
+    result_->sync.Notify();
+  }
+
+  void CancelImpl() override {
+    result_->cancelled = true;
+    result_->sync.Notify();
+  }
+
+  Result* result_;
+};
+
+class TestExpensiveOperationCallback : public ExpensiveOperationCallback {
+ public:
+  TestExpensiveOperationCallback(Sequence* sequence, Result* result)
+      : ExpensiveOperationCallback(sequence), result_(result) {}
+
+ private:
+  void RunImpl(scoped_ptr<ExpensiveOperationContext>* context) override {
+    result_->ran = true;
+    result_->expensive_context.reset(context->release());
+    result_->sync.Notify();
+  }
+
+  void CancelImpl() override {
+    result_->cancelled = true;
+    result_->sync.Notify();
+  }
+
+  Result* result_;
+};
+
+}  // namespace
+
+class SharedMemCentralControllerTest : public testing::Test {
+ protected:
+  SharedMemCentralControllerTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(Platform::CreateTimer()),
+        shm_runtime_(thread_system_.get()),
+        worker_(1, "shared_mem_central_controller_test",
+                thread_system_.get()),
+        sequence_(worker_.NewSequence()),
+        fake_controller_(thread_system_.get()),
+        fallback_(new FakeFallback) {
+    root_channel_.reset(
+        new SharedMemControllerChannel(&shm_runtime_, kSegmentName));
+    CHECK(root_channel_->InitSegment(true, &handler_));
+    server_.reset(new SharedMemControllerServer(
+        AttachChannel(), thread_system_.get(), timer_.get(), &handler_));
+    client_.reset(new SharedMemCentralController(
+        AttachChannel(), fallback_, thread_system_.get(), &handler_));
+  }
+
+  ~SharedMemCentralControllerTest() override {
+    client_->ShutDown();
+    server_->Stop();
+    worker_.FreeSequence(sequence_);
+    client_.reset();
+    server_.clear();
+    root_channel_->GlobalCleanup(&handler_);
+  }
+
+  SharedMemControllerChannel* AttachChannel() {
+    SharedMemControllerChannel* channel =
+        new SharedMemControllerChannel(&shm_runtime_, kSegmentName);
+    CHECK(channel->InitSegment(false, &handler_));
+    return channel;
+  }
+
+  void StartServer() {
+    ASSERT_TRUE(server_->Start(&fake_controller_, &fake_controller_));
+  }
+
+  void ScheduleExpensiveOperation(const ExpensiveOperationCost& cost,
+                                  Result* result) {
+    ExpensiveOperationCallback* callback =
+        new TestExpensiveOperationCallback(sequence_, result);
+    callback->set_cost(cost);
+    client_->ScheduleExpensiveOperation(callback);
+  }
+
+  void ScheduleRewrite(const GoogleString& key, Result* result) {
+    client_->ScheduleRewrite(
+        new TestRewriteCallback(key, sequence_, result));
+  }
+
+  // Takes a place on the ring without filling it in, as a client that dies
+  // halfway through submitting a request would.
+  void AbandonRingPosition() {
+    root_channel_->ReserveRingPosition();
+  }
+
+  int BusySlots() {
+    int busy = 0;
+    for (int i = 0; i < SharedMemControllerChannel::kNumSlots; ++i) {
+      if (root_channel_->state(i) != SharedMemControllerChannel::kFree) {
+        ++busy;
+      }
+    }
+    return busy;
+  }
+
+  // Returns the pid of a process that has exited.
+  int32 DeadPid() {
+    pid_t pid = fork();
+    CHECK_GE(pid, 0);
+    if (pid == 0) {
+      _exit(0);
+    }
+    CHECK_EQ(pid, waitpid(pid, NULL, 0));
+    return pid;
+  }
+
+  std::unique_ptr<ThreadSystem> thread_system_;
+  std::unique_ptr<Timer> timer_;
+  GoogleMessageHandler handler_;
+  InProcessSharedMem shm_runtime_;
+  QueuedWorkerPool worker_;
+  QueuedWorkerPool::Sequence* sequence_;
+  FakeController fake_controller_;
+  FakeFallback* fallback_;  // Owned by client_.
+  std::unique_ptr<SharedMemControllerChannel> root_channel_;
+  RefCountedPtr<SharedMemControllerServer> server_;
+  std::unique_ptr<SharedMemCentralController> client_;
+};
+
+TEST_F(SharedMemCentralControllerTest, GrantedRewriteSucceeds) {
+  StartServer();
+  Result result(thread_system_.get());
+  ScheduleRewrite("key", &result);
+  result.sync.Wait();
+  EXPECT_TRUE(result.ran);
+  EXPECT_EQ(1, BusySlots());
+
+  WorkerTestBase::SyncPoint released(thread_system_.get());
+  fake_controller_.ExpectReleases(1, &released);
+  result.rewrite_context.reset();  // Implicitly succeeds.
+  released.Wait();
+  EXPECT_EQ("succeeded:key", fake_controller_.releases());
+  EXPECT_EQ(0, BusySlots());
+  EXPECT_TRUE(fallback_->rewrites().empty());
+}
+
+TEST_F(SharedMemCentralControllerTest, GrantedRewriteFails) {
+  StartServer();
+  Result result(thread_system_.get());
+  ScheduleRewrite("key", &result);
+  result.sync.Wait();
+  ASSERT_TRUE(result.ran);
+
+  WorkerTestBase::SyncPoint released(thread_system_.get());
+  fake_controller_.ExpectReleases(1, &released);
+  result.rewrite_context->MarkFailed();
+  released.Wait();
+  EXPECT_EQ("failed:key", fake_controller_.releases());
+  // Further calls are ignored.
+  result.rewrite_context->MarkSucceeded();
+  result.rewrite_context.reset();
+  EXPECT_EQ("failed:key", fake_controller_.releases());
+}
+
+TEST_F(SharedMemCentralControllerTest, DeniedRewriteIsCancelled) {
+  StartServer();
+  Result result(thread_system_.get());
+  ScheduleRewrite(kDeniedKey, &result);
+  result.sync.Wait();
+  EXPECT_TRUE(result.cancelled);
+  EXPECT_FALSE(result.ran);
+  EXPECT_EQ(0, BusySlots());
+  EXPECT_EQ("", fake_controller_.releases());
+}
+
+TEST_F(SharedMemCentralControllerTest, ExpensiveOperation) {
+  StartServer();
+  Result result(thread_system_.get());
+  client_->ScheduleExpensiveOperation(
+      new TestExpensiveOperationCallback(sequence_, &result));
+  result.sync.Wait();
+  ASSERT_TRUE(result.ran);
+
+  WorkerTestBase::SyncPoint released(thread_system_.get());
+  fake_controller_.ExpectReleases(1, &released);
+  result.expensive_context->Done();
+  released.Wait();
+  EXPECT_EQ("done", fake_controller_.releases());
+  EXPECT_EQ(0, BusySlots());
+  EXPECT_EQ(0, fallback_->expensive_operations());
+}
+
+TEST_F(SharedMemCentralControllerTest, ExpensiveOperationCarriesCost) {
+  StartServer();
+  Result result(thread_system_.get());
+  ScheduleExpensiveOperation(ExpensiveOperationCost("ic:jpeg", 1234, 5678),
+                             &result);
+  result.sync.Wait();
+  ASSERT_TRUE(result.ran);
+
+  WorkerTestBase::SyncPoint released(thread_system_.get());
+  fake_controller_.ExpectReleases(1, &released);
+  result.expensive_context->ReportCpuUsage(910);
+  result.expensive_context->Done();
+  released.Wait();
+  EXPECT_EQ("ic:jpeg/1234/5678 ic:jpeg/1234/5678 910",
+            fake_controller_.last_cost());
+}
+
+TEST_F(SharedMemCentralControllerTest, ManyConcurrentRewrites) {
+  StartServer();
+  const int kNumRewrites = 100;
+  std::vector<Result*> results;
+  for (int i = 0; i < kNumRewrites; ++i) {
+    results.push_back(new Result(thread_system_.get()));
+    ScheduleRewrite(IntegerToString(i), results.back());
+  }
+  for (int i = 0; i < kNumRewrites; ++i) {
+    results[i]->sync.Wait();
+    EXPECT_TRUE(results[i]->ran);
+  }
+  EXPECT_EQ(kNumRewrites, BusySlots());
+
+  WorkerTestBase::SyncPoint released(thread_system_.get());
+  fake_controller_.ExpectReleases(kNumRewrites, &released);
+  for (int i = 0; i < kNumRewrites; ++i) {
+    delete results[i];
+  }
+  released.Wait();
+  EXPECT_EQ(0, BusySlots());
+}
+
+TEST_F(SharedMemCentralControllerTest, FallsBackWhenNotServing) {
+  Result result(thread_system_.get());
+  ScheduleRewrite("key", &result);
+  result.sync.Wait();
+  EXPECT_TRUE(result.cancelled);
+  ASSERT_EQ(1, fallback_->rewrites().size());
+  EXPECT_EQ("key", fallback_->rewrites()[0]);
+  EXPECT_EQ(0, BusySlots());
+}
+
+TEST_F(SharedMemCentralControllerTest, FallsBackForLongKeys) {
+  StartServer();
+  GoogleString key(SharedMemControllerChannel::kMaxKeySize + 1, 'x');
+  Result result(thread_system_.get());
+  ScheduleRewrite(key, &result);
+  result.sync.Wait();
+  ASSERT_EQ(1, fallback_->rewrites().size());
+  EXPECT_EQ(key, fallback_->rewrites()[0]);
+}
+
+TEST_F(SharedMemCentralControllerTest, ShutDownAbandonsWaitingRequests) {
+  StartServer();
+  WorkerTestBase::SyncPoint held(thread_system_.get());
+  fake_controller_.Hold(&held);
+  Result result(thread_system_.get());
+  ScheduleRewrite("key", &result);
+  held.Wait();
+
+  client_->ShutDown();
+  result.sync.Wait();
+  EXPECT_TRUE(result.cancelled);
+  EXPECT_TRUE(fallback_->shut_down());
+
+  // When the controller gets around to granting it, it's handed straight
+  // back.
+  WorkerTestBase::SyncPoint released(thread_system_.get());
+  fake_controller_.ExpectReleases(1, &released);
+  fake_controller_.RunHeld();
+  released.Wait();
+  EXPECT_EQ("failed:key", fake_controller_.releases());
+  EXPECT_EQ(0, BusySlots());
+
+  // New requests are rejected.
+  Result after_shutdown(thread_system_.get());
+  ScheduleRewrite("other", &after_shutdown);
+  after_shutdown.sync.Wait();
+  EXPECT_TRUE(after_shutdown.cancelled);
+}
+
+TEST_F(SharedMemCentralControllerTest, ServerStopCancelsWaitingRequests) {
+  StartServer();
+  WorkerTestBase::SyncPoint held(thread_system_.get());
+  fake_controller_.Hold(&held);
+  Result result(thread_system_.get());
+  ScheduleRewrite("key", &result);
+  held.Wait();
+
+  server_->Stop();
+  result.sync.Wait();
+  EXPECT_TRUE(result.cancelled);
+
+  WorkerTestBase::SyncPoint released(thread_system_.get());
+  fake_controller_.ExpectReleases(1, &released);
+  fake_controller_.RunHeld();
+  released.Wait();
+  EXPECT_EQ("failed:key", fake_controller_.releases());
+
+  // With nobody serving the channel, requests go to the fallback.
+  Result after_stop(thread_system_.get());
+  ScheduleRewrite("other", &after_stop);
+  after_stop.sync.Wait();
+  ASSERT_EQ(1, fallback_->rewrites().size());
+  EXPECT_EQ("other", fallback_->rewrites()[0]);
+}
+
+TEST_F(SharedMemCentralControllerTest, CancelsWhenControllerExits) {
+  // Pretend a controller started serving and then crashed.
+  root_channel_->StartServing(DeadPid());
+  Result result(thread_system_.get());
+  ScheduleRewrite("key", &result);
+  result.sync.Wait();
+  EXPECT_TRUE(result.cancelled);
+  EXPECT_TRUE(fallback_->rewrites().empty());
+
+  // Now we know it's gone, we don't try again.
+  Result retry(thread_system_.get());
+  ScheduleRewrite("key", &retry);
+  retry.sync.Wait();
+  ASSERT_EQ(1, fallback_->rewrites().size());
+}
+
+TEST_F(SharedMemCentralControllerTest, ReapsOperationsOfExitedClients) {
+  StartServer();
+  // Submit a request on behalf of a worker that then exits without
+  // completing it.
+  WorkerTestBase::SyncPoint released(thread_system_.get());
+  fake_controller_.ExpectReleases(1, &released);
+  int slot = root_channel_->ClaimSlot();
+  ASSERT_NE(SharedMemControllerChannel::kNoSlot, slot);
+  root_channel_->FillSlot(slot, DeadPid(), root_channel_->epoch(), "key");
+  root_channel_->Submit(slot, SharedMemControllerChannel::kScheduleRewrite);
+  released.Wait();
+  EXPECT_EQ("failed:key", fake_controller_.releases());
+  EXPECT_EQ(0, BusySlots());
+}
+
+TEST_F(SharedMemCentralControllerTest, SkipsPlaceOfClientThatDied) {
+  StartServer();
+  AbandonRingPosition();
+  Result result(thread_system_.get());
+  ScheduleRewrite("key", &result);
+  result.sync.Wait();
+  EXPECT_TRUE(result.ran);
+  EXPECT_TRUE(fallback_->rewrites().empty());
+
+  // The ring still works afterwards.
+  Result next(thread_system_.get());
+  ScheduleRewrite("next", &next);
+  next.sync.Wait();
+  EXPECT_TRUE(next.ran);
+}
+
+TEST_F(SharedMemCentralControllerTest, FallsBackWhenNotPickedUp) {
+  // A live controller that never gets to the ring.
+  root_channel_->StartServing(getpid());
+  int64 start_ms = timer_->NowMs();
+  Result result(thread_system_.get());
+  ScheduleRewrite("key", &result);
+  result.sync.Wait();
+  EXPECT_LE(SharedMemCentralController::kPickUpTimeoutMs,
+            timer_->NowMs() - start_ms);
+  EXPECT_TRUE(result.cancelled);
+  ASSERT_EQ(1, fallback_->rewrites().size());
+  EXPECT_EQ("key", fallback_->rewrites()[0]);
+  // Left for the server to free when it gets to it.
+  EXPECT_EQ(1, BusySlots());
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,393 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/controller/shared_mem_controller_channel.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <cstring>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_shared_mem.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/sharedmem/shared_mem_futex.h"
+
+namespace net_instaweb {
+
+using base::subtle::Acquire_CompareAndSwap;
+using base::subtle::Acquire_Load;
+using base::subtle::Atomic32;
+using base::subtle::Barrier_AtomicIncrement;
+using base::subtle::MemoryBarrier;
+using base::subtle::NoBarrier_Load;
+using base::subtle::NoBarrier_Store;
+using base::subtle::Release_Store;
+
+namespace {
+
+const int kSlotMask = SharedMemControllerChannel::kNumSlots - 1;
+
+// Ring entries hold a slot number plus one in their low bits and, above
+// them, the lap of the ring they were written for. An entry written after the
+// server skipped its place so can't be mistaken for a later one.
+const int kEntrySlotBits = 12;
+const uint32 kEntrySlotMask = (1 << kEntrySlotBits) - 1;
+
+uint32 EntryLap(Atomic32 position) {
+  return (static_cast<uint32>(position) /
+          SharedMemControllerChannel::kNumSlots) << kEntrySlotBits;
+}
+
+Atomic32 MakeEntry(Atomic32 position, int index) {
+  return static_cast<Atomic32>(EntryLap(position) | (index + 1));
+}
+
+bool IsEntryFor(Atomic32 entry, Atomic32 position) {
+  uint32 value = static_cast<uint32>(entry);
+  return ((value & kEntrySlotMask) != 0) &&
+         ((value & ~kEntrySlotMask) == EntryLap(position));
+}
+
+int EntrySlot(Atomic32 entry) {
+  return static_cast<int>(static_cast<uint32>(entry) & kEntrySlotMask) - 1;
+}
+
+}  // namespace
+
+const int SharedMemControllerChannel::kNumSlots;
+const int SharedMemControllerChannel::kMaxKeySize;
+const int SharedMemControllerChannel::kNoSlot;
+
+struct SharedMemControllerChannel::Header {
+  Atomic32 server_pid;
+  Atomic32 epoch;
+  // Producers (clients) reserve ring positions by incrementing request_tail;
+  // the single consumer (the server thread) owns request_head.
+  Atomic32 request_tail;
+  Atomic32 request_head;
+  Atomic32 request_sequence;
+  Atomic32 server_sleeping;
+  Atomic32 decision_sequence;
+  Atomic32 client_sleepers;
+};
+
+struct SharedMemControllerChannel::Slot {
+  Atomic32 state;
+  Atomic32 owner_pid;
+  Atomic32 epoch;
+  // Where on the ring the slot was last submitted. Written before state.
+  Atomic32 position;
+  int32 key_size;
+  // Only for expensive operations. Like the key, written by the client
+  // before it submits the slot, so the Release_Store of state publishes them.
+  int64 input_bytes;
+  int64 pixels;
+  int64 cpu_us;
+  char key[kMaxKeySize];
+};
+
+SharedMemControllerChannel::SharedMemControllerChannel(
+    AbstractSharedMem* shm_runtime, const GoogleString& segment_name)
+    : shm_runtime_(shm_runtime),
+      segment_name_(segment_name),
+      header_(NULL),
+      ring_(NULL),
+      slots_(NULL),
+      next_slot_hint_(0) {
+  COMPILE_ASSERT((kNumSlots & kSlotMask) == 0, num_slots_must_be_power_of_2);
+  COMPILE_ASSERT(kNumSlots < (1 << kEntrySlotBits), num_slots_too_large);
+}
+
+SharedMemControllerChannel::~SharedMemControllerChannel() {
+}
+
+size_t SharedMemControllerChannel::SegmentSize() {
+  return sizeof(Header) + kNumSlots * sizeof(Atomic32) +
+         kNumSlots * sizeof(Slot);
+}
+
+bool SharedMemControllerChannel::InitSegment(bool parent,
+                                             MessageHandler* handler) {
+  if (parent) {
+    segment_.reset(
+        shm_runtime_->CreateSegment(segment_name_, SegmentSize(), handler));
+  } else {
+    segment_.reset(
+        shm_runtime_->AttachToSegment(segment_name_, SegmentSize(), handler));
+  }
+  if (segment_.get() == NULL) {
+    handler->Message(kWarning,
+                     "Unable to %s shared memory segment %s for the "
+                     "central controller", parent ? "create" : "attach to",
+                     segment_name_.c_str());
+    return false;
+  }
+  char* base = const_cast<char*>(segment_->Base());
+  if (parent) {
+    memset(base, 0, SegmentSize());
+  }
+  header_ = reinterpret_cast<Header*>(base);
+  ring_ = reinterpret_cast<volatile Atomic32*>(base + sizeof(Header));
+  slots_ = base + sizeof(Header) + kNumSlots * sizeof(Atomic32);
+  return true;
+}
+
+void SharedMemControllerChannel::GlobalCleanup(MessageHandler* handler) {
+  if (segment_.get() != NULL) {
+    shm_runtime_->DestroySegment(segment_name_, handler);
+  }
+}
+
+SharedMemControllerChannel::Slot* SharedMemControllerChannel::slot(
+    int index) {
+  DCHECK_GE(index, 0);
+  DCHECK_LT(index, kNumSlots);
+  return reinterpret_cast<Slot*>(slots_ + index * sizeof(Slot));
+}
+
+void SharedMemControllerChannel::StartServing(int32 pid) {
+  // Clients that are in the middle of something while we do this will notice
+  // the epoch change and give up on their operations.
+  for (int i = 0; i < kNumSlots; ++i) {
+    Slot* s = slot(i);
+    NoBarrier_Store(&s->owner_pid, 0);
+    NoBarrier_Store(&s->position, 0);
+    NoBarrier_Store(&s->state, kFree);
+    NoBarrier_Store(&ring_[i], 0);
+  }
+  NoBarrier_Store(&header_->request_head, 0);
+  NoBarrier_Store(&header_->request_tail, 0);
+  Barrier_AtomicIncrement(&header_->epoch, 1);
+  Release_Store(&header_->server_pid, pid);
+  WakeClients();
+}
+
+void SharedMemControllerChannel::StopServing() {
+  Release_Store(&header_->server_pid, 0);
+  WakeClients();
+}
+
+int SharedMemControllerChannel::PopRequest() {
+  Atomic32 head = NoBarrier_Load(&header_->request_head);
+  volatile Atomic32* entry = &ring_[head & kSlotMask];
+  Atomic32 value = Acquire_Load(entry);
+  if (!IsEntryFor(value, head)) {
+    // Either the ring is empty, or the client that reserved this position
+    // hasn't written it yet. It will bump request_sequence once it has, or
+    // the server will skip it if it never does.
+    return kNoSlot;
+  }
+  NoBarrier_Store(entry, 0);
+  Release_Store(&header_->request_head, head + 1);
+  return EntrySlot(value);
+}
+
+bool SharedMemControllerChannel::RequestStalled(int32* position) {
+  Atomic32 head = NoBarrier_Load(&header_->request_head);
+  if (Acquire_Load(&header_->request_tail) == head ||
+      IsEntryFor(Acquire_Load(&ring_[head & kSlotMask]), head)) {
+    return false;
+  }
+  *position = head;
+  return true;
+}
+
+void SharedMemControllerChannel::SkipRequest(int32 position) {
+  DCHECK_EQ(position, NoBarrier_Load(&header_->request_head));
+  Release_Store(&header_->request_head, position + 1);
+}
+
+void SharedMemControllerChannel::WaitForRequests(int32 seen,
+                                                 int64 timeout_ms) {
+  // Pairs with the barrier in Submit: either the client sees that we are
+  // asleep and wakes us, or we see its sequence bump and don't sleep.
+  Release_Store(&header_->server_sleeping, 1);
+  MemoryBarrier();
+  if (Acquire_Load(&header_->request_sequence) == seen) {
+    SharedMemFutex::Wait(&header_->request_sequence, seen, timeout_ms);
+  }
+  Release_Store(&header_->server_sleeping, 0);
+}
+
+int32 SharedMemControllerChannel::request_sequence() {
+  return Acquire_Load(&header_->request_sequence);
+}
+
+void SharedMemControllerChannel::WakeServer() {
+  Barrier_AtomicIncrement(&header_->request_sequence, 1);
+  SharedMemFutex::WakeAll(&header_->request_sequence);
+}
+
+bool SharedMemControllerChannel::PublishDecision(int index,
+                                                 SlotState expected,
+                                                 SlotState decision) {
+  if (!CompareAndSwapState(index, expected, decision)) {
+    return false;
+  }
+  Barrier_AtomicIncrement(&header_->decision_sequence, 1);
+  if (Acquire_Load(&header_->client_sleepers) > 0) {
+    SharedMemFutex::WakeAll(&header_->decision_sequence);
+  }
+  return true;
+}
+
+void SharedMemControllerChannel::WakeClients() {
+  Barrier_AtomicIncrement(&header_->decision_sequence, 1);
+  SharedMemFutex::WakeAll(&header_->decision_sequence);
+}
+
+int32 SharedMemControllerChannel::server_pid() {
+  return Acquire_Load(&header_->server_pid);
+}
+
+int32 SharedMemControllerChannel::epoch() {
+  return Acquire_Load(&header_->epoch);
+}
+
+int SharedMemControllerChannel::ClaimSlot() {
+  int hint = NoBarrier_Load(&next_slot_hint_);
+  for (int i = 0; i < kNumSlots; ++i) {
+    int index = (hint + i) & kSlotMask;
+    Slot* s = slot(index);
+    if (NoBarrier_Load(&s->state) == kFree &&
+        Acquire_CompareAndSwap(&s->state, kFree, kClaimed) == kFree) {
+      NoBarrier_Store(&next_slot_hint_, index + 1);
+      return index;
+    }
+  }
+  return kNoSlot;
+}
+
+void SharedMemControllerChannel::FillSlot(int index, int32 owner_pid,
+                                          int32 epoch, StringPiece key) {
+  DCHECK_LE(key.size(), static_cast<size_t>(kMaxKeySize));
+  Slot* s = slot(index);
+  NoBarrier_Store(&s->owner_pid, owner_pid);
+  NoBarrier_Store(&s->epoch, epoch);
+  s->key_size = key.size();
+  memcpy(s->key, key.data(), key.size());
+  s->input_bytes = 0;
+  s->pixels = 0;
+  s->cpu_us = 0;
+}
+
+void SharedMemControllerChannel::SetCost(int index, int64 input_bytes,
+                                         int64 pixels) {
+  Slot* s = slot(index);
+  s->input_bytes = input_bytes;
+  s->pixels = pixels;
+}
+
+void SharedMemControllerChannel::SetCpuUs(int index, int64 cpu_us) {
+  slot(index)->cpu_us = cpu_us;
+}
+
+int32 SharedMemControllerChannel::ReserveRingPosition() {
+  return Barrier_AtomicIncrement(&header_->request_tail, 1) - 1;
+}
+
+void SharedMemControllerChannel::Submit(int index, SlotState state) {
+  Slot* s = slot(index);
+  Atomic32 position = ReserveRingPosition();
+  // Recorded before the state, so whoever sees the slot submitted can tell
+  // whether its place on the ring has already been passed.
+  NoBarrier_Store(&s->position, position);
+  Release_Store(&s->state, state);
+  Release_Store(&ring_[position & kSlotMask], MakeEntry(position, index));
+  Barrier_AtomicIncrement(&header_->request_sequence, 1);
+  if (Acquire_Load(&header_->server_sleeping) != 0) {
+    SharedMemFutex::WakeAll(&header_->request_sequence);
+  }
+}
+
+bool SharedMemControllerChannel::Consumed(int index) {
+  uint32 position = Acquire_Load(&slot(index)->position);
+  uint32 head = Acquire_Load(&header_->request_head);
+  return static_cast<int32>(head - position) > 0;
+}
+
+void SharedMemControllerChannel::WaitForDecisions(int32 seen,
+                                                  int64 timeout_ms) {
+  Barrier_AtomicIncrement(&header_->client_sleepers, 1);
+  if (Acquire_Load(&header_->decision_sequence) == seen) {
+    SharedMemFutex::Wait(&header_->decision_sequence, seen, timeout_ms);
+  }
+  Barrier_AtomicIncrement(&header_->client_sleepers, -1);
+}
+
+int32 SharedMemControllerChannel::decision_sequence() {
+  return Acquire_Load(&header_->decision_sequence);
+}
+
+SharedMemControllerChannel::SlotState SharedMemControllerChannel::state(
+    int index) {
+  return static_cast<SlotState>(Acquire_Load(&slot(index)->state));
+}
+
+bool SharedMemControllerChannel::CompareAndSwapState(int index,
+                                                     SlotState expected,
+                                                     SlotState state) {
+  // Acquire_CompareAndSwap is a full barrier on every platform we support, so
+  // writes made before a successful swap are visible to whoever observes it.
+  return Acquire_CompareAndSwap(&slot(index)->state, expected, state) ==
+         expected;
+}
+
+void SharedMemControllerChannel::FreeSlot(int index) {
+  Slot* s = slot(index);
+  NoBarrier_Store(&s->owner_pid, 0);
+  Release_Store(&s->state, kFree);
+}
+
+int32 SharedMemControllerChannel::owner_pid(int index) {
+  return NoBarrier_Load(&slot(index)->owner_pid);
+}
+
+int32 SharedMemControllerChannel::slot_epoch(int index) {
+  return NoBarrier_Load(&slot(index)->epoch);
+}
+
+GoogleString SharedMemControllerChannel::key(int index) {
+  Slot* s = slot(index);
+  int size = s->key_size;
+  if (size < 0 || size > kMaxKeySize) {
+    size = 0;  // Never trust what's in shared memory too much.
+  }
+  return GoogleString(s->key, size);
+}
+
+int64 SharedMemControllerChannel::input_bytes(int index) {
+  return slot(index)->input_bytes;
+}
+
+int64 SharedMemControllerChannel::pixels(int index) {
+  return slot(index)->pixels;
+}
+
+int64 SharedMemControllerChannel::cpu_us(int index) {
+  return slot(index)->cpu_us;
+}
+
+bool SharedMemControllerChannel::ProcessAlive(int32 pid) {
+  // EPERM means the process exists but belongs to someone else.
+  return (kill(pid, 0) == 0) || (errno == EPERM);
+}
+
+}  // namespace net_instaweb
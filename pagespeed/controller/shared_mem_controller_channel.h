@@ -0,0 +1,210 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_CONTROLLER_SHARED_MEM_CONTROLLER_CHANNEL_H_
+#define PAGESPEED_CONTROLLER_SHARED_MEM_CONTROLLER_CHANNEL_H_
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/atomicops.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+class AbstractSharedMem;
+class AbstractSharedMemSegment;
+class MessageHandler;
+
+// Shared memory segment used to carry CentralController requests between the
+// worker processes and a controller process on the same host, without going
+// through gRPC. SharedMemCentralController is the client side and
+// SharedMemControllerServer is the server side; this class only knows about
+// the layout of the segment and the low-level operations on it.
+//
+// The segment holds a fixed array of slots, one per operation in flight, and
+// a ring of slot numbers that clients use to tell the server a slot needs its
+// attention. A client claims a free slot, fills in the key and submits it
+// (sets the state and pushes the slot onto the ring). The server pops it,
+// asks its controller, and publishes the decision by updating the slot's
+// state. Once a granted operation finishes, the client submits the same slot
+// again with the outcome and the server frees it. Every slot has at most one
+// entry on the ring at a time, so the ring can't overflow.
+//
+// A client reserves its place on the ring before it writes its entry, so one
+// that dies in between would hold up everything behind it. The server skips
+// such places once they have been empty for a while, and recovers any slot
+// whose submission was skipped by looking for slots that are still submitted
+// although their place on the ring has been passed.
+//
+// Both directions have a sequence number that is bumped on every change and
+// doubles as a futex word, so the server and the clients can sleep until
+// there is something to do. Wakes are only issued when someone is asleep.
+//
+// The server bumps the epoch whenever it (re)starts and resets every slot, so
+// clients can tell that operations they submitted earlier have been lost.
+//
+// As with other shared memory objects, call InitSegment(true, ...) once in
+// the root process, then InitSegment(false, ...) in each child.
+class SharedMemControllerChannel {
+ public:
+  enum SlotState {
+    kFree = 0,
+    kClaimed,  // A client is filling it in.
+    // Submitted by a client, waiting for a decision.
+    kScheduleRewrite,
+    kScheduleExpensiveOperation,
+    // Decided by the server.
+    kGranted,
+    kDenied,
+    // Submitted by a client once a granted operation is done.
+    kRewriteSucceeded,
+    kRewriteFailed,
+    kExpensiveOperationDone,
+    // The client gave up before the decision arrived.
+    kAbandoned,
+  };
+
+  static const int kNumSlots = 2048;  // Must be a power of 2.
+  // Longer keys can't be carried; callers should use a different transport.
+  static const int kMaxKeySize = 1024;
+  static const int kNoSlot = -1;
+
+  SharedMemControllerChannel(AbstractSharedMem* shm_runtime,
+                             const GoogleString& segment_name);
+  ~SharedMemControllerChannel();
+
+  // Creates the segment if parent is true, otherwise attaches to the segment
+  // the parent made. Returns false on failure.
+  bool InitSegment(bool parent, MessageHandler* handler);
+
+  // Should be called from the root process as it is about to exit, when no
+  // future children are expected to start.
+  void GlobalCleanup(MessageHandler* handler);
+
+  // Server side.
+
+  // Resets every slot and the ring, bumps the epoch and publishes pid as the
+  // serving process. Any operations in flight are lost.
+  void StartServing(int32 pid);
+  // Tells clients there is no longer a server.
+  void StopServing();
+
+  // Returns the next slot a client has submitted, or kNoSlot if there are
+  // none.
+  int PopRequest();
+
+  // Returns true if PopRequest is held up by a client that reserved the next
+  // place on the ring but hasn't filled it in yet, and sets *position to it.
+  bool RequestStalled(int32* position);
+  // Gives up on the place on the ring RequestStalled reported.
+  void SkipRequest(int32 position);
+
+  // Sleeps for up to timeout_ms until a client submits something, unless
+  // request_sequence() has already moved on from seen.
+  void WaitForRequests(int32 seen, int64 timeout_ms);
+  int32 request_sequence();
+  // Wakes up the server from WaitForRequests.
+  void WakeServer();
+
+  // Sets the state of slot to a decision, if it is still in state expected.
+  // Returns false if the client gave up in the meantime.
+  bool PublishDecision(int slot, SlotState expected, SlotState decision);
+
+  // Client side.
+
+  // 0 if there is no server.
+  int32 server_pid();
+  int32 epoch();
+
+  // Wakes up clients sleeping in WaitForDecisions, eg so they notice a
+  // shutdown.
+  void WakeClients();
+
+  // Returns a slot in state kClaimed, or kNoSlot if they are all in use.
+  int ClaimSlot();
+
+  // Records who the operation in a claimed slot belongs to and its key, which
+  // must be no longer than kMaxKeySize. Expensive operations put the kind of
+  // their cost in the key.
+  void FillSlot(int slot, int32 owner_pid, int32 epoch, StringPiece key);
+  // The rest of an expensive operation's cost, for a claimed slot.
+  void SetCost(int slot, int64 input_bytes, int64 pixels);
+  // The CPU time a granted expensive operation used, before submitting
+  // kExpensiveOperationDone.
+  void SetCpuUs(int slot, int64 cpu_us);
+
+  // Sets the state of slot and queues it for the server.
+  void Submit(int slot, SlotState state);
+  // Whether the server has taken the slot's latest submission off the ring,
+  // or skipped its place there.
+  bool Consumed(int slot);
+
+  // Sleeps for up to timeout_ms until the server publishes a decision, unless
+  // decision_sequence() has already moved on from seen.
+  void WaitForDecisions(int32 seen, int64 timeout_ms);
+  int32 decision_sequence();
+
+  // Either side.
+
+  SlotState state(int slot);
+  bool CompareAndSwapState(int slot, SlotState expected, SlotState state);
+  // Releases the slot for reuse.
+  void FreeSlot(int slot);
+  int32 owner_pid(int slot);
+  int32 slot_epoch(int slot);
+  GoogleString key(int slot);
+  int64 input_bytes(int slot);
+  int64 pixels(int slot);
+  int64 cpu_us(int slot);
+
+  // Whether pid still refers to a running process.
+  static bool ProcessAlive(int32 pid);
+
+ private:
+  friend class SharedMemCentralControllerTest;
+
+  struct Header;
+  struct Slot;
+
+  static size_t SegmentSize();
+  Slot* slot(int index);
+
+  // Takes the next place on the ring, for Submit to fill in.
+  int32 ReserveRingPosition();
+
+  AbstractSharedMem* shm_runtime_;
+  const GoogleString segment_name_;
+  scoped_ptr<AbstractSharedMemSegment> segment_;
+  Header* header_;
+  volatile base::subtle::Atomic32* ring_;
+  char* slots_;
+  // Where ClaimSlot starts looking. Only a hint, so loads and stores are
+  // unordered.
+  base::subtle::Atomic32 next_slot_hint_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedMemControllerChannel);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_CONTROLLER_SHARED_MEM_CONTROLLER_CHANNEL_H_
@@ -0,0 +1,372 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/controller/shared_mem_controller_server.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/thread.h"
+
+namespace net_instaweb {
+
+const int64 SharedMemControllerServer::kReapIntervalMs;
+const int64 SharedMemControllerServer::kStalledRequestMs;
+
+class SharedMemControllerServer::ServerThread : public ThreadSystem::Thread {
+ public:
+  ServerThread(SharedMemControllerServer* server, ThreadSystem* thread_system)
+      : Thread(thread_system, "shm_controller_server",
+               ThreadSystem::kJoinable),
+        server_(server) {}
+
+ private:
+  void Run() override { server_->ServeLoop(); }
+
+  SharedMemControllerServer* server_;
+
+  DISALLOW_COPY_AND_ASSIGN(ServerThread);
+};
+
+// Passed to the controllers. Keeps the server alive until they decide.
+class SharedMemControllerServer::DecisionCallback : public Function {
+ public:
+  DecisionCallback(SharedMemControllerServer* server, int slot)
+      : server_(server), slot_(slot) {}
+
+ protected:
+  void Run() override { server_->Decide(slot_, true /* granted */); }
+  void Cancel() override { server_->Decide(slot_, false /* granted */); }
+
+ private:
+  RefCountedPtr<SharedMemControllerServer> server_;
+  const int slot_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecisionCallback);
+};
+
+SharedMemControllerServer::SharedMemControllerServer(
+    SharedMemControllerChannel* channel, ThreadSystem* thread_system,
+    Timer* timer, MessageHandler* handler)
+    : channel_(channel),
+      thread_system_(thread_system),
+      timer_(timer),
+      handler_(handler),
+      mutex_(thread_system->NewMutex()),
+      expensive_operation_controller_(nullptr),
+      rewrite_controller_(nullptr),
+      epoch_(0),
+      started_(false),
+      stopped_(false),
+      operations_(SharedMemControllerChannel::kNumSlots) {
+}
+
+SharedMemControllerServer::~SharedMemControllerServer() {
+  Stop();
+}
+
+bool SharedMemControllerServer::Start(
+    ExpensiveOperationController* expensive_operation_controller,
+    ScheduleRewriteController* rewrite_controller) {
+  ScopedMutex lock(mutex_.get());
+  DCHECK(!started_);
+  if (started_ || stopped_) {
+    return false;
+  }
+  expensive_operation_controller_ = expensive_operation_controller;
+  rewrite_controller_ = rewrite_controller;
+  channel_->StartServing(getpid());
+  epoch_ = channel_->epoch();
+  thread_.reset(new ServerThread(this, thread_system_));
+  if (!thread_->Start()) {
+    handler_->Message(kError, "Unable to start shared memory controller "
+                      "server thread");
+    channel_->StopServing();
+    thread_.reset();
+    return false;
+  }
+  started_ = true;
+  return true;
+}
+
+void SharedMemControllerServer::Stop() {
+  {
+    ScopedMutex lock(mutex_.get());
+    if (stopped_) {
+      return;
+    }
+    stopped_ = true;
+    if (!started_) {
+      return;
+    }
+  }
+  channel_->WakeServer();
+  thread_->Join();
+  channel_->StopServing();
+}
+
+bool SharedMemControllerServer::stopped() {
+  ScopedMutex lock(mutex_.get());
+  return stopped_;
+}
+
+void SharedMemControllerServer::ServeLoop() {
+  int64 next_reap_ms = timer_->NowMs() + kReapIntervalMs;
+  int32 stalled_position = 0;
+  int64 stalled_since_ms = -1;
+  while (!stopped()) {
+    // Read the sequence number before draining, so anything submitted after
+    // we find the ring empty stops us from sleeping.
+    int32 seen = channel_->request_sequence();
+    int slot;
+    while ((slot = channel_->PopRequest()) !=
+           SharedMemControllerChannel::kNoSlot) {
+      HandleRequest(slot);
+    }
+    int64 now_ms = timer_->NowMs();
+    int64 wait_ms = kReapIntervalMs;
+    int32 position;
+    if (!channel_->RequestStalled(&position)) {
+      stalled_since_ms = -1;
+    } else if (stalled_since_ms < 0 || position != stalled_position) {
+      stalled_position = position;
+      stalled_since_ms = now_ms;
+      wait_ms = kStalledRequestMs;
+    } else if (now_ms - stalled_since_ms >= kStalledRequestMs) {
+      // The client most likely died before filling in its place. If it got
+      // as far as marking its slot submitted, RecoverLostRequests handles it.
+      handler_->Message(kWarning, "Skipping a shared memory controller "
+                        "request that was never completed");
+      channel_->SkipRequest(position);
+      stalled_since_ms = -1;
+      continue;
+    } else {
+      wait_ms = stalled_since_ms + kStalledRequestMs - now_ms;
+    }
+    if (now_ms >= next_reap_ms) {
+      ReapDeadClients();
+      RecoverLostRequests();
+      next_reap_ms = now_ms + kReapIntervalMs;
+    }
+    channel_->WaitForRequests(seen, std::min(wait_ms, next_reap_ms - now_ms));
+  }
+}
+
+void SharedMemControllerServer::HandleRequest(int slot) {
+  SlotState state = channel_->state(slot);
+  if (channel_->slot_epoch(slot) != epoch_) {
+    // Submitted before we started, so nobody is waiting on it any more.
+    channel_->FreeSlot(slot);
+    return;
+  }
+  switch (state) {
+    case SharedMemControllerChannel::kScheduleRewrite:
+    case SharedMemControllerChannel::kScheduleExpensiveOperation: {
+      GoogleString key = channel_->key(slot);
+      ExpensiveOperationCost cost;
+      if (state == SharedMemControllerChannel::kScheduleExpensiveOperation) {
+        // Expensive operations carry their kind in the key field.
+        cost.kind.swap(key);
+        cost.input_bytes = channel_->input_bytes(slot);
+        cost.pixels = channel_->pixels(slot);
+      }
+      {
+        ScopedMutex lock(mutex_.get());
+        Operation* operation = &operations_[slot];
+        *operation = Operation();
+        operation->request = state;
+        operation->key = key;
+        operation->cost = cost;
+        operation->owner_pid = channel_->owner_pid(slot);
+        operation->waiting = true;
+      }
+      // The controller may well decide synchronously.
+      Function* callback = new DecisionCallback(this, slot);
+      if (state == SharedMemControllerChannel::kScheduleRewrite) {
+        rewrite_controller_->ScheduleRewrite(key, callback);
+      } else {
+        expensive_operation_controller_->ScheduleExpensiveOperation(cost,
+                                                                    callback);
+      }
+      break;
+    }
+    case SharedMemControllerChannel::kRewriteSucceeded:
+    case SharedMemControllerChannel::kRewriteFailed:
+    case SharedMemControllerChannel::kExpensiveOperationDone: {
+      bool release = false;
+      Operation released;
+      int64 cpu_us = channel_->cpu_us(slot);
+      {
+        ScopedMutex lock(mutex_.get());
+        Operation* operation = &operations_[slot];
+        if (operation->running) {
+          operation->running = false;
+          release = true;
+          released = *operation;
+        }
+        channel_->FreeSlot(slot);
+      }
+      if (release) {
+        ReleaseOperation(released,
+                         state != SharedMemControllerChannel::kRewriteFailed,
+                         cpu_us);
+      }
+      break;
+    }
+    case SharedMemControllerChannel::kAbandoned:
+      // The client gave up before we got to it.
+      channel_->FreeSlot(slot);
+      break;
+    default:
+      LOG(DFATAL) << "Unexpected state " << state << " for slot " << slot;
+      break;
+  }
+}
+
+void SharedMemControllerServer::Decide(int slot, bool granted) {
+  SlotState request;
+  Operation released;
+  bool release = false;
+  {
+    // The lock is held across PublishDecision so the reaper and
+    // HandleRequest see running and the slot state change together.
+    ScopedMutex lock(mutex_.get());
+    Operation* operation = &operations_[slot];
+    DCHECK(operation->waiting);
+    operation->waiting = false;
+    request = operation->request;
+    if (stopped_ || operation->owner_dead) {
+      channel_->FreeSlot(slot);
+      release = granted;
+    } else {
+      operation->running = granted;
+      SlotState decision = granted ? SharedMemControllerChannel::kGranted
+                                   : SharedMemControllerChannel::kDenied;
+      if (!channel_->PublishDecision(slot, request, decision)) {
+        // The client abandoned the request while we were deciding.
+        operation->running = false;
+        channel_->FreeSlot(slot);
+        release = granted;
+      }
+    }
+    if (release) {
+      released = *operation;
+    }
+  }
+  if (release) {
+    ReleaseOperation(released, false /* succeeded */, 0 /* cpu_us */);
+  }
+}
+
+void SharedMemControllerServer::ReapDeadClients() {
+  std::map<int32, bool> alive;
+  std::vector<Operation> to_release;
+  {
+    ScopedMutex lock(mutex_.get());
+    for (int slot = 0; slot < SharedMemControllerChannel::kNumSlots; ++slot) {
+      SlotState state = channel_->state(slot);
+      int32 pid = channel_->owner_pid(slot);
+      if (state == SharedMemControllerChannel::kFree || pid == 0) {
+        continue;
+      }
+      std::map<int32, bool>::iterator iter = alive.find(pid);
+      if (iter == alive.end()) {
+        iter = alive.insert(std::make_pair(
+            pid, SharedMemControllerChannel::ProcessAlive(pid))).first;
+      }
+      if (iter->second) {
+        continue;
+      }
+      Operation* operation = &operations_[slot];
+      if (operation->waiting) {
+        // Decide will clean up.
+        operation->owner_dead = true;
+      } else if (state == SharedMemControllerChannel::kGranted) {
+        if (operation->running) {
+          operation->running = false;
+          to_release.push_back(*operation);
+        }
+        channel_->FreeSlot(slot);
+      } else if (state == SharedMemControllerChannel::kClaimed ||
+                 state == SharedMemControllerChannel::kDenied) {
+        channel_->FreeSlot(slot);
+      }
+      // Anything else is on the ring and will be dealt with when we get to
+      // it, or by RecoverLostRequests if its place there was skipped.
+    }
+  }
+  for (int i = 0, n = to_release.size(); i < n; ++i) {
+    ReleaseOperation(to_release[i], false /* succeeded */, 0 /* cpu_us */);
+  }
+  if (!to_release.empty()) {
+    handler_->Message(kInfo, "Released %d operations held by exited "
+                      "processes", static_cast<int>(to_release.size()));
+  }
+}
+
+void SharedMemControllerServer::RecoverLostRequests() {
+  std::vector<int> lost;
+  {
+    ScopedMutex lock(mutex_.get());
+    for (int slot = 0; slot < SharedMemControllerChannel::kNumSlots; ++slot) {
+      switch (channel_->state(slot)) {
+        case SharedMemControllerChannel::kScheduleRewrite:
+        case SharedMemControllerChannel::kScheduleExpensiveOperation:
+        case SharedMemControllerChannel::kRewriteSucceeded:
+        case SharedMemControllerChannel::kRewriteFailed:
+        case SharedMemControllerChannel::kExpensiveOperationDone:
+        case SharedMemControllerChannel::kAbandoned:
+          // Anything we popped is either done with or waiting for a
+          // decision, so one that is still submitted after its place on the
+          // ring was passed was skipped.
+          if (!operations_[slot].waiting && channel_->Consumed(slot)) {
+            lost.push_back(slot);
+          }
+          break;
+        default:
+          break;
+      }
+    }
+  }
+  for (int i = 0, n = lost.size(); i < n; ++i) {
+    HandleRequest(lost[i]);
+  }
+}
+
+void SharedMemControllerServer::ReleaseOperation(const Operation& operation,
+                                                 bool succeeded,
+                                                 int64 cpu_us) {
+  if (operation.request == SharedMemControllerChannel::kScheduleRewrite) {
+    if (succeeded) {
+      rewrite_controller_->NotifyRewriteComplete(operation.key);
+    } else {
+      rewrite_controller_->NotifyRewriteFailed(operation.key);
+    }
+  } else {
+    expensive_operation_controller_->NotifyExpensiveOperationComplete(
+        operation.cost, cpu_us);
+  }
+}
+
+}  // namespace net_instaweb
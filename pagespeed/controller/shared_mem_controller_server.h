@@ -0,0 +1,132 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_CONTROLLER_SHARED_MEM_CONTROLLER_SERVER_H_
+#define PAGESPEED_CONTROLLER_SHARED_MEM_CONTROLLER_SERVER_H_
+
+#include <memory>
+#include <vector>
+
+#include "pagespeed/controller/expensive_operation_controller.h"
+#include "pagespeed/controller/expensive_operation_cost.h"
+#include "pagespeed/controller/schedule_rewrite_controller.h"
+#include "pagespeed/controller/shared_mem_controller_channel.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+
+namespace net_instaweb {
+
+// Serves CentralController requests that arrive over a
+// SharedMemControllerChannel, by passing them to the same controllers the
+// gRPC server uses. Runs in the controller process, on its own thread.
+//
+// Worker processes may die at any point. About once a second the server
+// looks for slots that belong to processes that no longer exist and releases
+// whatever they were holding, so a crashed worker can't pin a key or an
+// expensive operation slot forever. A worker that dies halfway through
+// submitting a request leaves an empty place on the ring; the server skips
+// it after kStalledRequestMs, and picks up at the next reap any submission
+// that was skipped with it.
+class SharedMemControllerServer
+    : public RefCounted<SharedMemControllerServer> {
+ public:
+  static const int64 kReapIntervalMs = 1000;
+  static const int64 kStalledRequestMs = 100;
+
+  // Takes ownership of channel, which must already be initialized.
+  SharedMemControllerServer(SharedMemControllerChannel* channel,
+                            ThreadSystem* thread_system, Timer* timer,
+                            MessageHandler* handler);
+
+  // Starts serving, which discards anything already in the channel. The
+  // controllers must remain valid until after Stop() returns, and for as long
+  // as they may still invoke callbacks passed to them. Returns false if the
+  // server thread couldn't be started.
+  bool Start(ExpensiveOperationController* expensive_operation_controller,
+             ScheduleRewriteController* rewrite_controller)
+      LOCKS_EXCLUDED(mutex_);
+
+  // Stops serving and waits for the server thread to exit. Decisions that the
+  // controllers make after this are released straight back to them. Safe to
+  // call more than once and from any thread.
+  void Stop() LOCKS_EXCLUDED(mutex_);
+
+ private:
+  class ServerThread;
+  class DecisionCallback;
+
+  typedef SharedMemControllerChannel::SlotState SlotState;
+
+  // What the server knows about the operation in each slot.
+  struct Operation {
+    Operation() : request(SharedMemControllerChannel::kFree), owner_pid(0),
+                  waiting(false), running(false), owner_dead(false) { }
+
+    SlotState request;  // kScheduleRewrite or kScheduleExpensiveOperation.
+    GoogleString key;  // Only for rewrites.
+    ExpensiveOperationCost cost;  // Only for expensive operations.
+    int32 owner_pid;
+    bool waiting;  // Passed to a controller, no decision yet.
+    bool running;  // Granted, not yet released.
+    bool owner_dead;  // The reaper found owner_pid gone while waiting.
+  };
+
+  friend class RefCounted<SharedMemControllerServer>;
+  ~SharedMemControllerServer();
+
+  void ServeLoop();
+  void HandleRequest(int slot) LOCKS_EXCLUDED(mutex_);
+  void Decide(int slot, bool granted) LOCKS_EXCLUDED(mutex_);
+  // Frees any slot whose owner process has died, releasing what it held.
+  void ReapDeadClients() LOCKS_EXCLUDED(mutex_);
+  // Handles slots whose submission was skipped on the ring.
+  void RecoverLostRequests() LOCKS_EXCLUDED(mutex_);
+  // Tells the controller that a granted operation is over. cpu_us is what
+  // the client reported for an expensive operation, or 0 if unknown.
+  void ReleaseOperation(const Operation& operation, bool succeeded,
+                        int64 cpu_us);
+
+  bool stopped() LOCKS_EXCLUDED(mutex_);
+
+  std::unique_ptr<SharedMemControllerChannel> channel_;
+  ThreadSystem* thread_system_;
+  Timer* timer_;
+  MessageHandler* handler_;
+  std::unique_ptr<AbstractMutex> mutex_;
+  std::unique_ptr<ServerThread> thread_;
+  ExpensiveOperationController* expensive_operation_controller_;
+  ScheduleRewriteController* rewrite_controller_;
+  int32 epoch_;
+  bool started_ GUARDED_BY(mutex_);
+  bool stopped_ GUARDED_BY(mutex_);
+  std::vector<Operation> operations_ GUARDED_BY(mutex_);
+
+  DISALLOW_COPY_AND_ASSIGN(SharedMemControllerServer);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_CONTROLLER_SHARED_MEM_CONTROLLER_SERVER_H_
@@ -44,7 +44,9 @@ class WorkBoundExpensiveOperationController
                                         Statistics* stats);
   virtual ~WorkBoundExpensiveOperationController();
 
-  // ExpensiveOperationController interface.
+  // ExpensiveOperationController interface. Cost hints are ignored.
+  using ExpensiveOperationController::ScheduleExpensiveOperation;
+  using ExpensiveOperationController::NotifyExpensiveOperationComplete;
   virtual void ScheduleExpensiveOperation(Function* callback);
   virtual void NotifyExpensiveOperationComplete();
 
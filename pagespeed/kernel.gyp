@@ -276,6 +276,7 @@
       'sources': [
         'kernel/http/data_url.cc',
         'kernel/http/domain_registry.cc',
+        'kernel/http/header_index.cc',
         'kernel/http/headers.cc',
         'kernel/http/http_options.cc',
         'kernel/http/response_headers_parser.cc',
@@ -607,6 +608,7 @@
         'kernel/sharedmem/shared_dynamic_string_map.cc',
         'kernel/sharedmem/shared_mem_cache.cc',
         'kernel/sharedmem/shared_mem_cache_data.cc',
+        'kernel/sharedmem/shared_mem_futex.cc',
         'kernel/sharedmem/shared_mem_lock_manager.cc',
         'kernel/sharedmem/shared_mem_statistics.cc',
       ],
@@ -622,6 +624,8 @@
       'target_name': 'pagespeed_thread',
       'type': '<(library)',
       'sources': [
+        'kernel/thread/cpu_affinity.cc',
+        'kernel/thread/pipelined_writer.cc',
         'kernel/thread/queued_alarm.cc',
         'kernel/thread/queued_worker.cc',
         'kernel/thread/queued_worker_pool.cc',
@@ -696,11 +700,14 @@
       'type': '<(library)',
       'sources': [
         '<(DEPTH)/pagespeed/kernel/util/brotli_inflater.cc',
+        '<(DEPTH)/pagespeed/kernel/util/streaming_decoder.cc',
       ],
       'include_dirs': [
         '<(DEPTH)',
       ],
       'dependencies': [
+        'pagespeed_http',
+        'util',
         '<(DEPTH)/third_party/brotli/brotli.gyp:brotli_dec',
         '<(DEPTH)/third_party/brotli/brotli.gyp:brotli_enc',
       ],
@@ -27,7 +27,9 @@
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/named_lock_manager.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
 
 namespace net_instaweb {
 
@@ -41,7 +43,10 @@ class NamedLockTester {
   explicit NamedLockTester(ThreadSystem* thread_system)
       : acquired_(false),
         failed_(false),
-        mutex_(thread_system->NewMutex()) {
+        mutex_(thread_system->NewMutex()),
+        timer_(NULL),
+        start_us_(0),
+        latency_histogram_(NULL) {
   }
 
   bool TryLock(NamedLock* lock) {
@@ -137,16 +142,30 @@ class NamedLockTester {
     quiesce_.reset(quiesce);
   }
 
+  // Records how long each successful lock operation took to acquire the
+  // lock, in milliseconds as measured by timer, in histogram.
+  void set_latency_histogram(Timer* timer, Histogram* histogram) {
+    timer_ = timer;
+    latency_histogram_ = histogram;
+  }
+
  private:
   void Clear() {
     ScopedMutex lock(mutex_.get());
     acquired_ = false;
     failed_ = false;
+    if (timer_ != NULL) {
+      start_us_ = timer_->NowUs();
+    }
   }
 
   void LockAcquired() {
     ScopedMutex lock(mutex_.get());
     acquired_ = true;
+    if (latency_histogram_ != NULL) {
+      latency_histogram_->Add(
+          static_cast<double>(timer_->NowUs() - start_us_) / Timer::kMsUs);
+    }
   }
   void LockFailed() {
     ScopedMutex lock(mutex_.get());
@@ -166,6 +185,9 @@ class NamedLockTester {
   scoped_ptr<AbstractMutex> mutex_;
   scoped_ptr<Function> quiesce_;
   scoped_ptr<NamedLock> lock_for_deletion_;
+  Timer* timer_;
+  int64 start_us_;
+  Histogram* latency_histogram_;
 
   DISALLOW_COPY_AND_ASSIGN(NamedLockTester);
 };
@@ -105,6 +105,14 @@ class SharedString {
   // detached prior to extending it.
   void Extend(int new_size);
 
+  // Ensures the underlying storage can grow to 'capacity' bytes without
+  // reallocating, so that a sequence of Append calls of known total size
+  // copies each byte once.  Does not change the value.
+  //
+  // If this method is called on a truncated SharedString, then it will be
+  // detached first.
+  void Reserve(int capacity);
+
   // Swaps storage with the the passed-in string, detaching from any other
   // previously-linked SharedStrings.
   void SwapWithString(GoogleString* str);
@@ -232,4 +232,20 @@ TEST_F(SharedStringTest, ExtendUniqueTruncated) {
       << "Re-use the same storage across truncate/extend of unique string";
 }
 
+TEST_F(SharedStringTest, Reserve) {
+  SharedString ss("ab");
+  SharedString ss2(ss);
+  ss.Reserve(100);
+  EXPECT_EQ("ab", ss.Value());
+  EXPECT_TRUE(ss.SharesStorage(ss2)) << "reserving doesn't detach";
+
+  const char* data = ss.data();
+  GoogleString more(98, 'x');
+  ss.Append(more);
+  EXPECT_EQ(100, ss.size());
+  EXPECT_EQ(data, ss.data()) << "appending within the reservation doesn't "
+                             << "reallocate";
+  EXPECT_EQ("ab", ss2.Value());
+}
+
 }  // namespace net_instaweb
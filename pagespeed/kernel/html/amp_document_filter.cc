@@ -92,6 +92,14 @@ void AmpDocumentFilter::StartElement(HtmlElement* element) {
   }
 }
 
+bool AmpDocumentFilter::GetRelevantElements(
+    std::vector<HtmlName::Keyword>* keywords) const {
+  // Any other leading tag is passed through as non-whitespace Characters,
+  // which declares the document as not AMP, just as its StartElement would.
+  keywords->push_back(HtmlName::kHtml);
+  return true;
+}
+
 void AmpDocumentFilter::Characters(HtmlCharactersNode* characters) {
   if (!is_known_) {
     StringPiece contents = characters->contents();
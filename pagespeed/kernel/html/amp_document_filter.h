@@ -22,10 +22,12 @@
 #define PAGESPEED_KERNEL_HTML_AMP_DOCUMENT_FILTER_H_
 
 #include <memory>
+#include <vector>
 
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/callback.h"
 #include "pagespeed/kernel/html/empty_html_filter.h"
+#include "pagespeed/kernel/html/html_name.h"
 #include "pagespeed/kernel/html/html_node.h"
 
 namespace net_instaweb {
@@ -61,6 +63,8 @@ class AmpDocumentFilter : public EmptyHtmlFilter {
   void EndDocument() override;
   void StartElement(HtmlElement* element) override;
   void Characters(HtmlCharactersNode* chars) override;
+  bool GetRelevantElements(
+      std::vector<HtmlName::Keyword>* keywords) const override;
 
   const char* Name() const override { return "AmpDocumentFilter"; }
 
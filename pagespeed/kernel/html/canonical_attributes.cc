@@ -40,9 +40,8 @@ void CanonicalAttributes::StartDocument() {
 }
 
 void CanonicalAttributes::StartElement(HtmlElement* element) {
-  HtmlElement::AttributeList* attrs = element->mutable_attributes();
-  for (HtmlElement::AttributeIterator i(attrs->begin());
-       i != attrs->end(); ++i) {
+  for (HtmlElement::AttributeIterator i(element->attributes_begin());
+       i != element->attributes_end(); ++i) {
     HtmlElement::Attribute& attribute = *i;
     const char* value = attribute.DecodedValueOrNull();
     if (attribute.decoding_error()) {
@@ -242,9 +242,8 @@ void ElideAttributesFilter::StartElement(HtmlElement* element) {
         one_value_attrs_map_.find(element->keyword());
     if (iter != one_value_attrs_map_.end()) {
       const KeywordSet& oneValueAttrs = iter->second;
-      HtmlElement::AttributeList* attrs = element->mutable_attributes();
-      for (HtmlElement::AttributeIterator i(attrs->begin());
-           i != attrs->end(); ++i) {
+      for (HtmlElement::AttributeIterator i(element->attributes_begin());
+           i != element->attributes_end(); ++i) {
         HtmlElement::Attribute& attribute = *i;
         if (attribute.escaped_value() != NULL &&
             oneValueAttrs.count(attribute.keyword()) > 0) {
@@ -260,9 +259,8 @@ void ElideAttributesFilter::StartElement(HtmlElement* element) {
   if (iter1 != default_value_map_.end()) {
     const ValueMap& default_values = iter1->second;
 
-    HtmlElement::AttributeList* attrs = element->mutable_attributes();
-    HtmlElement::AttributeIterator i(attrs->begin());
-    while (i != attrs->end()) {
+    HtmlElement::AttributeIterator i(element->attributes_begin());
+    while (i != element->attributes_end()) {
       HtmlElement::Attribute& attribute = *i;
       bool remove = false;
       const char* attr_value = attribute.DecodedValueOrNull();
@@ -278,7 +276,7 @@ void ElideAttributesFilter::StartElement(HtmlElement* element) {
         }
       }
       if (remove) {
-        attrs->Erase(&i);
+        element->EraseAttribute(&i);
       } else {
         ++i;
       }
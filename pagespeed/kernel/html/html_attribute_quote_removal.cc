@@ -93,9 +93,8 @@ void HtmlAttributeQuoteRemoval::StartElement(HtmlElement* element) {
     return;  // XHTML doctypes require quotes, so don't remove any.
   }
   int rewritten = 0;
-  HtmlElement::AttributeList* attrs = element->mutable_attributes();
-  for (HtmlElement::AttributeIterator i(attrs->begin());
-       i != attrs->end(); ++i) {
+  for (HtmlElement::AttributeIterator i(element->attributes_begin());
+       i != element->attributes_end(); ++i) {
     HtmlElement::Attribute& attr = *i;
     if (attr.quote_style() != HtmlElement::NO_QUOTE &&
         !NeedsQuotes(attr.escaped_value())) {
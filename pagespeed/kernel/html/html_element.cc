@@ -23,6 +23,7 @@
 #include <cstdio>
 
 #include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
@@ -32,6 +33,16 @@
 
 namespace net_instaweb {
 
+namespace {
+
+inline uint32 AttributeIndexHash(HtmlName::Keyword keyword) {
+  return static_cast<uint32>(keyword) * 0x9e3779b1U;
+}
+
+}  // namespace
+
+const int HtmlElement::kMinAttributesToIndex;
+
 HtmlElement::HtmlElement(HtmlElement* parent, const HtmlName& name,
     const HtmlEventListIterator& begin, const HtmlEventListIterator& end)
     : HtmlNode(parent),
@@ -50,7 +61,9 @@ HtmlElement::Data::Data(const HtmlName& name,
       style_(AUTO_CLOSE),
       name_(name),
       begin_(begin),
-      end_(end) {
+      end_(end),
+      attribute_index_state_(kIndexUnknown),
+      attribute_index_mask_(0) {
 }
 
 HtmlElement::Data::~Data() {
@@ -74,10 +87,10 @@ void HtmlElement::SynthesizeEvents(const HtmlEventListIterator& iter,
 }
 
 bool HtmlElement::DeleteAttribute(HtmlName::Keyword keyword) {
-  AttributeList* attrs = mutable_attributes();
-  for (AttributeIterator iter(attrs->begin()); iter != attrs->end(); ++iter) {
+  for (AttributeIterator iter(attributes_begin()); iter != attributes_end();
+       ++iter) {
     if (iter->keyword() == keyword) {
-      attrs->Erase(&iter);
+      EraseAttribute(&iter);
       return true;
     }
   }
@@ -85,10 +98,10 @@ bool HtmlElement::DeleteAttribute(HtmlName::Keyword keyword) {
 }
 
 bool HtmlElement::DeleteAttribute(StringPiece name) {
-  AttributeList* attrs = mutable_attributes();
-  for (AttributeIterator iter(attrs->begin()); iter != attrs->end(); ++iter) {
+  for (AttributeIterator iter(attributes_begin()); iter != attributes_end();
+       ++iter) {
     if (iter->name_str() == name) {
-      attrs->Erase(&iter);
+      EraseAttribute(&iter);
       return true;
     }
   }
@@ -97,7 +110,31 @@ bool HtmlElement::DeleteAttribute(StringPiece name) {
 
 const HtmlElement::Attribute* HtmlElement::FindAttribute(
     HtmlName::Keyword keyword) const {
+  Data* data = data_.get();
+  if ((data->attribute_index_state_ == Data::kIndexBuilt) &&
+      (keyword != HtmlName::kNotAKeyword)) {
+    return LookupAttributeIndex(keyword);
+  }
+
   const Attribute* ret = NULL;
+  if (data->attribute_index_state_ == Data::kIndexUnknown) {
+    // Scan the whole list so we learn whether it's worth indexing.
+    int num_attributes = 0;
+    for (AttributeConstIterator iter = attributes().begin();
+         iter != attributes().end(); ++iter) {
+      const Attribute* attribute = iter.Get();
+      if ((ret == NULL) && (attribute->keyword() == keyword)) {
+        ret = attribute;
+      }
+      ++num_attributes;
+    }
+    if (num_attributes >= kMinAttributesToIndex) {
+      BuildAttributeIndex(num_attributes);
+    } else {
+      data->attribute_index_state_ = Data::kIndexTooSmall;
+    }
+    return ret;
+  }
 
   for (AttributeConstIterator iter = attributes().begin();
        iter != attributes().end(); ++iter) {
@@ -110,6 +147,50 @@ const HtmlElement::Attribute* HtmlElement::FindAttribute(
   return ret;
 }
 
+void HtmlElement::BuildAttributeIndex(int num_attributes) const {
+  // Keep the load factor at or below 1/2 so probe sequences stay short.
+  int size = 16;
+  while (size < 2 * num_attributes) {
+    size *= 2;
+  }
+  Data* data = data_.get();
+  Attribute** table = new Attribute*[size]();
+  int mask = size - 1;
+  for (AttributeConstIterator iter = attributes().begin();
+       iter != attributes().end(); ++iter) {
+    HtmlName::Keyword keyword = iter->keyword();
+    if (keyword == HtmlName::kNotAKeyword) {
+      continue;
+    }
+    int slot = AttributeIndexHash(keyword) & mask;
+    while ((table[slot] != NULL) && (table[slot]->keyword() != keyword)) {
+      slot = (slot + 1) & mask;
+    }
+    // Duplicate attributes are illegal but common; FindAttribute has always
+    // returned the first one.
+    if (table[slot] == NULL) {
+      table[slot] = const_cast<Attribute*>(iter.Get());
+    }
+  }
+  data->attribute_index_.reset(table);
+  data->attribute_index_mask_ = mask;
+  data->attribute_index_state_ = Data::kIndexBuilt;
+}
+
+const HtmlElement::Attribute* HtmlElement::LookupAttributeIndex(
+    HtmlName::Keyword keyword) const {
+  const Data* data = data_.get();
+  const Attribute* const* table = data->attribute_index_.get();
+  int mask = data->attribute_index_mask_;
+  for (int slot = AttributeIndexHash(keyword) & mask; table[slot] != NULL;
+       slot = (slot + 1) & mask) {
+    if (table[slot]->keyword() == keyword) {
+      return table[slot];
+    }
+  }
+  return NULL;
+}
+
 const HtmlElement::Attribute* HtmlElement::FindAttribute(
     StringPiece name) const {
   for (AttributeConstIterator iter = attributes().begin();
@@ -173,11 +254,14 @@ void HtmlElement::AddAttribute(const Attribute& src_attr) {
   Attribute* attr = new Attribute(src_attr.name(),
                                   src_attr.escaped_value(),
                                   src_attr.quote_style());
-  if (src_attr.decoded_value_computed_) {
+  // If the value needs no decoding, the constructor already worked that out;
+  // in that case src_attr's decoded value is an alias we must not copy.
+  if (src_attr.decoded_value_computed_ && !attr->decoded_value_computed_) {
     attr->decoded_value_computed_ = true;
     attr->decoding_error_ = src_attr.decoding_error_;
     Attribute::CopyValue(src_attr.decoded_value_.get(), &attr->decoded_value_);
   }
+  InvalidateAttributeIndex();
   data_->attributes_.Append(attr);
 }
 
@@ -188,9 +272,14 @@ void HtmlElement::AddAttribute(const HtmlName& name,
   Attribute* attr = new Attribute(name,
                                   HtmlKeywords::Escape(decoded_value, &buf),
                                   quote_style);
-  attr->decoded_value_computed_ = true;
-  attr->decoding_error_ = false;
-  Attribute::CopyValue(decoded_value, &attr->decoded_value_);
+  // If escaping changed nothing, the constructor already aliased the decoded
+  // value to the escaped one.
+  if (!attr->decoded_value_is_escaped_) {
+    attr->decoded_value_computed_ = true;
+    attr->decoding_error_ = false;
+    Attribute::CopyValue(decoded_value, &attr->decoded_value_);
+  }
+  InvalidateAttributeIndex();
   data_->attributes_.Append(attr);
 }
 
@@ -198,6 +287,7 @@ void HtmlElement::AddEscapedAttribute(const HtmlName& name,
                                       const StringPiece& escaped_value,
                                       QuoteStyle quote_style) {
   Attribute* attr = new Attribute(name, escaped_value, quote_style);
+  InvalidateAttributeIndex();
   data_->attributes_.Append(attr);
 }
 
@@ -221,8 +311,38 @@ HtmlElement::Attribute::Attribute(const HtmlName& name,
     : name_(name),
       quote_style_(quote_style),
       decoding_error_(false),
-      decoded_value_computed_(false) {
+      decoded_value_computed_(false),
+      decoded_value_is_escaped_(false) {
   CopyValue(escaped_value, &escaped_value_);
+  ScanEscapedValue();
+}
+
+void HtmlElement::SetAttributeName(Attribute* attribute,
+                                   const HtmlName& name) {
+  if (attribute->keyword() != name.keyword()) {
+    InvalidateAttributeIndex();
+  }
+  attribute->name_ = name;
+}
+
+void HtmlElement::Attribute::ScanEscapedValue() {
+  decoded_value_.reset();
+  decoding_error_ = false;
+  // HtmlKeywords::Unescape only ever changes a value that contains '&', and
+  // fails on any 8-bit character.  Anything else decodes to itself,
+  // including a NULL value.
+  decoded_value_is_escaped_ = true;
+  const char* escaped = escaped_value_.get();
+  if (escaped != NULL) {
+    for (; *escaped != '\0'; ++escaped) {
+      uint8 ch = static_cast<uint8>(*escaped);
+      if ((ch == '&') || (ch > 127)) {
+        decoded_value_is_escaped_ = false;
+        break;
+      }
+    }
+  }
+  decoded_value_computed_ = decoded_value_is_escaped_;
 }
 
 // Modify value of attribute (eg to rewrite dest of src or href).
@@ -230,15 +350,30 @@ HtmlElement::Attribute::Attribute(const HtmlName& name,
 // ownership of value.
 void HtmlElement::Attribute::SetValue(const StringPiece& decoded_value) {
   GoogleString buf;
+  StringPiece value(decoded_value);
+  GoogleString value_copy;
+  const char* escaped_chars = escaped_value_.get();
+  if (decoded_value_is_escaped_) {
+    // DecodedValueOrNull() hands out escaped_value_ itself for values that
+    // need no decoding, so callers may legitimately pass (a substring of)
+    // it back in.  Copy it out before escaped_value_ is replaced.
+    if ((value.data() != NULL) && (escaped_chars != NULL) &&
+        (value.data() >= escaped_chars) &&
+        (value.data() <= escaped_chars + strlen(escaped_chars))) {
+      value.CopyToString(&value_copy);
+      value = value_copy;
+    }
+    decoded_value_is_escaped_ = false;
+  } else {
+    DCHECK(decoded_value.data() + decoded_value.size() < escaped_chars ||
+           escaped_chars + strlen(escaped_chars) < decoded_value.data())
+        << "Setting unescaped value from substring of escaped value.";
+  }
   // Note that we execute the lines in this order in case value
   // is a substring of value_.  This copies the value just prior
   // to deallocation of the old value_.
-  const char* escaped_chars = escaped_value_.get();
-  DCHECK(decoded_value.data() + decoded_value.size() < escaped_chars ||
-         escaped_chars + strlen(escaped_chars) < decoded_value.data())
-      << "Setting unescaped value from substring of escaped value.";
-  CopyValue(HtmlKeywords::Escape(decoded_value, &buf), &escaped_value_);
-  CopyValue(decoded_value, &decoded_value_);
+  CopyValue(HtmlKeywords::Escape(value, &buf), &escaped_value_);
+  CopyValue(value, &decoded_value_);
 }
 
 void HtmlElement::Attribute::SetEscapedValue(const StringPiece& escaped_value) {
@@ -253,11 +388,8 @@ void HtmlElement::Attribute::SetEscapedValue(const StringPiece& escaped_value) {
         << "Setting escaped value from substring of unescaped value.";
   }
 
-  decoded_value_.reset();
-  decoding_error_ = false;
-  decoded_value_computed_ = false;
-
   CopyValue(escaped_value, &escaped_value_);
+  ScanEscapedValue();
 }
 
 const char* HtmlElement::Attribute::quote_str() const {
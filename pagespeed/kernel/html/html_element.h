@@ -86,7 +86,6 @@ class HtmlElement : public HtmlNode {
     HtmlName::Keyword keyword() const { return name_.keyword(); }
 
     HtmlName name() const { return name_; }
-    void set_name(const HtmlName& name) { name_ = name; }
 
     // Returns the value in its original directly from the HTML source.
     // This may have HTML escapes in it, such as "&amp;".
@@ -117,11 +116,16 @@ class HtmlElement : public HtmlNode {
     //
     // The decoded value uses 8-bit characters to represent any unicode
     // code-point less than 256.
+    //
+    // Values containing neither '&' nor 8-bit characters decode to
+    // themselves; for those this returns escaped_value() without any
+    // decoding or copying.
     const char* DecodedValueOrNull() const {
       if (!decoded_value_computed_) {
         ComputeDecodedValue();
       }
-      return decoded_value_.get();
+      return decoded_value_is_escaped_ ? escaped_value_.get()
+                                       : decoded_value_.get();
     }
 
     void set_decoding_error(bool x) { decoding_error_ = x; }
@@ -173,6 +177,11 @@ class HtmlElement : public HtmlNode {
    private:
     void ComputeDecodedValue() const;
 
+    // Determines whether escaped_value_ is already in decoded form, in which
+    // case the decoded value is marked computed and aliases escaped_value_.
+    // Otherwise decoding is deferred until it's first needed.
+    void ScanEscapedValue();
+
     // This should only be called from AddAttribute
     Attribute(const HtmlName& name, const StringPiece& escaped_value,
               QuoteStyle quote_style);
@@ -184,6 +193,7 @@ class HtmlElement : public HtmlNode {
     QuoteStyle quote_style_ : 8;
     mutable bool decoding_error_;
     mutable bool decoded_value_computed_;
+    bool decoded_value_is_escaped_;  // decoded_value_ is unused if true.
 
     // Attribute value represented as ascii and
     // HTML-escape-sequences, typically parsed directly from an HTML
@@ -258,6 +268,9 @@ class HtmlElement : public HtmlNode {
   bool DeleteAttribute(HtmlName::Keyword keyword);
   bool DeleteAttribute(StringPiece name);
 
+  // Renames one of this element's attributes, keeping its value.
+  void SetAttributeName(Attribute* attribute, const HtmlName& name);
+
   // Look up attribute by name.  NULL if no attribute exists.
   // Use this for attributes whose value you might want to change
   // after lookup.
@@ -331,7 +344,24 @@ class HtmlElement : public HtmlNode {
   void set_name(const HtmlName& new_tag) { data_->name_ = new_tag; }
 
   const AttributeList& attributes() const { return data_->attributes_; }
-  AttributeList* mutable_attributes() { return &data_->attributes_; }
+  AttributeList* mutable_attributes() {
+    // The caller may add or erase attributes behind our back.
+    InvalidateAttributeIndex();
+    return &data_->attributes_;
+  }
+
+  // Iterate over the attributes in a way that lets callers change their
+  // values and quoting, but not add, remove or rename them.  Prefer these to
+  // mutable_attributes(), which must discard FindAttribute's index.
+  AttributeIterator attributes_begin() { return data_->attributes_.begin(); }
+  AttributeIterator attributes_end() { return data_->attributes_.end(); }
+
+  // Removes the attribute iter points to, and advances iter past it, as
+  // InlineSList::Erase does.  iter must come from attributes_begin().
+  void EraseAttribute(AttributeIterator* iter) {
+    InvalidateAttributeIndex();
+    data_->attributes_.Erase(iter);
+  }
 
   friend class HtmlParse;
   friend class HtmlLexer;
@@ -355,9 +385,19 @@ class HtmlElement : public HtmlNode {
   virtual HtmlEventListIterator end() const { return data_->end_; }
 
  private:
+  // Elements with at least this many attributes get an index to speed up
+  // FindAttribute(HtmlName::Keyword).
+  static const int kMinAttributesToIndex = 8;
+
   // All of the data associated with an HtmlElement is indirected through this
   // class, so we can delete it on Flush after a CloseElement event.
   struct Data {
+    enum AttributeIndexState {
+      kIndexUnknown,   // Attributes changed since we last looked.
+      kIndexTooSmall,  // Too few attributes to be worth indexing.
+      kIndexBuilt,
+    };
+
     Data(const HtmlName& name,
          const HtmlEventListIterator& begin,
          const HtmlEventListIterator& end);
@@ -387,8 +427,23 @@ class HtmlElement : public HtmlNode {
     AttributeList attributes_;
     HtmlEventListIterator begin_;
     HtmlEventListIterator end_;
+
+    // Open-addressed hash table, keyed by keyword, of the first attribute
+    // with each keyword.  Attributes with kNotAKeyword are not indexed.
+    // Built lazily by FindAttribute, and discarded whenever the attribute
+    // list or an attribute's name may have changed.
+    AttributeIndexState attribute_index_state_;
+    int attribute_index_mask_;
+    scoped_array<Attribute*> attribute_index_;
   };
 
+  void InvalidateAttributeIndex() {
+    data_->attribute_index_state_ = Data::kIndexUnknown;
+    data_->attribute_index_.reset();
+  }
+  void BuildAttributeIndex(int num_attributes) const;
+  const Attribute* LookupAttributeIndex(HtmlName::Keyword keyword) const;
+
   // Begin/end event iterators are used by HtmlParse to keep track
   // of the span of events underneath an element.  This is primarily to
   // help delete the element.  Events are not public.
@@ -31,4 +31,9 @@ HtmlFilter::~HtmlFilter() {
 void HtmlFilter::RenderDone() {
 }
 
+bool HtmlFilter::GetRelevantElements(
+    std::vector<HtmlName::Keyword>* keywords) const {
+  return false;
+}
+
 }  // namespace net_instaweb
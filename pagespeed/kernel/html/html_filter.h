@@ -21,7 +21,10 @@
 #ifndef PAGESPEED_KERNEL_HTML_HTML_FILTER_H_
 #define PAGESPEED_KERNEL_HTML_HTML_FILTER_H_
 
+#include <vector>
+
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/html/html_name.h"
 
 namespace net_instaweb {
 
@@ -144,6 +147,22 @@ class HtmlFilter {
   // that is not page-critical.
   virtual ScriptUsage GetScriptUsage() const = 0;
 
+  // Filters that only act on a known set of elements can declare them here
+  // by appending their keywords to *keywords and returning true.  When every
+  // enabled filter does so, and HtmlParse::set_allow_passthrough(true) has
+  // been called, the lexer forwards the bytes of all other tags as raw
+  // Characters without constructing elements for them.
+  //
+  // A filter returning true must therefore tolerate Characters nodes that
+  // contain markup, and must not depend on seeing elements outside its set,
+  // e.g. as the parent() of an element it does care about.  Literal tags
+  // such as <script> and <style>, and the <html>, <head> and <body>
+  // structure, are always lexed as elements.
+  //
+  // The default returns false, indicating the filter needs every event.
+  virtual bool GetRelevantElements(
+      std::vector<HtmlName::Keyword>* keywords) const;
+
   // The name of this filter -- used for logging and debugging.
   virtual const char* Name() const = 0;
 
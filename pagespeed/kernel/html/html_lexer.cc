@@ -25,6 +25,7 @@
 #include <cstdarg>
 #include <cstddef>  // for size_t
 #include <cstdio>
+#include <cstring>
 
 #include "base/logging.h"
 #include "strings/stringpiece_utils.h"
@@ -169,7 +170,11 @@ HtmlLexer::HtmlLexer(HtmlParse* html_parse)
       discard_until_start_state_for_error_recovery_(false),
       size_limit_exceeded_(false),
       skip_parsing_(false),
-      size_limit_(-1) {
+      size_limit_(-1),
+      passthrough_(false),
+      pending_literal_size_(0),
+      passthrough_quote_('\0'),
+      passthrough_after_eq_(false) {
 #ifndef NDEBUG
   CHECK_KEYWORD_SET_ORDERING(kImplicitlyClosedHtmlTags);
   CHECK_KEYWORD_SET_ORDERING(kNonBriefTerminatedTags);
@@ -183,9 +188,15 @@ HtmlLexer::~HtmlLexer() {
 
 void HtmlLexer::EvalStart(char c) {
   if (c == '<') {
-    literal_.resize(literal_.size() - 1);
-    EmitLiteral();
-    literal_ += c;
+    if (passthrough_) {
+      // Hold on to the preceding text until we know whether this tag is
+      // relevant; if it is not, it will be coalesced with the tag bytes.
+      pending_literal_size_ = literal_.size() - 1;
+    } else {
+      literal_.resize(literal_.size() - 1);
+      EmitLiteral();
+      literal_ += c;
+    }
     state_ = TAG;
     discard_until_start_state_for_error_recovery_ = false;
     tag_start_line_ = line_;
@@ -232,6 +243,8 @@ void HtmlLexer::EvalTag(char c) {
     discard_until_start_state_for_error_recovery_ = false;
     token_ += c;
   } else if (c == '!') {
+    // Comments, CDATA and directives are never passed through.
+    EmitPendingLiteral();
     state_ = COMMENT_START1;
   } else if (c == '?') {
     state_ = BOGUS_COMMENT;
@@ -248,7 +261,21 @@ void HtmlLexer::EvalTag(char c) {
 void HtmlLexer::EvalTagOpen(char c) {
   if (IsLegalTagChar(c)) {
     token_ += c;
-  } else if (c == '>') {
+    return;
+  }
+  if (passthrough_ && ((c == '>') || (c == '/') || IsHtmlSpace(c))) {
+    if (IsPassthroughTag()) {
+      // Leave the tag bytes in literal_, and skip to its closing '>'.
+      token_.clear();
+      passthrough_quote_ = '\0';
+      passthrough_after_eq_ = false;
+      state_ = PASSTHROUGH_TAG;
+      EvalPassthroughTag(c);
+      return;
+    }
+    EmitPendingLiteral();
+  }
+  if (c == '>') {
     MakeElement();
     EmitTagOpen(true);
   } else if (c == '/') {
@@ -322,7 +349,13 @@ void HtmlLexer::EvalTagClose(char c) {
       state_ = TAG_CLOSE_TERMINATE;
     }
   } else if (c == '>') {
-    EmitTagClose(HtmlElement::EXPLICIT_CLOSE);
+    if (passthrough_ && IsPassthroughTag()) {
+      token_.clear();
+      state_ = START;
+    } else {
+      EmitPendingLiteral();
+      EmitTagClose(HtmlElement::EXPLICIT_CLOSE);
+    }
   } else {
     SyntaxError("Invalid tag syntax: expected `>' after `</%s' got `%c'",
                 token_.c_str(), c);
@@ -352,6 +385,27 @@ void HtmlLexer::EvalBogusComment(char c) {
   }
 }
 
+// Handle the remainder of an open tag that is being passed through.  We
+// only need to find the '>' that terminates it, taking care to skip over
+// any '>' within quoted attribute values.  As in EvalAttrEq, a quote only
+// starts a value if it directly follows the '=', modulo whitespace.
+void HtmlLexer::EvalPassthroughTag(char c) {
+  if (passthrough_quote_ != '\0') {
+    if (c == passthrough_quote_) {
+      passthrough_quote_ = '\0';
+    }
+  } else if (c == '>') {
+    state_ = START;
+  } else if (passthrough_after_eq_ && ((c == '"') || (c == '\''))) {
+    passthrough_quote_ = c;
+    passthrough_after_eq_ = false;
+  } else if (c == '=') {
+    passthrough_after_eq_ = true;
+  } else if (!IsHtmlSpace(c)) {
+    passthrough_after_eq_ = false;
+  }
+}
+
 // After a partial match of a multi-character lexical sequence, a mismatched
 // character needs to temporarily removed from the retained literal_ before
 // being emitted.  Then re-inserted for so that EvalStart can attempt to
@@ -645,9 +699,44 @@ void HtmlLexer::EmitLiteral() {
         html_parse_->NewCharactersNode(Parent(), literal_), tag_start_line_));
     literal_.clear();
   }
+  pending_literal_size_ = 0;
   state_ = START;
 }
 
+void HtmlLexer::EmitPendingLiteral() {
+  if (pending_literal_size_ > 0) {
+    DCHECK_LE(pending_literal_size_, static_cast<int>(literal_.size()));
+    StringPiece pending(literal_.data(), pending_literal_size_);
+    html_parse_->AddEvent(new HtmlCharactersEvent(
+        html_parse_->NewCharactersNode(Parent(), pending), tag_start_line_));
+    literal_.erase(0, pending_literal_size_);
+    pending_literal_size_ = 0;
+  }
+}
+
+bool HtmlLexer::IsPassthroughTag() const {
+  return !passthrough_keywords_[HtmlName::Lookup(token_)];
+}
+
+void HtmlLexer::EnablePassthrough(
+    const std::vector<HtmlName::Keyword>& keywords) {
+  passthrough_ = true;
+  passthrough_keywords_.assign(HtmlName::kNotAKeyword + 1, false);
+  for (int i = 0, n = keywords.size(); i < n; ++i) {
+    passthrough_keywords_[keywords[i]] = true;
+  }
+
+  // We can't skip the contents of a literal tag without lexing it, and
+  // keeping the document structure lets filters find <head> and <body>.
+  for (int i = 0; i < static_cast<int>(arraysize(kLiteralTags)); ++i) {
+    passthrough_keywords_[kLiteralTags[i]] = true;
+  }
+  passthrough_keywords_[HtmlName::kHtml] = true;
+  passthrough_keywords_[HtmlName::kHead] = true;
+  passthrough_keywords_[HtmlName::kBody] = true;
+  passthrough_keywords_[HtmlName::kNotAKeyword] = false;
+}
+
 void HtmlLexer::EmitComment() {
   literal_.clear();
   // The precise syntax of IE conditional comments (for example, exactly where
@@ -788,6 +877,9 @@ void HtmlLexer::StartParse(const StringPiece& id,
   script_html_comment_ = false;
   script_html_comment_script_ = false;
   discard_until_start_state_for_error_recovery_ = false;
+  passthrough_ = false;
+  passthrough_keywords_.clear();
+  pending_literal_size_ = 0;
   // clear buffers
 }
 
@@ -1039,6 +1131,23 @@ void HtmlLexer::Parse(const char* text, int size) {
       // Return without doing anything if skip_parsing_ is true.
       return;
     }
+
+    // Between tags, every byte up to the next '<' just accumulates into
+    // literal_, so scan for it in bulk rather than a character at a time.
+    if (state_ == START) {
+      const char* start = text + i;
+      const char* lt = static_cast<const char*>(memchr(start, '<', size - i));
+      int n = (lt == NULL) ? (size - i) : (lt - start);
+      if (n > 0) {
+        line_ += std::count(start, start + n, '\n');
+        literal_.append(start, n);
+        i += n;
+        if (i == size) {
+          break;
+        }
+      }
+    }
+
     char c = text[i];
     if (c == '\n') {
       ++line_;
@@ -1084,6 +1193,7 @@ void HtmlLexer::Parse(const char* text, int size) {
       case SCRIPT_TAG:            EvalScriptTag(c);           break;
       case DIRECTIVE:             EvalDirective(c);           break;
       case BOGUS_COMMENT:         EvalBogusComment(c);        break;
+      case PASSTHROUGH_TAG:       EvalPassthroughTag(c);      break;
     }
   }
 }
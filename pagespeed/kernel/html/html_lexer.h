@@ -97,6 +97,14 @@ class HtmlLexer {
   // that we should parse.
   bool size_limit_exceeded() const { return size_limit_exceeded_; }
 
+  // Switches the lexer into passthrough mode for the remainder of the current
+  // parse.  Open and close tags whose keyword is not in 'keywords' are left in
+  // the literal buffer and emitted, together with any surrounding text, as a
+  // single Characters event.  Literal tags and the html, head and body
+  // elements are always lexed normally.  Comments, CDATA and directives are
+  // unaffected.  StartParse turns passthrough mode off again.
+  void EnablePassthrough(const std::vector<HtmlName::Keyword>& keywords);
+
  private:
   // Most of these routines expect c to be the last character of literal_
   inline void EvalStart(char c);
@@ -130,6 +138,7 @@ class HtmlLexer {
   inline void EvalScriptTag(char c);
   inline void EvalDirective(char c);
   inline void EvalBogusComment(char c);
+  inline void EvalPassthroughTag(char c);
 
   // Makes an element based on token_, which will be parsed as the tag
   // name.
@@ -147,6 +156,14 @@ class HtmlLexer {
   void EmitDirective();
   void Restart(char c);
 
+  // In passthrough mode, text preceding the tag currently being lexed is
+  // retained in literal_ until we know whether the tag is relevant.  If it
+  // is, this emits that text as Characters, leaving just the tag in literal_.
+  void EmitPendingLiteral();
+
+  // Returns whether a tag named by token_ should be forwarded as raw bytes.
+  bool IsPassthroughTag() const;
+
   // Emits a syntax error message.
   void SyntaxError(const char* format, ...) INSTAWEB_PRINTF_FORMAT(2, 3);
 
@@ -217,6 +234,7 @@ class HtmlLexer {
     SCRIPT_TAG,            // "<script "
     DIRECTIVE,             // "<!x"
     BOGUS_COMMENT,         // "<?foo>" or "</?foo>"
+    PASSTHROUGH_TAG,       // "<x " where x is not relevant in passthrough mode
   };
 
   HtmlParse* html_parse_;
@@ -252,6 +270,17 @@ class HtmlLexer {
   int64 num_bytes_parsed_;
   int64 size_limit_;
 
+  // Passthrough state; see EnablePassthrough.  passthrough_keywords_ is
+  // indexed by HtmlName::Keyword.  pending_literal_size_ is the number of
+  // bytes at the front of literal_ that precede the tag being lexed.
+  bool passthrough_;
+  std::vector<bool> passthrough_keywords_;
+  int pending_literal_size_;
+  // Quote character of an attribute value in a PASSTHROUGH_TAG, or '\0'.
+  char passthrough_quote_;
+  // Whether the last non-space character in a PASSTHROUGH_TAG was '='.
+  bool passthrough_after_eq_;
+
   DISALLOW_COPY_AND_ASSIGN(HtmlLexer);
 };
 
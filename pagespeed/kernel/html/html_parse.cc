@@ -63,6 +63,9 @@ HtmlParse::HtmlParse(MessageHandler* message_handler)
       log_rewrite_timing_(false),
       running_filters_(false),
       buffer_events_(false),
+      allow_passthrough_(false),
+      passthrough_possible_(false),
+      passthrough_active_(false),
       parse_start_time_us_(0),
       timer_(NULL),
       current_filter_(NULL),
@@ -246,6 +249,7 @@ bool HtmlParse::StartParseId(const StringPiece& url, const StringPiece& id,
   delayed_start_literal_.reset();
   determine_filter_behavior_called_ = false;
   buffer_events_ = false;
+  passthrough_active_ = false;
 
   // Paranoid debug-checking and unconditional clearing of state variables.
   DCHECK(!skip_increment_);
@@ -352,6 +356,23 @@ void HtmlParse::CheckFilterBehavior(HtmlFilter* filter) {
   } else {
     // Only enabled filters will be aggregated.
     can_modify_urls_ = can_modify_urls_ || filter->CanModifyUrls();
+    if (passthrough_possible_ &&
+        !filter->GetRelevantElements(&passthrough_keywords_)) {
+      passthrough_possible_ = false;
+    }
+  }
+}
+
+void HtmlParse::ConfigurePassthrough() {
+  for (int i = 0, n = event_listeners_.size();
+       passthrough_possible_ && (i < n); ++i) {
+    if (!event_listeners_[i]->GetRelevantElements(&passthrough_keywords_)) {
+      passthrough_possible_ = false;
+    }
+  }
+  passthrough_active_ = passthrough_possible_;
+  if (passthrough_active_) {
+    lexer_->EnablePassthrough(passthrough_keywords_);
   }
 }
 
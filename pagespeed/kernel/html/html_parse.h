@@ -327,9 +327,10 @@ class HtmlParse {
     return element->AddEscapedAttribute(MakeName(keyword), escaped_value,
                                         HtmlElement::DOUBLE_QUOTE);
   }
-  void SetAttributeName(HtmlElement::Attribute* attribute,
+  void SetAttributeName(HtmlElement* element,
+                        HtmlElement::Attribute* attribute,
                         HtmlName::Keyword keyword) {
-    attribute->set_name(MakeName(keyword));
+    element->SetAttributeName(attribute, MakeName(keyword));
   }
 
   HtmlName MakeName(const StringPiece& str);
@@ -514,6 +515,17 @@ class HtmlParse {
     return can_modify_urls_;
   }
 
+  // Permits the lexer to forward tags that no enabled filter or event
+  // listener cares about as raw Characters, rather than constructing
+  // elements for them and running them through the filter chain.  This
+  // only takes effect for documents where every enabled filter declares
+  // its elements via HtmlFilter::GetRelevantElements.  Must be called
+  // before parsing starts.  Defaults to false.
+  void set_allow_passthrough(bool x) { allow_passthrough_ = x; }
+
+  // Returns whether the current document is being lexed in passthrough mode.
+  bool passthrough_active() const { return passthrough_active_; }
+
  protected:
   typedef std::vector<HtmlFilter*> FilterVector;
   typedef std::list<HtmlFilter*> FilterList;
@@ -542,7 +554,10 @@ class HtmlParse {
     if (!determine_filter_behavior_called_) {
       determine_filter_behavior_called_ = true;
       can_modify_urls_ = false;
+      passthrough_possible_ = allow_passthrough_;
+      passthrough_keywords_.clear();
       DetermineFiltersBehaviorImpl();
+      ConfigurePassthrough();
     }
   }
 
@@ -594,6 +609,10 @@ class HtmlParse {
 
  private:
   void ApplyFilterHelper(HtmlFilter* filter);
+  // Aggregates the relevant elements of the event listeners with those
+  // collected from the filters in CheckFilterBehavior, and enables
+  // passthrough lexing if they all opted in.
+  void ConfigurePassthrough();
   HtmlEventListIterator Last();  // Last element in queue
   bool IsInEventWindow(const HtmlEventListIterator& iter) const;
   void InsertNodeBeforeEvent(const HtmlEventListIterator& event,
@@ -659,6 +678,11 @@ class HtmlParse {
   bool log_rewrite_timing_;  // Should we time the speed of parsing?
   bool running_filters_;
   bool buffer_events_;
+  bool allow_passthrough_;
+  bool passthrough_possible_;
+  bool passthrough_active_;
+  // Union of the elements declared by enabled filters and event listeners.
+  std::vector<HtmlName::Keyword> passthrough_keywords_;
   int64 parse_start_time_us_;
   scoped_ptr<HtmlEvent> delayed_start_literal_;
   Timer* timer_;
@@ -1980,7 +1980,7 @@ TEST_F(AttributeManipulationTest, ModifyAttribute) {
   EXPECT_TRUE(href != NULL);
   href->SetValue("google");
   href->set_quote_style(HtmlElement::SINGLE_QUOTE);
-  html_parse_.SetAttributeName(href, HtmlName::kSrc);
+  html_parse_.SetAttributeName(node_, href, HtmlName::kSrc);
   CheckExpected("<a src='google' id=37 class='search!' selected />");
 }
 
@@ -1991,7 +1991,7 @@ TEST_F(AttributeManipulationTest, ModifyKeepAttribute) {
   // This apparently do-nothing call to SetValue exposed an allocation bug.
   href->SetValue(href->DecodedValueOrNull());
   href->set_quote_style(href->quote_style());
-  href->set_name(href->name());
+  node_->SetAttributeName(href, href->name());
   CheckExpected("<a href=\"http://www.google.com/\" id=37 class='search!'"
                 " selected />");
 }
@@ -2037,6 +2037,85 @@ TEST_F(AttributeManipulationTest, CloneElement) {
                 " selected />");
 }
 
+TEST_F(AttributeManipulationTest, DecodedValueAliasesEscapedValue) {
+  // Values that need no decoding share storage with the escaped value.
+  HtmlElement::Attribute* id = node_->FindAttribute(HtmlName::kId);
+  ASSERT_TRUE(id != NULL);
+  EXPECT_EQ(id->escaped_value(), id->DecodedValueOrNull());
+  EXPECT_FALSE(id->decoding_error());
+
+  id->SetEscapedValue("a&amp;b");
+  EXPECT_STREQ("a&b", id->DecodedValueOrNull());
+  EXPECT_NE(id->escaped_value(), id->DecodedValueOrNull());
+
+  id->SetEscapedValue("mu\xf1" "ecos");
+  EXPECT_TRUE(id->DecodedValueOrNull() == NULL);
+  EXPECT_TRUE(id->decoding_error());
+
+  // Setting a value from a substring of its aliased decoded value is safe.
+  id->SetEscapedValue("  37  ");
+  id->SetValue(StringPiece(id->DecodedValueOrNull() + 2, 2));
+  EXPECT_STREQ("37", id->DecodedValueOrNull());
+  EXPECT_STREQ("37", id->escaped_value());
+}
+
+TEST_F(AttributeManipulationTest, FindAttributeOnManyAttributes) {
+  static const HtmlName::Keyword kExtra[] = {
+    HtmlName::kAlt, HtmlName::kDir, HtmlName::kLang, HtmlName::kName,
+    HtmlName::kRel, HtmlName::kStyle, HtmlName::kTitle,
+  };
+  for (int i = 0, n = arraysize(kExtra); i < n; ++i) {
+    html_parse_.AddAttribute(node_, kExtra[i], IntegerToString(i));
+  }
+  // Duplicate of an existing attribute; lookups return the first.
+  html_parse_.AddAttribute(node_, HtmlName::kId, "dup");
+  ASSERT_EQ(12, NumAttributes(node_));
+
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int i = 0, n = arraysize(kExtra); i < n; ++i) {
+      EXPECT_STREQ(IntegerToString(i).c_str(),
+                   node_->AttributeValue(kExtra[i]));
+    }
+    EXPECT_STREQ("37", node_->AttributeValue(HtmlName::kId));
+    EXPECT_TRUE(node_->FindAttribute(HtmlName::kSrc) == NULL);
+    EXPECT_TRUE(node_->FindAttribute(HtmlName::kNotAKeyword) == NULL);
+  }
+
+  // Renames and deletions are reflected in subsequent lookups.
+  html_parse_.SetAttributeName(node_, node_->FindAttribute(HtmlName::kHref),
+                               HtmlName::kSrc);
+  EXPECT_TRUE(node_->FindAttribute(HtmlName::kHref) == NULL);
+  EXPECT_STREQ("http://www.google.com/", node_->AttributeValue(HtmlName::kSrc));
+  EXPECT_TRUE(node_->DeleteAttribute(HtmlName::kId));
+  EXPECT_STREQ("dup", node_->AttributeValue(HtmlName::kId));
+
+  HtmlElement::AttributeList* attrs = node_->mutable_attributes();
+  for (HtmlElement::AttributeIterator i(attrs->begin()); i != attrs->end();) {
+    if (i->keyword() == HtmlName::kLang) {
+      attrs->Erase(&i);
+    } else {
+      ++i;
+    }
+  }
+  EXPECT_TRUE(node_->FindAttribute(HtmlName::kLang) == NULL);
+  EXPECT_STREQ("0", node_->AttributeValue(HtmlName::kAlt));
+
+  // Values changed through attributes_begin() are seen through the index,
+  // and EraseAttribute drops the erased attribute from it.
+  for (HtmlElement::AttributeIterator i(node_->attributes_begin());
+       i != node_->attributes_end();) {
+    if (i->keyword() == HtmlName::kDir) {
+      node_->EraseAttribute(&i);
+    } else {
+      i->SetValue("x");
+      ++i;
+    }
+  }
+  EXPECT_TRUE(node_->FindAttribute(HtmlName::kDir) == NULL);
+  EXPECT_STREQ("x", node_->AttributeValue(HtmlName::kAlt));
+  EXPECT_STREQ("x", node_->AttributeValue(HtmlName::kTitle));
+}
+
 TEST_F(HtmlParseTest, NoDisabledFilter) {
   std::vector<GoogleString> disabled_filters;
   ASSERT_TRUE(disabled_filters.empty());
@@ -3216,4 +3295,61 @@ TEST_F(HtmlParseTestNoBody, InsertExternalScriptAfterEndOfHead) {
 }
 
 
+namespace {
+
+// Annotating filter that declares interest only in <img>, letting the
+// parser pass through every other tag as characters.
+class ImgOnlyAnnotatingFilter : public AnnotatingHtmlFilter {
+ public:
+  virtual bool GetRelevantElements(
+      std::vector<HtmlName::Keyword>* keywords) const {
+    keywords->push_back(HtmlName::kImg);
+    return true;
+  }
+};
+
+}  // namespace
+
+class HtmlPassthroughTest : public HtmlParseTestNoBody {
+ protected:
+  virtual void SetUp() {
+    HtmlParseTestNoBody::SetUp();
+    html_parse_.set_allow_passthrough(true);
+    html_parse_.AddFilter(&annotation_);
+  }
+
+  virtual bool AddHtmlTags() const { return false; }
+
+  ImgOnlyAnnotatingFilter annotation_;
+};
+
+TEST_F(HtmlPassthroughTest, IrrelevantTagsBecomeCharacters) {
+  ValidateNoChanges("passthrough",
+                    "<div class=\"a\"><p>x</p><img src=a.png></div>");
+  EXPECT_TRUE(html_parse_.passthrough_active());
+  EXPECT_EQ("'<div class=\"a\"><p>x</p>' +img:src=a.png -img(i) '</div>'",
+            annotation_.buffer());
+}
+
+TEST_F(HtmlPassthroughTest, QuotedGreaterThanInPassthroughTag) {
+  ValidateNoChanges("quoted_gt", "<a title=\"1>0\" href='>'>x</a><img>");
+  EXPECT_EQ("'<a title=\"1>0\" href='>'>x</a>' +img -img(i)",
+            annotation_.buffer());
+}
+
+TEST_F(HtmlPassthroughTest, LiteralTagsAreStillLexed) {
+  ValidateNoChanges("script",
+                    "<p><script>var s = '<img src=x>';</script></p>");
+  EXPECT_EQ("'<p>' +script 'var s = '<img src=x>';' -script(e) '</p>'",
+            annotation_.buffer());
+}
+
+TEST_F(HtmlPassthroughTest, DisabledWhenAFilterNeedsAllElements) {
+  AnnotatingHtmlFilter everything;
+  html_parse_.AddFilter(&everything);
+  ValidateNoChanges("no_passthrough", "<div><img></div>");
+  EXPECT_FALSE(html_parse_.passthrough_active());
+  EXPECT_EQ("+div +img -img(i) -div(e)", annotation_.buffer());
+}
+
 }  // namespace net_instaweb
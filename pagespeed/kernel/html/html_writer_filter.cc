@@ -77,6 +77,13 @@ void HtmlWriterFilter::EmitBytes(const StringPiece& str) {
   }
 }
 
+bool HtmlWriterFilter::GetRelevantElements(
+    std::vector<HtmlName::Keyword>* keywords) const {
+  // Passed-through tags are written verbatim, so we can only allow that
+  // when we would not have reformatted them.
+  return !case_fold_ && (max_column_ <= 0);
+}
+
 void HtmlWriterFilter::EmitName(const HtmlName& name) {
   if (case_fold_) {
     name.value().CopyToString(&case_fold_buffer_);
@@ -21,6 +21,8 @@
 #ifndef PAGESPEED_KERNEL_HTML_HTML_WRITER_FILTER_H_
 #define PAGESPEED_KERNEL_HTML_HTML_WRITER_FILTER_H_
 
+#include <vector>
+
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
@@ -56,6 +58,8 @@ class HtmlWriterFilter : public HtmlFilter {
   // This filter will not change urls.
   virtual bool CanModifyUrls() { return false; }
   ScriptUsage GetScriptUsage() const override { return kNeverInjectsScripts; }
+  bool GetRelevantElements(
+      std::vector<HtmlName::Keyword>* keywords) const override;
 
   void set_max_column(int max_column) { max_column_ = max_column; }
   void set_case_fold(bool case_fold) { case_fold_ = case_fold; }
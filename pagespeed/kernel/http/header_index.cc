@@ -0,0 +1,135 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/http/header_index.h"
+
+#include <algorithm>
+
+namespace net_instaweb {
+
+HeaderIndex::HeaderIndex() {
+}
+
+HeaderIndex::~HeaderIndex() {
+  Clear();
+}
+
+void HeaderIndex::Clear() {
+  for (int i = 0, n = entries_.size(); i < n; ++i) {
+    if (entries_[i].owned) {
+      delete entries_[i].value;
+    }
+  }
+  hashes_.clear();
+  entries_.clear();
+}
+
+uint32 HeaderIndex::HashName(StringPiece name) {
+  // 32-bit FNV-1a.  Header names are short tokens, so this is cheaper than
+  // anything that needs a setup phase.
+  uint32 hash = 2166136261U;
+  for (size_t i = 0, n = name.size(); i < n; ++i) {
+    hash ^= static_cast<uint8>(LowerChar(name[i]));
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+void HeaderIndex::Add(StringPiece name, const GoogleString* value) {
+  hashes_.push_back(HashName(name));
+  entries_.push_back(Entry(name, value, false));
+}
+
+void HeaderIndex::AddCopy(StringPiece name, StringPiece value) {
+  hashes_.push_back(HashName(name));
+  entries_.push_back(
+      Entry(name, new GoogleString(value.data(), value.size()), true));
+}
+
+int HeaderIndex::Find(StringPiece name, uint32 hash, int start) const {
+  const uint32* hashes = hashes_.data();
+  for (int i = start, n = hashes_.size(); i < n; ++i) {
+    if ((hashes[i] == hash) && StringCaseEqual(entries_[i].name, name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool HeaderIndex::Lookup(StringPiece name,
+                         ConstStringStarVector* values) const {
+  uint32 hash = HashName(name);
+  int i = Find(name, hash, 0);
+  if (i < 0) {
+    return false;
+  }
+  values->clear();
+  for (; i >= 0; i = Find(name, hash, i + 1)) {
+    values->push_back(entries_[i].value);
+  }
+  return true;
+}
+
+bool HeaderIndex::Has(StringPiece name) const {
+  return Find(name, HashName(name), 0) >= 0;
+}
+
+bool HeaderIndex::RemoveAllFromSortedArray(const StringPiece* names,
+                                           int names_size) {
+  StringCompareInsensitive compare;
+  int out = 0;
+  for (int in = 0, n = entries_.size(); in < n; ++in) {
+    const Entry& entry = entries_[in];
+    if (std::binary_search(names, names + names_size, entry.name, compare)) {
+      if (entry.owned) {
+        delete entry.value;
+      }
+    } else {
+      if (in != out) {
+        hashes_[out] = hashes_[in];
+        entries_[out] = entry;
+      }
+      ++out;
+    }
+  }
+  bool removed_anything = (out != static_cast<int>(entries_.size()));
+  hashes_.resize(out);
+  entries_.erase(entries_.begin() + out, entries_.end());
+  return removed_anything;
+}
+
+int HeaderIndex::num_names() const {
+  // Count the entries whose name did not appear earlier.  Quadratic, but
+  // only used for diagnostics and headers are few.
+  int count = 0;
+  for (int i = 0, n = entries_.size(); i < n; ++i) {
+    bool seen = false;
+    for (int j = 0; !seen && (j < i); ++j) {
+      seen = (hashes_[j] == hashes_[i]) &&
+          StringCaseEqual(entries_[j].name, entries_[i].name);
+    }
+    if (!seen) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+}  // namespace net_instaweb
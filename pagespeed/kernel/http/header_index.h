@@ -0,0 +1,104 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_HTTP_HEADER_INDEX_H_
+#define PAGESPEED_KERNEL_HTTP_HEADER_INDEX_H_
+
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Case-insensitive lookup index for HTTP headers whose name and value
+// strings are owned elsewhere -- in practice by the Headers protobuf.
+//
+// It records, for each value, a hash of the lower-cased header name and a
+// pointer to the value, so building it copies no strings (unlike a
+// StringMultiMapInsensitive, which keeps its own copy of every name and
+// value).  The hashes are kept in their own contiguous array: a lookup
+// hashes the requested name once and scans that array, and only compares
+// strings, case-insensitively, on a hash match.  For the few dozen headers
+// a message carries that is faster than a tree or hash map.
+//
+// Values that are not stored verbatim elsewhere, e.g. the pieces of a
+// comma-separated Cache-Control, are copied in via AddCopy.
+//
+// Pointers passed in must remain valid until they are removed, or until
+// Clear() or destruction.
+class HeaderIndex {
+ public:
+  HeaderIndex();
+  ~HeaderIndex();
+
+  void Clear();
+
+  // Hash of name with ASCII letters folded to lower case.
+  static uint32 HashName(StringPiece name);
+
+  // Adds value under name.  Neither is copied.
+  void Add(StringPiece name, const GoogleString* value);
+
+  // Adds a copy of value under name.  name is not copied.
+  void AddCopy(StringPiece name, StringPiece value);
+
+  // If there are any values for name, replaces *values with them, in the
+  // order they were added, and returns true.  Otherwise leaves *values
+  // alone and returns false.  This matches StringMultiMap::Lookup.
+  bool Lookup(StringPiece name, ConstStringStarVector* values) const;
+
+  bool Has(StringPiece name) const;
+
+  // Removes all values for the names in the array, which must be sorted
+  // with StringCompareInsensitive.  Values for other names, including
+  // pointers previously returned by Lookup, are unaffected.  Returns true
+  // if anything was removed.
+  bool RemoveAllFromSortedArray(const StringPiece* names, int names_size);
+
+  // Number of distinct names, ignoring case.
+  int num_names() const;
+
+  // Number of values, which can be larger than num_names.
+  int num_values() const { return hashes_.size(); }
+
+ private:
+  struct Entry {
+    Entry(StringPiece n, const GoogleString* v, bool o)
+        : name(n), value(v), owned(o) {}
+    StringPiece name;
+    const GoogleString* value;
+    bool owned;  // value was created by AddCopy.
+  };
+
+  // Returns the index of the first entry at or after start whose name
+  // matches name (which hashes to hash), or -1.
+  int Find(StringPiece name, uint32 hash, int start) const;
+
+  std::vector<uint32> hashes_;  // Parallel to entries_.
+  std::vector<Entry> entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(HeaderIndex);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_HTTP_HEADER_INDEX_H_
@@ -0,0 +1,128 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/http/header_index.h"
+
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class HeaderIndexTest : public testing::Test {
+ protected:
+  HeaderIndexTest()
+      : chunked_("chunked"),
+        cookie1_("a=1"),
+        cookie2_("b=2") {
+    index_.Add("Transfer-Encoding", &chunked_);
+    index_.Add("Set-Cookie", &cookie1_);
+    index_.Add("set-cookie", &cookie2_);
+  }
+
+  GoogleString chunked_;
+  GoogleString cookie1_;
+  GoogleString cookie2_;
+  HeaderIndex index_;
+};
+
+TEST_F(HeaderIndexTest, HashIgnoresCase) {
+  EXPECT_EQ(HeaderIndex::HashName("content-type"),
+            HeaderIndex::HashName("Content-Type"));
+  EXPECT_NE(HeaderIndex::HashName("Content-Type"),
+            HeaderIndex::HashName("Content-Length"));
+}
+
+TEST_F(HeaderIndexTest, Lookup) {
+  ConstStringStarVector values;
+  ASSERT_TRUE(index_.Lookup("TRANSFER-ENCODING", &values));
+  ASSERT_EQ(1, values.size());
+  EXPECT_EQ(&chunked_, values[0]);  // Not copied.
+
+  ASSERT_TRUE(index_.Lookup("Set-Cookie", &values));
+  ASSERT_EQ(2, values.size());
+  EXPECT_EQ("a=1", *values[0]);
+  EXPECT_EQ("b=2", *values[1]);
+
+  EXPECT_TRUE(index_.Has("transfer-encoding"));
+  EXPECT_FALSE(index_.Has("Transfer"));
+  EXPECT_FALSE(index_.Has(""));
+}
+
+TEST_F(HeaderIndexTest, MissLeavesValuesAlone) {
+  ConstStringStarVector values;
+  values.push_back(&chunked_);
+  EXPECT_FALSE(index_.Lookup("Vary", &values));
+  ASSERT_EQ(1, values.size());
+  EXPECT_EQ(&chunked_, values[0]);
+}
+
+TEST_F(HeaderIndexTest, AddCopy) {
+  GoogleString cache_control("max-age=0, no-cache");
+  StringPiece whole(cache_control);
+  index_.AddCopy("Cache-Control", whole.substr(0, 9));
+  index_.AddCopy("Cache-Control", whole.substr(11));
+  cache_control.clear();
+
+  ConstStringStarVector values;
+  ASSERT_TRUE(index_.Lookup("cache-control", &values));
+  ASSERT_EQ(2, values.size());
+  EXPECT_EQ("max-age=0", *values[0]);
+  EXPECT_EQ("no-cache", *values[1]);
+}
+
+TEST_F(HeaderIndexTest, RemoveAllFromSortedArray) {
+  index_.AddCopy("Vary", "Accept-Encoding");
+  ConstStringStarVector vary;
+  ASSERT_TRUE(index_.Lookup("Vary", &vary));
+
+  StringPiece names[] = {"Connection", "set-cookie", "Transfer-Encoding"};
+  EXPECT_TRUE(index_.RemoveAllFromSortedArray(names, arraysize(names)));
+  EXPECT_FALSE(index_.RemoveAllFromSortedArray(names, arraysize(names)));
+  EXPECT_FALSE(index_.Has("Set-Cookie"));
+  EXPECT_FALSE(index_.Has("Transfer-Encoding"));
+  EXPECT_EQ(1, index_.num_values());
+
+  // Values for other names survive the removal.
+  ConstStringStarVector values;
+  ASSERT_TRUE(index_.Lookup("vary", &values));
+  ASSERT_EQ(1, values.size());
+  EXPECT_EQ(vary[0], values[0]);
+  EXPECT_EQ("Accept-Encoding", *values[0]);
+}
+
+TEST_F(HeaderIndexTest, Counts) {
+  EXPECT_EQ(2, index_.num_names());
+  EXPECT_EQ(3, index_.num_values());
+  index_.AddCopy("Vary", "Accept-Encoding");
+  EXPECT_EQ(3, index_.num_names());
+  EXPECT_EQ(4, index_.num_values());
+
+  index_.Clear();
+  EXPECT_EQ(0, index_.num_names());
+  EXPECT_EQ(0, index_.num_values());
+  EXPECT_FALSE(index_.Has("Set-Cookie"));
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
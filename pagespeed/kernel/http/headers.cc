@@ -32,9 +32,9 @@
 #include "pagespeed/kernel/base/proto_util.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
-#include "pagespeed/kernel/base/string_multi_map.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/writer.h"
+#include "pagespeed/kernel/http/header_index.h"
 #include "pagespeed/kernel/http/http.pb.h"
 #include "pagespeed/kernel/http/http_names.h"
 
@@ -138,10 +138,14 @@ template<class Proto> void Headers<Proto>::Clear() {
 
 template<class Proto> void Headers<Proto>::SetProto(Proto* proto) {
   proto_.reset(proto);
+  map_.reset(NULL);
+  cookies_.reset(NULL);
 }
 
 template<class Proto> void Headers<Proto>::CopyProto(const Proto& proto) {
   proto_->CopyFrom(proto);
+  map_.reset(NULL);
+  cookies_.reset(NULL);
 }
 
 template<class Proto> int Headers<Proto>::major_version() const {
@@ -186,7 +190,7 @@ template<class Proto> void Headers<Proto>::SetValue(int i, StringPiece value) {
 
 template<class Proto> void Headers<Proto>::PopulateMap() const {
   if (map_.get() == NULL) {
-    map_.reset(new StringMultiMapInsensitive);
+    map_.reset(new HeaderIndex);
     cookies_.reset(NULL);
     for (int i = 0, n = NumAttributes(); i < n; ++i) {
       AddToMap(Name(i), Value(i));
@@ -314,17 +318,21 @@ template<class Proto> void Headers<Proto>::Add(
   NameValue* name_value = proto_->add_header();
   name_value->set_name(name.data(), name.size());
   name_value->set_value(value.data(), value.size());
-  AddToMap(name, value);
+  AddToMap(name_value->name(), name_value->value());
   UpdateHook();
 }
 
 template<class Proto> void Headers<Proto>::AddToMap(
-    const StringPiece& name, const StringPiece& value) const {
+    const GoogleString& name, const GoogleString& value) const {
   if (map_.get() != NULL) {
     StringPieceVector split;
     SplitValues(name, value, &split);
-    for (int i = 0, n = split.size(); i < n; ++i) {
-      map_->Add(name, split[i]);
+    if ((split.size() == 1) && (split[0].size() == value.size())) {
+      map_->Add(name, &value);  // The common case: nothing to copy.
+    } else {
+      for (int i = 0, n = split.size(); i < n; ++i) {
+        map_->AddCopy(name, split[i]);
+      }
     }
     cookies_.reset(NULL);  // Pessimistically assume this.
   }
@@ -418,32 +426,20 @@ template<class Proto> bool Headers<Proto>::RemoveAll(const StringPiece& name) {
 
 template<class Proto> bool Headers<Proto>::RemoveAllFromSortedArray(
     const StringPiece* names, int names_size) {
-  // First, we update the map.
-  PopulateMap();
-  bool removed_anything = map_->RemoveAllFromSortedArray(names, names_size);
+  // First, we update the map, if present, while the strings it refers to
+  // are intact.
+  if (map_.get() != NULL) {
+    map_->RemoveAllFromSortedArray(names, names_size);
+  }
 
-  // If we removed anything, we update the proto as well.
+  // Then we remove the headers from the proto.  This reorders the proto by
+  // swapping element pointers, so the strings of the headers we keep don't
+  // move and the map remains valid without being rebuilt.  Callers rely on
+  // that: e.g. ResponseHeaders::Sanitize holds values from
+  // Lookup(Connection) while removing other headers.
+  bool removed_anything =
+      RemoveFromHeaders(names, names_size, proto_->mutable_header());
   if (removed_anything) {
-    // Remove all headers that are slated for removal.
-    protobuf::RepeatedPtrField<NameValue>* headers = proto_->mutable_header();
-    // Note: you might be tempted to consider repopulating the protobuf
-    // from the map, which should be correct at this point, rather
-    // than doing more searches.  This is feasible, but will result in
-    // splitting multi-value entries into separate headers, e.g.
-    // Cache-Control:max-age=0, no-cache will become two separate Cache-Control
-    // entries, which will cause
-    // ResponseHeadersTest.TestRemoveDoesntSeparateCommaValues to fail.
-    // headers->Clear();
-    // for (int i = 0; i < map_->num_values(); ++i) {
-    //   NameValue* name_value = proto_->add_header();
-    //   name_value->set_name(map_->name(i));
-    //   const GoogleString* value = map_->value(i);
-    //   name_value->set_value(value->data(), value->size());
-    // }
-    //
-    // Instead, we call this helper, which re-implements StringMultiMap
-    // functionality in the protobuf.
-    RemoveFromHeaders(names, names_size, headers);
     cookies_.reset(NULL);  // Pessimistically assume this.
     UpdateHook();
   }
@@ -30,12 +30,12 @@
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/http/header_index.h"
 
 namespace net_instaweb {
 
 class MessageHandler;
 class NameValue;
-class StringMultiMapInsensitive;
 class Writer;
 
 // Read/write API for HTTP headers (shared base class)
@@ -230,19 +230,22 @@ template<class Proto> class Headers {
   // const is a lie
   // NOTE: the map will contain the comma-split values, but the protobuf
   // will contain the original pairs including comma-separated values.
-  void AddToMap(const StringPiece& name, const StringPiece& value) const;
-
-  // We have two representations for the name/value pairs.  Proto contains a
-  // simple string-pair vector, but lacks a fast associative lookup.  So we
-  // will build structures for associative lookup lazily, and keep them
-  // up-to-date if they are present.
-  mutable scoped_ptr<StringMultiMapInsensitive> map_;
+  // name and value must be the strings held in proto_, as the map refers
+  // to them rather than copying them.
+  void AddToMap(const GoogleString& name, const GoogleString& value) const;
+
+  // Proto contains a simple string-pair vector, but lacks a fast
+  // associative lookup.  So we build an index over the proto's strings
+  // lazily, and keep it up-to-date as headers are added.  Any other
+  // mutation of the proto's headers must reset it.
+  mutable scoped_ptr<HeaderIndex> map_;
   scoped_ptr<Proto> proto_;
 
   // Furthermore, we also have a map of cookie names to <value, attributes>.
   // It is lazilyloaded by PopulateCookieMap as/when required. The keys and
-  // values all point into the map_ data element. We cater for the same cookie
-  // being set multiple times though we don't necessarily handle that correctly.
+  // values all point into the proto_ header values. We cater for the same
+  // cookie being set multiple times though we don't necessarily handle that
+  // correctly.
   mutable scoped_ptr<CookieMultimap> cookies_;
 
   DISALLOW_COPY_AND_ASSIGN(Headers);
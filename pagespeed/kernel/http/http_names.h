@@ -43,6 +43,7 @@ struct HttpAttributes {
   static const char kAlternateProtocol[];
   static const char kAttachment[];
   static const char kAuthorization[];
+  static const char kBrotli[];
   static const char kCacheControl[];
   static const char kConnection[];
   static const char kContentEncoding[];
@@ -220,6 +220,7 @@ void ResponseHeaders::Clear() {
   proto->clear_reason_phrase();
   proto->clear_header();
   proto->clear_is_implicitly_cacheable();
+  proto->clear_caching_summary();
   cache_fields_dirty_ = false;
   force_cache_ttl_ms_ = -1;
   force_cached_ = false;
@@ -430,6 +431,21 @@ bool ResponseHeaders::IsProxyCacheable(
     return false;
   }
 
+  if (HasCachingSummary()) {
+    // Equivalent to the header checks below.
+    const HttpCachingSummary& summary = proto()->caching_summary();
+    bool cookie_vary_ok = summary.html_like() &&
+        (has_request_validator == kHasValidator);
+    return (!req_properties.has_authorization ||
+            summary.cache_control_public()) &&
+        (!summary.vary_cookie() ||
+         (cookie_vary_ok && !req_properties.has_cookie)) &&
+        (!summary.vary_cookie2() ||
+         (cookie_vary_ok && !req_properties.has_cookie2)) &&
+        (!summary.vary_other() ||
+         ((respect_vary == kIgnoreVaryOnResources) && !summary.html_like()));
+  }
+
   // For something requested with authorization to be cacheable, it must
   // either  be something that goes through revalidation (which we currently
   // do not do) or something that has a Cache-Control: public.
@@ -549,6 +565,10 @@ void ResponseHeaders::SetOriginalContentLength(int64 content_length) {
 }
 
 bool ResponseHeaders::Sanitize() {
+  if (HasCachingSummary() && !proto()->caching_summary().needs_sanitize()) {
+    return false;
+  }
+
   ConstStringStarVector v;
   bool changed = false;
 
@@ -815,9 +835,49 @@ void ResponseHeaders::ComputeCaching() {
     proto->set_expiration_time_ms(0);
     proto->set_proxy_cacheable(false);
   }
+  ComputeCachingSummary();
   cache_fields_dirty_ = false;
 }
 
+void ResponseHeaders::ComputeCachingSummary() {
+  HttpCachingSummary* summary = mutable_proto()->mutable_caching_summary();
+  summary->Clear();
+  summary->set_html_like(IsHtmlLike());
+  summary->set_cache_control_public(
+      HasValue(HttpAttributes::kCacheControl, "public"));
+
+  ConstStringStarVector values;
+  Lookup(HttpAttributes::kVary, &values);
+  for (int i = 0, n = values.size(); i < n; ++i) {
+    StringPiece val(*values[i]);
+    if (val.empty() || StringCaseEqual(HttpAttributes::kAcceptEncoding, val)) {
+      continue;
+    } else if (StringCaseEqual(HttpAttributes::kCookie, val)) {
+      summary->set_vary_cookie(true);
+    } else if (StringCaseEqual(HttpAttributes::kCookie2, val)) {
+      summary->set_vary_cookie2(true);
+    } else {
+      summary->set_vary_other(true);
+    }
+  }
+
+  // Sanitize removes the hop-by-hop headers, which include Connection, and
+  // anything named in Connection.  So if none are present it is a no-op.
+  const StringPieceVector& hop_by_hop = HttpAttributes::SortedHopByHopHeaders();
+  StringCompareInsensitive compare;
+  for (int i = 0, n = NumAttributes(); i < n; ++i) {
+    if (std::binary_search(hop_by_hop.begin(), hop_by_hop.end(),
+                           StringPiece(Name(i)), compare)) {
+      summary->set_needs_sanitize(true);
+      break;
+    }
+  }
+}
+
+bool ResponseHeaders::HasCachingSummary() const {
+  return !cache_fields_dirty_ && proto()->has_caching_summary();
+}
+
 GoogleString ResponseHeaders::CacheControlValuesToPreserve() {
   GoogleString to_preserve;
   if (HasValue(HttpAttributes::kCacheControl, "no-transform")) {
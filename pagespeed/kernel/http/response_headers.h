@@ -110,8 +110,17 @@ class ResponseHeaders : public Headers<HttpResponseHeaders> {
   // the absolute time when a cache resource will expire.  The timestamp
   // is in milliseconds since 1970.  It is an error to call any of the
   // accessors before ComputeCaching is called.
+  //
+  // This also records a summary of the header values that IsProxyCacheable
+  // and Sanitize depend on.  It is serialized with the headers, so headers
+  // read back from the cache can answer those without header lookups.
   void ComputeCaching();
 
+  // Returns true if the caching summary recorded by ComputeCaching is
+  // present and current.  It is absent from headers serialized before the
+  // summary was introduced.
+  bool HasCachingSummary() const;
+
   // Returns true if these response headers indicate the response is
   // publicly cacheable if it was fetched w/o special authorization
   // headers.
@@ -411,6 +420,9 @@ class ResponseHeaders : public Headers<HttpResponseHeaders> {
   // Returns true if the headers were changed.
   bool CombineContentTypes(const StringPiece& orig, const StringPiece& fresh);
 
+  // Records the caching summary; called at the end of ComputeCaching.
+  void ComputeCachingSummary();
+
   friend class ResponseHeadersTest;
   bool cache_fields_dirty_;
 
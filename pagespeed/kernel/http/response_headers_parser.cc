@@ -21,6 +21,8 @@
 
 #include "pagespeed/kernel/http/response_headers_parser.h"
 
+#include <cstring>
+
 #include "base/logging.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/string.h"
@@ -30,9 +32,8 @@
 namespace net_instaweb {
 
 void ResponseHeadersParser::Clear() {
-  parsing_http_ = false;
-  parsing_value_ = false;
   headers_complete_ = false;
+  partial_line_.clear();
 }
 
 // TODO(jmaessen): http://www.w3.org/Protocols/rfc2616/rfc2616-sec4.html#sec4.2
@@ -42,51 +43,85 @@ void ResponseHeadersParser::Clear() {
 int ResponseHeadersParser::ParseChunk(const StringPiece& text,
                                       MessageHandler* handler) {
   CHECK(!headers_complete_);
-  int num_consumed = 0;
-  int num_bytes = text.size();
+  const char* data = text.data();
+  size_t size = text.size();
+  size_t pos = 0;
 
-  for (; num_consumed < num_bytes; ++num_consumed) {
-    char c = text[num_consumed];
-    if ((c == '/') && (parse_name_ == "HTTP")) {
-      if (response_headers_->has_major_version()) {
-        handler->MessageS(kError, "Multiple HTTP Lines");
-      } else {
-        parsing_http_ = true;
-        parsing_value_ = true;
-      }
-    } else if (!parsing_value_ && (c == ':')) {
-      parsing_value_ = true;
-    } else if (c == '\r') {
-      // Just ignore CRs for now, and break up headers on newlines for
-      // simplicity.  It's not clear to me if it's important that we
-      // reject headers that lack the CR in front of the LF.
-    } else if (c == '\n') {
-      if (parse_name_.empty()) {
-        // blank line.  This marks the end of the headers.
-        ++num_consumed;
-        headers_complete_ = true;
-        response_headers_->ComputeCaching();
-        break;
-      }
-      if (parsing_http_) {
-        response_headers_->ParseFirstLineHelper(parse_value_);
-        parsing_http_ = false;
-      } else {
-        response_headers_->Add(parse_name_, parse_value_);
-      }
-      parsing_value_ = false;
-      parse_name_.clear();
-      parse_value_.clear();
-    } else if (parsing_value_) {
-      // Skip leading whitespace (form feeds don't count, unlike html)
-      if (!parse_value_.empty() || !IsHtmlSpace(c) || c == '\f') {
-        parse_value_ += c;
-      }
+  while (pos < size) {
+    const char* newline =
+        static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+    if (newline == NULL) {
+      partial_line_.append(data + pos, size - pos);
+      pos = size;
+      break;
+    }
+    size_t line_end = newline - data;
+    StringPiece line(data + pos, line_end - pos);
+    pos = line_end + 1;
+
+    bool end_of_headers;
+    if (partial_line_.empty()) {
+      end_of_headers = ParseLine(line, handler);
     } else {
-      parse_name_ += c;
+      line.AppendToString(&partial_line_);
+      end_of_headers = ParseLine(partial_line_, handler);
+      partial_line_.clear();
+    }
+    if (end_of_headers) {
+      headers_complete_ = true;
+      response_headers_->ComputeCaching();
+      break;
+    }
+  }
+  return pos;
+}
+
+bool ResponseHeadersParser::ParseLine(StringPiece line,
+                                      MessageHandler* handler) {
+  // Just ignore CRs for now, and break up headers on newlines for
+  // simplicity.  It's not clear to me if it's important that we
+  // reject headers that lack the CR in front of the LF.
+  GoogleString without_cr;
+  if (memchr(line.data(), '\r', line.size()) != NULL) {
+    for (size_t i = 0; i < line.size(); ++i) {
+      if (line[i] != '\r') {
+        without_cr.push_back(line[i]);
+      }
+    }
+    line = without_cr;
+  }
+
+  StringPiece value;
+  bool first_line = line.starts_with("HTTP/");
+  if (first_line) {
+    if (response_headers_->has_major_version()) {
+      handler->MessageS(kError, "Multiple HTTP Lines");
+      return false;
     }
+    value = line.substr(STATIC_STRLEN("HTTP/"));
+  } else {
+    const char* colon =
+        static_cast<const char*>(memchr(line.data(), ':', line.size()));
+    if (colon != NULL) {
+      value = line.substr(colon - line.data() + 1);
+      line = line.substr(0, colon - line.data());
+    }
+    if (line.empty()) {
+      // blank line.  This marks the end of the headers.
+      return true;
+    }
+  }
+
+  // Skip leading whitespace (form feeds don't count, unlike html).
+  while (!value.empty() && ((value[0] == ' ') || (value[0] == '\t'))) {
+    value.remove_prefix(1);
+  }
+  if (first_line) {
+    response_headers_->ParseFirstLineHelper(value);
+  } else {
+    response_headers_->Add(line, value);
   }
-  return num_consumed;
+  return false;
 }
 
 }  // namespace net_instaweb
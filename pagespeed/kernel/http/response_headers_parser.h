@@ -32,6 +32,11 @@ class MessageHandler;
 class ResponseHeaders;
 
 // Parses a stream of HTTP header text into a ResponseHeaders instance.
+//
+// Text is processed a line at a time: line ends are located with memchr,
+// which the C library vectorizes, and each complete line is split at its
+// first colon without copying.  Only a line that straddles two chunks is
+// buffered.
 class ResponseHeadersParser {
  public:
   explicit ResponseHeadersParser(ResponseHeaders* rh) : response_headers_(rh) {
@@ -40,20 +45,22 @@ class ResponseHeadersParser {
 
   void Clear();
 
-  // Parse a chunk of HTTP response header.  Returns number of bytes consumed.
+  // Parse a chunk of HTTP response header.  Returns number of bytes consumed,
+  // which is less than text.size() only if the headers ended in this chunk.
   int ParseChunk(const StringPiece& text, MessageHandler* handler);
 
   bool headers_complete() const { return headers_complete_; }
   void set_headers_complete(bool x) { headers_complete_ = x; }
 
  private:
+  // Handles one line, excluding its terminating newline.  Returns true if
+  // it was the blank line that ends the headers.
+  bool ParseLine(StringPiece line, MessageHandler* handler);
+
   ResponseHeaders* response_headers_;
 
-  bool parsing_http_;
-  bool parsing_value_;
   bool headers_complete_;
-  GoogleString parse_name_;
-  GoogleString parse_value_;
+  GoogleString partial_line_;  // Start of a line split across chunks.
 
   DISALLOW_COPY_AND_ASSIGN(ResponseHeadersParser);
 };
@@ -0,0 +1,137 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Measures ResponseHeadersParser on a small corpus of origin response
+// headers of the kind seen in practice: an HTML page behind a CDN, a
+// static asset with validators, an image, and a redirect.  Each block is
+// parsed whole, and again in small chunks as it might arrive from a slow
+// origin, so that lines frequently straddle chunk boundaries.  Parsing
+// includes the ComputeCaching done when the headers are complete.  The
+// benchmark framework reports MB/s of header text.
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/benchmark.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/http/response_headers.h"
+#include "pagespeed/kernel/http/response_headers_parser.h"
+
+namespace {
+
+const char* kCorpus[] = {
+  "HTTP/1.1 200 OK\r\n"
+  "Date: Mon, 05 Apr 2010 18:49:46 GMT\r\n"
+  "Content-Type: text/html; charset=utf-8\r\n"
+  "Transfer-Encoding: chunked\r\n"
+  "Connection: keep-alive\r\n"
+  "Cache-Control: private, max-age=0, must-revalidate\r\n"
+  "Expires: -1\r\n"
+  "Vary: Accept-Encoding, User-Agent\r\n"
+  "Set-Cookie: PREF=ID=3935f510d83d2a7a:TM=1270493386:LM=1270493386; "
+  "expires=Wed, 04-Apr-2012 18:49:46 GMT; path=/; domain=.example.com\r\n"
+  "Set-Cookie: NID=33=aGkk7cKzznoUuCd19qTgXlBjXC8fc_luIo2Yk9BmrevUgXYP; "
+  "expires=Tue, 05-Oct-2010 18:49:46 GMT; path=/; HttpOnly\r\n"
+  "Strict-Transport-Security: max-age=31536000; includeSubDomains\r\n"
+  "X-Content-Type-Options: nosniff\r\n"
+  "X-Frame-Options: SAMEORIGIN\r\n"
+  "X-XSS-Protection: 1; mode=block\r\n"
+  "Content-Security-Policy: default-src 'self'; img-src *\r\n"
+  "Link: </static/site.css>; rel=preload; as=style\r\n"
+  "Server: nginx\r\n"
+  "Via: 1.1 varnish\r\n"
+  "X-Cache: MISS\r\n"
+  "X-Request-Id: 3f2a9c1e-7b4d-4e8a-9c3f-2d1b0a9e8f7c\r\n"
+  "\r\n",
+
+  "HTTP/1.1 200 OK\r\n"
+  "Date: Mon, 05 Apr 2010 18:49:46 GMT\r\n"
+  "Content-Type: text/css\r\n"
+  "Content-Length: 48213\r\n"
+  "Cache-Control: public, max-age=31536000, immutable\r\n"
+  "Last-Modified: Thu, 01 Apr 2010 12:00:00 GMT\r\n"
+  "Etag: \"5db1-4a16f1a0b8c00\"\r\n"
+  "Accept-Ranges: bytes\r\n"
+  "Age: 1234\r\n"
+  "Vary: Accept-Encoding\r\n"
+  "Access-Control-Allow-Origin: *\r\n"
+  "Timing-Allow-Origin: *\r\n"
+  "Server: ECS (sjc/4E5D)\r\n"
+  "X-Cache: HIT\r\n"
+  "\r\n",
+
+  "HTTP/1.1 200 OK\r\n"
+  "Date: Mon, 05 Apr 2010 18:49:46 GMT\r\n"
+  "Content-Type: image/png\r\n"
+  "Content-Length: 1734\r\n"
+  "Expires: Tue, 05 Apr 2011 18:49:46 GMT\r\n"
+  "Last-Modified: Thu, 01 Apr 2010 12:00:00 GMT\r\n"
+  "Cache-Control: max-age=31536000\r\n"
+  "Pragma: public\r\n"
+  "Server: Apache\r\n"
+  "\r\n",
+
+  "HTTP/1.1 301 Moved Permanently\r\n"
+  "Date: Mon, 05 Apr 2010 18:49:46 GMT\r\n"
+  "Location: https://www.example.com/\r\n"
+  "Content-Type: text/html; charset=iso-8859-1\r\n"
+  "Content-Length: 0\r\n"
+  "Cache-Control: max-age=3600\r\n"
+  "Server: Apache\r\n"
+  "\r\n",
+};
+
+void ParseCorpus(int iters, int chunk_size) {
+  net_instaweb::NullMessageHandler handler;
+  int64 bytes = 0;
+  for (int i = 0; i < iters; ++i) {
+    for (int j = 0, n = arraysize(kCorpus); j < n; ++j) {
+      net_instaweb::ResponseHeaders headers;
+      net_instaweb::ResponseHeadersParser parser(&headers);
+      StringPiece text(kCorpus[j]);
+      while (!parser.headers_complete() && !text.empty()) {
+        StringPiece chunk = text.substr(0, chunk_size);
+        text.remove_prefix(chunk.size());
+        parser.ParseChunk(chunk, &handler);
+      }
+      CHECK(parser.headers_complete());
+      bytes += strlen(kCorpus[j]);
+    }
+  }
+  SetBenchmarkBytesProcessed(bytes);
+}
+
+static void BM_ParseWhole(int iters) {
+  ParseCorpus(iters, 64 << 10);
+}
+
+static void BM_ParseInSmallChunks(int iters) {
+  ParseCorpus(iters, 37);
+}
+
+}  // namespace
+
+BENCHMARK(BM_ParseWhole);
+BENCHMARK(BM_ParseInSmallChunks);
@@ -155,6 +155,14 @@ class ResponseHeadersTest : public testing::Test {
     return response_headers_.cache_fields_dirty_;
   }
 
+  const HttpCachingSummary& CachingSummary(const ResponseHeaders& headers) {
+    return headers.proto()->caching_summary();
+  }
+
+  void ClearCachingSummary(ResponseHeaders* headers) {
+    headers->mutable_proto()->clear_caching_summary();
+  }
+
   bool IsProxyCacheable(const RequestHeaders& request_headers,
                         ResponseHeaders::VaryOption respect_vary) {
     return response_headers_.IsProxyCacheable(request_headers.GetProperties(),
@@ -301,6 +309,49 @@ TEST_F(ResponseHeadersTest, TestParseAndWrite) {
   CheckGoogleHeaders(response_headers3);
 }
 
+// Parse the same text split into chunks of every size, so that lines, CRLF
+// pairs, and the end of the headers each get split at every position.
+TEST_F(ResponseHeadersTest, TestParseInEveryChunkSize) {
+  const char kHttpData[] =
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type:text/html\r\n"
+      "Cache-Control: \t max-age=300, public\r\n"
+      "Link: <http://example.com/a.css>; rel=preload\n"
+      "X-Empty:\r\n"
+      "X-No-Colon\r\n"
+      "X-Trailing: space \r\n"
+      "Date: Mon, 05 Apr 2010 18:49:46 GMT\r\n"
+      "\r\n"
+      "<html>";
+  const StringPiece http_data(kHttpData, STATIC_STRLEN(kHttpData));
+  const int expected_consumed = http_data.find("<html>");
+
+  for (int chunk_size = 1, n = http_data.size(); chunk_size <= n;
+       ++chunk_size) {
+    ResponseHeaders headers;
+    ResponseHeadersParser parser(&headers);
+    int num_consumed = 0;
+    for (int i = 0; (i < n) && !parser.headers_complete(); i += chunk_size) {
+      num_consumed += parser.ParseChunk(http_data.substr(i, chunk_size),
+                                        &message_handler_);
+    }
+    ASSERT_TRUE(parser.headers_complete()) << chunk_size;
+    EXPECT_EQ(expected_consumed, num_consumed) << chunk_size;
+    EXPECT_EQ(200, headers.status_code());
+    EXPECT_STREQ("OK", headers.reason_phrase());
+    ASSERT_EQ(7, headers.NumAttributes()) << chunk_size;
+    EXPECT_STREQ("text/html", headers.Lookup1(HttpAttributes::kContentType));
+    EXPECT_EQ("max-age=300, public", headers.Value(1));
+    EXPECT_EQ("<http://example.com/a.css>; rel=preload", headers.Value(2));
+    EXPECT_TRUE(headers.Has("X-Empty"));
+    EXPECT_EQ("", headers.Value(3));
+    EXPECT_EQ("X-No-Colon", headers.Name(4));
+    EXPECT_EQ("", headers.Value(4));
+    EXPECT_EQ("space ", headers.Value(5));
+    EXPECT_EQ(300 * Timer::kSecondMs, headers.cache_ttl_ms());
+  }
+}
+
 TEST_F(ResponseHeadersTest, TestSizeEstimate) {
   GoogleString headers = StrCat(
       "HTTP/1.0 200 OK\r\n"
@@ -2203,4 +2254,120 @@ TEST_F(ResponseHeadersTest, TestHopByHopSanitization) {
   EXPECT_EQ("HTTP/1.0 0 (null)\r\nbar: baz\r\n\r\n", headers2.ToString());
 }
 
+TEST_F(ResponseHeadersTest, CachingSummaryComputed) {
+  EXPECT_FALSE(response_headers_.HasCachingSummary());
+  response_headers_.SetStatusAndReason(HttpStatus::kOK);
+  response_headers_.Add(HttpAttributes::kContentType, "text/html");
+  response_headers_.Add(HttpAttributes::kCacheControl, "public, max-age=300");
+  response_headers_.Add(HttpAttributes::kVary, "Cookie, User-Agent");
+  response_headers_.SetDate(MockTimer::kApr_5_2010_ms);
+  response_headers_.ComputeCaching();
+  ASSERT_TRUE(response_headers_.HasCachingSummary());
+  const HttpCachingSummary& summary = CachingSummary(response_headers_);
+  EXPECT_TRUE(summary.html_like());
+  EXPECT_TRUE(summary.cache_control_public());
+  EXPECT_TRUE(summary.vary_cookie());
+  EXPECT_FALSE(summary.vary_cookie2());
+  EXPECT_TRUE(summary.vary_other());
+  EXPECT_FALSE(summary.needs_sanitize());
+
+  // Any mutation makes the summary stale until ComputeCaching runs again.
+  response_headers_.Add(HttpAttributes::kTransferEncoding, "chunked");
+  EXPECT_FALSE(response_headers_.HasCachingSummary());
+  response_headers_.ComputeCaching();
+  ASSERT_TRUE(response_headers_.HasCachingSummary());
+  EXPECT_TRUE(CachingSummary(response_headers_).needs_sanitize());
+}
+
+TEST_F(ResponseHeadersTest, CachingSummaryMatchesHeaderLookups) {
+  const char* kContentTypes[] = { "text/html", "image/png" };
+  const char* kCacheControls[] = { "max-age=300", "public, max-age=300" };
+  const char* kVaries[] = {
+    "", "Accept-Encoding", "Cookie", "Cookie2", "Cookie, Cookie2",
+    "User-Agent", "Accept-Encoding, Cookie, User-Agent" };
+  for (int t = 0; t < arraysize(kContentTypes); ++t) {
+    for (int c = 0; c < arraysize(kCacheControls); ++c) {
+      for (int v = 0; v < arraysize(kVaries); ++v) {
+        ResponseHeaders headers;
+        headers.SetStatusAndReason(HttpStatus::kOK);
+        headers.Add(HttpAttributes::kContentType, kContentTypes[t]);
+        headers.Add(HttpAttributes::kCacheControl, kCacheControls[c]);
+        if (kVaries[v][0] != '\0') {
+          headers.Add(HttpAttributes::kVary, kVaries[v]);
+        }
+        headers.SetDate(MockTimer::kApr_5_2010_ms);
+        headers.ComputeCaching();
+
+        // Serializing without the summary is how entries written before it
+        // existed look; they must take the header-lookup path.
+        ResponseHeaders legacy;
+        legacy.CopyFrom(headers);
+        ClearCachingSummary(&legacy);
+        ASSERT_TRUE(headers.HasCachingSummary());
+        ASSERT_FALSE(legacy.HasCachingSummary());
+
+        for (int props = 0; props < 8; ++props) {
+          RequestHeaders::Properties properties;
+          properties.has_cookie = (props & 1) != 0;
+          properties.has_cookie2 = (props & 2) != 0;
+          properties.has_authorization = (props & 4) != 0;
+          for (int respect = 0; respect < 2; ++respect) {
+            ResponseHeaders::VaryOption vary_option = (respect == 0)
+                ? ResponseHeaders::kRespectVaryOnResources
+                : ResponseHeaders::kIgnoreVaryOnResources;
+            for (int validator = 0; validator < 2; ++validator) {
+              ResponseHeaders::ValidatorOption validator_option =
+                  (validator == 0) ? ResponseHeaders::kNoValidator
+                                   : ResponseHeaders::kHasValidator;
+              EXPECT_EQ(
+                  legacy.IsProxyCacheable(properties, vary_option,
+                                          validator_option),
+                  headers.IsProxyCacheable(properties, vary_option,
+                                           validator_option))
+                  << kContentTypes[t] << " " << kCacheControls[c] << " "
+                  << kVaries[v] << " " << props << " " << respect << " "
+                  << validator;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_F(ResponseHeadersTest, CachingSummarySurvivesSerialization) {
+  response_headers_.SetStatusAndReason(HttpStatus::kOK);
+  response_headers_.Add(HttpAttributes::kContentType, "text/css");
+  response_headers_.Add(HttpAttributes::kVary, "Cookie");
+  response_headers_.SetDateAndCaching(MockTimer::kApr_5_2010_ms, 300 * 1000);
+  response_headers_.ComputeCaching();
+
+  GoogleString binary;
+  StringWriter writer(&binary);
+  ASSERT_TRUE(response_headers_.WriteAsBinary(&writer, &message_handler_));
+  ResponseHeaders read_back;
+  ASSERT_TRUE(read_back.ReadFromBinary(binary, &message_handler_));
+  ASSERT_TRUE(read_back.HasCachingSummary());
+  EXPECT_TRUE(CachingSummary(read_back).vary_cookie());
+  EXPECT_FALSE(CachingSummary(read_back).html_like());
+
+  // Sanitize can tell from the summary that there is nothing to remove.
+  EXPECT_FALSE(read_back.Sanitize());
+  EXPECT_TRUE(read_back.HasCachingSummary());
+}
+
+TEST_F(ResponseHeadersTest, SanitizeWithCachingSummary) {
+  response_headers_.SetStatusAndReason(HttpStatus::kOK);
+  response_headers_.Add(HttpAttributes::kConnection, "Foo");
+  response_headers_.Add("Foo", "bar");
+  response_headers_.Add(HttpAttributes::kCacheControl, "max-age=300");
+  response_headers_.SetDate(MockTimer::kApr_5_2010_ms);
+  response_headers_.ComputeCaching();
+  ASSERT_TRUE(response_headers_.HasCachingSummary());
+  EXPECT_TRUE(CachingSummary(response_headers_).needs_sanitize());
+  EXPECT_TRUE(response_headers_.Sanitize());
+  EXPECT_FALSE(response_headers_.Has(HttpAttributes::kConnection));
+  EXPECT_FALSE(response_headers_.Has("Foo"));
+}
+
 }  // namespace net_instaweb
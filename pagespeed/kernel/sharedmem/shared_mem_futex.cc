@@ -0,0 +1,74 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/sharedmem/shared_mem_futex.h"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <climits>
+#endif
+
+#include "pagespeed/kernel/base/timer.h"
+
+namespace net_instaweb {
+
+namespace SharedMemFutex {
+
+#ifdef __linux__
+
+bool Supported() {
+  return true;
+}
+
+void Wait(volatile base::subtle::Atomic32* word, int32 expected,
+          int64 timeout_ms) {
+  struct timespec timeout;
+  timeout.tv_sec = timeout_ms / Timer::kSecondMs;
+  timeout.tv_nsec = (timeout_ms % Timer::kSecondMs) * 1000 * 1000;
+  // Not FUTEX_PRIVATE_FLAG: the word lives in memory shared between
+  // processes.
+  syscall(SYS_futex, word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+void WakeAll(volatile base::subtle::Atomic32* word) {
+  syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+#else
+
+bool Supported() {
+  return false;
+}
+
+void Wait(volatile base::subtle::Atomic32* word, int32 expected,
+          int64 timeout_ms) {
+}
+
+void WakeAll(volatile base::subtle::Atomic32* word) {
+}
+
+#endif
+
+}  // namespace SharedMemFutex
+
+}  // namespace net_instaweb
@@ -0,0 +1,50 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_FUTEX_H_
+#define PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_FUTEX_H_
+
+#include "pagespeed/kernel/base/atomicops.h"
+#include "pagespeed/kernel/base/basictypes.h"
+
+namespace net_instaweb {
+
+// Thin wrappers around futex(2) for 32-bit words that live in memory shared
+// between processes. These are only hints: Wait may return early for any
+// reason, so callers must re-check whatever condition they are waiting for.
+// Where futexes are not available (non-Linux), Supported() returns false and
+// Wait and WakeAll do nothing, so callers need to fall back to polling.
+namespace SharedMemFutex {
+
+bool Supported();
+
+// Sleeps until *word is woken via WakeAll or timeout_ms passes, unless *word
+// no longer holds expected, in which case it returns immediately.
+void Wait(volatile base::subtle::Atomic32* word, int32 expected,
+          int64 timeout_ms);
+
+// Wakes every thread, in any process, sleeping in Wait on word.
+void WakeAll(volatile base::subtle::Atomic32* word);
+
+}  // namespace SharedMemFutex
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_FUTEX_H_
@@ -19,18 +19,31 @@
 
 #include "pagespeed/kernel/sharedmem/shared_mem_lock_manager.h"
 
+#include <unistd.h>
+
+#include <algorithm>
 #include <cstddef>
+#include <map>
+#include <utility>
+#include <vector>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
+#include "pagespeed/kernel/base/atomicops.h"
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/hasher.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/sharedmem/shared_mem_futex.h"
 #include "pagespeed/kernel/thread/scheduler.h"
 #include "pagespeed/kernel/thread/scheduler_based_abstract_lock.h"
 
@@ -53,6 +66,9 @@ namespace SharedMemLockData {
 //  ..
 // Bucket kBuckets - 1:
 //  ..
+// Header
+//  release count (32-bit)
+//  number of sleeping waiter threads (32-bit)
 //
 // Each key is statically assigned to a bucket based on its hash.
 // When we're trying to lock or unlock the given named lock, we lock
@@ -69,6 +85,11 @@ namespace SharedMemLockData {
 // 2) It makes it possible for the last grabber to be the one to unlock the
 // lock, as we check the grabber's acquisition timestamp versus the lock's.
 //
+// Every unlock increments the header's release count, which is also the
+// futex word on which processes with blocked waiters sleep (see
+// SharedMemLockWaiters below); unlock only pays for the wake system call when
+// the sleeper count says someone is asleep.
+//
 // A further issue is what happens when a bucket is overflowed. In that case,
 // however, we simply state that lock acquisition failed. This is because the
 // purpose of this service is to limit the load on the system, and the table
@@ -91,6 +112,11 @@ struct Bucket {
   char mutex_base[1];
 };
 
+struct Header {
+  base::subtle::Atomic32 release_count;
+  base::subtle::Atomic32 num_sleepers;
+};
+
 inline size_t Align64(size_t in) {
   return (in + 63) & ~63;
 }
@@ -99,14 +125,112 @@ inline size_t BucketSize(size_t lock_size) {
   return Align64(offsetof(Bucket, mutex_base) + lock_size);
 }
 
-inline size_t SegmentSize(size_t lock_size) {
+inline size_t HeaderOffset(size_t lock_size) {
   return kBuckets * BucketSize(lock_size);
 }
 
+inline size_t SegmentSize(size_t lock_size) {
+  return HeaderOffset(lock_size) + sizeof(Header);
+}
+
 }  // namespace SharedMemLockData
 
 namespace Data = SharedMemLockData;
 
+namespace {
+
+// How long the watcher thread sleeps on the futex before re-checking whether
+// it still has anything to do.
+const int64 kWatcherSleepMs = Timer::kSecondMs;
+
+// Without futexes, waiters poll with exponential backoff up to this interval.
+const int64 kMaxPollIntervalMs = Timer::kSecondMs;
+
+}  // namespace
+
+class SharedMemLock;
+
+// Process-local set of SharedMemLocks blocked in the LockTimedWait* family.
+// A waiter is retried by a scheduler alarm when its wait times out or when
+// the current holder's lock becomes old enough to steal, and by PollAll()
+// whenever any process releases a lock in the segment.  Releases are noticed
+// by a watcher thread that sleeps on the segment's futex word while this
+// process has waiters, so waiters don't need to poll.  Without futexes
+// (non-Linux), waiters fall back to polling with exponential backoff.
+//
+// This is reference-counted because scheduler alarms may outlive the
+// manager; once ShutDown() is called they do nothing.
+class SharedMemLockWaiters : public RefCounted<SharedMemLockWaiters> {
+ public:
+  explicit SharedMemLockWaiters(Scheduler* scheduler);
+
+  // Points at the segment header; called from Initialize/Attach.
+  void set_header(Data::Header* header) LOCKS_EXCLUDED(mutex_);
+
+  // Registers a wait by lock, whose lock attempt just failed with the lock
+  // held since holder_acquired_ms (or kNotAcquired if the bucket was full).
+  // release_count is the segment's release count read before that attempt.
+  // callback is run or cancelled exactly once.
+  void Add(SharedMemLock* lock, bool steal, int64 steal_ms, int64 end_ms,
+           int64 holder_acquired_ms, int32 release_count, Function* callback)
+      LOCKS_EXCLUDED(mutex_);
+
+  // Cancels every pending wait and stops the watcher thread.
+  void ShutDown() LOCKS_EXCLUDED(mutex_);
+
+ private:
+  friend class RefCounted<SharedMemLockWaiters>;
+  class RetryAlarm;
+  class Watcher;
+
+  struct Waiter {
+    SharedMemLock* lock;
+    bool steal;
+    int64 steal_ms;
+    int64 end_ms;
+    int64 backoff_ms;
+    int64 alarm_ms;  // Time of the pending retry alarm, or 0 if none.
+    Function* callback;
+  };
+  typedef std::map<int64, Waiter> WaiterMap;
+  // Callbacks to run once the mutex is dropped, and whether to Run them
+  // (versus Cancel).
+  typedef std::vector<std::pair<Function*, bool> > Completions;
+
+  ~SharedMemLockWaiters();
+
+  // Decides what to do about a waiter whose latest attempt failed: times it
+  // out (returning true and adding it to *done), or schedules its next retry.
+  bool WaitLonger(int64 id, Waiter* waiter, int64 holder_acquired_ms,
+                  Completions* done) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Retries waiter, returning true if it finished.
+  bool Retry(int64 id, Waiter* waiter, Completions* done)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Schedules a retry of waiter id, or of all waiters, at retry_ms.
+  void ScheduleRetry(int64 id, int64 retry_ms);
+  void PollAll() LOCKS_EXCLUDED(mutex_);
+  void PollOne(int64 id, int64 alarm_ms) LOCKS_EXCLUDED(mutex_);
+  void Nudge() LOCKS_EXCLUDED(mutex_);
+  // Body of the watcher thread; seen is the release count at its start.
+  void WatchReleases(int32 seen) LOCKS_EXCLUDED(mutex_);
+  static void Complete(const Completions& done);
+
+  Scheduler* scheduler_;
+  scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  // Signalled when waiters_ becomes non-empty, and on shutdown.
+  scoped_ptr<ThreadSystem::Condvar> have_waiters_;
+  Data::Header* header_ GUARDED_BY(mutex_);
+  WaiterMap waiters_ GUARDED_BY(mutex_);
+  int64 next_id_ GUARDED_BY(mutex_);
+  bool poll_all_pending_ GUARDED_BY(mutex_);
+  bool shut_down_ GUARDED_BY(mutex_);
+  scoped_ptr<Watcher> watcher_ GUARDED_BY(mutex_);
+  pid_t watcher_pid_ GUARDED_BY(mutex_);  // Process watcher_ was started in.
+
+  DISALLOW_COPY_AND_ASSIGN(SharedMemLockWaiters);
+};
+
 class SharedMemLock : public SchedulerBasedAbstractLock {
  public:
   virtual ~SharedMemLock() {
@@ -114,11 +238,35 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
   }
 
   virtual bool TryLock() {
-    return TryLockImpl(false, 0);
+    return TryLockImpl(false, 0, NULL);
   }
 
   virtual bool TryLockStealOld(int64 timeout_ms) {
-    return TryLockImpl(true, timeout_ms);
+    return TryLockImpl(true, timeout_ms, NULL);
+  }
+
+  // The timed waits sleep until some lock in the segment is released, or
+  // until the wait times out or the holder's lock becomes stealable, rather
+  // than polling via the scheduler.
+  virtual bool LockTimedWait(int64 wait_ms) {
+    SchedulerBlockingFunction block(scheduler());
+    LockTimedWait(wait_ms, &block);
+    return block.Block();
+  }
+
+  virtual void LockTimedWait(int64 wait_ms, Function* callback) {
+    WaitImpl(false, 0, wait_ms, callback);
+  }
+
+  virtual bool LockTimedWaitStealOld(int64 wait_ms, int64 steal_ms) {
+    SchedulerBlockingFunction block(scheduler());
+    LockTimedWaitStealOld(wait_ms, steal_ms, &block);
+    return block.Block();
+  }
+
+  virtual void LockTimedWaitStealOld(int64 wait_ms, int64 steal_ms,
+                                     Function* callback) {
+    WaitImpl(true, steal_ms, wait_ms, callback);
   }
 
   virtual void Unlock() {
@@ -146,6 +294,7 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
     }
 
     acquisition_time_ = Data::kNotAcquired;
+    manager_->NotifyRelease();
   }
 
   virtual GoogleString name() const {
@@ -163,6 +312,7 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
 
  private:
   friend class SharedMemLockManager;
+  friend class SharedMemLockWaiters;
 
   // ctor should only be called by CreateNamedLock below.
   SharedMemLock(SharedMemLockManager* manager, const StringPiece& name)
@@ -200,7 +350,26 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
         manager_->MutexOffset(bucket_));
   }
 
-  bool TryLockImpl(bool steal, int64 steal_timeout_ms) {
+  // Common code for the LockTimedWait family.
+  void WaitImpl(bool steal, int64 steal_ms, int64 wait_ms,
+                Function* callback) {
+    int32 release_count = manager_->ReleaseCount();
+    int64 holder_acquired_ms = Data::kNotAcquired;
+    if (TryLockImpl(steal, steal_ms, &holder_acquired_ms)) {
+      callback->CallRun();
+    } else if (wait_ms <= 0) {
+      callback->CallCancel();
+    } else {
+      int64 end_ms = manager_->scheduler_->timer()->NowMs() + wait_ms;
+      manager_->waiters_->Add(this, steal, steal_ms, end_ms,
+                              holder_acquired_ms, release_count, callback);
+    }
+  }
+
+  // If the lock is held by someone else, sets *holder_acquired_ms (when
+  // non-NULL) to the time they acquired it.
+  bool TryLockImpl(bool steal, int64 steal_timeout_ms,
+                   int64* holder_acquired_ms) {
     // Protect the bucket.
     scoped_ptr<AbstractMutex> lock(AttachMutex());
     ScopedMutex hold_lock(lock.get());
@@ -234,6 +403,9 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
           return true;
         } else {
           // Not permitted to steal or not stale enough to steal.
+          if (holder_acquired_ms != NULL) {
+            *holder_acquired_ms = slot.acquired_at_ms;
+          }
           return false;
         }
       } else if (slot.acquired_at_ms == Data::kNotAcquired) {
@@ -276,6 +448,279 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
   DISALLOW_COPY_AND_ASSIGN(SharedMemLock);
 };
 
+// Scheduler alarm that retries one waiter, or all of them.  It holds a
+// reference so the waiter set outlives it.
+class SharedMemLockWaiters::RetryAlarm : public Function {
+ public:
+  static const int64 kAllWaiters = 0;  // Waiter ids start at 1.
+
+  RetryAlarm(SharedMemLockWaiters* waiters, int64 id, int64 alarm_ms)
+      : waiters_(waiters), id_(id), alarm_ms_(alarm_ms) {
+  }
+
+ protected:
+  virtual void Run() {
+    if (id_ == kAllWaiters) {
+      waiters_->PollAll();
+    } else {
+      waiters_->PollOne(id_, alarm_ms_);
+    }
+  }
+
+ private:
+  RefCountedPtr<SharedMemLockWaiters> waiters_;
+  int64 id_;
+  int64 alarm_ms_;
+  DISALLOW_COPY_AND_ASSIGN(RetryAlarm);
+};
+
+class SharedMemLockWaiters::Watcher : public ThreadSystem::Thread {
+ public:
+  Watcher(ThreadSystem* thread_system, SharedMemLockWaiters* waiters,
+          int32 seen)
+      : Thread(thread_system, "shm_lock_watcher", ThreadSystem::kJoinable),
+        waiters_(waiters),
+        seen_(seen) {
+  }
+
+  virtual void Run() {
+    waiters_->WatchReleases(seen_);
+  }
+
+ private:
+  SharedMemLockWaiters* waiters_;
+  int32 seen_;
+  DISALLOW_COPY_AND_ASSIGN(Watcher);
+};
+
+SharedMemLockWaiters::SharedMemLockWaiters(Scheduler* scheduler)
+    : scheduler_(scheduler),
+      mutex_(scheduler->thread_system()->NewMutex()),
+      have_waiters_(mutex_->NewCondvar()),
+      header_(NULL),
+      next_id_(0),
+      poll_all_pending_(false),
+      shut_down_(false),
+      watcher_pid_(0) {
+}
+
+SharedMemLockWaiters::~SharedMemLockWaiters() {
+  DCHECK(waiters_.empty());
+}
+
+void SharedMemLockWaiters::set_header(Data::Header* header) {
+  ScopedMutex lock(mutex_.get());
+  header_ = header;
+}
+
+void SharedMemLockWaiters::Add(
+    SharedMemLock* lock, bool steal, int64 steal_ms, int64 end_ms,
+    int64 holder_acquired_ms, int32 release_count, Function* callback) {
+  Completions done;
+  bool released_meanwhile = false;
+  {
+    ScopedMutex hold(mutex_.get());
+    if (shut_down_) {
+      done.push_back(std::make_pair(callback, false));
+    } else {
+      int64 id = ++next_id_;
+      Waiter* waiter = &waiters_[id];
+      waiter->lock = lock;
+      waiter->steal = steal;
+      waiter->steal_ms = steal_ms;
+      waiter->end_ms = end_ms;
+      waiter->backoff_ms = 0;
+      waiter->alarm_ms = 0;
+      waiter->callback = callback;
+      if (WaitLonger(id, waiter, holder_acquired_ms, &done)) {
+        waiters_.erase(id);
+      } else if (SharedMemFutex::Supported() && header_ != NULL) {
+        int32 current =
+            base::subtle::Acquire_Load(&header_->release_count);
+        // The watcher only notices releases after this point.
+        released_meanwhile = (current != release_count);
+        // A fork leaves the watcher thread behind in the parent; it can't be
+        // joined from here, so its object is deliberately leaked.
+        if (watcher_.get() != NULL && watcher_pid_ != getpid()) {
+          ignore_result(watcher_.release());
+        }
+        if (watcher_.get() == NULL) {
+          watcher_.reset(
+              new Watcher(scheduler_->thread_system(), this, current));
+          watcher_pid_ = getpid();
+          if (!watcher_->Start()) {
+            LOG(DFATAL) << "Unable to start shared-memory lock watcher";
+          }
+        }
+        have_waiters_->Signal();
+      }
+    }
+  }
+  Complete(done);
+  if (released_meanwhile) {
+    Nudge();
+  }
+}
+
+void SharedMemLockWaiters::ShutDown() {
+  Completions done;
+  scoped_ptr<Watcher> watcher;
+  {
+    ScopedMutex hold(mutex_.get());
+    shut_down_ = true;
+    for (WaiterMap::iterator p = waiters_.begin(); p != waiters_.end(); ++p) {
+      done.push_back(std::make_pair(p->second.callback, false));
+    }
+    waiters_.clear();
+    if (watcher_pid_ == getpid()) {
+      watcher.reset(watcher_.release());
+    }
+    have_waiters_->Signal();
+    if (watcher.get() != NULL && header_ != NULL) {
+      // Kick the watcher out of its futex wait.
+      base::subtle::Barrier_AtomicIncrement(&header_->release_count, 1);
+      SharedMemFutex::WakeAll(&header_->release_count);
+    }
+  }
+  if (watcher.get() != NULL) {
+    watcher->Join();
+  }
+  Complete(done);
+}
+
+bool SharedMemLockWaiters::WaitLonger(int64 id, Waiter* waiter,
+                                      int64 holder_acquired_ms,
+                                      Completions* done) {
+  int64 now_ms = scheduler_->timer()->NowMs();
+  if (now_ms >= waiter->end_ms) {
+    done->push_back(std::make_pair(waiter->callback, false));
+    return true;
+  }
+  int64 retry_ms = waiter->end_ms;
+  if (waiter->steal && (holder_acquired_ms != Data::kNotAcquired)) {
+    retry_ms = std::min(retry_ms, holder_acquired_ms + waiter->steal_ms);
+  }
+  if (!SharedMemFutex::Supported() ||
+      (holder_acquired_ms == Data::kNotAcquired)) {
+    // Nothing will tell us when to retry: either there's no futex, or the
+    // bucket was full and some other lock's release will free a slot.
+    waiter->backoff_ms = std::min(
+        1 + waiter->backoff_ms + (waiter->backoff_ms >> 1), kMaxPollIntervalMs);
+    retry_ms = std::min(retry_ms, now_ms + waiter->backoff_ms);
+  }
+  if ((waiter->alarm_ms == 0) || (retry_ms < waiter->alarm_ms)) {
+    // Any later alarm is left to fire; PollOne ignores it as superseded.
+    waiter->alarm_ms = retry_ms;
+    ScheduleRetry(id, retry_ms);
+  }
+  return false;
+}
+
+bool SharedMemLockWaiters::Retry(int64 id, Waiter* waiter,
+                                 Completions* done) {
+  int64 holder_acquired_ms = Data::kNotAcquired;
+  if (waiter->lock->TryLockImpl(waiter->steal, waiter->steal_ms,
+                                &holder_acquired_ms)) {
+    done->push_back(std::make_pair(waiter->callback, true));
+    return true;
+  }
+  return WaitLonger(id, waiter, holder_acquired_ms, done);
+}
+
+void SharedMemLockWaiters::ScheduleRetry(int64 id, int64 retry_ms) {
+  // Doesn't use AddAlarmAtUs, as that can run alarms, which would need our
+  // mutex, right here.
+  ScopedMutex lock(scheduler_->mutex());
+  scheduler_->AddAlarmAtUsMutexHeld(retry_ms * Timer::kMsUs,
+                                    new RetryAlarm(this, id, retry_ms));
+  scheduler_->Wakeup();
+}
+
+void SharedMemLockWaiters::PollAll() {
+  Completions done;
+  {
+    ScopedMutex hold(mutex_.get());
+    poll_all_pending_ = false;
+    WaiterMap::iterator p = waiters_.begin();
+    while (p != waiters_.end()) {
+      if (Retry(p->first, &p->second, &done)) {
+        waiters_.erase(p++);
+      } else {
+        ++p;
+      }
+    }
+  }
+  Complete(done);
+}
+
+void SharedMemLockWaiters::PollOne(int64 id, int64 alarm_ms) {
+  Completions done;
+  {
+    ScopedMutex hold(mutex_.get());
+    WaiterMap::iterator p = waiters_.find(id);
+    if ((p == waiters_.end()) || (p->second.alarm_ms != alarm_ms)) {
+      return;  // Finished already, or superseded by an earlier alarm.
+    }
+    p->second.alarm_ms = 0;
+    if (Retry(id, &p->second, &done)) {
+      waiters_.erase(p);
+    }
+  }
+  Complete(done);
+}
+
+void SharedMemLockWaiters::Nudge() {
+  {
+    ScopedMutex hold(mutex_.get());
+    if (shut_down_ || waiters_.empty() || poll_all_pending_) {
+      return;
+    }
+    poll_all_pending_ = true;
+  }
+  ScheduleRetry(RetryAlarm::kAllWaiters, scheduler_->timer()->NowMs());
+}
+
+void SharedMemLockWaiters::WatchReleases(int32 seen) {
+  while (true) {
+    volatile base::subtle::Atomic32* release_count;
+    volatile base::subtle::Atomic32* num_sleepers;
+    {
+      ScopedMutex hold(mutex_.get());
+      while (!shut_down_ && waiters_.empty()) {
+        have_waiters_->TimedWait(kWatcherSleepMs);
+      }
+      if (shut_down_) {
+        return;
+      }
+      release_count = &header_->release_count;
+      num_sleepers = &header_->num_sleepers;
+    }
+    // The full barrier pairs with the one in NotifyRelease: either we see its
+    // increment of release_count, or it sees us as a sleeper and wakes us.
+    base::subtle::Barrier_AtomicIncrement(num_sleepers, 1);
+    if (base::subtle::Acquire_Load(release_count) == seen) {
+      SharedMemFutex::Wait(release_count, seen, kWatcherSleepMs);
+    }
+    base::subtle::Barrier_AtomicIncrement(num_sleepers, -1);
+    int32 current = base::subtle::Acquire_Load(release_count);
+    if (current != seen) {
+      // Read before retrying, so any later release wakes us again.
+      seen = current;
+      Nudge();
+    }
+  }
+}
+
+void SharedMemLockWaiters::Complete(const Completions& done) {
+  for (int i = 0, n = done.size(); i < n; ++i) {
+    if (done[i].second) {
+      done[i].first->CallRun();
+    } else {
+      done[i].first->CallCancel();
+    }
+  }
+}
+
 SharedMemLockManager::SharedMemLockManager(
     AbstractSharedMem* shm, const GoogleString& path, Scheduler* scheduler,
     Hasher* hasher, MessageHandler* handler)
@@ -284,11 +729,13 @@ SharedMemLockManager::SharedMemLockManager(
       scheduler_(scheduler),
       hasher_(hasher),
       handler_(handler),
-      lock_size_(shm->SharedMutexSize()) {
+      lock_size_(shm->SharedMutexSize()),
+      waiters_(new SharedMemLockWaiters(scheduler)) {
   CHECK_GE(hasher_->RawHashSizeInBytes(), 9) << "Need >= 9 byte hashes";
 }
 
 SharedMemLockManager::~SharedMemLockManager() {
+  waiters_->ShutDown();
 }
 
 bool SharedMemLockManager::Initialize() {
@@ -308,6 +755,10 @@ bool SharedMemLockManager::Initialize() {
       return false;
     }
   }
+  Data::Header* header = Header();
+  base::subtle::NoBarrier_Store(&header->release_count, 0);
+  base::subtle::NoBarrier_Store(&header->num_sleepers, 0);
+  waiters_->set_header(header);
   return true;
 }
 
@@ -320,6 +771,7 @@ bool SharedMemLockManager::Attach() {
     return false;
   }
 
+  waiters_->set_header(Header());
   return true;
 }
 
@@ -342,4 +794,21 @@ size_t SharedMemLockManager::MutexOffset(SharedMemLockData::Bucket* bucket) {
   return &bucket->mutex_base[0] - seg_->Base();
 }
 
+Data::Header* SharedMemLockManager::Header() {
+  return reinterpret_cast<Data::Header*>(
+      const_cast<char*>(seg_->Base()) + Data::HeaderOffset(lock_size_));
+}
+
+int32 SharedMemLockManager::ReleaseCount() {
+  return base::subtle::Acquire_Load(&Header()->release_count);
+}
+
+void SharedMemLockManager::NotifyRelease() {
+  Data::Header* header = Header();
+  base::subtle::Barrier_AtomicIncrement(&header->release_count, 1);
+  if (base::subtle::Acquire_Load(&header->num_sleepers) > 0) {
+    SharedMemFutex::WakeAll(&header->release_count);
+  }
+}
+
 }  // namespace net_instaweb
@@ -25,6 +25,7 @@
 
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/named_lock_manager.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
@@ -37,17 +38,19 @@ class AbstractSharedMemSegment;
 class Hasher;
 class MessageHandler;
 class Scheduler;
+class SharedMemLockWaiters;
 
 namespace SharedMemLockData {
 
 struct Bucket;
+struct Header;
 
 }  // namespace SharedMemLockData
 
-// A simple shared memory named locking manager, which uses scheduler alarms
-// (via SchedulerBasedAbstractLock) when it needs to block.
-//
-// TODO(morlovich): Implement condvars?
+// A simple shared memory named locking manager.  Locks that need to block
+// sleep until some lock in the segment is released (on Linux, via a futex in
+// the segment), or until their wait times out or the holder's lock becomes
+// stealable, which are handled with scheduler alarms.
 class SharedMemLockManager : public NamedLockManager {
  public:
   // Note that you must call Initialize() in the root process, and Attach in
@@ -85,6 +88,15 @@ class SharedMemLockManager : public NamedLockManager {
   // Offset of mutex wrt to segment base.
   size_t MutexOffset(SharedMemLockData::Bucket*);
 
+  SharedMemLockData::Header* Header();
+
+  // Number of releases of any lock in the segment (modulo 2^32).  Read it
+  // before a lock attempt to tell whether a release raced with the attempt.
+  int32 ReleaseCount();
+
+  // Called after a lock is released, to wake up any waiters.
+  void NotifyRelease();
+
   AbstractSharedMem* shm_runtime_;
   GoogleString path_;
 
@@ -93,6 +105,7 @@ class SharedMemLockManager : public NamedLockManager {
   Hasher* hasher_;
   MessageHandler* handler_;
   size_t lock_size_;
+  RefCountedPtr<SharedMemLockWaiters> waiters_;
 
   DISALLOW_COPY_AND_ASSIGN(SharedMemLockManager);
 };
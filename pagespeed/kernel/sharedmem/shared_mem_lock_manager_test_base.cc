@@ -20,14 +20,22 @@
 
 #include "pagespeed/kernel/sharedmem/shared_mem_lock_manager_test_base.h"
 
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/md5_hasher.h"
+#include "pagespeed/kernel/base/mem_file_system.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
 #include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/named_lock_tester.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_lock_manager.h"
+#include "pagespeed/kernel/sharedmem/shared_mem_statistics.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_test_base.h"
+#include "pagespeed/kernel/thread/scheduler.h"
 #include "pagespeed/kernel/thread/scheduler_based_abstract_lock.h"
 #include "pagespeed/kernel/util/platform.h"
 
@@ -38,6 +46,11 @@ namespace {
 const char kPath[] = "shm_locks";
 const char kLockA[] = "lock_a";
 const char kLockB[] = "lock_b";
+const char kStatsPrefix[] = "shm_lock_stats";
+const char kLatencyHistogram[] = "lock_acquire_latency_ms";
+
+// How long TestWaitForReleaseChild holds the lock.
+const int64 kHoldMs = 50;
 
 }  // namespace
 
@@ -197,4 +210,82 @@ void SharedMemLockManagerTestBase::TestStealChild() {
   }
 }
 
+void SharedMemLockManagerTestBase::TestWaitForRelease() {
+  // This uses real time, since what matters is how soon a waiter notices
+  // another process releasing the lock.
+  const int kRounds = 10;
+  scoped_ptr<Timer> timer(thread_system_->NewTimer());
+  Scheduler scheduler(thread_system_.get(), timer.get());
+  SharedMemLockManager lock_manager(shmem_runtime_.get(), kPath, &scheduler,
+                                    &hasher_, &handler_);
+  ASSERT_TRUE(lock_manager.Attach());
+  scoped_ptr<SchedulerBasedAbstractLock> lock_a(
+      lock_manager.CreateNamedLock(kLockA));
+
+  MemFileSystem file_system(thread_system_.get(), timer.get());
+  SharedMemStatistics stats(
+      Timer::kMinuteMs, 0 /* max_logfile_size_kb */, "", false /* logging */,
+      kStatsPrefix, shmem_runtime_.get(), &handler_, &file_system,
+      timer.get());
+  Histogram* latency = stats.AddHistogram(kLatencyHistogram);
+  ASSERT_TRUE(stats.Init(true, &handler_));
+  latency->SetMaxValue(Timer::kSecondMs);
+
+  NamedLockTester tester(thread_system_.get());
+  tester.set_latency_histogram(timer.get(), latency);
+  tester.set_quiesce(MakeFunction(
+      this, &SharedMemLockManagerTestBase::RunUntilHeld,
+      &scheduler, static_cast<NamedLock*>(lock_a.get())));
+
+  for (int round = 0; round < kRounds; ++round) {
+    CreateChild(&SharedMemLockManagerTestBase::TestWaitForReleaseChild);
+    // Wait for the child to take the lock, then block until it lets go.  If
+    // we somehow miss the child's hold entirely the wait below just succeeds
+    // at once.
+    int64 give_up_ms = timer->NowMs() + 5 * Timer::kSecondMs;
+    while (lock_a->TryLock() && (timer->NowMs() < give_up_ms)) {
+      lock_a->Unlock();
+      timer->SleepUs(100);
+    }
+    lock_a->Unlock();
+    EXPECT_TRUE(tester.LockTimedWait(Timer::kMinuteMs, lock_a.get()));
+    lock_a->Unlock();
+    test_env_->WaitForChildren();
+  }
+
+  EXPECT_EQ(kRounds, latency->Count());
+  LOG(INFO) << "Lock acquire latency (ms): median "
+            << latency->Percentile(50) << ", 90th "
+            << latency->Percentile(90) << ", max " << latency->Maximum();
+  // The waiter should wake promptly once the child's kHoldMs is up, rather
+  // than after a polling interval proportional to how long it has waited.
+  EXPECT_GT(Timer::kSecondMs, latency->Maximum());
+  stats.GlobalCleanup(&handler_);
+}
+
+void SharedMemLockManagerTestBase::TestWaitForReleaseChild() {
+  scoped_ptr<SharedMemLockManager> lock_manager(AttachDefault());
+  scoped_ptr<Timer> timer(thread_system_->NewTimer());
+  if (lock_manager.get() == NULL) {
+    test_env_->ChildFailed();
+    return;
+  }
+  scoped_ptr<SchedulerBasedAbstractLock> lock_a(
+      lock_manager->CreateNamedLock(kLockA));
+  if (!lock_a->TryLock()) {
+    test_env_->ChildFailed();
+  }
+  timer->SleepMs(kHoldMs);
+  lock_a->Unlock();
+}
+
+void SharedMemLockManagerTestBase::RunUntilHeld(Scheduler* scheduler,
+                                                NamedLock* lock) {
+  ScopedMutex hold(scheduler->mutex());
+  int64 end_us = scheduler->timer()->NowUs() + Timer::kMinuteUs;
+  while (!lock->Held() && (scheduler->timer()->NowUs() < end_us)) {
+    scheduler->ProcessAlarmsOrWaitUs(10 * Timer::kMsUs);
+  }
+}
+
 }  // namespace net_instaweb
@@ -27,6 +27,7 @@
 #include "pagespeed/kernel/base/md5_hasher.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
 #include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/named_lock_manager.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_lock_manager.h"
@@ -35,6 +36,8 @@
 
 namespace net_instaweb {
 
+class Scheduler;
+
 class SharedMemLockManagerTestBase : public testing::Test {
  protected:
   typedef void (SharedMemLockManagerTestBase::*TestMethod)();
@@ -46,6 +49,7 @@ class SharedMemLockManagerTestBase : public testing::Test {
   void TestBasic();
   void TestDestructorUnlock();
   void TestSteal();
+  void TestWaitForRelease();
 
  private:
   bool CreateChild(TestMethod method);
@@ -55,6 +59,10 @@ class SharedMemLockManagerTestBase : public testing::Test {
 
   void TestBasicChild();
   void TestStealChild();
+  void TestWaitForReleaseChild();
+
+  // Runs scheduler's alarms until lock is held, for up to a minute.
+  void RunUntilHeld(Scheduler* scheduler, NamedLock* lock);
 
   scoped_ptr<SharedMemTestEnv> test_env_;
   scoped_ptr<AbstractSharedMem> shmem_runtime_;
@@ -93,8 +101,13 @@ TYPED_TEST_P(SharedMemLockManagerTestTemplate, TestSteal) {
   SharedMemLockManagerTestBase::TestSteal();
 }
 
+TYPED_TEST_P(SharedMemLockManagerTestTemplate, TestWaitForRelease) {
+  SharedMemLockManagerTestBase::TestWaitForRelease();
+}
+
 REGISTER_TYPED_TEST_CASE_P(SharedMemLockManagerTestTemplate, TestBasic,
-                           TestDestructorUnlock, TestSteal);
+                           TestDestructorUnlock, TestSteal,
+                           TestWaitForRelease);
 
 }  // namespace net_instaweb
 
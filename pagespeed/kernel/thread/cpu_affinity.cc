@@ -0,0 +1,141 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/thread/cpu_affinity.h"
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Keeps a malformed or hostile spec from making us build a huge list.
+const int kMaxCpu = 4096;
+
+}  // namespace
+
+const int CpuAffinity::kUnknown;
+
+bool CpuAffinity::ParseCpuList(StringPiece spec, std::vector<int>* cpus) {
+  cpus->clear();
+  TrimWhitespace(&spec);
+  if (StringCaseEqual(spec, "all")) {
+    AllowedCpus(cpus);
+    return !cpus->empty();
+  }
+  StringPieceVector ranges;
+  SplitStringPieceToVector(spec, ",", &ranges, true);
+  for (int i = 0, n = ranges.size(); i < n; ++i) {
+    StringPieceVector bounds;
+    SplitStringPieceToVector(ranges[i], "-", &bounds, false);
+    for (int j = 0, m = bounds.size(); j < m; ++j) {
+      TrimWhitespace(&bounds[j]);
+    }
+    int first = 0;
+    int last = 0;
+    if ((bounds.size() < 1) || (bounds.size() > 2) ||
+        !StringToInt(bounds[0].as_string(), &first) ||
+        !StringToInt(bounds.back().as_string(), &last) ||
+        (first < 0) || (last < first) || (last >= kMaxCpu)) {
+      cpus->clear();
+      return false;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus->push_back(cpu);
+    }
+  }
+  std::sort(cpus->begin(), cpus->end());
+  cpus->erase(std::unique(cpus->begin(), cpus->end()), cpus->end());
+  return !cpus->empty();
+}
+
+void CpuAffinity::AllowedCpus(std::vector<int>* cpus) {
+  cpus->clear();
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus->push_back(cpu);
+      }
+    }
+  }
+#endif
+}
+
+bool CpuAffinity::PinCurrentThread(int cpu) {
+#ifdef __linux__
+  if ((cpu < 0) || (cpu >= CPU_SETSIZE)) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+int CpuAffinity::CurrentCpu() {
+#ifdef __linux__
+  int cpu = sched_getcpu();
+  return (cpu < 0) ? kUnknown : cpu;
+#else
+  return kUnknown;
+#endif
+}
+
+int CpuAffinity::NumaNodeOfCpu(int cpu) {
+  int node = kUnknown;
+#ifdef __linux__
+  // The kernel links each CPU's sysfs directory to its node as "nodeN".
+  GoogleString path = StrCat("/sys/devices/system/cpu/cpu",
+                             IntegerToString(cpu));
+  DIR* dir = opendir(path.c_str());
+  if (dir != NULL) {
+    while (struct dirent* entry = readdir(dir)) {
+      StringPiece name(entry->d_name);
+      int n = 0;
+      if (name.starts_with("node") &&
+          StringToInt(name.substr(4).as_string(), &n)) {
+        node = n;
+        break;
+      }
+    }
+    closedir(dir);
+  }
+#endif
+  return node;
+}
+
+}  // namespace net_instaweb
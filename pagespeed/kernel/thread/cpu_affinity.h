@@ -0,0 +1,63 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+//
+// Helpers for pinning threads to CPUs and discovering the CPU topology, for
+// running worker threads one per core.  On platforms without CPU affinity
+// support these report that nothing is known and pinning fails.
+
+#ifndef PAGESPEED_KERNEL_THREAD_CPU_AFFINITY_H_
+#define PAGESPEED_KERNEL_THREAD_CPU_AFFINITY_H_
+
+#include <vector>
+
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+class CpuAffinity {
+ public:
+  // Returned by CurrentCpu and NumaNodeOfCpu when the answer is unknown.
+  static const int kUnknown = -1;
+
+  // Parses a list of CPU numbers and ranges, such as "0-3,8", into a sorted
+  // list without duplicates.  The word "all" stands for AllowedCpus().
+  // Returns false if spec is malformed or names no CPUs.
+  static bool ParseCpuList(StringPiece spec, std::vector<int>* cpus);
+
+  // Fills cpus with the CPUs this process is allowed to run on, in order.
+  static void AllowedCpus(std::vector<int>* cpus);
+
+  // Restricts the calling thread to the given CPU.  Returns false on
+  // failure, e.g. if the CPU does not exist or is outside this process's
+  // allowed set.
+  static bool PinCurrentThread(int cpu);
+
+  // Returns the CPU the calling thread is running on.  Unless the thread is
+  // pinned this may be stale as soon as it is returned.
+  static int CurrentCpu();
+
+  // Returns the NUMA node the given CPU belongs to.
+  static int NumaNodeOfCpu(int cpu);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_THREAD_CPU_AFFINITY_H_
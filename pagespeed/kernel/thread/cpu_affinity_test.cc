@@ -0,0 +1,106 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/thread/cpu_affinity.h"
+
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/platform.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class PinningThread : public ThreadSystem::Thread {
+ public:
+  PinningThread(ThreadSystem* thread_system, int cpu)
+      : Thread(thread_system, "pinning_thread", ThreadSystem::kJoinable),
+        cpu_(cpu), pinned_(false), ran_on_(CpuAffinity::kUnknown) {}
+
+  virtual void Run() {
+    pinned_ = CpuAffinity::PinCurrentThread(cpu_);
+    ran_on_ = CpuAffinity::CurrentCpu();
+  }
+
+  bool pinned() const { return pinned_; }
+  int ran_on() const { return ran_on_; }
+
+ private:
+  int cpu_;
+  bool pinned_;
+  int ran_on_;
+};
+
+TEST(CpuAffinityTest, ParseCpuList) {
+  std::vector<int> cpus;
+  ASSERT_TRUE(CpuAffinity::ParseCpuList("3", &cpus));
+  EXPECT_EQ(std::vector<int>({3}), cpus);
+  ASSERT_TRUE(CpuAffinity::ParseCpuList("0-3,8", &cpus));
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 8}), cpus);
+  ASSERT_TRUE(CpuAffinity::ParseCpuList(" 6, 2 - 3,2 ", &cpus));
+  EXPECT_EQ(std::vector<int>({2, 3, 6}), cpus);
+}
+
+TEST(CpuAffinityTest, ParseCpuListRejectsMalformed) {
+  std::vector<int> cpus;
+  EXPECT_FALSE(CpuAffinity::ParseCpuList("", &cpus));
+  EXPECT_FALSE(CpuAffinity::ParseCpuList("x", &cpus));
+  EXPECT_FALSE(CpuAffinity::ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(CpuAffinity::ParseCpuList("1-2-3", &cpus));
+  EXPECT_FALSE(CpuAffinity::ParseCpuList("-1", &cpus));
+  EXPECT_FALSE(CpuAffinity::ParseCpuList("0-100000", &cpus));
+  EXPECT_TRUE(cpus.empty());
+}
+
+TEST(CpuAffinityTest, AllIsAllowedCpus) {
+  std::vector<int> allowed, cpus;
+  CpuAffinity::AllowedCpus(&allowed);
+  EXPECT_EQ(!allowed.empty(), CpuAffinity::ParseCpuList("all", &cpus));
+  EXPECT_EQ(allowed, cpus);
+}
+
+TEST(CpuAffinityTest, PinnedThreadStaysOnItsCpu) {
+  std::vector<int> allowed;
+  CpuAffinity::AllowedCpus(&allowed);
+  if (allowed.empty()) {
+    LOG(INFO) << "CPU affinity not supported; skipping.";
+    return;
+  }
+  scoped_ptr<ThreadSystem> thread_system(Platform::CreateThreadSystem());
+  PinningThread thread(thread_system.get(), allowed.back());
+  ASSERT_TRUE(thread.Start());
+  thread.Join();
+  EXPECT_TRUE(thread.pinned());
+  EXPECT_EQ(allowed.back(), thread.ran_on());
+  EXPECT_LE(CpuAffinity::kUnknown, CpuAffinity::NumaNodeOfCpu(thread.ran_on()));
+}
+
+TEST(CpuAffinityTest, PinningToMissingCpuFails) {
+  EXPECT_FALSE(CpuAffinity::PinCurrentThread(-1));
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
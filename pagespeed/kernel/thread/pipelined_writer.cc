@@ -0,0 +1,208 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/thread/pipelined_writer.h"
+
+#include <deque>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_bool.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/thread/sequence.h"
+
+namespace net_instaweb {
+
+// The chunks awaiting delivery, shared between the PipelinedWriter and the
+// closures it queues on the sequence.  Delivery is serialized by
+// delivering_, and the mutex is released while the wrapped writer runs so
+// the producer can keep queueing.
+class PipelinedWriter::Pipe : public RefCounted<PipelinedWriter::Pipe> {
+ public:
+  Pipe(Writer* writer, ThreadSystem* thread_system)
+      : mutex_(thread_system->NewMutex()),
+        delivered_(mutex_->NewCondvar()),
+        writer_(writer),
+        queued_bytes_(0),
+        delivering_(false) {
+  }
+
+  // Takes ownership of data; returns the number of bytes now queued.
+  int64 Enqueue(GoogleString* data, bool flush, MessageHandler* handler) {
+    Chunk* chunk = new Chunk;
+    chunk->data.swap(*data);
+    chunk->flush = flush;
+    chunk->handler = handler;
+    ScopedMutex lock(mutex_.get());
+    queued_bytes_ += chunk->data.size();
+    chunks_.push_back(chunk);
+    return queued_bytes_;
+  }
+
+  // Writes every chunk queued so far to the wrapped writer, unless the
+  // pipe has been detached.
+  void Deliver() LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    WaitForDeliveryLockHeld();
+    delivering_ = true;
+    while ((writer_ != NULL) && !chunks_.empty()) {
+      Chunk* chunk = chunks_.front();
+      chunks_.pop_front();
+      queued_bytes_ -= chunk->data.size();
+      Writer* writer = writer_;
+      bool ok = !failed_.value();
+      mutex_->Unlock();
+      if (ok) {
+        ok = ((chunk->data.empty() || writer->Write(chunk->data,
+                                                    chunk->handler)) &&
+              (!chunk->flush || writer->Flush(chunk->handler)));
+      }
+      delete chunk;
+      if (!ok) {
+        failed_.set_value(true);
+      }
+      mutex_->Lock();
+    }
+    delivering_ = false;
+    delivered_->Broadcast();
+  }
+
+  // Waits out any delivery in progress, then drops the remaining chunks and
+  // forgets the wrapped writer.
+  void Detach() LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    WaitForDeliveryLockHeld();
+    writer_ = NULL;
+    STLDeleteElements(&chunks_);
+    queued_bytes_ = 0;
+  }
+
+  void Fail() { failed_.set_value(true); }
+
+  // Lock-free, as the producer checks this on every Write.
+  bool failed() const { return failed_.value(); }
+
+ private:
+  friend class RefCounted<Pipe>;
+
+  struct Chunk {
+    GoogleString data;
+    bool flush;
+    MessageHandler* handler;
+  };
+
+  ~Pipe() {
+    STLDeleteElements(&chunks_);
+  }
+
+  void WaitForDeliveryLockHeld() EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    while (delivering_) {
+      delivered_->Wait();
+    }
+  }
+
+  scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  scoped_ptr<ThreadSystem::Condvar> delivered_;
+  Writer* writer_ GUARDED_BY(mutex_);
+  std::deque<Chunk*> chunks_ GUARDED_BY(mutex_);
+  int64 queued_bytes_ GUARDED_BY(mutex_);
+  bool delivering_ GUARDED_BY(mutex_);
+  AtomicBool failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(Pipe);
+};
+
+// Runs on the sequence: delivers whatever is queued, then runs done, if any.
+// If the sequence cancels delivery (e.g. at shutdown), the output is marked
+// failed but done is still run, as callers rely on it to finish the request.
+class PipelinedWriter::DeliverFunction : public Function {
+ public:
+  DeliverFunction(const RefCountedPtr<Pipe>& pipe, Function* done)
+      : pipe_(pipe), done_(done) {
+  }
+
+ protected:
+  virtual void Run() {
+    pipe_->Deliver();
+    if (done_ != NULL) {
+      done_->CallRun();
+    }
+  }
+
+  virtual void Cancel() {
+    pipe_->Fail();
+    if (done_ != NULL) {
+      done_->CallRun();
+    }
+  }
+
+ private:
+  RefCountedPtr<Pipe> pipe_;
+  Function* done_;
+
+  DISALLOW_COPY_AND_ASSIGN(DeliverFunction);
+};
+
+PipelinedWriter::PipelinedWriter(Writer* writer, Sequence* sequence,
+                                 ThreadSystem* thread_system,
+                                 int64 max_queued_bytes)
+    : writer_(writer),
+      sequence_(sequence),
+      max_queued_bytes_(max_queued_bytes),
+      pipe_(new Pipe(writer, thread_system)) {
+}
+
+PipelinedWriter::~PipelinedWriter() {
+  pipe_->Detach();
+}
+
+bool PipelinedWriter::Write(const StringPiece& str, MessageHandler* handler) {
+  str.AppendToString(&buffer_);
+  return !pipe_->failed();
+}
+
+bool PipelinedWriter::Flush(MessageHandler* handler) {
+  QueueBuffer(true, handler);
+  return !pipe_->failed();
+}
+
+void PipelinedWriter::Drain(Function* done) {
+  if (!buffer_.empty()) {
+    QueueBuffer(false, NULL);
+  }
+  sequence_->Add(new DeliverFunction(pipe_, done));
+}
+
+void PipelinedWriter::QueueBuffer(bool flush, MessageHandler* handler) {
+  if (pipe_->Enqueue(&buffer_, flush, handler) > max_queued_bytes_) {
+    // The sequence has fallen too far behind; deliver the backlog here
+    // rather than let it grow without bound.
+    pipe_->Deliver();
+  } else {
+    sequence_->Add(new DeliverFunction(pipe_, NULL));
+  }
+}
+
+}  // namespace net_instaweb
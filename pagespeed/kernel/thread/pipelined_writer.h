@@ -0,0 +1,94 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Writer that decouples producing output from delivering it downstream.
+
+#ifndef PAGESPEED_KERNEL_THREAD_PIPELINED_WRITER_H_
+#define PAGESPEED_KERNEL_THREAD_PIPELINED_WRITER_H_
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/writer.h"
+
+namespace net_instaweb {
+
+class Function;
+class MessageHandler;
+class Sequence;
+class ThreadSystem;
+
+// Buffers writes made between flushes, and hands each flushed chunk to a
+// Sequence which writes it, followed by a Flush, to the wrapped writer.
+// This lets the producer (e.g. the HTML filter chain) start on the next
+// flush window while the previous one is still being delivered, while
+// keeping output in order.
+//
+// Write and Flush must be called from a single thread at a time.  The
+// wrapped writer must not be written to directly while chunks are pending.
+// Because delivery is asynchronous, Write and Flush report failures of the
+// wrapped writer lazily: once a downstream Write or Flush fails, all
+// subsequent calls return false.
+//
+// At most max_queued_bytes of flushed output wait for the sequence; beyond
+// that, Flush delivers the backlog itself, so a slow client throttles the
+// producer as it would without pipelining.
+//
+// The closures queued on the sequence share ownership of the pending chunks,
+// not of the PipelinedWriter, so the writer may be destroyed while they are
+// still queued.  Destruction waits for any in-progress delivery and drops
+// the rest; nothing is written to the wrapped writer afterwards.
+class PipelinedWriter : public Writer {
+ public:
+  // Does not take ownership of writer, sequence or thread_system.
+  PipelinedWriter(Writer* writer, Sequence* sequence,
+                  ThreadSystem* thread_system, int64 max_queued_bytes);
+  virtual ~PipelinedWriter();
+
+  virtual bool Write(const StringPiece& str, MessageHandler* handler);
+  virtual bool Flush(MessageHandler* handler);
+
+  // Hands any buffered bytes to the sequence (without flushing the wrapped
+  // writer), then queues 'done' to run once everything queued so far has
+  // been written.  'done' is run, never canceled, even if the sequence
+  // drops the delivery, in which case subsequent Writes return false.
+  void Drain(Function* done);
+
+  Writer* writer() const { return writer_; }
+
+ private:
+  class DeliverFunction;
+  class Pipe;
+
+  // Hands buffer_ to the sequence, optionally followed by a Flush.
+  void QueueBuffer(bool flush, MessageHandler* handler);
+
+  Writer* const writer_;
+  Sequence* const sequence_;
+  const int64 max_queued_bytes_;
+  GoogleString buffer_;
+  RefCountedPtr<Pipe> pipe_;
+
+  DISALLOW_COPY_AND_ASSIGN(PipelinedWriter);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_THREAD_PIPELINED_WRITER_H_
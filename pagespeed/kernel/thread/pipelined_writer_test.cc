@@ -0,0 +1,211 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/thread/pipelined_writer.h"
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/writer.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/thread/worker_test_base.h"
+
+namespace net_instaweb {
+
+class MessageHandler;
+
+namespace {
+
+// Records writes, marking each flush with a '|'.  Fails writes once
+// fail_ is set.
+class RecordingWriter : public Writer {
+ public:
+  RecordingWriter() : fail_(false) {}
+
+  virtual bool Write(const StringPiece& str, MessageHandler* handler) {
+    if (fail_) {
+      return false;
+    }
+    str.AppendToString(&contents_);
+    return true;
+  }
+
+  virtual bool Flush(MessageHandler* handler) {
+    contents_ += "|";
+    return true;
+  }
+
+  const GoogleString& contents() const { return contents_; }
+  void set_fail(bool x) { fail_ = x; }
+
+ private:
+  GoogleString contents_;
+  bool fail_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordingWriter);
+};
+
+// Notifies one SyncPoint on running, then waits on another.
+class NotifyAndWaitFunction : public Function {
+ public:
+  NotifyAndWaitFunction(WorkerTestBase::SyncPoint* started,
+                        WorkerTestBase::SyncPoint* resume)
+      : started_(started), resume_(resume) {}
+
+  virtual void Run() {
+    started_->Notify();
+    resume_->Wait();
+  }
+
+ private:
+  WorkerTestBase::SyncPoint* started_;
+  WorkerTestBase::SyncPoint* resume_;
+
+  DISALLOW_COPY_AND_ASSIGN(NotifyAndWaitFunction);
+};
+
+class PipelinedWriterTest : public WorkerTestBase {
+ protected:
+  static const int64 kMaxQueuedBytes = 1000;
+
+  PipelinedWriterTest()
+      : pool_(new QueuedWorkerPool(1, "pipelined_writer_test",
+                                   thread_runtime_.get())),
+        sequence_(pool_->NewSequence()),
+        writer_(&recorder_, sequence_, thread_runtime_.get(),
+                kMaxQueuedBytes) {
+  }
+
+  // Waits for everything already on the sequence to run.
+  void WaitForSequence() {
+    SyncPoint sync(thread_runtime_.get());
+    sequence_->Add(new NotifyRunFunction(&sync));
+    sync.Wait();
+  }
+
+  void Drain() {
+    SyncPoint sync(thread_runtime_.get());
+    writer_.Drain(new NotifyRunFunction(&sync));
+    sync.Wait();
+  }
+
+  scoped_ptr<QueuedWorkerPool> pool_;
+  QueuedWorkerPool::Sequence* sequence_;
+  RecordingWriter recorder_;
+  PipelinedWriter writer_;
+};
+
+TEST_F(PipelinedWriterTest, PreservesOrderAndFlushes) {
+  EXPECT_TRUE(writer_.Write("a", NULL));
+  EXPECT_TRUE(writer_.Write("b", NULL));
+  EXPECT_TRUE(writer_.Flush(NULL));
+  EXPECT_TRUE(writer_.Write("c", NULL));
+  EXPECT_TRUE(writer_.Flush(NULL));
+  EXPECT_TRUE(writer_.Write("d", NULL));
+  Drain();
+  EXPECT_EQ("ab|c|d", recorder_.contents());
+}
+
+TEST_F(PipelinedWriterTest, ProducerNotBlockedByDelivery) {
+  // Stall the sequence; the producer can keep writing and flushing, and
+  // everything is delivered in order once the sequence resumes.
+  SyncPoint stall(thread_runtime_.get());
+  sequence_->Add(new WaitRunFunction(&stall));
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(writer_.Write(IntegerToString(i), NULL));
+    EXPECT_TRUE(writer_.Flush(NULL));
+  }
+  EXPECT_EQ("", recorder_.contents());
+  stall.Notify();
+  Drain();
+  EXPECT_EQ("0|1|2|3|4|5|6|7|8|9|", recorder_.contents());
+}
+
+TEST_F(PipelinedWriterTest, DownstreamFailureIsSticky) {
+  recorder_.set_fail(true);
+  EXPECT_TRUE(writer_.Write("a", NULL));
+  EXPECT_TRUE(writer_.Flush(NULL));
+  Drain();
+  recorder_.set_fail(false);
+  EXPECT_FALSE(writer_.Write("b", NULL));
+  EXPECT_FALSE(writer_.Flush(NULL));
+  Drain();
+  EXPECT_EQ("", recorder_.contents());
+}
+
+TEST_F(PipelinedWriterTest, DestroyWithChunksQueued) {
+  // Destroying the writer while its chunks are still waiting on the sequence
+  // drops them; the queued closures must not touch the destroyed writer.
+  SyncPoint stall(thread_runtime_.get());
+  sequence_->Add(new WaitRunFunction(&stall));
+  scoped_ptr<PipelinedWriter> writer(new PipelinedWriter(
+      &recorder_, sequence_, thread_runtime_.get(), kMaxQueuedBytes));
+  EXPECT_TRUE(writer->Write("a", NULL));
+  EXPECT_TRUE(writer->Flush(NULL));
+  EXPECT_TRUE(writer->Write("b", NULL));
+  writer.reset();
+  stall.Notify();
+  WaitForSequence();
+  EXPECT_EQ("", recorder_.contents());
+}
+
+TEST_F(PipelinedWriterTest, QueueIsBounded) {
+  // Once more than max_queued_bytes are waiting, Flush delivers the backlog
+  // itself rather than queueing more.
+  SyncPoint stall(thread_runtime_.get());
+  sequence_->Add(new WaitRunFunction(&stall));
+  PipelinedWriter writer(&recorder_, sequence_, thread_runtime_.get(), 3);
+  EXPECT_TRUE(writer.Write("ab", NULL));
+  EXPECT_TRUE(writer.Flush(NULL));
+  EXPECT_EQ("", recorder_.contents());
+  EXPECT_TRUE(writer.Write("cd", NULL));
+  EXPECT_TRUE(writer.Flush(NULL));
+  EXPECT_EQ("ab|cd|", recorder_.contents());
+  stall.Notify();
+  SyncPoint sync(thread_runtime_.get());
+  writer.Drain(new NotifyRunFunction(&sync));
+  sync.Wait();
+  EXPECT_EQ("ab|cd|", recorder_.contents());
+}
+
+TEST_F(PipelinedWriterTest, CanceledDrainStillRunsDone) {
+  // When the sequence cancels delivery, as at shutdown, the output fails
+  // but the drain's callback still runs, so the request can complete.
+  SyncPoint started(thread_runtime_.get());
+  SyncPoint resume(thread_runtime_.get());
+  sequence_->Add(new NotifyAndWaitFunction(&started, &resume));
+  started.Wait();
+  EXPECT_TRUE(writer_.Write("a", NULL));
+  int count = 0;
+  writer_.Drain(new CountFunction(&count));
+  sequence_->CancelPendingFunctions();
+  EXPECT_EQ(1, count);
+  EXPECT_FALSE(writer_.Write("b", NULL));
+  resume.Notify();
+  WaitForSequence();
+  EXPECT_EQ("", recorder_.contents());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
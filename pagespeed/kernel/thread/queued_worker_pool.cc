@@ -20,18 +20,24 @@
 
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
 
+#include <algorithm>
+#include <cmath>
 #include <deque>
 #include <set>
 #include <vector>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomicops.h"
 #include "pagespeed/kernel/base/condvar.h"
 #include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/base/waveform.h"
+#include "pagespeed/kernel/thread/cpu_affinity.h"
 #include "pagespeed/kernel/thread/queued_worker.h"
 
 namespace net_instaweb {
@@ -46,6 +52,31 @@ inline void UpdateWaveform(Waveform* queue_size, int delta) {
 
 const size_t kUnboundedQueue = 0;
 
+// Values for Sequence::QueuedFunction's times when not applicable.
+const int64 kNotTimed = -1;
+const int64 kNoDeadline = -1;
+
+// CoDel recommends returning to the dropping rate in effect when we last
+// left the dropping state if we re-enter it within this many intervals.
+const int kDropRateMemoryIntervals = 16;
+
+// Queued as the first function on a new worker under EnableCoreAffinity.
+class PinWorkerFunction : public Function {
+ public:
+  explicit PinWorkerFunction(int cpu) : cpu_(cpu) {}
+
+ protected:
+  virtual void Run() {
+    if (!CpuAffinity::PinCurrentThread(cpu_)) {
+      LOG(WARNING) << "Unable to pin worker thread to CPU " << cpu_;
+    }
+  }
+
+ private:
+  int cpu_;
+  DISALLOW_COPY_AND_ASSIGN(PinWorkerFunction);
+};
+
 }  // namespace
 
 QueuedWorkerPool::QueuedWorkerPool(
@@ -55,8 +86,25 @@ QueuedWorkerPool::QueuedWorkerPool(
       max_workers_(max_workers),
       shutdown_(false),
       queue_size_(NULL),
-      load_shedding_threshold_(kNoLoadShedding) {
+      load_shedding_threshold_(kNoLoadShedding),
+      timer_(thread_system->NewTimer()),
+      sojourn_time_histogram_(NULL),
+      shedding_target_us_(0),
+      shedding_interval_us_(0),
+      shedding_mutex_(thread_system->NewMutex()),
+      first_above_target_us_(0),
+      drop_next_us_(0),
+      drop_count_(0),
+      last_drop_count_(0),
+      dropping_(false) {
   thread_name_base.CopyToString(&thread_name_base_);
+  max_background_workers_ = (max_workers > 1) ? (max_workers - 1) : 1;
+  for (int i = 0; i < kNumPriorities; ++i) {
+    queue_time_histograms_[i] = NULL;
+  }
+  for (int i = 0; i < kNumShedReasons; ++i) {
+    shed_counts_[i] = NULL;
+  }
 }
 
 QueuedWorkerPool::~QueuedWorkerPool() {
@@ -69,6 +117,7 @@ QueuedWorkerPool::~QueuedWorkerPool() {
     sequence->WaitForShutDown();
     delete sequence;
   }
+  STLDeleteElements(&work_queues_);
 }
 
 void QueuedWorkerPool::ShutDown() {
@@ -144,19 +193,52 @@ void QueuedWorkerPool::WaitForShutDownComplete() {
     delete worker;
   }
   available_workers_.clear();
+  worker_index_.clear();
+  num_available_workers_.set_value(0);
 }
 
 // Runs computable tasks through a worker.  Note that a first
 // candidate sequence is passed into this method, but we can start
 // looking at a new sequence when the passed-in one is exhausted
 void QueuedWorkerPool::Run(Sequence* sequence, QueuedWorker* worker) {
+  if (sequence == NULL) {
+    // Woken by WakeAvailableWorker, which leaves us to find the work.
+    sequence = AssignWorkerToNextSequence(worker);
+  }
+  Variable* busy_time = NULL;
+  if (!worker_cpus_.empty()) {
+    // Pinned, so the CPU will not change under us.
+    size_t cpu = static_cast<size_t>(CpuAffinity::CurrentCpu());
+    if (cpu < cpu_busy_time_stats_.size()) {
+      busy_time = cpu_busy_time_stats_[cpu];
+    }
+  }
   while (sequence != NULL) {
+    // The sequence may be recycled as soon as NextFunction returns NULL, so
+    // take note now of the priority it was dispatched with.
+    Priority priority = sequence->queued_priority_;
+    bool yielded = false;
+
     // This is a little unfair but we will continue to pull tasks from
     // the same sequence and run them until the sequence is exhausted.  This
     // avoids locking the pool's central mutex every time we want to
-    // run a new task; we need only mutex at the sequence level.
+    // run a new task; we need only mutex at the sequence level.  The
+    // exception is when a more urgent sequence is waiting for a worker, in
+    // which case we put this one back in the queue and go run that instead.
     while (Function* function = sequence->NextFunction()) {
+      int64 start_us = (busy_time == NULL) ? 0 : timer_->NowUs();
       function->CallRun();
+      if (busy_time != NULL) {
+        busy_time->Add(timer_->NowUs() - start_us);
+      }
+      if (HigherPriorityQueued(priority) && sequence->Yield()) {
+        yielded = true;
+        break;
+      }
+    }
+    ReleaseAdmission(priority);
+    if (yielded) {
+      QueueSequence(sequence);
     }
 
     // Once a sequence is exhausted see if there's another queued sequence,
@@ -169,62 +251,348 @@ void QueuedWorkerPool::Run(Sequence* sequence, QueuedWorker* worker) {
 QueuedWorkerPool::Sequence* QueuedWorkerPool::AssignWorkerToNextSequence(
     QueuedWorker* worker) {
   Sequence* sequence = NULL;
-  ScopedMutex lock(mutex_.get());
-  if (!shutdown_) {
-    if (queued_sequences_.empty()) {
-      int erased = active_workers_.erase(worker);
-      DCHECK_EQ(1, erased);
-      available_workers_.push_back(worker);
+  if (work_stealing()) {
+    sequence = StealSequence();
+    if (sequence != NULL) {
+      return sequence;
+    }
+  }
+  {
+    ScopedMutex lock(mutex_.get());
+    if (shutdown_) {
+      return NULL;
+    }
+    sequence = PopQueuedSequence();
+    if (sequence != NULL) {
+      return sequence;
+    }
+    int erased = active_workers_.erase(worker);
+    DCHECK_EQ(1, erased);
+    available_workers_.push_back(worker);
+    // Full barrier: pairs with the one in QueueSequence so that either it
+    // sees us as available, or our re-check below sees its sequence.
+    num_available_workers_.BarrierIncrement(1);
+  }
+  if (!work_stealing()) {
+    return NULL;
+  }
+
+  // A sequence may have been pushed between StealSequence above and our
+  // becoming available, by a thread that saw no available workers.
+  sequence = StealSequence();
+  if (sequence != NULL) {
+    ScopedMutex lock(mutex_.get());
+    if (shutdown_) {
+      // WaitForShutDownComplete reaps available_workers_ without the lock,
+      // so we must stay put.  The sequence is canceled by its own shutdown.
+      return NULL;
+    }
+    std::vector<QueuedWorker*>::iterator p = std::find(
+        available_workers_.begin(), available_workers_.end(), worker);
+    if (p != available_workers_.end()) {
+      available_workers_.erase(p);
+      num_available_workers_.BarrierIncrement(-1);
+      active_workers_.insert(worker);
     } else {
-      sequence = queued_sequences_.front();
-      queued_sequences_.pop_front();
+      // WakeAvailableWorker already claimed us and queued a Run on our
+      // thread, which will pick this sequence back up.
+      PushWorkQueue(sequence, true);
+      ReleaseAdmission(sequence->queued_priority_);
+      sequence = NULL;
     }
   }
   return sequence;
 }
 
+void QueuedWorkerPool::EnableWorkStealing() {
+  DCHECK(work_queues_.empty());
+  for (size_t i = 0; i < max_workers_; ++i) {
+    work_queues_.push_back(new WorkQueue(thread_system_->NewMutex()));
+  }
+}
+
+void QueuedWorkerPool::EnableCoreAffinity(const std::vector<int>& cpus) {
+  DCHECK(worker_cpus_.empty());
+  if (cpus.empty()) {
+    return;
+  }
+  if (work_queues_.empty()) {
+    EnableWorkStealing();
+  }
+  int max_cpu = 0;
+  for (size_t i = 0; i < max_workers_; ++i) {
+    worker_cpus_.push_back(cpus[i % cpus.size()]);
+    max_cpu = std::max(max_cpu, worker_cpus_.back());
+  }
+
+  // Work made runnable on one of our CPUs goes to its own workers; work
+  // from anywhere else goes to workers on the same NUMA node, if any.
+  std::vector<int> allowed;
+  CpuAffinity::AllowedCpus(&allowed);
+  for (int i = 0, n = allowed.size(); i < n; ++i) {
+    max_cpu = std::max(max_cpu, allowed[i]);
+  }
+  local_queues_.resize(max_cpu + 1);
+  std::vector<int> worker_nodes;
+  for (int i = 0, n = worker_cpus_.size(); i < n; ++i) {
+    local_queues_[worker_cpus_[i]].push_back(i);
+    worker_nodes.push_back(CpuAffinity::NumaNodeOfCpu(worker_cpus_[i]));
+  }
+  for (int cpu = 0; cpu <= max_cpu; ++cpu) {
+    int node = CpuAffinity::NumaNodeOfCpu(cpu);
+    if (!local_queues_[cpu].empty() || (node == CpuAffinity::kUnknown)) {
+      continue;
+    }
+    for (int i = 0, n = worker_nodes.size(); i < n; ++i) {
+      if (worker_nodes[i] == node) {
+        local_queues_[cpu].push_back(i);
+      }
+    }
+  }
+}
+
+const std::vector<int>* QueuedWorkerPool::LocalQueues() const {
+  if (local_queues_.empty()) {
+    return NULL;
+  }
+  size_t cpu = static_cast<size_t>(CpuAffinity::CurrentCpu());
+  if ((cpu >= local_queues_.size()) || local_queues_[cpu].empty()) {
+    return NULL;
+  }
+  return &local_queues_[cpu];
+}
+
+void QueuedWorkerPool::PushWorkQueue(Sequence* sequence, bool at_front) {
+  uint32 index = static_cast<uint32>(next_push_queue_.NoBarrierIncrement(1));
+  const std::vector<int>* local = LocalQueues();
+  if (local != NULL) {
+    index = (*local)[index % local->size()];
+  }
+  WorkQueue* queue = work_queues_[index % work_queues_.size()];
+  std::deque<Sequence*>* sequences =
+      &queue->sequences[sequence->queued_priority_];
+  ScopedMutex lock(queue->mutex.get());
+  if (at_front) {
+    sequences->push_front(sequence);
+  } else {
+    sequences->push_back(sequence);
+  }
+  NoteQueued(sequence);
+}
+
+QueuedWorkerPool::Sequence* QueuedWorkerPool::StealSequence() {
+  uint32 start = static_cast<uint32>(next_steal_queue_.NoBarrierIncrement(1));
+  const std::vector<int>* local = LocalQueues();
+  if (local != NULL) {
+    // Our own core's queue first.
+    start = (*local)[start % local->size()];
+  }
+  for (int p = 0; p < kNumPriorities; ++p) {
+    Priority priority = static_cast<Priority>(p);
+    if ((num_queued_[p].value() == 0) || !Admit(priority)) {
+      continue;
+    }
+    for (size_t i = 0, n = work_queues_.size(); i < n; ++i) {
+      WorkQueue* queue = work_queues_[(start + i) % n];
+      ScopedMutex lock(queue->mutex.get());
+      std::deque<Sequence*>& sequences = queue->sequences[p];
+      if (!sequences.empty()) {
+        Sequence* sequence = sequences.front();
+        sequences.pop_front();
+        NoteDequeued(sequence);
+        return sequence;
+      }
+    }
+    ReleaseAdmission(priority);
+  }
+  return NULL;
+}
+
+QueuedWorkerPool::Sequence* QueuedWorkerPool::PopQueuedSequence() {
+  for (int p = 0; p < kNumPriorities; ++p) {
+    std::deque<Sequence*>& sequences = queued_sequences_[p];
+    if (!sequences.empty() && Admit(static_cast<Priority>(p))) {
+      Sequence* sequence = sequences.front();
+      sequences.pop_front();
+      NoteDequeued(sequence);
+      return sequence;
+    }
+  }
+  return NULL;
+}
+
+void QueuedWorkerPool::NoteQueued(Sequence* sequence) {
+  num_queued_[sequence->queued_priority_].BarrierIncrement(1);
+  if (queue_time_histograms_[sequence->queued_priority_] != NULL) {
+    sequence->queued_us_ = timer_->NowUs();
+  }
+}
+
+void QueuedWorkerPool::NoteDequeued(Sequence* sequence) {
+  num_queued_[sequence->queued_priority_].BarrierIncrement(-1);
+  Histogram* histogram = queue_time_histograms_[sequence->queued_priority_];
+  if (histogram != NULL) {
+    histogram->Add(timer_->NowUs() - sequence->queued_us_);
+  }
+}
+
+bool QueuedWorkerPool::HigherPriorityQueued(Priority priority) const {
+  for (int p = 0; p < priority; ++p) {
+    if (num_queued_[p].value() != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool QueuedWorkerPool::Admit(Priority priority) {
+  if (priority != kBackground) {
+    return true;
+  }
+  while (true) {
+    int32 running = num_background_workers_.value();
+    if (running >= max_background_workers_) {
+      return false;
+    }
+    if (num_background_workers_.CompareAndSwap(running, running + 1) ==
+        running) {
+      return true;
+    }
+  }
+}
+
+void QueuedWorkerPool::ReleaseAdmission(Priority priority) {
+  if (priority == kBackground) {
+    num_background_workers_.BarrierIncrement(-1);
+  }
+}
+
+void QueuedWorkerPool::WakeAvailableWorker() {
+  QueuedWorker* worker = NULL;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (shutdown_ || available_workers_.empty()) {
+      return;
+    }
+    worker = ActivateAvailableWorker();
+  }
+  worker->RunInWorkThread(
+      new MemberFunction2<QueuedWorkerPool, QueuedWorkerPool::Sequence*,
+                          QueuedWorker*>(
+          &QueuedWorkerPool::Run, this, NULL, worker));
+}
+
+QueuedWorker* QueuedWorkerPool::ActivateAvailableWorker() {
+  std::vector<QueuedWorker*>::iterator p = available_workers_.end() - 1;
+  const std::vector<int>* local = LocalQueues();
+  if (local != NULL) {
+    for (std::vector<QueuedWorker*>::iterator q = available_workers_.begin();
+         q != available_workers_.end(); ++q) {
+      std::map<QueuedWorker*, int>::const_iterator index =
+          worker_index_.find(*q);
+      if ((index != worker_index_.end()) &&
+          (std::find(local->begin(), local->end(), index->second) !=
+           local->end())) {
+        p = q;
+        break;
+      }
+    }
+  }
+  QueuedWorker* worker = *p;
+  available_workers_.erase(p);
+  num_available_workers_.BarrierIncrement(-1);
+  active_workers_.insert(worker);
+  return worker;
+}
+
 void QueuedWorkerPool::QueueSequence(Sequence* sequence) {
+  Priority priority = sequence->priority();
+  sequence->queued_priority_ = priority;
+  if (work_stealing() &&
+      (num_available_workers_.value() == 0) &&
+      (static_cast<size_t>(num_workers_.value()) >= max_workers_)) {
+    // Every worker is busy, so one of them will pick this up when it
+    // finishes its current sequence; no need for the pool mutex.
+    PushWorkQueue(sequence, false);
+    base::subtle::MemoryBarrier();
+    if (num_available_workers_.value() != 0) {
+      WakeAvailableWorker();
+    }
+    return;
+  }
+
   QueuedWorker* worker = NULL;
   Sequence* drop_sequence = NULL;
   {
     ScopedMutex lock(mutex_.get());
-    if (available_workers_.empty()) {
+    bool admitted = Admit(priority);
+    if (admitted && !available_workers_.empty()) {
+      // We pulled a worker off the free-stack.
+      worker = ActivateAvailableWorker();
+    } else if (admitted && (active_workers_.size() < max_workers_)) {
       // If we have haven't yet initiated our full allotment of threads, add
       // on demand until we hit that limit.
-      if (active_workers_.size() < max_workers_) {
-        worker =
-            new QueuedWorker(StrCat(thread_name_base_, "-",
-                                    IntegerToString(active_workers_.size())),
-                             thread_system_);
-        worker->Start();
-        active_workers_.insert(worker);
+      int index = active_workers_.size();
+      worker =
+          new QueuedWorker(StrCat(thread_name_base_, "-",
+                                  IntegerToString(index)),
+                           thread_system_);
+      worker->Start();
+      if (!worker_cpus_.empty()) {
+        worker_index_[worker] = index;
+        worker->RunInWorkThread(new PinWorkerFunction(worker_cpus_[index]));
+      }
+      active_workers_.insert(worker);
+      num_workers_.BarrierIncrement(1);
+    } else {
+      // Either every worker is busy, or this is background work and enough
+      // workers are already running background work.  In the latter case
+      // one of those will pick this up when it finishes.
+      if (admitted) {
+        ReleaseAdmission(priority);
+      }
+      if (work_stealing()) {
+        // A worker that goes idle after this will find the sequence when it
+        // re-checks the work queues.
+        PushWorkQueue(sequence, false);
       } else {
         // No workers available: must queue the sequence.
-        queued_sequences_.push_back(sequence);
+        queued_sequences_[priority].push_back(sequence);
+        NoteQueued(sequence);
 
         // If too many sequences are waiting, we will cancel the oldest
-        // waiting one.
-        if ((load_shedding_threshold_ != kNoLoadShedding) &&
-            (queued_sequences_.size() >
-             static_cast<size_t>(load_shedding_threshold_))) {
-          drop_sequence = queued_sequences_.front();
-          queued_sequences_.pop_front();
+        // waiting one of the lowest priority.
+        if (load_shedding_threshold_ != kNoLoadShedding) {
+          size_t num_queued = 0;
+          for (int p = 0; p < kNumPriorities; ++p) {
+            num_queued += queued_sequences_[p].size();
+          }
+          for (int p = kNumPriorities - 1;
+               (p >= 0) && (num_queued >
+                            static_cast<size_t>(load_shedding_threshold_));
+               --p) {
+            if (!queued_sequences_[p].empty()) {
+              drop_sequence = queued_sequences_[p].front();
+              queued_sequences_[p].pop_front();
+              num_queued_[p].BarrierIncrement(-1);
+              break;
+            }
+          }
         }
       }
-    } else {
-      // We pulled a worker off the free-stack.
-      worker = available_workers_.back();
-      available_workers_.pop_back();
-      active_workers_.insert(worker);
     }
   }
 
   if (drop_sequence != NULL) {
-    drop_sequence->Cancel();
+    CountShed(kShedQueueLength, drop_sequence->Cancel());
   }
 
   // Run the worker without holding the Pool lock.
   if (worker != NULL) {
+    Histogram* histogram = queue_time_histograms_[priority];
+    if (histogram != NULL) {
+      histogram->Add(0);
+    }
     worker->RunInWorkThread(
         new MemberFunction2<QueuedWorkerPool, QueuedWorkerPool::Sequence*,
                             QueuedWorker*>(
@@ -263,6 +631,99 @@ void QueuedWorkerPool::SetLoadSheddingThreshold(int x) {
   load_shedding_threshold_ = x;
 }
 
+void QueuedWorkerPool::SetMaxBackgroundWorkers(int x) {
+  DCHECK_GT(x, 0);
+  max_background_workers_ = x;
+}
+
+void QueuedWorkerPool::EnableQueueTimeShedding(int64 target_us,
+                                               int64 interval_us) {
+  DCHECK_GT(target_us, 0);
+  DCHECK_GE(interval_us, target_us);
+  shedding_target_us_ = target_us;
+  shedding_interval_us_ = interval_us;
+}
+
+int64 QueuedWorkerPool::QueueTimeUs(bool has_timeout) {
+  if (has_timeout || (shedding_target_us_ > 0) ||
+      (sojourn_time_histogram_ != NULL)) {
+    return timer_->NowUs();
+  }
+  return kNotTimed;
+}
+
+bool QueuedWorkerPool::ShouldShed(int64 queued_us, int64 deadline_us) {
+  if (queued_us == kNotTimed) {
+    return false;
+  }
+  int64 now_us = timer_->NowUs();
+  int64 sojourn_us = now_us - queued_us;
+  if (sojourn_time_histogram_ != NULL) {
+    sojourn_time_histogram_->Add(sojourn_us);
+  }
+  if ((deadline_us != kNoDeadline) && (now_us > deadline_us)) {
+    CountShed(kShedDeadline, 1);
+    return true;
+  }
+  if ((shedding_target_us_ > 0) && QueueTimeShouldShed(sojourn_us, now_us)) {
+    CountShed(kShedQueueTime, 1);
+    return true;
+  }
+  return false;
+}
+
+bool QueuedWorkerPool::QueueTimeShouldShed(int64 sojourn_us, int64 now_us) {
+  ScopedMutex lock(shedding_mutex_.get());
+
+  // A single short wait says nothing about whether the queue is standing,
+  // so we only consider shedding once waits have stayed over target for a
+  // whole interval.
+  bool over_target_for_interval = false;
+  if (sojourn_us < shedding_target_us_) {
+    first_above_target_us_ = 0;
+  } else if (first_above_target_us_ == 0) {
+    first_above_target_us_ = now_us + shedding_interval_us_;
+  } else if (now_us >= first_above_target_us_) {
+    over_target_for_interval = true;
+  }
+
+  if (dropping_) {
+    if (!over_target_for_interval) {
+      dropping_ = false;
+      return false;
+    }
+    if (now_us < drop_next_us_) {
+      return false;
+    }
+    // Drop at a rate that increases with the square root of the number of
+    // drops so far, until the queue drains.
+    ++drop_count_;
+    drop_next_us_ += shedding_interval_us_ / std::sqrt(drop_count_);
+    return true;
+  }
+  if (!over_target_for_interval) {
+    return false;
+  }
+  dropping_ = true;
+  int delta = drop_count_ - last_drop_count_;
+  if ((delta > 1) &&
+      (now_us - drop_next_us_ <
+       kDropRateMemoryIntervals * shedding_interval_us_)) {
+    drop_count_ = delta;
+  } else {
+    drop_count_ = 1;
+  }
+  last_drop_count_ = drop_count_;
+  drop_next_us_ = now_us + shedding_interval_us_ / std::sqrt(drop_count_);
+  return true;
+}
+
+void QueuedWorkerPool::CountShed(ShedReason reason, int count) {
+  if ((shed_counts_[reason] != NULL) && (count != 0)) {
+    shed_counts_[reason]->Add(count);
+  }
+}
+
 QueuedWorkerPool::Sequence* QueuedWorkerPool::NewSequence() {
   ScopedMutex lock(mutex_.get());
   Sequence* sequence = NULL;
@@ -305,7 +766,9 @@ QueuedWorkerPool::Sequence::Sequence(ThreadSystem* thread_system,
       pool_(pool),
       termination_condvar_(sequence_mutex_->NewCondvar()),
       queue_size_(NULL),
-      max_queue_size_(kUnboundedQueue) {
+      max_queue_size_(kUnboundedQueue),
+      queued_priority_(kNormal),
+      queued_us_(0) {
   Reset();
 }
 
@@ -313,6 +776,7 @@ void QueuedWorkerPool::Sequence::Reset() {
   ScopedMutex lock(sequence_mutex_.get());
   shutdown_ = false;
   active_ = false;
+  priority_.set_value(kNormal);
   DCHECK(work_queue_.empty());
 }
 
@@ -353,7 +817,7 @@ void QueuedWorkerPool::Sequence::WaitForShutDown() {
 int QueuedWorkerPool::Sequence::CancelTasksOnWorkQueue() {
   int num_canceled = 0;
   while (!work_queue_.empty()) {
-    Function* function = work_queue_.front();
+    Function* function = work_queue_.front().function;
     work_queue_.pop_front();
     sequence_mutex_->Unlock();
     function->CallCancel();
@@ -363,7 +827,7 @@ int QueuedWorkerPool::Sequence::CancelTasksOnWorkQueue() {
   return num_canceled;
 }
 
-void QueuedWorkerPool::Sequence::Cancel() {
+int QueuedWorkerPool::Sequence::Cancel() {
   int num_canceled = 0;
   {
     ScopedMutex lock(sequence_mutex_.get());
@@ -371,11 +835,24 @@ void QueuedWorkerPool::Sequence::Cancel() {
   }
 
   UpdateWaveform(queue_size_, -num_canceled);
+  return num_canceled;
 }
 
 void QueuedWorkerPool::Sequence::Add(Function* function) {
+  AddImpl(function, kNoDeadline);
+}
+
+void QueuedWorkerPool::Sequence::AddWithTimeout(Function* function,
+                                                int64 timeout_us) {
+  DCHECK_GE(timeout_us, 0);
+  AddImpl(function, timeout_us);
+}
+
+void QueuedWorkerPool::Sequence::AddImpl(Function* function,
+                                         int64 timeout_us) {
   bool queue_sequence = false;
   bool cancel = false;
+  QueuedWorkerPool* shed_from_pool = NULL;
   {
     ScopedMutex lock(sequence_mutex_.get());
     if (shutdown_) {
@@ -393,17 +870,25 @@ void QueuedWorkerPool::Sequence::Add(Function* function) {
         // of older HTML requests that are waiting to be retired.  We'd rather
         // retire them without optimization than delay them further with a
         // slow cache.
-        function = work_queue_.front();
+        function = work_queue_.front().function;
         work_queue_.pop_front();
         cancel = true;
+        shed_from_pool = pool_;
       }
 
-      work_queue_.push_back(function_to_add);
+      bool has_timeout = (timeout_us != kNoDeadline);
+      int64 queued_us = pool_->QueueTimeUs(has_timeout);
+      work_queue_.push_back(QueuedFunction(
+          function_to_add, queued_us,
+          has_timeout ? queued_us + timeout_us : kNoDeadline));
       queue_sequence = (!active_ && (work_queue_.size() == 1));
     }
   }
   if (cancel) {
     function->CallCancel();
+    if (shed_from_pool != NULL) {
+      shed_from_pool->CountShed(kShedQueueLength, 1);
+    }
   }
   if (queue_sequence) {
     pool_->QueueSequence(this);
@@ -412,64 +897,84 @@ void QueuedWorkerPool::Sequence::Add(Function* function) {
 }
 
 void QueuedWorkerPool::Sequence::CancelPendingFunctions() {
-  std::deque<Function*> cancel_queue;
+  std::deque<QueuedFunction> cancel_queue;
   {
     ScopedMutex lock(sequence_mutex_.get());
     work_queue_.swap(cancel_queue);
   }
   UpdateWaveform(queue_size_, -static_cast<int>(cancel_queue.size()));
   while (!cancel_queue.empty()) {
-    Function* f = cancel_queue.front();
+    Function* f = cancel_queue.front().function;
     cancel_queue.pop_front();
     f->CallCancel();
   }
 }
 
 Function* QueuedWorkerPool::Sequence::NextFunction() {
-  Function* function = NULL;
-  QueuedWorkerPool* release_to_pool = NULL;
-  int queue_size_delta = 0;
-  {
-    ScopedMutex lock(sequence_mutex_.get());
-    if (shutdown_) {
-      if (active_) {
-        if (!work_queue_.empty()) {
-          LOG(WARNING) << "Canceling " << work_queue_.size()
-                       << " functions on sequence Shutdown";
-          queue_size_delta -= CancelTasksOnWorkQueue();
+  // Functions the pool decides to shed are canceled here, in sequence order,
+  // and we move on to the next.  active_ remains true while we cancel them,
+  // so nothing else in the sequence can start in the meantime.
+  while (true) {
+    Function* function = NULL;
+    bool shed = false;
+    QueuedWorkerPool* release_to_pool = NULL;
+    int queue_size_delta = 0;
+    {
+      ScopedMutex lock(sequence_mutex_.get());
+      if (shutdown_) {
+        if (active_) {
+          if (!work_queue_.empty()) {
+            LOG(WARNING) << "Canceling " << work_queue_.size()
+                         << " functions on sequence Shutdown";
+            queue_size_delta -= CancelTasksOnWorkQueue();
+          }
+          active_ = false;
+
+          // Note after the Signal(), the current sequence may be
+          // deleted if we are in the process of shutting down the
+          // entire pool, so no further access to member variables is
+          // allowed.  Hence we copied the pool_ variable to a local
+          // temp so we can return it.  Note also that if the pool is in
+          // the process of shutting down, then pool_ will be NULL so we
+          // won't bother to add the free_sequences_ list.  In any case
+          // this will be cleaned on shutdown via all_sequences_.
+          release_to_pool = pool_;
+          termination_condvar_->Signal();
         }
+      } else if (work_queue_.empty()) {
         active_ = false;
-
-        // Note after the Signal(), the current sequence may be
-        // deleted if we are in the process of shutting down the
-        // entire pool, so no further access to member variables is
-        // allowed.  Hence we copied the pool_ variable to a local
-        // temp so we can return it.  Note also that if the pool is in
-        // the process of shutting down, then pool_ will be NULL so we
-        // won't bother to add the free_sequences_ list.  In any case
-        // this will be cleaned on shutdown via all_sequences_.
-        release_to_pool = pool_;
-        termination_condvar_->Signal();
+      } else {
+        const QueuedFunction& next = work_queue_.front();
+        function = next.function;
+        shed = pool_->ShouldShed(next.queued_us, next.deadline_us);
+        work_queue_.pop_front();
+        active_ = true;
+        --queue_size_delta;
       }
-    } else if (work_queue_.empty()) {
-      active_ = false;
-    } else {
-      function = work_queue_.front();
-      work_queue_.pop_front();
-      active_ = true;
-      --queue_size_delta;
     }
+    if (release_to_pool != NULL) {
+      // If the entire pool is in the process of shutting down when
+      // NextFunction is called, we don't need to add this to the
+      // free list; the pool will directly delete all sequences from
+      // QueuedWorkerPool::ShutDown().
+      release_to_pool->SequenceNoLongerActive(this);
+    }
+    UpdateWaveform(queue_size_, queue_size_delta);
+
+    if (!shed) {
+      return function;
+    }
+    function->CallCancel();
   }
-  if (release_to_pool != NULL) {
-    // If the entire pool is in the process of shutting down when
-    // NextFunction is called, we don't need to add this to the
-    // free list; the pool will directly delete all sequences from
-    // QueuedWorkerPool::ShutDown().
-    release_to_pool->SequenceNoLongerActive(this);
-  }
-  UpdateWaveform(queue_size_, queue_size_delta);
+}
 
-  return function;
+bool QueuedWorkerPool::Sequence::Yield() {
+  ScopedMutex lock(sequence_mutex_.get());
+  if (shutdown_ || work_queue_.empty()) {
+    return false;
+  }
+  active_ = false;
+  return true;
 }
 
 bool QueuedWorkerPool::Sequence::IsBusy() {
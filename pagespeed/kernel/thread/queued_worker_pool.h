@@ -29,10 +29,12 @@
 
 #include <cstddef>  // for size_t
 #include <deque>
+#include <map>
 #include <set>
 #include <vector>
 
 #include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_int32.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
@@ -44,7 +46,10 @@
 
 namespace net_instaweb {
 
+class Histogram;
 class QueuedWorker;
+class Timer;
+class Variable;
 class Waveform;
 
 // Maintains a predefined number of worker threads, and dispatches any
@@ -53,6 +58,34 @@ class QueuedWorkerPool {
  public:
   static const int kNoLoadShedding = -1;
 
+  // Sequences are dispatched to workers in priority order, and within a
+  // priority in the order they became runnable.  A worker running a sequence
+  // yields it back to the queue between functions if a sequence of strictly
+  // higher priority is waiting, so a long-running low-priority sequence
+  // delays more urgent work by at most one function.
+  enum Priority {
+    // Work an HTML response is blocked on, subject to a rewrite deadline.
+    kDeadlineCritical,
+    // The default.
+    kNormal,
+    // Work nobody is waiting on, e.g. rewrites that continue after their
+    // deadline has passed and in-place resource recording.
+    kBackground,
+    kNumPriorities
+  };
+
+  // Reasons for which queued functions are canceled rather than run.
+  enum ShedReason {
+    // The pool's SetLoadSheddingThreshold or a sequence's
+    // set_max_queue_size limit was exceeded.
+    kShedQueueLength,
+    // EnableQueueTimeShedding found the queue persistently backed up.
+    kShedQueueTime,
+    // The timeout passed to Sequence::AddWithTimeout expired.
+    kShedDeadline,
+    kNumShedReasons
+  };
+
   QueuedWorkerPool(int max_workers, StringPiece thread_name_base,
                    ThreadSystem* thread_system);
   ~QueuedWorkerPool();
@@ -104,6 +137,13 @@ class QueuedWorkerPool {
     // this method will call function->Cancel().
     void Add(Function* function) LOCKS_EXCLUDED(sequence_mutex_);
 
+    // Like Add, but if 'function' has not started running within
+    // 'timeout_us' of being added -- typically the time left before whoever
+    // is waiting for its result gives up -- it is canceled instead, as the
+    // work can no longer be of use.
+    void AddWithTimeout(Function* function, int64 timeout_us)
+        LOCKS_EXCLUDED(sequence_mutex_);
+
     void set_queue_size_stat(Waveform* x) { queue_size_ = x; }
 
     // Sets the maximum number of functions that can be enqueued to a sequence.
@@ -114,6 +154,14 @@ class QueuedWorkerPool {
     // Calls Cancel on all pending functions in the queue.
     void CancelPendingFunctions() LOCKS_EXCLUDED(sequence_mutex_);
 
+    // Sets the priority with which this sequence competes for workers.  This
+    // may be called at any time; it takes effect the next time the sequence
+    // is queued to run.  Sequences start out, and are recycled as, kNormal.
+    void set_priority(Priority x) { priority_.set_value(x); }
+    Priority priority() const {
+      return static_cast<Priority>(priority_.value());
+    }
+
    private:
     // Construct using QueuedWorkerPool::NewSequence().
     Sequence(ThreadSystem* thread_system, QueuedWorkerPool* pool);
@@ -138,7 +186,8 @@ class QueuedWorkerPool {
     bool InitiateShutDown() LOCKS_EXCLUDED(sequence_mutex_);
 
     // Gets the next function in the sequence, and transfers ownership
-    // the the caller.
+    // the the caller.  Functions ahead of it that the pool decides to shed
+    // are canceled first.
     Function* NextFunction() LOCKS_EXCLUDED(sequence_mutex_);
 
     bool IsBusy() EXCLUSIVE_LOCKS_REQUIRED(sequence_mutex_);
@@ -146,11 +195,34 @@ class QueuedWorkerPool {
     // Returns number of tasks that were canceled.
     int CancelTasksOnWorkQueue() EXCLUSIVE_LOCKS_REQUIRED(sequence_mutex_);
 
-    // Cancels all pending tasks (and updates stats appropriately).
-    void Cancel() LOCKS_EXCLUDED(sequence_mutex_);
+    // Cancels all pending tasks (and updates stats appropriately), returning
+    // the number canceled.
+    int Cancel() LOCKS_EXCLUDED(sequence_mutex_);
+
+    // Called by the worker running this sequence between functions when it
+    // wants to run something more urgent.  Returns true if the sequence has
+    // more work and has been marked inactive, in which case the caller must
+    // queue it again.  Returns false if the sequence is idle or shutting
+    // down, in which case the caller should just carry on with it.
+    bool Yield() LOCKS_EXCLUDED(sequence_mutex_);
+
+    // A function waiting to run, with the pool-timer times at which it was
+    // queued and after which it should be canceled rather than run.  These
+    // are negative if the pool is not tracking queue times, or the function
+    // has no timeout, respectively.
+    struct QueuedFunction {
+      QueuedFunction(Function* f, int64 queued, int64 deadline)
+          : function(f), queued_us(queued), deadline_us(deadline) {}
+      Function* function;
+      int64 queued_us;
+      int64 deadline_us;
+    };
+
+    void AddImpl(Function* function, int64 timeout_us)
+        LOCKS_EXCLUDED(sequence_mutex_);
 
     friend class QueuedWorkerPool;
-    std::deque<Function*> work_queue_ GUARDED_BY(sequence_mutex_);
+    std::deque<QueuedFunction> work_queue_ GUARDED_BY(sequence_mutex_);
     scoped_ptr<ThreadSystem::CondvarCapableMutex> sequence_mutex_;
     QueuedWorkerPool* pool_;
     bool shutdown_ GUARDED_BY(sequence_mutex_);
@@ -159,6 +231,13 @@ class QueuedWorkerPool {
         GUARDED_BY(sequence_mutex_);
     Waveform* queue_size_;
     size_t max_queue_size_;
+    AtomicInt32 priority_;
+
+    // Set by the pool while the sequence is waiting in one of its queues.
+    // queued_priority_ is the priority it was queued with, which may differ
+    // from priority_ if that has since changed.
+    Priority queued_priority_;
+    int64 queued_us_;
 
     DISALLOW_COPY_AND_ASSIGN(Sequence);
   };
@@ -223,8 +302,158 @@ class QueuedWorkerPool {
   // This must be called prior to creating sequences.
   void set_queue_size_stat(Waveform* x) { queue_size_ = x; }
 
+  // Records, in microseconds, how long sequences of the given priority wait
+  // between becoming runnable and being picked up by a worker.  Sequences
+  // handed straight to an idle worker record a wait of 0.
+  //
+  // Should be called before starting any work.
+  void set_queue_time_histogram(Priority priority, Histogram* x) {
+    queue_time_histograms_[priority] = x;
+  }
+
+  // Limits how many workers may run kBackground sequences at once, so that
+  // background work cannot occupy every worker and make more urgent
+  // sequences wait for one of them to finish.  Defaults to all but one of
+  // the workers, or 1 for a single-worker pool.
+  //
+  // Should be called before starting any work.
+  void SetMaxBackgroundWorkers(int x);
+
+  // Enables CoDel-style shedding based on how long functions wait in their
+  // sequences.  Short bursts of queueing are fine, but once every function
+  // dequeued over a full interval_us has waited at least target_us, the
+  // queue is considered to be standing, and functions are canceled as they
+  // reach the head of their sequence, at an increasing rate, until waits
+  // drop back under target_us.  Unlike SetLoadSheddingThreshold this does
+  // not depend on how many sequences are queued, so it does not drop work
+  // from a deep queue that is draining quickly.
+  //
+  // As with load shedding, this should only be used for pools whose
+  // functions are safe to cancel, and should be called before starting any
+  // work.
+  void EnableQueueTimeShedding(int64 target_us, int64 interval_us);
+
+  // Counts functions canceled for the given reason.
+  void set_shed_count_stat(ShedReason reason, Variable* x) {
+    shed_counts_[reason] = x;
+  }
+
+  // Records, in microseconds, how long each function waits in its sequence
+  // before being run or shed.  Sojourn times are only tracked while this,
+  // EnableQueueTimeShedding or Sequence::AddWithTimeout calls for them.
+  //
+  // Should be called before starting any work.
+  void set_sojourn_time_histogram(Histogram* x) { sojourn_time_histogram_ = x; }
+
+  // Switches the pool to work-stealing dispatch.  Rather than funneling
+  // every runnable sequence through one queue under the pool mutex, runnable
+  // sequences are spread across one queue per worker, each with its own
+  // mutex, and a worker that exhausts its sequence takes the next one from
+  // whichever queue has work.  The pool mutex is then only needed to park or
+  // wake idle workers.  Functions within a Sequence still run in FIFO order,
+  // as a sequence is never queued in more than one place at a time.
+  //
+  // Load shedding needs a single queue to find the oldest waiting sequence,
+  // so this has no effect if SetLoadSheddingThreshold has enabled it.
+  //
+  // Should be called before starting any work.
+  void EnableWorkStealing();
+
+  // Runs the pool one worker per core.  This implies EnableWorkStealing,
+  // and pins the i'th worker started to cpus[i % cpus.size()].  A sequence
+  // that becomes runnable is handed to an idle worker on the CPU of the
+  // thread that made it runnable -- for a new request, the thread that
+  // accepted it -- or queued for that worker if none is idle, falling back
+  // to workers on the same NUMA node, so that a request's work tends to
+  // stay on the core whose caches already hold its data.  Workers look in
+  // their own core's queue before stealing from the others.
+  //
+  // Should be called before starting any work.
+  void EnableCoreAffinity(const std::vector<int>& cpus);
+
+  // Accumulates, in microseconds, the time workers pinned to each CPU spend
+  // running functions, indexed by CPU; CPUs beyond the end, or with NULL
+  // entries, are not tracked.  The rate of increase divided by a million is
+  // the fraction of that core this pool keeps busy.  Only recorded once
+  // EnableCoreAffinity has been called.
+  //
+  // Should be called before starting any work.
+  void set_cpu_busy_time_stats(const std::vector<Variable*>& x) {
+    cpu_busy_time_stats_ = x;
+  }
+
  private:
   friend class Sequence;
+
+  // One of the queues of runnable sequences used for work stealing, with one
+  // deque per priority.
+  struct WorkQueue {
+    explicit WorkQueue(AbstractMutex* m) : mutex(m) {}
+    scoped_ptr<AbstractMutex> mutex;
+    std::deque<Sequence*> sequences[kNumPriorities] GUARDED_BY(mutex);
+  };
+
+  bool work_stealing() const {
+    return !work_queues_.empty() &&
+        (load_shedding_threshold_ == kNoLoadShedding);
+  }
+
+  // Adds a runnable sequence to one of work_queues_, round-robin, according
+  // to its queued_priority_.  If at_front is true the sequence goes ahead of
+  // the others of that priority in its queue.
+  void PushWorkQueue(Sequence* sequence, bool at_front);
+
+  // Takes the oldest sequence of the highest priority with work waiting,
+  // starting the search at a different queue each call.  Returns NULL if
+  // all are empty, or if only kBackground sequences are waiting and
+  // AdmitBackground refuses them.
+  Sequence* StealSequence();
+
+  // With core affinity, returns the indexes of the work_queues_ (and so of
+  // the workers) preferred by the calling thread's CPU, or NULL if it has
+  // none.
+  const std::vector<int>* LocalQueues() const;
+
+  // Moves an available worker to active_workers_ and returns it, preferring
+  // one local to the calling thread.  available_workers_ must be non-empty.
+  QueuedWorker* ActivateAvailableWorker() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Like StealSequence, but for the central queued_sequences_.
+  Sequence* PopQueuedSequence() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Bookkeeping for a sequence entering or leaving a queue: tracks
+  // num_queued_ and the queue-time histograms.
+  void NoteQueued(Sequence* sequence);
+  void NoteDequeued(Sequence* sequence);
+
+  // Returns true if a sequence of a priority strictly higher than 'priority'
+  // is waiting to run.
+  bool HigherPriorityQueued(Priority priority) const;
+
+  // Reserves one of the max_background_workers_ slots, returning false if
+  // all are in use.  Non-background priorities are always admitted.  Each
+  // successful call must be matched by a call to ReleaseAdmission once the
+  // worker is done with the sequence.
+  bool Admit(Priority priority);
+  void ReleaseAdmission(Priority priority);
+
+  // Returns the time to record as a function's queue time, or -1 if sojourn
+  // times are not being tracked.
+  int64 QueueTimeUs(bool has_timeout);
+
+  // Called as a function is dequeued; returns true if it should be canceled
+  // instead of run, counting the reason.
+  bool ShouldShed(int64 queued_us, int64 deadline_us);
+
+  // The CoDel drop decision for a function that waited sojourn_us.
+  bool QueueTimeShouldShed(int64 sojourn_us, int64 now_us)
+      LOCKS_EXCLUDED(shedding_mutex_);
+
+  void CountShed(ShedReason reason, int count);
+
+  // Called after a sequence has been pushed without the pool mutex held, in
+  // case all workers went idle in the meantime.
+  void WakeAvailableWorker();
   void Run(Sequence* sequence, QueuedWorker* worker);
   void QueueSequence(Sequence* sequence);
   Sequence* AssignWorkerToNextSequence(QueuedWorker* worker);
@@ -238,11 +467,38 @@ class QueuedWorkerPool {
   std::vector<QueuedWorker*> available_workers_;
 
   // queued_sequences_ and free_sequences_ are mutually exclusive, but
-  // all_sequences contains all of them.
+  // all_sequences contains all of them.  queued_sequences_ has one deque per
+  // priority.
   std::vector<Sequence*> all_sequences_;
-  std::deque<Sequence*> queued_sequences_;
+  std::deque<Sequence*> queued_sequences_[kNumPriorities];
   std::vector<Sequence*> free_sequences_;
 
+  // Number of sequences waiting in queued_sequences_ or work_queues_, per
+  // priority; lets workers check for more urgent work without locking.
+  AtomicInt32 num_queued_[kNumPriorities];
+
+  // Number of workers currently running kBackground sequences.
+  AtomicInt32 num_background_workers_;
+  int max_background_workers_;
+
+  // Work-stealing state; see EnableWorkStealing.  num_available_workers_
+  // mirrors available_workers_.size() and num_workers_ counts all started
+  // workers, so QueueSequence can tell that every worker is busy without
+  // taking mutex_.
+  std::vector<WorkQueue*> work_queues_;
+  AtomicInt32 next_push_queue_;
+  AtomicInt32 next_steal_queue_;
+  AtomicInt32 num_available_workers_;
+  AtomicInt32 num_workers_;
+
+  // Core-affinity state; see EnableCoreAffinity.  worker_cpus_[i] is the CPU
+  // the i'th worker, which owns work_queues_[i], is pinned to, and
+  // local_queues_[cpu] lists the queues preferred by threads on that CPU.
+  std::vector<int> worker_cpus_;
+  std::vector<std::vector<int> > local_queues_;
+  std::map<QueuedWorker*, int> worker_index_ GUARDED_BY(mutex_);
+  std::vector<Variable*> cpu_busy_time_stats_;
+
   GoogleString thread_name_base_;
 
   size_t max_workers_;
@@ -251,6 +507,23 @@ class QueuedWorkerPool {
   Waveform* queue_size_;
   int load_shedding_threshold_;
 
+  scoped_ptr<Timer> timer_;
+  Histogram* queue_time_histograms_[kNumPriorities];
+
+  Histogram* sojourn_time_histogram_;
+  Variable* shed_counts_[kNumShedReasons];
+
+  // CoDel state for EnableQueueTimeShedding; see RFC 8289.  A target of 0
+  // disables queue-time shedding.
+  int64 shedding_target_us_;
+  int64 shedding_interval_us_;
+  scoped_ptr<AbstractMutex> shedding_mutex_;
+  int64 first_above_target_us_ GUARDED_BY(shedding_mutex_);
+  int64 drop_next_us_ GUARDED_BY(shedding_mutex_);
+  int drop_count_ GUARDED_BY(shedding_mutex_);
+  int last_drop_count_ GUARDED_BY(shedding_mutex_);
+  bool dropping_ GUARDED_BY(shedding_mutex_);
+
   DISALLOW_COPY_AND_ASSIGN(QueuedWorkerPool);
 };
 
@@ -22,11 +22,19 @@
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
 
 #include "base/logging.h"
+#include <vector>
+
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/thread/cpu_affinity.h"
 #include "pagespeed/kernel/thread/worker_test_base.h"
+#include "pagespeed/kernel/util/simple_stats.h"
 
 namespace net_instaweb {
 namespace {
@@ -330,6 +338,461 @@ TEST_F(QueuedWorkerPoolTest, CancelPending) {
   EXPECT_EQ(-300, count);
 }
 
+// Appends a character to a string; used to check the order in which
+// sequences run on a single-worker pool.
+class AppendFunction : public Function {
+ public:
+  AppendFunction(char c, GoogleString* log) : c_(c), log_(log) {}
+
+ protected:
+  virtual void Run() { log_->push_back(c_); }
+
+ private:
+  char c_;
+  GoogleString* log_;
+
+  DISALLOW_COPY_AND_ASSIGN(AppendFunction);
+};
+
+class QueuedWorkerPoolPriorityTest : public QueuedWorkerPoolTest {
+ protected:
+  QueuedWorkerPoolPriorityTest() : stats_(thread_runtime_.get()) {
+    worker_.reset(new QueuedWorkerPool(1, "priority_test",
+                                       thread_runtime_.get()));
+    static const char* kNames[QueuedWorkerPool::kNumPriorities] = {
+      "critical", "normal", "background"
+    };
+    for (int i = 0; i < QueuedWorkerPool::kNumPriorities; ++i) {
+      QueuedWorkerPool::Priority priority =
+          static_cast<QueuedWorkerPool::Priority>(i);
+      histograms_[i] = stats_.AddHistogram(kNames[i]);
+      worker_->set_queue_time_histogram(priority, histograms_[i]);
+    }
+  }
+
+  QueuedWorkerPool::Sequence* NewSequence(QueuedWorkerPool::Priority p) {
+    QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
+    sequence->set_priority(p);
+    return sequence;
+  }
+
+  SimpleStats stats_;
+  Histogram* histograms_[QueuedWorkerPool::kNumPriorities];
+};
+
+// Sequences waiting for the worker are run most urgent first, regardless
+// of the order in which they were queued.
+TEST_F(QueuedWorkerPoolPriorityTest, RunsInPriorityOrder) {
+  SyncPoint wedge(thread_runtime_.get());
+  SyncPoint done(thread_runtime_.get());
+  QueuedWorkerPool::Sequence* wedge_sequence =
+      NewSequence(QueuedWorkerPool::kNormal);
+  wedge_sequence->Add(new WaitRunFunction(&wedge));
+
+  GoogleString log;
+  NewSequence(QueuedWorkerPool::kBackground)->Add(
+      new AppendFunction('b', &log));
+  NewSequence(QueuedWorkerPool::kNormal)->Add(new AppendFunction('n', &log));
+  NewSequence(QueuedWorkerPool::kDeadlineCritical)->Add(
+      new AppendFunction('c', &log));
+  NewSequence(QueuedWorkerPool::kBackground)->Add(
+      new NotifyRunFunction(&done));
+  wedge.Notify();
+  done.Wait();
+  EXPECT_STREQ("cnb", log);
+
+  // The wedge went straight to the idle worker; everything else waited.
+  EXPECT_EQ(1, histograms_[QueuedWorkerPool::kDeadlineCritical]->Count());
+  EXPECT_EQ(2, histograms_[QueuedWorkerPool::kNormal]->Count());
+  EXPECT_EQ(2, histograms_[QueuedWorkerPool::kBackground]->Count());
+  EXPECT_EQ(0, histograms_[QueuedWorkerPool::kNormal]->Minimum());
+}
+
+// A background sequence with a backlog gives up the worker between
+// functions once critical work is waiting for it.
+TEST_F(QueuedWorkerPoolPriorityTest, PreemptsBetweenFunctions) {
+  SyncPoint started(thread_runtime_.get());
+  SyncPoint wait(thread_runtime_.get());
+  SyncPoint done(thread_runtime_.get());
+  GoogleString log;
+  QueuedWorkerPool::Sequence* background =
+      NewSequence(QueuedWorkerPool::kBackground);
+  background->Add(new NotifyAndWait(&started, &wait));
+  background->Add(new AppendFunction('b', &log));
+  background->Add(new AppendFunction('b', &log));
+  background->Add(new NotifyRunFunction(&done));
+  started.Wait();
+
+  NewSequence(QueuedWorkerPool::kDeadlineCritical)->Add(
+      new AppendFunction('c', &log));
+  wait.Notify();
+  done.Wait();
+  EXPECT_STREQ("cbb", log);
+}
+
+// Background work is kept off at least one worker, so it cannot hold up
+// normal work.
+TEST_F(QueuedWorkerPoolPriorityTest, BackgroundAdmission) {
+  worker_.reset(new QueuedWorkerPool(2, "admission_test",
+                                     thread_runtime_.get()));
+  SyncPoint started(thread_runtime_.get());
+  SyncPoint wait(thread_runtime_.get());
+  SyncPoint normal_done(thread_runtime_.get());
+  SyncPoint background_done(thread_runtime_.get());
+  GoogleString log;
+
+  NewSequence(QueuedWorkerPool::kBackground)->Add(
+      new NotifyAndWait(&started, &wait));
+  started.Wait();
+  QueuedWorkerPool::Sequence* background =
+      NewSequence(QueuedWorkerPool::kBackground);
+  background->Add(new AppendFunction('b', &log));
+  background->Add(new NotifyRunFunction(&background_done));
+
+  // The second worker is free, but only for non-background work.
+  NewSequence(QueuedWorkerPool::kNormal)->Add(
+      new NotifyRunFunction(&normal_done));
+  normal_done.Wait();
+  EXPECT_STREQ("", log);
+
+  wait.Notify();
+  background_done.Wait();
+  EXPECT_STREQ("b", log);
+}
+
+// Counts runs and cancellations, optionally sleeping when run.
+class CountingFunction : public Function {
+ public:
+  CountingFunction(Timer* timer, int64 sleep_us, int* runs, int* cancels)
+      : timer_(timer), sleep_us_(sleep_us), runs_(runs), cancels_(cancels) {}
+
+ protected:
+  virtual void Run() {
+    ++*runs_;
+    if (sleep_us_ > 0) {
+      timer_->SleepUs(sleep_us_);
+    }
+  }
+  virtual void Cancel() { ++*cancels_; }
+
+ private:
+  Timer* timer_;
+  int64 sleep_us_;
+  int* runs_;
+  int* cancels_;
+
+  DISALLOW_COPY_AND_ASSIGN(CountingFunction);
+};
+
+// Notifies a SyncPoint whether run or canceled, so it can be used to wait for
+// a sequence to drain when anything in it might be shed.
+class NotifyDoneFunction : public Function {
+ public:
+  explicit NotifyDoneFunction(WorkerTestBase::SyncPoint* sync) : sync_(sync) {}
+
+ protected:
+  virtual void Run() { sync_->Notify(); }
+  virtual void Cancel() { sync_->Notify(); }
+
+ private:
+  WorkerTestBase::SyncPoint* sync_;
+
+  DISALLOW_COPY_AND_ASSIGN(NotifyDoneFunction);
+};
+
+class QueuedWorkerPoolSheddingTest : public QueuedWorkerPoolTest {
+ protected:
+  QueuedWorkerPoolSheddingTest()
+      : stats_(thread_runtime_.get()),
+        timer_(thread_runtime_->NewTimer()),
+        runs_(0),
+        cancels_(0) {
+    worker_.reset(new QueuedWorkerPool(1, "shedding_test",
+                                       thread_runtime_.get()));
+    static const char* kNames[QueuedWorkerPool::kNumShedReasons] = {
+      "shed_queue_length", "shed_queue_time", "shed_deadline"
+    };
+    for (int i = 0; i < QueuedWorkerPool::kNumShedReasons; ++i) {
+      shed_counts_[i] = stats_.AddVariable(kNames[i]);
+      worker_->set_shed_count_stat(
+          static_cast<QueuedWorkerPool::ShedReason>(i), shed_counts_[i]);
+    }
+    sojourn_ = stats_.AddHistogram("sojourn");
+    worker_->set_sojourn_time_histogram(sojourn_);
+  }
+
+  CountingFunction* NewCountingFunction(int64 sleep_us) {
+    return new CountingFunction(timer_.get(), sleep_us, &runs_, &cancels_);
+  }
+
+  // Queues num_functions functions, each sleeping sleep_us when run, behind
+  // one that blocks the only worker for wedge_ms, then waits for them all.
+  void RunBacklog(int wedge_ms, int num_functions, int64 sleep_us) {
+    SyncPoint started(thread_runtime_.get());
+    SyncPoint wait(thread_runtime_.get());
+    QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
+    sequence->Add(new NotifyAndWait(&started, &wait));
+    started.Wait();
+    for (int i = 0; i < num_functions; ++i) {
+      sequence->Add(NewCountingFunction(sleep_us));
+    }
+    SyncPoint done(thread_runtime_.get());
+    sequence->Add(new NotifyDoneFunction(&done));
+    timer_->SleepMs(wedge_ms);
+    wait.Notify();
+    done.Wait();
+  }
+
+  int64 ShedCount(QueuedWorkerPool::ShedReason reason) {
+    return shed_counts_[reason]->Get();
+  }
+
+  SimpleStats stats_;
+  scoped_ptr<Timer> timer_;
+  Variable* shed_counts_[QueuedWorkerPool::kNumShedReasons];
+  Histogram* sojourn_;
+  int runs_;
+  int cancels_;
+};
+
+// Functions still queued when their timeout expires are canceled; others,
+// including those without a timeout, run in order.
+TEST_F(QueuedWorkerPoolSheddingTest, Timeout) {
+  SyncPoint started(thread_runtime_.get());
+  SyncPoint wait(thread_runtime_.get());
+  QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
+  sequence->Add(new NotifyAndWait(&started, &wait));
+  started.Wait();
+
+  int count = 0;
+  sequence->AddWithTimeout(new Increment(-100, &count), 1000);
+  sequence->AddWithTimeout(new Increment(-99, &count),
+                           Timer::kMinuteMs * Timer::kMsUs);
+  sequence->Add(new Increment(-98, &count));
+  timer_->SleepMs(20);
+  wait.Notify();
+  WaitUntilSequenceCompletes(sequence);
+  EXPECT_EQ(-98, count);
+  EXPECT_EQ(1, ShedCount(QueuedWorkerPool::kShedDeadline));
+  EXPECT_EQ(0, ShedCount(QueuedWorkerPool::kShedQueueTime));
+  EXPECT_EQ(0, ShedCount(QueuedWorkerPool::kShedQueueLength));
+  // The three above, plus the wedge and the NotifyRunFunction.
+  EXPECT_EQ(5, sojourn_->Count());
+}
+
+// A backlog that drains well within the target is left alone, however deep.
+TEST_F(QueuedWorkerPoolSheddingTest, QuicklyDrainingQueueNotShed) {
+  worker_->EnableQueueTimeShedding(200 * Timer::kMsUs, 400 * Timer::kMsUs);
+  RunBacklog(1, 1000, 0);
+  EXPECT_EQ(1000, runs_);
+  EXPECT_EQ(0, cancels_);
+  EXPECT_EQ(0, ShedCount(QueuedWorkerPool::kShedQueueTime));
+}
+
+// Once waits stay above target for an interval, functions are shed at an
+// increasing rate, but not wholesale.
+TEST_F(QueuedWorkerPoolSheddingTest, StandingQueueShed) {
+  worker_->EnableQueueTimeShedding(2 * Timer::kMsUs, 10 * Timer::kMsUs);
+  RunBacklog(20, 100, Timer::kMsUs);
+  EXPECT_EQ(100, runs_ + cancels_);
+  EXPECT_LT(0, cancels_);
+  EXPECT_LT(0, runs_);
+  // The final NotifyDoneFunction may have been shed as well.
+  EXPECT_LE(cancels_, ShedCount(QueuedWorkerPool::kShedQueueTime));
+  EXPECT_GE(cancels_ + 1, ShedCount(QueuedWorkerPool::kShedQueueTime));
+  EXPECT_EQ(0, ShedCount(QueuedWorkerPool::kShedDeadline));
+}
+
+// Sequences dropped by the length threshold are counted too.
+TEST_F(QueuedWorkerPoolSheddingTest, QueueLengthShedCounted) {
+  worker_->SetLoadSheddingThreshold(1);
+  SyncPoint started(thread_runtime_.get());
+  SyncPoint wait(thread_runtime_.get());
+  worker_->NewSequence()->Add(new NotifyAndWait(&started, &wait));
+  started.Wait();
+  QueuedWorkerPool::Sequence* sequence = NULL;
+  for (int i = 0; i < 3; ++i) {
+    sequence = worker_->NewSequence();
+    sequence->Add(NewCountingFunction(0));
+  }
+  SyncPoint done(thread_runtime_.get());
+  sequence->Add(new NotifyRunFunction(&done));
+  wait.Notify();
+  done.Wait();
+  EXPECT_EQ(1, runs_);
+  EXPECT_EQ(2, cancels_);
+  EXPECT_EQ(2, ShedCount(QueuedWorkerPool::kShedQueueLength));
+}
+
+class QueuedWorkerPoolWorkStealingTest : public QueuedWorkerPoolTest {
+ protected:
+  QueuedWorkerPoolWorkStealingTest() {
+    worker_.reset(new QueuedWorkerPool(4, "work_stealing_test",
+                                       thread_runtime_.get()));
+    worker_->EnableWorkStealing();
+  }
+
+  // Runs kRounds rounds of adding one Increment to each of kNumSequences
+  // sequences on a pool of num_threads workers, and returns the elapsed
+  // time in microseconds.  Each sequence's Increments check that they ran
+  // in order.
+  int64 RunThroughput(int num_threads, bool work_stealing) {
+    static const int kNumSequences = 64;
+    static const int kRounds = 200;
+    QueuedWorkerPool pool(num_threads, "throughput", thread_runtime_.get());
+    if (work_stealing) {
+      pool.EnableWorkStealing();
+    }
+    scoped_ptr<Timer> timer(thread_runtime_->NewTimer());
+    std::vector<QueuedWorkerPool::Sequence*> sequences;
+    std::vector<int> counts(kNumSequences, 0);
+    std::vector<SyncPoint*> done;
+    for (int i = 0; i < kNumSequences; ++i) {
+      sequences.push_back(pool.NewSequence());
+      done.push_back(new SyncPoint(thread_runtime_.get()));
+    }
+    int64 start_us = timer->NowUs();
+    for (int round = 0; round < kRounds; ++round) {
+      for (int i = 0; i < kNumSequences; ++i) {
+        sequences[i]->Add(new Increment(round + 1, &counts[i]));
+      }
+    }
+    for (int i = 0; i < kNumSequences; ++i) {
+      sequences[i]->Add(new NotifyRunFunction(done[i]));
+    }
+    for (int i = 0; i < kNumSequences; ++i) {
+      done[i]->Wait();
+      EXPECT_EQ(kRounds, counts[i]);
+      pool.FreeSequence(sequences[i]);
+    }
+    int64 elapsed_us = timer->NowUs() - start_us;
+    STLDeleteElements(&done);
+    return elapsed_us;
+  }
+};
+
+TEST_F(QueuedWorkerPoolWorkStealingTest, SequencesStayOrdered) {
+  const int kNumSequences = 16;
+  const int kBound = 100;
+  int counts[kNumSequences] = { 0 };
+  std::vector<QueuedWorkerPool::Sequence*> sequences;
+  for (int i = 0; i < kNumSequences; ++i) {
+    sequences.push_back(worker_->NewSequence());
+  }
+  for (int j = 0; j < kBound; ++j) {
+    for (int i = 0; i < kNumSequences; ++i) {
+      sequences[i]->Add(new Increment(j + 1, &counts[i]));
+    }
+  }
+  for (int i = 0; i < kNumSequences; ++i) {
+    WaitUntilSequenceCompletes(sequences[i]);
+    EXPECT_EQ(kBound, counts[i]);
+    worker_->FreeSequence(sequences[i]);
+  }
+}
+
+TEST_F(QueuedWorkerPoolWorkStealingTest, BlockedWorkersDontStallOthers) {
+  // Wedge three of the four workers; the remaining one must still drain
+  // sequences queued behind them.
+  std::vector<QueuedWorkerPool::Sequence*> wedges;
+  std::vector<SyncPoint*> releases;
+  for (int i = 0; i < 3; ++i) {
+    SyncPoint* started = new SyncPoint(thread_runtime_.get());
+    releases.push_back(new SyncPoint(thread_runtime_.get()));
+    wedges.push_back(worker_->NewSequence());
+    wedges.back()->Add(new NotifyRunFunction(started));
+    wedges.back()->Add(new WaitRunFunction(releases.back()));
+    started->Wait();
+    delete started;
+  }
+
+  int count = 0;
+  QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
+  for (int i = 0; i < 42; ++i) {
+    sequence->Add(new Increment(i + 1, &count));
+  }
+  WaitUntilSequenceCompletes(sequence);
+  EXPECT_EQ(42, count);
+  worker_->FreeSequence(sequence);
+
+  for (int i = 0; i < 3; ++i) {
+    releases[i]->Notify();
+    WaitUntilSequenceCompletes(wedges[i]);
+    worker_->FreeSequence(wedges[i]);
+  }
+  STLDeleteElements(&releases);
+}
+
+TEST_F(QueuedWorkerPoolWorkStealingTest, Throughput) {
+  for (int num_threads = 1; num_threads <= 64; num_threads *= 2) {
+    int64 central_us = RunThroughput(num_threads, false);
+    int64 stealing_us = RunThroughput(num_threads, true);
+    LOG(INFO) << num_threads << " threads: central queue " << central_us
+              << "us, work stealing " << stealing_us << "us";
+  }
+}
+
+// Records the CPU it ran on, taking a little time about it so that there is
+// some busy time to account.
+class RecordCpuFunction : public Function {
+ public:
+  RecordCpuFunction(Timer* timer, std::vector<int>* cpus)
+      : timer_(timer), cpus_(cpus) {}
+
+ protected:
+  virtual void Run() {
+    timer_->SleepMs(1);
+    cpus_->push_back(CpuAffinity::CurrentCpu());
+  }
+
+ private:
+  Timer* timer_;
+  std::vector<int>* cpus_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordCpuFunction);
+};
+
+TEST_F(QueuedWorkerPoolTest, CoreAffinity) {
+  std::vector<int> allowed;
+  CpuAffinity::AllowedCpus(&allowed);
+  if (allowed.empty()) {
+    LOG(INFO) << "CPU affinity not supported; skipping.";
+    return;
+  }
+  int cpu = allowed.back();
+  SimpleStats stats(thread_runtime_.get());
+  std::vector<Variable*> busy_time(cpu + 1, static_cast<Variable*>(NULL));
+  busy_time[cpu] = stats.AddVariable("busy_time");
+  worker_.reset(new QueuedWorkerPool(2, "affinity_test",
+                                     thread_runtime_.get()));
+  worker_->EnableCoreAffinity(std::vector<int>(1, cpu));
+  worker_->set_cpu_busy_time_stats(busy_time);
+
+  scoped_ptr<Timer> timer(thread_runtime_->NewTimer());
+  const int kNumSequences = 4;
+  const int kBound = 5;
+  std::vector<int> ran_on[kNumSequences];
+  int counts[kNumSequences] = { 0 };
+  QueuedWorkerPool::Sequence* sequences[kNumSequences];
+  for (int i = 0; i < kNumSequences; ++i) {
+    sequences[i] = worker_->NewSequence();
+    for (int j = 0; j < kBound; ++j) {
+      sequences[i]->Add(new RecordCpuFunction(timer.get(), &ran_on[i]));
+      sequences[i]->Add(new Increment(j + 1, &counts[i]));
+    }
+  }
+  for (int i = 0; i < kNumSequences; ++i) {
+    WaitUntilSequenceCompletes(sequences[i]);
+    EXPECT_EQ(kBound, counts[i]);
+    EXPECT_EQ(std::vector<int>(kBound, cpu), ran_on[i]);
+    worker_->FreeSequence(sequences[i]);
+  }
+  // Busy time is accounted after each function returns, so let the workers
+  // finish with the last ones.
+  worker_->ShutDown();
+  EXPECT_LE(kNumSequences * kBound * Timer::kMsUs, busy_time[cpu]->Get());
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
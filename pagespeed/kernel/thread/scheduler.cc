@@ -21,6 +21,7 @@
 #include "pagespeed/kernel/thread/scheduler.h"
 
 #include <algorithm>
+#include <cstring>
 #include <set>
 
 #include "base/logging.h"
@@ -39,6 +40,10 @@ namespace {
 
 const int kIndexNotSet = 0;
 
+// Values of Alarm::wheel_slot_ other than an actual timing-wheel slot.
+const int kNotInTimerWheel = -2;
+const int kTimerWheelDue = -1;
+
 }  // namespace
 
 // Basic Alarm type (forward declared in the .h file).  Note that Alarms are
@@ -78,11 +83,15 @@ class Scheduler::Alarm {
  protected:
   Alarm() : wakeup_time_us_(0),
             index_(kIndexNotSet),
-            in_wait_dispatch_(false) { }
+            in_wait_dispatch_(false),
+            wheel_slot_(kNotInTimerWheel),
+            wheel_next_(NULL),
+            wheel_prev_(NULL) { }
   virtual ~Alarm() { }
 
  private:
   friend class Scheduler;
+  friend class Scheduler::TimerWheel;
   int64 wakeup_time_us_;
   uint32 index_;  // Set by scheduler to disambiguate equal wakeup times.
 
@@ -90,9 +99,214 @@ class Scheduler::Alarm {
   // as owned by it for purposes of cleanup, so any concurrent timeout will
   // know not to delete it.
   bool in_wait_dispatch_;
+
+  // Position in Scheduler::TimerWheel, when that is in use: the slot index
+  // and intrusive list links, or kTimerWheelDue / kNotInTimerWheel.
+  int wheel_slot_;
+  Alarm* wheel_next_;
+  Alarm* wheel_prev_;
   DISALLOW_COPY_AND_ASSIGN(Alarm);
 };
 
+// Hierarchical timing wheel used in place of the ordered outstanding_alarms_
+// set once Scheduler::EnableTimerWheel() is called.  Wakeup times are
+// quantized to ticks of ~1ms.  Level L of the wheel holds the alarms whose
+// tick first differs from current_tick_ in the L'th group of kSlotBits bits,
+// each slot being an intrusive doubly-linked list, so insertion and
+// cancellation are O(1).  current_tick_ follows the timer, never running
+// ahead of it: once the lowest occupied slot starts at or before now, it is
+// emptied in one batch, its alarms either becoming due (and moving into due_)
+// or cascading into lower levels.  Only alarms that are already due pay for
+// the ordered due_ set, which is ordered exactly like outstanding_alarms_, so
+// alarm order is unchanged.
+class Scheduler::TimerWheel {
+ public:
+  explicit TimerWheel(Timer* timer)
+      : timer_(timer),
+        current_tick_(NowTick()),
+        size_(0),
+        earliest_(NULL) {
+    memset(slots_, 0, sizeof(slots_));
+    memset(occupied_, 0, sizeof(occupied_));
+  }
+
+  bool empty() const { return size_ == 0; }
+  int num_due() const { return due_.size(); }
+
+  void Insert(Alarm* alarm) {
+    if (!AnySlotOccupied()) {
+      // Nothing is placed relative to current_tick_, so it can catch up
+      // with the timer; alarms that are not yet due then get wheel slots.
+      current_tick_ = std::max(current_tick_, NowTick());
+    }
+    ++size_;
+    Place(alarm, Tick(alarm));
+    if ((earliest_ != NULL) && (alarm->Compare(earliest_) < 0)) {
+      earliest_ = alarm;
+    }
+  }
+
+  // Returns false if alarm was not in the wheel.
+  bool Erase(Alarm* alarm) {
+    if (alarm->wheel_slot_ == kNotInTimerWheel) {
+      return false;
+    } else if (alarm->wheel_slot_ == kTimerWheelDue) {
+      due_.erase(alarm);
+    } else {
+      Unlink(alarm);
+    }
+    if (alarm == earliest_) {
+      earliest_ = NULL;
+    }
+    alarm->wheel_slot_ = kNotInTimerWheel;
+    --size_;
+    return true;
+  }
+
+  // Returns the earliest alarm, or NULL if the wheel is empty.
+  Alarm* First() {
+    if (size_ == 0) {
+      return NULL;
+    }
+    if (due_.empty()) {
+      uint64 now_tick = NowTick();
+      while (due_.empty()) {
+        int level, slot_in_level;
+        uint64 start_tick = LowestSlot(&level, &slot_in_level);
+        if (start_tick > now_tick) {
+          break;
+        }
+        Advance(level, slot_in_level, start_tick);
+      }
+      if (due_.empty()) {
+        return Earliest();
+      }
+    }
+    return *due_.begin();
+  }
+
+ private:
+  static const int kTickShift = 10;  // 1024us per tick.
+  static const int kSlotBits = 6;
+  static const int kSlotsPerLevel = 1 << kSlotBits;
+  // Enough levels that any 64-bit tick fits, so there's no overflow list.
+  static const int kNumLevels = (64 + kSlotBits - 1) / kSlotBits;
+
+  static uint64 Tick(int64 time_us) {
+    return (time_us <= 0) ? 0 : static_cast<uint64>(time_us) >> kTickShift;
+  }
+  static uint64 Tick(const Alarm* alarm) {
+    return Tick(alarm->wakeup_time_us_);
+  }
+  uint64 NowTick() const { return Tick(timer_->NowUs()); }
+
+  bool AnySlotOccupied() const {
+    for (int level = 0; level < kNumLevels; ++level) {
+      if (occupied_[level] != 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Place(Alarm* alarm, uint64 tick) {
+    if (tick <= current_tick_) {
+      alarm->wheel_slot_ = kTimerWheelDue;
+      due_.insert(alarm);
+      return;
+    }
+    int level = (63 - __builtin_clzll(tick ^ current_tick_)) / kSlotBits;
+    int slot_in_level = (tick >> (level * kSlotBits)) & (kSlotsPerLevel - 1);
+    int slot = level * kSlotsPerLevel + slot_in_level;
+    alarm->wheel_slot_ = slot;
+    alarm->wheel_prev_ = NULL;
+    alarm->wheel_next_ = slots_[slot];
+    if (slots_[slot] != NULL) {
+      slots_[slot]->wheel_prev_ = alarm;
+    }
+    slots_[slot] = alarm;
+    occupied_[level] |= static_cast<uint64>(1) << slot_in_level;
+  }
+
+  void Unlink(Alarm* alarm) {
+    int slot = alarm->wheel_slot_;
+    if (alarm->wheel_prev_ != NULL) {
+      alarm->wheel_prev_->wheel_next_ = alarm->wheel_next_;
+    } else {
+      slots_[slot] = alarm->wheel_next_;
+    }
+    if (alarm->wheel_next_ != NULL) {
+      alarm->wheel_next_->wheel_prev_ = alarm->wheel_prev_;
+    }
+    if (slots_[slot] == NULL) {
+      occupied_[slot / kSlotsPerLevel] &=
+          ~(static_cast<uint64>(1) << (slot % kSlotsPerLevel));
+    }
+  }
+
+  // Finds the lowest occupied slot, which holds the earliest alarms not in
+  // due_, since every occupied slot lies strictly after current_tick_ and
+  // lower levels hold earlier ticks than higher ones.  Returns the first
+  // tick that slot covers.  Requires some slot to be occupied.
+  uint64 LowestSlot(int* level, int* slot_in_level) const {
+    *level = 0;
+    while (occupied_[*level] == 0) {
+      ++*level;
+      DCHECK_LT(*level, kNumLevels);
+    }
+    *slot_in_level = __builtin_ctzll(occupied_[*level]);
+    int shift = *level * kSlotBits;
+    uint64 kept_bits = 0;
+    if (shift + kSlotBits < 64) {
+      kept_bits = ~((static_cast<uint64>(1) << (shift + kSlotBits)) - 1);
+    }
+    return (current_tick_ & kept_bits) |
+        (static_cast<uint64>(*slot_in_level) << shift);
+  }
+
+  // Moves current_tick_ forward to start_tick, the start of the slot found
+  // by LowestSlot, and redistributes that slot's alarms.
+  void Advance(int level, int slot_in_level, uint64 start_tick) {
+    current_tick_ = start_tick;
+    earliest_ = NULL;
+    int slot = level * kSlotsPerLevel + slot_in_level;
+    Alarm* alarm = slots_[slot];
+    slots_[slot] = NULL;
+    occupied_[level] &= ~(static_cast<uint64>(1) << slot_in_level);
+    while (alarm != NULL) {
+      Alarm* next = alarm->wheel_next_;
+      Place(alarm, Tick(alarm));
+      alarm = next;
+    }
+  }
+
+  // Returns the earliest alarm while none is due, scanning the lowest
+  // occupied slot if it is not already known.
+  Alarm* Earliest() {
+    if (earliest_ == NULL) {
+      int level, slot_in_level;
+      LowestSlot(&level, &slot_in_level);
+      for (Alarm* alarm = slots_[level * kSlotsPerLevel + slot_in_level];
+           alarm != NULL; alarm = alarm->wheel_next_) {
+        if ((earliest_ == NULL) || (alarm->Compare(earliest_) < 0)) {
+          earliest_ = alarm;
+        }
+      }
+    }
+    return earliest_;
+  }
+
+  Timer* timer_;
+  uint64 current_tick_;  // Never later than the timer's tick when set.
+  int size_;
+  AlarmSet due_;  // Alarms with tick <= current_tick_, in run order.
+  Alarm* slots_[kNumLevels * kSlotsPerLevel];
+  uint64 occupied_[kNumLevels];  // Bitmap of non-empty slots per level.
+  // The earliest alarm when due_ is empty, or NULL if not yet known.
+  Alarm* earliest_;
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+};
+
 namespace {
 
 // private class to encapsulate a function being
@@ -216,10 +430,9 @@ Scheduler::Scheduler(ThreadSystem* thread_system, Timer* timer)
 Scheduler::~Scheduler() {
 #if SCHEDULER_CANCEL_OUTSTANDING_ALARMS_ON_DESTRUCTION
   ScopedMutex lock(mutex_.get());
-  while (!outstanding_alarms_.empty()) {
-    AlarmSet::iterator p = outstanding_alarms_.begin();
-    Alarm* alarm = *p;
-    outstanding_alarms_.erase(p);
+  Alarm* alarm;
+  while ((alarm = FirstOutstandingAlarm()) != NULL) {
+    EraseOutstandingAlarm(alarm);
     alarm->CancelAlarm();
   }
 #endif
@@ -314,14 +527,53 @@ void Scheduler::InsertAlarmAtUsMutexHeld(int64 wakeup_time_us,
   alarm->index_ = ++index_;
 
   if (broadcast_on_wakeup_change) {
-    bool wakeup_time_changed = outstanding_alarms_.empty() ||
-        (wakeup_time_us < (*outstanding_alarms_.begin())->wakeup_time_us_);
+    Alarm* first_alarm = FirstOutstandingAlarm();
+    bool wakeup_time_changed = (first_alarm == NULL) ||
+        (wakeup_time_us < first_alarm->wakeup_time_us_);
     if (wakeup_time_changed) {
       condvar_->Broadcast();
     }
   }
 
-  outstanding_alarms_.insert(alarm);
+  InsertOutstandingAlarm(alarm);
+}
+
+void Scheduler::InsertOutstandingAlarm(Alarm* alarm) {
+  if (timer_wheel_.get() != NULL) {
+    timer_wheel_->Insert(alarm);
+  } else {
+    outstanding_alarms_.insert(alarm);
+  }
+}
+
+bool Scheduler::EraseOutstandingAlarm(Alarm* alarm) {
+  if (timer_wheel_.get() != NULL) {
+    return timer_wheel_->Erase(alarm);
+  }
+  return outstanding_alarms_.erase(alarm) != 0;
+}
+
+Scheduler::Alarm* Scheduler::FirstOutstandingAlarm() {
+  if (timer_wheel_.get() != NULL) {
+    return timer_wheel_->First();
+  }
+  return outstanding_alarms_.empty() ? NULL : *outstanding_alarms_.begin();
+}
+
+int Scheduler::NumTimerWheelDueAlarms() {
+  return (timer_wheel_.get() == NULL) ? 0 : timer_wheel_->num_due();
+}
+
+void Scheduler::EnableTimerWheel() {
+  ScopedMutex lock(mutex_.get());
+  if (timer_wheel_.get() == NULL) {
+    timer_wheel_.reset(new TimerWheel(timer_));
+    for (AlarmSet::iterator p = outstanding_alarms_.begin();
+         p != outstanding_alarms_.end(); ++p) {
+      timer_wheel_->Insert(*p);
+    }
+    outstanding_alarms_.clear();
+  }
 }
 
 Scheduler::Alarm* Scheduler::AddAlarmAtUs(int64 wakeup_time_us,
@@ -342,7 +594,7 @@ Scheduler::Alarm* Scheduler::AddAlarmAtUsMutexHeld(int64 wakeup_time_us,
 
 bool Scheduler::CancelAlarm(Alarm* alarm) {
   mutex_->DCheckLocked();
-  if (outstanding_alarms_.erase(alarm) != 0) {
+  if (EraseOutstandingAlarm(alarm)) {
     // Note: the following call may drop and re-lock the scheduler mutex.
     alarm->CancelAlarm();
     return true;
@@ -352,12 +604,11 @@ bool Scheduler::CancelAlarm(Alarm* alarm) {
 }
 
 int64 Scheduler::RunAlarms(bool* ran_alarms) {
-  while (!outstanding_alarms_.empty()) {
+  Alarm* first_alarm;
+  // We don't iterate over the store, because we're dropping the lock in
+  // mid-loop thus permitting new insertions and cancellations.
+  while ((first_alarm = FirstOutstandingAlarm()) != NULL) {
     mutex_->DCheckLocked();
-    // We don't use the iterator to go through the set, because we're dropping
-    // the lock in mid-loop thus permitting new insertions and cancellations.
-    AlarmSet::iterator first_alarm_iterator = outstanding_alarms_.begin();
-    Alarm* first_alarm = *first_alarm_iterator;
     int64 now_us = timer_->NowUs();
     if (now_us < first_alarm->wakeup_time_us_) {
       // The next deadline lies in the future.
@@ -365,7 +616,7 @@ int64 Scheduler::RunAlarms(bool* ran_alarms) {
     }
     // first_alarm should be run.  It can't have been cancelled as we've held
     // the lock since we found it.
-    outstanding_alarms_.erase(first_alarm_iterator);  // Prevent cancellation.
+    EraseOutstandingAlarm(first_alarm);  // Prevent cancellation.
     if (ran_alarms != NULL) {
       *ran_alarms = true;
     }
@@ -403,13 +654,13 @@ bool Scheduler::ProcessAlarmsOrWaitUs(int64 timeout_us) {
 
     next_wakeup_us = RunAlarms(NULL);
   }
-  return !outstanding_alarms_.empty();
+  return FirstOutstandingAlarm() != NULL;
 }
 
 // For testing purposes, let a tester know when the scheduler has quiesced.
 bool Scheduler::NoPendingAlarms() {
   mutex_->DCheckLocked();
-  return (outstanding_alarms_.empty());
+  return FirstOutstandingAlarm() == NULL;
 }
 
 SchedulerBlockingFunction::SchedulerBlockingFunction(Scheduler* scheduler)
@@ -180,6 +180,13 @@ class Scheduler {
   // Creates a new sequence, controlled by the scheduler.
   Sequence* NewSequence();
 
+  // Switches outstanding alarms from the default ordered set to a
+  // hierarchical timing wheel, making AddAlarmAtUs and CancelAlarm O(1)
+  // rather than O(log n).  Worthwhile for schedulers with many thousands of
+  // pending deadlines; alarms still run in exactly the same order.  Alarms
+  // already queued are moved over.
+  void EnableTimerWheel() LOCKS_EXCLUDED(mutex());
+
  protected:
   // Internal method to await a wakeup event.  Block until wakeup_time_us (an
   // absolute time since the epoch), or until something interesting (such as a
@@ -193,6 +200,7 @@ class Scheduler {
  private:
   class CondVarTimeout;
   class CondVarCallbackTimeout;
+  class TimerWheel;
   friend class SchedulerTest;
 
   typedef std::set<Alarm*, CompareAlarms> AlarmSet;
@@ -205,6 +213,16 @@ class Scheduler {
   void CancelWaiting(Alarm* alarm);
   bool NoPendingAlarms();
 
+  // Operations on the outstanding alarm store, which is either
+  // outstanding_alarms_ or timer_wheel_.  FirstOutstandingAlarm returns NULL
+  // if there are no outstanding alarms.
+  void InsertOutstandingAlarm(Alarm* alarm) EXCLUSIVE_LOCKS_REQUIRED(mutex());
+  bool EraseOutstandingAlarm(Alarm* alarm) EXCLUSIVE_LOCKS_REQUIRED(mutex());
+  Alarm* FirstOutstandingAlarm() EXCLUSIVE_LOCKS_REQUIRED(mutex());
+  // Number of alarms the timer wheel holds in its ordered set of due alarms;
+  // for tests.
+  int NumTimerWheelDueAlarms() EXCLUSIVE_LOCKS_REQUIRED(mutex());
+
   ThreadSystem* thread_system_;
   Timer* timer_;
   scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
@@ -213,8 +231,10 @@ class Scheduler {
   scoped_ptr<ThreadSystem::Condvar> condvar_;
   uint32 index_;  // Used to disambiguate alarms with equal deadlines
   AlarmSet outstanding_alarms_;  // Priority queue of future alarms
+  // Replaces outstanding_alarms_ when EnableTimerWheel has been called.
+  scoped_ptr<TimerWheel> timer_wheel_;
   // An alarm may be deleted iff it is successfully removed from
-  // outstanding_alarms_.
+  // outstanding_alarms_ (or timer_wheel_).
   int64 signal_count_;           // Number of times Signal has been called
   AlarmSet waiting_alarms_;      // Alarms waiting for signal_count to change
   bool running_waiting_alarms_;  // True if we're in process of invoking
@@ -20,10 +20,15 @@
 
 #include "pagespeed/kernel/thread/scheduler.h"
 
+#include <algorithm>
+#include <utility>
+#include <vector>
+
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mock_timer.h"
 #include "pagespeed/kernel/util/platform.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
@@ -46,6 +51,11 @@ class SchedulerTest : public WorkerTestBase {
     return comparator(a, b);
   }
 
+  int NumTimerWheelDueAlarms(Scheduler* scheduler) {
+    ScopedMutex lock(scheduler->mutex());
+    return scheduler->NumTimerWheelDueAlarms();
+  }
+
   void LockAndProcessAlarms() {
     ScopedMutex lock(scheduler_.mutex());
     scheduler_.ProcessAlarmsOrWaitUs(0);  // Don't block!
@@ -309,6 +319,218 @@ TEST_F(SchedulerTest, TimedWaitFromSignalWakeup) {
   EXPECT_GE(2, counter);
 }
 
+class SchedulerTimerWheelTest : public SchedulerTest {
+ protected:
+  SchedulerTimerWheelTest() {
+    scheduler_.EnableTimerWheel();
+  }
+};
+
+// Records the deadline and insertion number of each alarm as it runs, checks
+// that it didn't run early, and tracks the worst lateness seen.
+class RecordFunction : public Function {
+ public:
+  typedef std::vector<std::pair<int64, int> > Log;
+
+  RecordFunction(Timer* timer, int64 deadline_us, int id, Log* log,
+                 int64* max_late_us)
+      : timer_(timer), deadline_us_(deadline_us), id_(id), log_(log),
+        max_late_us_(max_late_us) { }
+
+  virtual void Run() {
+    int64 late_us = timer_->NowUs() - deadline_us_;
+    EXPECT_LE(0, late_us);
+    *max_late_us_ = std::max(*max_late_us_, late_us);
+    log_->push_back(std::make_pair(deadline_us_, id_));
+  }
+
+ private:
+  Timer* timer_;
+  int64 deadline_us_;
+  int id_;
+  Log* log_;
+  int64* max_late_us_;
+  DISALLOW_COPY_AND_ASSIGN(RecordFunction);
+};
+
+// Adds kNumAlarms alarms with deadlines spread from the past out to years
+// ahead, cancels a third of them, and runs the rest in mock time.  Returns
+// the order in which they ran.
+void RunAlarmsInMockTime(ThreadSystem* thread_system, bool timer_wheel,
+                         RecordFunction::Log* log) {
+  const int kNumAlarms = 20000;
+  const int64 kStartUs = 1000 * Timer::kYearMs * Timer::kMsUs;
+  MockTimer timer(thread_system->NewMutex(), kStartUs / Timer::kMsUs);
+  Scheduler scheduler(thread_system, &timer);
+  if (timer_wheel) {
+    scheduler.EnableTimerWheel();
+  }
+  std::vector<Scheduler::Alarm*> future_alarms;
+  int64 max_late_us = 0;
+  uint32 random = 12345;
+  int64 last_deadline_us = kStartUs;
+  for (int i = 0; i < kNumAlarms; ++i) {
+    random = random * 1103515245 + 12345;
+    int64 delay_us = (random >> 8) % (static_cast<int64>(1) << (random % 40));
+    int64 deadline_us = kStartUs - Timer::kMsUs + delay_us;
+    last_deadline_us = std::max(last_deadline_us, deadline_us);
+    Scheduler::Alarm* alarm = scheduler.AddAlarmAtUs(
+        deadline_us,
+        new RecordFunction(&timer, deadline_us, i, log, &max_late_us));
+    if (deadline_us > kStartUs) {
+      // Alarms in the past have already run and been deleted.
+      future_alarms.push_back(alarm);
+    }
+  }
+  {
+    ScopedMutex lock(scheduler.mutex());
+    for (int i = 0, n = future_alarms.size(); i < n; i += 3) {
+      EXPECT_TRUE(scheduler.CancelAlarm(future_alarms[i]));
+    }
+    int64 now_us = kStartUs;
+    while (scheduler.ProcessAlarmsOrWaitUs(0)) {
+      now_us += (now_us < kStartUs + Timer::kSecondUs) ? 100 :
+          (now_us - kStartUs) / 16;
+      timer.SetTimeUs(std::min(now_us, last_deadline_us));
+    }
+  }
+}
+
+TEST_F(SchedulerTimerWheelTest, AlarmsGetRun) {
+  int64 start_us = timer_->NowUs();
+  int counter = 0;
+  scheduler_.AddAlarmAtUs(start_us + 2 * Timer::kMsUs,
+                          new CountFunction(&counter));
+  scheduler_.AddAlarmAtUs(start_us + 6 * Timer::kMsUs,
+                          new CountFunction(&counter));
+  Scheduler::Alarm* alarm3 =
+      scheduler_.AddAlarmAtUs(start_us + Timer::kMinuteUs,
+                              new CountFunction(&counter));
+  {
+    ScopedMutex lock(scheduler_.mutex());
+    scheduler_.BlockingTimedWaitMs(4);  // Never signaled, should time out.
+    EXPECT_LE(1, counter);
+    scheduler_.CancelAlarm(alarm3);
+  }
+  QuiesceAlarms(Timer::kMinuteUs);
+  EXPECT_EQ(-98, counter);
+  EXPECT_LT(start_us + 6 * Timer::kMsUs, timer_->NowUs());
+}
+
+TEST_F(SchedulerTimerWheelTest, TimedWaitMidpointSignal) {
+  int counter = 0;
+  {
+    ScopedMutex lock(scheduler_.mutex());
+    scheduler_.TimedWaitMs(Timer::kMinuteMs, new CountFunction(&counter));
+    scheduler_.TimedWaitMs(Timer::kMinuteMs, new CountFunction(&counter));
+    scheduler_.Signal();
+  }
+  EXPECT_EQ(2, counter);
+  QuiesceAlarms(Timer::kMinuteUs);
+  EXPECT_EQ(2, counter);
+}
+
+TEST_F(SchedulerTimerWheelTest, SameOrderAsAlarmSet) {
+  RecordFunction::Log set_log, wheel_log;
+  RunAlarmsInMockTime(thread_system_.get(), false, &set_log);
+  RunAlarmsInMockTime(thread_system_.get(), true, &wheel_log);
+  EXPECT_LT(10000, wheel_log.size());
+  EXPECT_TRUE(set_log == wheel_log);
+}
+
+TEST_F(SchedulerTimerWheelTest, FarAndNearAlarmsStayInWheel) {
+  const int64 kStartUs = 1000 * Timer::kYearMs * Timer::kMsUs;
+  MockTimer timer(thread_system_->NewMutex(), kStartUs / Timer::kMsUs);
+  Scheduler scheduler(thread_system_.get(), &timer);
+  scheduler.EnableTimerWheel();
+  RecordFunction::Log log;
+  int64 max_late_us = 0;
+
+  // A far-future alarm followed by nearer ones, latest first.  None is due,
+  // so none should need the ordered set of due alarms, even after the
+  // scheduler has looked for the next wakeup.
+  int64 far_us = kStartUs + Timer::kMinuteUs;
+  scheduler.AddAlarmAtUs(
+      far_us, new RecordFunction(&timer, far_us, 0, &log, &max_late_us));
+  for (int i = 1; i <= 10; ++i) {
+    int64 deadline_us = kStartUs + (11 - i) * 5 * Timer::kMsUs;
+    scheduler.AddAlarmAtUs(
+        deadline_us,
+        new RecordFunction(&timer, deadline_us, i, &log, &max_late_us));
+  }
+  {
+    ScopedMutex lock(scheduler.mutex());
+    scheduler.ProcessAlarmsOrWaitUs(0);
+  }
+  int64 near_us = kStartUs + 2 * Timer::kMsUs;
+  scheduler.AddAlarmAtUs(
+      near_us, new RecordFunction(&timer, near_us, 11, &log, &max_late_us));
+  EXPECT_EQ(0, NumTimerWheelDueAlarms(&scheduler));
+  EXPECT_TRUE(log.empty());
+
+  {
+    ScopedMutex lock(scheduler.mutex());
+    while (scheduler.ProcessAlarmsOrWaitUs(0)) {
+      timer.AdvanceMs(1);
+    }
+  }
+  ASSERT_EQ(12, log.size());
+  EXPECT_EQ(11, log[0].second);
+  for (int i = 1; i <= 10; ++i) {
+    EXPECT_EQ(11 - i, log[i].second);
+  }
+  EXPECT_EQ(0, log[11].second);
+  EXPECT_GT(2 * Timer::kMsUs, max_late_us);
+}
+
+TEST_F(SchedulerTimerWheelTest, Throughput) {
+  const int kNumAlarms = 100000;
+  int64 start_us = timer_->NowUs();
+  for (int timer_wheel = 0; timer_wheel <= 1; ++timer_wheel) {
+    Scheduler scheduler(thread_system_.get(), timer_.get());
+    if (timer_wheel) {
+      scheduler.EnableTimerWheel();
+    }
+    std::vector<Scheduler::Alarm*> alarms;
+    int counter = 0;
+    int64 begin_us = timer_->NowUs();
+    ScopedMutex lock(scheduler.mutex());
+    for (int i = 0; i < kNumAlarms; ++i) {
+      // Typical fetch and rewrite deadlines: seconds out, unordered.
+      int64 deadline_us = start_us + Timer::kMinuteUs +
+          (i * 7919) % (10 * Timer::kSecondUs);
+      alarms.push_back(scheduler.AddAlarmAtUsMutexHeld(
+          deadline_us, new CountFunction(&counter)));
+    }
+    for (int i = 0; i < kNumAlarms; ++i) {
+      EXPECT_TRUE(scheduler.CancelAlarm(alarms[i]));
+    }
+    int64 elapsed_us = timer_->NowUs() - begin_us;
+    EXPECT_EQ(-100 * kNumAlarms, counter);
+    LOG(INFO) << (timer_wheel ? "timer wheel: " : "alarm set: ")
+              << kNumAlarms << " adds and cancels in " << elapsed_us << "us";
+  }
+}
+
+TEST_F(SchedulerTimerWheelTest, WakeupLatency) {
+  const int kNumAlarms = 50;
+  RecordFunction::Log log;
+  int64 max_late_us = 0;
+  int64 start_us = timer_->NowUs();
+  for (int i = 0; i < kNumAlarms; ++i) {
+    int64 deadline_us = start_us + (i % 10 + 1) * Timer::kMsUs + i * 13;
+    scheduler_.AddAlarmAtUs(
+        deadline_us,
+        new RecordFunction(timer_.get(), deadline_us, i, &log, &max_late_us));
+  }
+  QuiesceAlarms(Timer::kMinuteUs);
+  EXPECT_EQ(kNumAlarms, log.size());
+  LOG(INFO) << "Maximum alarm lateness " << max_late_us << "us";
+  // Deadlines are honored to within a scheduling quantum, not to the ~1ms
+  // wheel tick.
+  EXPECT_GT(Timer::kSecondUs, max_late_us);
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -33,6 +33,7 @@ namespace net_instaweb {
 
 BrotliInflater::BrotliInflater()
     : state_used_(false),
+      stream_finished_(false),
       brotli_state_(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr),
                     &BrotliDecoderDestroyInstance) { }
 
@@ -70,17 +71,39 @@ bool BrotliInflater::Compress(StringPiece in, MessageHandler* handler,
 
 bool BrotliInflater::DecompressHelper(StringPiece in, MessageHandler* handler,
                                       Writer* writer) {
+  StartStream();
+  if (!DecompressChunk(in, handler, writer)) {
+    return false;
+  }
+  if (!stream_finished_) {
+    // The compressed input isn't streamed, so running out of it before the
+    // end of the brotli stream means it was truncated.
+    handler->Message(kWarning, "BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT");
+    return false;
+  }
+  return true;
+}
+
+void BrotliInflater::StartStream() {
+  ResetState();
+  stream_finished_ = false;
+}
+
+bool BrotliInflater::DecompressChunk(StringPiece in, MessageHandler* handler,
+                                     Writer* writer) {
   // Mostly taken from BrotliDecompress in the tool "bro".
   // https://raw.githubusercontent.com/google/brotli/v0.2.0/tools/bro.cc
-  char output[kStackBufferSize];
-  size_t available_in = in.length();
-  const char* next_in = in.data();
-  BrotliDecoderResult result = BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT;
-  ResetState();
   if (!brotli_state_.get()) {
     return false;  // Memory allocation failed.
   }
-  while (result != BROTLI_DECODER_RESULT_SUCCESS) {
+  if (stream_finished_) {
+    return true;  // Like DecompressHelper, ignore bytes after the stream end.
+  }
+  char output[kStackBufferSize];
+  size_t available_in = in.length();
+  const char* next_in = in.data();
+  BrotliDecoderResult result = BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT;
+  while (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
     size_t available_out = sizeof(output);
     char* next_out = output;
     result = BrotliDecoderDecompressStream(brotli_state_.get(),
@@ -91,15 +114,14 @@ bool BrotliInflater::DecompressHelper(StringPiece in, MessageHandler* handler,
     in.remove_prefix(next_in - in.data());
     switch (result) {
       case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
-        // We should never hit this case because the compressed input isn't
-        // streamed.
-        handler->Message(kWarning, "BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT");
-        return false;
+        // All of this chunk has been consumed; wait for the next one.
+        break;
       case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
         // Need to flush the output buffer to the writer.
         break;
       case BROTLI_DECODER_RESULT_SUCCESS:
         // Decompression succeeded, write out the last chunk if needed.
+        stream_finished_ = true;
         break;
       case BROTLI_DECODER_RESULT_ERROR:
         handler->Message(kError, "%s", BrotliDecoderErrorString(
@@ -111,7 +133,7 @@ bool BrotliInflater::DecompressHelper(StringPiece in, MessageHandler* handler,
       return false;
     }
   }
-  return true;  // BROTLI_DECODER_RESULT_SUCCESS
+  return true;
 }
 
 bool BrotliInflater::Decompress(StringPiece in, MessageHandler* handler,
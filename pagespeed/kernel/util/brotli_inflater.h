@@ -57,6 +57,16 @@ class BrotliInflater {
   bool DecompressHelper(StringPiece in, MessageHandler* handler,
                         Writer* writer);
 
+  // Streaming interface.  Call StartStream() once, then DecompressChunk() for
+  // each piece of compressed input as it arrives; decompressed bytes are
+  // written to writer as they are produced.  Returns false on corrupt input
+  // or a failed Write.  Input following the end of the brotli stream is
+  // ignored.
+  void StartStream();
+  bool DecompressChunk(StringPiece in, MessageHandler* handler,
+                       Writer* writer);
+  bool stream_finished() const { return stream_finished_; }
+
   // TODO(jcrowell): Add API with properly sized output buffer (taken from
   // X-Original-Content-Length).
 
@@ -67,6 +77,7 @@ class BrotliInflater {
   // Keep track of if the internal state is "dirty", if so, refreshed by
   // ResetState() before Decompression.
   bool state_used_;
+  bool stream_finished_;
   std::unique_ptr<BrotliDecoderStateStruct, void(*)(BrotliDecoderStateStruct*)>
       brotli_state_;
 
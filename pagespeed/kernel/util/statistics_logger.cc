@@ -120,7 +120,8 @@ const char* const kGraphsVars[] = {
   "ipro_not_rewritable", "ipro_recorder_resources", "cache_deletes",
   "ipro_recorder_inserted_into_cache", "ipro_recorder_not_cacheable",
   "ipro_recorder_failed", "ipro_recorder_dropped_due_to_load",
-  "ipro_recorder_dropped_due_to_size", "shm_cache_deletes", "shm_cache_hits",
+  "ipro_recorder_dropped_due_to_size", "ipro_recorder_peak_buffered_bytes",
+  "shm_cache_deletes", "shm_cache_hits",
   "shm_cache_inserts", "shm_cache_misses", "memcached_async_deletes",
   "memcached_async_hits", "memcached_async_inserts", "memcached_async_misses",
   "memcached_blocking_deletes", "memcached_blocking_hits", "cache_expirations",
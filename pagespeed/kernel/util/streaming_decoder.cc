@@ -0,0 +1,139 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/util/streaming_decoder.h"
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/stack_buffer.h"
+#include "pagespeed/kernel/base/writer.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/util/brotli_inflater.h"
+#include "pagespeed/kernel/util/gzip_inflater.h"
+
+namespace net_instaweb {
+
+StreamingDecoder::StreamingDecoder(Encoding encoding)
+    : encoding_(encoding),
+      error_(false) {
+}
+
+StreamingDecoder::~StreamingDecoder() {
+  if (gzip_.get() != NULL) {
+    gzip_->ShutDown();
+  }
+}
+
+bool StreamingDecoder::ParseEncoding(StringPiece value, Encoding* encoding) {
+  if (StringCaseEqual(value, HttpAttributes::kGzip)) {
+    *encoding = kGzip;
+  } else if (StringCaseEqual(value, HttpAttributes::kDeflate)) {
+    *encoding = kDeflate;
+  } else if (StringCaseEqual(value, HttpAttributes::kBrotli)) {
+    *encoding = kBrotli;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool StreamingDecoder::Init() {
+  DCHECK(gzip_.get() == NULL && brotli_.get() == NULL);
+  switch (encoding_) {
+    case kGzip:
+    case kDeflate:
+      gzip_.reset(new GzipInflater(
+          encoding_ == kGzip ? GzipInflater::kGzip : GzipInflater::kDeflate));
+      if (!gzip_->Init()) {
+        gzip_.reset(NULL);
+        error_ = true;
+      }
+      break;
+    case kBrotli:
+      brotli_.reset(new BrotliInflater);
+      brotli_->StartStream();
+      break;
+  }
+  return !error_;
+}
+
+bool StreamingDecoder::finished() const {
+  if (gzip_.get() != NULL) {
+    return gzip_->finished();
+  }
+  return (brotli_.get() != NULL) && brotli_->stream_finished();
+}
+
+bool StreamingDecoder::Decode(StringPiece in, Writer* writer,
+                              MessageHandler* handler) {
+  if (error_) {
+    return false;
+  }
+  if (gzip_.get() != NULL) {
+    error_ = !DecodeGzip(in, writer, handler);
+  } else if (brotli_.get() != NULL) {
+    error_ = !brotli_->DecompressChunk(in, handler, writer);
+  } else {
+    LOG(DFATAL) << "StreamingDecoder::Decode called before Init";
+    error_ = true;
+  }
+  return !error_;
+}
+
+bool StreamingDecoder::DecodeGzip(StringPiece in, Writer* writer,
+                                  MessageHandler* handler) {
+  // GzipInflater rejects empty input and input after the end of stream, but
+  // neither is an error in a body that arrives in arbitrary pieces.
+  if (in.empty() || gzip_->finished()) {
+    return true;
+  }
+  DCHECK(!gzip_->HasUnconsumedInput());
+  if (!gzip_->SetInput(in.data(), in.size())) {
+    handler->MessageS(kWarning, "inflation failure SetInput returning false");
+    return false;
+  }
+  char buf[kStackBufferSize];
+  while (gzip_->HasUnconsumedInput()) {
+    int size = gzip_->InflateBytes(buf, sizeof(buf));
+    if (gzip_->error() || (size < 0)) {
+      handler->Message(kWarning, "inflation failure, size=%d", size);
+      return false;
+    }
+    if ((size > 0) && !writer->Write(StringPiece(buf, size), handler)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool StreamingDecoder::DecodeAll(Encoding encoding, StringPiece in,
+                                 Writer* writer, MessageHandler* handler) {
+  StreamingDecoder decoder(encoding);
+  if (!decoder.Init() || !decoder.Decode(in, writer, handler)) {
+    return false;
+  }
+  if (!decoder.finished()) {
+    handler->MessageS(kWarning, "compressed stream truncated");
+    return false;
+  }
+  return true;
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,84 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_UTIL_STREAMING_DECODER_H_
+#define PAGESPEED_KERNEL_UTIL_STREAMING_DECODER_H_
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+class BrotliInflater;
+class GzipInflater;
+class MessageHandler;
+class Writer;
+
+// Incrementally decodes a body sent with Content-Encoding gzip, deflate or
+// br.  Each compressed chunk passed to Decode() is decoded through a single
+// stack buffer and handed straight to the caller's Writer, so neither the
+// compressed nor the decoded body needs to be accumulated in memory.
+//
+// Bytes following the end of the compressed stream are ignored.
+class StreamingDecoder {
+ public:
+  enum Encoding { kGzip, kDeflate, kBrotli };
+
+  // Maps a Content-Encoding token (case-insensitive) to an Encoding.
+  // Returns false for identity and for encodings we cannot decode.
+  static bool ParseEncoding(StringPiece value, Encoding* encoding);
+
+  explicit StreamingDecoder(Encoding encoding);
+  ~StreamingDecoder();
+
+  // Must be called once before Decode().  Returns false if the codec state
+  // could not be allocated.
+  bool Init();
+
+  // Decodes the next chunk of the body, writing whatever output it produces
+  // to writer.  Returns false on corrupt input or a failed Write; once that
+  // happens error() is true and all further calls fail.
+  bool Decode(StringPiece in, Writer* writer, MessageHandler* handler);
+
+  // True once the end of the compressed stream has been decoded.
+  bool finished() const;
+  bool error() const { return error_; }
+  Encoding encoding() const { return encoding_; }
+
+  // Decodes a complete body in one call.  Returns false if the input is
+  // corrupt or truncated, or if a Write fails.
+  static bool DecodeAll(Encoding encoding, StringPiece in, Writer* writer,
+                        MessageHandler* handler);
+
+ private:
+  bool DecodeGzip(StringPiece in, Writer* writer, MessageHandler* handler);
+
+  Encoding encoding_;
+  scoped_ptr<GzipInflater> gzip_;
+  scoped_ptr<BrotliInflater> brotli_;
+  bool error_;
+
+  DISALLOW_COPY_AND_ASSIGN(StreamingDecoder);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_UTIL_STREAMING_DECODER_H_
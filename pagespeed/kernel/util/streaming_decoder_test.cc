@@ -0,0 +1,164 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/util/streaming_decoder.h"
+
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/message_handler_test_base.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/stack_buffer.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/util/brotli_inflater.h"
+#include "pagespeed/kernel/util/gzip_inflater.h"
+#include "pagespeed/kernel/util/simple_random.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class StreamingDecoderTest : public testing::Test {
+ protected:
+  StreamingDecoderTest() : random_(new NullMutex) {
+    // Mix compressible and random text so the output spans several stack
+    // buffers whatever the codec.
+    for (int i = 0; i < 20; ++i) {
+      StrAppend(&payload_, "body { color: blue; margin: 0 auto; }\n",
+                random_.GenerateHighEntropyString(kStackBufferSize / 4));
+    }
+  }
+
+  GoogleString Encode(StreamingDecoder::Encoding encoding) {
+    GoogleString encoded;
+    StringWriter writer(&encoded);
+    switch (encoding) {
+      case StreamingDecoder::kGzip:
+        EXPECT_TRUE(GzipInflater::Deflate(payload_, GzipInflater::kGzip,
+                                          &writer));
+        break;
+      case StreamingDecoder::kDeflate:
+        EXPECT_TRUE(GzipInflater::Deflate(payload_, GzipInflater::kDeflate,
+                                          &writer));
+        break;
+      case StreamingDecoder::kBrotli:
+        EXPECT_TRUE(BrotliInflater::Compress(payload_, 5, &handler_,
+                                             &writer));
+        break;
+    }
+    return encoded;
+  }
+
+  // Feeds the encoded payload to a decoder chunk_size bytes at a time and
+  // checks that the original payload comes out.
+  void DecodeInChunks(StreamingDecoder::Encoding encoding, int chunk_size) {
+    GoogleString encoded = Encode(encoding);
+    GoogleString decoded;
+    StringWriter writer(&decoded);
+    StreamingDecoder decoder(encoding);
+    ASSERT_TRUE(decoder.Init());
+    StringPiece input(encoded);
+    while (!input.empty()) {
+      StringPiece chunk = input.substr(0, chunk_size);
+      input.remove_prefix(chunk.size());
+      ASSERT_TRUE(decoder.Decode(chunk, &writer, &handler_));
+      EXPECT_EQ(input.empty(), decoder.finished());
+    }
+    EXPECT_TRUE(decoder.finished());
+    EXPECT_FALSE(decoder.error());
+    EXPECT_EQ(payload_, decoded);
+  }
+
+  SimpleRandom random_;
+  GoogleString payload_;
+  TestMessageHandler handler_;
+};
+
+TEST_F(StreamingDecoderTest, ParseEncoding) {
+  StreamingDecoder::Encoding encoding;
+  EXPECT_TRUE(StreamingDecoder::ParseEncoding("gzip", &encoding));
+  EXPECT_EQ(StreamingDecoder::kGzip, encoding);
+  EXPECT_TRUE(StreamingDecoder::ParseEncoding("Deflate", &encoding));
+  EXPECT_EQ(StreamingDecoder::kDeflate, encoding);
+  EXPECT_TRUE(StreamingDecoder::ParseEncoding("br", &encoding));
+  EXPECT_EQ(StreamingDecoder::kBrotli, encoding);
+  EXPECT_FALSE(StreamingDecoder::ParseEncoding("identity", &encoding));
+  EXPECT_FALSE(StreamingDecoder::ParseEncoding("compress", &encoding));
+}
+
+TEST_F(StreamingDecoderTest, GzipWhole) {
+  DecodeInChunks(StreamingDecoder::kGzip, kint32max);
+}
+
+TEST_F(StreamingDecoderTest, GzipByteAtATime) {
+  DecodeInChunks(StreamingDecoder::kGzip, 1);
+}
+
+TEST_F(StreamingDecoderTest, DeflateInChunks) {
+  DecodeInChunks(StreamingDecoder::kDeflate, 1000);
+}
+
+TEST_F(StreamingDecoderTest, BrotliWhole) {
+  DecodeInChunks(StreamingDecoder::kBrotli, kint32max);
+}
+
+TEST_F(StreamingDecoderTest, BrotliByteAtATime) {
+  DecodeInChunks(StreamingDecoder::kBrotli, 1);
+}
+
+TEST_F(StreamingDecoderTest, EmptyChunksAndTrailingBytesIgnored) {
+  GoogleString encoded = Encode(StreamingDecoder::kGzip);
+  GoogleString decoded;
+  StringWriter writer(&decoded);
+  StreamingDecoder decoder(StreamingDecoder::kGzip);
+  ASSERT_TRUE(decoder.Init());
+  EXPECT_TRUE(decoder.Decode("", &writer, &handler_));
+  EXPECT_TRUE(decoder.Decode(encoded, &writer, &handler_));
+  EXPECT_TRUE(decoder.Decode("trailing", &writer, &handler_));
+  EXPECT_EQ(payload_, decoded);
+}
+
+TEST_F(StreamingDecoderTest, CorruptInputIsSticky) {
+  GoogleString decoded;
+  StringWriter writer(&decoded);
+  StreamingDecoder decoder(StreamingDecoder::kBrotli);
+  ASSERT_TRUE(decoder.Init());
+  EXPECT_FALSE(decoder.Decode("this is not brotli", &writer, &handler_));
+  EXPECT_TRUE(decoder.error());
+
+  // Once failed, even valid input is refused.
+  EXPECT_FALSE(decoder.Decode(Encode(StreamingDecoder::kBrotli), &writer,
+                              &handler_));
+}
+
+TEST_F(StreamingDecoderTest, DecodeAllRejectsTruncatedInput) {
+  GoogleString encoded = Encode(StreamingDecoder::kGzip);
+  encoded.resize(encoded.size() / 2);
+  GoogleString decoded;
+  StringWriter writer(&decoded);
+  EXPECT_FALSE(StreamingDecoder::DecodeAll(StreamingDecoder::kGzip, encoded,
+                                           &writer, &handler_));
+  ASSERT_EQ(1, handler_.messages().size());
+  EXPECT_EQ("Warning: compressed stream truncated", handler_.messages()[0]);
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -36,12 +36,20 @@ AddHeadersFetcher::~AddHeadersFetcher() {}
 void AddHeadersFetcher::Fetch(const GoogleString& original_url,
                               MessageHandler* message_handler,
                               AsyncFetch* fetch) {
+  FetchOnSequence(original_url, message_handler, fetch, NULL);
+}
+
+void AddHeadersFetcher::FetchOnSequence(const GoogleString& original_url,
+                                        MessageHandler* message_handler,
+                                        AsyncFetch* fetch,
+                                        Sequence* response_sequence) {
   RequestHeaders* request_headers = fetch->request_headers();
   for (int i = 0; i < options_->num_custom_fetch_headers(); ++i) {
     const RewriteOptions::NameValue* nv = options_->custom_fetch_header(i);
     request_headers->Replace(nv->name, nv->value);
   }
-  backend_fetcher_->Fetch(original_url, message_handler, fetch);
+  backend_fetcher_->FetchOnSequence(original_url, message_handler, fetch,
+                                    response_sequence);
 }
 
 }  // namespace net_instaweb
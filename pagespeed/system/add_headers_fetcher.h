@@ -30,6 +30,7 @@ namespace net_instaweb {
 class AsyncFetch;
 class RewriteOptions;
 class MessageHandler;
+class Sequence;
 
 // A simple wrapper around another fetcher that adds headers to requests based
 // on settings in the rewrite options before passing them on to the backend
@@ -48,6 +49,10 @@ class AddHeadersFetcher : public UrlAsyncFetcher {
   virtual void Fetch(const GoogleString& url,
                      MessageHandler* message_handler,
                      AsyncFetch* callback);
+  virtual void FetchOnSequence(const GoogleString& url,
+                               MessageHandler* message_handler,
+                               AsyncFetch* callback,
+                               Sequence* response_sequence);
 
  private:
   const RewriteOptions* const options_;
@@ -27,6 +27,7 @@
 
 #include "net/instaweb/http/public/async_fetch.h"
 #include "net/instaweb/http/public/http_cache.h"
+#include "net/instaweb/http/public/rate_controller.h"
 #include "net/instaweb/rewriter/public/rewrite_options.h"
 #include "net/instaweb/rewriter/public/rewrite_query.h"
 #include "net/instaweb/rewriter/public/server_context.h"
@@ -86,6 +87,10 @@ struct Tab {
 const char kShortBreak[] = " ";
 const char kLongBreak[] = " &nbsp;&nbsp; ";
 
+// The statistics page lists at most this many hosts' fetch limits, so that a
+// process tracking many hosts doesn't produce an enormous page.
+const int kMaxHostFetchLimitsShown = 100;
+
 // TODO(jmarantz): disable or recolor links to pages that are not available
 // based on the current config.
 const Tab kTabs[] = {
@@ -190,7 +195,8 @@ AdminSite::AdminSite(StaticAssetManager* static_asset_manager, Timer* timer,
                      MessageHandler* message_handler)
     : message_handler_(message_handler),
       static_asset_manager_(static_asset_manager),
-      timer_(timer) {
+      timer_(timer),
+      rate_controller_(NULL) {
 }
 
 // Handler which serves PSOL console.
@@ -281,6 +287,7 @@ void AdminSite::StatisticsHandler(const RewriteOptions& options,
   fetch->Write("<pre id='stat'>", message_handler_);
   stats->Dump(fetch, message_handler_);
   fetch->Write("</pre>\n", message_handler_);
+  PrintHostFetchLimits(fetch);
   StringPiece statistics_js = options.Enabled(RewriteOptions::kDebug) ?
         JS_statistics_js :
         JS_statistics_js_opt;
@@ -289,6 +296,39 @@ void AdminSite::StatisticsHandler(const RewriteOptions& options,
                message_handler_);
 }
 
+void AdminSite::PrintHostFetchLimits(AsyncFetch* fetch) {
+  if (rate_controller_ == NULL) {
+    return;
+  }
+  std::vector<RateController::HostLimit> limits;
+  int num_hosts = rate_controller_->GetHostLimits(kMaxHostFetchLimitsShown,
+                                                  &limits);
+  if (limits.empty()) {
+    return;
+  }
+  GoogleString out(
+      "<h3>Background fetch limits per host</h3>\n"
+      "<table id='host_fetch_limits'>\n"
+      "  <tr><th>Host</th><th>Limit</th><th>Latency (ms)</th></tr>\n");
+  for (int i = 0, n = limits.size(); i < n; ++i) {
+    const RateController::HostLimit& limit = limits[i];
+    GoogleString escaped_host;
+    HtmlKeywords::Escape(limit.host, &escaped_host);
+    StrAppend(&out, "  <tr><td>", escaped_host, "</td><td>",
+              IntegerToString(limit.outgoing_limit), "</td><td>",
+              (limit.baseline_latency_ms < 0) ?
+                  GoogleString("-") :
+                  Integer64ToString(limit.baseline_latency_ms),
+              "</td></tr>\n");
+  }
+  out += "</table>\n";
+  if (num_hosts > static_cast<int>(limits.size())) {
+    StrAppend(&out, "<p>", IntegerToString(num_hosts - limits.size()),
+              " more hosts not shown.</p>\n");
+  }
+  fetch->Write(out, message_handler_);
+}
+
 void AdminSite::GraphsHandler(const RewriteOptions& options,
                               AdminSource source,
                               const QueryParams& query_params,
@@ -33,6 +33,7 @@ class HTTPCache;
 class MessageHandler;
 class PropertyCache;
 class QueryParams;
+class RateController;
 class RewriteOptions;
 class ServerContext;
 class StaticAssetManager;
@@ -153,10 +154,18 @@ class AdminSite {
   // Return the message handler for debugging use.
   MessageHandler* MessageHandlerForTesting() { return message_handler_; }
 
+  // Sets the rate controller whose adaptive per-host fetch limits are listed
+  // on the statistics page, or NULL (the default) to list none.  Not owned.
+  void set_rate_controller(RateController* x) { rate_controller_ = x; }
+
  private:
+  // Writes a table of the most throttled hosts' fetch limits, if any.
+  void PrintHostFetchLimits(AsyncFetch* fetch);
+
   MessageHandler* message_handler_;
   StaticAssetManager* static_asset_manager_;
   Timer* timer_;
+  RateController* rate_controller_;
   DISALLOW_COPY_AND_ASSIGN(AdminSite);
 };
 
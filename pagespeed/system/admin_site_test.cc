@@ -22,6 +22,9 @@
 #include "pagespeed/system/admin_site.h"
 
 #include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/counting_url_async_fetcher.h"
+#include "net/instaweb/http/public/rate_controller.h"
+#include "net/instaweb/http/public/rate_controlling_url_async_fetcher.h"
 #include "net/instaweb/rewriter/public/custom_rewrite_test_base.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
 #include "net/instaweb/rewriter/public/rewrite_driver_factory.h"
@@ -36,7 +39,9 @@
 #include "pagespeed/kernel/base/mock_message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/http/content_type.h"
 #include "pagespeed/kernel/util/platform.h"
 
 namespace net_instaweb {
@@ -55,6 +60,20 @@ class SystemServerContextNoProxyHtml : public SystemServerContext {
   DISALLOW_COPY_AND_ASSIGN(SystemServerContextNoProxyHtml);
 };
 
+// A background fetch, so the rate controller applies its limits to it.
+class BackgroundStringAsyncFetch : public StringAsyncFetch {
+ public:
+  BackgroundStringAsyncFetch(const RequestContextPtr& request_context,
+                             GoogleString* buffer)
+      : StringAsyncFetch(request_context, buffer) {
+  }
+
+  virtual bool IsBackgroundFetch() const { return true; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(BackgroundStringAsyncFetch);
+};
+
 class AdminSiteTest : public CustomRewriteTestBase<SystemRewriteOptions> {
  protected:
   AdminSiteTest()
@@ -84,6 +103,15 @@ class AdminSiteTest : public CustomRewriteTestBase<SystemRewriteOptions> {
     return server_context.release();
   }
 
+  // Fetches url in the background through fetcher.
+  void BackgroundFetch(const GoogleString& url, UrlAsyncFetcher* fetcher) {
+    GoogleString buffer;
+    BackgroundStringAsyncFetch fetch(rewrite_driver()->request_context(),
+                                     &buffer);
+    fetcher->Fetch(url, message_handler(), &fetch);
+    EXPECT_TRUE(fetch.done());
+  }
+
   scoped_ptr<ThreadSystem> thread_system_;
   scoped_ptr<ServerContext> server_context_;
   scoped_ptr<SystemRewriteOptions> options_;
@@ -114,6 +142,45 @@ TEST_F(AdminSiteTest, ColorMessagesInHistoryPage) {
       buffer, ::testing::HasSubstr(StringPrintf(kColorTemplate, "brown")));
   EXPECT_THAT(buffer, ::testing::HasSubstr("style=\"margin:0;\""));
 }
+
+TEST_F(AdminSiteTest, StatisticsPageListsHostFetchLimits) {
+  RateControllingUrlAsyncFetcher rate_fetcher(
+      counting_url_async_fetcher(), 100 /* max_global_queue_size */,
+      2 /* per_host_outgoing_request_threshold */,
+      4 /* per_host_queued_request_threshold */,
+      server_context()->thread_system(), statistics());
+  rate_fetcher.rate_controller()->EnableAdaptiveLimits(timer(), 8);
+  admin_site_->set_rate_controller(rate_fetcher.rate_controller());
+
+  // Only a bounded number of hosts are listed, however many are tracked.
+  for (int i = 0; i < 101; ++i) {
+    GoogleString url = StrCat("http://h", IntegerToString(i), ".com/a.css");
+    SetResponseWithDefaultHeaders(url, kContentTypeCss, "a{}", 100);
+    BackgroundFetch(url, &rate_fetcher);
+  }
+
+  GoogleString buffer;
+  StringAsyncFetch fetch(rewrite_driver()->request_context(), &buffer);
+  admin_site_->StatisticsHandler(*(rewrite_driver()->options()),
+                                 AdminSite::kStatistics, &fetch, statistics());
+  EXPECT_THAT(buffer, ::testing::HasSubstr("<table id='host_fetch_limits'>"));
+  EXPECT_THAT(buffer, ::testing::HasSubstr("<tr><td>h0.com</td><td>2</td>"));
+  EXPECT_THAT(buffer, ::testing::HasSubstr(
+      "1 more hosts not shown."));
+  EXPECT_THAT(buffer, ::testing::Not(::testing::HasSubstr(
+      "<td>h99.com</td>")));
+}
+
+TEST_F(AdminSiteTest, StatisticsPageWithoutRateController) {
+  GoogleString buffer;
+  StringAsyncFetch fetch(rewrite_driver()->request_context(), &buffer);
+  admin_site_->StatisticsHandler(*(rewrite_driver()->options()),
+                                 AdminSite::kStatistics, &fetch, statistics());
+  EXPECT_THAT(buffer, ::testing::HasSubstr("<pre id='stat'>"));
+  EXPECT_THAT(buffer, ::testing::Not(::testing::HasSubstr(
+      "host_fetch_limits")));
+}
+
 // TODO(xqyin): Add unit tests for other methods in AdminSite.
 
 }  // namespace
@@ -0,0 +1,1008 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/system/http2_url_async_fetcher.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+
+#include "base/logging.h"
+#include "nghttp2/nghttp2.h"
+#include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/public/global_constants.h"
+#include "net/instaweb/public/version.h"
+#include "strings/stringpiece_utils.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/http/google_url.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/request_headers.h"
+#include "pagespeed/kernel/http/response_headers.h"
+
+namespace net_instaweb {
+
+const char Http2UrlAsyncFetcher::kHttp2FetchRequestCount[] =
+    "http2_fetch_request_count";
+const char Http2UrlAsyncFetcher::kHttp2FetchConnectionCount[] =
+    "http2_fetch_connection_count";
+const char Http2UrlAsyncFetcher::kHttp2FetchByteCount[] =
+    "http2_fetch_bytes_count";
+const char Http2UrlAsyncFetcher::kHttp2FetchFailureCount[] =
+    "http2_fetch_failure_count";
+const char Http2UrlAsyncFetcher::kHttp2FetchTimeoutCount[] =
+    "http2_fetch_timeout_count";
+const char Http2UrlAsyncFetcher::kHttp2FetchActiveConnections[] =
+    "http2_fetch_active_connections";
+const char Http2UrlAsyncFetcher::kHttp2FetchLatencyUsHistogram[] =
+    "http2_fetch_latency_us";
+
+namespace {
+
+// How long the event thread sleeps in poll() when nothing happens; this
+// bounds how late a timeout can be noticed.
+const int kPollIntervalMs = 50;
+
+// Connections with no streams are closed after this long.
+const int64 kIdleConnectionTimeoutMs = 30 * Timer::kSecondMs;
+
+// Our receive window per stream.  The nghttp2 default is the 64k minimum
+// from the spec, which throttles large resources on high-latency links.
+const uint32 kInitialWindowSize = 1 << 20;
+
+const int kReadBufferSize = 16 * 1024;
+
+bool SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return (flags >= 0) && (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
+}
+
+// Looks up a numeric host, as GoogleUrl::Host() gives it, and port without
+// consulting DNS, so it never blocks.  Returns NULL unless host is an IPv4
+// or bracketed IPv6 literal.  The caller must freeaddrinfo the result.
+struct addrinfo* LookUpNumericHost(StringPiece host, const GoogleString& port) {
+  if ((host.size() >= 2) && (host[0] == '[') &&
+      (host[host.size() - 1] == ']')) {
+    host = host.substr(1, host.size() - 2);
+  }
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  struct addrinfo* addrs = NULL;
+  if (getaddrinfo(host.as_string().c_str(), port.c_str(), &hints,
+                  &addrs) != 0) {
+    return NULL;
+  }
+  return addrs;
+}
+
+nghttp2_nv MakeNv(const GoogleString& name, const GoogleString& value) {
+  nghttp2_nv nv;
+  nv.name = reinterpret_cast<uint8_t*>(const_cast<char*>(name.data()));
+  nv.namelen = name.size();
+  nv.value = reinterpret_cast<uint8_t*>(const_cast<char*>(value.data()));
+  nv.valuelen = value.size();
+  nv.flags = NGHTTP2_NV_FLAG_NONE;
+  return nv;
+}
+
+}  // namespace
+
+// A single fetch.  Until it is submitted to a connection it is owned by
+// the fetcher's pending_ or retry_ lists; after that by the connection.
+class Http2UrlAsyncFetcher::Stream {
+ public:
+  Stream(const GoogleString& url, AsyncFetch* async_fetch,
+         MessageHandler* message_handler, int64 start_us, int64 deadline_ms)
+      : url_(url),
+        async_fetch_(async_fetch),
+        message_handler_(message_handler),
+        start_us_(start_us),
+        deadline_ms_(deadline_ms),
+        body_offset_(0),
+        bytes_received_(0),
+        response_started_(false),
+        headers_complete_(false),
+        skipping_headers_(false),
+        retried_(false),
+        timed_out_(false) {
+  }
+
+  // Fills in the request name/value pairs from the AsyncFetch's request
+  // headers, removing the headers that do not apply to HTTP/2.
+  // Called again if the stream is retried.
+  void PrepareRequest(const GoogleUrl& gurl) {
+    names_.clear();
+    values_.clear();
+    nva_.clear();
+    body_offset_ = 0;
+    FixUserAgent();
+    RequestHeaders* request_headers = async_fetch_->request_headers();
+    StringPieceVector names_to_sanitize =
+        HttpAttributes::SortedHopByHopHeaders();
+    request_headers->RemoveAllFromSortedArray(&names_to_sanitize[0],
+                                              names_to_sanitize.size());
+    request_headers->RemoveAll(HttpAttributes::kContentLength);
+
+    const char* host = request_headers->Lookup1(HttpAttributes::kHost);
+    AddPair(":method", request_headers->method_string());
+    AddPair(":scheme", "http");
+    AddPair(":authority", (host != NULL) ? StringPiece(host)
+                                         : gurl.HostAndPort());
+    AddPair(":path", gurl.PathAndLeaf());
+    for (int i = 0, n = request_headers->NumAttributes(); i < n; ++i) {
+      if (StringCaseEqual(request_headers->Name(i), HttpAttributes::kHost)) {
+        continue;
+      }
+      GoogleString name = request_headers->Name(i);
+      LowerString(&name);
+      AddPair(name, request_headers->Value(i));
+    }
+    for (int i = 0, n = names_.size(); i < n; ++i) {
+      nva_.push_back(MakeNv(names_[i], values_[i]));
+    }
+  }
+
+  bool has_body() const {
+    RequestHeaders* request_headers = async_fetch_->request_headers();
+    return !request_headers->message_body().empty() &&
+        (request_headers->method() == RequestHeaders::kPost);
+  }
+
+  // nghttp2_data_source_read_callback for the POST body.
+  static ssize_t ReadBody(nghttp2_session* session, int32_t stream_id,
+                          uint8_t* buf, size_t length, uint32_t* data_flags,
+                          nghttp2_data_source* source, void* user_data) {
+    Stream* stream = static_cast<Stream*>(source->ptr);
+    if (stream->async_fetch_ == NULL) {
+      return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+    const GoogleString& body =
+        stream->async_fetch_->request_headers()->message_body();
+    size_t n = std::min(length, body.size() - stream->body_offset_);
+    memcpy(buf, body.data() + stream->body_offset_, n);
+    stream->body_offset_ += n;
+    if (stream->body_offset_ == body.size()) {
+      *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    return n;
+  }
+
+  const nghttp2_nv* nva() const { return &nva_[0]; }
+  size_t nvlen() const { return nva_.size(); }
+
+  const GoogleString& url() const { return url_; }
+  AsyncFetch* async_fetch() { return async_fetch_; }
+  MessageHandler* message_handler() { return message_handler_; }
+  bool finished() const { return async_fetch_ == NULL; }
+  int64 start_us() const { return start_us_; }
+  int64 deadline_ms() const { return deadline_ms_; }
+  int64 bytes_received() const { return bytes_received_; }
+  void add_bytes_received(int64 n) { bytes_received_ += n; }
+
+  bool response_started() const { return response_started_; }
+  void set_response_started() { response_started_ = true; }
+  bool headers_complete() const { return headers_complete_; }
+  void set_headers_complete() { headers_complete_ = true; }
+  bool skipping_headers() const { return skipping_headers_; }
+  void set_skipping_headers(bool x) { skipping_headers_ = x; }
+  bool retried() const { return retried_; }
+  void set_retried() { retried_ = true; }
+  bool timed_out() const { return timed_out_; }
+  void set_timed_out() { timed_out_ = true; }
+
+  // Calls Done on the AsyncFetch; the stream itself lives on until its
+  // owner is through with it.
+  void Done(bool success) {
+    async_fetch_->Done(success);
+    async_fetch_ = NULL;
+  }
+
+ private:
+  void AddPair(StringPiece name, StringPiece value) {
+    names_.push_back(name.as_string());
+    values_.push_back(value.as_string());
+  }
+
+  // Same as SerfFetch::FixUserAgent, with our own suffix.
+  void FixUserAgent() {
+    GoogleString user_agent;
+    ConstStringStarVector v;
+    RequestHeaders* request_headers = async_fetch_->request_headers();
+    if (request_headers->Lookup(HttpAttributes::kUserAgent, &v)) {
+      for (int i = 0, n = v.size(); i < n; ++i) {
+        if (i != 0) {
+          user_agent += " ";
+        }
+        if (v[i] != NULL) {
+          user_agent += *(v[i]);
+        }
+      }
+      request_headers->RemoveAll(HttpAttributes::kUserAgent);
+    }
+    if (user_agent.empty()) {
+      user_agent += "nghttp2";
+    }
+    GoogleString version = StrCat(
+        " (", kModPagespeedSubrequestUserAgent,
+        "/" MOD_PAGESPEED_VERSION_STRING "-" LASTCHANGE_STRING ")");
+    if (!strings::EndsWith(StringPiece(user_agent), version)) {
+      user_agent += version;
+    }
+    request_headers->Add(HttpAttributes::kUserAgent, user_agent);
+  }
+
+  const GoogleString url_;
+  AsyncFetch* async_fetch_;
+  MessageHandler* message_handler_;
+  const int64 start_us_;
+  const int64 deadline_ms_;
+
+  // Backing store for nva_.
+  StringVector names_;
+  StringVector values_;
+  std::vector<nghttp2_nv> nva_;
+  size_t body_offset_;
+
+  int64 bytes_received_;
+  bool response_started_;
+  bool headers_complete_;
+  bool skipping_headers_;  // In a 1xx or trailer header block.
+  bool retried_;
+  bool timed_out_;
+
+  DISALLOW_COPY_AND_ASSIGN(Stream);
+};
+
+// An HTTP/2 client session on one socket to one origin.  Lives on the event
+// thread.
+class Http2UrlAsyncFetcher::Connection {
+ public:
+  Connection(Http2UrlAsyncFetcher* fetcher, const GoogleString& host,
+             const GoogleString& port, int64 now_ms)
+      : fetcher_(fetcher),
+        host_(host),
+        port_(port),
+        fd_(-1),
+        session_(NULL),
+        connected_(false),
+        going_away_(false),
+        failed_(false),
+        created_ms_(now_ms),
+        last_active_ms_(now_ms) {
+  }
+
+  ~Connection() {
+    if (session_ != NULL) {
+      nghttp2_session_del(session_);
+    }
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  // Creates the session and starts a non-blocking connect.  Returns false
+  // on immediate failure.
+  bool Connect() {
+    nghttp2_session_callbacks* callbacks;
+    if (nghttp2_session_callbacks_new(&callbacks) != 0) {
+      return false;
+    }
+    nghttp2_session_callbacks_set_send_callback(callbacks, SendCallback);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(
+        callbacks, OnFrameRecvCallback);
+    nghttp2_session_callbacks_set_on_header_callback(
+        callbacks, OnHeaderCallback);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(
+        callbacks, OnDataChunkRecvCallback);
+    nghttp2_session_callbacks_set_on_stream_close_callback(
+        callbacks, OnStreamCloseCallback);
+    int rv = nghttp2_session_client_new(&session_, callbacks, this);
+    nghttp2_session_callbacks_del(callbacks);
+    if (rv != 0) {
+      session_ = NULL;
+      return false;
+    }
+    nghttp2_settings_entry settings[] = {
+      {NGHTTP2_SETTINGS_ENABLE_PUSH, 0},
+      {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, kInitialWindowSize},
+    };
+    nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, settings,
+                            arraysize(settings));
+
+    // Origins are numeric (see ParseOrigins), so this does not block the
+    // event thread on DNS.
+    struct addrinfo* addrs = LookUpNumericHost(host_, port_);
+    if (addrs == NULL) {
+      fetcher_->message_handler_->Message(
+          kWarning, "HTTP/2 fetcher could not look up %s", host_.c_str());
+      return false;
+    }
+    // Try each address until a connect starts.  errno is saved as each
+    // attempt fails, as close() and freeaddrinfo() may clobber it.
+    int error = 0;
+    for (struct addrinfo* addr = addrs; addr != NULL; addr = addr->ai_next) {
+      fd_ = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+      // Frames are written as soon as they are ready, so don't let Nagle
+      // hold back e.g. a WINDOW_UPDATE behind an unacknowledged request.
+      int one = 1;
+      if ((fd_ >= 0) && SetNonBlocking(fd_) &&
+          (setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one,
+                      sizeof(one)) == 0) &&
+          ((connect(fd_, addr->ai_addr, addr->ai_addrlen) == 0) ||
+           (errno == EINPROGRESS))) {
+        break;
+      }
+      error = errno;
+      if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+      }
+    }
+    freeaddrinfo(addrs);
+    if (fd_ < 0) {
+      fetcher_->message_handler_->Message(
+          kWarning, "HTTP/2 fetcher could not connect to %s:%s: %s",
+          host_.c_str(), port_.c_str(), strerror(error));
+      return false;
+    }
+    return true;
+  }
+
+  // Submits the request for stream, which the connection then owns.
+  bool Submit(Stream* stream) {
+    nghttp2_data_provider provider;
+    provider.source.ptr = stream;
+    provider.read_callback = Stream::ReadBody;
+    int32_t stream_id = nghttp2_submit_request(
+        session_, NULL, stream->nva(), stream->nvlen(),
+        stream->has_body() ? &provider : NULL, stream);
+    if (stream_id < 0) {
+      return false;
+    }
+    streams_[stream_id] = stream;
+    return true;
+  }
+
+  // Returns the poll() events this connection is waiting for.
+  short Events() const {  // NOLINT
+    short events = POLLIN;  // NOLINT
+    if (!connected_ || !out_.empty() || nghttp2_session_want_write(session_)) {
+      events |= POLLOUT;
+    }
+    return events;
+  }
+
+  // Services the socket after poll() returns revents for it.
+  void Process(short revents, int64 now_ms) {  // NOLINT
+    if (!connected_) {
+      if ((revents & (POLLOUT | POLLERR | POLLHUP)) == 0) {
+        return;
+      }
+      int error = 0;
+      socklen_t len = sizeof(error);
+      if ((getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &len) != 0) ||
+          (error != 0)) {
+        fetcher_->message_handler_->Message(
+            kWarning, "HTTP/2 fetcher could not connect to %s:%s: %s",
+            host_.c_str(), port_.c_str(), strerror(error));
+        failed_ = true;
+        return;
+      }
+      connected_ = true;
+    }
+    if ((revents & (POLLIN | POLLERR | POLLHUP)) != 0) {
+      char buf[kReadBufferSize];
+      for (;;) {
+        ssize_t n = read(fd_, buf, sizeof(buf));
+        if (n > 0) {
+          last_active_ms_ = now_ms;
+          ssize_t consumed = nghttp2_session_mem_recv(
+              session_, reinterpret_cast<uint8_t*>(buf), n);
+          if (consumed < 0) {
+            fetcher_->message_handler_->Message(
+                kWarning, "HTTP/2 protocol error from %s:%s: %s",
+                host_.c_str(), port_.c_str(),
+                nghttp2_strerror(static_cast<int>(consumed)));
+            failed_ = true;
+            return;
+          }
+        } else if ((n < 0) && (errno == EINTR)) {
+          continue;
+        } else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+          break;
+        } else {
+          // EOF or error.
+          failed_ = true;
+          return;
+        }
+      }
+    }
+    Send();
+  }
+
+  // Serializes whatever frames nghttp2 has queued and writes as much as
+  // the socket will take.
+  void Send() {
+    if (failed_ || (nghttp2_session_send(session_) != 0)) {
+      failed_ = true;
+      return;
+    }
+    if (!connected_) {
+      return;
+    }
+    while (!out_.empty()) {
+      ssize_t n = write(fd_, out_.data(), out_.size());
+      if (n > 0) {
+        out_.erase(0, n);
+      } else if ((n < 0) && (errno == EINTR)) {
+        continue;
+      } else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+        break;
+      } else {
+        failed_ = true;
+        return;
+      }
+    }
+  }
+
+  // Cancels streams that have run past their deadline.
+  void ExpireStreams(int64 now_ms) {
+    for (StreamMap::iterator p = streams_.begin(); p != streams_.end(); ++p) {
+      Stream* stream = p->second;
+      if (!stream->finished() && (now_ms >= stream->deadline_ms())) {
+        stream->message_handler()->Message(
+            kWarning, "HTTP/2 fetch of %s timed out", stream->url().c_str());
+        stream->set_timed_out();
+        fetcher_->timeout_count_->Add(1);
+        fetcher_->FinishStream(stream, false);
+        nghttp2_submit_rst_stream(session_, NGHTTP2_FLAG_NONE, p->first,
+                                  NGHTTP2_CANCEL);
+      }
+    }
+  }
+
+  // True if this connection should be closed: the socket failed, the
+  // session is over, it never connected, or it has sat idle too long.
+  bool ShouldClose(int64 now_ms) const {
+    if (failed_) {
+      return true;
+    }
+    if (!nghttp2_session_want_read(session_) &&
+        !nghttp2_session_want_write(session_)) {
+      return true;
+    }
+    if (!connected_ && (now_ms - created_ms_ >= fetcher_->timeout_ms_)) {
+      return true;
+    }
+    return streams_.empty() &&
+        (going_away_ || (now_ms - last_active_ms_ >= kIdleConnectionTimeoutMs));
+  }
+
+  // Hands every stream still open back to the fetcher to retry or fail.
+  void AbandonStreams() {
+    StreamMap streams;
+    streams.swap(streams_);
+    for (StreamMap::iterator p = streams.begin(); p != streams.end(); ++p) {
+      fetcher_->StreamInterrupted(p->second);
+    }
+  }
+
+  bool accepting_streams() const { return !going_away_ && !failed_; }
+  int fd() const { return fd_; }
+  void touch(int64 now_ms) { last_active_ms_ = now_ms; }
+
+ private:
+  typedef std::map<int32, Stream*> StreamMap;
+
+  Stream* FindStream(int32 stream_id) {
+    return static_cast<Stream*>(
+        nghttp2_session_get_stream_user_data(session_, stream_id));
+  }
+
+  static ssize_t SendCallback(nghttp2_session* session, const uint8_t* data,
+                              size_t length, int flags, void* user_data) {
+    Connection* connection = static_cast<Connection*>(user_data);
+    connection->out_.append(reinterpret_cast<const char*>(data), length);
+    return length;
+  }
+
+  static int OnHeaderCallback(nghttp2_session* session,
+                              const nghttp2_frame* frame,
+                              const uint8_t* name, size_t namelen,
+                              const uint8_t* value, size_t valuelen,
+                              uint8_t flags, void* user_data) {
+    Connection* connection = static_cast<Connection*>(user_data);
+    if (frame->hd.type != NGHTTP2_HEADERS) {
+      return 0;
+    }
+    Stream* stream = connection->FindStream(frame->hd.stream_id);
+    if ((stream == NULL) || stream->finished() || stream->headers_complete()) {
+      // Trailers, or a stream we've given up on.
+      return 0;
+    }
+    StringPiece name_piece(reinterpret_cast<const char*>(name), namelen);
+    StringPiece value_piece(reinterpret_cast<const char*>(value), valuelen);
+    stream->set_response_started();
+    ResponseHeaders* response_headers =
+        stream->async_fetch()->response_headers();
+    if (name_piece == ":status") {
+      int code;
+      if (!StringToInt(value_piece.as_string(), &code)) {
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+      }
+      // Informational responses are followed by the real one.
+      stream->set_skipping_headers(code < 200);
+      if (code >= 200) {
+        response_headers->SetStatusAndReason(
+            static_cast<HttpStatus::Code>(code));
+        // The rest of the system, caches included, deals in HTTP/1.x
+        // responses, so present the response as one.
+        response_headers->set_major_version(1);
+        response_headers->set_minor_version(1);
+      }
+    } else if (!stream->skipping_headers() &&
+               !name_piece.starts_with(":")) {
+      response_headers->Add(name_piece, value_piece);
+    }
+    return 0;
+  }
+
+  static int OnFrameRecvCallback(nghttp2_session* session,
+                                 const nghttp2_frame* frame,
+                                 void* user_data) {
+    Connection* connection = static_cast<Connection*>(user_data);
+    if (frame->hd.type == NGHTTP2_GOAWAY) {
+      // Streams past last_stream_id will be closed with REFUSED_STREAM and
+      // retried elsewhere; finish the rest, then go.
+      connection->going_away_ = true;
+      return 0;
+    }
+    Stream* stream = connection->FindStream(frame->hd.stream_id);
+    if ((stream == NULL) || stream->finished()) {
+      return 0;
+    }
+    if ((frame->hd.type == NGHTTP2_HEADERS) &&
+        ((frame->hd.flags & NGHTTP2_FLAG_END_HEADERS) != 0)) {
+      if (stream->skipping_headers()) {
+        stream->set_skipping_headers(false);
+      } else if (!stream->headers_complete()) {
+        stream->set_headers_complete();
+        ResponseHeaders* response_headers =
+            stream->async_fetch()->response_headers();
+        response_headers->ComputeCaching();
+        int64 content_length;
+        if (connection->fetcher_->track_original_content_length_ &&
+            response_headers->FindContentLength(&content_length)) {
+          response_headers->SetOriginalContentLength(content_length);
+        }
+      }
+    } else if (frame->hd.type == NGHTTP2_DATA) {
+      stream->async_fetch()->Flush(stream->message_handler());
+    }
+    return 0;
+  }
+
+  static int OnDataChunkRecvCallback(nghttp2_session* session, uint8_t flags,
+                                     int32_t stream_id, const uint8_t* data,
+                                     size_t len, void* user_data) {
+    Connection* connection = static_cast<Connection*>(user_data);
+    Stream* stream = connection->FindStream(stream_id);
+    if ((stream == NULL) || stream->finished()) {
+      return 0;
+    }
+    stream->add_bytes_received(len);
+    connection->fetcher_->byte_count_->Add(len);
+    stream->async_fetch()->Write(
+        StringPiece(reinterpret_cast<const char*>(data), len),
+        stream->message_handler());
+    return 0;
+  }
+
+  static int OnStreamCloseCallback(nghttp2_session* session,
+                                   int32_t stream_id, uint32_t error_code,
+                                   void* user_data) {
+    Connection* connection = static_cast<Connection*>(user_data);
+    StreamMap::iterator p = connection->streams_.find(stream_id);
+    if (p == connection->streams_.end()) {
+      return 0;
+    }
+    Stream* stream = p->second;
+    connection->streams_.erase(p);
+    if ((error_code == NGHTTP2_REFUSED_STREAM) && !stream->finished()) {
+      // Never processed by the server, so safe to try again.
+      connection->fetcher_->StreamInterrupted(stream);
+      return 0;
+    }
+    if (!stream->finished()) {
+      bool success = (error_code == NGHTTP2_NO_ERROR) &&
+          stream->headers_complete();
+      if (!success) {
+        stream->message_handler()->Message(
+            kWarning, "HTTP/2 fetch of %s failed: stream error %u",
+            stream->url().c_str(), error_code);
+      }
+      connection->fetcher_->FinishStream(stream, success);
+    }
+    delete stream;
+    return 0;
+  }
+
+  Http2UrlAsyncFetcher* fetcher_;
+  const GoogleString host_;
+  const GoogleString port_;
+  int fd_;
+  nghttp2_session* session_;
+  GoogleString out_;  // Serialized frames not yet written to fd_.
+  StreamMap streams_;
+  bool connected_;
+  bool going_away_;
+  bool failed_;
+  const int64 created_ms_;
+  int64 last_active_ms_;
+
+  DISALLOW_COPY_AND_ASSIGN(Connection);
+};
+
+class Http2UrlAsyncFetcher::EventThread : public ThreadSystem::Thread {
+ public:
+  EventThread(Http2UrlAsyncFetcher* fetcher, ThreadSystem* thread_system)
+      : Thread(thread_system, "http2_fetcher", ThreadSystem::kJoinable),
+        fetcher_(fetcher) {
+  }
+
+ protected:
+  virtual void Run() { fetcher_->EventLoop(); }
+
+ private:
+  Http2UrlAsyncFetcher* fetcher_;
+
+  DISALLOW_COPY_AND_ASSIGN(EventThread);
+};
+
+Http2UrlAsyncFetcher::Http2UrlAsyncFetcher(ThreadSystem* thread_system,
+                                           Statistics* statistics,
+                                           Timer* timer, int64 timeout_ms,
+                                           MessageHandler* message_handler)
+    : thread_system_(thread_system),
+      timer_(timer),
+      message_handler_(message_handler),
+      timeout_ms_(timeout_ms),
+      track_original_content_length_(false),
+      mutex_(thread_system->NewMutex()),
+      shutdown_(false),
+      wake_read_fd_(-1),
+      wake_write_fd_(-1),
+      request_count_(statistics->GetVariable(kHttp2FetchRequestCount)),
+      connection_count_(statistics->GetVariable(kHttp2FetchConnectionCount)),
+      byte_count_(statistics->GetVariable(kHttp2FetchByteCount)),
+      failure_count_(statistics->GetVariable(kHttp2FetchFailureCount)),
+      timeout_count_(statistics->GetVariable(kHttp2FetchTimeoutCount)),
+      active_connections_(
+          statistics->GetUpDownCounter(kHttp2FetchActiveConnections)),
+      latency_us_histogram_(
+          statistics->GetHistogram(kHttp2FetchLatencyUsHistogram)) {
+  int fds[2];
+  if ((pipe(fds) == 0) && SetNonBlocking(fds[0]) && SetNonBlocking(fds[1])) {
+    wake_read_fd_ = fds[0];
+    wake_write_fd_ = fds[1];
+  } else {
+    message_handler_->Message(kError, "HTTP/2 fetcher could not create pipe");
+  }
+}
+
+Http2UrlAsyncFetcher::~Http2UrlAsyncFetcher() {
+  ShutDown();
+  if (wake_read_fd_ >= 0) {
+    close(wake_read_fd_);
+    close(wake_write_fd_);
+  }
+}
+
+void Http2UrlAsyncFetcher::InitStats(Statistics* statistics) {
+  statistics->AddVariable(kHttp2FetchRequestCount);
+  statistics->AddVariable(kHttp2FetchConnectionCount);
+  statistics->AddVariable(kHttp2FetchByteCount);
+  statistics->AddVariable(kHttp2FetchFailureCount);
+  statistics->AddVariable(kHttp2FetchTimeoutCount);
+  statistics->AddUpDownCounter(kHttp2FetchActiveConnections);
+  Histogram* histogram =
+      statistics->AddHistogram(kHttp2FetchLatencyUsHistogram);
+  histogram->SetMaxValue(5 * Timer::kSecondUs);
+}
+
+bool Http2UrlAsyncFetcher::SetPriorKnowledgeOrigins(StringPiece spec) {
+  std::set<GoogleString> origins;
+  if (!ParseOrigins(spec, &origins)) {
+    return false;
+  }
+  origins_.swap(origins);
+  return true;
+}
+
+bool Http2UrlAsyncFetcher::ParseOrigins(StringPiece spec,
+                                        std::set<GoogleString>* origins) {
+  StringPieceVector entries;
+  SplitStringPieceToVector(spec, ",", &entries, true /* omit_empty */);
+  for (int i = 0, n = entries.size(); i < n; ++i) {
+    StringPiece entry = entries[i];
+    TrimWhitespace(&entry);
+    GoogleUrl gurl(StrCat("http://", entry, "/"));
+    if (entry.empty() || !gurl.IsWebValid() ||
+        !StringCaseEqual(gurl.HostAndPort(), entry)) {
+      return false;
+    }
+    // Connections are made on the event thread, which must not block on
+    // DNS, so only IP literals are accepted.
+    struct addrinfo* addrs = LookUpNumericHost(
+        gurl.Host(), IntegerToString(gurl.EffectiveIntPort()));
+    if (addrs == NULL) {
+      return false;
+    }
+    freeaddrinfo(addrs);
+    origins->insert(StrCat(gurl.Host(), ":",
+                           IntegerToString(gurl.EffectiveIntPort())));
+  }
+  return true;
+}
+
+bool Http2UrlAsyncFetcher::HandlesUrl(const GoogleUrl& url) const {
+  if (origins_.empty() || !url.IsWebValid() || !url.SchemeIs("http")) {
+    return false;
+  }
+  GoogleString origin = StrCat(url.Host(), ":",
+                               IntegerToString(url.EffectiveIntPort()));
+  return origins_.find(origin) != origins_.end();
+}
+
+void Http2UrlAsyncFetcher::Fetch(const GoogleString& url,
+                                 MessageHandler* message_handler,
+                                 AsyncFetch* async_fetch) {
+  async_fetch = EnableInflation(async_fetch);
+  request_count_->Add(1);
+  Stream* stream = new Stream(url, async_fetch, message_handler,
+                              timer_->NowUs(), timer_->NowMs() + timeout_ms_);
+  {
+    ScopedMutex lock(mutex_.get());
+    if (!shutdown_ && (wake_read_fd_ >= 0)) {
+      if (thread_.get() == NULL) {
+        thread_.reset(new EventThread(this, thread_system_));
+        if (!thread_->Start()) {
+          message_handler_->Message(kError,
+                                    "HTTP/2 fetcher could not start thread");
+          thread_.reset(NULL);
+          shutdown_ = true;
+        }
+      }
+      if (thread_.get() != NULL) {
+        pending_.push_back(stream);
+        stream = NULL;
+      }
+    }
+  }
+  if (stream != NULL) {
+    FinishStream(stream, false);
+    delete stream;
+  } else {
+    Wake();
+  }
+}
+
+void Http2UrlAsyncFetcher::ShutDown() {
+  scoped_ptr<EventThread> thread;
+  {
+    ScopedMutex lock(mutex_.get());
+    shutdown_ = true;
+    thread.reset(thread_.release());
+  }
+  if (thread.get() != NULL) {
+    Wake();
+    thread->Join();
+  }
+}
+
+void Http2UrlAsyncFetcher::Wake() {
+  char c = 0;
+  // A full pipe already means a wakeup is due, so errors are ignored.
+  ssize_t ignored = write(wake_write_fd_, &c, 1);
+  (void) ignored;
+}
+
+void Http2UrlAsyncFetcher::EventLoop() {
+  std::vector<Stream*> to_start;
+  std::vector<struct pollfd> fds;
+  std::vector<Connection*> polled;
+  for (;;) {
+    char buf[64];
+    while (read(wake_read_fd_, buf, sizeof(buf)) > 0) {
+    }
+    bool shutdown;
+    {
+      ScopedMutex lock(mutex_.get());
+      to_start.swap(pending_);
+      shutdown = shutdown_;
+    }
+    to_start.insert(to_start.end(), retry_.begin(), retry_.end());
+    retry_.clear();
+    if (shutdown) {
+      break;
+    }
+    for (int i = 0, n = to_start.size(); i < n; ++i) {
+      StartStream(to_start[i]);
+    }
+    to_start.clear();
+
+    fds.clear();
+    polled.clear();
+    struct pollfd wake_fd = {wake_read_fd_, POLLIN, 0};
+    fds.push_back(wake_fd);
+    for (ConnectionMap::iterator p = connections_.begin();
+         p != connections_.end(); ++p) {
+      p->second->Send();
+      struct pollfd fd = {p->second->fd(), p->second->Events(), 0};
+      fds.push_back(fd);
+      polled.push_back(p->second);
+    }
+    int n = poll(&fds[0], fds.size(), kPollIntervalMs);
+    if ((n < 0) && (errno != EINTR)) {
+      message_handler_->Message(kError, "HTTP/2 fetcher poll failed: %s",
+                                strerror(errno));
+    }
+
+    int64 now_ms = timer_->NowMs();
+    for (int i = 0, num = polled.size(); i < num; ++i) {
+      if ((n > 0) && (fds[i + 1].revents != 0)) {
+        polled[i]->Process(fds[i + 1].revents, now_ms);
+      }
+      polled[i]->ExpireStreams(now_ms);
+    }
+    for (ConnectionMap::iterator p = connections_.begin();
+         p != connections_.end(); ) {
+      Connection* connection = p->second;
+      if (connection->ShouldClose(now_ms)) {
+        connections_.erase(p++);
+        connection->AbandonStreams();
+        delete connection;
+        active_connections_->Add(-1);
+      } else {
+        ++p;
+      }
+    }
+  }
+
+  // Shutting down: fail anything not yet started, then everything in
+  // flight.
+  for (int i = 0, n = to_start.size(); i < n; ++i) {
+    FinishStream(to_start[i], false);
+    delete to_start[i];
+  }
+  ConnectionMap connections;
+  connections.swap(connections_);
+  for (ConnectionMap::iterator p = connections.begin();
+       p != connections.end(); ++p) {
+    p->second->AbandonStreams();
+    delete p->second;
+    active_connections_->Add(-1);
+  }
+  for (int i = 0, n = retry_.size(); i < n; ++i) {
+    FinishStream(retry_[i], false);
+    delete retry_[i];
+  }
+  retry_.clear();
+}
+
+void Http2UrlAsyncFetcher::StartStream(Stream* stream) {
+  GoogleUrl gurl(stream->url());
+  if (!HandlesUrl(gurl)) {
+    stream->message_handler()->Message(
+        kError, "HTTP/2 fetcher given invalid URL %s", stream->url().c_str());
+    FinishStream(stream, false);
+    delete stream;
+    return;
+  }
+  stream->PrepareRequest(gurl);
+
+  GoogleString port = IntegerToString(gurl.EffectiveIntPort());
+  GoogleString origin = StrCat(gurl.Host(), ":", port);
+  int64 now_ms = timer_->NowMs();
+  Connection* connection = NULL;
+  ConnectionMap::iterator p = connections_.find(origin);
+  if ((p != connections_.end()) && p->second->accepting_streams()) {
+    connection = p->second;
+  } else {
+    connection = new Connection(this, gurl.Host().as_string(), port, now_ms);
+    connection_count_->Add(1);
+    if (!connection->Connect()) {
+      delete connection;
+      FinishStream(stream, false);
+      delete stream;
+      return;
+    }
+    if (p != connections_.end()) {
+      // Keep the old connection until its streams are done, under a key
+      // that will not be reused.
+      connections_[StrCat(origin, " ", IntegerToString(
+          reinterpret_cast<intptr_t>(p->second)))] = p->second;
+      p->second = connection;
+    } else {
+      connections_[origin] = connection;
+    }
+    active_connections_->Add(1);
+  }
+  connection->touch(now_ms);
+  if (!connection->Submit(stream)) {
+    stream->message_handler()->Message(
+        kWarning, "HTTP/2 fetcher could not submit %s", stream->url().c_str());
+    FinishStream(stream, false);
+    delete stream;
+  }
+}
+
+void Http2UrlAsyncFetcher::StreamInterrupted(Stream* stream) {
+  if (!stream->finished() && !stream->response_started() &&
+      !stream->retried()) {
+    stream->set_retried();
+    retry_.push_back(stream);
+    return;
+  }
+  if (!stream->finished()) {
+    stream->message_handler()->Message(
+        kWarning, "HTTP/2 fetch of %s failed: connection lost",
+        stream->url().c_str());
+    FinishStream(stream, false);
+  }
+  delete stream;
+}
+
+void Http2UrlAsyncFetcher::FinishStream(Stream* stream, bool success) {
+  if (stream->finished()) {
+    return;
+  }
+  if (!success) {
+    failure_count_->Add(1);
+  }
+  AsyncFetch* async_fetch = stream->async_fetch();
+  if (track_original_content_length_ &&
+      !async_fetch->response_headers()->Has(
+          HttpAttributes::kXOriginalContentLength)) {
+    async_fetch->extra_response_headers()->SetOriginalContentLength(
+        stream->bytes_received());
+  }
+  latency_us_histogram_->Add(timer_->NowUs() - stream->start_us());
+  stream->Done(success);
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,171 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Fetches http:// URLs over cleartext HTTP/2 with prior knowledge (h2c, RFC
+// 7540 section 3.4), using nghttp2.  Unlike SerfUrlAsyncFetcher, which opens
+// a connection per fetch, this keeps one connection per origin and
+// multiplexes every fetch to that origin over it as a separate stream, so a
+// page's worth of subresources costs one TCP handshake rather than dozens.
+//
+// As there is no negotiation, the origin must be known to speak HTTP/2;
+// SerfUrlAsyncFetcher only routes origins configured with
+// FetchHttp2PriorKnowledgeOrigins here.  HTTPS is not supported.
+//
+// This is only built, along with nghttp2, when gyp is run with
+// -Denable_http2_fetcher=1.
+
+#ifndef PAGESPEED_SYSTEM_HTTP2_URL_ASYNC_FETCHER_H_
+#define PAGESPEED_SYSTEM_HTTP2_URL_ASYNC_FETCHER_H_
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "net/instaweb/http/public/url_async_fetcher.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
+
+namespace net_instaweb {
+
+class AsyncFetch;
+class GoogleUrl;
+class Histogram;
+class MessageHandler;
+class Statistics;
+class Timer;
+class UpDownCounter;
+class Variable;
+
+class Http2UrlAsyncFetcher : public UrlAsyncFetcher {
+ public:
+  static const char kHttp2FetchRequestCount[];
+  static const char kHttp2FetchConnectionCount[];
+  static const char kHttp2FetchByteCount[];
+  static const char kHttp2FetchFailureCount[];
+  static const char kHttp2FetchTimeoutCount[];
+  static const char kHttp2FetchActiveConnections[];
+  static const char kHttp2FetchLatencyUsHistogram[];
+
+  Http2UrlAsyncFetcher(ThreadSystem* thread_system, Statistics* statistics,
+                       Timer* timer, int64 timeout_ms,
+                       MessageHandler* message_handler);
+  virtual ~Http2UrlAsyncFetcher();
+
+  static void InitStats(Statistics* statistics);
+
+  // Sets the origins, as a comma-separated list of host[:port], that are
+  // known to accept h2c; the port defaults to 80.  Each host must be an
+  // IPv4 or bracketed IPv6 literal, as connections are opened on the event
+  // thread, which must not wait on DNS.  Returns false, leaving the list
+  // unchanged, if spec is malformed.  Must be called before the first Fetch.
+  bool SetPriorKnowledgeOrigins(StringPiece spec);
+
+  // Checks the syntax of a SetPriorKnowledgeOrigins spec, for early
+  // reporting of configuration errors.
+  static bool ValidatePriorKnowledgeOrigins(StringPiece spec) {
+    std::set<GoogleString> origins;
+    return ParseOrigins(spec, &origins);
+  }
+
+  // Returns true if url is an http:// URL on one of the prior-knowledge
+  // origins.
+  bool HandlesUrl(const GoogleUrl& url) const;
+
+  void set_track_original_content_length(bool x) {
+    track_original_content_length_ = x;
+  }
+
+  virtual bool SupportsHttps() const { return false; }
+  virtual void Fetch(const GoogleString& url,
+                     MessageHandler* message_handler,
+                     AsyncFetch* async_fetch);
+  virtual int64 timeout_ms() { return timeout_ms_; }
+
+  // Fails any outstanding fetches, closes all connections, and makes
+  // further fetches fail immediately.
+  virtual void ShutDown();
+
+ private:
+  class Connection;
+  class EventThread;
+  class Stream;
+  typedef std::map<GoogleString, Connection*> ConnectionMap;
+
+  static bool ParseOrigins(StringPiece spec, std::set<GoogleString>* origins);
+
+  // Body of the event thread: starts queued streams, services connections
+  // and expires fetches until ShutDown.
+  void EventLoop();
+
+  // Hands a stream to its origin's connection, opening one if there is
+  // none or the existing one is going away.
+  void StartStream(Stream* stream);
+
+  // Completes a stream's fetch and deletes it.
+  void FinishStream(Stream* stream, bool success);
+
+  // Called by a connection that has failed or been closed by the peer, for
+  // each stream that had not finished.  Streams that had not yet seen any
+  // response are retried once on a new connection, as the server may just
+  // have closed an idle connection as we were reusing it.
+  void StreamInterrupted(Stream* stream);
+
+  void Wake();
+
+  ThreadSystem* thread_system_;
+  Timer* timer_;
+  MessageHandler* message_handler_;
+  const int64 timeout_ms_;
+  bool track_original_content_length_;
+
+  // host:port of each prior-knowledge origin.
+  std::set<GoogleString> origins_;
+
+  scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  std::vector<Stream*> pending_ GUARDED_BY(mutex_);
+  bool shutdown_ GUARDED_BY(mutex_);
+  scoped_ptr<EventThread> thread_ GUARDED_BY(mutex_);
+
+  // Written to wake the event thread from poll().
+  int wake_read_fd_;
+  int wake_write_fd_;
+
+  // Owned and used only by the event thread.
+  ConnectionMap connections_;
+  std::vector<Stream*> retry_;
+
+  Variable* request_count_;
+  Variable* connection_count_;
+  Variable* byte_count_;
+  Variable* failure_count_;
+  Variable* timeout_count_;
+  UpDownCounter* active_connections_;
+  Histogram* latency_us_histogram_;
+
+  DISALLOW_COPY_AND_ASSIGN(Http2UrlAsyncFetcher);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_SYSTEM_HTTP2_URL_ASYNC_FETCHER_H_
@@ -0,0 +1,580 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Unit tests for Http2UrlAsyncFetcher, run against an h2c server on a
+// loopback port.
+
+#include "pagespeed/system/http2_url_async_fetcher.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/request_context.h"
+#include "nghttp2/nghttp2.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mock_message_handler.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/time_util.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/http/google_url.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/request_headers.h"
+#include "pagespeed/kernel/http/response_headers.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int64 kFetcherTimeoutMs = 5 * Timer::kSecondMs;
+const int kBigResponseSize = 300 * 1000;
+
+// Minimal h2c server: answers /big with kBigResponseSize bytes, POSTs by
+// echoing the body, /hang never, and anything else with "hello <path>".
+class Http2TestServer : public ThreadSystem::Thread {
+ public:
+  explicit Http2TestServer(ThreadSystem* thread_system)
+      : Thread(thread_system, "h2_test_server", ThreadSystem::kJoinable),
+        mutex_(thread_system->NewMutex()),
+        connections_accepted_(0),
+        port_(0) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    CHECK_EQ(0, bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), len));
+    CHECK_EQ(0, listen(listen_fd_, 16));
+    CHECK_EQ(0, getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr),
+                            &len));
+    port_ = ntohs(addr.sin_port);
+    int fds[2];
+    CHECK_EQ(0, pipe(fds));
+    stop_read_fd_ = fds[0];
+    stop_write_fd_ = fds[1];
+  }
+
+  virtual ~Http2TestServer() {
+    char c = 0;
+    CHECK_EQ(1, write(stop_write_fd_, &c, 1));
+    Join();
+    close(listen_fd_);
+    close(stop_read_fd_);
+    close(stop_write_fd_);
+  }
+
+  int port() const { return port_; }
+
+  int connections_accepted() {
+    ScopedMutex lock(mutex_.get());
+    return connections_accepted_;
+  }
+
+ protected:
+  virtual void Run() {
+    std::vector<Session*> sessions;
+    for (;;) {
+      std::vector<struct pollfd> fds;
+      struct pollfd stop = {stop_read_fd_, POLLIN, 0};
+      struct pollfd listen = {listen_fd_, POLLIN, 0};
+      fds.push_back(stop);
+      fds.push_back(listen);
+      for (int i = 0, n = sessions.size(); i < n; ++i) {
+        struct pollfd fd = {sessions[i]->fd, POLLIN, 0};
+        fds.push_back(fd);
+      }
+      poll(&fds[0], fds.size(), -1);
+      if (fds[0].revents != 0) {
+        break;
+      }
+      if (fds[1].revents != 0) {
+        int fd = accept(listen_fd_, NULL, NULL);
+        if (fd >= 0) {
+          int one = 1;
+          setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+          ScopedMutex lock(mutex_.get());
+          ++connections_accepted_;
+          sessions.push_back(new Session(fd));
+        }
+      }
+      for (int i = 0, n = fds.size() - 2; i < n; ++i) {
+        if ((fds[i + 2].revents != 0) && !sessions[i]->Read()) {
+          delete sessions[i];
+          sessions[i] = NULL;
+        }
+      }
+      sessions.erase(std::remove(sessions.begin(), sessions.end(),
+                                 static_cast<Session*>(NULL)),
+                     sessions.end());
+    }
+    for (int i = 0, n = sessions.size(); i < n; ++i) {
+      delete sessions[i];
+    }
+  }
+
+ private:
+  struct Request {
+    Request() : offset(0) {}
+    GoogleString method;
+    GoogleString path;
+    GoogleString request_body;
+    GoogleString response_body;
+    size_t offset;
+  };
+
+  struct Session {
+    explicit Session(int fd_in) : fd(fd_in), session(NULL) {
+      nghttp2_session_callbacks* callbacks;
+      nghttp2_session_callbacks_new(&callbacks);
+      nghttp2_session_callbacks_set_send_callback(callbacks, Send);
+      nghttp2_session_callbacks_set_on_header_callback(callbacks, OnHeader);
+      nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks,
+                                                                OnData);
+      nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks,
+                                                           OnFrame);
+      nghttp2_session_callbacks_set_on_stream_close_callback(callbacks,
+                                                             OnClose);
+      nghttp2_session_server_new(&session, callbacks, this);
+      nghttp2_session_callbacks_del(callbacks);
+      nghttp2_settings_entry settings[] = {
+        {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 100},
+      };
+      nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, settings,
+                              arraysize(settings));
+      nghttp2_session_send(session);
+    }
+
+    ~Session() {
+      for (std::map<int32, Request*>::iterator p = requests.begin();
+           p != requests.end(); ++p) {
+        delete p->second;
+      }
+      nghttp2_session_del(session);
+      close(fd);
+    }
+
+    // Returns false when the connection should be dropped.
+    bool Read() {
+      char buf[16 * 1024];
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n <= 0) {
+        return false;
+      }
+      if (nghttp2_session_mem_recv(
+              session, reinterpret_cast<uint8_t*>(buf), n) < 0) {
+        return false;
+      }
+      return nghttp2_session_send(session) == 0;
+    }
+
+    Request* GetRequest(int32 stream_id) {
+      Request*& request = requests[stream_id];
+      if (request == NULL) {
+        request = new Request;
+      }
+      return request;
+    }
+
+    void Respond(int32 stream_id) {
+      Request* request = GetRequest(stream_id);
+      if (request->path == "/hang") {
+        return;
+      }
+      if (request->method == "POST") {
+        request->response_body = request->request_body;
+      } else if (request->path == "/big") {
+        request->response_body.assign(kBigResponseSize, 'x');
+      } else {
+        request->response_body = StrCat("hello ", request->path);
+      }
+      GoogleString length = IntegerToString(request->response_body.size());
+      GoogleString date;
+      ConvertTimeToString(time(NULL) * Timer::kSecondMs, &date);
+      nghttp2_nv headers[] = {
+        MakeNv(":status", "200"),
+        MakeNv("date", date),
+        MakeNv("content-type", "text/plain"),
+        MakeNv("cache-control", "max-age=300"),
+        MakeNv("content-length", length),
+      };
+      nghttp2_data_provider provider;
+      provider.source.ptr = request;
+      provider.read_callback = ReadBody;
+      nghttp2_submit_response(session, stream_id, headers,
+                              arraysize(headers), &provider);
+    }
+
+    static nghttp2_nv MakeNv(StringPiece name, StringPiece value) {
+      nghttp2_nv nv;
+      nv.name = reinterpret_cast<uint8_t*>(const_cast<char*>(name.data()));
+      nv.namelen = name.size();
+      nv.value = reinterpret_cast<uint8_t*>(const_cast<char*>(value.data()));
+      nv.valuelen = value.size();
+      nv.flags = NGHTTP2_NV_FLAG_NONE;
+      return nv;
+    }
+
+    static ssize_t ReadBody(nghttp2_session* session, int32_t stream_id,
+                            uint8_t* buf, size_t length, uint32_t* data_flags,
+                            nghttp2_data_source* source, void* user_data) {
+      Request* request = static_cast<Request*>(source->ptr);
+      size_t n = std::min(length,
+                          request->response_body.size() - request->offset);
+      memcpy(buf, request->response_body.data() + request->offset, n);
+      request->offset += n;
+      if (request->offset == request->response_body.size()) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+      }
+      return n;
+    }
+
+    static ssize_t Send(nghttp2_session* session, const uint8_t* data,
+                        size_t length, int flags, void* user_data) {
+      Session* self = static_cast<Session*>(user_data);
+      size_t written = 0;
+      while (written < length) {
+        ssize_t n = write(self->fd, data + written, length - written);
+        if (n <= 0) {
+          return NGHTTP2_ERR_CALLBACK_FAILURE;
+        }
+        written += n;
+      }
+      return length;
+    }
+
+    static int OnHeader(nghttp2_session* session, const nghttp2_frame* frame,
+                        const uint8_t* name, size_t namelen,
+                        const uint8_t* value, size_t valuelen, uint8_t flags,
+                        void* user_data) {
+      Session* self = static_cast<Session*>(user_data);
+      Request* request = self->GetRequest(frame->hd.stream_id);
+      StringPiece name_piece(reinterpret_cast<const char*>(name), namelen);
+      StringPiece value_piece(reinterpret_cast<const char*>(value), valuelen);
+      if (name_piece == ":path") {
+        request->path = value_piece.as_string();
+      } else if (name_piece == ":method") {
+        request->method = value_piece.as_string();
+      }
+      return 0;
+    }
+
+    static int OnData(nghttp2_session* session, uint8_t flags,
+                      int32_t stream_id, const uint8_t* data, size_t len,
+                      void* user_data) {
+      Session* self = static_cast<Session*>(user_data);
+      self->GetRequest(stream_id)->request_body.append(
+          reinterpret_cast<const char*>(data), len);
+      return 0;
+    }
+
+    static int OnFrame(nghttp2_session* session, const nghttp2_frame* frame,
+                       void* user_data) {
+      Session* self = static_cast<Session*>(user_data);
+      if (((frame->hd.type == NGHTTP2_HEADERS) ||
+           (frame->hd.type == NGHTTP2_DATA)) &&
+          ((frame->hd.flags & NGHTTP2_FLAG_END_STREAM) != 0)) {
+        self->Respond(frame->hd.stream_id);
+      }
+      return 0;
+    }
+
+    static int OnClose(nghttp2_session* session, int32_t stream_id,
+                       uint32_t error_code, void* user_data) {
+      Session* self = static_cast<Session*>(user_data);
+      std::map<int32, Request*>::iterator p = self->requests.find(stream_id);
+      if (p != self->requests.end()) {
+        delete p->second;
+        self->requests.erase(p);
+      }
+      return 0;
+    }
+
+    int fd;
+    nghttp2_session* session;
+    std::map<int32, Request*> requests;
+  };
+
+  scoped_ptr<AbstractMutex> mutex_;
+  int connections_accepted_ GUARDED_BY(mutex_);
+  int listen_fd_;
+  int stop_read_fd_;
+  int stop_write_fd_;
+  int port_;
+
+  DISALLOW_COPY_AND_ASSIGN(Http2TestServer);
+};
+
+class TestFetch : public StringAsyncFetch {
+ public:
+  TestFetch(const RequestContextPtr& ctx, ThreadSystem* thread_system)
+      : StringAsyncFetch(ctx),
+        mutex_(thread_system->NewMutex()),
+        done_(false) {
+  }
+
+  virtual void HandleDone(bool success) {
+    ScopedMutex lock(mutex_.get());
+    StringAsyncFetch::HandleDone(success);
+    done_ = true;
+  }
+
+  bool IsDone() {
+    ScopedMutex lock(mutex_.get());
+    return done_;
+  }
+
+ private:
+  scoped_ptr<AbstractMutex> mutex_;
+  bool done_;
+};
+
+class Http2UrlAsyncFetcherTest : public ::testing::Test {
+ protected:
+  Http2UrlAsyncFetcherTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(Platform::CreateTimer()),
+        message_handler_(new NullMutex),
+        statistics_(thread_system_.get()) {
+    Http2UrlAsyncFetcher::InitStats(&statistics_);
+  }
+
+  virtual void SetUp() {
+    server_.reset(new Http2TestServer(thread_system_.get()));
+    ASSERT_TRUE(server_->Start());
+    origin_ = StrCat("127.0.0.1:", IntegerToString(server_->port()));
+    fetcher_.reset(NewFetcher(kFetcherTimeoutMs));
+  }
+
+  virtual void TearDown() {
+    fetcher_.reset(NULL);
+    server_.reset(NULL);
+  }
+
+  Http2UrlAsyncFetcher* NewFetcher(int64 timeout_ms) {
+    Http2UrlAsyncFetcher* fetcher = new Http2UrlAsyncFetcher(
+        thread_system_.get(), &statistics_, timer_.get(), timeout_ms,
+        &message_handler_);
+    EXPECT_TRUE(fetcher->SetPriorKnowledgeOrigins(origin_));
+    return fetcher;
+  }
+
+  TestFetch* NewFetch() {
+    return new TestFetch(
+        RequestContext::NewTestRequestContext(thread_system_.get()),
+        thread_system_.get());
+  }
+
+  GoogleString Url(StringPiece path) {
+    return StrCat("http://", origin_, path);
+  }
+
+  // Starts a fetch of path; the caller owns the returned fetch.
+  TestFetch* StartFetch(StringPiece path) {
+    TestFetch* fetch = NewFetch();
+    fetcher_->Fetch(Url(path), &message_handler_, fetch);
+    return fetch;
+  }
+
+  void WaitForFetch(TestFetch* fetch) {
+    int64 deadline_ms = timer_->NowMs() + 2 * kFetcherTimeoutMs;
+    while (!fetch->IsDone() && (timer_->NowMs() < deadline_ms)) {
+      timer_->SleepMs(5);
+    }
+    ASSERT_TRUE(fetch->IsDone());
+  }
+
+  int64 Stat(const char* name) {
+    return statistics_.GetVariable(name)->Get();
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  scoped_ptr<Timer> timer_;
+  MockMessageHandler message_handler_;
+  SimpleStats statistics_;
+  scoped_ptr<Http2TestServer> server_;
+  scoped_ptr<Http2UrlAsyncFetcher> fetcher_;
+  GoogleString origin_;
+};
+
+TEST_F(Http2UrlAsyncFetcherTest, PriorKnowledgeOrigins) {
+  EXPECT_TRUE(fetcher_->SetPriorKnowledgeOrigins(
+      "10.0.0.2, 10.0.0.1:8080, [::1]:8081"));
+  EXPECT_TRUE(fetcher_->HandlesUrl(GoogleUrl("http://10.0.0.2/a")));
+  EXPECT_TRUE(fetcher_->HandlesUrl(GoogleUrl("http://10.0.0.2:80/a")));
+  EXPECT_TRUE(fetcher_->HandlesUrl(GoogleUrl("http://10.0.0.1:8080/a.css")));
+  EXPECT_TRUE(fetcher_->HandlesUrl(GoogleUrl("http://[::1]:8081/a")));
+  EXPECT_FALSE(fetcher_->HandlesUrl(GoogleUrl("https://10.0.0.2/a")));
+  EXPECT_FALSE(fetcher_->HandlesUrl(GoogleUrl("http://10.0.0.2:8080/a")));
+  EXPECT_FALSE(fetcher_->HandlesUrl(GoogleUrl("http://10.0.0.1/a")));
+  EXPECT_FALSE(fetcher_->HandlesUrl(GoogleUrl("http://10.0.0.3/")));
+
+  // Malformed lists are rejected without changing the origins.
+  EXPECT_FALSE(fetcher_->SetPriorKnowledgeOrigins("10.0.0.3, http://b.com/"));
+  EXPECT_FALSE(fetcher_->SetPriorKnowledgeOrigins("10.0.0.3:port"));
+  EXPECT_TRUE(fetcher_->HandlesUrl(GoogleUrl("http://10.0.0.2/a")));
+
+  // Host names would need a DNS lookup on the event thread.
+  EXPECT_FALSE(fetcher_->SetPriorKnowledgeOrigins("backend.example.com"));
+  EXPECT_FALSE(Http2UrlAsyncFetcher::ValidatePriorKnowledgeOrigins(
+      "10.0.0.3, localhost:8080"));
+  EXPECT_TRUE(fetcher_->HandlesUrl(GoogleUrl("http://10.0.0.2/a")));
+
+  EXPECT_TRUE(fetcher_->SetPriorKnowledgeOrigins(""));
+  EXPECT_FALSE(fetcher_->HandlesUrl(GoogleUrl("http://10.0.0.2/")));
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, SimpleFetch) {
+  scoped_ptr<TestFetch> fetch(StartFetch("/index.html"));
+  WaitForFetch(fetch.get());
+  EXPECT_TRUE(fetch->success());
+  EXPECT_EQ("hello /index.html", fetch->buffer());
+  ResponseHeaders* headers = fetch->response_headers();
+  EXPECT_EQ(HttpStatus::kOK, headers->status_code());
+  EXPECT_STREQ("text/plain", headers->Lookup1(HttpAttributes::kContentType));
+  EXPECT_TRUE(headers->IsProxyCacheable());
+  EXPECT_EQ(300 * Timer::kSecondMs, headers->cache_ttl_ms());
+  EXPECT_EQ(1, Stat(Http2UrlAsyncFetcher::kHttp2FetchRequestCount));
+  EXPECT_EQ(1, Stat(Http2UrlAsyncFetcher::kHttp2FetchConnectionCount));
+  EXPECT_EQ(0, Stat(Http2UrlAsyncFetcher::kHttp2FetchFailureCount));
+  EXPECT_EQ(17, Stat(Http2UrlAsyncFetcher::kHttp2FetchByteCount));
+  EXPECT_EQ(1, statistics_.GetHistogram(
+      Http2UrlAsyncFetcher::kHttp2FetchLatencyUsHistogram)->Count());
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, ConcurrentFetchesShareOneConnection) {
+  const int kNumFetches = 50;
+  std::vector<TestFetch*> fetches;
+  for (int i = 0; i < kNumFetches; ++i) {
+    fetches.push_back(StartFetch(StrCat("/", IntegerToString(i))));
+  }
+  for (int i = 0; i < kNumFetches; ++i) {
+    WaitForFetch(fetches[i]);
+    EXPECT_TRUE(fetches[i]->success());
+    EXPECT_EQ(StrCat("hello /", IntegerToString(i)), fetches[i]->buffer());
+    delete fetches[i];
+  }
+  EXPECT_EQ(1, server_->connections_accepted());
+  EXPECT_EQ(kNumFetches, Stat(Http2UrlAsyncFetcher::kHttp2FetchRequestCount));
+  EXPECT_EQ(1, Stat(Http2UrlAsyncFetcher::kHttp2FetchConnectionCount));
+  EXPECT_EQ(1, statistics_.GetUpDownCounter(
+      Http2UrlAsyncFetcher::kHttp2FetchActiveConnections)->Get());
+  EXPECT_EQ(kNumFetches, statistics_.GetHistogram(
+      Http2UrlAsyncFetcher::kHttp2FetchLatencyUsHistogram)->Count());
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, SequentialFetchesReuseConnection) {
+  for (int i = 0; i < 5; ++i) {
+    scoped_ptr<TestFetch> fetch(StartFetch("/a.css"));
+    WaitForFetch(fetch.get());
+    EXPECT_TRUE(fetch->success());
+  }
+  EXPECT_EQ(1, server_->connections_accepted());
+  EXPECT_EQ(1, Stat(Http2UrlAsyncFetcher::kHttp2FetchConnectionCount));
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, LargeResponse) {
+  // Bigger than the default flow-control windows.
+  scoped_ptr<TestFetch> fetch(StartFetch("/big"));
+  WaitForFetch(fetch.get());
+  EXPECT_TRUE(fetch->success());
+  EXPECT_EQ(static_cast<size_t>(kBigResponseSize), fetch->buffer().size());
+  EXPECT_EQ(kBigResponseSize,
+            Stat(Http2UrlAsyncFetcher::kHttp2FetchByteCount));
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, Post) {
+  scoped_ptr<TestFetch> fetch(NewFetch());
+  fetch->request_headers()->set_method(RequestHeaders::kPost);
+  fetch->request_headers()->set_message_body("a=1&b=2");
+  fetcher_->Fetch(Url("/form"), &message_handler_, fetch.get());
+  WaitForFetch(fetch.get());
+  EXPECT_TRUE(fetch->success());
+  EXPECT_EQ("a=1&b=2", fetch->buffer());
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, TrackOriginalContentLength) {
+  fetcher_->set_track_original_content_length(true);
+  scoped_ptr<TestFetch> fetch(StartFetch("/x"));
+  WaitForFetch(fetch.get());
+  EXPECT_TRUE(fetch->success());
+  EXPECT_STREQ("8", fetch->response_headers()->Lookup1(
+      HttpAttributes::kXOriginalContentLength));
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, Timeout) {
+  fetcher_.reset(NewFetcher(200 /* timeout_ms */));
+  scoped_ptr<TestFetch> hang(StartFetch("/hang"));
+  scoped_ptr<TestFetch> ok(StartFetch("/ok"));
+  WaitForFetch(hang.get());
+  WaitForFetch(ok.get());
+  EXPECT_FALSE(hang->success());
+  EXPECT_TRUE(ok->success());
+  EXPECT_EQ(1, Stat(Http2UrlAsyncFetcher::kHttp2FetchTimeoutCount));
+  EXPECT_EQ(1, Stat(Http2UrlAsyncFetcher::kHttp2FetchFailureCount));
+
+  // The connection survives the cancelled stream.
+  scoped_ptr<TestFetch> again(StartFetch("/again"));
+  WaitForFetch(again.get());
+  EXPECT_TRUE(again->success());
+  EXPECT_EQ(1, server_->connections_accepted());
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, ConnectionRefused) {
+  server_.reset(NULL);  // Nothing listening on the port any more.
+  scoped_ptr<TestFetch> fetch(StartFetch("/a"));
+  WaitForFetch(fetch.get());
+  EXPECT_FALSE(fetch->success());
+  EXPECT_EQ(1, Stat(Http2UrlAsyncFetcher::kHttp2FetchFailureCount));
+}
+
+TEST_F(Http2UrlAsyncFetcherTest, ShutDownFailsOutstandingFetches) {
+  scoped_ptr<TestFetch> hang(StartFetch("/hang"));
+  timer_->SleepMs(100);
+  EXPECT_FALSE(hang->IsDone());
+  fetcher_->ShutDown();
+  EXPECT_TRUE(hang->IsDone());
+  EXPECT_FALSE(hang->success());
+
+  scoped_ptr<TestFetch> after(StartFetch("/a"));
+  EXPECT_TRUE(after->IsDone());
+  EXPECT_FALSE(after->success());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
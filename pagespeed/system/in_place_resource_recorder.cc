@@ -44,6 +44,8 @@ const char kNumNotCacheable[] = "ipro_recorder_not_cacheable";
 const char kNumFailed[] = "ipro_recorder_failed";
 const char kNumDroppedDueToLoad[] = "ipro_recorder_dropped_due_to_load";
 const char kNumDroppedDueToSize[] = "ipro_recorder_dropped_due_to_size";
+const char kBufferedBytes[] = "ipro_recorder_buffered_bytes";
+const char kPeakBufferedBytes[] = "ipro_recorder_peak_buffered_bytes";
 
 }
 
@@ -70,6 +72,9 @@ InPlaceResourceRecorder::InPlaceResourceRecorder(
       num_failed_(stats->GetVariable(kNumFailed)),
       num_dropped_due_to_load_(stats->GetVariable(kNumDroppedDueToLoad)),
       num_dropped_due_to_size_(stats->GetVariable(kNumDroppedDueToSize)),
+      buffered_bytes_(stats->GetUpDownCounter(kBufferedBytes)),
+      peak_buffered_bytes_(stats->GetUpDownCounter(kPeakBufferedBytes)),
+      accounted_bytes_(0),
       status_code_(-1),
       failure_(false),
       full_response_headers_considered_(false),
@@ -97,6 +102,7 @@ InPlaceResourceRecorder::InPlaceResourceRecorder(
 }
 
 InPlaceResourceRecorder::~InPlaceResourceRecorder() {
+  ReleaseBuffer();
   if (limit_active_recordings()) {
     active_recordings_.BarrierIncrement(-1);
   }
@@ -109,12 +115,34 @@ void InPlaceResourceRecorder::InitStats(Statistics* statistics) {
   statistics->AddVariable(kNumFailed);
   statistics->AddVariable(kNumDroppedDueToLoad);
   statistics->AddVariable(kNumDroppedDueToSize);
+  statistics->AddUpDownCounter(kBufferedBytes);
+  statistics->AddUpDownCounter(kPeakBufferedBytes);
+}
+
+void InPlaceResourceRecorder::AccountForBuffer() {
+  int64 size = resource_value_.size();
+  int64 total = buffered_bytes_->Add(size - accounted_bytes_);
+  accounted_bytes_ = size;
+  // Concurrent recorders may race here, which can only lose a peak that
+  // another recorder is about to exceed.  That's fine for a statistic.
+  if (total > peak_buffered_bytes_->Get()) {
+    peak_buffered_bytes_->Set(total);
+  }
+}
+
+void InPlaceResourceRecorder::ReleaseBuffer() {
+  resource_value_.Clear();
+  if (accounted_bytes_ != 0) {
+    buffered_bytes_->Add(-accounted_bytes_);
+    accounted_bytes_ = 0;
+  }
 }
 
 bool InPlaceResourceRecorder::Write(const StringPiece& contents,
                                     MessageHandler* handler) {
   DCHECK(consider_response_headers_called_);
   if (failure_) {
+    ReleaseBuffer();
     return false;
   }
 
@@ -122,9 +150,15 @@ bool InPlaceResourceRecorder::Write(const StringPiece& contents,
   failure_ = !inflating_fetch_.Write(contents, handler_);
   if (max_response_bytes_ <= 0 ||
       resource_value_.contents_size() < max_response_bytes_) {
+    if (failure_) {
+      ReleaseBuffer();
+    } else {
+      AccountForBuffer();
+    }
     return !failure_;
   } else {
     DroppedDueToSize();
+    ReleaseBuffer();
     VLOG(1) << "IPRO: MaxResponseBytes exceeded while recording " << url_;
     return false;
   }
@@ -144,6 +178,18 @@ void InPlaceResourceRecorder::ConsiderResponseHeaders(
     inflating_fetch_.response_headers()->CopyFrom(*response_headers);
     write_to_resource_value_.response_headers()->set_status_code(
         HttpStatus::kOK);
+
+    // If we know how much uncompressed content to expect, allocate it now
+    // so the buffer isn't repeatedly reallocated, and transiently doubled,
+    // as it grows.
+    int64 expected_length;
+    if (!response_headers->Has(HttpAttributes::kContentEncoding) &&
+        response_headers->FindContentLength(&expected_length) &&
+        (expected_length > 0) &&
+        ((max_response_bytes_ <= 0) ||
+         (expected_length < max_response_bytes_))) {
+      resource_value_.ReserveContents(expected_length);
+    }
   }
 
   status_code_ = response_headers->status_code();
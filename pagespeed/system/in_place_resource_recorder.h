@@ -39,11 +39,19 @@ namespace net_instaweb {
 class HTTPCache;
 class MessageHandler;
 class Statistics;
+class UpDownCounter;
 class Variable;
 
 // Records a copy of a resource streamed through it and saves the result to
 // the cache if it's cacheable. Used in the In-Place Resource Optimization
 // (IPRO) flow to get resources into the cache.
+//
+// The cache stores each resource as a single value, so the contents are
+// accumulated in memory until DoneAndSetHeaders.  To bound that, the buffer
+// is sized up front when the Content-Length is known, and released as soon
+// as the recording fails rather than when the response completes.  The
+// bytes held by all recorders in the process, and the peak of that, are
+// exported as statistics.
 class InPlaceResourceRecorder : public Writer {
  public:
   enum HeadersKind {
@@ -159,6 +167,11 @@ class InPlaceResourceRecorder : public Writer {
   void DroppedDueToSize();
   void DroppedAsUncacheable();
 
+  // Updates the buffered-bytes statistics after resource_value_ grows.
+  void AccountForBuffer();
+  // Frees the recorded contents, which will not be written to cache.
+  void ReleaseBuffer();
+
   const GoogleString url_;
   const GoogleString fragment_;
   const RequestHeaders::Properties request_properties_;
@@ -180,6 +193,11 @@ class InPlaceResourceRecorder : public Writer {
   Variable* num_failed_;
   Variable* num_dropped_due_to_load_;
   Variable* num_dropped_due_to_size_;
+  UpDownCounter* buffered_bytes_;
+  UpDownCounter* peak_buffered_bytes_;
+
+  // Bytes of resource_value_ last added to buffered_bytes_.
+  int64 accounted_bytes_;
 
   // Track how many simultaneous recordings are underway in this process.  Not
   // used when max_concurrent_recordings_ == 0 (unlimited).
@@ -30,6 +30,7 @@
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/http/content_type.h"
 #include "pagespeed/kernel/http/http_names.h"
@@ -221,6 +222,76 @@ TEST_F(InPlaceResourceRecorderTest, IncompleteResponse) {
             HttpBlockingFind(kTestUrl, http_cache(), &value_out, &headers_out));
 }
 
+TEST_F(InPlaceResourceRecorderTest, BufferedBytesStatistics) {
+  ResponseHeaders prelim_headers;
+  prelim_headers.set_status_code(HttpStatus::kOK);
+  prelim_headers.SetContentLength(STATIC_STRLEN(kHello) + STATIC_STRLEN(kBye));
+
+  ResponseHeaders ok_headers;
+  SetDefaultLongCacheHeaders(&kContentTypeCss, &ok_headers);
+
+  UpDownCounter* buffered =
+      statistics()->GetUpDownCounter("ipro_recorder_buffered_bytes");
+  UpDownCounter* peak =
+      statistics()->GetUpDownCounter("ipro_recorder_peak_buffered_bytes");
+  scoped_ptr<InPlaceResourceRecorder> recorder(MakeRecorder(kTestUrl));
+  recorder->ConsiderResponseHeaders(
+      InPlaceResourceRecorder::kPreliminaryHeaders, &prelim_headers);
+  recorder->Write(kHello, message_handler());
+  int64 after_hello = buffered->Get();
+  EXPECT_LT(0, after_hello);
+  recorder->Write(kBye, message_handler());
+  int64 after_bye = buffered->Get();
+  EXPECT_EQ(after_hello + STATIC_STRLEN(kBye), after_bye);
+  EXPECT_EQ(after_bye, peak->Get());
+  recorder.release()->DoneAndSetHeaders(
+      &ok_headers, true /* complete response */);
+
+  // Once the resource is in the cache the recorder holds nothing, but the
+  // peak is retained.
+  EXPECT_EQ(0, buffered->Get());
+  EXPECT_EQ(after_bye, peak->Get());
+  HTTPValue value_out;
+  ResponseHeaders headers_out;
+  EXPECT_EQ(kFoundResult,
+            HttpBlockingFind(kTestUrl, http_cache(), &value_out, &headers_out));
+}
+
+TEST_F(InPlaceResourceRecorderTest, ReleaseBufferWhenTooBig) {
+  ResponseHeaders prelim_headers;
+  prelim_headers.set_status_code(HttpStatus::kOK);
+
+  ResponseHeaders ok_headers;
+  SetDefaultLongCacheHeaders(&kContentTypeCss, &ok_headers);
+
+  UpDownCounter* buffered =
+      statistics()->GetUpDownCounter("ipro_recorder_buffered_bytes");
+  scoped_ptr<InPlaceResourceRecorder> recorder(MakeRecorder(kTestUrl));
+  recorder->ConsiderResponseHeaders(
+      InPlaceResourceRecorder::kPreliminaryHeaders, &prelim_headers);
+  EXPECT_TRUE(recorder->Write(kHello, message_handler()));
+  EXPECT_LT(0, buffered->Get());
+
+  // Crossing the limit drops the recording and frees what was buffered
+  // immediately, without waiting for the end of the response.
+  GoogleString big(kMaxResponseBytes, 'x');
+  EXPECT_FALSE(recorder->Write(big, message_handler()));
+  EXPECT_TRUE(recorder->failed());
+  EXPECT_EQ(0, buffered->Get());
+  EXPECT_FALSE(recorder->Write(kBye, message_handler()));
+  EXPECT_EQ(0, buffered->Get());
+  EXPECT_EQ(1, statistics()->GetVariable(
+      "ipro_recorder_dropped_due_to_size")->Get());
+  recorder.release()->DoneAndSetHeaders(
+      &ok_headers, true /* complete response */);
+
+  HTTPValue value_out;
+  ResponseHeaders headers_out;
+  EXPECT_EQ(HTTPCache::FindResult(HTTPCache::kRecentFailure,
+                                  kFetchStatusUncacheable200),
+            HttpBlockingFind(kTestUrl, http_cache(), &value_out, &headers_out));
+}
+
 TEST_F(InPlaceResourceRecorderTest, CheckCacheableContentTypes) {
   CheckCacheableContentType(&kContentTypeJpeg);
   CheckCacheableContentType(&kContentTypeCss);
@@ -58,6 +58,13 @@ LoopbackRouteFetcher::~LoopbackRouteFetcher() {
 void LoopbackRouteFetcher::Fetch(const GoogleString& original_url,
                                  MessageHandler* message_handler,
                                  AsyncFetch* fetch) {
+  FetchOnSequence(original_url, message_handler, fetch, NULL);
+}
+
+void LoopbackRouteFetcher::FetchOnSequence(const GoogleString& original_url,
+                                           MessageHandler* message_handler,
+                                           AsyncFetch* fetch,
+                                           Sequence* response_sequence) {
   GoogleString url = original_url;
   GoogleUrl parsed_url(original_url);
 
@@ -111,7 +118,8 @@ void LoopbackRouteFetcher::Fetch(const GoogleString& original_url,
     // keep the host: header matching what's in the request_headers.
   }
 
-  backend_fetcher_->Fetch(url, message_handler, fetch);
+  backend_fetcher_->FetchOnSequence(url, message_handler, fetch,
+                                    response_sequence);
 }
 
 bool LoopbackRouteFetcher::IsLoopbackAddr(const apr_sockaddr_t* addr) {
@@ -35,6 +35,7 @@ namespace net_instaweb {
 class AsyncFetch;
 class RewriteOptions;
 class MessageHandler;
+class Sequence;
 
 // See file comment.
 class LoopbackRouteFetcher : public UrlAsyncFetcher {
@@ -59,6 +60,10 @@ class LoopbackRouteFetcher : public UrlAsyncFetcher {
   virtual void Fetch(const GoogleString& url,
                      MessageHandler* message_handler,
                      AsyncFetch* fetch);
+  virtual void FetchOnSequence(const GoogleString& url,
+                               MessageHandler* message_handler,
+                               AsyncFetch* fetch,
+                               Sequence* response_sequence);
 
   // Returns true if the given address is an IPv4 or IPv6 loopback.
   static bool IsLoopbackAddr(const apr_sockaddr_t* addr);
@@ -25,12 +25,15 @@
 
 #include "pagespeed/system/serf_url_async_fetcher.h"
 
+#include <algorithm>
 #include <cstddef>
+#include <deque>
 #include <list>
 #include <vector>
 
 #include "apr.h"
 #include "apr_network_io.h"
+#include "apr_poll.h"
 #include "apr_strings.h"
 #include "apr_pools.h"
 #include "apr_thread_proc.h"
@@ -40,12 +43,17 @@
 #include "net/instaweb/public/version.h"
 #include "strings/stringpiece_utils.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_bool.h"
+#include "pagespeed/kernel/base/atomic_int32.h"
+#include "pagespeed/kernel/base/atomicops.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/pool.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
@@ -53,8 +61,13 @@
 #include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/request_headers.h"
 #include "pagespeed/kernel/http/response_headers.h"
+#include "pagespeed/kernel/thread/sequence.h"
 #include "pagespeed/system/apr_thread_compatible_pool.h"
 
+#ifdef PAGESPEED_ENABLE_HTTP2_FETCHER
+#include "pagespeed/system/http2_url_async_fetcher.h"
+#endif
+
 // This is an easy way to turn on lots of debug messages. Note that this
 // is somewhat verbose.
 #define SERF_DEBUG(x)
@@ -108,6 +121,11 @@ const char SerfStats::kSerfFetchTimeoutCount[] = "serf_fetch_timeout_count";
 const char SerfStats::kSerfFetchFailureCount[] = "serf_fetch_failure_count";
 const char SerfStats::kSerfFetchCertErrors[] = "serf_fetch_cert_errors";
 const char SerfStats::kSerfFetchReadCalls[] = "serf_fetch_num_calls_to_read";
+const char SerfStats::kSerfFetchConnectionCount[] =
+    "serf_fetch_connection_count";
+const char SerfStats::kSerfFetchConnectionReuseCount[] =
+    "serf_fetch_connection_reuse_count";
+const char SerfStats::kSerfFetchLatencyUsHistogram[] = "serf_fetch_latency_us";
 const char SerfStats::kSerfFetchUltimateSuccess[] =
     "serf_fetch_ultimate_success";
 const char SerfStats::kSerfFetchUltimateFailure[] =
@@ -121,6 +139,244 @@ GoogleString GetAprErrorString(apr_status_t status) {
   return error_str;
 }
 
+// A serf connection to one origin.  Without keep-alive pooling each SerfFetch
+// opens and owns one of these.  With pooling they are owned by the
+// SerfUrlAsyncFetcher and shared by the fetches to their origin, which queue
+// up on the connection: serf sends each request once the response to the
+// previous one is complete, so fetches_.front() is the one being served.
+class SerfConnection {
+ public:
+  SerfConnection(SerfUrlAsyncFetcher* fetcher, const GoogleString& key)
+      : fetcher_(fetcher),
+        key_(key),
+        pool_(NULL),
+        bucket_alloc_(NULL),
+        sni_host_(NULL),
+        using_https_(false),
+        connection_(NULL),
+        ssl_context_(NULL),
+        last_used_ms_(0),
+        closed_(false),
+        broken_(false) {
+    memset(&url_, 0, sizeof(url_));
+    apr_pool_create(&pool_, fetcher_->pool());
+    bucket_alloc_ = serf_bucket_allocator_create(pool_, NULL, NULL);
+  }
+
+  ~SerfConnection() {
+    DCHECK(fetches_.empty());
+    if (connection_ != NULL) {
+      // Drops any requests still queued, without calling their handlers.
+      serf_connection_close(connection_);
+    }
+    apr_pool_destroy(pool_);
+  }
+
+  // Creates the serf connection to the origin of fetch's URL; serf connects
+  // when it next runs with a request queued.
+  bool Open(serf_context_t* serf_context, SerfFetch* fetch) {
+    // Parse our own copy of the URL: serf retains pointers into it.
+    apr_status_t status = apr_uri_parse(pool_, fetch->str_url_.c_str(), &url_);
+    if (status != APR_SUCCESS) {
+      return false;
+    }
+    url_.port = fetch->url_.port;
+    using_https_ = StringCaseEqual("https", url_.scheme);
+    if (fetch->sni_host_ != NULL) {
+      sni_host_ = apr_pstrdup(pool_, fetch->sni_host_);
+    }
+    status = serf_connection_create2(&connection_, serf_context, url_,
+                                     ConnectionSetup, this,
+                                     ClosedConnection, this,
+                                     pool_);
+    if (status != APR_SUCCESS) {
+      fetch->message_handler()->Error(
+          fetch->DebugInfo().c_str(), 0,
+          "Error status=%d (%s) serf_connection_create2",
+          status, GetAprErrorString(status).c_str());
+      connection_ = NULL;
+      return false;
+    }
+    // No pipelining: a request is written only once the previous response
+    // has been read, so a slow response delays just the fetches queued
+    // behind it on this connection.
+    serf_connection_set_max_outstanding_requests(connection_, 1);
+    fetcher_->connection_count_->Add(1);
+    return true;
+  }
+
+  void Enqueue(SerfFetch* fetch) {
+    fetches_.push_back(fetch);
+    serf_connection_request_create(connection_, SerfFetch::SetupRequest,
+                                   fetch);
+  }
+
+  // Removes fetch from the queue.  Its request must be complete, or about to
+  // be dropped by closing the connection.
+  void Remove(SerfFetch* fetch) {
+    std::deque<SerfFetch*>::iterator p =
+        std::find(fetches_.begin(), fetches_.end(), fetch);
+    if (p != fetches_.end()) {
+      fetches_.erase(p);
+    }
+  }
+
+  // Empties the queue into *fetches, which no longer refer to us.
+  void DetachFetches(std::vector<SerfFetch*>* fetches) {
+    for (int i = 0, n = fetches_.size(); i < n; ++i) {
+      fetches_[i]->connection_ = NULL;
+      fetches->push_back(fetches_[i]);
+    }
+    fetches_.clear();
+  }
+
+  // Whether new fetches may be queued here: neither end has closed or
+  // broken the connection since it was opened.  Must not be called from
+  // within serf callbacks.
+  bool IsHealthy() const {
+    return !broken_ && !closed_ && !InErrorState();
+  }
+
+  bool InErrorState() const {
+    return serf_connection_is_in_error_state(connection_);
+  }
+
+  const GoogleString& key() const { return key_; }
+  bool idle() const { return fetches_.empty(); }
+  int queue_size() const { return fetches_.size(); }
+  int64 last_used_ms() const { return last_used_ms_; }
+  void set_last_used_ms(int64 x) { last_used_ms_ = x; }
+  bool broken() const { return broken_; }
+  // Marks the connection for retirement by the fetcher, which happens
+  // outside the serf callback that found it broken.
+  void set_broken() { broken_ = true; }
+
+ private:
+  // The code under SERF_HTTPS_FETCHING was contributed by Devin Anderson
+  // (surfacepatterns@gmail.com).
+  //
+  // Note this must be ifdef'd because calling serf_bucket_ssl_decrypt_create
+  // requires ssl_buckets.c in the link.  ssl_buckets.c requires openssl.
+#if SERF_HTTPS_FETCHING
+  static apr_status_t SSLCertValidate(void *data, int failures,
+                                      const serf_ssl_certificate_t *cert) {
+    SerfFetch* fetch = static_cast<SerfConnection*>(data)->current_fetch();
+    if (fetch == NULL) {
+      return APR_SUCCESS;
+    }
+    return fetch->HandleSSLCertValidation(failures, 0, cert);
+  }
+
+  static apr_status_t SSLCertChainValidate(
+      void *data, int failures, int error_depth,
+      const serf_ssl_certificate_t * const *certs,
+      apr_size_t certs_count) {
+    SerfFetch* fetch = static_cast<SerfConnection*>(data)->current_fetch();
+    if (fetch == NULL) {
+      return APR_SUCCESS;
+    }
+    return fetch->HandleSSLCertValidation(failures, error_depth, NULL);
+  }
+#endif
+
+  static apr_status_t ConnectionSetup(
+      apr_socket_t* socket, serf_bucket_t **read_bkt, serf_bucket_t **write_bkt,
+      void* setup_baton, apr_pool_t* pool) {
+    SerfConnection* connection = static_cast<SerfConnection*>(setup_baton);
+    return connection->SetupStreams(socket, read_bkt, write_bkt);
+  }
+
+  static void ClosedConnection(serf_connection_t* conn,
+                               void* closed_baton,
+                               apr_status_t why,
+                               apr_pool_t* pool) {
+    SerfConnection* connection = static_cast<SerfConnection*>(closed_baton);
+    SerfFetch* fetch = connection->current_fetch();
+    if ((why != APR_SUCCESS) && (fetch != NULL)) {
+      fetch->message_handler()->Warning(
+          fetch->DebugInfo().c_str(), 0, "Connection close (code=%d %s).",
+          why, GetAprErrorString(why).c_str());
+    }
+    // Serf reconnects for any requests still queued, but we stop handing
+    // out a connection once its socket has been closed.
+    connection->closed_ = true;
+  }
+
+  SerfFetch* current_fetch() const {
+    return fetches_.empty() ? NULL : fetches_.front();
+  }
+
+  apr_status_t SetupStreams(apr_socket_t* socket, serf_bucket_t** read_bkt,
+                            serf_bucket_t** write_bkt) {
+    *read_bkt = serf_bucket_socket_create(socket, bucket_alloc_);
+#if SERF_HTTPS_FETCHING
+    apr_status_t status = APR_SUCCESS;
+    if (using_https_) {
+      *read_bkt = serf_bucket_ssl_decrypt_create(*read_bkt, ssl_context_,
+                                                 bucket_alloc_);
+      if (ssl_context_ == NULL) {
+        ssl_context_ = serf_bucket_ssl_decrypt_context_get(*read_bkt);
+        if (ssl_context_ == NULL) {
+          status = APR_EGENERAL;
+        } else {
+          const GoogleString& certs_dir = fetcher_->ssl_certificates_dir();
+          const GoogleString& certs_file = fetcher_->ssl_certificates_file();
+
+          if (!certs_file.empty()) {
+            status = serf_ssl_set_certificates_file(
+                ssl_context_, certs_file.c_str());
+          }
+          if ((status == APR_SUCCESS) && !certs_dir.empty()) {
+            status = serf_ssl_set_certificates_directory(ssl_context_,
+                                                         certs_dir.c_str());
+          }
+
+          // If no explicit file or directory is specified, then use the
+          // compiled-in default.
+          if (certs_dir.empty() && certs_file.empty()) {
+            status = serf_ssl_use_default_certificates(ssl_context_);
+          }
+        }
+        if (status != APR_SUCCESS) {
+          return status;
+        }
+      }
+
+      serf_ssl_server_cert_callback_set(ssl_context_, SSLCertValidate, this);
+
+      serf_ssl_server_cert_chain_callback_set(
+          ssl_context_, SSLCertValidate, SSLCertChainValidate, this);
+
+      status = serf_ssl_set_hostname(ssl_context_, sni_host_);
+      if (status != APR_SUCCESS) {
+        LOG(INFO) << "Unable to set hostname from serf fetcher. Connection "
+                     "setup failed";
+        return status;
+      }
+      *write_bkt = serf_bucket_ssl_encrypt_create(*write_bkt, ssl_context_,
+                                                  bucket_alloc_);
+    }
+#endif
+    return APR_SUCCESS;
+  }
+
+  SerfUrlAsyncFetcher* fetcher_;
+  const GoogleString key_;
+  apr_pool_t* pool_;
+  serf_bucket_alloc_t* bucket_alloc_;
+  apr_uri_t url_;
+  const char* sni_host_;  // in pool_
+  bool using_https_;
+  serf_connection_t* connection_;
+  serf_ssl_context_t* ssl_context_;
+  std::deque<SerfFetch*> fetches_;
+  int64 last_used_ms_;
+  bool closed_;
+  bool broken_;
+
+  DISALLOW_COPY_AND_ASSIGN(SerfConnection);
+};
+
 SerfFetch::SerfFetch(const GoogleString& url,
                      AsyncFetch* async_fetch,
                      MessageHandler* message_handler,
@@ -133,23 +389,25 @@ SerfFetch::SerfFetch(const GoogleString& url,
       status_line_read_(false),
       message_handler_(message_handler),
       pool_(NULL),  // filled in once assigned to a thread, to use its pool.
-      bucket_alloc_(NULL),
       host_header_(NULL),
       sni_host_(NULL),
       connection_(NULL),
+      pooled_connection_(false),
+      moved_connection_(false),
       bytes_received_(0),
       fetch_start_ms_(0),
       fetch_end_ms_(0),
-      using_https_(false),
-      ssl_context_(NULL),
-      ssl_error_message_(NULL) {
+      ssl_error_message_(NULL),
+      next_submitted_(NULL) {
   memset(&url_, 0, sizeof(url_));
 }
 
 SerfFetch::~SerfFetch() {
   DCHECK(async_fetch_ == NULL);
-  if (connection_ != NULL) {
-    serf_connection_close(connection_);
+  if (pooled_connection_) {
+    DCHECK(connection_ == NULL);
+  } else {
+    CloseConnection();
   }
   if (pool_ != NULL) {
     apr_pool_destroy(pool_);
@@ -190,8 +448,14 @@ void SerfFetch::Cancel(CancelCause cause) {
     // keep re-detecting it, which will interfere with other jobs getting
     // handled (until we finally cleanup the old fetch and close things in
     // ~SerfFetch).
-    serf_connection_close(connection_);
-    connection_ = NULL;
+    //
+    // A pooled connection is retired as a whole, as its other fetches can't
+    // share it once we have abandoned a request part way through.
+    if (pooled_connection_) {
+      RetireConnection();
+    } else {
+      CloseConnection();
+    }
   }
 
   CallCallback(cause == CancelCause::kClientDecision ?
@@ -206,6 +470,17 @@ void SerfFetch::CallCallback(SerfCompletionResult result) {
 
   if (async_fetch_ != NULL) {
     fetch_end_ms_ = timer_->NowMs();
+    if (pooled_connection_ && (connection_ != NULL)) {
+      // We may be inside a serf callback, so a connection left in an unknown
+      // state is just marked for the fetcher to retire after the run.
+      connection_->Remove(this);
+      if (result == SerfCompletionResult::kSuccess) {
+        connection_->set_last_used_ms(fetch_end_ms_);
+      } else {
+        connection_->set_broken();
+      }
+      connection_ = NULL;
+    }
     fetcher_->ReportCompletedFetchStats(this);
     CallbackDone(result);
     fetcher_->FetchComplete(this);
@@ -241,114 +516,66 @@ void SerfFetch::CallbackDone(SerfCompletionResult result) {
 }
 
 void SerfFetch::CleanupIfError() {
-  if ((connection_ != NULL) &&
-      serf_connection_is_in_error_state(connection_)) {
+  if ((connection_ != NULL) && connection_->InErrorState()) {
     message_handler_->Message(
         kInfo, "Serf cleanup for error'd fetch of: %s", DebugInfo().c_str());
-    Cancel(CancelCause::kSerfError);
+    if (pooled_connection_) {
+      // Let RetireBrokenConnections move this and the other queued fetches
+      // to a new connection if they haven't seen a response yet.
+      connection_->set_broken();
+    } else {
+      Cancel(CancelCause::kSerfError);
+    }
   }
 }
 
-int64 SerfFetch::TimeDuration() const {
-  if ((fetch_start_ms_ != 0) && (fetch_end_ms_ != 0)) {
-    return fetch_end_ms_ - fetch_start_ms_;
-  } else {
-    return 0;
+void SerfFetch::CloseConnection() {
+  if (connection_ != NULL) {
+    connection_->Remove(this);
+    delete connection_;
+    connection_ = NULL;
   }
 }
 
-#if SERF_HTTPS_FETCHING
-// static
-apr_status_t SerfFetch::SSLCertValidate(void *data, int failures,
-                                     const serf_ssl_certificate_t *cert) {
-  return static_cast<SerfFetch*>(data)->HandleSSLCertValidation(
-      failures, 0, cert);
+void SerfFetch::RetireConnection() {
+  SerfConnection* connection = connection_;
+  connection->Remove(this);
+  connection_ = NULL;
+  fetcher_->RetireConnection(connection);
 }
 
-// static
-apr_status_t SerfFetch::SSLCertChainValidate(
-    void *data, int failures, int error_depth,
-    const serf_ssl_certificate_t * const *certs,
-    apr_size_t certs_count) {
-  return static_cast<SerfFetch*>(data)->HandleSSLCertValidation(
-      failures, error_depth, NULL);
-}
-#endif
-
-// static
-apr_status_t SerfFetch::ConnectionSetup(
-    apr_socket_t* socket, serf_bucket_t **read_bkt, serf_bucket_t **write_bkt,
-    void* setup_baton, apr_pool_t* pool) {
-  SerfFetch* fetch = static_cast<SerfFetch*>(setup_baton);
-  *read_bkt = serf_bucket_socket_create(socket, fetch->bucket_alloc_);
-#if SERF_HTTPS_FETCHING
-  apr_status_t status = APR_SUCCESS;
-  if (fetch->using_https_) {
-    *read_bkt = serf_bucket_ssl_decrypt_create(*read_bkt,
-                                               fetch->ssl_context_,
-                                               fetch->bucket_alloc_);
-    if (fetch->ssl_context_ == NULL) {
-      fetch->ssl_context_ = serf_bucket_ssl_decrypt_context_get(*read_bkt);
-      if (fetch->ssl_context_ == NULL) {
-        status = APR_EGENERAL;
-      } else {
-        SerfUrlAsyncFetcher* fetcher = fetch->fetcher_;
-        const GoogleString& certs_dir = fetcher->ssl_certificates_dir();
-        const GoogleString& certs_file = fetcher->ssl_certificates_file();
-
-        if (!certs_file.empty()) {
-          status = serf_ssl_set_certificates_file(
-              fetch->ssl_context_, certs_file.c_str());
-        }
-        if ((status == APR_SUCCESS) && !certs_dir.empty()) {
-          status = serf_ssl_set_certificates_directory(fetch->ssl_context_,
-                                                       certs_dir.c_str());
-        }
-
-        // If no explicit file or directory is specified, then use the
-        // compiled-in default.
-        if (certs_dir.empty() && certs_file.empty()) {
-          status = serf_ssl_use_default_certificates(fetch->ssl_context_);
-        }
-      }
-      if (status != APR_SUCCESS) {
-        return status;
-      }
+void SerfFetch::ConnectionRetired(bool may_retry) {
+  connection_ = NULL;
+  if (async_fetch_ == NULL) {
+    return;
+  }
+  if (may_retry && !moved_connection_ && !status_line_read_ &&
+      (bytes_received_ == 0) && (ssl_error_message_ == NULL)) {
+    moved_connection_ = true;
+    connection_ = fetcher_->AttachToPooledConnection(this);
+    if (connection_ != NULL) {
+      return;
     }
+  }
+  CallCallback(SerfCompletionResult::kFailure);
+}
 
-    serf_ssl_server_cert_callback_set(
-        fetch->ssl_context_, SSLCertValidate, fetch);
-
-    serf_ssl_server_cert_chain_callback_set(
-        fetch->ssl_context_, SSLCertValidate, SSLCertChainValidate, fetch);
-
-    status = serf_ssl_set_hostname(fetch->ssl_context_, fetch->sni_host_);
-    if (status != APR_SUCCESS) {
-      LOG(INFO) << "Unable to set hostname from serf fetcher. Connection "
-                   "setup failed";
-      return status;
-    }
-    *write_bkt = serf_bucket_ssl_encrypt_create(*write_bkt,
-                                                fetch->ssl_context_,
-                                                fetch->bucket_alloc_);
+GoogleString SerfFetch::ConnectionKey() const {
+  GoogleString key = StrCat(url_.scheme, "://",
+                            (url_.hostname == NULL) ? "" : url_.hostname, ":",
+                            IntegerToString(url_.port));
+  if (sni_host_ != NULL) {
+    StrAppend(&key, " ", sni_host_);
   }
-#endif
-  return APR_SUCCESS;
+  return key;
 }
 
-// static
-void SerfFetch::ClosedConnection(serf_connection_t* conn,
-                                 void* closed_baton,
-                                 apr_status_t why,
-                                 apr_pool_t* pool) {
-  SerfFetch* fetch = static_cast<SerfFetch*>(closed_baton);
-  if (why != APR_SUCCESS) {
-    fetch->message_handler_->Warning(
-        fetch->DebugInfo().c_str(), 0, "Connection close (code=%d %s).",
-        why, GetAprErrorString(why).c_str());
+int64 SerfFetch::TimeDuration() const {
+  if ((fetch_start_ms_ != 0) && (fetch_end_ms_ != 0)) {
+    return fetch_end_ms_ - fetch_start_ms_;
+  } else {
+    return 0;
   }
-  // Connection is closed.
-  fetch->connection_ = NULL;
 }
 
 // static
@@ -474,6 +701,18 @@ apr_status_t SerfFetch::HandleSSLCertValidation(
 
 apr_status_t SerfFetch::HandleResponse(serf_bucket_t* response) {
   if (response == NULL) {
+    if (pooled_connection_ && (connection_ != NULL) && !moved_connection_ &&
+        !status_line_read_) {
+      // Serf dropped our request along with its connection, typically
+      // because the origin closed an idle keep-alive connection just as we
+      // reused it.  Leave the fetch queued so that RetireBrokenConnections
+      // moves it to a fresh connection.
+      message_handler_->Message(
+          kInfo, "serf connection lost before response for %s, retrying",
+          DebugInfo().c_str());
+      connection_->set_broken();
+      return APR_EGENERAL;
+    }
     message_handler_->Message(
         kInfo, "serf HandleResponse called with NULL response for %s",
         DebugInfo().c_str());
@@ -995,41 +1234,397 @@ class SerfThreadedFetcher : public SerfUrlAsyncFetcher {
   DISALLOW_COPY_AND_ASSIGN(SerfThreadedFetcher);
 };
 
+// Buffers a fetch's response, then hands all of it to base_fetch by adding a
+// single function to sequence once the fetch is done.  Used for
+// SerfUrlAsyncFetcher::FetchOnSequence.
+class SerfSequencedFetch : public SharedAsyncFetch {
+ public:
+  SerfSequencedFetch(AsyncFetch* base_fetch, Sequence* sequence,
+                     MessageHandler* message_handler)
+      : SharedAsyncFetch(base_fetch),
+        base_fetch_(base_fetch),
+        sequence_(sequence),
+        message_handler_(message_handler),
+        success_(false) {
+  }
+  virtual ~SerfSequencedFetch() {}
+
+ protected:
+  // The headers are shared with base_fetch, which is told they are complete
+  // only once we run on sequence_.
+  virtual void HandleHeadersComplete() {}
+
+  virtual bool HandleWrite(const StringPiece& content,
+                           MessageHandler* handler) {
+    content.AppendToString(&buffer_);
+    return true;
+  }
+
+  virtual bool HandleFlush(MessageHandler* handler) { return true; }
+
+  virtual void HandleDone(bool success) {
+    success_ = success;
+    sequence_->Add(MakeFunction(this, &SerfSequencedFetch::Deliver,
+                                &SerfSequencedFetch::CancelDelivery));
+  }
+
+ private:
+  void Deliver() {
+    PropagateContentLength();
+    base_fetch_->HeadersComplete();
+    if (!buffer_.empty()) {
+      base_fetch_->Write(buffer_, message_handler_);
+    }
+    base_fetch_->Done(success_);
+    delete this;
+  }
+
+  void CancelDelivery() {
+    base_fetch_->Done(false);
+    delete this;
+  }
+
+  AsyncFetch* base_fetch_;
+  Sequence* sequence_;
+  MessageHandler* message_handler_;
+  GoogleString buffer_;
+  bool success_;
+
+  DISALLOW_COPY_AND_ASSIGN(SerfSequencedFetch);
+};
+
+// Runs fetches on a thread of its own, like SerfThreadedFetcher, but owns the
+// pollset that serf waits on and creates it wakeable.  Submit pushes onto a
+// lock-free stack and wakes the poll, so a new fetch starts as soon as it is
+// submitted rather than when the poll next times out.  Only the loop thread
+// touches serf once it is running.
+class SerfEventLoopFetcher : public SerfUrlAsyncFetcher {
+ public:
+  SerfEventLoopFetcher(SerfUrlAsyncFetcher* parent, const char* proxy)
+      : SerfUrlAsyncFetcher(parent, proxy),
+        thread_id_(NULL),
+        pollset_(NULL),
+        submissions_(0),
+        num_taken_(0),
+        control_mutex_(parent->thread_system()->NewMutex()),
+        control_condvar_(control_mutex_->NewCondvar()),
+        shutdown_done_(false) {
+    CHECK_EQ(APR_SUCCESS, apr_pollset_create(&pollset_, kPollsetSize, pool_,
+                                             APR_POLLSET_WAKEABLE));
+    // Replace the context Init made with one whose sockets go in pollset_.
+    ScopedMutex lock(mutex_);
+    serf_context_ = serf_context_create_ex(this, AddToPollset,
+                                           RemoveFromPollset, pool_);
+    SetupProxy(proxy);  // Init has already reported any failure.
+  }
+
+  virtual ~SerfEventLoopFetcher() {
+    thread_finish_.set_value(true);
+    if (thread_started_.value()) {
+      LOG(INFO) << "Waiting for serf event loop to terminate";
+      apr_pollset_wakeup(pollset_);
+      apr_status_t ignored_retval;
+      apr_thread_join(&ignored_retval, thread_id_);
+    }
+
+    // With the loop gone we may run serf here.  Call back whatever was
+    // submitted but never started, then whatever is still running.
+    {
+      ScopedMutex lock(mutex_);
+      set_shutdown(true);
+    }
+    StartSubmittedFetches();
+    CancelActiveFetches();
+    completed_fetches_.DeleteAll();
+  }
+
+  // Queues fetch for the loop, starting the loop on first use.  May be
+  // called from any thread.
+  void Submit(SerfFetch* fetch) {
+    // Like SerfThreadedFetcher, start the thread only once there is
+    // something to fetch, to avoid problems with ITK.
+    if (!thread_started_.value()) {
+      StartThread();
+    }
+    num_submitted_.BarrierIncrement(1);
+    if (PushSubmission(fetch)) {
+      // The stack was empty, so the loop may be waiting in poll.  If it is
+      // busy instead, this just makes its next poll return at once.
+      apr_pollset_wakeup(pollset_);
+    }
+  }
+
+  void ShutDown() {
+    shutdown_requested_.set_value(true);
+    ScopedMutex lock(control_mutex_.get());
+    if (!thread_started_.value()) {
+      ScopedMutex hold(mutex_);
+      set_shutdown(true);
+      return;
+    }
+    // Have the loop cancel its fetches; it alone may touch serf.
+    apr_pollset_wakeup(pollset_);
+    while (!shutdown_done_) {
+      control_condvar_->Wait();
+    }
+  }
+
+  // Waits up to max_ms for every submitted fetch to complete.
+  bool WaitForIdle(int64 max_ms, MessageHandler* message_handler) {
+    int64 end_ms = timer_->NowMs() + max_ms;
+    {
+      ScopedMutex lock(control_mutex_.get());
+      while (AnyPendingFetches()) {
+        int64 remaining_ms = end_ms - timer_->NowMs();
+        if (remaining_ms <= 0) {
+          break;
+        }
+        control_condvar_->TimedWait(remaining_ms);
+      }
+    }
+    if (AnyPendingFetches()) {
+      message_handler->Message(
+          kError, "Serf event loop timeout waiting for fetches to complete:");
+      PrintActiveFetches(message_handler);
+      return false;
+    }
+    return true;
+  }
+
+ protected:
+  // Counts fetches from Submit until the loop has finished with them,
+  // without taking mutex_, which the loop holds while it waits for events.
+  virtual bool AnyPendingFetches() {
+    return num_submitted_.value() != num_finished_.value();
+  }
+
+  virtual apr_status_t RunSerfContext(apr_short_interval_time_t duration) {
+    // This is what serf_context_run does with the pollset it owns.
+    apr_status_t status = serf_context_prerun(serf_context_);
+    if (status != APR_SUCCESS) {
+      return status;
+    }
+    if (base::subtle::Acquire_Load(&submissions_) != 0) {
+      // An earlier poll, e.g. the one in SerfFetch::Start, may have consumed
+      // the wakeup for these, so don't block; the loop starts them next.
+      duration = 0;
+    }
+    apr_int32_t num_events = 0;
+    const apr_pollfd_t* events = NULL;
+    status = apr_pollset_poll(pollset_, duration, &num_events, &events);
+    if (APR_STATUS_IS_EINTR(status)) {
+      // Woken by Submit, ShutDown or the destructor.  Report it as a timeout
+      // so Poll still expires stale fetches however often we are woken.
+      return APR_TIMEUP;
+    }
+    if (status != APR_SUCCESS) {
+      return status;
+    }
+    for (int i = 0; i < num_events; ++i) {
+      status = serf_event_trigger(serf_context_, events[i].client_data,
+                                  &events[i]);
+      if (status != APR_SUCCESS) {
+        return status;
+      }
+    }
+    return APR_SUCCESS;
+  }
+
+ private:
+  // Only a hint on Linux, where APR uses epoll.
+  static const int kPollsetSize = 1024;
+  // As in SerfThreadedFetcher, this bounds how long data can stream in
+  // before Poll checks for timed out fetches.  New fetches don't wait for it.
+  static const int64 kActivePollMs = Timer::kSecondMs / 20;
+  // How long to wait for work when there are no active fetches; idle
+  // keep-alive connections are evicted at this granularity.
+  static const int64 kIdlePollMs = Timer::kSecondMs;
+
+  static apr_status_t AddToPollset(void* user_baton, apr_pollfd_t* pfd,
+                                   void* serf_baton) {
+    SerfEventLoopFetcher* loop = static_cast<SerfEventLoopFetcher*>(user_baton);
+    pfd->client_data = serf_baton;
+    return apr_pollset_add(loop->pollset_, pfd);
+  }
+
+  static apr_status_t RemoveFromPollset(void* user_baton, apr_pollfd_t* pfd,
+                                        void* serf_baton) {
+    SerfEventLoopFetcher* loop = static_cast<SerfEventLoopFetcher*>(user_baton);
+    return apr_pollset_remove(loop->pollset_, pfd);
+  }
+
+  static void* APR_THREAD_FUNC EventLoopFn(apr_thread_t* thread_id,
+                                           void* context) {
+    SerfEventLoopFetcher* loop = static_cast<SerfEventLoopFetcher*>(context);
+    CHECK_EQ(thread_id, loop->thread_id_);
+    loop->EventLoop();
+    return NULL;
+  }
+
+  void StartThread() {
+    ScopedMutex lock(control_mutex_.get());
+    if (!thread_started_.value()) {
+      CHECK_EQ(APR_SUCCESS, apr_thread_create(&thread_id_, NULL, EventLoopFn,
+                                              this, pool_));
+      thread_started_.set_value(true);
+    }
+  }
+
+  // Pushes fetch on submissions_, returning true if it was empty.  The stack
+  // is only ever emptied as a whole, by TakeSubmissions, so the classic ABA
+  // problem of lock-free stacks can't arise.
+  bool PushSubmission(SerfFetch* fetch) {
+    base::subtle::AtomicWord head = base::subtle::NoBarrier_Load(&submissions_);
+    while (true) {
+      fetch->set_next_submitted(reinterpret_cast<SerfFetch*>(head));
+      base::subtle::AtomicWord seen = base::subtle::Release_CompareAndSwap(
+          &submissions_, head,
+          reinterpret_cast<base::subtle::AtomicWord>(fetch));
+      if (seen == head) {
+        return (head == 0);
+      }
+      head = seen;
+    }
+  }
+
+  // Empties submissions_, returning its fetches oldest first.
+  SerfFetch* TakeSubmissions() {
+    base::subtle::AtomicWord head =
+        base::subtle::NoBarrier_AtomicExchange(&submissions_, 0);
+    // Pairs with the release in PushSubmission, so we see each fetch as its
+    // submitter left it.
+    base::subtle::MemoryBarrier();
+    SerfFetch* oldest_first = NULL;
+    SerfFetch* fetch = reinterpret_cast<SerfFetch*>(head);
+    while (fetch != NULL) {
+      SerfFetch* next = fetch->next_submitted();
+      fetch->set_next_submitted(oldest_first);
+      oldest_first = fetch;
+      fetch = next;
+    }
+    return oldest_first;
+  }
+
+  void StartSubmittedFetches() {
+    SerfFetch* fetch = TakeSubmissions();
+    ScopedMutex lock(mutex_);
+    while (fetch != NULL) {
+      SerfFetch* next = fetch->next_submitted();
+      fetch->set_next_submitted(NULL);
+      ++num_taken_;
+      StartFetch(fetch);  // May delete fetch.
+      fetch = next;
+    }
+  }
+
+  void EventLoop() {
+    // See SerfThreadedFetcher::SerfThread.
+    apr_setup_signal_thread();
+
+    bool shutdown_seen = false;
+    while (!thread_finish_.value()) {
+      if (!shutdown_seen && shutdown_requested_.value()) {
+        shutdown_seen = true;
+        AcknowledgeShutDown();
+      }
+      StartSubmittedFetches();
+      int num_active = Poll(kActivePollMs);
+      PublishProgress(num_active);
+      if (num_active == 0) {
+        WaitForEvents(kIdlePollMs);
+      }
+    }
+  }
+
+  // Waits until woken, or for events on idle keep-alive connections.
+  void WaitForEvents(int64 max_wait_ms) {
+    ScopedMutex lock(mutex_);
+    RunSerfContext(max_wait_ms * Timer::kMsUs);
+    RetireBrokenConnections();
+    completed_fetches_.DeleteAll();
+    EvictIdleConnections();
+  }
+
+  void AcknowledgeShutDown() {
+    {
+      ScopedMutex lock(mutex_);
+      set_shutdown(true);
+      CancelActiveFetchesMutexHeld();
+    }
+    ScopedMutex lock(control_mutex_.get());
+    shutdown_done_ = true;
+    control_condvar_->Broadcast();
+  }
+
+  // Makes fetches the loop is done with visible to AnyPendingFetches, and
+  // wakes WaitForIdle once none are left.
+  void PublishProgress(int num_active) {
+    int32 num_finished = num_taken_ - num_active;
+    if (num_finished != num_finished_.value()) {
+      num_finished_.set_value(num_finished);
+      if (!AnyPendingFetches()) {
+        ScopedMutex lock(control_mutex_.get());
+        control_condvar_->Broadcast();
+      }
+    }
+  }
+
+  apr_thread_t* thread_id_;
+  apr_pollset_t* pollset_;
+
+  // Stack of submitted fetches, linked through SerfFetch::next_submitted().
+  volatile base::subtle::AtomicWord submissions_;
+  AtomicInt32 num_submitted_;
+  // Fetches taken from submissions_, and how many of those have finished.
+  // Only the loop writes these.
+  int32 num_taken_;
+  AtomicInt32 num_finished_;
+
+  AtomicBool thread_started_;  // Set under control_mutex_.
+  AtomicBool thread_finish_;
+  AtomicBool shutdown_requested_;
+
+  // Guards thread start-up and shutdown_done_, and is used to wait for
+  // the loop in ShutDown and WaitForIdle.
+  scoped_ptr<ThreadSystem::CondvarCapableMutex> control_mutex_;
+  scoped_ptr<ThreadSystem::Condvar> control_condvar_;
+  bool shutdown_done_;
+
+  DISALLOW_COPY_AND_ASSIGN(SerfEventLoopFetcher);
+};
+
 bool SerfFetch::Start(SerfUrlAsyncFetcher* fetcher,
                       serf_context_t* serf_context) {
   // Note: this is called in the thread's context, so this is when we do
   // the pool ops.
   fetcher_ = fetcher;
   apr_pool_create(&pool_, fetcher_->pool());
-  bucket_alloc_ = serf_bucket_allocator_create(pool_, NULL, NULL);
 
   fetch_start_ms_ = timer_->NowMs();
   // Parse and validate the URL.
   if (!ParseUrl()) {
     return false;
   }
+  DCHECK(fetcher->allow_https() || !StringCaseEqual("https", url_.scheme));
 
-  using_https_ = StringCaseEqual("https", url_.scheme);
-  DCHECK(fetcher->allow_https() || !using_https_);
-
-  apr_status_t status = serf_connection_create2(&connection_,
-                                                serf_context,
-                                                url_,
-                                                ConnectionSetup, this,
-                                                ClosedConnection, this,
-                                                pool_);
-  if (status != APR_SUCCESS) {
-    message_handler_->Error(DebugInfo().c_str(), 0,
-                            "Error status=%d (%s) serf_connection_create2",
-                            status, GetAprErrorString(status).c_str());
-    return false;
+  if (fetcher_->keep_alive_connections_per_host() > 0) {
+    pooled_connection_ = true;
+    connection_ = fetcher_->AttachToPooledConnection(this);
+    if (connection_ == NULL) {
+      return false;
+    }
+  } else {
+    connection_ = new SerfConnection(fetcher_, ConnectionKey());
+    if (!connection_->Open(serf_context, this)) {
+      CloseConnection();
+      return false;
+    }
+    connection_->Enqueue(this);
   }
-  serf_connection_request_create(connection_, SetupRequest, this);
 
   // Start the fetch. It will connect to the remote host, send the request,
   // and accept the response, without blocking.
-  status =
-      serf_context_run(serf_context, SERF_DURATION_NOBLOCK, fetcher_->pool());
+  apr_status_t status = fetcher_->RunSerfContext(SERF_DURATION_NOBLOCK);
 
   if (status == APR_SUCCESS || APR_STATUS_IS_TIMEUP(status)) {
     return true;
@@ -1037,6 +1632,10 @@ bool SerfFetch::Start(SerfUrlAsyncFetcher* fetcher,
     message_handler_->Error(DebugInfo().c_str(), 0,
                             "serf_context_run error status=%d (%s)",
                             status, GetAprErrorString(status).c_str());
+    if (pooled_connection_ && (connection_ != NULL)) {
+      // Our caller deletes us, so take our request off the shared connection.
+      RetireConnection();
+    }
     return false;
   }
 }
@@ -1088,9 +1687,9 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(const char* proxy, apr_pool_t* pool,
       thread_system_(thread_system),
       timer_(timer),
       mutex_(NULL),
+      serf_context_(NULL),
       threaded_fetcher_(NULL),
       active_count_(NULL),
-      serf_context_(NULL),
       request_count_(NULL),
       byte_count_(NULL),
       time_duration_ms_(NULL),
@@ -1099,6 +1698,9 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(const char* proxy, apr_pool_t* pool,
       failure_count_(NULL),
       cert_errors_(NULL),
       read_calls_count_(NULL),
+      connection_count_(NULL),
+      connection_reuse_count_(NULL),
+      latency_us_histogram_(NULL),
       ultimate_success_(NULL),
       ultimate_failure_(NULL),
       last_check_timestamp_ms_(NULL),
@@ -1107,7 +1709,12 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(const char* proxy, apr_pool_t* pool,
       list_outstanding_urls_on_error_(false),
       track_original_content_length_(false),
       https_options_(0),
-      message_handler_(message_handler) {
+      keep_alive_connections_per_host_(0),
+      keep_alive_max_idle_per_host_(0),
+      keep_alive_idle_timeout_ms_(0),
+      message_handler_(message_handler),
+      proxy_((proxy == NULL) ? "" : proxy),
+      statistics_(statistics) {
   CHECK(statistics != NULL);
   request_count_  =
       statistics->GetVariable(SerfStats::kSerfFetchRequestCount);
@@ -1122,6 +1729,12 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(const char* proxy, apr_pool_t* pool,
   cert_errors_ = statistics->GetVariable(SerfStats::kSerfFetchCertErrors);
   // Using FindVariable for this one since it's only set in debug builds.
   read_calls_count_ = statistics->FindVariable(SerfStats::kSerfFetchReadCalls);
+  connection_count_ =
+      statistics->GetVariable(SerfStats::kSerfFetchConnectionCount);
+  connection_reuse_count_ =
+      statistics->GetVariable(SerfStats::kSerfFetchConnectionReuseCount);
+  latency_us_histogram_ =
+      statistics->GetHistogram(SerfStats::kSerfFetchLatencyUsHistogram);
   ultimate_success_ =
       statistics->GetVariable(SerfStats::kSerfFetchUltimateSuccess);
   ultimate_failure_ =
@@ -1138,9 +1751,9 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(SerfUrlAsyncFetcher* parent,
       thread_system_(parent->thread_system_),
       timer_(parent->timer_),
       mutex_(NULL),
+      serf_context_(NULL),
       threaded_fetcher_(NULL),
       active_count_(parent->active_count_),
-      serf_context_(NULL),
       request_count_(parent->request_count_),
       byte_count_(parent->byte_count_),
       time_duration_ms_(parent->time_duration_ms_),
@@ -1149,6 +1762,9 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(SerfUrlAsyncFetcher* parent,
       failure_count_(parent->failure_count_),
       cert_errors_(parent->cert_errors_),
       read_calls_count_(parent->read_calls_count_),
+      connection_count_(parent->connection_count_),
+      connection_reuse_count_(parent->connection_reuse_count_),
+      latency_us_histogram_(parent->latency_us_histogram_),
       ultimate_success_(parent->ultimate_success_),
       ultimate_failure_(parent->ultimate_failure_),
       last_check_timestamp_ms_(parent->last_check_timestamp_ms_),
@@ -1157,7 +1773,13 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(SerfUrlAsyncFetcher* parent,
       list_outstanding_urls_on_error_(parent->list_outstanding_urls_on_error_),
       track_original_content_length_(parent->track_original_content_length_),
       https_options_(parent->https_options_),
-      message_handler_(parent->message_handler_) {
+      keep_alive_connections_per_host_(
+          parent->keep_alive_connections_per_host_),
+      keep_alive_max_idle_per_host_(parent->keep_alive_max_idle_per_host_),
+      keep_alive_idle_timeout_ms_(parent->keep_alive_idle_timeout_ms_),
+      message_handler_(parent->message_handler_),
+      proxy_((proxy == NULL) ? "" : proxy),
+      statistics_(NULL) {
   Init(parent->pool(), proxy);
 }
 
@@ -1178,6 +1800,7 @@ SerfUrlAsyncFetcher::~SerfUrlAsyncFetcher() {
   }
 
   active_fetches_.DeleteAll();
+  STLDeleteElements(&event_loops_);
   if (threaded_fetcher_ != NULL) {
     delete threaded_fetcher_;
   }
@@ -1191,6 +1814,14 @@ void SerfUrlAsyncFetcher::ShutDown() {
   if (threaded_fetcher_ != NULL) {
     threaded_fetcher_->ShutDown();
   }
+  for (int i = 0, n = event_loops_.size(); i < n; ++i) {
+    event_loops_[i]->ShutDown();
+  }
+#ifdef PAGESPEED_ENABLE_HTTP2_FETCHER
+  if (http2_fetcher_.get() != NULL) {
+    http2_fetcher_->ShutDown();
+  }
+#endif
 
   ScopedMutex lock(mutex_);
   shutdown_ = true;
@@ -1215,6 +1846,10 @@ void SerfUrlAsyncFetcher::CancelActiveFetches() {
 }
 
 void SerfUrlAsyncFetcher::CancelActiveFetchesMutexHeld() {
+  // Close the pooled connections up front, so canceling one fetch doesn't
+  // move the others queued behind it to new connections.
+  ClosePooledConnections();
+
   // If there are still active requests, cancel them.
   int num_canceled = 0;
   while (!active_fetches_.empty()) {
@@ -1238,6 +1873,9 @@ bool SerfUrlAsyncFetcher::StartFetch(SerfFetch* fetch) {
   active_fetches_.Add(fetch);
   active_count_->Add(1);
   bool started = !shutdown_ && fetch->Start(this, serf_context_);
+  // Starting the fetch ran serf, which may have broken pooled connections
+  // that have requests queued for fetches we're about to delete.
+  RetireBrokenConnections();
   if (!started) {
     fetch->message_handler()->Message(kWarning, "Fetch failed to start: %s",
                                       fetch->DebugInfo().c_str());
@@ -1255,15 +1893,45 @@ void SerfUrlAsyncFetcher::Fetch(const GoogleString& url,
                                 MessageHandler* message_handler,
                                 AsyncFetch* async_fetch) {
   async_fetch = EnableInflation(async_fetch);
+#ifdef PAGESPEED_ENABLE_HTTP2_FETCHER
+  if ((http2_fetcher_.get() != NULL) &&
+      http2_fetcher_->HandlesUrl(GoogleUrl(url))) {
+    http2_fetcher_->Fetch(url, message_handler, async_fetch);
+    return;
+  }
+#endif
   SerfFetch* fetch = new SerfFetch(url, async_fetch, message_handler, timer_);
 
   request_count_->Add(1);
+  if (!event_loops_.empty()) {
+    uint32 index = next_event_loop_.NoBarrierIncrement(1);
+    event_loops_[index % event_loops_.size()]->Submit(fetch);
+    return;
+  }
   threaded_fetcher_->InitiateFetch(fetch);
 
   // TODO(morlovich): There is quite a bit of code related to doing work
   // both on 'this' and threaded_fetcher_ that could use cleaning up.
 }
 
+void SerfUrlAsyncFetcher::FetchOnSequence(const GoogleString& url,
+                                          MessageHandler* message_handler,
+                                          AsyncFetch* async_fetch,
+                                          Sequence* response_sequence) {
+  if (response_sequence == NULL) {
+    Fetch(url, message_handler, async_fetch);
+    return;
+  }
+  Fetch(url, message_handler,
+        new SerfSequencedFetch(async_fetch, response_sequence,
+                               message_handler));
+}
+
+apr_status_t SerfUrlAsyncFetcher::RunSerfContext(
+    apr_short_interval_time_t duration) {
+  return serf_context_run(serf_context_, duration, pool_);
+}
+
 void SerfUrlAsyncFetcher::PrintActiveFetches(
     MessageHandler* handler) const {
   ScopedMutex mutex(mutex_);
@@ -1280,8 +1948,10 @@ int SerfUrlAsyncFetcher::Poll(int64 max_wait_ms) {
   // Run serf polling up to microseconds.
   ScopedMutex mutex(mutex_);
   if (!active_fetches_.empty()) {
-    apr_status_t status =
-        serf_context_run(serf_context_, 1000*max_wait_ms, pool_);
+    apr_status_t status = RunSerfContext(1000*max_wait_ms);
+    // Pooled connections that broke during the run may still have requests
+    // queued for completed fetches, so must be closed before those go.
+    RetireBrokenConnections();
     completed_fetches_.DeleteAll();
     if (APR_STATUS_IS_TIMEUP(status)) {
       // Remove expired fetches from the front of the queue.
@@ -1349,6 +2019,7 @@ int SerfUrlAsyncFetcher::Poll(int64 max_wait_ms) {
       CleanupFetchesWithErrors();
     }
   }
+  EvictIdleConnections();
   return active_fetches_.size();
 }
 
@@ -1370,6 +2041,9 @@ void SerfUrlAsyncFetcher::ReportCompletedFetchStats(const SerfFetch* fetch) {
   if (time_duration_ms_) {
     time_duration_ms_->Add(fetch->TimeDuration());
   }
+  if (latency_us_histogram_) {
+    latency_us_histogram_->Add(fetch->TimeDuration() * Timer::kMsUs);
+  }
   if (byte_count_) {
     byte_count_->Add(fetch->bytes_received());
   }
@@ -1430,6 +2104,11 @@ int SerfUrlAsyncFetcher:: ApproximateNumActiveFetches() {
 bool SerfUrlAsyncFetcher::WaitForActiveFetches(
     int64 max_ms, MessageHandler* message_handler, WaitChoice wait_choice) {
   bool ret = true;
+  if (wait_choice != kMainlineOnly) {
+    for (int i = 0, n = event_loops_.size(); i < n; ++i) {
+      ret &= event_loops_[i]->WaitForIdle(max_ms, message_handler);
+    }
+  }
   if ((threaded_fetcher_ != NULL) && (wait_choice != kMainlineOnly)) {
     ret &= threaded_fetcher_->WaitForActiveFetchesHelper(
         max_ms, message_handler);
@@ -1482,6 +2161,136 @@ void SerfUrlAsyncFetcher::CleanupFetchesWithErrors() {
   for (int i = 0, size = fetches.size(); i < size; ++i) {
     fetches[i]->CleanupIfError();
   }
+  RetireBrokenConnections();
+}
+
+SerfConnection* SerfUrlAsyncFetcher::AttachToPooledConnection(
+    SerfFetch* fetch) NO_THREAD_SAFETY_ANALYSIS {
+  // Like FetchComplete, this is reached via SerfFetch from Poll or StartFetch,
+  // both of which hold mutex_.
+  GoogleString key = fetch->ConnectionKey();
+  ConnectionVector& connections = pooled_connections_[key];
+  SerfConnection* least_loaded = NULL;
+  int num_healthy = 0;
+  for (int i = 0, n = connections.size(); i < n; ++i) {
+    SerfConnection* connection = connections[i];
+    if (connection->IsHealthy()) {
+      ++num_healthy;
+      if ((least_loaded == NULL) ||
+          (connection->queue_size() < least_loaded->queue_size())) {
+        least_loaded = connection;
+      }
+    }
+  }
+  if ((least_loaded != NULL) &&
+      (least_loaded->idle() ||
+       (num_healthy >= keep_alive_connections_per_host_))) {
+    connection_reuse_count_->Add(1);
+    least_loaded->Enqueue(fetch);
+    return least_loaded;
+  }
+
+  SerfConnection* connection = new SerfConnection(this, key);
+  if (!connection->Open(serf_context_, fetch)) {
+    delete connection;
+    if (connections.empty()) {
+      pooled_connections_.erase(key);
+    }
+    return NULL;
+  }
+  connections.push_back(connection);
+  connection->Enqueue(fetch);
+  return connection;
+}
+
+void SerfUrlAsyncFetcher::RetireConnection(SerfConnection* connection)
+    NO_THREAD_SAFETY_ANALYSIS {
+  // See AttachToPooledConnection for locking.
+  ConnectionMap::iterator p = pooled_connections_.find(connection->key());
+  DCHECK(p != pooled_connections_.end());
+  if (p != pooled_connections_.end()) {
+    ConnectionVector& connections = p->second;
+    connections.erase(
+        std::find(connections.begin(), connections.end(), connection));
+    if (connections.empty()) {
+      pooled_connections_.erase(p);
+    }
+  }
+  std::vector<SerfFetch*> orphans;
+  connection->DetachFetches(&orphans);
+  delete connection;
+  for (int i = 0, n = orphans.size(); i < n; ++i) {
+    orphans[i]->ConnectionRetired(!shutdown_);
+  }
+}
+
+void SerfUrlAsyncFetcher::RetireBrokenConnections() {
+  ConnectionVector broken;
+  for (ConnectionMap::iterator p = pooled_connections_.begin(),
+           e = pooled_connections_.end(); p != e; ++p) {
+    const ConnectionVector& connections = p->second;
+    for (int i = 0, n = connections.size(); i < n; ++i) {
+      if (connections[i]->broken()) {
+        broken.push_back(connections[i]);
+      }
+    }
+  }
+  for (int i = 0, n = broken.size(); i < n; ++i) {
+    RetireConnection(broken[i]);
+  }
+}
+
+namespace {
+
+bool MoreRecentlyUsed(const SerfConnection* a, const SerfConnection* b) {
+  return a->last_used_ms() > b->last_used_ms();
+}
+
+}  // namespace
+
+void SerfUrlAsyncFetcher::EvictIdleConnections() {
+  if (pooled_connections_.empty()) {
+    return;
+  }
+  int64 idle_cutoff_ms = timer_->NowMs() - keep_alive_idle_timeout_ms_;
+  ConnectionVector evict;
+  for (ConnectionMap::iterator p = pooled_connections_.begin(),
+           e = pooled_connections_.end(); p != e; ++p) {
+    ConnectionVector idle;
+    const ConnectionVector& connections = p->second;
+    for (int i = 0, n = connections.size(); i < n; ++i) {
+      if (connections[i]->idle()) {
+        idle.push_back(connections[i]);
+      }
+    }
+    // Keep the most recently used connections, which are the least likely
+    // to have been closed by the origin in the meantime.
+    std::sort(idle.begin(), idle.end(), MoreRecentlyUsed);
+    for (int i = 0, n = idle.size(); i < n; ++i) {
+      SerfConnection* connection = idle[i];
+      if ((i >= keep_alive_max_idle_per_host_) ||
+          (connection->last_used_ms() < idle_cutoff_ms) ||
+          !connection->IsHealthy()) {
+        evict.push_back(connection);
+      }
+    }
+  }
+  for (int i = 0, n = evict.size(); i < n; ++i) {
+    RetireConnection(evict[i]);
+  }
+}
+
+void SerfUrlAsyncFetcher::ClosePooledConnections() {
+  for (ConnectionMap::iterator p = pooled_connections_.begin(),
+           e = pooled_connections_.end(); p != e; ++p) {
+    ConnectionVector& connections = p->second;
+    for (int i = 0, n = connections.size(); i < n; ++i) {
+      std::vector<SerfFetch*> detached;
+      connections[i]->DetachFetches(&detached);
+      delete connections[i];
+    }
+  }
+  pooled_connections_.clear();
 }
 
 void SerfUrlAsyncFetcher::InitStats(Statistics* statistics) {
@@ -1499,6 +2308,14 @@ void SerfUrlAsyncFetcher::InitStats(Statistics* statistics) {
   statistics->AddVariable(SerfStats::kSerfFetchUltimateSuccess);
   statistics->AddVariable(SerfStats::kSerfFetchUltimateFailure);
   statistics->AddUpDownCounter(SerfStats::kSerfFetchLastCheckTimestampMs);
+  statistics->AddVariable(SerfStats::kSerfFetchConnectionCount);
+  statistics->AddVariable(SerfStats::kSerfFetchConnectionReuseCount);
+  Histogram* latency_histogram =
+      statistics->AddHistogram(SerfStats::kSerfFetchLatencyUsHistogram);
+  latency_histogram->SetMaxValue(5 * Timer::kSecondUs);
+#ifdef PAGESPEED_ENABLE_HTTP2_FETCHER
+  Http2UrlAsyncFetcher::InitStats(statistics);
+#endif
 }
 
 void SerfUrlAsyncFetcher::set_list_outstanding_urls_on_error(bool x) {
@@ -1513,6 +2330,77 @@ void SerfUrlAsyncFetcher::set_track_original_content_length(bool x) {
   if (threaded_fetcher_ != NULL) {
     threaded_fetcher_->set_track_original_content_length(x);
   }
+#ifdef PAGESPEED_ENABLE_HTTP2_FETCHER
+  if (http2_fetcher_.get() != NULL) {
+    http2_fetcher_->set_track_original_content_length(x);
+  }
+#endif
+}
+
+bool SerfUrlAsyncFetcher::SetHttp2PriorKnowledgeOrigins(StringPiece origins) {
+  DCHECK(statistics_ != NULL);
+  GoogleString error_message;
+  if (!ValidateHttp2PriorKnowledgeOrigins(origins, &error_message)) {
+    message_handler_->Message(kError, "%s", error_message.c_str());
+    return false;
+  }
+#ifdef PAGESPEED_ENABLE_HTTP2_FETCHER
+  if (origins.empty()) {
+    http2_fetcher_.reset(NULL);
+    return true;
+  }
+  if (http2_fetcher_.get() == NULL) {
+    http2_fetcher_.reset(new Http2UrlAsyncFetcher(
+        thread_system_, statistics_, timer_, timeout_ms_, message_handler_));
+    http2_fetcher_->set_track_original_content_length(
+        track_original_content_length_);
+  }
+  return http2_fetcher_->SetPriorKnowledgeOrigins(origins);
+#else
+  return true;
+#endif
+}
+
+// static
+bool SerfUrlAsyncFetcher::ValidateHttp2PriorKnowledgeOrigins(
+    StringPiece origins, GoogleString* error_message) {
+#ifdef PAGESPEED_ENABLE_HTTP2_FETCHER
+  if (!Http2UrlAsyncFetcher::ValidatePriorKnowledgeOrigins(origins)) {
+    *error_message = "Expected a comma-separated list of ip[:port]";
+    return false;
+  }
+#else
+  if (!origins.empty()) {
+    *error_message = "HTTP/2 origin fetching is not built in; rebuild with "
+                     "enable_http2_fetcher=1";
+    return false;
+  }
+#endif
+  return true;
+}
+
+void SerfUrlAsyncFetcher::SetKeepAliveOptions(int connections_per_host,
+                                              int max_idle_per_host,
+                                              int64 idle_timeout_ms) {
+  keep_alive_connections_per_host_ = connections_per_host;
+  keep_alive_max_idle_per_host_ = max_idle_per_host;
+  keep_alive_idle_timeout_ms_ = idle_timeout_ms;
+  if (threaded_fetcher_ != NULL) {
+    threaded_fetcher_->SetKeepAliveOptions(
+        connections_per_host, max_idle_per_host, idle_timeout_ms);
+  }
+}
+
+void SerfUrlAsyncFetcher::SetEventLoopThreads(int num_threads) {
+  DCHECK(event_loops_.empty());
+  // The loops copy the rest of our configuration when constructed.
+  for (int i = 0; i < num_threads; ++i) {
+    SerfEventLoopFetcher* loop =
+        new SerfEventLoopFetcher(this, proxy_.c_str());
+    loop->SetSslCertificatesDir(ssl_certificates_dir_);
+    loop->SetSslCertificatesFile(ssl_certificates_file_);
+    event_loops_.push_back(loop);
+  }
 }
 
 bool SerfUrlAsyncFetcher::ParseHttpsOptions(StringPiece directive,
@@ -22,14 +22,17 @@
 #define PAGESPEED_SYSTEM_SERF_URL_ASYNC_FETCHER_H_
 
 #include <cstddef>
+#include <map>
 #include <vector>
 
 #include "apr_network_io.h"
 #include "net/instaweb/http/public/url_async_fetcher.h"
+#include "pagespeed/kernel/base/atomic_int32.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/gtest_prod.h"
 #include "pagespeed/kernel/base/pool.h"
 #include "pagespeed/kernel/base/pool_element.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
@@ -59,10 +62,15 @@ struct serf_context_t;
 namespace net_instaweb {
 
 class AsyncFetch;
+class Histogram;
+class Http2UrlAsyncFetcher;
 class MessageHandler;
 class Statistics;
+class SerfConnection;
+class SerfEventLoopFetcher;
 class SerfFetch;
 class SerfThreadedFetcher;
+class Sequence;
 class Timer;
 class UpDownCounter;
 class Variable;
@@ -78,6 +86,13 @@ struct SerfStats {
   static const char kSerfFetchCertErrors[];
   static const char kSerfFetchReadCalls[];
 
+  // Connections opened by serf: one per fetch, unless keep-alive pooling
+  // is on; compare with Http2UrlAsyncFetcher::kHttp2FetchConnectionCount.
+  static const char kSerfFetchConnectionCount[];
+  // Fetches sent on an already-open pooled connection.
+  static const char kSerfFetchConnectionReuseCount[];
+  static const char kSerfFetchLatencyUsHistogram[];
+
   // A fetch that finished with a 2xx or a 3xx code --- and not just a
   // mechanically successful one that's a 4xx or such.
   static const char kSerfFetchUltimateSuccess[];
@@ -137,6 +152,17 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
   virtual void Fetch(const GoogleString& url,
                      MessageHandler* message_handler,
                      AsyncFetch* callback);
+
+  // Rather than calling callback from the serf thread as the response
+  // arrives, buffers the response and delivers all of it by adding a single
+  // function to response_sequence once the fetch is done.  If
+  // response_sequence is destroyed before running that function, callback
+  // gets Done(false).
+  virtual void FetchOnSequence(const GoogleString& url,
+                               MessageHandler* message_handler,
+                               AsyncFetch* callback,
+                               Sequence* response_sequence);
+
   // TODO(morlovich): Make private once non-thread mode concept removed.
   int Poll(int64 max_wait_ms);
 
@@ -193,6 +219,41 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
     return ParseHttpsOptions(directive, &options, error_message);
   }
 
+  // Routes fetches to the given comma-separated host[:port] origins over
+  // cleartext HTTP/2 with prior knowledge, multiplexing them on one
+  // connection per origin; see Http2UrlAsyncFetcher.  Each host must be an
+  // IP literal; other origins, including all https ones, keep using serf.
+  // An empty list turns this off.  Returns false if the list does not parse,
+  // or is not empty in a build without enable_http2_fetcher=1.  Must be
+  // called before the first Fetch.
+  bool SetHttp2PriorKnowledgeOrigins(StringPiece origins);
+
+  static bool ValidateHttp2PriorKnowledgeOrigins(StringPiece origins,
+                                                 GoogleString* error_message);
+
+  // Keeps HTTP/1.1 connections open across fetches to the same scheme, host
+  // and port.  At most connections_per_host are opened per origin; further
+  // fetches queue on the least loaded one and are sent when its current
+  // response completes.  Idle connections beyond max_idle_per_host, or idle
+  // for longer than idle_timeout_ms, are closed.  connections_per_host <= 0
+  // turns pooling off, so each fetch opens its own connection.  Must be
+  // called before the first Fetch.
+  void SetKeepAliveOptions(int connections_per_host, int max_idle_per_host,
+                           int64 idle_timeout_ms);
+  int keep_alive_connections_per_host() const {
+    return keep_alive_connections_per_host_;
+  }
+
+  // Runs fetches on num_threads event-loop threads rather than on the single
+  // SerfThreadedFetcher thread.  Each loop drives its own serf context from
+  // a wakeable pollset.  Fetch hands fetches to the loops round-robin
+  // through a lock-free queue and wakes the loop at once, instead of leaving
+  // them for the threaded fetcher to pick up between polls.  num_threads <= 0
+  // keeps the threaded fetcher.  Must be called after the other setters and
+  // before the first Fetch.
+  void SetEventLoopThreads(int num_threads);
+  int num_event_loop_threads() const { return event_loops_.size(); }
+
   void SetSslCertificatesDir(StringPiece dir);
   const GoogleString& ssl_certificates_dir() const {
     return ssl_certificates_dir_;
@@ -220,6 +281,12 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   bool SetupProxy(const char* proxy) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Runs serf for up to duration microseconds, or without blocking for
+  // SERF_DURATION_NOBLOCK.  Overridden by SerfEventLoopFetcher, whose serf
+  // context uses a pollset of its own.
+  virtual apr_status_t RunSerfContext(apr_short_interval_time_t duration)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   // Start a SerfFetch. Takes ownership of fetch and makes sure callback is
   // called even if fetch fails to start.
   bool StartFetch(SerfFetch* fetch) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
@@ -242,6 +309,25 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
   // Must be called only immediately after running the serf event loop.
   void CleanupFetchesWithErrors() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Pooled connection management; see SetKeepAliveOptions.  These must not
+  // be called from within serf callbacks, as they close connections.
+  //
+  // Queues fetch on a healthy pooled connection to its origin, opening one
+  // if there is none or all are busy and the per-host limit allows it.
+  // Returns NULL if a connection could not be opened.
+  SerfConnection* AttachToPooledConnection(SerfFetch* fetch);
+  // Closes connection, moving the fetches queued on it to other connections
+  // where that is still possible and failing them otherwise.
+  void RetireConnection(SerfConnection* connection);
+  // Retires the connections that failed while running the serf event loop.
+  void RetireBrokenConnections() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Closes idle connections that are unhealthy, too old, or in excess of
+  // keep_alive_max_idle_per_host_.
+  void EvictIdleConnections() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Closes every pooled connection, detaching the queued fetches without
+  // calling them back; used before canceling all active fetches.
+  void ClosePooledConnections() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   bool shutdown() const EXCLUSIVE_LOCKS_REQUIRED(mutex_) { return shutdown_; }
   void set_shutdown(bool s) EXCLUSIVE_LOCKS_REQUIRED(mutex_) { shutdown_ = s; }
 
@@ -253,9 +339,15 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
   // protected because SerfThreadedFetcher needs access.
   ThreadSystem::CondvarCapableMutex* mutex_;
 
+  // Protected so SerfEventLoopFetcher can replace it with one that uses its
+  // own pollset.
+  serf_context_t* serf_context_ GUARDED_BY(mutex_);
+
   typedef std::vector<SerfFetch*> FetchVector;
   SerfFetchPool completed_fetches_;
   SerfThreadedFetcher* threaded_fetcher_;
+  // When non-empty, these take the fetches instead of threaded_fetcher_.
+  std::vector<SerfEventLoopFetcher*> event_loops_;
 
   // This is protected because it's updated along with active_fetches_,
   // which happens in subclass SerfThreadedFetcher as well as this class.
@@ -263,6 +355,11 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
 
  private:
   friend class SerfFetch;  // To access stats variables below.
+  friend class SerfConnection;
+
+  typedef std::vector<SerfConnection*> ConnectionVector;
+  // Keyed by SerfFetch::ConnectionKey().
+  typedef std::map<GoogleString, ConnectionVector> ConnectionMap;
 
   // Note: returned string memory substring of memory in the pool.
   static const char* ExtractHostHeader(const apr_uri_t& uri,
@@ -277,8 +374,8 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
   static bool ParseHttpsOptions(StringPiece directive, uint32* options,
                                 GoogleString* error_message);
 
-  serf_context_t* serf_context_ GUARDED_BY(mutex_);
   SerfFetchPool active_fetches_ GUARDED_BY(mutex_);
+  ConnectionMap pooled_connections_ GUARDED_BY(mutex_);
 
   Variable* request_count_;
   Variable* byte_count_;
@@ -288,6 +385,9 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
   Variable* failure_count_;
   Variable* cert_errors_;
   Variable* read_calls_count_;  // Non-NULL only on debug builds.
+  Variable* connection_count_;
+  Variable* connection_reuse_count_;
+  Histogram* latency_us_histogram_;
   Variable* ultimate_success_;
   Variable* ultimate_failure_;
   UpDownCounter* last_check_timestamp_ms_;
@@ -296,10 +396,23 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
   bool list_outstanding_urls_on_error_;
   bool track_original_content_length_;
   uint32 https_options_;  // Composed of HttpsOptions ORed together.
+  int keep_alive_connections_per_host_;
+  int keep_alive_max_idle_per_host_;
+  int64 keep_alive_idle_timeout_ms_;
   MessageHandler* message_handler_;
+  // Retained to configure event_loops_.
+  GoogleString proxy_;
+  AtomicInt32 next_event_loop_;
   GoogleString ssl_certificates_dir_;
   GoogleString ssl_certificates_file_;
 
+  // Retained to create http2_fetcher_ on demand.  NULL in the threaded
+  // fetcher, which never sees fetches for HTTP/2 origins.
+  Statistics* statistics_;
+#ifdef PAGESPEED_ENABLE_HTTP2_FETCHER
+  scoped_ptr<Http2UrlAsyncFetcher> http2_fetcher_;
+#endif
+
   DISALLOW_COPY_AND_ASSIGN(SerfUrlAsyncFetcher);
 };
 
@@ -343,6 +456,16 @@ class SerfFetch : public PoolElement<SerfFetch> {
   // Must be called after serf_context_run, with fetcher's mutex_ held.
   void CleanupIfError();
 
+  // Called when the pooled connection this fetch is queued on is closed
+  // before the fetch completed.  If may_retry and no part of the response
+  // has arrived, the fetch moves to another connection, once; otherwise it
+  // fails.
+  void ConnectionRetired(bool may_retry);
+
+  // Identifies the connections this fetch can share: the same scheme, host,
+  // port and, for https, SNI host.  Valid once Start has parsed the URL.
+  GoogleString ConnectionKey() const;
+
   // For use only by unit tests.  Calls ParseUrl(), then makes things available
   // for checking.
   void ParseUrlForTesting(bool* status,
@@ -359,31 +482,14 @@ class SerfFetch : public PoolElement<SerfFetch> {
   size_t bytes_received() const { return bytes_received_; }
   MessageHandler* message_handler() { return message_handler_; }
 
- private:
-  // Static functions used in callbacks.
-
-  // The code under SERF_HTTPS_FETCHING was contributed by Devin Anderson
-  // (surfacepatterns@gmail.com).
-  //
-  // Note this must be ifdef'd because calling serf_bucket_ssl_decrypt_create
-  // requires ssl_buckets.c in the link.  ssl_buckets.c requires openssl.
-#if SERF_HTTPS_FETCHING
-  static apr_status_t SSLCertValidate(void *data, int failures,
-                                   const serf_ssl_certificate_t *cert);
+  // Link used by SerfEventLoopFetcher's submission queue.
+  SerfFetch* next_submitted() const { return next_submitted_; }
+  void set_next_submitted(SerfFetch* next) { next_submitted_ = next; }
 
-  static apr_status_t SSLCertChainValidate(
-      void *data, int failures, int error_depth,
-      const serf_ssl_certificate_t * const *certs,
-      apr_size_t certs_count);
-#endif
+ private:
+  friend class SerfConnection;  // For HandleSSLCertValidation and the URL.
 
-  static apr_status_t ConnectionSetup(
-      apr_socket_t* socket, serf_bucket_t **read_bkt, serf_bucket_t **write_bkt,
-      void* setup_baton, apr_pool_t* pool);
-  static void ClosedConnection(serf_connection_t* conn,
-                               void* closed_baton,
-                               apr_status_t why,
-                               apr_pool_t* pool);
+  // Static functions used in callbacks.
   static serf_bucket_t* AcceptResponse(serf_request_t* request,
                                        serf_bucket_t* stream,
                                        void* acceptor_baton,
@@ -441,6 +547,12 @@ class SerfFetch : public PoolElement<SerfFetch> {
                                    apr_pool_t* pool);
   bool ParseUrl();
 
+  // Closes the connection_ this fetch owns, if any.
+  void CloseConnection();
+  // Detaches from the pooled connection_ and retires it, e.g. when this
+  // fetch gives up on its request.
+  void RetireConnection();
+
   SerfUrlAsyncFetcher* fetcher_;
   Timer* timer_;
   const GoogleString str_url_;
@@ -450,20 +562,24 @@ class SerfFetch : public PoolElement<SerfFetch> {
   MessageHandler* message_handler_;
 
   apr_pool_t* pool_;
-  serf_bucket_alloc_t* bucket_alloc_;
   apr_uri_t url_;
   const char* host_header_;  // in pool_
   const char* sni_host_;  // in pool_
-  serf_connection_t* connection_;
+
+  // Owned by this fetch unless pooled_connection_, in which case it is owned
+  // by fetcher_ and NULL once the fetch no longer needs it.
+  SerfConnection* connection_;
+  bool pooled_connection_;
+  bool moved_connection_;  // Whether ConnectionRetired retried the fetch.
   size_t bytes_received_;
   int64 fetch_start_ms_;
   int64 fetch_end_ms_;
 
-  // Variables used for HTTPS connection handling
-  bool using_https_;
-  serf_ssl_context_t* ssl_context_;
+  // Set when certificate validation fails on an HTTPS connection.
   const char* ssl_error_message_;
 
+  SerfFetch* next_submitted_;
+
   DISALLOW_COPY_AND_ASSIGN(SerfFetch);
 };
 
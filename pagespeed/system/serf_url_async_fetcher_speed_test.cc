@@ -0,0 +1,344 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Measures sequential fetch throughput of SerfUrlAsyncFetcher against a
+// loopback HTTP/1.1 server, with and without keep-alive connection pooling.
+// Each iteration is one complete fetch of a 1k response, so fetches/s is
+// 1e9 / Time(ns).  BM_SerfFetchNewConnection opens a connection per fetch,
+// as the fetcher does by default; BM_SerfFetchKeepAlive reuses one.
+//
+// BM_SerfFetchLatency* time the same fetches while a fetch from a second,
+// slow server is always outstanding, and print their p50 and p99 latency.
+// That is when handing fetches to a thread that is busy polling costs most;
+// the difference between the two modes is the latency each adds.
+//
+//   src/out/Release/mod_pagespeed_speed_test .SerfFetch
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "apr_network_io.h"
+#include "apr_pools.h"
+#include "base/logging.h"
+#include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/request_context.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/benchmark.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/google_message_handler.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stack_buffer.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+#include "pagespeed/system/serf_url_async_fetcher.h"
+#include "pagespeed/system/tcp_server_thread_for_testing.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int64 kFetchTimeoutMs = 10 * Timer::kSecondMs;
+const int kBodySize = 1024;
+const int64 kSlowResponseMs = 200;
+
+// Answers every request on a connection until the client closes it, after
+// delay_ms.
+class KeepAliveServerThread : public TcpServerThreadForTesting {
+ public:
+  KeepAliveServerThread(ThreadSystem* thread_system, int64 delay_ms)
+      : TcpServerThreadForTesting(0, "serf_speed_test_server", thread_system),
+        delay_ms_(delay_ms) {
+    ServeMultipleConnections();
+    response_ = StrCat("HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/plain\r\n"
+                       "Content-Length: ", IntegerToString(kBodySize), "\r\n"
+                       "\r\n");
+    response_.append(kBodySize, 'x');
+  }
+  virtual ~KeepAliveServerThread() { ShutDown(); }
+
+  void HandleClientConnection(apr_socket_t* sock) override {
+    apr_socket_opt_set(sock, APR_TCP_NODELAY, 1);
+    GoogleString pending;
+    char buffer[kStackBufferSize];
+    apr_size_t size = sizeof(buffer);
+    while (apr_socket_recv(sock, buffer, &size) == APR_SUCCESS) {
+      pending.append(buffer, size);
+      size_t end;
+      while ((end = pending.find("\r\n\r\n")) != GoogleString::npos) {
+        pending.erase(0, end + 4);
+        if (delay_ms_ > 0) {
+          usleep(delay_ms_ * Timer::kMsUs);
+        }
+        apr_size_t response_size = response_.size();
+        apr_socket_send(sock, response_.data(), &response_size);
+      }
+      size = sizeof(buffer);
+    }
+  }
+
+ private:
+  const int64 delay_ms_;
+  GoogleString response_;
+};
+
+class BlockingFetch : public StringAsyncFetch {
+ public:
+  explicit BlockingFetch(ThreadSystem* thread_system)
+      : StringAsyncFetch(RequestContext::NewTestRequestContext(thread_system)),
+        mutex_(thread_system->NewMutex()),
+        done_condvar_(mutex_->NewCondvar()),
+        done_(false) {
+  }
+
+  virtual void HandleDone(bool success) {
+    ScopedMutex lock(mutex_.get());
+    StringAsyncFetch::HandleDone(success);
+    done_ = true;
+    done_condvar_->Signal();
+  }
+
+  void Wait() {
+    ScopedMutex lock(mutex_.get());
+    while (!done_) {
+      done_condvar_->Wait();
+    }
+  }
+
+ private:
+  scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  scoped_ptr<ThreadSystem::Condvar> done_condvar_;
+  bool done_;
+};
+
+class SerfFetchTester {
+ public:
+  explicit SerfFetchTester(int keep_alive_connections_per_host)
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(Platform::CreateTimer()),
+        statistics_(thread_system_.get()) {
+    StopBenchmarkTiming();
+    apr_initialize();
+    apr_pool_create(&pool_, NULL);
+    SerfUrlAsyncFetcher::InitStats(&statistics_);
+    server_.reset(new KeepAliveServerThread(thread_system_.get(), 0));
+    CHECK(server_->Start());
+    url_ = StrCat("http://127.0.0.1:",
+                  IntegerToString(server_->GetListeningPort()), "/");
+    fetcher_.reset(new SerfUrlAsyncFetcher(
+        "", pool_, thread_system_.get(), &statistics_, timer_.get(),
+        kFetchTimeoutMs, &handler_));
+    fetcher_->SetKeepAliveOptions(keep_alive_connections_per_host,
+                                  keep_alive_connections_per_host,
+                                  kFetchTimeoutMs);
+  }
+
+  ~SerfFetchTester() {
+    // The fetcher must close its connections before the server can stop.
+    fetcher_.reset(NULL);
+    server_.reset(NULL);
+    apr_pool_destroy(pool_);
+    apr_terminate();
+    StartBenchmarkTiming();
+  }
+
+  void FetchSequentially(int iters) {
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; ++i) {
+      BlockingFetch fetch(thread_system_.get());
+      fetcher_->Fetch(url_, &handler_, &fetch);
+      fetch.Wait();
+      CHECK(fetch.success());
+      CHECK_EQ(static_cast<size_t>(kBodySize), fetch.buffer().size());
+    }
+    StopBenchmarkTiming();
+    fprintf(stdout, "%d fetches over %d connections\n", iters,
+            static_cast<int>(statistics_.GetVariable(
+                SerfStats::kSerfFetchConnectionCount)->Get()));
+  }
+
+ private:
+  scoped_ptr<ThreadSystem> thread_system_;
+  scoped_ptr<Timer> timer_;
+  SimpleStats statistics_;
+  GoogleMessageHandler handler_;
+  apr_pool_t* pool_;
+  scoped_ptr<KeepAliveServerThread> server_;
+  scoped_ptr<SerfUrlAsyncFetcher> fetcher_;
+  GoogleString url_;
+};
+
+static void BM_SerfFetchNewConnection(int iters) {
+  SerfFetchTester tester(0);
+  tester.FetchSequentially(iters);
+}
+BENCHMARK(BM_SerfFetchNewConnection);
+
+static void BM_SerfFetchKeepAlive(int iters) {
+  SerfFetchTester tester(1);
+  tester.FetchSequentially(iters);
+}
+BENCHMARK(BM_SerfFetchKeepAlive);
+
+class SerfLatencyTester {
+ public:
+  // event_loop_threads is passed to SetEventLoopThreads; 0 measures the
+  // threaded fetcher.
+  explicit SerfLatencyTester(int event_loop_threads)
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(Platform::CreateTimer()),
+        statistics_(thread_system_.get()),
+        mutex_(thread_system_->NewMutex()),
+        background_done_condvar_(mutex_->NewCondvar()),
+        stopping_(false),
+        background_done_(false) {
+    StopBenchmarkTiming();
+    apr_initialize();
+    apr_pool_create(&pool_, NULL);
+    SerfUrlAsyncFetcher::InitStats(&statistics_);
+    fast_server_.reset(new KeepAliveServerThread(thread_system_.get(), 0));
+    slow_server_.reset(new KeepAliveServerThread(thread_system_.get(),
+                                                 kSlowResponseMs));
+    CHECK(fast_server_->Start());
+    CHECK(slow_server_->Start());
+    fast_url_ = StrCat("http://127.0.0.1:",
+                       IntegerToString(fast_server_->GetListeningPort()), "/");
+    slow_url_ = StrCat("http://127.0.0.1:",
+                       IntegerToString(slow_server_->GetListeningPort()), "/");
+    fetcher_.reset(new SerfUrlAsyncFetcher(
+        "", pool_, thread_system_.get(), &statistics_, timer_.get(),
+        kFetchTimeoutMs, &handler_));
+    // Keep-alive, so each server sees a single connection.
+    fetcher_->SetKeepAliveOptions(1, 1, kFetchTimeoutMs);
+    fetcher_->SetEventLoopThreads(event_loop_threads);
+  }
+
+  ~SerfLatencyTester() {
+    fetcher_.reset(NULL);
+    fast_server_.reset(NULL);
+    slow_server_.reset(NULL);
+    apr_pool_destroy(pool_);
+    apr_terminate();
+    StartBenchmarkTiming();
+  }
+
+  void MeasureLatency(int iters) {
+    StartBackgroundFetch();
+    std::vector<int64> latencies_us;
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; ++i) {
+      BlockingFetch fetch(thread_system_.get());
+      int64 start_us = timer_->NowUs();
+      fetcher_->Fetch(fast_url_, &handler_, &fetch);
+      fetch.Wait();
+      latencies_us.push_back(timer_->NowUs() - start_us);
+      CHECK(fetch.success());
+    }
+    StopBenchmarkTiming();
+    StopBackgroundFetches();
+    std::sort(latencies_us.begin(), latencies_us.end());
+    fprintf(stdout, "%d fetches: p50 %ldus, p99 %ldus\n", iters,
+            static_cast<long>(latencies_us[iters / 2]),  // NOLINT
+            static_cast<long>(latencies_us[iters * 99 / 100]));  // NOLINT
+  }
+
+ private:
+  // Fetches from the slow server, then starts another such fetch.
+  class BackgroundFetch : public StringAsyncFetch {
+   public:
+    explicit BackgroundFetch(SerfLatencyTester* tester)
+        : StringAsyncFetch(RequestContext::NewTestRequestContext(
+              tester->thread_system_.get())),
+          tester_(tester) {
+    }
+
+    virtual void HandleDone(bool success) {
+      tester_->BackgroundFetchDone();
+      delete this;
+    }
+
+   private:
+    SerfLatencyTester* tester_;
+  };
+
+  void StartBackgroundFetch() {
+    fetcher_->Fetch(slow_url_, &handler_, new BackgroundFetch(this));
+  }
+
+  void BackgroundFetchDone() {
+    ScopedMutex lock(mutex_.get());
+    if (stopping_) {
+      background_done_ = true;
+      background_done_condvar_->Signal();
+    } else {
+      StartBackgroundFetch();
+    }
+  }
+
+  void StopBackgroundFetches() {
+    ScopedMutex lock(mutex_.get());
+    stopping_ = true;
+    while (!background_done_) {
+      background_done_condvar_->Wait();
+    }
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  scoped_ptr<Timer> timer_;
+  SimpleStats statistics_;
+  GoogleMessageHandler handler_;
+  apr_pool_t* pool_;
+  scoped_ptr<KeepAliveServerThread> fast_server_;
+  scoped_ptr<KeepAliveServerThread> slow_server_;
+  scoped_ptr<SerfUrlAsyncFetcher> fetcher_;
+  GoogleString fast_url_;
+  GoogleString slow_url_;
+  scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  scoped_ptr<ThreadSystem::Condvar> background_done_condvar_;
+  bool stopping_;
+  bool background_done_;
+};
+
+static void BM_SerfFetchLatencyThreaded(int iters) {
+  SerfLatencyTester tester(0);
+  tester.MeasureLatency(iters);
+}
+BENCHMARK(BM_SerfFetchLatencyThreaded);
+
+static void BM_SerfFetchLatencyEventLoop(int iters) {
+  SerfLatencyTester tester(1);
+  tester.MeasureLatency(iters);
+}
+BENCHMARK(BM_SerfFetchLatencyEventLoop);
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -34,6 +34,7 @@
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/dynamic_annotations.h"
+#include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
@@ -50,6 +51,7 @@
 #include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/request_headers.h"
 #include "pagespeed/kernel/http/response_headers.h"
+#include "pagespeed/kernel/thread/sequence.h"
 #include "pagespeed/kernel/util/gzip_inflater.h"
 #include "pagespeed/kernel/util/platform.h"
 #include "pagespeed/kernel/util/simple_stats.h"
@@ -137,6 +139,45 @@ class SerfTestFetch : public AsyncFetch {
   DISALLOW_COPY_AND_ASSIGN(SerfTestFetch);
 };
 
+// Holds the functions added to it until the test runs them, canceling any
+// left when destroyed.
+class HeldSequence : public Sequence {
+ public:
+  explicit HeldSequence(AbstractMutex* mutex) : mutex_(mutex) {}
+  virtual ~HeldSequence() {
+    for (int i = 0, n = functions_.size(); i < n; ++i) {
+      functions_[i]->CallCancel();
+    }
+  }
+
+  virtual void Add(Function* function) {
+    ScopedMutex lock(mutex_.get());
+    functions_.push_back(function);
+  }
+
+  int size() {
+    ScopedMutex lock(mutex_.get());
+    return functions_.size();
+  }
+
+  void RunAll() {
+    std::vector<Function*> functions;
+    {
+      ScopedMutex lock(mutex_.get());
+      functions.swap(functions_);
+    }
+    for (int i = 0, n = functions.size(); i < n; ++i) {
+      functions[i]->CallRun();
+    }
+  }
+
+ private:
+  scoped_ptr<AbstractMutex> mutex_;
+  std::vector<Function*> functions_;
+
+  DISALLOW_COPY_AND_ASSIGN(HeldSequence);
+};
+
 }  // namespace
 
 class SerfUrlAsyncFetcherTest : public ::testing::Test {
@@ -1129,4 +1170,174 @@ TEST_F(SerfUrlAsyncFetcherTestFakeWebServer, TestHangingGet) {
 #endif
 }
 
+// Serves any number of requests on each connection, so the fetcher can keep
+// its connections alive.
+class SerfUrlAsyncFetcherTestKeepAlive : public SerfUrlAsyncFetcherTest {
+ public:
+  class KeepAliveServerThread : public TcpServerThreadForTesting {
+   public:
+    explicit KeepAliveServerThread(ThreadSystem* thread_system)
+        : TcpServerThreadForTesting(0, "keep_alive_webserver", thread_system) {
+      ServeMultipleConnections();
+    }
+    virtual ~KeepAliveServerThread() { ShutDown(); }
+
+    void HandleClientConnection(apr_socket_t* sock) override {
+      static const char kResponse[] =
+          "HTTP/1.1 200 OK\r\n"
+          "Content-Type: text/plain\r\n"
+          "Content-Length: 15\r\n"
+          "\r\n"
+          "keep-alive body";
+      GoogleString pending;
+      char buffer[kStackBufferSize];
+      apr_size_t size = sizeof(buffer);
+      // Our requests have no body, so each ends with a blank line.
+      while (apr_socket_recv(sock, buffer, &size) == APR_SUCCESS) {
+        pending.append(buffer, size);
+        size_t end;
+        while ((end = pending.find("\r\n\r\n")) != GoogleString::npos) {
+          pending.erase(0, end + 4);
+          apr_size_t response_size = STATIC_STRLEN(kResponse);
+          apr_socket_send(sock, kResponse, &response_size);
+        }
+        size = sizeof(buffer);
+      }
+    }
+  };
+
+  void SetUp() override {
+    SerfUrlAsyncFetcherTest::SetUp();
+    server_.reset(new KeepAliveServerThread(thread_system_.get()));
+    ASSERT_TRUE(server_->Start());
+    GoogleString base = StrCat(
+        "http://127.0.0.1:", IntegerToString(server_->GetListeningPort()), "/");
+    first_ = AddTestUrl(StrCat(base, "a"), "keep-alive body");
+    AddTestUrl(StrCat(base, "b"), "keep-alive body");
+    last_ = AddTestUrl(StrCat(base, "c"), "keep-alive body");
+  }
+
+  void TearDown() override {
+    // Closing the fetcher's connections lets the server thread finish.
+    serf_url_async_fetcher_.reset(NULL);
+    server_.reset(NULL);
+    SerfUrlAsyncFetcherTest::TearDown();
+  }
+
+  // Fetches each test URL after the previous one is done.
+  void FetchSequentially() {
+    for (int idx = first_; idx <= last_; ++idx) {
+      prev_done_count = 0;
+      StartFetch(idx);
+      ASSERT_EQ(1, WaitTillDone(idx, idx));
+      ValidateFetches(idx, idx);
+    }
+  }
+
+  int64 Stat(const char* name) {
+    return statistics_->GetVariable(name)->Get();
+  }
+
+  scoped_ptr<KeepAliveServerThread> server_;
+  int first_;
+  int last_;
+};
+
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, ConnectionPerFetchByDefault) {
+  FetchSequentially();
+  EXPECT_EQ(3, Stat(SerfStats::kSerfFetchConnectionCount));
+  EXPECT_EQ(0, Stat(SerfStats::kSerfFetchConnectionReuseCount));
+}
+
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, ReusesIdleConnection) {
+  serf_url_async_fetcher_->SetKeepAliveOptions(2, 2, 10 * Timer::kSecondMs);
+  FetchSequentially();
+  EXPECT_EQ(1, Stat(SerfStats::kSerfFetchConnectionCount));
+  EXPECT_EQ(2, Stat(SerfStats::kSerfFetchConnectionReuseCount));
+  ValidateMonitoringStats(3, 0);
+}
+
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, QueuesBeyondPerHostLimit) {
+  serf_url_async_fetcher_->SetKeepAliveOptions(1, 1, 10 * Timer::kSecondMs);
+  EXPECT_TRUE(TestFetch(first_, last_));
+  EXPECT_EQ(1, Stat(SerfStats::kSerfFetchConnectionCount));
+  EXPECT_EQ(2, Stat(SerfStats::kSerfFetchConnectionReuseCount));
+}
+
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, ClosesIdleConnectionsBeyondLimit) {
+  // With no idle connections allowed, each is closed as soon as its fetch
+  // completes.
+  serf_url_async_fetcher_->SetKeepAliveOptions(2, 0, 10 * Timer::kSecondMs);
+  FetchSequentially();
+  EXPECT_EQ(3, Stat(SerfStats::kSerfFetchConnectionCount));
+  EXPECT_EQ(0, Stat(SerfStats::kSerfFetchConnectionReuseCount));
+}
+
+// The event-loop tests use the keep-alive server above, which serves one
+// connection at a time, so they either share a connection or close each.
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, EventLoopFetchesSequentially) {
+  serf_url_async_fetcher_->SetEventLoopThreads(2);
+  FetchSequentially();
+  EXPECT_EQ(3, Stat(SerfStats::kSerfFetchConnectionCount));
+  ValidateMonitoringStats(3, 0);
+}
+
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, EventLoopFetchesConcurrently) {
+  serf_url_async_fetcher_->SetKeepAliveOptions(1, 1, 10 * Timer::kSecondMs);
+  serf_url_async_fetcher_->SetEventLoopThreads(1);
+  EXPECT_TRUE(TestFetch(first_, last_));
+  EXPECT_EQ(1, Stat(SerfStats::kSerfFetchConnectionCount));
+  EXPECT_EQ(2, Stat(SerfStats::kSerfFetchConnectionReuseCount));
+}
+
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, EventLoopWaitForActiveFetches) {
+  serf_url_async_fetcher_->SetEventLoopThreads(2);
+  StartFetches(first_, last_);
+  EXPECT_TRUE(serf_url_async_fetcher_->WaitForActiveFetches(
+      fetcher_timeout_ms_, &message_handler_,
+      SerfUrlAsyncFetcher::kThreadedOnly));
+  EXPECT_EQ(3, CountCompletedFetches(first_, last_));
+  ValidateFetches(first_, last_);
+}
+
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, EventLoopShutDownFailsFetches) {
+  serf_url_async_fetcher_->SetEventLoopThreads(1);
+  serf_url_async_fetcher_->ShutDown();
+  StartFetch(first_);
+  ASSERT_EQ(1, WaitTillDone(first_, first_));
+  EXPECT_FALSE(fetches_[first_]->success());
+}
+
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, EventLoopDeliversOnSequence) {
+  serf_url_async_fetcher_->SetEventLoopThreads(1);
+  HeldSequence sequence(thread_system_->NewMutex());
+  fetches_[first_]->Reset();
+  serf_url_async_fetcher_->FetchOnSequence(
+      urls_[first_], &message_handler_, fetches_[first_], &sequence);
+  while (sequence.size() == 0) {
+    YieldToThread();
+  }
+  // The whole response waits on the sequence.
+  EXPECT_FALSE(fetches_[first_]->IsDone());
+  EXPECT_TRUE(fetches_[first_]->buffer().empty());
+  sequence.RunAll();
+  ASSERT_TRUE(fetches_[first_]->IsDone());
+  ValidateFetches(first_, first_);
+}
+
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, EventLoopSequenceCancelFailsFetch) {
+  serf_url_async_fetcher_->SetEventLoopThreads(1);
+  scoped_ptr<HeldSequence> sequence(
+      new HeldSequence(thread_system_->NewMutex()));
+  fetches_[first_]->Reset();
+  serf_url_async_fetcher_->FetchOnSequence(
+      urls_[first_], &message_handler_, fetches_[first_], sequence.get());
+  while (sequence->size() == 0) {
+    YieldToThread();
+  }
+  sequence.reset(NULL);
+  ASSERT_TRUE(fetches_[first_]->IsDone());
+  EXPECT_FALSE(fetches_[first_]->success());
+}
+
 }  // namespace net_instaweb
@@ -51,7 +51,9 @@
 #include "pagespeed/kernel/cache/compressed_cache.h"
 #include "pagespeed/kernel/cache/fallback_cache.h"
 #include "pagespeed/kernel/cache/file_cache.h"
+#include "pagespeed/kernel/cache/lru_cache.h"
 #include "pagespeed/kernel/cache/purge_context.h"
+#include "pagespeed/kernel/cache/threadsafe_cache.h"
 #include "pagespeed/kernel/cache/write_through_cache.h"
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
 #include "pagespeed/kernel/thread/slow_worker.h"
@@ -516,6 +518,16 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
   }
 
   http_cache->set_max_cacheable_response_content_length(max_content_length);
+  if (config->http_cache_decoded_copies_kb() > 0) {
+    // Only the wrapper is thread-safe; both are owned by the server context.
+    LRUCache* decoded_lru = new LRUCache(
+        config->http_cache_decoded_copies_kb() * 1024);
+    server_context->DeleteCacheOnDestruction(decoded_lru);
+    ThreadsafeCache* decoded_cache = new ThreadsafeCache(
+        decoded_lru, factory_->thread_system()->NewMutex());
+    server_context->DeleteCacheOnDestruction(decoded_cache);
+    http_cache->set_decoded_cache(decoded_cache);
+  }
   server_context->set_http_cache(http_cache);
 
   // And now the metadata cache. If we only have one level, it will be in
@@ -21,13 +21,14 @@
 #include "pagespeed/system/system_rewrite_driver_factory.h"
 
 #include <sys/prctl.h>
-#include <algorithm>  // for min
+#include <algorithm>  // for min, max
 #include <cstdio>
 #include <cstdlib>
 #include <map>
 #include <memory>
 #include <set>
 #include <utility>  // for pair
+#include <vector>
 
 #include "apr_general.h"
 #include "base/logging.h"
@@ -42,8 +43,15 @@
 #include "net/instaweb/rewriter/public/static_asset_manager.h"
 #include "pagespeed/controller/central_controller_rpc_client.h"
 #include "pagespeed/controller/central_controller_rpc_server.h"
+#include "pagespeed/controller/cost_based_expensive_operation_controller.h"
+#include "pagespeed/controller/expensive_operation_controller.h"
 #include "pagespeed/controller/popularity_contest_schedule_rewrite_controller.h"
 #include "pagespeed/controller/queued_expensive_operation_controller.h"
+#include "pagespeed/controller/schedule_rewrite_controller.h"
+#include "pagespeed/controller/sharded_schedule_rewrite_controller.h"
+#include "pagespeed/controller/shared_mem_central_controller.h"
+#include "pagespeed/controller/shared_mem_controller_channel.h"
+#include "pagespeed/controller/shared_mem_controller_server.h"
 #include "pagespeed/system/controller_manager.h"
 #include "pagespeed/system/controller_process.h"
 #include "pagespeed/system/in_place_resource_recorder.h"
@@ -68,7 +76,9 @@
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/sharedmem/shared_circular_buffer.h"
+#include "pagespeed/kernel/sharedmem/shared_mem_futex.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_statistics.h"
+#include "pagespeed/kernel/thread/cpu_affinity.h"
 #include "pagespeed/kernel/thread/pthread_shared_mem.h"
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
 #include "pagespeed/kernel/util/input_file_nonce_generator.h"
@@ -87,6 +97,10 @@ const char kUsePerVHostStatistics[] = "UsePerVHostStatistics";
 const char kInstallCrashHandler[] = "InstallCrashHandler";
 const char kNumRewriteThreads[] = "NumRewriteThreads";
 const char kNumExpensiveRewriteThreads[] = "NumExpensiveRewriteThreads";
+const char kRewriteDriverPoolWarmSize[] = "RewriteDriverPoolWarmSize";
+const char kExpensiveRewriteQueueTimeTargetMs[] =
+    "ExpensiveRewriteQueueTimeTargetMs";
+const char kRewriteWorkerCpus[] = "RewriteWorkerCpus";
 const char kForceCaching[] = "ForceCaching";
 const char kListOutstandingUrlsOnError[] = "ListOutstandingUrlsOnError";
 const char kMessageBufferSize[] = "MessageBufferSize";
@@ -114,7 +128,9 @@ SystemRewriteDriverFactory::SystemRewriteDriverFactory(
       install_crash_handler_(false),
       thread_counts_finalized_(false),
       num_rewrite_threads_(-1),
-      num_expensive_rewrite_threads_(-1) {
+      num_expensive_rewrite_threads_(-1),
+      rewrite_driver_pool_warm_size_(0),
+      expensive_rewrite_queue_time_target_ms_(0) {
   if (shared_mem_runtime == NULL) {
 #ifdef PAGESPEED_SUPPORT_POSIX_SHARED_MEM
     shared_mem_runtime = new PthreadSharedMem();
@@ -240,17 +256,30 @@ QueuedWorkerPool* SystemRewriteDriverFactory::CreateWorkerPool(
     case kHtmlWorkers:
       // In Apache this will effectively be 0, as it doesn't use HTML threads.
       return new QueuedWorkerPool(1, name, thread_system());
-    case kRewriteWorkers:
-      return new QueuedWorkerPool(num_rewrite_threads_, name, thread_system());
-    case kLowPriorityRewriteWorkers:
-      return new QueuedWorkerPool(num_expensive_rewrite_threads_,
-                                  name,
-                                  thread_system());
+    case kRewriteWorkers: {
+      QueuedWorkerPool* workers =
+          new QueuedWorkerPool(num_rewrite_threads_, name, thread_system());
+      workers->EnableWorkStealing();
+      workers->EnableCoreAffinity(rewrite_worker_cpus_);
+      return workers;
+    }
+    case kLowPriorityRewriteWorkers: {
+      QueuedWorkerPool* workers =
+          new QueuedWorkerPool(num_expensive_rewrite_threads_,
+                               name,
+                               thread_system());
+      workers->EnableCoreAffinity(rewrite_worker_cpus_);
+      return workers;
+    }
     default:
       return RewriteDriverFactory::CreateWorkerPool(pool, name);
   }
 }
 
+int64 SystemRewriteDriverFactory::LowPriorityQueueTimeTargetMs() const {
+  return expensive_rewrite_queue_time_target_ms_;
+}
+
 void SystemRewriteDriverFactory::ParentOrChildInit() {
   SharedCircularBufferInit(is_root_process_);
 }
@@ -282,16 +311,59 @@ void SystemRewriteDriverFactory::PrepareControllerProcess() {
 void SystemRewriteDriverFactory::StartController(
     const SystemRewriteOptions& options) {
   if (!options.controller_port().empty()) {
+    ScheduleRewriteController* rewrite_controller;
+    if (options.popularity_contest_shards() > 1) {
+      rewrite_controller = new ShardedScheduleRewriteController(
+          thread_system(), statistics(), timer(),
+          options.popularity_contest_shards(),
+          options.popularity_contest_max_inflight_requests(),
+          options.popularity_contest_max_queue_size());
+    } else {
+      rewrite_controller = new PopularityContestScheduleRewriteController(
+          thread_system(), statistics(), timer(),
+          options.popularity_contest_max_inflight_requests(),
+          options.popularity_contest_max_queue_size());
+    }
+    ExpensiveOperationController* expensive_operation_controller;
+    if (options.expensive_operation_cpu_budget_ms() > 0) {
+      // Like the queued controller, the queue is unbounded.
+      expensive_operation_controller =
+          new CostBasedExpensiveOperationController(
+              options.expensive_operation_cpu_budget_ms() * Timer::kMsUs,
+              Timer::kSecondMs, -1 /* max_queue_size */, thread_system(),
+              timer(), statistics());
+    } else {
+      expensive_operation_controller = new QueuedExpensiveOperationController(
+          options.image_max_rewrites_at_once(), thread_system(), statistics());
+    }
     std::unique_ptr<CentralControllerRpcServer> controller(
         new CentralControllerRpcServer(
-            options.controller_port(), new QueuedExpensiveOperationController(
-                                           options.image_max_rewrites_at_once(),
-                                           thread_system(), statistics()),
-            new PopularityContestScheduleRewriteController(
-                thread_system(), statistics(), timer(),
-                options.popularity_contest_max_inflight_requests(),
-                options.popularity_contest_max_queue_size()),
-            message_handler()));
+            options.controller_port(), expensive_operation_controller,
+            rewrite_controller, message_handler()));
+    if (options.controller_shared_mem() && SharedMemFutex::Supported()) {
+      // The controller is always on this host, so workers can skip gRPC. The
+      // segment outlives controller restarts, so only create it once.
+      if (controller_channel_.get() == NULL) {
+        controller_channel_.reset(new SharedMemControllerChannel(
+            shared_mem_runtime(), ControllerSegmentName()));
+        if (!controller_channel_->InitSegment(true, message_handler())) {
+          controller_channel_.reset(NULL);
+        }
+      }
+      SharedMemControllerChannel* server_channel = NULL;
+      if (controller_channel_.get() != NULL) {
+        server_channel = new SharedMemControllerChannel(
+            shared_mem_runtime(), ControllerSegmentName());
+        if (!server_channel->InitSegment(false, message_handler())) {
+          delete server_channel;
+          server_channel = NULL;
+        }
+      }
+      if (server_channel != NULL) {
+        controller->set_shared_mem_server(new SharedMemControllerServer(
+            server_channel, thread_system(), timer(), message_handler()));
+      }
+    }
     // In the forked process, this call starts a new event loop and never
     // returns.
     ControllerManager::ForkControllerProcess(
@@ -377,15 +449,33 @@ SystemRewriteDriverFactory::GetCentralController(
   }
 
   if (central_controller_ == nullptr) {
-    central_controller_ = std::make_shared<CentralControllerRpcClient>(
+    CentralControllerRpcClient* rpc_client = new CentralControllerRpcClient(
         conf->controller_port(),
         conf->popularity_contest_max_queue_size() +
             conf->popularity_contest_max_inflight_requests(),
         thread_system(), timer(), statistics(), message_handler());
+    if (controller_channel_.get() != NULL) {
+      // The root process set up a shared memory transport for us; gRPC
+      // handles whatever doesn't fit through it.
+      scoped_ptr<SharedMemControllerChannel> channel(
+          new SharedMemControllerChannel(shared_mem_runtime(),
+                                         ControllerSegmentName()));
+      if (channel->InitSegment(false, message_handler())) {
+        central_controller_ = std::make_shared<SharedMemCentralController>(
+            channel.release(), rpc_client, thread_system(), message_handler());
+      }
+    }
+    if (central_controller_ == nullptr) {
+      central_controller_.reset(rpc_client);
+    }
   }
   return central_controller_;
 }
 
+GoogleString SystemRewriteDriverFactory::ControllerSegmentName() {
+  return StrCat(filename_prefix(), "central_controller");
+}
+
 // TODO(jmarantz): make this per-vhost.
 void SystemRewriteDriverFactory::SharedCircularBufferInit(bool is_root) {
   // Set buffer size to 0 means turning it off
@@ -415,7 +505,10 @@ SystemRewriteDriverFactory::ParseAndSetOption1(StringPiece option,
       StringCaseEqual(option, kUsePerVHostStatistics) ||
       StringCaseEqual(option, kInstallCrashHandler) ||
       StringCaseEqual(option, kNumRewriteThreads) ||
-      StringCaseEqual(option, kNumExpensiveRewriteThreads)) {
+      StringCaseEqual(option, kNumExpensiveRewriteThreads) ||
+      StringCaseEqual(option, kRewriteDriverPoolWarmSize) ||
+      StringCaseEqual(option, kExpensiveRewriteQueueTimeTargetMs) ||
+      StringCaseEqual(option, kRewriteWorkerCpus)) {
     if (!process_scope) {
       *msg = StrCat("'", option, "' is global and can't be set at this scope.");
       return RewriteOptions::kOptionValueInvalid;
@@ -441,6 +534,14 @@ SystemRewriteDriverFactory::ParseAndSetOption1(StringPiece option,
   if (StringCaseEqual(option, kStaticAssetPrefix)) {
     set_static_asset_prefix(arg);
     return RewriteOptions::kOptionOk;
+  } else if (StringCaseEqual(option, kRewriteWorkerCpus)) {
+    std::vector<int> cpus;
+    if (!CpuAffinity::ParseCpuList(arg, &cpus)) {
+      *msg = "must be 'all' or a list of CPUs, such as 0-3,8";
+      return RewriteOptions::kOptionValueInvalid;
+    }
+    set_rewrite_worker_cpus(cpus);
+    return RewriteOptions::kOptionOk;
   }
 
   // Most of our options take booleans, so just parse once.
@@ -470,6 +571,8 @@ SystemRewriteDriverFactory::ParseAndSetOption1(StringPiece option,
   // Values of 0 have special meanings:
   //   Num(Expensive)RewriteThreads: autodetect (see AutoDetectThreadCounts())
   //   MessageBufferSize: disable the message buffer
+  //   RewriteDriverPoolWarmSize: don't pre-construct any drivers
+  //   ExpensiveRewriteQueueTimeTargetMs: no queue-time load shedding
   int int_value = 0;
   RewriteOptions::OptionSettingResult parsed_as_int =
       RewriteOptions::ParseFromString(arg, &int_value) ?
@@ -483,6 +586,12 @@ SystemRewriteDriverFactory::ParseAndSetOption1(StringPiece option,
   } else if (StringCaseEqual(option, kMessageBufferSize)) {
     set_message_buffer_size(int_value);
     return parsed_as_int;
+  } else if (StringCaseEqual(option, kRewriteDriverPoolWarmSize)) {
+    set_rewrite_driver_pool_warm_size(int_value);
+    return parsed_as_int;
+  } else if (StringCaseEqual(option, kExpensiveRewriteQueueTimeTargetMs)) {
+    set_expensive_rewrite_queue_time_target_ms(int_value);
+    return parsed_as_int;
   }
 
   LOG(FATAL) << "Unknown options should have been handled in scope checking.";
@@ -614,6 +723,10 @@ void SystemRewriteDriverFactory::ShutDown() {
     if (shared_circular_buffer_ != NULL) {
       shared_circular_buffer_->GlobalCleanup(&handler);
     }
+
+    if (controller_channel_.get() != NULL) {
+      controller_channel_->GlobalCleanup(message_handler());
+    }
   }
 }
 
@@ -641,7 +754,20 @@ GoogleString SystemRewriteDriverFactory::GetFetcherKey(
     StrAppend(&key,
               "\nhttps: ", config->https_options(),
               "\ncert_dir: ", config->ssl_cert_directory(),
-              "\ncert_file: ", config->ssl_cert_file());
+              "\ncert_file: ", config->ssl_cert_file(),
+              "\nh2_origins: ", config->http2_prior_knowledge_origins());
+    StrAppend(&key,
+              "\nkeep_alive: ",
+              IntegerToString(config->fetch_keep_alive_connections_per_host()),
+              "/",
+              IntegerToString(config->fetch_keep_alive_max_idle_per_host()),
+              "/",
+              Integer64ToString(config->fetch_keep_alive_idle_timeout_ms()),
+              "\nevent_loops: ",
+              IntegerToString(config->fetch_event_loop_threads()));
+    StrAppend(&key, "\nadaptive_max_per_host: ",
+              IntegerToString(
+                  config->fetch_adaptive_concurrency_max_per_host()));
   }
 
   return key;
@@ -673,9 +799,15 @@ UrlAsyncFetcher* SystemRewriteDriverFactory::GetFetcher(
         // Unfortunately, we need stats for load-shedding.
         if (config->statistics_enabled()) {
           TakeOwnership(fetcher);
-          fetcher = new RateControllingUrlAsyncFetcher(
-              fetcher, max_queue_size(), requests_per_host(), queued_per_host(),
-              thread_system(), statistics());
+          RateControllingUrlAsyncFetcher* rate_fetcher =
+              new RateControllingUrlAsyncFetcher(
+                  fetcher, max_queue_size(), requests_per_host(),
+                  queued_per_host(), thread_system(), statistics());
+          if (config->fetch_adaptive_concurrency_max_per_host() > 0) {
+            rate_fetcher->rate_controller()->EnableAdaptiveLimits(
+                timer(), config->fetch_adaptive_concurrency_max_per_host());
+          }
+          fetcher = rate_fetcher;
         } else {
           message_handler()->Message(
               kError, "Can't enable fetch rate-limiting without statistics");
@@ -701,6 +833,20 @@ UrlAsyncFetcher* SystemRewriteDriverFactory::AllocateFetcher(
   serf->SetHttpsOptions(config->https_options());
   serf->SetSslCertificatesDir(config->ssl_cert_directory());
   serf->SetSslCertificatesFile(config->ssl_cert_file());
+  serf->SetHttp2PriorKnowledgeOrigins(
+      config->http2_prior_knowledge_origins());
+  int keep_alive_connections = config->fetch_keep_alive_connections_per_host();
+  if (keep_alive_connections < 0) {
+    // One connection for each fetch RateControllingUrlAsyncFetcher lets
+    // through to a host at a time, so pooling never makes a fetch wait.
+    keep_alive_connections = std::max(
+        requests_per_host(), config->fetch_adaptive_concurrency_max_per_host());
+  }
+  serf->SetKeepAliveOptions(keep_alive_connections,
+                            config->fetch_keep_alive_max_idle_per_host(),
+                            config->fetch_keep_alive_idle_timeout_ms());
+  // Last, as the event loops copy the configuration above.
+  serf->SetEventLoopThreads(config->fetch_event_loop_threads());
   return serf;
 }
 
@@ -754,6 +900,11 @@ void SystemRewriteDriverFactory::AutoDetectThreadCounts() {
     return;
   }
 
+  if (!rewrite_worker_cpus_.empty() && (num_rewrite_threads_ <= 0)) {
+    // One rewrite thread per core.
+    num_rewrite_threads_ = rewrite_worker_cpus_.size();
+  }
+
   if (IsServerThreaded()) {
     if (num_rewrite_threads_ <= 0) {
       num_rewrite_threads_ = 4;
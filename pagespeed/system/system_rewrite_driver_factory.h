@@ -48,6 +48,7 @@ class NonceGenerator;
 class ProcessContext;
 class ServerContext;
 class SharedCircularBuffer;
+class SharedMemControllerChannel;
 class SharedMemStatistics;
 class StaticAssetManager;
 class SystemCaches;
@@ -233,6 +234,34 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
   void set_num_expensive_rewrite_threads(int x) {
     num_expensive_rewrite_threads_ = x;
   }
+  // Number of RewriteDrivers each server context with rewriting enabled
+  // constructs up front, and keeps, in each child process.  0 (the default)
+  // disables pre-construction.
+  int rewrite_driver_pool_warm_size() const {
+    return rewrite_driver_pool_warm_size_;
+  }
+  void set_rewrite_driver_pool_warm_size(int x) {
+    rewrite_driver_pool_warm_size_ = x;
+  }
+  // How long work may wait for an expensive-rewrite thread, in ms, before
+  // persistent queueing causes it to be dropped.  0 (the default) disables
+  // such load shedding.
+  int expensive_rewrite_queue_time_target_ms() const {
+    return expensive_rewrite_queue_time_target_ms_;
+  }
+  void set_expensive_rewrite_queue_time_target_ms(int x) {
+    expensive_rewrite_queue_time_target_ms_ = x;
+  }
+  // CPUs to pin rewrite worker threads to, one thread per core unless
+  // NumRewriteThreads says otherwise; see
+  // QueuedWorkerPool::EnableCoreAffinity.  Empty (the default) leaves
+  // scheduling to the OS.
+  const std::vector<int>& rewrite_worker_cpus() const {
+    return rewrite_worker_cpus_;
+  }
+  void set_rewrite_worker_cpus(const std::vector<int>& x) {
+    rewrite_worker_cpus_ = x;
+  }
   bool use_per_vhost_statistics() const {
     return use_per_vhost_statistics_;
   }
@@ -297,6 +326,7 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
   virtual void SetupCaches(ServerContext* server_context);
   virtual QueuedWorkerPool* CreateWorkerPool(WorkerPoolCategory pool,
                                              StringPiece name);
+  virtual int64 LowPriorityQueueTimeTargetMs() const;
 
   // TODO(jefftk): create SystemMessageHandler and get rid of these hooks.
   virtual void SetupMessageHandlers() {}
@@ -336,6 +366,9 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
       NamedLockManager* lock_manager) override;
 
  private:
+  // Name of the segment used by SharedMemControllerChannel.
+  GoogleString ControllerSegmentName();
+
   // Build global shared-memory statistics, taking ownership.  This is invoked
   // if at least one server context (global or VirtualHost) enables statistics.
   Statistics* SetUpGlobalSharedMemStatistics(
@@ -361,6 +394,10 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
   StringVector local_shm_stats_segment_names_;
   scoped_ptr<AbstractSharedMem> shared_mem_runtime_;
   scoped_ptr<SharedCircularBuffer> shared_circular_buffer_;
+  // Created by the root process if workers should reach the central
+  // controller through shared memory; children inherit it as a flag to
+  // attach their own.
+  scoped_ptr<SharedMemControllerChannel> controller_channel_;
 
   bool statistics_frozen_;
   bool is_root_process_;
@@ -417,7 +454,11 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
   int num_rewrite_threads_;
   int num_expensive_rewrite_threads_;
 
-  std::shared_ptr<CentralControllerRpcClient> central_controller_;
+  int rewrite_driver_pool_warm_size_;
+  int expensive_rewrite_queue_time_target_ms_;
+  std::vector<int> rewrite_worker_cpus_;
+
+  std::shared_ptr<CentralController> central_controller_;
 
   DISALLOW_COPY_AND_ASSIGN(SystemRewriteDriverFactory);
 };
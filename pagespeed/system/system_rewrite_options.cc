@@ -40,6 +40,17 @@ const int64 kDefaultRedisDatabaseIndex = 0;
 const int64 kDefaultRedisTTLSec = -1;
 
 const char kFetchHttps[] = "FetchHttps";
+const char kFetchHttp2PriorKnowledgeOrigins[] =
+    "FetchHttp2PriorKnowledgeOrigins";
+const char kFetchKeepAliveConnectionsPerHost[] =
+    "FetchKeepAliveConnectionsPerHost";
+const char kFetchKeepAliveMaxIdlePerHost[] = "FetchKeepAliveMaxIdlePerHost";
+const char kFetchKeepAliveIdleTimeoutMs[] = "FetchKeepAliveIdleTimeoutMs";
+const char kFetchEventLoopThreads[] = "FetchEventLoopThreads";
+const char kFetchAdaptiveConcurrencyMaxPerHost[] =
+    "FetchAdaptiveConcurrencyMaxPerHost";
+const char kHttpCacheDecodedCopiesKb[] = "HttpCacheDecodedCopiesKb";
+const char kMergedOptionsCacheKb[] = "MergedOptionsCacheKb";
 
 }  // namespace
 
@@ -49,6 +60,12 @@ const char SystemRewriteOptions::kPopularityContestMaxInFlight[] =
     "ExperimentalPopularityContestMaxInFlight";
 const char SystemRewriteOptions::kPopularityContestMaxQueueSize[] =
     "ExperimentalPopularityContestMaxQueueSize";
+const char SystemRewriteOptions::kPopularityContestShards[] =
+    "ExperimentalPopularityContestShards";
+const char SystemRewriteOptions::kCentralControllerSharedMem[] =
+    "CentralControllerSharedMem";
+const char SystemRewriteOptions::kExpensiveOperationCpuBudgetMs[] =
+    "ExperimentalExpensiveOperationCpuBudgetMs";
 const char SystemRewriteOptions::kStaticAssetCDN[] = "StaticAssetCDN";
 const char SystemRewriteOptions::kRedisServer[] = "RedisServer";
 const char SystemRewriteOptions::kRedisReconnectionDelayMs[] =
@@ -202,6 +219,18 @@ void SystemRewriteOptions::AddProperties() {
                     RewriteOptions::kLruCacheKbPerProcess,
                     "Set the total size, in KB, of the per-process in-memory "
                         "LRU cache", true);
+  AddSystemProperty(0, &SystemRewriteOptions::http_cache_decoded_copies_kb_,
+                    "ahcdc", kHttpCacheDecodedCopiesKb,
+                    "Size, in KB, of an in-memory cache of inflated copies of "
+                        "gzipped HTTP cache entries, used when serving "
+                        "clients that do not accept gzip.  0 disables it.",
+                    true);
+  AddSystemProperty(0, &SystemRewriteOptions::merged_options_cache_kb_,
+                    "amock", kMergedOptionsCacheKb,
+                    "Size, in KB, of an in-memory cache of global options "
+                        "merged with query-param and request-header "
+                        "overrides.  0 disables it.",
+                    true);
   AddSystemProperty("", &SystemRewriteOptions::cache_flush_filename_, "acff",
                     RewriteOptions::kCacheFlushFilename,
                     "Name of file to check for timestamp updates used to flush "
@@ -222,6 +251,44 @@ void SystemRewriteOptions::AddProperties() {
                     kFetchHttps, "Controls direct fetching of HTTPS resources."
                     "  Value is comma-separated list of keywords: "
                     SERF_HTTPS_KEYWORDS, false);
+  AddSystemProperty("",
+                    &SystemRewriteOptions::http2_prior_knowledge_origins_,
+                    "fh2po", kFetchHttp2PriorKnowledgeOrigins,
+                    "Comma-separated ip[:port] origins known to serve "
+                    "cleartext HTTP/2 (h2c with prior knowledge); fetches "
+                    "from them are multiplexed over one connection per "
+                    "origin.  Other origins, including https ones, are "
+                    "fetched over HTTP/1.1 as before.  Needs a build with "
+                    "enable_http2_fetcher=1.", false);
+  AddSystemProperty(
+      0, &SystemRewriteOptions::fetch_keep_alive_connections_per_host_,
+      "fkach", kFetchKeepAliveConnectionsPerHost,
+      "Maximum number of keep-alive connections to reuse for fetches from "
+      "each origin; 0 opens a connection per fetch, -1 matches the per-host "
+      "fetch rate limit.", true);
+  AddSystemProperty(2,
+                    &SystemRewriteOptions::fetch_keep_alive_max_idle_per_host_,
+                    "fkami", kFetchKeepAliveMaxIdlePerHost,
+                    "Maximum number of idle keep-alive connections to keep "
+                    "open to each origin.", true);
+  AddSystemProperty(4 * Timer::kSecondMs,
+                    &SystemRewriteOptions::fetch_keep_alive_idle_timeout_ms_,
+                    "fkait", kFetchKeepAliveIdleTimeoutMs,
+                    "Time after which an idle keep-alive connection is "
+                    "closed (ms); keep this below the origin's own keep-alive "
+                    "timeout.", true);
+  AddSystemProperty(0, &SystemRewriteOptions::fetch_event_loop_threads_,
+                    "felt", kFetchEventLoopThreads,
+                    "Number of event-loop threads to run origin fetches on; "
+                    "0 uses a single fetch thread.", true);
+  AddSystemProperty(0,
+                    &SystemRewriteOptions::
+                        fetch_adaptive_concurrency_max_per_host_,
+                    "facmh", kFetchAdaptiveConcurrencyMaxPerHost,
+                    "If positive, tune each origin's rate-limited background "
+                    "fetch concurrency from its latency and errors, up to "
+                    "this many at once; 0 keeps a fixed per-origin limit.",
+                    true);
   AddSystemProperty("", &SystemRewriteOptions::ssl_cert_directory_, "assld",
                     RewriteOptions::kSslCertDirectory,
                     "Directory to find SSL certificates.", false);
@@ -266,6 +333,26 @@ void SystemRewriteOptions::AddProperties() {
       1000, &SystemRewriteOptions::popularity_contest_max_queue_size_, "pcq",
       SystemRewriteOptions::kPopularityContestMaxQueueSize, kProcessScopeStrict,
       "Max number of queued rewrites allowed in the popularity contest", false);
+  AddSystemProperty(
+      1, &SystemRewriteOptions::popularity_contest_shards_, "pcs",
+      SystemRewriteOptions::kPopularityContestShards, kProcessScopeStrict,
+      "Number of independent shards the popularity contest is split into, "
+      "each with a proportional share of the in-flight and queue limits",
+      false);
+  AddSystemProperty(
+      true, &SystemRewriteOptions::controller_shared_mem_, "ccsm",
+      SystemRewriteOptions::kCentralControllerSharedMem, kProcessScopeStrict,
+      "Whether worker processes talk to the central controller through "
+      "shared memory rather than over its port, when both are on the same "
+      "host", false);
+  AddSystemProperty(
+      0, &SystemRewriteOptions::expensive_operation_cpu_budget_ms_, "eocb",
+      SystemRewriteOptions::kExpensiveOperationCpuBudgetMs,
+      kProcessScopeStrict,
+      "Milliseconds of CPU per second the central controller lets expensive "
+      "operations such as image rewrites use, estimated from the size of "
+      "their inputs. 0 limits them by count, with ImageMaxRewritesAtOnce, "
+      "instead", false);
   AddSystemProperty(false, &SystemRewriteOptions::disable_loopback_routing_,
                     "adlr",
                     "DangerPermitFetchFromUnknownHosts",
@@ -385,6 +472,16 @@ bool SystemRewriteOptions::HttpsOptions::SetFromString(
   return success;
 }
 
+bool SystemRewriteOptions::Http2PriorKnowledgeOriginsOption::SetFromString(
+    StringPiece value, GoogleString* error_detail) {
+  if (!SerfUrlAsyncFetcher::ValidateHttp2PriorKnowledgeOrigins(
+          value, error_detail)) {
+    return false;
+  }
+  set(value.as_string());
+  return true;
+}
+
 bool SystemRewriteOptions::StaticAssetCDNOptions::SetFromString(
     StringPiece value, GoogleString* error_detail) {
   StringPieceVector args;
@@ -48,6 +48,9 @@ class SystemRewriteOptions : public RewriteOptions {
   static const char kCentralControllerPort[];
   static const char kPopularityContestMaxInFlight[];
   static const char kPopularityContestMaxQueueSize[];
+  static const char kPopularityContestShards[];
+  static const char kCentralControllerSharedMem[];
+  static const char kExpensiveOperationCpuBudgetMs[];
   static const char kStaticAssetCDN[];
   static const char kRedisServer[];
   static const char kRedisReconnectionDelayMs[];
@@ -113,6 +116,18 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_lru_cache_kb_per_process(int64 x) {
     set_option(x, &lru_cache_kb_per_process_);
   }
+  int64 http_cache_decoded_copies_kb() const {
+    return http_cache_decoded_copies_kb_.value();
+  }
+  void set_http_cache_decoded_copies_kb(int64 x) {
+    set_option(x, &http_cache_decoded_copies_kb_);
+  }
+  int64 merged_options_cache_kb() const {
+    return merged_options_cache_kb_.value();
+  }
+  void set_merged_options_cache_kb(int64 x) {
+    set_option(x, &merged_options_cache_kb_);
+  }
   bool use_shared_mem_locking() const {
     return use_shared_mem_locking_.value();
   }
@@ -230,6 +245,15 @@ class SystemRewriteOptions : public RewriteOptions {
   int popularity_contest_max_queue_size() const {
     return popularity_contest_max_queue_size_.value();
   }
+  int popularity_contest_shards() const {
+    return popularity_contest_shards_.value();
+  }
+  bool controller_shared_mem() const {
+    return controller_shared_mem_.value();
+  }
+  int64 expensive_operation_cpu_budget_ms() const {
+    return expensive_operation_cpu_budget_ms_.value();
+  }
 
   // Cache flushing configuration.
   void set_cache_flush_poll_interval_sec(int64 num_seconds) {
@@ -254,6 +278,33 @@ class SystemRewriteOptions : public RewriteOptions {
   const GoogleString& ssl_cert_file() const {
     return ssl_cert_file_.value();
   }
+  const GoogleString& http2_prior_knowledge_origins() const {
+    return http2_prior_knowledge_origins_.value();
+  }
+  int fetch_keep_alive_connections_per_host() const {
+    return fetch_keep_alive_connections_per_host_.value();
+  }
+  void set_fetch_keep_alive_connections_per_host(int x) {
+    set_option(x, &fetch_keep_alive_connections_per_host_);
+  }
+  int fetch_keep_alive_max_idle_per_host() const {
+    return fetch_keep_alive_max_idle_per_host_.value();
+  }
+  int64 fetch_keep_alive_idle_timeout_ms() const {
+    return fetch_keep_alive_idle_timeout_ms_.value();
+  }
+  int fetch_event_loop_threads() const {
+    return fetch_event_loop_threads_.value();
+  }
+  void set_fetch_event_loop_threads(int x) {
+    set_option(x, &fetch_event_loop_threads_);
+  }
+  int fetch_adaptive_concurrency_max_per_host() const {
+    return fetch_adaptive_concurrency_max_per_host_.value();
+  }
+  void set_fetch_adaptive_concurrency_max_per_host(int x) {
+    set_option(x, &fetch_adaptive_concurrency_max_per_host_);
+  }
 
   int64 slurp_flush_limit() const {
     return slurp_flush_limit_.value();
@@ -399,6 +450,14 @@ class SystemRewriteOptions : public RewriteOptions {
                                GoogleString* error_detail);
   };
 
+  // Origins fetched over h2c with prior knowledge; only IP literal hosts are
+  // accepted, and only in builds with enable_http2_fetcher=1.
+  class Http2PriorKnowledgeOriginsOption : public Option<GoogleString> {
+   public:
+    virtual bool SetFromString(StringPiece value_string,
+                               GoogleString* error_detail);
+  };
+
   class StaticAssetCDNOptions : public OptionTemplateBase<GoogleString> {
    public:
     virtual bool SetFromString(StringPiece value_string,
@@ -487,6 +546,7 @@ class SystemRewriteOptions : public RewriteOptions {
   Option<GoogleString> ssl_cert_directory_;
   Option<GoogleString> ssl_cert_file_;
   HttpsOptions https_options_;
+  Http2PriorKnowledgeOriginsOption http2_prior_knowledge_origins_;
 
   Option<GoogleString> slurp_directory_;
   Option<GoogleString> test_proxy_slurp_;
@@ -512,6 +572,15 @@ class SystemRewriteOptions : public RewriteOptions {
   ControllerPortOption controller_port_;
   Option<int> popularity_contest_max_inflight_requests_;
   Option<int> popularity_contest_max_queue_size_;
+  Option<int> popularity_contest_shards_;
+  Option<bool> controller_shared_mem_;
+  Option<int64> expensive_operation_cpu_budget_ms_;
+
+  Option<int> fetch_keep_alive_connections_per_host_;
+  Option<int> fetch_keep_alive_max_idle_per_host_;
+  Option<int64> fetch_keep_alive_idle_timeout_ms_;
+  Option<int> fetch_event_loop_threads_;
+  Option<int> fetch_adaptive_concurrency_max_per_host_;
 
   Option<int> memcached_threads_;
   Option<int> memcached_timeout_us_;
@@ -526,6 +595,8 @@ class SystemRewriteOptions : public RewriteOptions {
   Option<int64> file_cache_clean_size_kb_;
   Option<int64> lru_cache_byte_limit_;
   Option<int64> lru_cache_kb_per_process_;
+  Option<int64> http_cache_decoded_copies_kb_;
+  Option<int64> merged_options_cache_kb_;
   Option<int64> statistics_logging_interval_ms_;
   // If cache_flush_poll_interval_sec_<=0 then we turn off polling for
   // cache-flushes.
@@ -274,6 +274,22 @@ TEST_F(SystemRewriteOptionsTest, CentralControllerBadTcpPort) {
   EXPECT_NE("", msg);
 }
 
+TEST_F(SystemRewriteOptionsTest, CentralControllerSharedMem) {
+  EXPECT_TRUE(options_.controller_shared_mem());
+  GoogleString msg;
+  EXPECT_EQ(options_.ParseAndSetOptionFromName1(
+            SystemRewriteOptions::kCentralControllerSharedMem, "false", &msg,
+            &handler_), RewriteOptions::kOptionOk);
+  EXPECT_FALSE(options_.controller_shared_mem());
+
+  // The option's name while it was experimental still works.
+  EXPECT_EQ(options_.ParseAndSetOptionFromName1(
+            "ExperimentalCentralControllerSharedMem", "true", &msg,
+            &handler_), RewriteOptions::kOptionOk);
+  EXPECT_TRUE(options_.controller_shared_mem());
+  EXPECT_EQ("", msg);
+}
+
 TEST_F(SystemRewriteOptionsTest, RedisServer) {
   TestExternalCacheSingleOption(SystemRewriteOptions::kRedisServer,
                                 &SystemRewriteOptions::redis_server,
@@ -21,6 +21,7 @@
 #include "pagespeed/system/system_server_context.h"
 
 #include "base/logging.h"
+#include "net/instaweb/http/public/rate_controlling_url_async_fetcher.h"
 #include "net/instaweb/http/public/url_async_fetcher.h"
 #include "net/instaweb/http/public/url_async_fetcher_stats.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
@@ -180,7 +181,11 @@ void SystemServerContext::CheckLegacyGlobalCacheFlushFile() {
 
 void SystemServerContext::UpdateCachePurgeSet(
     const CopyOnWrite<PurgeSet>& purge_set) {
-  global_options()->UpdateCachePurgeSet(purge_set);
+  if (global_options()->UpdateCachePurgeSet(purge_set)) {
+    // The PurgeSet is not part of the options signature, so merged options
+    // cached against the old one must be dropped.
+    ClearMergedOptionsCache();
+  }
   if (cache_flush_count_ == NULL) {
     cache_flush_count_ = statistics()->GetVariable(kCacheFlushCount);
   }
@@ -188,7 +193,12 @@ void SystemServerContext::UpdateCachePurgeSet(
 }
 
 bool SystemServerContext::UpdateCacheFlushTimestampMs(int64 timestamp_ms) {
-  return global_options()->UpdateCacheInvalidationTimestampMs(timestamp_ms);
+  bool updated =
+      global_options()->UpdateCacheInvalidationTimestampMs(timestamp_ms);
+  if (updated) {
+    ClearMergedOptionsCache();
+  }
+  return updated;
 }
 
 void SystemServerContext::AddHtmlRewriteTimeUs(int64 rewrite_time_us) {
@@ -247,6 +257,13 @@ void SystemServerContext::ChildInit(SystemRewriteDriverFactory* factory) {
   if (!initialized_ && !global_options()->unplugged()) {
     initialized_ = true;
     system_caches_ = factory->caches();
+    set_merged_options_cache_bytes(
+        global_system_rewrite_options()->merged_options_cache_kb() * 1024);
+    // Only a controller process admits expensive operations by cost.
+    set_estimate_expensive_operation_costs(
+        !global_system_rewrite_options()->controller_port().empty() &&
+        (global_system_rewrite_options()->expensive_operation_cpu_budget_ms() >
+         0));
     set_lock_manager(factory->caches()->GetLockManager(
         global_system_rewrite_options()));
     UrlAsyncFetcher* fetcher =
@@ -291,9 +308,24 @@ void SystemServerContext::ChildInit(SystemRewriteDriverFactory* factory) {
         thread_system()->NewRWLock());
     factory->InitServerContext(this);
 
+    // List this process's per-host fetch limits on the statistics page.
+    RateControllingUrlAsyncFetcher* rate_fetcher =
+        dynamic_cast<RateControllingUrlAsyncFetcher*>(fetcher);
+    if (rate_fetcher != NULL) {
+      admin_site_->set_rate_controller(rate_fetcher->rate_controller());
+    }
+
     html_rewrite_time_us_histogram_ = statistics()->GetHistogram(
         kHtmlRewriteTimeUsHistogram);
     html_rewrite_time_us_histogram_->SetMaxValue(2 * Timer::kSecondUs);
+
+    // Only warm servers that rewrite HTML.  Those in standby or unplugged
+    // build drivers just for the occasional resource fetch, and would keep
+    // the warmed ones idle for the life of the process.
+    if (factory->rewrite_driver_pool_warm_size() > 0 &&
+        global_options()->enabled()) {
+      WarmRewriteDriverPool(factory->rewrite_driver_pool_warm_size());
+    }
   }
 }
 
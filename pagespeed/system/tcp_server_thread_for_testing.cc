@@ -41,7 +41,8 @@ TcpServerThreadForTesting::TcpServerThreadForTesting(
       actual_listening_port_(0),
       listen_sock_(nullptr),
       terminating_(false),
-      is_shut_down_(false) {}
+      is_shut_down_(false),
+      serve_multiple_connections_(false) {}
 
 void TcpServerThreadForTesting::ShutDown() {
   // We want to ensure that the thread is terminated and it has accepted exactly
@@ -99,13 +100,22 @@ void TcpServerThreadForTesting::Run() {
     local_listen_sock = listen_sock_ = CreateAndBindSocket();
   }
   apr_socket_t* accepted_socket;
-  apr_status_t status =
-      apr_socket_accept(&accepted_socket, local_listen_sock, pool_);
-  EXPECT_EQ(APR_SUCCESS, status)
-      << "TcpServerThreadForTesting: "
-         "apr_socket_accept failed (did not receive a connection?)";
-  if (status == APR_SUCCESS) {
-    HandleClientConnection(accepted_socket);
+  if (serve_multiple_connections_) {
+    // Runs until ShutDown() makes accept() fail.
+    while (apr_socket_accept(&accepted_socket, local_listen_sock, pool_) ==
+           APR_SUCCESS) {
+      HandleClientConnection(accepted_socket);
+      apr_socket_close(accepted_socket);
+    }
+  } else {
+    apr_status_t status =
+        apr_socket_accept(&accepted_socket, local_listen_sock, pool_);
+    EXPECT_EQ(APR_SUCCESS, status)
+        << "TcpServerThreadForTesting: "
+           "apr_socket_accept failed (did not receive a connection?)";
+    if (status == APR_SUCCESS) {
+      HandleClientConnection(accepted_socket);
+    }
   }
   {
     ScopedMutex lock(mutex_.get());
@@ -62,6 +62,11 @@ class TcpServerThreadForTesting : public ThreadSystem::Thread {
   // bound port number, which will be bound to IPv4 localhost.
   apr_port_t GetListeningPort();
 
+  // By default the server handles a single connection.  Call this before
+  // Start() to instead accept and handle connections one after another until
+  // ShutDown(), e.g. to serve a client that opens a connection per request.
+  void ServeMultipleConnections() { serve_multiple_connections_ = true; }
+
   // Helper to deal with only allocating the listening port once.
   // port_number must be a pointer to a static apr_port_t.
   static void PickListenPortOnce(apr_port_t* port_number);
@@ -72,7 +77,8 @@ class TcpServerThreadForTesting : public ThreadSystem::Thread {
  private:
   // Called after a successful call to apr_accept. Implementor can close the
   // socket themselves or it will be automatically closed by apr_pool_destroy()
-  // called in ShutDown().
+  // called in ShutDown(), or, with ServeMultipleConnections(), once this
+  // returns.
   virtual void HandleClientConnection(apr_socket_t* sock) = 0;
 
   // Returns a socket bound to requested_listen_port_ if non-zero, otherwise
@@ -94,6 +100,7 @@ class TcpServerThreadForTesting : public ThreadSystem::Thread {
   apr_socket_t* listen_sock_ GUARDED_BY(mutex_);
   bool terminating_ GUARDED_BY(mutex_);
   bool is_shut_down_;
+  bool serve_multiple_connections_;
 };
 
 }  // namespace net_instaweb